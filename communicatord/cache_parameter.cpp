@@ -0,0 +1,177 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Parse the "cache" parameter of a message.
+ *
+ * The communicator daemon caches messages sent to services which are not
+ * yet registered and the communicator client queues messages sent while
+ * the connection to the daemon is down. Both honor the "cache" parameter
+ * of the message and use this parser so they always agree on its meaning.
+ */
+
+// self
+//
+#include    "communicatord/cache_parameter.h"
+
+#include    "communicatord/names.h"
+
+
+// advgetopt
+//
+#include    <advgetopt/validator_duration.h>
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <cmath>
+#include    <string_view>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicatord
+{
+
+
+
+/** \brief Parse the "cache" parameter of a message.
+ *
+ * The "cache" parameter is a list of name/value pairs separated by
+ * semicolons. The following names are supported:
+ *
+ * * "no[=true]" -- do not cache the message
+ * * "reply[=true]" -- send a reply to the sender to let them know that the
+ *   destination is not currently available
+ * * "ttl=<duration>" -- amount of time the message is considered valid; this
+ *   is an approximation; the default is 60 seconds; durations can be defined
+ *   with a time such as 1m for one minute and 3h for three hours
+ *
+ * Unknown names are ignored. A TTL which is not a valid duration or is
+ * out of range (10 seconds to one day) is ignored and the default is used.
+ *
+ * \param[in] msg  The message with the "cache" parameter.
+ *
+ * \return The parsed parameter; the defaults if \p msg has no "cache"
+ * parameter.
+ */
+cache_parameter parse_cache_parameter(ed::message const & msg)
+{
+    cache_parameter result;
+    if(!msg.has_parameter(g_name_communicatord_param_cache))
+    {
+        return result;
+    }
+    std::string const cache_value(msg.get_parameter(g_name_communicatord_param_cache));
+
+    // go through the `cache` name/value parameters in place
+    //
+    bool has_ttl(false);
+    std::string_view ttl_value;
+    std::string_view const parameters(cache_value);
+    std::string_view::size_type start(0);
+    while(start < parameters.length())
+    {
+        std::string_view::size_type end(parameters.find(';', start));
+        if(end == std::string_view::npos)
+        {
+            end = parameters.length();
+        }
+        std::string_view const p(parameters.substr(start, end - start));
+        start = end + 1;
+        if(p.empty())
+        {
+            continue;
+        }
+        std::string_view::size_type const pos(p.find('='));
+        if(pos == 0)
+        {
+            SNAP_LOG_NOTICE
+                << "invalid cache parameter \""
+                << p
+                << "\"; expected \"<name>[=<value>]\"; \"<name>\" is missing, it cannot be empty."
+                << SNAP_LOG_SEND;
+            continue;
+        }
+        std::string_view const name(p.substr(0, pos));
+        if(name == "reply")
+        {
+            result.f_reply = true;
+        }
+        else if(name == "no")
+        {
+            result.f_no_cache = true;
+        }
+        else if(name == "ttl")
+        {
+            has_ttl = true;
+            ttl_value = pos == std::string_view::npos
+                            ? std::string_view("true") // a.k.a. defined
+                            : p.substr(pos + 1);
+        }
+    }
+
+    if(has_ttl)
+    {
+        double value(0.0);
+        if(!advgetopt::validator_duration::convert_string(
+                  std::string(ttl_value)
+                , advgetopt::validator_duration::VALIDATOR_DURATION_DEFAULT_FLAGS
+                , value))
+        {
+            SNAP_LOG_ERROR
+                << "cache TTL parameter is not a valid integer ("
+                << ttl_value
+                << ")."
+                << SNAP_LOG_SEND;
+        }
+        else if(value < static_cast<double>(MINIMUM_CACHE_TTL)
+             || value > static_cast<double>(MAXIMUM_CACHE_TTL))
+        {
+            SNAP_LOG_UNIMPORTANT
+                << "cache TTL is out of range ("
+                << ttl_value
+                << "); expected a number between "
+                << MINIMUM_CACHE_TTL
+                << " and "
+                << MAXIMUM_CACHE_TTL
+                << "."
+                << SNAP_LOG_SEND;
+        }
+        else
+        {
+            result.f_ttl = static_cast<std::int64_t>(ceil(value));
+        }
+    }
+
+    return result;
+}
+
+
+
+} // namespace communicatord
+// vim: ts=4 sw=4 et
@@ -0,0 +1,54 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+// eventdispatcher
+//
+#include    <eventdispatcher/message.h>
+
+
+// C++
+//
+#include    <cstdint>
+
+
+
+namespace communicatord
+{
+
+
+
+constexpr std::int64_t const    DEFAULT_CACHE_TTL = 60;         // in seconds
+constexpr std::int64_t const    MINIMUM_CACHE_TTL = 10;
+constexpr std::int64_t const    MAXIMUM_CACHE_TTL = 86'400;     // one day
+
+
+struct cache_parameter
+{
+    bool                        f_no_cache = false;             // "no" -- do not cache the message
+    bool                        f_reply = false;                // "reply" -- tell the sender when not sent immediately
+    std::int64_t                f_ttl = DEFAULT_CACHE_TTL;      // "ttl=<duration>" -- in seconds
+};
+
+
+cache_parameter parse_cache_parameter(ed::message const & msg);
+
+
+
+} // namespace communicatord
+// vim: ts=4 sw=4 et
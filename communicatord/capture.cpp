@@ -0,0 +1,447 @@
+// Copyright (c) 2013-2024  Made to Order Software Corp.  All Rights Reserved.
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the traffic capture file format.
+ *
+ * A capture file starts with a header line listing the names of the
+ * routes in the order of their numbers:
+ *
+ * \code
+ *     CDCAPTURE 1 handled,forwarded,...\n
+ * \endcode
+ *
+ * followed by one record per message. All the numbers are saved as
+ * variable length integers (7 bits per byte, the last byte has its
+ * high bit cleared):
+ *
+ * \code
+ *     record: <size> <timestamp> <route:8> <connection> <type size> <type> <source size> <source> <message>
+ * \endcode
+ *
+ * where \<size\> is the number of bytes following it in that record and
+ * the message uses all the bytes left in the record. The \<connection\>
+ * is the socket plus one (0 when the message did not come from a
+ * connection) which distinguishes connections sharing the same name. A record which is
+ * cut short (i.e. the daemon was killed while writing) ends the capture.
+ */
+
+// self
+//
+#include    "communicatord/capture.h"
+
+
+// C++
+//
+#include    <algorithm>
+#include    <cerrno>
+
+
+// C
+//
+#include    <fcntl.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicatord
+{
+
+
+namespace
+{
+
+
+
+char const g_capture_magic[] = "CDCAPTURE 1 ";
+
+std::size_t const g_read_size = 64 * 1024;
+std::size_t const g_max_header_size = 4096;
+std::size_t const g_max_record_size = 64 * 1024 * 1024;
+
+
+void write_varint(std::string & out, std::uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+
+std::size_t varint_size(std::uint64_t value)
+{
+    std::size_t size(1);
+    while(value >= 0x80)
+    {
+        ++size;
+        value >>= 7;
+    }
+    return size;
+}
+
+
+bool read_varint(char const * & s, char const * end, std::uint64_t & value)
+{
+    value = 0;
+    for(int shift(0); shift < 64; shift += 7)
+    {
+        if(s >= end)
+        {
+            return false;
+        }
+        std::uint8_t const c(static_cast<std::uint8_t>(*s++));
+        value |= static_cast<std::uint64_t>(c & 0x7F) << shift;
+        if((c & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool read_string(char const * & s, char const * end, std::string & value)
+{
+    std::uint64_t length(0);
+    if(!read_varint(s, end, length)
+    || length > static_cast<std::uint64_t>(end - s))
+    {
+        return false;
+    }
+    value.assign(s, length);
+    s += length;
+    return true;
+}
+
+
+
+} // no name namespace
+
+
+
+/** \brief Generate the header of a capture file.
+ *
+ * \param[in] route_names  The names of the routes, indexed by the route
+ * numbers saved in the records.
+ *
+ * \return The header line.
+ */
+std::string capture_header(std::vector<std::string> const & route_names)
+{
+    std::string header(g_capture_magic);
+    for(std::size_t idx(0); idx < route_names.size(); ++idx)
+    {
+        if(idx != 0)
+        {
+            header += ',';
+        }
+        header += route_names[idx];
+    }
+    header += '\n';
+    return header;
+}
+
+
+/** \brief Serialize one record at the end of a buffer.
+ *
+ * \param[in,out] out  The buffer where the record gets appended.
+ * \param[in] record  The record to serialize.
+ */
+void append_capture_record(std::string & out, capture_record const & record)
+{
+    std::uint64_t const timestamp(record.f_timestamp < 0 ? 0 : static_cast<std::uint64_t>(record.f_timestamp));
+    std::uint64_t const connection(record.f_connection < 0 ? 0 : static_cast<std::uint64_t>(record.f_connection) + 1);
+    std::size_t const size(
+              varint_size(timestamp)
+            + 1
+            + varint_size(connection)
+            + varint_size(record.f_source_type.length())
+            + record.f_source_type.length()
+            + varint_size(record.f_source.length())
+            + record.f_source.length()
+            + record.f_message.length());
+
+    write_varint(out, size);
+    write_varint(out, timestamp);
+    out += static_cast<char>(record.f_route);
+    write_varint(out, connection);
+    write_varint(out, record.f_source_type.length());
+    out += record.f_source_type;
+    write_varint(out, record.f_source.length());
+    out += record.f_source;
+    out += record.f_message;
+}
+
+
+
+/** \class capture_reader
+ * \brief Read the records of a capture file.
+ *
+ * The file is read in blocks so a capture much larger than the available
+ * memory can still be replayed.
+ */
+
+
+/** \brief Close the capture file.
+ */
+capture_reader::~capture_reader()
+{
+    close();
+}
+
+
+/** \brief Open a capture file and read its header.
+ *
+ * \param[in] filename  The path to the capture file.
+ *
+ * \return true if the file exists and starts with a valid header.
+ */
+bool capture_reader::open(std::string const & filename)
+{
+    close();
+
+    f_fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(f_fd < 0)
+    {
+        return false;
+    }
+
+    std::string::size_type eol(std::string::npos);
+    for(;;)
+    {
+        eol = f_buffer.find('\n');
+        if(eol != std::string::npos
+        || f_eof
+        || f_buffer.length() >= g_max_header_size)
+        {
+            break;
+        }
+        fill(f_buffer.length() + 1);
+    }
+    if(eol == std::string::npos
+    || f_buffer.compare(0, sizeof(g_capture_magic) - 1, g_capture_magic) != 0)
+    {
+        close();
+        return false;
+    }
+
+    std::string const names(f_buffer.substr(sizeof(g_capture_magic) - 1, eol - (sizeof(g_capture_magic) - 1)));
+    std::string::size_type start(0);
+    while(start < names.length())
+    {
+        std::string::size_type comma(names.find(',', start));
+        if(comma == std::string::npos)
+        {
+            comma = names.length();
+        }
+        f_route_names.push_back(names.substr(start, comma - start));
+        start = comma + 1;
+    }
+
+    f_pos = eol + 1;
+    return true;
+}
+
+
+/** \brief Close the capture file.
+ *
+ * The reader can be reused by calling open() again.
+ */
+void capture_reader::close()
+{
+    if(f_fd >= 0)
+    {
+        ::close(f_fd);
+        f_fd = -1;
+    }
+    f_buffer.clear();
+    f_pos = 0;
+    f_eof = false;
+    f_truncated = false;
+    f_route_names.clear();
+}
+
+
+/** \brief Read the next record.
+ *
+ * \param[out] record  The record read from the file.
+ *
+ * \return true if a record was read, false at the end of the file or
+ * when the last record is incomplete or invalid.
+ */
+bool capture_reader::next(capture_record & record)
+{
+    if(f_fd < 0
+    || f_truncated)
+    {
+        return false;
+    }
+
+    // the size of a record is at most 10 bytes
+    //
+    fill(10);
+    if(f_pos >= f_buffer.length())
+    {
+        return false;
+    }
+
+    char const * s(f_buffer.data() + f_pos);
+    char const * end(f_buffer.data() + f_buffer.length());
+    std::uint64_t size(0);
+    if(!read_varint(s, end, size)
+    || size > g_max_record_size)
+    {
+        f_truncated = true;
+        return false;
+    }
+    std::size_t const header_size(s - (f_buffer.data() + f_pos));
+    if(!fill(header_size + size))
+    {
+        f_truncated = true;
+        return false;
+    }
+
+    // fill() may have moved the buffer
+    //
+    s = f_buffer.data() + f_pos + header_size;
+    end = s + size;
+    std::uint64_t timestamp(0);
+    if(!read_varint(s, end, timestamp)
+    || s >= end)
+    {
+        f_truncated = true;
+        return false;
+    }
+    record.f_timestamp = static_cast<std::int64_t>(timestamp);
+    record.f_route = static_cast<std::uint8_t>(*s++);
+    std::uint64_t connection(0);
+    if(!read_varint(s, end, connection)
+    || !read_string(s, end, record.f_source_type)
+    || !read_string(s, end, record.f_source))
+    {
+        f_truncated = true;
+        return false;
+    }
+    record.f_connection = static_cast<std::int64_t>(connection) - 1;
+    record.f_message.assign(s, end - s);
+
+    f_pos += header_size + size;
+    return true;
+}
+
+
+/** \brief Check whether the capture ended with an invalid record.
+ *
+ * \return true if next() stopped on an incomplete or invalid record.
+ */
+bool capture_reader::is_truncated() const
+{
+    return f_truncated;
+}
+
+
+/** \brief Retrieve the names of the routes found in the header.
+ *
+ * \return The route names, indexed by route number.
+ */
+std::vector<std::string> const & capture_reader::get_route_names() const
+{
+    return f_route_names;
+}
+
+
+/** \brief Retrieve the name of one route.
+ *
+ * \param[in] route  The route number of a record.
+ *
+ * \return The name of the route, "none" if no route was recorded, or
+ * the number if the header does not name it.
+ */
+std::string capture_reader::get_route_name(std::uint8_t route) const
+{
+    if(route < f_route_names.size())
+    {
+        return f_route_names[route];
+    }
+    if(route == capture_record::NO_ROUTE)
+    {
+        return "none";
+    }
+    return std::to_string(static_cast<int>(route));
+}
+
+
+/** \brief Make sure the buffer holds at least \p size unread bytes.
+ *
+ * \param[in] size  The number of bytes needed.
+ *
+ * \return true if at least \p size bytes are available, false if the end
+ * of the file was reached first.
+ */
+bool capture_reader::fill(std::size_t size)
+{
+    if(f_buffer.length() - f_pos >= size)
+    {
+        return true;
+    }
+
+    // drop the bytes already parsed
+    //
+    if(f_pos > 0)
+    {
+        f_buffer.erase(0, f_pos);
+        f_pos = 0;
+    }
+
+    while(!f_eof
+       && f_buffer.length() < size)
+    {
+        std::size_t const used(f_buffer.length());
+        std::size_t const want(std::max(size - used, g_read_size));
+        f_buffer.resize(used + want);
+        ssize_t const r(::read(f_fd, f_buffer.data() + used, want));
+        if(r < 0
+        && errno == EINTR)
+        {
+            f_buffer.resize(used);
+            continue;
+        }
+        if(r <= 0)
+        {
+            f_buffer.resize(used);
+            f_eof = true;
+            break;
+        }
+        f_buffer.resize(used + r);
+    }
+
+    return f_buffer.length() >= size;
+}
+
+
+
+} // namespace communicatord
+// vim: ts=4 sw=4 et
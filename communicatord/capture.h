@@ -0,0 +1,92 @@
+// Copyright (c) 2013-2024  Made to Order Software Corp.  All Rights Reserved.
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Traffic capture file format.
+ *
+ * The communicatord can save each message it dispatches in a capture
+ * file along the time it was received, the connection it came from and
+ * how it was routed. The message tool reads such a file back to replay
+ * the traffic against a running daemon.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <string>
+#include    <vector>
+
+
+
+namespace communicatord
+{
+
+
+
+struct capture_record
+{
+    typedef std::vector<capture_record>     vector_t;
+
+    static constexpr std::uint8_t const     NO_ROUTE = 255;
+
+    std::int64_t                f_timestamp = 0;                // microseconds since the Unix epoch
+    std::uint8_t                f_route = NO_ROUTE;
+    std::string                 f_source_type = std::string();  // "local", "remote", "udp" or "none"
+    std::string                 f_source = std::string();       // name of the connection
+    std::int64_t                f_connection = -1;              // socket of the connection, -1 if none
+    std::string                 f_message = std::string();      // the serialized message
+};
+
+
+std::string                     capture_header(std::vector<std::string> const & route_names);
+void                            append_capture_record(std::string & out, capture_record const & record);
+
+
+
+class capture_reader
+{
+public:
+                                capture_reader() = default;
+                                capture_reader(capture_reader const &) = delete;
+                                ~capture_reader();
+    capture_reader &            operator = (capture_reader const &) = delete;
+
+    bool                        open(std::string const & filename);
+    void                        close();
+    bool                        next(capture_record & record);
+    bool                        is_truncated() const;
+    std::vector<std::string> const &
+                                get_route_names() const;
+    std::string                 get_route_name(std::uint8_t route) const;
+
+private:
+    bool                        fill(std::size_t size);
+
+    int                         f_fd = -1;
+    std::string                 f_buffer = std::string();
+    std::size_t                 f_pos = 0;
+    bool                        f_eof = false;
+    bool                        f_truncated = false;
+    std::vector<std::string>    f_route_names = std::vector<std::string>();
+};
+
+
+
+} // namespace communicatord
+// vim: ts=4 sw=4 et
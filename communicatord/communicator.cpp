@@ -20,8 +20,10 @@
 //
 #include    "communicatord/communicator.h"
 
+#include    "communicatord/cache_parameter.h"
 #include    "communicatord/exception.h"
 #include    "communicatord/names.h"
+#include    "communicatord/shm_channel.h"
 
 
 // snaplogger
@@ -29,9 +31,16 @@
 #include    <snaplogger/message.h>
 
 
+// snapdev
+//
+#include    <snapdev/tokenize_string.h>
+
+
 // eventdispatcher
 //
+#include    <eventdispatcher/dispatcher.h>
 #include    <eventdispatcher/local_stream_client_permanent_message_connection.h>
+#include    <eventdispatcher/names.h>
 #include    <eventdispatcher/tcp_client_permanent_message_connection.h>
 #include    <eventdispatcher/udp_server_message_connection.h>
 
@@ -47,6 +56,22 @@
 #include    <edhttp/uri.h>
 
 
+// C++
+//
+#include    <algorithm>
+#include    <chrono>
+#include    <cstdlib>
+#include    <cstring>
+#include    <list>
+
+
+// C
+//
+#include    <sys/socket.h>
+#include    <sys/un.h>
+#include    <unistd.h>
+
+
 // snapdev
 //
 #include    <snapdev/poison.h>
@@ -69,6 +94,7 @@ namespace
  * \li TCP / plain text / remote (on your local network)
  * \li TCP / secure / remote (from anywhere)
  * \li Stream / Unix socket (on your computer via a local stream)
+ * \li Shared memory / Unix socket (on your computer, for high rates)
  * \li UDP / plain text (on your local network)
  *
  * The options offered to the clients allow for selection which one
@@ -90,7 +116,7 @@ advgetopt::option const g_options[] =
             , advgetopt::GETOPT_FLAG_SHOW_SYSTEM>())
         , advgetopt::EnvironmentVariableName("COMMUNICATORD_LISTEN")
         , advgetopt::DefaultValue("cd:///run/communicatord/communicatord.sock")
-        , advgetopt::Help("define the communicator daemon connection type as a scheme (cd://, cdu://, cds://, cdb://) along an \"address:port\" or \"/socket/path\".")
+        , advgetopt::Help("define the communicator daemon connection type as a scheme (cd://, cdm://, cdu://, cds://, cdb://) along an \"address:port\" or \"/socket/path\".")
     ),
 
     // END
@@ -106,9 +132,89 @@ public:
     virtual             ~communicatord_connection() {}
 
     virtual bool        is_connected() const = 0;
+
+    void set_owner(communicator * owner)
+    {
+        f_owner = owner;
+    }
+
+protected:
+    /** \brief Give the owner a chance to handle a message.
+     *
+     * Replies to requests sent with communicator::send_request() are
+     * handled by the communicator and never reach the dispatcher.
+     *
+     * The READY message first flushes the outbound queue so the messages
+     * sent while disconnected go out before anything the READY handler
+     * sends.
+     *
+     * The CLUSTER_CURRENT_STATUS message is always handled by the owner
+     * which caches the status.
+     *
+     * \param[in] msg  The message just received.
+     *
+     * \return true if the message was handled by the owner.
+     */
+    bool intercept_response(ed::message & msg)
+    {
+        if(f_owner == nullptr)
+        {
+            return false;
+        }
+        if(msg.get_command() == ed::g_name_ed_cmd_ready)
+        {
+            f_owner->flush_outbound_queue();
+        }
+        else if(msg.get_command() == g_name_communicatord_cmd_cluster_current_status)
+        {
+            f_owner->msg_cluster_current_status(msg);
+            return true;
+        }
+        return f_owner->process_response(msg);
+    }
+
+private:
+    communicator *      f_owner = nullptr;
 };
 
 
+/** \brief Timer used to time out pending requests.
+ *
+ * The communicator only creates this timer once a request with a
+ * correlation identifier is sent. The timeout date is set to the
+ * earliest deadline of all the pending requests.
+ */
+class request_timer
+    : public ed::timer
+{
+public:
+    typedef std::shared_ptr<request_timer>  pointer_t;
+
+    request_timer(communicator * owner)
+        : timer(-1)
+        , f_owner(owner)
+    {
+        set_name("communicator_request_timer");
+        set_enable(false);
+    }
+
+    virtual void process_timeout() override
+    {
+        f_owner->process_request_timeouts();
+    }
+
+private:
+    communicator *      f_owner = nullptr;
+};
+
+
+std::int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
 class local_stream
     : public ed::local_stream_client_permanent_message_connection
     , public communicatord_connection
@@ -134,6 +240,15 @@ public:
         register_service();
     }
 
+    virtual void process_message(ed::message & msg) override
+    {
+        if(intercept_response(msg))
+        {
+            return;
+        }
+        local_stream_client_permanent_message_connection::process_message(msg);
+    }
+
     virtual bool is_connected() const override
     {
         return local_stream_client_permanent_message_connection::is_connected();
@@ -141,6 +256,241 @@ public:
 };
 
 
+class shm_stream;
+
+
+/** \brief Wake up the shm_stream when the communicatord sent messages.
+ *
+ * This connection polls the eventfd of the client side of the shared
+ * memory channel.
+ */
+class shm_reader
+    : public ed::connection
+{
+public:
+    typedef std::shared_ptr<shm_reader>     pointer_t;
+
+    shm_reader(
+              shm_stream * stream
+            , shm_channel::pointer_t channel)
+        : f_stream(stream)
+        , f_channel(channel)
+    {
+        set_name("communicator_shm_reader");
+    }
+
+    virtual int get_socket() const override
+    {
+        return f_channel->get_wakeup_fd();
+    }
+
+    virtual bool is_reader() const override
+    {
+        return true;
+    }
+
+    virtual void process_read() override;
+
+private:
+    shm_stream *            f_stream = nullptr;
+    shm_channel::pointer_t  f_channel = shm_channel::pointer_t();
+};
+
+
+/** \brief The "cdm:" connection.
+ *
+ * This connection is a local_stream which, once registered, requests
+ * a shared memory channel from the communicatord. Once the channel is
+ * active, the messages go through the shared memory rings and the Unix
+ * socket is only used as the control channel.
+ *
+ * Each side sends an SHM_ACTIVE message on the Unix socket just before
+ * it starts using the rings and only reads the rings once it received
+ * the SHM_ACTIVE of the other side. This keeps the messages in order
+ * while switching.
+ */
+class shm_stream
+    : public local_stream
+{
+public:
+    shm_stream(
+              addr::addr_unix const & address
+            , std::string const & service_name)
+        : local_stream(address, service_name)
+    {
+        set_name("communicator_shm_stream");
+    }
+
+    virtual ~shm_stream() override
+    {
+        detach();
+    }
+
+    virtual void process_connected() override
+    {
+        // a new connection requires a new channel
+        //
+        detach();
+
+        local_stream::process_connected();
+
+        ed::message request;
+        request.set_command(g_name_communicatord_cmd_shm_request);
+        request.set_service(g_name_communicatord_service_communicatord);
+        local_stream::send_message(request);
+    }
+
+    virtual void process_message(ed::message & msg) override
+    {
+        if(msg.get_command() == g_name_communicatord_cmd_shm_ready)
+        {
+            attach(msg);
+            return;
+        }
+        if(msg.get_command() == g_name_communicatord_cmd_shm_active)
+        {
+            start_reading();
+            return;
+        }
+        local_stream::process_message(msg);
+    }
+
+    virtual bool send_message(ed::message & msg, bool cache = false) override
+    {
+        if(f_channel != nullptr
+        && f_channel->is_valid()
+        && is_connected())
+        {
+            std::string const data(msg.to_message());
+            if(!data.empty()
+            && f_channel->send(data))
+            {
+                return true;
+            }
+        }
+        return local_stream::send_message(msg, cache);
+    }
+
+    void process_channel()
+    {
+        shm_channel::pointer_t channel(f_channel);
+        if(channel == nullptr)
+        {
+            return;
+        }
+
+        do
+        {
+            channel->clear_wakeup();
+            std::string data;
+            while(channel->receive(data))
+            {
+                ed::message msg;
+                if(msg.from_message(data))
+                {
+                    local_stream::process_message(msg);
+                }
+            }
+            channel->flush();
+        }
+        while(!channel->prepare_to_sleep());
+
+        if(!channel->is_valid())
+        {
+            SNAP_LOG_ERROR
+                << "the shared memory channel with the communicatord is invalid, using the Unix socket instead."
+                << SNAP_LOG_SEND;
+            detach();
+        }
+    }
+
+private:
+    void attach(ed::message & msg)
+    {
+        if(!msg.has_parameter(g_name_communicatord_param_path)
+        || !msg.has_parameter(g_name_communicatord_param_token))
+        {
+            return;
+        }
+        std::string const path(msg.get_parameter(g_name_communicatord_param_path));
+
+        sockaddr_un un = {};
+        un.sun_family = AF_UNIX;
+        if(path.length() >= sizeof(un.sun_path))
+        {
+            return;
+        }
+        memcpy(un.sun_path, path.c_str(), path.length());
+
+        int const s(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if(s == -1)
+        {
+            return;
+        }
+        shm_channel::pointer_t channel;
+        if(connect(s, reinterpret_cast<sockaddr const *>(&un), sizeof(un)) == 0)
+        {
+            channel = shm_channel::receive_descriptors(s, msg.get_parameter(g_name_communicatord_param_token));
+        }
+        close(s);
+
+        if(channel == nullptr)
+        {
+            SNAP_LOG_WARNING
+                << "could not retrieve the shared memory channel from the communicatord, using the Unix socket instead."
+                << SNAP_LOG_SEND;
+            return;
+        }
+
+        // from now on, our messages go through the channel
+        //
+        ed::message active;
+        active.set_command(g_name_communicatord_cmd_shm_active);
+        active.set_service(g_name_communicatord_service_communicatord);
+        local_stream::send_message(active);
+
+        f_channel = channel;
+    }
+
+    void start_reading()
+    {
+        if(f_channel == nullptr
+        || f_reader != nullptr)
+        {
+            return;
+        }
+        f_reader = std::make_shared<shm_reader>(this, f_channel);
+        if(!ed::communicator::instance()->add_connection(f_reader))
+        {
+            f_reader.reset();
+        }
+    }
+
+    void detach()
+    {
+        if(f_reader != nullptr)
+        {
+            ed::communicator::instance()->remove_connection(f_reader);
+            f_reader.reset();
+        }
+        f_channel.reset();
+    }
+
+    shm_channel::pointer_t  f_channel = shm_channel::pointer_t();
+    shm_reader::pointer_t   f_reader = shm_reader::pointer_t();
+};
+
+
+void shm_reader::process_read()
+{
+    // the stream may release this object
+    //
+    pointer_t keep(std::static_pointer_cast<shm_reader>(shared_from_this()));
+
+    f_stream->process_channel();
+}
+
+
 class tcp_stream
     : public ed::tcp_client_permanent_message_connection
     , public communicatord_connection
@@ -166,6 +516,15 @@ public:
         register_service();
     }
 
+    virtual void process_message(ed::message & msg) override
+    {
+        if(intercept_response(msg))
+        {
+            return;
+        }
+        tcp_client_permanent_message_connection::process_message(msg);
+    }
+
     virtual bool is_connected() const override
     {
         return tcp_client_permanent_message_connection::is_connected();
@@ -194,6 +553,15 @@ public:
         register_service();
     }
 
+    virtual void process_message(ed::message & msg) override
+    {
+        if(intercept_response(msg))
+        {
+            return;
+        }
+        udp_server_message_connection::process_message(msg);
+    }
+
     virtual bool is_connected() const override
     {
         // UDP is not really ever "connected"
@@ -249,15 +617,29 @@ communicator::communicator(
     set_name("communicator_client");
     f_opts.parse_options_info(g_options, true);
     ed::add_message_definition_options(f_opts);
+
+    f_correlation_prefix = f_service_name + '-' + std::to_string(getpid()) + '-';
 }
 
 
 /** \brief Destroy the communicator.
  *
  * The communicator needed a virtual destructor so here it is.
+ *
+ * The connection and the request timer keep a bare pointer to this
+ * object so the destructor detaches them.
  */
 communicator::~communicator()
 {
+    std::shared_ptr<communicatord_connection> c(std::dynamic_pointer_cast<communicatord_connection>(f_communicator_connection));
+    if(c != nullptr)
+    {
+        c->set_owner(nullptr);
+    }
+    if(f_request_timer != nullptr)
+    {
+        f_communicator->remove_connection(f_request_timer);
+    }
 }
 
 
@@ -295,9 +677,10 @@ void communicator::process_communicatord_options()
     //
     if(u.is_unix())
     {
-        if(scheme != "cd")
+        if(scheme != g_name_communicatord_scheme_cd
+        && scheme != g_name_communicatord_scheme_cdm)
         {
-            connection_unavailable const e("a Unix socket connection only works with the \"cd:\" scheme.");
+            connection_unavailable const e("a Unix socket connection only works with the \"cd:\" and \"cdm:\" schemes.");
             SNAP_LOG_FATAL
                 << e
                 << SNAP_LOG_SEND;
@@ -305,7 +688,14 @@ void communicator::process_communicatord_options()
         }
         addr::addr_unix address('/' + u.path(false));
         address.set_scheme(scheme);
-        f_communicator_connection = std::make_shared<local_stream>(address, f_service_name);
+        if(scheme == g_name_communicatord_scheme_cdm)
+        {
+            f_communicator_connection = std::make_shared<shm_stream>(address, f_service_name);
+        }
+        else
+        {
+            f_communicator_connection = std::make_shared<local_stream>(address, f_service_name);
+        }
     }
     else
     {
@@ -450,6 +840,15 @@ void communicator::process_communicatord_options()
     }
     d->set_dispatcher(get_dispatcher());
 
+    // make sure the daemon knows we understand CLUSTER_CURRENT_STATUS
+    // (the message itself is intercepted before it reaches the dispatcher)
+    //
+    get_dispatcher()->add_matches({
+        DISPATCHER_MATCH(g_name_communicatord_cmd_cluster_current_status, &communicator::msg_cluster_current_status),
+    });
+
+    std::dynamic_pointer_cast<communicatord_connection>(f_communicator_connection)->set_owner(this);
+
     if(!f_communicator->add_connection(f_communicator_connection))
     {
         f_communicator_connection.reset();
@@ -487,6 +886,16 @@ bool communicator::send_message(ed::message & msg, bool cache)
         {
             msg.set_sent_from_service(f_service_name);
         }
+
+        // once a message is queued, further messages are queued too until
+        // the queue gets flushed on READY so the order is kept
+        //
+        if((f_outbound_max_messages != 0 || f_outbound_max_bytes != 0)
+        && (!f_outbound_queue.empty() || !is_connected()))
+        {
+            return queue_message(msg, cache);
+        }
+
         return messenger->send_message(msg, cache);
     }
 
@@ -494,6 +903,162 @@ bool communicator::send_message(ed::message & msg, bool cache)
 }
 
 
+/** \brief Enable the outbound queue.
+ *
+ * By default, a message sent while the connection to the communicator
+ * daemon is down gets dropped (or cached by the connection if the
+ * \p cache parameter of send_message() is true). When the outbound queue
+ * is enabled, those messages are kept in a bounded queue instead and
+ * sent in order once the daemon replies READY to our REGISTER.
+ *
+ * The "cache" parameter of the messages is honored as in the daemon:
+ * "cache=no" messages are not queued and "cache=ttl=<duration>" defines
+ * how long a message remains valid (60 seconds by default).
+ *
+ * When a limit is reached, the oldest messages are dropped first. A
+ * limit of zero means "no limit" on that dimension. Setting both limits
+ * to zero disables the queue (the default).
+ *
+ * \param[in] max_messages  The maximum number of messages to queue.
+ * \param[in] max_bytes  The maximum number of bytes to queue.
+ */
+void communicator::set_outbound_queue_limits(
+      std::size_t max_messages
+    , std::size_t max_bytes)
+{
+    f_outbound_max_messages = max_messages;
+    f_outbound_max_bytes = max_bytes;
+
+    if(f_outbound_max_messages == 0 && f_outbound_max_bytes == 0)
+    {
+        f_outbound_dropped += f_outbound_queue.size();
+        f_outbound_queue.clear();
+        f_outbound_bytes = 0;
+        return;
+    }
+
+    while(!f_outbound_queue.empty()
+       && ((f_outbound_max_messages != 0 && f_outbound_queue.size() > f_outbound_max_messages)
+        || (f_outbound_max_bytes != 0 && f_outbound_bytes > f_outbound_max_bytes)))
+    {
+        ++f_outbound_dropped;
+        pop_queued_message();
+    }
+}
+
+
+/** \brief Get the number of messages waiting in the outbound queue.
+ *
+ * \return The number of queued messages.
+ */
+std::size_t communicator::outbound_queue_size() const
+{
+    return f_outbound_queue.size();
+}
+
+
+/** \brief Get the number of messages dropped from the outbound queue.
+ *
+ * Messages get dropped when a limit is reached or their TTL expired
+ * before the connection was restored.
+ *
+ * \return The number of dropped messages since the communicator was
+ * created.
+ */
+std::size_t communicator::outbound_queue_dropped() const
+{
+    return f_outbound_dropped;
+}
+
+
+/** \brief Add a message to the outbound queue.
+ *
+ * \param[in] msg  The message to queue.
+ * \param[in] cache  The cache flag to use once the message gets sent.
+ *
+ * \return true if the message was queued.
+ */
+bool communicator::queue_message(ed::message & msg, bool cache)
+{
+    cache_parameter const parameter(parse_cache_parameter(msg));
+    if(parameter.f_no_cache)
+    {
+        return false;
+    }
+
+    std::size_t const size(msg.to_message().length());
+    if(f_outbound_max_bytes != 0
+    && size > f_outbound_max_bytes)
+    {
+        SNAP_LOG_WARNING
+            << "message \""
+            << msg.get_command()
+            << "\" is too large to be queued ("
+            << size
+            << " bytes)."
+            << SNAP_LOG_SEND;
+        ++f_outbound_dropped;
+        return false;
+    }
+
+    while(!f_outbound_queue.empty()
+       && ((f_outbound_max_messages != 0 && f_outbound_queue.size() >= f_outbound_max_messages)
+        || (f_outbound_max_bytes != 0 && f_outbound_bytes + size > f_outbound_max_bytes)))
+    {
+        ++f_outbound_dropped;
+        pop_queued_message();
+    }
+
+    f_outbound_queue.push_back({ msg, time(nullptr) + parameter.f_ttl, size, cache });
+    f_outbound_bytes += size;
+
+    return true;
+}
+
+
+void communicator::pop_queued_message()
+{
+    f_outbound_bytes -= f_outbound_queue.front().f_size;
+    f_outbound_queue.pop_front();
+}
+
+
+/** \brief Send the queued messages.
+ *
+ * The connection calls this function when it receives READY, i.e. once
+ * our REGISTER was accepted by the daemon. The messages are sent in the
+ * order they were queued. Messages which timed out are dropped.
+ *
+ * If sending fails (the connection was lost again), the remaining
+ * messages stay in the queue until the next READY.
+ *
+ * \param[in] now  The time used to check whether a message timed out.
+ */
+void communicator::flush_outbound_queue(time_t now)
+{
+    ed::connection_with_send_message::pointer_t messenger(std::dynamic_pointer_cast<ed::connection_with_send_message>(f_communicator_connection));
+    if(messenger == nullptr)
+    {
+        return;
+    }
+
+    while(!f_outbound_queue.empty())
+    {
+        queued_message & q(f_outbound_queue.front());
+        if(q.f_timeout >= now
+        && !messenger->send_message(q.f_message, q.f_cache))
+        {
+            break;
+        }
+        if(q.f_timeout < now)
+        {
+            ++f_outbound_dropped;
+        }
+        pop_queued_message();
+    }
+}
+
+
 /** \brief When exiting your process, make sure to unregister.
  *
  * To cleanly unregister a service and thus send a message to the communicator
@@ -535,6 +1100,316 @@ bool communicator::is_connected() const
 }
 
 
+/** \brief Send a request and get called back with its response.
+ *
+ * This function adds a unique correlation identifier to \p msg and sends
+ * it to the communicator daemon. The destination service is expected to
+ * reply with send_reply() (or to copy the correlation identifier in its
+ * reply with copy_correlation_id()). That reply is then passed to
+ * \p callback with RESPONSE_STATUS_REPLY instead of being dispatched.
+ *
+ * The function also requests a transmission report. If the daemon cannot
+ * forward the message or the service is reported as unavailable, the
+ * callback is called with RESPONSE_STATUS_FAILED. A "cached" report is
+ * ignored since the service may still reply once it starts. If nothing
+ * happens within \p timeout microseconds, the callback is called with
+ * RESPONSE_STATUS_TIMEOUT and the original request.
+ *
+ * The callback is called exactly once from the event loop (unless the
+ * request gets canceled). A callback is used rather than a future since
+ * the event loop runs in a single thread: waiting on a future in a
+ * callback would block the very loop which has to receive the reply.
+ *
+ * \param[in,out] msg  The request to send.
+ * \param[in] callback  The function called with the response.
+ * \param[in] timeout  The number of microseconds to wait for the reply.
+ *
+ * \return The correlation identifier or 0 if the message could not be
+ * sent, in which case \p callback does not get called.
+ */
+correlation_id_t communicator::send_request(
+      ed::message & msg
+    , response_callback_t callback
+    , std::int64_t timeout)
+{
+    if(callback == nullptr)
+    {
+        throw invalid_parameter("send_request() requires a callback.");
+    }
+
+    correlation_id_t const id(f_next_correlation_id++);
+    msg.add_parameter(
+          g_name_communicatord_param_correlation_id
+        , f_correlation_prefix + std::to_string(id));
+    request_failure(msg);
+    if(!send_message(msg))
+    {
+        return 0;
+    }
+
+    pending_request & p(f_pending_requests[id]);
+    p.f_callback = callback;
+    p.f_deadline = now_us() + std::max(timeout, static_cast<std::int64_t>(0));
+    p.f_request = msg;
+
+    update_request_timer();
+
+    return id;
+}
+
+
+/** \brief Cancel a pending request.
+ *
+ * The callback of a canceled request is never called. A reply received
+ * later is silently dropped.
+ *
+ * \param[in] id  The identifier returned by send_request().
+ *
+ * \return true if the request was still pending.
+ */
+bool communicator::cancel_request(correlation_id_t id)
+{
+    if(f_pending_requests.erase(id) == 0)
+    {
+        return false;
+    }
+    update_request_timer();
+    return true;
+}
+
+
+/** \brief Get the number of requests waiting for a response.
+ *
+ * \return The number of pending requests.
+ */
+std::size_t communicator::pending_requests() const
+{
+    return f_pending_requests.size();
+}
+
+
+/** \brief Reply to a request.
+ *
+ * This function sets up \p reply as a reply to \p request, copies the
+ * correlation identifier, if any, and sends it.
+ *
+ * \param[in] request  The request being replied to.
+ * \param[in,out] reply  The reply to send back.
+ *
+ * \return true if the reply was sent.
+ */
+bool communicator::send_reply(ed::message const & request, ed::message & reply)
+{
+    reply.reply_to(request);
+    copy_correlation_id(request, reply);
+    return send_message(reply);
+}
+
+
+/** \brief Handle a response to one of our requests.
+ *
+ * The connection to the communicator daemon calls this function with
+ * each message it receives. Messages without a correlation identifier
+ * or with an identifier which was not generated by this communicator
+ * are left alone.
+ *
+ * \param[in] msg  The message to check.
+ *
+ * \return true if the message was a response and it got handled.
+ */
+bool communicator::process_response(ed::message & msg)
+{
+    if(!msg.has_parameter(g_name_communicatord_param_correlation_id))
+    {
+        return false;
+    }
+    std::string const correlation_id(msg.get_parameter(g_name_communicatord_param_correlation_id));
+    if(correlation_id.length() <= f_correlation_prefix.length()
+    || correlation_id.compare(0, f_correlation_prefix.length(), f_correlation_prefix) != 0)
+    {
+        return false;
+    }
+
+    correlation_id_t id(0);
+    try
+    {
+        id = std::stoull(correlation_id.substr(f_correlation_prefix.length()));
+    }
+    catch(std::logic_error const &)
+    {
+        return false;
+    }
+
+    response_status_t status(response_status_t::RESPONSE_STATUS_REPLY);
+    if(msg.get_command() == g_name_communicatord_cmd_transmission_report)
+    {
+        if(msg.has_parameter(g_name_communicatord_param_status)
+        && msg.get_parameter(g_name_communicatord_param_status) == g_name_communicatord_value_cached)
+        {
+            // the service may reply once started, keep waiting
+            //
+            return true;
+        }
+        status = response_status_t::RESPONSE_STATUS_FAILED;
+    }
+    else if(msg.get_command() == ed::g_name_ed_cmd_service_unavailable)
+    {
+        status = response_status_t::RESPONSE_STATUS_FAILED;
+    }
+
+    auto it(f_pending_requests.find(id));
+    if(it == f_pending_requests.end())
+    {
+        // late reply to a request which timed out or was canceled
+        //
+        return true;
+    }
+
+    // the callback may send new requests, remove this one first
+    //
+    response_callback_t const callback(it->second.f_callback);
+    f_pending_requests.erase(it);
+    update_request_timer();
+
+    callback(status, msg);
+
+    return true;
+}
+
+
+/** \brief Time out the requests which reached their deadline.
+ *
+ * This function is called by the request timer. It calls the callback
+ * of each expired request with RESPONSE_STATUS_TIMEOUT and a copy of
+ * the request that was sent.
+ */
+void communicator::process_request_timeouts()
+{
+    std::int64_t const now(now_us());
+    for(;;)
+    {
+        auto it(std::find_if(
+              f_pending_requests.begin()
+            , f_pending_requests.end()
+            , [now](auto const & p)
+            {
+                return p.second.f_deadline <= now;
+            }));
+        if(it == f_pending_requests.end())
+        {
+            break;
+        }
+        response_callback_t const callback(it->second.f_callback);
+        ed::message request(it->second.f_request);
+        f_pending_requests.erase(it);
+
+        callback(response_status_t::RESPONSE_STATUS_TIMEOUT, request);
+    }
+
+    update_request_timer();
+}
+
+
+/** \brief Set the request timer to the earliest deadline.
+ *
+ * The timer gets created the first time a request is sent and is
+ * disabled when no more requests are pending.
+ */
+void communicator::update_request_timer()
+{
+    if(f_pending_requests.empty())
+    {
+        if(f_request_timer != nullptr)
+        {
+            f_request_timer->set_enable(false);
+        }
+        return;
+    }
+
+    if(f_request_timer == nullptr)
+    {
+        f_request_timer = std::make_shared<request_timer>(this);
+        if(!f_communicator->add_connection(f_request_timer))
+        {
+            f_request_timer.reset();
+            SNAP_LOG_ERROR
+                << "could not add the request timer, requests will not time out."
+                << SNAP_LOG_SEND;
+            return;
+        }
+    }
+
+    std::int64_t deadline(f_pending_requests.begin()->second.f_deadline);
+    for(auto const & p : f_pending_requests)
+    {
+        deadline = std::min(deadline, p.second.f_deadline);
+    }
+    f_request_timer->set_timeout_date(deadline);
+    f_request_timer->set_enable(true);
+}
+
+
+/** \brief Get the last known cluster status.
+ *
+ * The communicator daemon pushes a CLUSTER_CURRENT_STATUS message to
+ * the service as soon as it registered and then each time the status
+ * changes. This function returns the last status received so there is
+ * no need to send CLUSTER_STATUS messages.
+ *
+ * Until the first message is received, the f_known field is false.
+ *
+ * \return A reference to the cached cluster status.
+ */
+cluster_status const & communicator::get_cluster_status() const
+{
+    return f_cluster_status;
+}
+
+
+/** \brief Set a callback called whenever the cluster status changes.
+ *
+ * The \p callback gets called from the event loop each time a
+ * CLUSTER_CURRENT_STATUS message changes the cached status.
+ *
+ * \param[in] callback  The function to call or nullptr to remove it.
+ */
+void communicator::set_cluster_status_callback(cluster_status_callback_t callback)
+{
+    f_cluster_status_callback = callback;
+}
+
+
+/** \brief Save the cluster status sent by the daemon.
+ *
+ * \param[in] msg  The CLUSTER_CURRENT_STATUS message.
+ */
+void communicator::msg_cluster_current_status(ed::message & msg)
+{
+    cluster_status status;
+    status.f_known = true;
+    status.f_up = msg.has_parameter(g_name_communicatord_param_status)
+               && msg.get_parameter(g_name_communicatord_param_status) == g_name_communicatord_value_up;
+    status.f_complete = msg.has_parameter(g_name_communicatord_param_complete)
+               && msg.get_parameter(g_name_communicatord_param_complete) == g_name_communicatord_value_true;
+    if(msg.has_parameter(g_name_communicatord_param_neighbors_count))
+    {
+        status.f_neighbors_count = msg.get_integer_parameter(g_name_communicatord_param_neighbors_count);
+    }
+
+    bool const changed(!f_cluster_status.f_known
+                    || status.f_up != f_cluster_status.f_up
+                    || status.f_complete != f_cluster_status.f_complete
+                    || status.f_neighbors_count != f_cluster_status.f_neighbors_count);
+    f_cluster_status = status;
+
+    if(changed
+    && f_cluster_status_callback != nullptr)
+    {
+        f_cluster_status_callback(f_cluster_status);
+    }
+}
+
+
 /** \brief Request the communicator daemon to return a transmission report.
  *
  * By calling this function, you mark the message so that if an error
@@ -555,6 +1430,117 @@ void request_failure(ed::message & msg)
 }
 
 
+/** \brief Copy the correlation identifier of a request to its reply.
+ *
+ * When a service replies to a message sent with
+ * communicator::send_request(), the reply must include the same
+ * correlation identifier. This function copies it if present.
+ *
+ * \param[in] request  The message being replied to.
+ * \param[in,out] reply  The reply where the identifier gets copied.
+ */
+void copy_correlation_id(ed::message const & request, ed::message & reply)
+{
+    if(request.has_parameter(communicatord::g_name_communicatord_param_correlation_id))
+    {
+        reply.add_parameter(
+              communicatord::g_name_communicatord_param_correlation_id
+            , request.get_parameter(communicatord::g_name_communicatord_param_correlation_id));
+    }
+}
+
+
+/** \brief Request the communicator daemons to trace a message.
+ *
+ * This function adds an empty "trace" parameter to \p msg. Each
+ * communicator daemon forwarding the message appends its name along the
+ * time it received the message and the time it sent it further. The
+ * recipient retrieves the list with get_trace().
+ *
+ * The daemons can also be configured to trace a sample of the messages
+ * sent by their local services (see the trace_sample_rate option).
+ *
+ * \param[in,out] msg  The message to trace.
+ */
+void request_trace(ed::message & msg)
+{
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_trace))
+    {
+        msg.add_parameter(communicatord::g_name_communicatord_param_trace, std::string());
+    }
+}
+
+
+/** \brief Retrieve the hops a traced message went through.
+ *
+ * The "trace" parameter is a comma separated list of hops each defined
+ * as `<server name>:<received>:<sent>[:<offset>]` with times in
+ * microseconds since the Unix epoch. The times come from the clock of
+ * each server. When a server has an estimate of the offset between the
+ * clock of the previous hop and its own clock, it adds that offset so
+ * the latency between the two hops can be computed as:
+ *
+ * \code
+ *     hop[i].f_received - (hop[i - 1].f_sent - hop[i].f_offset)
+ * \endcode
+ *
+ * Invalid hops are ignored.
+ *
+ * \param[in] msg  The message that was traced.
+ *
+ * \return The list of hops, empty if the message was not traced.
+ */
+trace_t get_trace(ed::message const & msg)
+{
+    trace_t result;
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_trace))
+    {
+        return result;
+    }
+
+    std::list<std::string> hops;
+    snapdev::tokenize_string(
+              hops
+            , msg.get_parameter(communicatord::g_name_communicatord_param_trace)
+            , { "," }
+            , true);
+    for(auto const & h : hops)
+    {
+        std::vector<std::string> fields;
+        snapdev::tokenize_string(fields, h, { ":" });
+        if((fields.size() != 3 && fields.size() != 4)
+        || fields[0].empty())
+        {
+            continue;
+        }
+        char * end(nullptr);
+        trace_hop hop;
+        hop.f_node = fields[0];
+        hop.f_received = std::strtoll(fields[1].c_str(), &end, 10);
+        if(end == nullptr || *end != '\0' || fields[1].empty())
+        {
+            continue;
+        }
+        hop.f_sent = std::strtoll(fields[2].c_str(), &end, 10);
+        if(end == nullptr || *end != '\0' || fields[2].empty())
+        {
+            continue;
+        }
+        if(fields.size() == 4)
+        {
+            hop.f_offset = std::strtoll(fields[3].c_str(), &end, 10);
+            if(end == nullptr || *end != '\0' || fields[3].empty())
+            {
+                continue;
+            }
+        }
+        result.push_back(hop);
+    }
+
+    return result;
+}
+
+
 
 } // namespace communicatord
 // vim: ts=4 sw=4 et
@@ -41,7 +41,13 @@
 
 // C++
 //
+#include    <cstdint>
+#include    <ctime>
+#include    <deque>
+#include    <functional>
+#include    <map>
 #include    <string_view>
+#include    <vector>
 
 
 namespace communicatord
@@ -59,6 +65,42 @@ constexpr std::string_view      g_communicatord_default_port = snapdev::integer_
 constexpr std::string_view      g_communicatord_colon = ":";
 constexpr std::string_view      g_communicatord_default_ip_port = snapdev::join_string_views<g_communicatord_default_ip, g_communicatord_colon, g_communicatord_default_port>;
 constexpr std::string_view      g_communicatord_any_ip_port = snapdev::join_string_views<g_communicatord_any_ip, g_communicatord_colon, g_communicatord_default_port>;
+constexpr std::int64_t const    DEFAULT_REQUEST_TIMEOUT = 10'000'000;   // 10 seconds in microseconds
+
+
+
+enum class response_status_t
+{
+    RESPONSE_STATUS_REPLY,      // the destination service replied
+    RESPONSE_STATUS_FAILED,     // the request could not be delivered (TRANSMISSION_REPORT or SERVICE_UNAVAILABLE)
+    RESPONSE_STATUS_TIMEOUT,    // no reply was received in time
+};
+
+
+struct cluster_status
+{
+    bool                        f_known = false;            // true once a CLUSTER_CURRENT_STATUS was received
+    bool                        f_up = false;               // a quorum of neighbors is connected
+    bool                        f_complete = false;         // all the neighbors are connected
+    std::size_t                 f_neighbors_count = 0;
+};
+
+
+struct trace_hop
+{
+    std::string                 f_node = std::string();     // name of the communicatord server
+    std::int64_t                f_received = 0;             // in microseconds since the Unix epoch
+    std::int64_t                f_sent = 0;                 // in microseconds since the Unix epoch
+    std::int64_t                f_offset = 0;               // clock of the previous hop minus the clock of this one, in microseconds
+};
+typedef std::vector<trace_hop>  trace_t;
+
+
+typedef std::function<void(cluster_status const & status)>
+                                cluster_status_callback_t;
+typedef std::uint64_t           correlation_id_t;
+typedef std::function<void(response_status_t status, ed::message & msg)>
+                                response_callback_t;
 
 
 
@@ -87,15 +129,76 @@ public:
     //
     virtual bool                send_message(ed::message & msg, bool cache = false) override;
 
+    correlation_id_t            send_request(
+                                      ed::message & msg
+                                    , response_callback_t callback
+                                    , std::int64_t timeout = DEFAULT_REQUEST_TIMEOUT);
+    bool                        cancel_request(correlation_id_t id);
+    std::size_t                 pending_requests() const;
+    bool                        send_reply(ed::message const & request, ed::message & reply);
+
+    void                        set_outbound_queue_limits(
+                                      std::size_t max_messages
+                                    , std::size_t max_bytes);
+    std::size_t                 outbound_queue_size() const;
+    std::size_t                 outbound_queue_dropped() const;
+
+    cluster_status const &      get_cluster_status() const;
+    void                        set_cluster_status_callback(cluster_status_callback_t callback);
+
+    // used internally by the connection and timer
+    //
+    bool                        process_response(ed::message & msg);
+    void                        process_request_timeouts();
+    void                        flush_outbound_queue(time_t now = time(nullptr));
+    void                        msg_cluster_current_status(ed::message & msg);
+
 private:
+    struct pending_request
+    {
+        response_callback_t     f_callback = response_callback_t();
+        std::int64_t            f_deadline = 0;
+        ed::message             f_request = ed::message();
+    };
+    typedef std::map<correlation_id_t, pending_request>
+                                pending_request_map_t;
+
+    struct queued_message
+    {
+        ed::message             f_message = ed::message();
+        time_t                  f_timeout = 0;
+        std::size_t             f_size = 0;
+        bool                    f_cache = false;
+    };
+    typedef std::deque<queued_message>
+                                outbound_queue_t;
+
+    void                        update_request_timer();
+    bool                        queue_message(ed::message & msg, bool cache);
+    void                        pop_queued_message();
+
     advgetopt::getopt &         f_opts;
     ed::communicator::pointer_t f_communicator = ed::communicator::pointer_t();
     std::string                 f_service_name = std::string();
     ed::connection::pointer_t   f_communicator_connection = ed::connection::pointer_t();
+    std::string                 f_correlation_prefix = std::string();
+    correlation_id_t            f_next_correlation_id = 1;
+    pending_request_map_t       f_pending_requests = pending_request_map_t();
+    ed::timer::pointer_t        f_request_timer = ed::timer::pointer_t();
+    outbound_queue_t            f_outbound_queue = outbound_queue_t();
+    std::size_t                 f_outbound_max_messages = 0;
+    std::size_t                 f_outbound_max_bytes = 0;
+    std::size_t                 f_outbound_bytes = 0;
+    std::size_t                 f_outbound_dropped = 0;
+    cluster_status              f_cluster_status = cluster_status();
+    cluster_status_callback_t   f_cluster_status_callback = cluster_status_callback_t();
 };
 
 
 void request_failure(ed::message & msg);
+void copy_correlation_id(ed::message const & request, ed::message & reply);
+void request_trace(ed::message & msg);
+trace_t get_trace(ed::message const & msg);
 
 
 
@@ -63,9 +63,24 @@
 #include    <snapdev/join_strings.h>
 #include    <snapdev/mkdir_p.h>
 #include    <snapdev/not_used.h>
+#include    <snapdev/raii_generic_deleter.h>
+#include    <snapdev/timespec_ex.h>
 #include    <snapdev/tokenize_string.h>
 
 
+// C++
+//
+#include    <fstream>
+#include    <sstream>
+
+
+// C
+//
+#include    <sys/inotify.h>
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
 // last include
 //
 #include    <snapdev/poison.h>
@@ -83,6 +98,50 @@ namespace
 constexpr char const * const        g_communicatord_flags = "/etc/communicatord/flags.conf";
 
 
+/** \brief The list of parameters found in a flag file.
+ *
+ * This list is used to load a flag file in a parameters_t map.
+ */
+constexpr char const * const        g_flag_parameter_names[] =
+{
+    communicatord::g_name_communicatord_param_unit,
+    communicatord::g_name_communicatord_param_section,
+    communicatord::g_name_communicatord_param_name,
+    communicatord::g_name_communicatord_param_source_file,
+    communicatord::g_name_communicatord_param_function,
+    communicatord::g_name_communicatord_param_line,
+    communicatord::g_name_communicatord_param_message,
+    communicatord::g_name_communicatord_param_priority,
+    communicatord::g_name_communicatord_param_manual_down,
+    communicatord::g_name_communicatord_param_date,
+    communicatord::g_name_communicatord_param_modified,
+    communicatord::g_name_communicatord_param_tags,
+    communicatord::g_name_communicatord_param_hostname,
+    communicatord::g_name_communicatord_param_count,
+    communicatord::g_name_communicatord_param_version,
+};
+
+
+/** \brief The marker starting a flag in a snapshot file.
+ *
+ * The snapshot file is a list of flags, each introduced by this line
+ * and followed by its parameters, one per line.
+ */
+constexpr char const * const        g_snapshot_flag_marker = "[flag]";
+
+
+/** \brief The prefix of the file stamps in a snapshot file.
+ *
+ * The header of the snapshot file includes one line per flag file
+ * with its size and modification time:
+ *
+ * \code
+ *      file=<size> <seconds> <nanoseconds> <filename>
+ * \endcode
+ */
+constexpr char const * const        g_snapshot_file_prefix = "file=";
+
+
 std::string get_config_param(std::string const & name, std::string const & default_value)
 {
     // TODO: fix this load, we need to support a sub-directory
@@ -192,6 +251,148 @@ std::string get_path_to_flag_files()
 }
 
 
+/** \brief Escape a value before saving it in a snapshot.
+ *
+ * The snapshot saves one parameter per line. This function escapes the
+ * backslash and new line characters so a message can safely include them.
+ *
+ * \param[in] value  The value to escape.
+ *
+ * \return The escaped value.
+ */
+std::string escape_snapshot_value(std::string const & value)
+{
+    std::string result;
+    result.reserve(value.length());
+    for(auto const c : value)
+    {
+        switch(c)
+        {
+        case '\\':
+            result += "\\\\";
+            break;
+
+        case '\n':
+            result += "\\n";
+            break;
+
+        case '\r':
+            result += "\\r";
+            break;
+
+        default:
+            result += c;
+            break;
+
+        }
+    }
+    return result;
+}
+
+
+/** \brief Restore a value escaped by escape_snapshot_value().
+ *
+ * \param[in] value  The escaped value.
+ *
+ * \return The original value.
+ */
+std::string unescape_snapshot_value(std::string const & value)
+{
+    std::string result;
+    result.reserve(value.length());
+    for(std::string::size_type i(0); i < value.length(); ++i)
+    {
+        if(value[i] == '\\'
+        && i + 1 < value.length())
+        {
+            ++i;
+            switch(value[i])
+            {
+            case 'n':
+                result += '\n';
+                break;
+
+            case 'r':
+                result += '\r';
+                break;
+
+            default:
+                result += value[i];
+                break;
+
+            }
+        }
+        else
+        {
+            result += value[i];
+        }
+    }
+    return result;
+}
+
+
+/** \brief Get the size and modification time of a file.
+ *
+ * The snapshot saves this stamp for each flag file. A flag file
+ * rewritten in place does not change the modification time of the
+ * directory, but it changes its own stamp.
+ *
+ * \param[in] filename  The name of the file to check.
+ *
+ * \return The stamp of \p filename or an empty string if it does not
+ * exist.
+ */
+std::string get_file_stamp(std::string const & filename)
+{
+    struct stat s;
+    if(stat(filename.c_str(), &s) != 0)
+    {
+        return std::string();
+    }
+
+    return std::to_string(s.st_size)
+         + ' '
+         + std::to_string(s.st_mtim.tv_sec)
+         + ' '
+         + std::to_string(s.st_mtim.tv_nsec);
+}
+
+
+/** \brief Limit the number of flags returned to the user.
+ *
+ * If more than flag::FLAGS_LIMIT flags are raised, the list gets truncated
+ * and a "dynamic" flag is added about the problem.
+ *
+ * \param[in,out] flags  The list of flags to limit.
+ * \param[in] path  The path to the flag files, used in the message.
+ */
+void limit_flags(flag::list_t & flags, std::string const & path)
+{
+    if(flags.size() <= flag::FLAGS_LIMIT)
+    {
+        return;
+    }
+
+    flags.resize(flag::FLAGS_LIMIT);
+
+    // that error means we have over 100 flags raised
+    //
+    // we raise a "dynamic" flag about this error and ignore the
+    // additional entries
+    //
+    auto too_many(COMMUNICATORD_FLAG_UP(
+              "communicatord"
+            , "flag"
+            , "too-many-flags"
+            , "too many flags were raised, showing only the first 100,"
+              " others can be viewed on this system at \"" + path + "\""));
+    too_many->set_priority(97);
+    too_many->add_tag("flag");
+    too_many->add_tag("too-many");
+    flags.push_back(too_many); // passed to user, not saved
+}
+
+
 
 }
 
@@ -279,71 +480,127 @@ flag::flag(std::string const & filename)
     advgetopt::conf_file_setup setup(get_filename());
     advgetopt::conf_file::pointer_t file(advgetopt::conf_file::get_conf_file(setup));
 
-    if(!file->has_parameter(communicatord::g_name_communicatord_param_unit)
-    || !file->has_parameter(communicatord::g_name_communicatord_param_section)
-    || !file->has_parameter(communicatord::g_name_communicatord_param_name)
-    || !file->has_parameter(communicatord::g_name_communicatord_param_message))
+    parameters_t parameters;
+    for(auto const & name : g_flag_parameter_names)
+    {
+        if(file->has_parameter(name))
+        {
+            parameters[name] = file->get_parameter(name);
+        }
+    }
+
+    set_parameters(parameters);
+}
+
+
+/** \brief Initialize a flag from a set of parameters.
+ *
+ * This constructor is used to recreate a flag from the parameters
+ * returned by get_parameters(). This is how a flag gets loaded from
+ * a flag snapshot instead of its own file.
+ *
+ * The filename is not part of the parameters. It gets computed from the
+ * unit, section, and name the first time get_filename() gets called.
+ *
+ * \exception invalid_parameter
+ * This exception is raised if one of the mandatory fields (unit, section,
+ * name, message) is missing.
+ *
+ * \param[in] parameters  The parameters of the flag.
+ */
+flag::flag(parameters_t const & parameters)
+{
+    set_parameters(parameters);
+}
+
+
+/** \brief Set the fields of this flag from a set of parameters.
+ *
+ * This function is used by the constructors which load a flag from a
+ * flag file or from a snapshot entry.
+ *
+ * \exception invalid_parameter
+ * This exception is raised if one of the mandatory fields (unit, section,
+ * name, message) is missing.
+ *
+ * \param[in] parameters  The parameters of the flag.
+ */
+void flag::set_parameters(parameters_t const & parameters)
+{
+    auto has = [&parameters](std::string const & name)
+    {
+        return parameters.find(name) != parameters.end();
+    };
+    auto get = [&parameters](std::string const & name)
+    {
+        return parameters.at(name);
+    };
+
+    if(!has(communicatord::g_name_communicatord_param_unit)
+    || !has(communicatord::g_name_communicatord_param_section)
+    || !has(communicatord::g_name_communicatord_param_name)
+    || !has(communicatord::g_name_communicatord_param_message))
     {
         throw invalid_parameter("a flag file is expected to include a unit, section, and name field, along with a message field. Other fields are optional.");
     }
 
-    f_unit = file->get_parameter(communicatord::g_name_communicatord_param_unit);
-    f_section = file->get_parameter(communicatord::g_name_communicatord_param_section);
-    f_name = file->get_parameter(communicatord::g_name_communicatord_param_name);
+    f_unit = get(communicatord::g_name_communicatord_param_unit);
+    f_section = get(communicatord::g_name_communicatord_param_section);
+    f_name = get(communicatord::g_name_communicatord_param_name);
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_source_file))
+    if(has(communicatord::g_name_communicatord_param_source_file))
     {
-        f_source_file = file->get_parameter(communicatord::g_name_communicatord_param_source_file);
+        f_source_file = get(communicatord::g_name_communicatord_param_source_file);
     }
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_function))
+    if(has(communicatord::g_name_communicatord_param_function))
     {
-        f_function = file->get_parameter(communicatord::g_name_communicatord_param_function);
+        f_function = get(communicatord::g_name_communicatord_param_function);
     }
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_line))
+    if(has(communicatord::g_name_communicatord_param_line))
     {
-        f_line = std::stol(file->get_parameter(communicatord::g_name_communicatord_param_line));
+        f_line = std::stol(get(communicatord::g_name_communicatord_param_line));
     }
 
-    f_message = file->get_parameter(communicatord::g_name_communicatord_param_message);
+    f_message = get(communicatord::g_name_communicatord_param_message);
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_priority))
+    if(has(communicatord::g_name_communicatord_param_priority))
     {
-        f_priority = std::stol(file->get_parameter(communicatord::g_name_communicatord_param_priority));
+        f_priority = std::stol(get(communicatord::g_name_communicatord_param_priority));
     }
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_manual_down))
+    if(has(communicatord::g_name_communicatord_param_manual_down))
     {
-        f_manual_down = file->get_parameter(communicatord::g_name_communicatord_param_manual_down)
+        f_manual_down = get(communicatord::g_name_communicatord_param_manual_down)
                                                     == communicatord::g_name_communicatord_value_yes;
     }
 
     time_t const now(time(nullptr));
-    if(file->has_parameter(communicatord::g_name_communicatord_param_date))
+    if(has(communicatord::g_name_communicatord_param_date))
     {
-        f_date = std::stol(file->get_parameter(communicatord::g_name_communicatord_param_date));
+        f_date = std::stol(get(communicatord::g_name_communicatord_param_date));
     }
     else
     {
         f_date = now;
     }
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_modified))
+    if(has(communicatord::g_name_communicatord_param_modified))
     {
-        f_modified = std::stol(file->get_parameter(communicatord::g_name_communicatord_param_modified));
+        f_modified = std::stol(get(communicatord::g_name_communicatord_param_modified));
     }
     else
     {
         f_modified = now;
     }
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_tags))
+    if(has(communicatord::g_name_communicatord_param_tags))
     {
         // here we use an intermediate tag_list vector so the tokenize_string
         // works then add those string in the f_tags parameter
         //
-        std::string const tags(file->get_parameter(communicatord::g_name_communicatord_param_tags));
+        std::string const tags(get(communicatord::g_name_communicatord_param_tags));
         std::vector<std::string> tag_list;
         snapdev::tokenize_string(tag_list
                       , tags
@@ -353,19 +610,19 @@ flag::flag(std::string const & filename)
         f_tags.insert(tag_list.begin(), tag_list.end());
     }
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_hostname))
+    if(has(communicatord::g_name_communicatord_param_hostname))
     {
-        f_hostname = file->get_parameter(communicatord::g_name_communicatord_param_hostname);
+        f_hostname = get(communicatord::g_name_communicatord_param_hostname);
     }
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_count))
+    if(has(communicatord::g_name_communicatord_param_count))
     {
-        f_count = std::stol(file->get_parameter(communicatord::g_name_communicatord_param_count));
+        f_count = std::stol(get(communicatord::g_name_communicatord_param_count));
     }
 
-    if(file->has_parameter(communicatord::g_name_communicatord_param_version))
+    if(has(communicatord::g_name_communicatord_param_version))
     {
-        f_version = file->get_parameter(communicatord::g_name_communicatord_param_version);
+        f_version = get(communicatord::g_name_communicatord_param_version);
     }
 }
 
@@ -962,6 +1219,263 @@ std::string flag::to_string() const
 }
 
 
+/** \brief Retrieve the fields of this flag as a set of parameters.
+ *
+ * This function returns the fields saved in a flag file as a map of
+ * parameter names to values. The result can be given to the flag
+ * constructor accepting parameters to recreate this flag.
+ *
+ * Optional fields which are not defined are not included.
+ *
+ * \return The parameters representing this flag.
+ */
+flag::parameters_t flag::get_parameters() const
+{
+    parameters_t result;
+
+    result[communicatord::g_name_communicatord_param_unit] = f_unit;
+    result[communicatord::g_name_communicatord_param_section] = f_section;
+    result[communicatord::g_name_communicatord_param_name] = f_name;
+    result[communicatord::g_name_communicatord_param_message] = f_message;
+    result[communicatord::g_name_communicatord_param_priority] = std::to_string(f_priority);
+    result[communicatord::g_name_communicatord_param_manual_down] = f_manual_down
+                                        ? communicatord::g_name_communicatord_value_yes
+                                        : communicatord::g_name_communicatord_value_no;
+    result[communicatord::g_name_communicatord_param_date] = std::to_string(f_date);
+    result[communicatord::g_name_communicatord_param_modified] = std::to_string(f_modified);
+    result[communicatord::g_name_communicatord_param_count] = std::to_string(f_count);
+
+    if(!f_source_file.empty())
+    {
+        result[communicatord::g_name_communicatord_param_source_file] = f_source_file;
+    }
+    if(!f_function.empty())
+    {
+        result[communicatord::g_name_communicatord_param_function] = f_function;
+    }
+    if(f_line > 0)
+    {
+        result[communicatord::g_name_communicatord_param_line] = std::to_string(f_line);
+    }
+    if(!f_tags.empty())
+    {
+        result[communicatord::g_name_communicatord_param_tags] = snapdev::join_strings(f_tags, ",");
+    }
+    if(!f_hostname.empty())
+    {
+        result[communicatord::g_name_communicatord_param_hostname] = f_hostname;
+    }
+    if(!f_version.empty())
+    {
+        result[communicatord::g_name_communicatord_param_version] = f_version;
+    }
+
+    return result;
+}
+
+
+/** \brief Convert a list of flags to a snapshot.
+ *
+ * A snapshot is a text representation of a list of flags. Each flag
+ * starts with a "[flag]" line followed by its parameters (see
+ * get_parameters()), one per line:
+ *
+ * \code
+ *      [flag]
+ *      <varname>=<value>
+ *      ...
+ * \endcode
+ *
+ * The values are escaped so they can include new line characters.
+ * This is the format of the snapshot file saved by the flag_index
+ * and of the FLAGS message sent by communicatord.
+ *
+ * \param[in] flags  The list of flags to convert.
+ *
+ * \return The snapshot of \p flags.
+ */
+std::string flag::to_snapshot(list_t const & flags)
+{
+    std::string result;
+    for(auto const & f : flags)
+    {
+        result += g_snapshot_flag_marker;
+        result += '\n';
+        for(auto const & p : f->get_parameters())
+        {
+            result += p.first;
+            result += '=';
+            result += escape_snapshot_value(p.second);
+            result += '\n';
+        }
+    }
+    return result;
+}
+
+
+/** \brief Load a list of flags from a snapshot.
+ *
+ * This function parses a snapshot created by to_snapshot(). Empty
+ * lines, comments (lines starting with '#'), and lines found before
+ * the first "[flag]" marker are ignored.
+ *
+ * \param[in] snapshot  The snapshot to parse.
+ * \param[out] flags  The list of flags found in \p snapshot.
+ *
+ * \return true if the snapshot was valid, false otherwise in which case
+ * \p flags is left unchanged.
+ */
+bool flag::from_snapshot(std::string const & snapshot, list_t & flags)
+{
+    list_t result;
+    try
+    {
+        parameters_t parameters;
+        bool in_flag(false);
+        std::istringstream in(snapshot);
+        std::string line;
+        while(std::getline(in, line))
+        {
+            if(line.empty()
+            || line[0] == '#')
+            {
+                continue;
+            }
+            if(line == g_snapshot_flag_marker)
+            {
+                if(in_flag)
+                {
+                    result.push_back(std::make_shared<flag>(parameters));
+                    parameters.clear();
+                }
+                in_flag = true;
+                continue;
+            }
+            if(!in_flag)
+            {
+                // header (i.e. the version)
+                //
+                continue;
+            }
+            std::string::size_type const pos(line.find('='));
+            if(pos == std::string::npos)
+            {
+                return false;
+            }
+            parameters[line.substr(0, pos)] = unescape_snapshot_value(line.substr(pos + 1));
+        }
+        if(in_flag)
+        {
+            result.push_back(std::make_shared<flag>(parameters));
+        }
+    }
+    catch(std::exception const &)
+    {
+        // an invalid snapshot is ignored, the caller reads the files
+        //
+        return false;
+    }
+
+    flags.swap(result);
+    return true;
+}
+
+
+/** \brief Load the flags from the snapshot saved by communicatord.
+ *
+ * The communicatord daemon watches the flag directory and saves the
+ * current set of flags in one snapshot file each time it changes.
+ * Reading that one file is much cheaper than opening and parsing each
+ * flag file.
+ *
+ * The snapshot is only used if it is at least as recent as the flag
+ * directory and the size and modification time of each flag file
+ * match the ones saved in the snapshot. This way a snapshot left
+ * behind by a daemon which is not running anymore is ignored as soon
+ * as a flag file gets created, deleted, or rewritten in place.
+ *
+ * \param[in] path  The path to the flag files.
+ * \param[out] flags  The list of flags found in the snapshot.
+ *
+ * \return true if the snapshot was loaded, false if it is missing, stale,
+ * or invalid, in which case the caller has to read the flag files and
+ * \p flags is left unchanged.
+ */
+bool flag::load_snapshot(std::string const & path, list_t & flags)
+{
+    std::string const filename(path + ".snapshot");
+
+    struct stat dir_stat;
+    struct stat snapshot_stat;
+    if(stat(path.c_str(), &dir_stat) != 0
+    || stat(filename.c_str(), &snapshot_stat) != 0
+    || snapdev::timespec_ex(snapshot_stat.st_mtim) < snapdev::timespec_ex(dir_stat.st_mtim))
+    {
+        return false;
+    }
+
+    std::ifstream in(filename);
+    if(!in.is_open())
+    {
+        return false;
+    }
+
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string const snapshot(ss.str());
+
+    // the stamps are found in the header, before the first flag
+    //
+    std::map<std::string, std::string> stamps;
+    std::string const prefix(g_snapshot_file_prefix);
+    std::string::size_type const prefix_length(prefix.length());
+    std::istringstream header(snapshot);
+    std::string line;
+    while(std::getline(header, line)
+       && line != g_snapshot_flag_marker)
+    {
+        if(line.compare(0, prefix_length, prefix) != 0)
+        {
+            continue;
+        }
+
+        // the stamp is composed of three numbers, the filename follows
+        //
+        std::string::size_type pos(prefix_length);
+        for(int count(0); count < 3 && pos != std::string::npos; ++count)
+        {
+            pos = line.find(' ', pos + 1);
+        }
+        if(pos == std::string::npos)
+        {
+            return false;
+        }
+        stamps[line.substr(pos + 1)] = line.substr(prefix_length, pos - prefix_length);
+    }
+
+    snapdev::glob_to_list<std::list<std::string>> flag_filenames;
+    flag_filenames.read_path<
+          snapdev::glob_to_list_flag_t::GLOB_FLAG_NO_ESCAPE
+        , snapdev::glob_to_list_flag_t::GLOB_FLAG_EMPTY>(
+              path + "/*.flag");
+    if(flag_filenames.size() != stamps.size())
+    {
+        return false;
+    }
+    for(auto const & name : flag_filenames)
+    {
+        auto const it(stamps.find(name));
+        if(it == stamps.end()
+        || it->second != get_file_stamp(name))
+        {
+            return false;
+        }
+    }
+
+    return from_snapshot(snapshot, flags);
+}
+
+
 /** \brief Save the data to file.
  *
  * This function is used to save the flag to file.
@@ -1389,6 +1903,11 @@ void flag::valid_name(std::string & name)
  *
  * This function is used to load all the flag files from disk.
  *
+ * When the communicatord daemon is running, it keeps an index of the
+ * flags (see flag_index) and saves them in a snapshot file each time
+ * one changes. If that snapshot is up to date, this function reads it
+ * instead of opening and parsing each flag file.
+ *
  * \note
  * It is expected that the number of flags is always going to be relatively
  * small. The function make sure that if more than 100 are defined, only
@@ -1415,6 +1934,12 @@ flag::list_t flag::load_flags()
         return result;
     }
 
+    if(flag::load_snapshot(path, result))
+    {
+        limit_flags(result, path);
+        return result;
+    }
+
     snapdev::glob_to_list<std::list<std::string>> flag_filenames;
     flag_filenames.read_path<
           snapdev::glob_to_list_flag_t::GLOB_FLAG_NO_ESCAPE
@@ -1423,30 +1948,18 @@ flag::list_t flag::load_flags()
 
     for(auto const & filename : flag_filenames)
     {
-        if(result.size() >= flag::FLAGS_LIMIT)
+        // read one more than the limit; limit_flags() replaces it
+        //
+        if(result.size() > flag::FLAGS_LIMIT)
         {
-            // that error means we have over 100 flags raised
-            //
-            // we raise a "dynamic" flag about this error and ignore the
-            // additional entries in the directory (the ignore happens because
-            // of the throw in the load_flag() function.)
-            //
-            auto flag(COMMUNICATORD_FLAG_UP(
-                      "communicatord"
-                    , "flag"
-                    , "too-many-flags"
-                    , "too many flags were raised, showing only the first 100,"
-                      " others can be viewed on this system at \"" + path + "\""));
-            flag->set_priority(97);
-            flag->add_tag("flag");
-            flag->add_tag("too-many");
-            result.push_back(flag); // passed to user, not saved
             break;
         }
 
         result.push_back(std::make_shared<flag>(filename));
     }
 
+    limit_flags(result, path);
+
     return result;
 }
 
@@ -1454,5 +1967,565 @@ flag::list_t flag::load_flags()
 
 
 
+
+/** \class flag_index
+ * \brief Keep the set of flags in memory.
+ *
+ * The flag::load_flags() function opens and parses every flag file each
+ * time it gets called. This class instead loads the flags once and then
+ * uses inotify to watch the flag directory. Only the files which get
+ * written, moved, or deleted are parsed again.
+ *
+ * The communicatord daemon keeps one such index and saves the current
+ * set of flags in a snapshot file each time it changes. The
+ * flag::load_flags() function reads that one file when it is up to date.
+ *
+ * \code
+ *     communicatord::flag_index index;
+ *     if(index.watch())
+ *     {
+ *         // add index.get_socket() to your poll() and on POLLIN call:
+ *         //
+ *         if(index.process_events())
+ *         {
+ *             communicatord::flag::list_t const flags(index.get_flags());
+ *             ...
+ *         }
+ *     }
+ * \endcode
+ */
+
+
+/** \brief Initialize the flag index.
+ *
+ * The index is empty until watch() or rescan() gets called.
+ *
+ * \param[in] path  The path to the flag files. If empty, the path defined
+ * in the flags.conf file is used.
+ */
+flag_index::flag_index(std::string const & path)
+    : f_path(path.empty() ? get_path_to_flag_files() : path)
+{
+}
+
+
+/** \brief Stop watching the flag directory.
+ *
+ * The destructor closes the inotify file descriptor.
+ */
+flag_index::~flag_index()
+{
+    if(f_inotify != -1)
+    {
+        close(f_inotify);
+    }
+}
+
+
+/** \brief Get the path to the flag files.
+ *
+ * \return The path to the directory where the flag files are saved.
+ */
+std::string const & flag_index::get_path() const
+{
+    return f_path;
+}
+
+
+/** \brief Get the name of the snapshot file.
+ *
+ * The snapshot is saved next to the flag directory (and not inside) so
+ * saving it does not change the modification time of the directory.
+ *
+ * \return The full path to the snapshot file.
+ */
+std::string flag_index::get_snapshot_filename() const
+{
+    return f_path + ".snapshot";
+}
+
+
+/** \brief Start watching the flag directory.
+ *
+ * This function creates the inotify file descriptor, adds a watch on the
+ * flag directory, and then loads all the existing flags. The watch is
+ * added first so a flag raised while loading is not missed.
+ *
+ * \return true if the directory is being watched.
+ */
+bool flag_index::watch()
+{
+    if(f_inotify != -1)
+    {
+        return true;
+    }
+
+    if(f_path.empty())
+    {
+        return false;
+    }
+
+    snapdev::raii_fd_t safe_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    if(safe_fd.get() == -1)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "could not create an inotify file descriptor to watch the flags: "
+            << e
+            << ", "
+            << strerror(e)
+            << SNAP_LOG_SEND;
+        return false;
+    }
+
+    if(inotify_add_watch(
+              safe_fd.get()
+            , f_path.c_str()
+            , IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR) == -1)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "could not watch the flags directory \""
+            << f_path
+            << "\": "
+            << e
+            << ", "
+            << strerror(e)
+            << SNAP_LOG_SEND;
+        return false;
+    }
+
+    f_inotify = safe_fd.release();
+
+    rescan();
+
+    return true;
+}
+
+
+/** \brief Get the inotify file descriptor.
+ *
+ * This descriptor becomes readable when a flag file changes. At that
+ * point, call process_events().
+ *
+ * \return The inotify file descriptor or -1 if watch() was not called
+ * or failed.
+ */
+int flag_index::get_socket() const
+{
+    return f_inotify;
+}
+
+
+/** \brief Read the pending inotify events.
+ *
+ * This function reads all the pending events and reloads or forgets the
+ * corresponding flag files. Files which do not end with ".flag" are
+ * ignored (i.e. the ".bak" backups).
+ *
+ * If the kernel event queue overflowed, the whole directory gets
+ * scanned again.
+ *
+ * Each flag which gets raised, updated, or lowered increments the
+ * version by one and, if \p changes is not nullptr, gets added to that
+ * list. The flags which were lowered have their state set to STATE_DOWN.
+ *
+ * \param[out] changes  The list where the changed flags get added.
+ *
+ * \return true if at least one flag changed.
+ */
+bool flag_index::process_events(flag::list_t * changes)
+{
+    if(f_inotify == -1)
+    {
+        return false;
+    }
+
+    bool changed(false);
+    alignas(struct inotify_event) char buffer[4096];
+    for(;;)
+    {
+        ssize_t const r(read(f_inotify, buffer, sizeof(buffer)));
+        if(r <= 0)
+        {
+            if(r < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                if(errno != EAGAIN)
+                {
+                    int const e(errno);
+                    SNAP_LOG_ERROR
+                        << "could not read the flags inotify events: "
+                        << e
+                        << ", "
+                        << strerror(e)
+                        << SNAP_LOG_SEND;
+                }
+            }
+            break;
+        }
+
+        for(char const * p(buffer); p < buffer + r; )
+        {
+            struct inotify_event const * event(reinterpret_cast<struct inotify_event const *>(p));
+            p += sizeof(struct inotify_event) + event->len;
+
+            if((event->mask & IN_Q_OVERFLOW) != 0)
+            {
+                if(rescan(changes))
+                {
+                    changed = true;
+                }
+                continue;
+            }
+            if(event->len == 0)
+            {
+                continue;
+            }
+            std::string const name(event->name);
+            if(!name.ends_with(".flag"))
+            {
+                continue;
+            }
+
+            std::string const filename(f_path + "/" + name);
+            if((event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0)
+            {
+                if(forget_file(filename, changes))
+                {
+                    changed = true;
+                }
+            }
+            else if(load_file(filename, changes))
+            {
+                changed = true;
+            }
+        }
+    }
+
+    return changed;
+}
+
+
+/** \brief Load all the flag files again.
+ *
+ * This function reads all the flag files as flag::load_flags() does and
+ * replaces the index. It is called by watch() and when inotify reports
+ * that some events were lost.
+ *
+ * The version is incremented once per flag which changed.
+ *
+ * \param[out] changes  If not nullptr, the flags which changed get added
+ * to this list. The lowered flags have their state set to STATE_DOWN.
+ *
+ * \return true if the set of flags changed.
+ */
+bool flag_index::rescan(flag::list_t * changes)
+{
+    if(f_path.empty())
+    {
+        return false;
+    }
+
+    snapdev::glob_to_list<std::list<std::string>> flag_filenames;
+    flag_filenames.read_path<
+          snapdev::glob_to_list_flag_t::GLOB_FLAG_NO_ESCAPE
+        , snapdev::glob_to_list_flag_t::GLOB_FLAG_EMPTY>(
+              f_path + "/*.flag");
+
+    flag_map_t flags;
+    stamp_map_t stamps;
+    for(auto const & filename : flag_filenames)
+    {
+        // invalid files get a stamp too, otherwise readers would never
+        // trust the snapshot
+        //
+        stamps[filename] = get_file_stamp(filename);
+        try
+        {
+            flags[filename] = std::make_shared<flag>(filename);
+        }
+        catch(std::exception const & e)
+        {
+            SNAP_LOG_WARNING
+                << "ignoring invalid flag file \""
+                << filename
+                << "\": "
+                << e.what()
+                << SNAP_LOG_SEND;
+        }
+    }
+
+    // each flag which was raised, updated, or lowered counts as one change
+    //
+    bool changed(false);
+    for(auto const & f : flags)
+    {
+        auto const old(f_flags.find(f.first));
+        if(old == f_flags.end()
+        || old->second->get_parameters() != f.second->get_parameters())
+        {
+            changed = true;
+            ++f_version;
+            if(changes != nullptr)
+            {
+                changes->push_back(f.second);
+            }
+        }
+    }
+    for(auto const & f : f_flags)
+    {
+        if(flags.find(f.first) == flags.end())
+        {
+            changed = true;
+            ++f_version;
+            f.second->set_state(flag::state_t::STATE_DOWN);
+            if(changes != nullptr)
+            {
+                changes->push_back(f.second);
+            }
+        }
+    }
+
+    f_flags.swap(flags);
+    f_stamps.swap(stamps);
+
+    return changed;
+}
+
+
+/** \brief Reload one flag file.
+ *
+ * This function parses \p filename again and replaces its flag in the
+ * index. If the file cannot be loaded (i.e. it was already deleted or
+ * it is invalid), the flag is removed from the index instead.
+ *
+ * \param[in] filename  The full path to the flag file.
+ * \param[out] changes  The list where the changed flag gets added.
+ *
+ * \return true if the index changed.
+ */
+bool flag_index::load_file(std::string const & filename, flag::list_t * changes)
+{
+    // get the stamp first, if the file changes while we read it, the
+    // snapshot stamp will not match and readers fall back to the files
+    //
+    std::string const stamp(get_file_stamp(filename));
+
+    flag::pointer_t f;
+    try
+    {
+        f = std::make_shared<flag>(filename);
+    }
+    catch(std::exception const & e)
+    {
+        SNAP_LOG_WARNING
+            << "ignoring invalid flag file \""
+            << filename
+            << "\": "
+            << e.what()
+            << SNAP_LOG_SEND;
+        bool const changed(forget_file(filename, changes));
+        if(!stamp.empty())
+        {
+            f_stamps[filename] = stamp;
+        }
+        return changed;
+    }
+
+    f_stamps[filename] = stamp;
+    f_flags[filename] = f;
+    ++f_version;
+    if(changes != nullptr)
+    {
+        changes->push_back(f);
+    }
+
+    return true;
+}
+
+
+/** \brief Remove one flag from the index.
+ *
+ * \param[in] filename  The full path to the flag file which was deleted.
+ * \param[out] changes  The list where the lowered flag gets added.
+ *
+ * \return true if the flag was in the index.
+ */
+bool flag_index::forget_file(std::string const & filename, flag::list_t * changes)
+{
+    f_stamps.erase(filename);
+
+    auto const it(f_flags.find(filename));
+    if(it == f_flags.end())
+    {
+        return false;
+    }
+
+    it->second->set_state(flag::state_t::STATE_DOWN);
+    if(changes != nullptr)
+    {
+        changes->push_back(it->second);
+    }
+    f_flags.erase(it);
+    ++f_version;
+
+    return true;
+}
+
+
+/** \brief Retrieve the current list of flags.
+ *
+ * The list is sorted by filename, the same as flag::load_flags(), and
+ * limited to flag::FLAGS_LIMIT entries.
+ *
+ * \return The list of flags currently raised.
+ */
+flag::list_t flag_index::get_flags() const
+{
+    flag::list_t result;
+    for(auto const & f : f_flags)
+    {
+        result.push_back(f.second);
+    }
+    limit_flags(result, f_path);
+    return result;
+}
+
+
+/** \brief Get the number of flags in the index.
+ *
+ * Unlike the list returned by get_flags(), this number is not limited.
+ *
+ * \return The number of flags currently raised.
+ */
+std::size_t flag_index::size() const
+{
+    return f_flags.size();
+}
+
+
+/** \brief Get the version of the index.
+ *
+ * The version is incremented each time a flag is raised, updated,
+ * or lowered.
+ *
+ * \return The current version of the index.
+ */
+std::uint64_t flag_index::get_version() const
+{
+    return f_version;
+}
+
+
+/** \brief Get a snapshot of all the flags in the index.
+ *
+ * Unlike get_flags(), the snapshot is not limited to flag::FLAGS_LIMIT
+ * entries.
+ *
+ * \return The snapshot as created by flag::to_snapshot().
+ */
+std::string flag_index::get_snapshot() const
+{
+    flag::list_t flags;
+    for(auto const & f : f_flags)
+    {
+        flags.push_back(f.second);
+    }
+    return flag::to_snapshot(flags);
+}
+
+
+/** \brief Save the current flags in the snapshot file.
+ *
+ * This function saves all the flags in one file which flag::load_flags()
+ * reads instead of the flag files. The snapshot is first written to a
+ * temporary file and then renamed so a reader never sees a partial file.
+ *
+ * The header includes the size and modification time of each flag file
+ * as they were when the index loaded them. Readers compare these stamps
+ * with the files to detect a stale snapshot.
+ *
+ * \return true if the snapshot was saved.
+ */
+bool flag_index::save_snapshot() const
+{
+    if(f_path.empty())
+    {
+        return false;
+    }
+
+    std::string const filename(get_snapshot_filename());
+    std::string const tmp(filename + ".tmp");
+    {
+        std::ofstream out(tmp);
+        if(!out.is_open())
+        {
+            SNAP_LOG_ERROR
+                << "could not create the flags snapshot \""
+                << tmp
+                << "\"."
+                << SNAP_LOG_SEND;
+            return false;
+        }
+
+        out << "# communicatord flags snapshot -- do not edit\n"
+            << "version=" << f_version << '\n';
+        for(auto const & s : f_stamps)
+        {
+            out << g_snapshot_file_prefix << s.second << ' ' << s.first << '\n';
+        }
+        out << get_snapshot();
+
+        out.close();
+        if(out.fail())
+        {
+            SNAP_LOG_ERROR
+                << "could not write the flags snapshot \""
+                << tmp
+                << "\"."
+                << SNAP_LOG_SEND;
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+
+    if(rename(tmp.c_str(), filename.c_str()) != 0)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "could not rename the flags snapshot \""
+            << tmp
+            << "\": "
+            << e
+            << ", "
+            << strerror(e)
+            << SNAP_LOG_SEND;
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+/** \brief Delete the snapshot file.
+ *
+ * The daemon calls this function when it stops so the other tools go
+ * back to reading the flag files.
+ */
+void flag_index::remove_snapshot() const
+{
+    if(!f_path.empty())
+    {
+        unlink(get_snapshot_filename().c_str());
+    }
+}
+
+
+
 } // namespace communicatord
 // vim: ts=4 sw=4 et
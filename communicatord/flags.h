@@ -24,6 +24,9 @@
 
 // C++
 //
+#include    <cstdint>
+#include    <list>
+#include    <map>
 #include    <memory>
 #include    <set>
 #include    <source_location>
@@ -47,6 +50,7 @@ public:
     typedef std::list<pointer_t>                list_t;
 
     typedef std::set<std::string>               tag_list_t;
+    typedef std::map<std::string, std::string>  parameters_t;
 
     static constexpr std::size_t                FLAGS_LIMIT = 100;
 
@@ -62,6 +66,7 @@ public:
                                     , std::string const & name
                                     , std::source_location const & location = std::source_location::current());
                                 flag(std::string const & filename);
+                                flag(parameters_t const & parameters);
 
     flag &                      set_from_raise_flag(); // only raise-flag tool should call this
     flag &                      set_state(state_t state);
@@ -94,14 +99,19 @@ public:
     int                         get_count() const;
     std::string const &         get_version() const;
     std::string                 to_string() const;
+    parameters_t                get_parameters() const;
 
     bool                        save();
 
     static list_t               load_flags();
+    static std::string          to_snapshot(list_t const & flags);
+    static bool                 from_snapshot(std::string const & snapshot, list_t & flags);
+    static bool                 load_snapshot(std::string const & path, list_t & flags);
 
 private:
     static void                 valid_name(std::string & name);
     bool                        remove(std::string const & filename);
+    void                        set_parameters(parameters_t const & parameters);
 
     state_t                     f_state             = state_t::STATE_UP;
     std::string                 f_unit              = std::string();
@@ -127,6 +137,49 @@ private:
 
 
 
+class flag_index
+{
+public:
+    typedef std::shared_ptr<flag_index>         pointer_t;
+
+                                flag_index(std::string const & path = std::string());
+                                flag_index(flag_index const &) = delete;
+                                ~flag_index();
+    flag_index &                operator = (flag_index const &) = delete;
+
+    std::string const &         get_path() const;
+    std::string                 get_snapshot_filename() const;
+
+    bool                        watch();
+    int                         get_socket() const;
+    bool                        process_events(flag::list_t * changes = nullptr);
+    bool                        rescan(flag::list_t * changes = nullptr);
+
+    flag::list_t                get_flags() const;
+    std::size_t                 size() const;
+    std::uint64_t               get_version() const;
+    std::string                 get_snapshot() const;
+
+    bool                        save_snapshot() const;
+    void                        remove_snapshot() const;
+
+private:
+    typedef std::map<std::string, flag::pointer_t>  flag_map_t;
+    typedef std::map<std::string, std::string>      stamp_map_t;
+
+    bool                        load_file(std::string const & filename, flag::list_t * changes);
+    bool                        forget_file(std::string const & filename, flag::list_t * changes);
+
+    std::string                 f_path              = std::string();
+    int                         f_inotify           = -1;
+    flag_map_t                  f_flags             = flag_map_t();
+    stamp_map_t                 f_stamps            = stamp_map_t();
+    std::uint64_t               f_version           = 0;
+};
+
+
+
+
 #define COMMUNICATORD_FLAG_UP(unit, section, name, message)   \
             std::make_shared<communicatord::flag>( \
                 communicatord::flag(unit, section, name) \
@@ -42,13 +42,18 @@
 // C++
 //
 #include    <algorithm>
+#include    <atomic>
+#include    <cstring>
 #include    <memory>
+#include    <new>
+#include    <random>
 
 
 // C
 //
 #include    <fcntl.h>
 #include    <sys/file.h>
+#include    <sys/mman.h>
 #include    <sys/stat.h>
 #include    <sys/types.h>
 #include    <unistd.h>
@@ -69,121 +74,470 @@ namespace
 
 
 
+// version 2 is the memory mapped table; version 1 was a sequential file
+// of loadavg_item structures which was read and written with one system
+// call per item
+//
+constexpr std::uint16_t const   LOADAVG_VERSION = 2;
 
+// the number of times a reader retries reading a slot being modified;
+// if the daemon dies in the middle of an update, the slot remains odd
+// forever and we do not want readers to spin
+//
+constexpr int const             LOADAVG_MAX_READ_ATTEMPTS = 1000;
 
 
-int const LOADAVG_VERSION = 1;
+struct alignas(64) loadavg_header
+{
+    char                        f_name[4]{'L', 'A', 'V', 'G'};  // 'LAVG'
+    std::uint16_t               f_version = LOADAVG_VERSION;    // 1+ representing the version
+    std::uint16_t               f_reserved = 0;
+    std::uint32_t               f_slots = 0;
+};
 
-struct loadavg_magic
+
+struct alignas(64) loadavg_slot
 {
-    char                    f_name[4]{'L', 'A', 'V', 'G'};  // 'LAVG'
-    uint16_t                f_version = LOADAVG_VERSION;    // 1+ representing the version
+    std::atomic<std::uint32_t>  f_sequence{0};                  // odd while the slot is being written
+    std::uint32_t               f_used = 0;
+    loadavg_item                f_item = loadavg_item();
 };
 
 
+std::size_t area_size(std::size_t slots)
+{
+    return sizeof(loadavg_header) + sizeof(loadavg_slot) * slots;
+}
+
+
+loadavg_slot * get_slot(void * area, std::size_t idx)
+{
+    return reinterpret_cast<loadavg_slot *>(reinterpret_cast<char *>(area) + sizeof(loadavg_header)) + idx;
+}
+
+
+/** \brief Compute the hash of an address.
+ *
+ * The table is keyed by the IPv6 address and port. The FNV-1a hash
+ * of these bytes gives us the first slot to probe.
+ *
+ * \param[in] addr  The address to hash.
+ *
+ * \return The hash of \p addr.
+ */
+std::size_t hash_address(struct sockaddr_in6 const & addr)
+{
+    std::uint64_t h(14695981039346656037ULL);
+    std::uint8_t const * s(reinterpret_cast<std::uint8_t const *>(&addr.sin6_addr));
+    for(std::size_t i(0); i < sizeof(addr.sin6_addr); ++i)
+    {
+        h = (h ^ s[i]) * 1099511628211ULL;
+    }
+    h = (h ^ (addr.sin6_port & 0xFF)) * 1099511628211ULL;
+    h = (h ^ (addr.sin6_port >> 8)) * 1099511628211ULL;
+    return h;
+}
+
+
+/** \brief Read one slot without locking.
+ *
+ * The reader copies the slot and then verifies that the sequence counter
+ * did not change and was even (i.e. no write happened in between). If
+ * it changed, the copy is retried.
+ *
+ * \param[in] slot  The slot to read.
+ * \param[out] item  The copy of the item.
+ *
+ * \return true if the slot holds an item.
+ */
+bool read_slot(loadavg_slot const * slot, loadavg_item & item)
+{
+    for(int attempt(0); attempt < LOADAVG_MAX_READ_ATTEMPTS; ++attempt)
+    {
+        std::uint32_t const before(slot->f_sequence.load(std::memory_order_acquire));
+        if((before & 1) != 0)
+        {
+            continue;
+        }
+        std::uint32_t const used(slot->f_used);
+        memcpy(&item, &slot->f_item, sizeof(item));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot->f_sequence.load(std::memory_order_relaxed) == before)
+        {
+            return used != 0;
+        }
+    }
+
+    return false;
+}
+
+
+/** \brief Claim one slot for writing.
+ *
+ * The daemon and loadavg_file::save() may both write to the table.
+ * A writer claims a slot by changing its even sequence counter to an
+ * odd value. Readers retry while the counter is odd and other writers
+ * wait for it to become even again.
+ *
+ * If the counter remains odd for too long, the writer which claimed
+ * the slot is assumed dead and the slot gets taken over.
+ *
+ * \param[in] slot  The slot to claim.
+ *
+ * \return The odd sequence counter to pass to release_slot().
+ */
+std::uint32_t claim_slot(loadavg_slot * slot)
+{
+    std::uint32_t sequence(slot->f_sequence.load(std::memory_order_relaxed));
+    for(int attempt(0); attempt < LOADAVG_MAX_READ_ATTEMPTS; ++attempt)
+    {
+        if((sequence & 1) == 0
+        && slot->f_sequence.compare_exchange_weak(
+                      sequence
+                    , sequence + 1
+                    , std::memory_order_acq_rel
+                    , std::memory_order_relaxed))
+        {
+            return sequence + 1;
+        }
+        sequence = slot->f_sequence.load(std::memory_order_relaxed);
+    }
+
+    sequence |= 1;
+    slot->f_sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return sequence;
+}
+
+
+/** \brief Release a slot claimed with claim_slot().
+ *
+ * This function makes the sequence counter even again so readers
+ * accept the new content of the slot.
+ *
+ * \param[in] slot  The slot to release.
+ * \param[in] sequence  The value returned by claim_slot().
+ */
+void release_slot(loadavg_slot * slot, std::uint32_t sequence)
+{
+    slot->f_sequence.store(sequence + 1, std::memory_order_release);
+}
+
+
 } // no name namespace
 
 
-bool loadavg_file::load()
+
+/** \brief Release the table.
+ *
+ * The destructor makes sure the table gets unmapped.
+ */
+loadavg_table::~loadavg_table()
 {
-    // open the file
-    //
-    snapdev::raii_fd_t safe_fd(open(get_loadavg_path().c_str(), O_RDONLY));
-    if(!safe_fd)
+    close();
+}
+
+
+/** \brief Map the load average table in memory.
+ *
+ * The table is a file composed of a header followed by \p slots slots.
+ * Each slot holds the load average of one computer. The slots are
+ * found using open addressing keyed by the IP address of the computer.
+ *
+ * The communicator daemon opens the table in \p writable mode. If the
+ * file does not exist or is not a valid table, it gets created with
+ * \p slots slots. An existing table keeps its size so readers never
+ * see the file shrink under their feet. Several writers can have the
+ * table open at the same time since each update claims its slot (see
+ * loadavg_file::save()).
+ *
+ * The file is locked only while its header gets verified or created;
+ * exclusively by writers and shared by readers. Once mapped, the
+ * table is accessed without locks.
+ *
+ * Clients open the table in read-only mode. The \p slots parameter is
+ * ignored in that case.
+ *
+ * \param[in] writable  Whether the table gets updated by this process.
+ * \param[in] slots  The number of slots of a new table.
+ *
+ * \return true if the table is now mapped.
+ */
+bool loadavg_table::open(bool writable, std::size_t slots)
+{
+    close();
+
+    if(slots == 0)
     {
         return false;
     }
 
-    // lock the file in share mode (multiple read, no writes)
-    //
-    if(flock(safe_fd.get(), LOCK_SH) != 0)
+    snapdev::raii_fd_t safe_fd(::open(
+              get_loadavg_path().c_str()
+            , writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC
+            , S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH));
+    if(!safe_fd)
     {
         return false;
     }
 
-    // verify the magic
-    //
-    loadavg_magic magic;
-    if(read(safe_fd.get(), &magic, sizeof(magic)) != sizeof(magic))
+    if(flock(safe_fd.get(), writable ? LOCK_EX : LOCK_SH) != 0)
     {
         return false;
     }
-    if(magic.f_name[0] != 'L'
-    || magic.f_name[1] != 'A'
-    || magic.f_name[2] != 'V'
-    || magic.f_name[3] != 'G'
-    || magic.f_version != LOADAVG_VERSION)
+
+    struct stat st = {};
+    if(fstat(safe_fd.get(), &st) != 0)
     {
         return false;
     }
 
-    // load each item
-    //
-    for(;;)
+    loadavg_header header;
+    bool valid(static_cast<std::size_t>(st.st_size) >= sizeof(header)
+            && pread(safe_fd.get(), &header, sizeof(header), 0) == sizeof(header)
+            && header.f_name[0] == 'L'
+            && header.f_name[1] == 'A'
+            && header.f_name[2] == 'V'
+            && header.f_name[3] == 'G'
+            && header.f_version == LOADAVG_VERSION
+            && header.f_slots > 0
+            && static_cast<std::size_t>(st.st_size) >= area_size(header.f_slots));
+    if(valid)
     {
-        loadavg_item item;
-        ssize_t const r(read(safe_fd.get(), &item, sizeof(item)));
-        if(r < 0)
+        slots = header.f_slots;
+    }
+    else
+    {
+        if(!writable)
         {
             return false;
         }
-        if(r == 0)
+
+        // a new file or an old version, start from scratch
+        //
+        if(ftruncate(safe_fd.get(), 0) != 0
+        || ftruncate(safe_fd.get(), area_size(slots)) != 0)
         {
-            // we got EOF
-            break;
+            return false;
         }
-        f_items.push_back(item);
     }
 
-    // it worked
+    std::size_t const size(area_size(slots));
+    void * area(mmap(
+              nullptr
+            , size
+            , writable ? PROT_READ | PROT_WRITE : PROT_READ
+            , MAP_SHARED
+            , safe_fd.get()
+            , 0));
+    if(area == MAP_FAILED)
+    {
+        return false;
+    }
+
+    if(!valid)
+    {
+        // the file was just truncated so it is all zeroes, which is
+        // what the slots expect; only the header needs to be written
+        //
+        loadavg_header * h(new (area) loadavg_header);
+        h->f_slots = slots;
+    }
+
+    f_area = area;
+    f_area_size = size;
+    f_slots = slots;
+    f_writable = writable;
+
+    // the mapping keeps the open file description alive so closing
+    // safe_fd would not release the lock
     //
+    flock(safe_fd.get(), LOCK_UN);
+
     return true;
 }
 
 
-bool loadavg_file::save() const
+/** \brief Unmap the table.
+ *
+ * This function releases the table. It is safe to call it on a table
+ * which is not open.
+ */
+void loadavg_table::close()
 {
-    // open the file
-    //
-    snapdev::raii_fd_t safe_fd(open(get_loadavg_path().c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH));
-    if(!safe_fd)
+    if(f_area != nullptr)
     {
-        return false;
+        munmap(f_area, f_area_size);
+        f_area = nullptr;
+        f_area_size = 0;
+        f_slots = 0;
     }
+    f_writable = false;
+}
 
-    // lock the file in share mode (multiple read, no writes)
-    //
-    if(flock(safe_fd.get(), LOCK_EX) != 0)
+
+/** \brief Check whether the table is mapped.
+ *
+ * \return true if open() succeeded.
+ */
+bool loadavg_table::is_open() const
+{
+    return f_area != nullptr;
+}
+
+
+/** \brief Get the number of slots in the table.
+ *
+ * \return The maximum number of computers the table can hold.
+ */
+std::size_t loadavg_table::get_slots() const
+{
+    return f_slots;
+}
+
+
+/** \brief Add or update the load average of a computer.
+ *
+ * This function saves \p item in the slot of its address. The cost
+ * is a few atomic operations and memory stores; no system call is
+ * involved.
+ *
+ * Each probed slot is claimed before it gets checked so two writers
+ * cannot both take the same free slot for different computers.
+ *
+ * \param[in] item  The load average of a computer.
+ *
+ * \return false if the table is not writable or full.
+ */
+bool loadavg_table::update(loadavg_item const & item)
+{
+    if(!f_writable)
     {
         return false;
     }
 
-    // write the magic each time (in case the version changed
-    // or we are creating a new file)
-    //
-    loadavg_magic magic;
-    if(write(safe_fd.get(), &magic, sizeof(magic)) != sizeof(magic))
+    std::size_t const start(hash_address(item.f_address) % f_slots);
+    for(std::size_t probe(0); probe < f_slots; ++probe)
+    {
+        loadavg_slot * slot(get_slot(f_area, (start + probe) % f_slots));
+        std::uint32_t const sequence(claim_slot(slot));
+        bool const match(slot->f_used == 0
+                      || slot->f_item.f_address == item.f_address);
+        if(match)
+        {
+            slot->f_used = 1;
+            memcpy(&slot->f_item, &item, sizeof(item));
+        }
+        release_slot(slot, sequence);
+        if(match)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/** \brief Search the load average of a computer.
+ *
+ * \param[in] addr  The address of the computer.
+ * \param[out] item  The load average of that computer.
+ *
+ * \return true if the computer was found.
+ */
+bool loadavg_table::find(struct sockaddr_in6 const & addr, loadavg_item & item) const
+{
+    if(f_area == nullptr)
     {
         return false;
     }
 
-    // write each item
-    //
-    for(auto const & item : f_items)
+    std::size_t const start(hash_address(addr) % f_slots);
+    for(std::size_t probe(0); probe < f_slots; ++probe)
     {
-        ssize_t const r(write(safe_fd.get(), &item, sizeof(item)));
-        if(r < 0)
+        if(!read_slot(get_slot(f_area, (start + probe) % f_slots), item))
         {
+            // slots are never freed so an empty slot ends the search
+            //
             return false;
         }
+        if(item.f_address == addr)
+        {
+            return true;
+        }
     }
 
-    // it worked
-    //
+    return false;
+}
+
+
+/** \brief Copy all the items of the table.
+ *
+ * This function appends a copy of each used slot to \p items.
+ *
+ * \param[in,out] items  The vector where the items get added.
+ */
+void loadavg_table::snapshot(loadavg_item::vector_t & items) const
+{
+    loadavg_item item;
+    for(std::size_t idx(0); idx < f_slots; ++idx)
+    {
+        if(read_slot(get_slot(f_area, idx), item))
+        {
+            items.push_back(item);
+        }
+    }
+}
+
+
+
+/** \brief Load the load average of all the computers.
+ *
+ * This function takes a snapshot of the load average table.
+ *
+ * \return true if the table could be read.
+ */
+bool loadavg_file::load()
+{
+    loadavg_table table;
+    if(!table.open(false))
+    {
+        return false;
+    }
+    table.snapshot(f_items);
     return true;
 }
 
 
+/** \brief Save the items to the load average table.
+ *
+ * This function updates the table with all the items. It requires
+ * write access to the file. It works while the communicator daemon
+ * has the table open since the slots are claimed one at a time.
+ *
+ * \return true if all the items were saved.
+ */
+bool loadavg_file::save() const
+{
+    loadavg_table table;
+    if(!table.open(true))
+    {
+        return false;
+    }
+
+    bool result(true);
+    for(auto const & item : f_items)
+    {
+        if(!table.update(item))
+        {
+            result = false;
+        }
+    }
+    return result;
+}
+
+
 void loadavg_file::add(loadavg_item const & new_item)
 {
     auto const & it(std::find_if(
@@ -221,15 +575,18 @@ void loadavg_file::add(loadavg_item const & new_item)
  * the least busy system to connect to:
  *
  * \code
- *      snap::loadavg_file avg;
+ *      communicatord::loadavg_file avg;
  *      avg.load();
- *      if(avg.remove_old_entries(10))
- *      {
- *          avg.save();
- *      }
- *      snap::loadavg_item const * item(avg.find_least_busy());
+ *      communicatord::loadavg_item const * item(avg.select(10));
  * \endcode
  *
+ * The select() function ignores the old entries by itself and picks
+ * one of the least busy computers at random so all the clients do not
+ * send their work to the same computer.
+ *
+ * The entries are only removed from this loadavg_file object. The
+ * table itself keeps all the computers and their last timestamp.
+ *
  * \param[in] how_old  The number of seconds after which an entry
  *                     is considered too old to be kept around.
  *
@@ -295,6 +652,7 @@ loadavg_item const * loadavg_file::find(struct sockaddr_in6 const & addr) const
  * \return The least busy server or nullptr if no server is available.
  *
  * \sa remove_old_entries()
+ * \sa select()
  */
 loadavg_item const * loadavg_file::find_least_busy() const
 {
@@ -315,6 +673,117 @@ loadavg_item const * loadavg_file::find_least_busy() const
 }
 
 
+/** \brief Select a server to send work to.
+ *
+ * All the clients reading the same snapshot would pick the same
+ * computer with find_least_busy() until the next LOADAVG update, which
+ * overloads that one computer. This function instead spreads the load
+ * using one of the following \p method:
+ *
+ * \li LOADAVG_SELECTION_LEAST_BUSY -- the lowest load, like
+ *     find_least_busy();
+ * \li LOADAVG_SELECTION_TWO_CHOICES -- pick two entries at random and
+ *     keep the least busy of the two (the power of two choices);
+ * \li LOADAVG_SELECTION_WEIGHTED_RANDOM -- pick an entry at random, the
+ *     probability being inversely proportional to its load.
+ *
+ * Entries older than \p max_age seconds and entries whose address is
+ * in \p exclude (i.e. computers that already failed the request) are
+ * ignored.
+ *
+ * \param[in] max_age  The maximum age of an entry in seconds, 0 or less
+ * to keep all the entries.
+ * \param[in] exclude  Addresses of computers to ignore.
+ * \param[in] method  The selection method.
+ *
+ * \return The selected server or nullptr if no server is available.
+ */
+loadavg_item const * loadavg_file::select(
+      int max_age
+    , std::vector<struct sockaddr_in6> const & exclude
+    , loadavg_selection_t method) const
+{
+    snapdev::timespec_ex const oldest(snapdev::now() - snapdev::timespec_ex(std::max(0, max_age), 0));
+    std::vector<loadavg_item const *> candidates;
+    candidates.reserve(f_items.size());
+    for(auto const & item : f_items)
+    {
+        if(max_age > 0
+        && snapdev::timespec_ex(item.f_timestamp) < oldest)
+        {
+            continue;
+        }
+        if(std::find_if(
+                  exclude.begin()
+                , exclude.end()
+                , [&item](auto const & addr)
+                  {
+                      return item.f_address == addr;
+                  }) != exclude.end())
+        {
+            continue;
+        }
+        candidates.push_back(&item);
+    }
+
+    if(candidates.empty())
+    {
+        return nullptr;
+    }
+
+    thread_local std::mt19937 generator(std::random_device{}());
+    switch(method)
+    {
+    case loadavg_selection_t::LOADAVG_SELECTION_TWO_CHOICES:
+        {
+            if(candidates.size() == 1)
+            {
+                return candidates[0];
+            }
+
+            // pick two different entries
+            //
+            std::size_t const first(std::uniform_int_distribution<std::size_t>(0, candidates.size() - 1)(generator));
+            std::size_t second(std::uniform_int_distribution<std::size_t>(0, candidates.size() - 2)(generator));
+            if(second >= first)
+            {
+                ++second;
+            }
+            loadavg_item const * a(candidates[first]);
+            loadavg_item const * b(candidates[second]);
+            return b->f_avg < a->f_avg ? b : a;
+        }
+
+    case loadavg_selection_t::LOADAVG_SELECTION_WEIGHTED_RANDOM:
+        {
+            // the small offset avoids a division by zero and keeps a
+            // computer with no load from getting all the work
+            //
+            std::vector<double> weights;
+            weights.reserve(candidates.size());
+            for(auto const * c : candidates)
+            {
+                weights.push_back(1.0 / (std::max(0.0f, c->f_avg) + 0.05));
+            }
+            std::discrete_distribution<std::size_t> pick(weights.begin(), weights.end());
+            return candidates[pick(generator)];
+        }
+
+    case loadavg_selection_t::LOADAVG_SELECTION_LEAST_BUSY:
+        break;
+
+    }
+
+    return *std::min_element(
+              candidates.begin()
+            , candidates.end()
+            , [](auto const * a, auto const * b)
+              {
+                  return a->f_avg < b->f_avg;
+              });
+}
+
+
 namespace
 {
 
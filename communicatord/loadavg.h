@@ -24,6 +24,7 @@
 
 // C++
 //
+#include    <memory>
 #include    <string>
 #include    <vector>
 
@@ -51,6 +52,45 @@ struct loadavg_item
 
 
 
+enum class loadavg_selection_t
+{
+    LOADAVG_SELECTION_LEAST_BUSY,           // always the lowest load
+    LOADAVG_SELECTION_TWO_CHOICES,          // least busy of two random entries
+    LOADAVG_SELECTION_WEIGHTED_RANDOM,      // random, weighted by the inverse of the load
+};
+
+
+
+class loadavg_table
+{
+public:
+    typedef std::shared_ptr<loadavg_table>  pointer_t;
+
+    static constexpr std::size_t const      DEFAULT_SLOTS = 1024;
+
+                                loadavg_table() = default;
+                                loadavg_table(loadavg_table const &) = delete;
+                                ~loadavg_table();
+    loadavg_table &             operator = (loadavg_table const &) = delete;
+
+    bool                        open(bool writable, std::size_t slots = DEFAULT_SLOTS);
+    void                        close();
+    bool                        is_open() const;
+    std::size_t                 get_slots() const;
+
+    bool                        update(loadavg_item const & item);
+    bool                        find(struct sockaddr_in6 const & addr, loadavg_item & item) const;
+    void                        snapshot(loadavg_item::vector_t & items) const;
+
+private:
+    void *                      f_area = nullptr;
+    std::size_t                 f_area_size = 0;
+    std::size_t                 f_slots = 0;
+    bool                        f_writable = false;
+};
+
+
+
 class loadavg_file
 {
 public:
@@ -61,6 +101,10 @@ public:
     bool                        remove_old_entries(int how_old);
     loadavg_item const *        find(struct sockaddr_in6 const & addr) const;
     loadavg_item const *        find_least_busy() const;
+    loadavg_item const *        select(
+                                      int max_age = 10
+                                    , std::vector<struct sockaddr_in6> const & exclude = std::vector<struct sockaddr_in6>()
+                                    , loadavg_selection_t method = loadavg_selection_t::LOADAVG_SELECTION_TWO_CHOICES) const;
 
 private:
     loadavg_item::vector_t      f_items = loadavg_item::vector_t();
@@ -0,0 +1,615 @@
+// Copyright (c) 2013-2024  Made to Order Software Corp.  All Rights Reserved.
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the shared memory channel.
+ *
+ * The communicatord creates a memfd with two rings:
+ *
+ * \code
+ *     area: channel_header ring(client to daemon) ring(daemon to client)
+ *     ring: ring_header data[ring_size]
+ *     data: (uint32_t length, bytes)*
+ * \endcode
+ *
+ * and two eventfd, one per side. The descriptors are sent to the service
+ * over a Unix socket (SCM_RIGHTS) after the service requested them with
+ * an SHM_REQUEST message.
+ *
+ * The wake up of the other side only happens when that side said it was
+ * going to sleep (f_reader_sleeping) or was waiting for space in a full
+ * ring (f_writer_waiting). Under load, messages go through the rings
+ * without any system call.
+ *
+ * The other side is not trusted: all the positions read from the shared
+ * memory are verified and a channel with invalid positions is marked as
+ * invalid.
+ */
+
+// self
+//
+#include    "communicatord/shm_channel.h"
+
+
+// C++
+//
+#include    <algorithm>
+#include    <atomic>
+#include    <cstring>
+#include    <new>
+
+
+// C
+//
+#include    <fcntl.h>
+#include    <sys/eventfd.h>
+#include    <sys/mman.h>
+#include    <sys/socket.h>
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicatord
+{
+
+
+namespace
+{
+
+
+
+constexpr std::uint32_t const       SHM_CHANNEL_VERSION = 1;
+constexpr std::size_t const         SHM_DESCRIPTOR_COUNT = 3;
+
+
+struct alignas(64) channel_header
+{
+    char                            f_magic[4]{'C', 'D', 'M', 'R'};     // 'CDMR'
+    std::uint32_t                   f_version = SHM_CHANNEL_VERSION;
+    std::uint64_t                   f_ring_size = 0;
+};
+
+
+struct alignas(64) ring_header
+{
+    alignas(64) std::atomic<std::uint64_t>  f_head{0};                  // written by the producer
+    alignas(64) std::atomic<std::uint64_t>  f_tail{0};                  // written by the consumer
+    alignas(64) std::atomic<std::uint32_t>  f_reader_sleeping{1};
+    std::atomic<std::uint32_t>              f_writer_waiting{0};
+};
+
+
+std::size_t area_size(std::size_t ring_size)
+{
+    return sizeof(channel_header) + (sizeof(ring_header) + ring_size) * 2;
+}
+
+
+ring_header * get_ring(void * area, std::size_t ring_size, int idx)
+{
+    return reinterpret_cast<ring_header *>(
+              reinterpret_cast<char *>(area)
+            + sizeof(channel_header)
+            + (sizeof(ring_header) + ring_size) * idx);
+}
+
+
+char * get_data(ring_header * ring)
+{
+    return reinterpret_cast<char *>(ring + 1);
+}
+
+
+void copy_in(char * data, std::size_t ring_size, std::uint64_t pos, void const * src, std::size_t size)
+{
+    std::size_t const offset(pos & (ring_size - 1));
+    std::size_t const first(std::min(size, ring_size - offset));
+    memcpy(data + offset, src, first);
+    memcpy(data, reinterpret_cast<char const *>(src) + first, size - first);
+}
+
+
+void copy_out(char const * data, std::size_t ring_size, std::uint64_t pos, void * dst, std::size_t size)
+{
+    std::size_t const offset(pos & (ring_size - 1));
+    std::size_t const first(std::min(size, ring_size - offset));
+    memcpy(dst, data + offset, first);
+    memcpy(reinterpret_cast<char *>(dst) + first, data, size - first);
+}
+
+
+void close_fd(int & fd)
+{
+    if(fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+
+
+} // no name namespace
+
+
+
+/** \class shm_channel
+ * \brief A pair of rings in shared memory.
+ *
+ * The daemon side creates the channel with create() and sends the
+ * descriptors with send_descriptors(). The client side gets the channel
+ * with receive_descriptors().
+ *
+ * Each side polls its get_wakeup_fd() descriptor. When it wakes up, it
+ * calls clear_wakeup(), receive() until it returns false, flush() and
+ * finally prepare_to_sleep(). If prepare_to_sleep() returns false, new
+ * messages arrived in the meantime and the side has to loop.
+ */
+
+
+shm_channel::shm_channel(side_t side)
+    : f_side(side)
+{
+}
+
+
+/** \brief Release the shared memory and the descriptors.
+ */
+shm_channel::~shm_channel()
+{
+    if(f_area != nullptr)
+    {
+        munmap(f_area, f_area_size);
+    }
+    close_fd(f_memfd);
+    close_fd(f_daemon_fd);
+    close_fd(f_client_fd);
+}
+
+
+/** \brief Create a new channel.
+ *
+ * This function is used by the communicatord. The \p ring_size is
+ * rounded up to a power of two.
+ *
+ * \param[in] ring_size  The size of each ring in bytes.
+ *
+ * \return The new channel or nullptr if it could not be created.
+ */
+shm_channel::pointer_t shm_channel::create(std::size_t ring_size)
+{
+    std::size_t size(4096);
+    while(size < ring_size)
+    {
+        size *= 2;
+    }
+
+    pointer_t channel(new shm_channel(side_t::SIDE_DAEMON));
+    channel->f_memfd = memfd_create("communicatord-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(channel->f_memfd == -1
+    || ftruncate(channel->f_memfd, area_size(size)) != 0)
+    {
+        return pointer_t();
+    }
+
+    // the service must not be able to resize the area under our feet
+    //
+    fcntl(channel->f_memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    channel->f_daemon_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    channel->f_client_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(channel->f_daemon_fd == -1
+    || channel->f_client_fd == -1)
+    {
+        return pointer_t();
+    }
+
+    void * area(mmap(nullptr, area_size(size), PROT_READ | PROT_WRITE, MAP_SHARED, channel->f_memfd, 0));
+    if(area == MAP_FAILED)
+    {
+        return pointer_t();
+    }
+    channel_header * header(new (area) channel_header);
+    header->f_ring_size = size;
+    new (get_ring(area, size, 0)) ring_header;
+    new (get_ring(area, size, 1)) ring_header;
+    munmap(area, area_size(size));
+
+    if(!channel->map(channel->f_memfd, size))
+    {
+        return pointer_t();
+    }
+    return channel;
+}
+
+
+/** \brief Get a channel from the communicatord.
+ *
+ * This function is used by the client. It sends the \p token to the
+ * communicatord on \p socket (a connection to its shared memory socket)
+ * and receives the descriptors of the channel.
+ *
+ * \param[in] socket  A socket connected to the communicatord shared
+ * memory listener.
+ * \param[in] token  The token received in the SHM_READY message.
+ *
+ * \return The channel or nullptr if it could not be retrieved.
+ */
+shm_channel::pointer_t shm_channel::receive_descriptors(int socket, std::string const & token)
+{
+    std::string const request(token + '\n');
+    if(::send(socket, request.data(), request.length(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.length()))
+    {
+        return pointer_t();
+    }
+
+    char status(0);
+    iovec iov = {};
+    iov.iov_base = &status;
+    iov.iov_len = sizeof(status);
+    union
+    {
+        cmsghdr     f_align;
+        char        f_buffer[CMSG_SPACE(sizeof(int) * SHM_DESCRIPTOR_COUNT)];
+    } control = {};
+    msghdr m = {};
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+    m.msg_control = control.f_buffer;
+    m.msg_controllen = sizeof(control.f_buffer);
+    ssize_t const r(recvmsg(socket, &m, MSG_CMSG_CLOEXEC));
+
+    pointer_t channel(new shm_channel(side_t::SIDE_CLIENT));
+    cmsghdr * c(CMSG_FIRSTHDR(&m));
+    if(c != nullptr
+    && c->cmsg_level == SOL_SOCKET
+    && c->cmsg_type == SCM_RIGHTS
+    && c->cmsg_len == CMSG_LEN(sizeof(int) * SHM_DESCRIPTOR_COUNT))
+    {
+        int fds[SHM_DESCRIPTOR_COUNT];
+        memcpy(fds, CMSG_DATA(c), sizeof(fds));
+        channel->f_memfd = fds[0];
+        channel->f_daemon_fd = fds[1];
+        channel->f_client_fd = fds[2];
+    }
+    if(r != 1
+    || status != 'Y'
+    || channel->f_memfd == -1)
+    {
+        return pointer_t();
+    }
+
+    struct stat st = {};
+    channel_header header;
+    if(fstat(channel->f_memfd, &st) != 0
+    || pread(channel->f_memfd, &header, sizeof(header), 0) != sizeof(header)
+    || memcmp(header.f_magic, "CDMR", 4) != 0
+    || header.f_version != SHM_CHANNEL_VERSION
+    || header.f_ring_size < 4096
+    || (header.f_ring_size & (header.f_ring_size - 1)) != 0
+    || static_cast<std::size_t>(st.st_size) != area_size(header.f_ring_size))
+    {
+        return pointer_t();
+    }
+
+    if(!channel->map(channel->f_memfd, header.f_ring_size))
+    {
+        return pointer_t();
+    }
+    return channel;
+}
+
+
+/** \brief Send the descriptors of this channel to the client.
+ *
+ * The function sends the memfd and the two eventfd descriptors to the
+ * client connected on \p socket.
+ *
+ * \param[in] socket  The socket connected to the client.
+ *
+ * \return true if the descriptors were sent.
+ */
+bool shm_channel::send_descriptors(int socket) const
+{
+    char status('Y');
+    iovec iov = {};
+    iov.iov_base = &status;
+    iov.iov_len = sizeof(status);
+    union
+    {
+        cmsghdr     f_align;
+        char        f_buffer[CMSG_SPACE(sizeof(int) * SHM_DESCRIPTOR_COUNT)];
+    } control = {};
+    msghdr m = {};
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+    m.msg_control = control.f_buffer;
+    m.msg_controllen = sizeof(control.f_buffer);
+
+    cmsghdr * c(CMSG_FIRSTHDR(&m));
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * SHM_DESCRIPTOR_COUNT);
+    int const fds[SHM_DESCRIPTOR_COUNT] = { f_memfd, f_daemon_fd, f_client_fd };
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    return sendmsg(socket, &m, MSG_NOSIGNAL) == 1;
+}
+
+
+bool shm_channel::map(int memfd, std::size_t ring_size)
+{
+    f_area_size = area_size(ring_size);
+    f_area = mmap(nullptr, f_area_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if(f_area == MAP_FAILED)
+    {
+        f_area = nullptr;
+        return false;
+    }
+    f_ring_size = ring_size;
+
+    // ring 0 goes from the client to the daemon
+    //
+    int const input(f_side == side_t::SIDE_DAEMON ? 0 : 1);
+    f_input = get_ring(f_area, ring_size, input);
+    f_output = get_ring(f_area, ring_size, 1 - input);
+    f_valid = true;
+    return true;
+}
+
+
+/** \brief The descriptor to poll to know when to call receive().
+ *
+ * \return The eventfd of this side of the channel.
+ */
+int shm_channel::get_wakeup_fd() const
+{
+    return f_side == side_t::SIDE_DAEMON ? f_daemon_fd : f_client_fd;
+}
+
+
+/** \brief Reset the wake up descriptor.
+ */
+void shm_channel::clear_wakeup()
+{
+    eventfd_t value(0);
+    eventfd_read(get_wakeup_fd(), &value);
+}
+
+
+/** \brief Check whether the channel can still be used.
+ *
+ * A channel becomes invalid when the other side corrupted the rings.
+ *
+ * \return true if the channel is valid.
+ */
+bool shm_channel::is_valid() const
+{
+    return f_valid;
+}
+
+
+void shm_channel::wakeup_peer()
+{
+    eventfd_write(f_side == side_t::SIDE_DAEMON ? f_client_fd : f_daemon_fd, 1);
+}
+
+
+bool shm_channel::push(std::string const & msg)
+{
+    ring_header * ring(reinterpret_cast<ring_header *>(f_output));
+    std::uint64_t const head(ring->f_head.load(std::memory_order_relaxed));
+    std::uint64_t const tail(ring->f_tail.load(std::memory_order_acquire));
+    std::uint64_t const used(head - tail);
+    if(used > f_ring_size)
+    {
+        f_valid = false;
+        return false;
+    }
+
+    std::uint32_t const length(msg.length());
+    if(sizeof(length) + length > f_ring_size - used)
+    {
+        return false;
+    }
+
+    char * data(get_data(ring));
+    copy_in(data, f_ring_size, head, &length, sizeof(length));
+    copy_in(data, f_ring_size, head + sizeof(length), msg.data(), length);
+    ring->f_head.store(head + sizeof(length) + length);
+
+    if(ring->f_reader_sleeping.exchange(0) != 0)
+    {
+        wakeup_peer();
+    }
+    return true;
+}
+
+
+/** \brief Send a message to the other side.
+ *
+ * The message gets added to the output ring. If the ring is full, the
+ * message is kept in memory and flush() sends it once the other side
+ * made room. An \p urgent message goes ahead of the messages already
+ * waiting for room.
+ *
+ * \param[in] msg  The message to send.
+ * \param[in] urgent  Whether the message skips the waiting messages.
+ *
+ * \return false if the channel is invalid or the message is too large for
+ * the ring, in which case it has to be sent on the Unix socket instead.
+ */
+bool shm_channel::send(std::string const & msg, bool urgent)
+{
+    if(!f_valid
+    || sizeof(std::uint32_t) + msg.length() > f_ring_size)
+    {
+        return false;
+    }
+
+    if(f_pending.empty()
+    && push(msg))
+    {
+        return true;
+    }
+    if(urgent)
+    {
+        f_pending.push_front(msg);
+    }
+    else
+    {
+        f_pending.push_back(msg);
+    }
+    f_pending_bytes += msg.length();
+    flush();
+    return f_valid;
+}
+
+
+/** \brief Send the messages that did not fit in the output ring.
+ *
+ * \return true if all the messages were sent.
+ */
+bool shm_channel::flush()
+{
+    ring_header * ring(reinterpret_cast<ring_header *>(f_output));
+    while(!f_pending.empty())
+    {
+        if(!push(f_pending.front()))
+        {
+            if(!f_valid)
+            {
+                return false;
+            }
+
+            // ask for a wake up and try again in case room was made
+            // before the flag was set
+            //
+            ring->f_writer_waiting.store(1);
+            if(!push(f_pending.front()))
+            {
+                return false;
+            }
+        }
+        f_pending_bytes -= f_pending.front().length();
+        f_pending.pop_front();
+    }
+    return true;
+}
+
+
+/** \brief Retrieve the number of bytes waiting for room in the ring.
+ *
+ * \return The total size of the messages not yet pushed to the ring.
+ */
+std::size_t shm_channel::get_pending_bytes() const
+{
+    return f_pending_bytes;
+}
+
+
+/** \brief Retrieve the number of messages waiting for room in the ring.
+ *
+ * \return The number of messages not yet pushed to the ring.
+ */
+std::size_t shm_channel::get_pending_messages() const
+{
+    return f_pending.size();
+}
+
+
+/** \brief Retrieve the next message sent by the other side.
+ *
+ * \param[out] msg  The message.
+ *
+ * \return true if a message was returned.
+ */
+bool shm_channel::receive(std::string & msg)
+{
+    if(!f_valid)
+    {
+        return false;
+    }
+
+    ring_header * ring(reinterpret_cast<ring_header *>(f_input));
+    std::uint64_t const tail(ring->f_tail.load(std::memory_order_relaxed));
+    std::uint64_t const head(ring->f_head.load(std::memory_order_acquire));
+    std::uint64_t const used(head - tail);
+    if(used == 0)
+    {
+        return false;
+    }
+
+    char const * data(get_data(ring));
+    std::uint32_t length(0);
+    if(used < sizeof(length)
+    || used > f_ring_size)
+    {
+        f_valid = false;
+        return false;
+    }
+    copy_out(data, f_ring_size, tail, &length, sizeof(length));
+    if(length > used - sizeof(length))
+    {
+        f_valid = false;
+        return false;
+    }
+    msg.resize(length);
+    copy_out(data, f_ring_size, tail + sizeof(length), msg.data(), length);
+    ring->f_tail.store(tail + sizeof(length) + length);
+
+    if(ring->f_writer_waiting.exchange(0) != 0)
+    {
+        wakeup_peer();
+    }
+    return true;
+}
+
+
+/** \brief Tell the other side to wake us up on its next message.
+ *
+ * \return true if the input ring is empty, false if messages arrived
+ * in the meantime and receive() has to be called again.
+ */
+bool shm_channel::prepare_to_sleep()
+{
+    if(!f_valid)
+    {
+        return true;
+    }
+
+    ring_header * ring(reinterpret_cast<ring_header *>(f_input));
+    ring->f_reader_sleeping.store(1);
+    if(ring->f_head.load() != ring->f_tail.load(std::memory_order_relaxed))
+    {
+        ring->f_reader_sleeping.store(0);
+        return false;
+    }
+    return true;
+}
+
+
+
+} // namespace communicatord
+// vim: ts=4 sw=4 et
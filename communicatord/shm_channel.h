@@ -0,0 +1,99 @@
+// Copyright (c) 2013-2024  Made to Order Software Corp.  All Rights Reserved.
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Shared memory channel between a service and the communicatord.
+ *
+ * A service connecting with the "cdm:" scheme exchanges its messages
+ * with the communicatord through two single producer, single consumer
+ * rings in shared memory. An eventfd per side is used to wake up a
+ * side sleeping in poll(). The Unix socket remains the control channel.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <deque>
+#include    <memory>
+#include    <string>
+
+
+
+namespace communicatord
+{
+
+
+
+class shm_channel
+{
+public:
+    typedef std::shared_ptr<shm_channel>    pointer_t;
+
+    static constexpr std::size_t const      DEFAULT_RING_SIZE = 1024 * 1024;
+
+    enum class side_t
+    {
+        SIDE_DAEMON,
+        SIDE_CLIENT,
+    };
+
+                                shm_channel(shm_channel const &) = delete;
+                                ~shm_channel();
+    shm_channel &               operator = (shm_channel const &) = delete;
+
+    static pointer_t            create(std::size_t ring_size = DEFAULT_RING_SIZE);
+    static pointer_t            receive_descriptors(int socket, std::string const & token);
+    bool                        send_descriptors(int socket) const;
+
+    int                         get_wakeup_fd() const;
+    void                        clear_wakeup();
+    bool                        is_valid() const;
+
+    bool                        send(std::string const & msg, bool urgent = false);
+    bool                        flush();
+    std::size_t                 get_pending_bytes() const;
+    std::size_t                 get_pending_messages() const;
+    bool                        receive(std::string & msg);
+    bool                        prepare_to_sleep();
+
+private:
+                                shm_channel(side_t side);
+
+    bool                        map(int memfd, std::size_t ring_size);
+    bool                        push(std::string const & msg);
+    void                        wakeup_peer();
+
+    side_t                      f_side = side_t::SIDE_DAEMON;
+    int                         f_memfd = -1;
+    int                         f_daemon_fd = -1;
+    int                         f_client_fd = -1;
+    void *                      f_area = nullptr;
+    std::size_t                 f_area_size = 0;
+    std::size_t                 f_ring_size = 0;
+    void *                      f_input = nullptr;
+    void *                      f_output = nullptr;
+    bool                        f_valid = false;
+    std::deque<std::string>     f_pending = std::deque<std::string>();
+    std::size_t                 f_pending_bytes = 0;
+};
+
+
+
+} // namespace communicatord
+// vim: ts=4 sw=4 et
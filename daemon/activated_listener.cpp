@@ -0,0 +1,211 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the socket activation listener.
+ *
+ * systemd passes the sockets of a .socket unit as file descriptors
+ * starting at 3 and defines the LISTEN_PID and LISTEN_FDS variables
+ * (see sd_listen_fds(3)). We search those descriptors for the Unix
+ * stream socket bound to our unix_listen path and accept the new
+ * clients on it exactly like the unix_listener does.
+ */
+
+// self
+//
+#include    "activated_listener.h"
+
+#include    "unix_connection.h"
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <cstdlib>
+#include    <cstring>
+
+
+// C
+//
+#include    <fcntl.h>
+#include    <sys/socket.h>
+#include    <sys/un.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace
+{
+
+
+
+constexpr int const     SD_LISTEN_FDS_START = 3;
+
+
+
+} // no name namespace
+
+
+
+/** \brief Initialize the listener with a socket received from systemd.
+ *
+ * \param[in] cs  The communicator server.
+ * \param[in] socket  The listening socket.
+ * \param[in] server_name  The name of the server running this instance.
+ */
+activated_listener::activated_listener(
+          server::pointer_t cs
+        , snapdev::raii_fd_t socket
+        , std::string const & server_name)
+    : f_server(cs)
+    , f_socket(std::move(socket))
+    , f_server_name(server_name)
+{
+}
+
+
+/** \brief Search the sockets passed by systemd for \p path.
+ *
+ * The function verifies that the sockets are for this process
+ * (LISTEN_PID) and returns the Unix stream socket bound to \p path, if
+ * any. The environment variables are then removed so our children do
+ * not see them.
+ *
+ * \param[in] path  The path of the Unix socket we want to listen on.
+ *
+ * \return The socket or an empty raii_fd_t if systemd did not pass it.
+ */
+snapdev::raii_fd_t activated_listener::get_activated_socket(std::string const & path)
+{
+    snapdev::raii_fd_t result;
+
+    char const * listen_pid(getenv("LISTEN_PID"));
+    char const * listen_fds(getenv("LISTEN_FDS"));
+    if(listen_pid == nullptr
+    || listen_fds == nullptr
+    || std::atol(listen_pid) != getpid())
+    {
+        return result;
+    }
+
+    int const count(std::atoi(listen_fds));
+    for(int fd(SD_LISTEN_FDS_START); fd < SD_LISTEN_FDS_START + count; ++fd)
+    {
+        sockaddr_un address = {};
+        socklen_t length(sizeof(address));
+        int type(0);
+        socklen_t type_length(sizeof(type));
+        if(getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) != 0
+        || address.sun_family != AF_UNIX
+        || getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_length) != 0
+        || type != SOCK_STREAM
+        || path != address.sun_path)
+        {
+            continue;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        result.reset(fd);
+        break;
+    }
+
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    return result;
+}
+
+
+bool activated_listener::is_listener() const
+{
+    return true;
+}
+
+
+int activated_listener::get_socket() const
+{
+    return f_socket.get();
+}
+
+
+void activated_listener::process_accept()
+{
+    snapdev::raii_fd_t new_client(accept4(f_socket.get(), nullptr, nullptr, SOCK_CLOEXEC));
+    if(new_client == nullptr)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "somehow accept() failed with errno: "
+            << e
+            << " -- "
+            << strerror(e)
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    // over budget, closing new_client closes the connection
+    //
+    admission_control::ticket ticket(f_server->admit_connection(
+              admission_budget_t::ADMISSION_BUDGET_LOCAL
+            , addr::addr()));
+    if(!ticket.is_admitted())
+    {
+        return;
+    }
+
+    unix_connection::pointer_t service(
+            std::make_shared<unix_connection>(
+                      f_server
+                    , std::move(new_client)
+                    , f_server_name));
+
+    // set a default name in each new connection, this changes
+    // whenever we receive a REGISTER message from that connection
+    //
+    service->set_name("client unix connection");
+
+    service->set_server_name(f_server_name);
+    service->set_admission_ticket(std::move(ticket));
+
+    if(!ed::communicator::instance()->add_connection(service))
+    {
+        SNAP_LOG_ERROR
+            << "new client connection could not be added to the ed::communicator list of connections."
+            << SNAP_LOG_SEND;
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
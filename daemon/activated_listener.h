@@ -0,0 +1,76 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the socket activation listener.
+ *
+ * When systemd starts the communicatord through a .socket unit, the
+ * Unix socket is created by systemd and passed to us. It stays open
+ * while the daemon restarts so services which connect in between wait
+ * in the backlog instead of failing.
+ */
+
+// self
+//
+#include    "server.h"
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/connection.h>
+
+
+// snapdev
+//
+#include    <snapdev/raii_generic_deleter.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+class activated_listener
+    : public ed::connection
+{
+public:
+    typedef std::shared_ptr<activated_listener>     pointer_t;
+
+                        activated_listener(
+                              server::pointer_t cs
+                            , snapdev::raii_fd_t socket
+                            , std::string const & server_name);
+
+    static snapdev::raii_fd_t
+                        get_activated_socket(std::string const & path);
+
+    // ed::connection implementation
+    virtual bool        is_listener() const override;
+    virtual int         get_socket() const override;
+    virtual void        process_accept() override;
+
+private:
+    server::pointer_t   f_server = server::pointer_t();
+    snapdev::raii_fd_t  f_socket = snapdev::raii_fd_t();
+    std::string const   f_server_name;
+};
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
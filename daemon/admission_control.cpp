@@ -0,0 +1,343 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the admission control.
+ *
+ * Each budget counts the connections currently admitted through one
+ * type of listener. The remote and secure budgets also count the
+ * connections per IP address since all the local connections come from
+ * the loopback address or the Unix socket anyway.
+ *
+ * A limit of 0 means that the corresponding budget is not limited.
+ */
+
+// self
+//
+#include    "admission_control.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Get the name of a budget.
+ *
+ * The name is used as the label of the admission metrics.
+ *
+ * \param[in] budget  The budget to name.
+ *
+ * \return The name of \p budget.
+ */
+char const * admission_budget_name(admission_budget_t budget)
+{
+    switch(budget)
+    {
+    case admission_budget_t::ADMISSION_BUDGET_LOCAL:
+        return "local";
+
+    case admission_budget_t::ADMISSION_BUDGET_REMOTE:
+        return "remote";
+
+    case admission_budget_t::ADMISSION_BUDGET_SECURE:
+        return "secure";
+
+    default:
+        return "unknown";
+
+    }
+}
+
+
+/** \brief Initialize an admission ticket.
+ *
+ * The admit() function creates the tickets of the connections it
+ * accepts. The ticket gives its slot back when destroyed.
+ *
+ * \param[in] control  The admission control which admitted the connection.
+ * \param[in] budget  The budget the connection was counted in.
+ * \param[in] address  The IP address the connection was counted for or
+ * an empty string.
+ */
+admission_control::ticket::ticket(
+          pointer_t control
+        , admission_budget_t budget
+        , std::string const & address)
+    : f_control(control)
+    , f_budget(budget)
+    , f_address(address)
+{
+}
+
+
+/** \brief Move a ticket.
+ *
+ * \param[in] rhs  The ticket to move; it is not admitted anymore.
+ */
+admission_control::ticket::ticket(ticket && rhs)
+    : f_control(std::move(rhs.f_control))
+    , f_budget(rhs.f_budget)
+    , f_address(std::move(rhs.f_address))
+{
+    rhs.f_control.reset();
+}
+
+
+/** \brief Give the slot of the connection back.
+ */
+admission_control::ticket::~ticket()
+{
+    release();
+}
+
+
+/** \brief Move a ticket.
+ *
+ * The slot held by this ticket, if any, is first given back.
+ *
+ * \param[in] rhs  The ticket to move; it is not admitted anymore.
+ *
+ * \return A reference to this ticket.
+ */
+admission_control::ticket & admission_control::ticket::operator = (ticket && rhs)
+{
+    if(this != &rhs)
+    {
+        release();
+        f_control = std::move(rhs.f_control);
+        f_budget = rhs.f_budget;
+        f_address = std::move(rhs.f_address);
+        rhs.f_control.reset();
+    }
+    return *this;
+}
+
+
+/** \brief Check whether the connection was admitted.
+ *
+ * \return true if this ticket holds a slot.
+ */
+bool admission_control::ticket::is_admitted() const
+{
+    return f_control != nullptr;
+}
+
+
+/** \brief Give the slot back now.
+ *
+ * Calling this function more than once has no additional effect.
+ */
+void admission_control::ticket::release()
+{
+    if(f_control != nullptr)
+    {
+        f_control->release(f_budget, f_address);
+        f_control.reset();
+    }
+}
+
+
+/** \brief Set the maximum number of connections of a budget.
+ *
+ * Changing the limit does not affect connections already admitted,
+ * even if there are now more than \p limit of them.
+ *
+ * \param[in] budget  The budget to change.
+ * \param[in] limit  The maximum number of connections, 0 for no limit.
+ */
+void admission_control::set_limit(admission_budget_t budget, std::size_t limit)
+{
+    f_budgets[static_cast<int>(budget)].f_limit = limit;
+}
+
+
+/** \brief Get the maximum number of connections of a budget.
+ *
+ * \param[in] budget  The budget to check.
+ *
+ * \return The maximum number of connections, 0 meaning no limit.
+ */
+std::size_t admission_control::get_limit(admission_budget_t budget) const
+{
+    return f_budgets[static_cast<int>(budget)].f_limit;
+}
+
+
+/** \brief Set the maximum number of remote connections per IP address.
+ *
+ * The limit applies to the sum of the remote and secure connections
+ * coming from the same IP address.
+ *
+ * \param[in] limit  The maximum number of connections, 0 for no limit.
+ */
+void admission_control::set_address_limit(std::size_t limit)
+{
+    f_address_limit = limit;
+}
+
+
+/** \brief Get the maximum number of remote connections per IP address.
+ *
+ * \return The maximum number of connections, 0 meaning no limit.
+ */
+std::size_t admission_control::get_address_limit() const
+{
+    return f_address_limit;
+}
+
+
+/** \brief Admit a new connection.
+ *
+ * This function checks whether one more connection fits in \p budget
+ * and, for the remote budgets, whether \p address has not yet reached
+ * its limit. If so, the connection gets counted and the returned
+ * ticket is admitted. Otherwise the refusal gets counted and the
+ * returned ticket is not admitted.
+ *
+ * The admission_control object must be managed by a shared pointer
+ * since each ticket keeps a reference to it.
+ *
+ * \param[in] budget  The budget of the listener which accepted the
+ * connection.
+ * \param[in] address  The IP address of the client, without the port.
+ *
+ * \return The ticket of the connection.
+ */
+admission_control::ticket admission_control::admit(
+          admission_budget_t budget
+        , std::string const & address)
+{
+    budget_info & b(f_budgets[static_cast<int>(budget)]);
+    if(b.f_limit != 0
+    && b.f_count >= b.f_limit)
+    {
+        ++b.f_refused;
+        return ticket();
+    }
+
+    std::string key;
+    if(budget != admission_budget_t::ADMISSION_BUDGET_LOCAL
+    && !address.empty())
+    {
+        std::size_t & count(f_addresses[address]);
+        if(f_address_limit != 0
+        && count >= f_address_limit)
+        {
+            ++f_address_refused;
+            return ticket();
+        }
+        ++count;
+        key = address;
+    }
+
+    ++b.f_count;
+    return ticket(shared_from_this(), budget, key);
+}
+
+
+/** \brief Get the number of connections currently admitted in a budget.
+ *
+ * \param[in] budget  The budget to check.
+ *
+ * \return The number of tickets of \p budget still alive.
+ */
+std::size_t admission_control::get_count(admission_budget_t budget) const
+{
+    return f_budgets[static_cast<int>(budget)].f_count;
+}
+
+
+/** \brief Get the number of remote connections from an IP address.
+ *
+ * \param[in] address  The IP address to check.
+ *
+ * \return The number of remote and secure connections from \p address.
+ */
+std::size_t admission_control::get_address_count(std::string const & address) const
+{
+    auto const it(f_addresses.find(address));
+    if(it == f_addresses.end())
+    {
+        return 0;
+    }
+    return it->second;
+}
+
+
+/** \brief Get the number of connections refused by a budget.
+ *
+ * \param[in] budget  The budget to check.
+ *
+ * \return The number of connections refused because \p budget was full.
+ */
+std::uint64_t admission_control::get_refused(admission_budget_t budget) const
+{
+    return f_budgets[static_cast<int>(budget)].f_refused;
+}
+
+
+/** \brief Get the number of connections refused by the per address limit.
+ *
+ * \return The number of connections refused because their IP address
+ * already had too many connections.
+ */
+std::uint64_t admission_control::get_address_refused() const
+{
+    return f_address_refused;
+}
+
+
+/** \brief Give the slot of a connection back.
+ *
+ * \param[in] budget  The budget the connection was counted in.
+ * \param[in] address  The IP address the connection was counted for or
+ * an empty string.
+ */
+void admission_control::release(admission_budget_t budget, std::string const & address)
+{
+    budget_info & b(f_budgets[static_cast<int>(budget)]);
+    if(b.f_count > 0)
+    {
+        --b.f_count;
+    }
+
+    if(!address.empty())
+    {
+        auto const it(f_addresses.find(address));
+        if(it != f_addresses.end())
+        {
+            --it->second;
+            if(it->second == 0)
+            {
+                f_addresses.erase(it);
+            }
+        }
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
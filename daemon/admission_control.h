@@ -0,0 +1,122 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the admission control.
+ *
+ * The listeners accept connections as fast as they arrive. Without a
+ * limit, a misbehaving client or a remote peer reconnecting in a loop
+ * can use all the file descriptors of the daemon before it even gets a
+ * chance to refuse a CONNECT. The admission control gives each type of
+ * listener its own budget of connections and limits the number of
+ * connections coming from the same IP address. A connection is
+ * admitted by getting a ticket which gives its slot back when the
+ * connection is destroyed.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <map>
+#include    <memory>
+#include    <string>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+enum class admission_budget_t
+{
+    ADMISSION_BUDGET_LOCAL,         // local TCP listener and Unix socket
+    ADMISSION_BUDGET_REMOTE,        // plain remote TCP listener
+    ADMISSION_BUDGET_SECURE,        // secure (TLS) remote TCP listener
+
+    ADMISSION_BUDGET_COUNT
+};
+
+
+char const *            admission_budget_name(admission_budget_t budget);
+
+
+class admission_control
+    : public std::enable_shared_from_this<admission_control>
+{
+public:
+    typedef std::shared_ptr<admission_control>  pointer_t;
+
+    class ticket
+    {
+    public:
+                                ticket() = default;
+                                ticket(
+                                      pointer_t control
+                                    , admission_budget_t budget
+                                    , std::string const & address);
+                                ticket(ticket const &) = delete;
+                                ticket(ticket && rhs);
+                                ~ticket();
+
+        ticket &                operator = (ticket const &) = delete;
+        ticket &                operator = (ticket && rhs);
+
+        bool                    is_admitted() const;
+        void                    release();
+
+    private:
+        pointer_t               f_control = pointer_t();
+        admission_budget_t      f_budget = admission_budget_t::ADMISSION_BUDGET_LOCAL;
+        std::string             f_address = std::string();
+    };
+
+    void                        set_limit(admission_budget_t budget, std::size_t limit);
+    std::size_t                 get_limit(admission_budget_t budget) const;
+    void                        set_address_limit(std::size_t limit);
+    std::size_t                 get_address_limit() const;
+
+    ticket                      admit(admission_budget_t budget, std::string const & address);
+
+    std::size_t                 get_count(admission_budget_t budget) const;
+    std::size_t                 get_address_count(std::string const & address) const;
+    std::uint64_t               get_refused(admission_budget_t budget) const;
+    std::uint64_t               get_address_refused() const;
+
+private:
+    struct budget_info
+    {
+        std::size_t             f_limit = 0;        // 0 means unlimited
+        std::size_t             f_count = 0;
+        std::uint64_t           f_refused = 0;
+    };
+
+    void                        release(admission_budget_t budget, std::string const & address);
+
+    budget_info                 f_budgets[static_cast<int>(admission_budget_t::ADMISSION_BUDGET_COUNT)] = {};
+    std::size_t                 f_address_limit = 0;
+    std::map<std::string, std::size_t>
+                                f_addresses = std::map<std::string, std::size_t>();
+    std::uint64_t               f_address_refused = 0;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -60,11 +60,29 @@
 #include    <communicatord/exception.h>
 
 
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
 // snapdev
 //
+#include    <snapdev/not_used.h>
 #include    <snapdev/tokenize_string.h>
 
 
+// C++
+//
+#include    <chrono>
+
+
+// C
+//
+#include    <netinet/in.h>
+#include    <netinet/tcp.h>
+#include    <sys/socket.h>
+
+
 // last include
 //
 #include    <snapdev/poison.h>
@@ -326,7 +344,7 @@ void base_connection::set_services(std::string const & services)
  */
 void base_connection::get_services(advgetopt::string_set_t & services)
 {
-    f_services.merge(services);
+    services.insert(f_services.begin(), f_services.end());
 }
 
 
@@ -345,6 +363,36 @@ bool base_connection::has_service(std::string const & name)
 }
 
 
+/** \brief Define the list of capabilities of a remote communicatord.
+ *
+ * When a communicatord connects to another one, it sends a list of
+ * optional features it supports in its CONNECT or ACCEPT message. This
+ * function saves that list.
+ *
+ * A communicatord which does not send that list is considered to not
+ * support any optional feature.
+ *
+ * \param[in] capabilities  The comma separated list of capabilities.
+ */
+void base_connection::set_capabilities(std::string const & capabilities)
+{
+    f_capabilities.clear();
+    snapdev::tokenize_string(f_capabilities, capabilities, { "," }, true);
+}
+
+
+/** \brief Check whether the remote communicatord supports a feature.
+ *
+ * \param[in] capability  The name of the capability to check.
+ *
+ * \return true if the capability was listed by the remote communicatord.
+ */
+bool base_connection::has_capability(std::string const & capability) const
+{
+    return f_capabilities.find(capability) != f_capabilities.end();
+}
+
+
 /** \brief Define the list of services we heard of.
  *
  * This function saves the list of services that were heard of by
@@ -364,6 +412,19 @@ void base_connection::set_services_heard_of(std::string const & services)
 }
 
 
+/** \brief Replace the list of services we heard of.
+ *
+ * This function replaces the list of services heard of by another
+ * communicatord server once updated by a HEARD_OF message.
+ *
+ * \param[in] services  The new list of services heard of.
+ */
+void base_connection::set_services_heard_of(advgetopt::string_set_t const & services)
+{
+    f_services_heard_of = services;
+}
+
+
 /** \brief Retrieve the list of services heard of by another server.
  *
  * This function saves in the input parameter \p services the list of
@@ -373,7 +434,7 @@ void base_connection::set_services_heard_of(std::string const & services)
  */
 void base_connection::get_services_heard_of(advgetopt::string_set_t & services)
 {
-    f_services_heard_of.merge(services);
+    services.insert(f_services_heard_of.begin(), f_services_heard_of.end());
 }
 
 
@@ -381,8 +442,12 @@ void base_connection::get_services_heard_of(advgetopt::string_set_t & services)
  *
  * This function saves the list of commands known by another process.
  * The \p commands parameter is broken up at each comma and the
- * resulting list saved in the f_understood_commands map for fast
- * retrieval.
+ * resulting list saved in the f_understood_commands bitset for fast
+ * retrieval. Each name is first converted to a command identifier
+ * (see intern_command()) which is used as the index in the bitset.
+ *
+ * Once the table of command identifiers is full, the names which did
+ * not get an identifier are saved as is in a separate set.
  *
  * In general a process receives the COMMANDS event whenever it
  * sent the HELP event to request for this list.
@@ -391,10 +456,32 @@ void base_connection::get_services_heard_of(advgetopt::string_set_t & services)
  */
 void base_connection::add_commands(std::string const & commands)
 {
+    std::vector<std::string> names;
     snapdev::tokenize_string(
-          f_understood_commands
+          names
         , commands
         , { "," });
+    for(auto const & n : names)
+    {
+        command_id_t const id(intern_command(n));
+        if(id == COMMAND_ID_UNKNOWN)
+        {
+            if(f_understood_other_commands.insert(n).second)
+            {
+                ++f_understood_commands_count;
+            }
+            continue;
+        }
+        if(id >= f_understood_commands.size())
+        {
+            f_understood_commands.resize(id + 1);
+        }
+        if(!f_understood_commands[id])
+        {
+            f_understood_commands[id] = true;
+            ++f_understood_commands_count;
+        }
+    }
 }
 
 
@@ -425,9 +512,50 @@ void base_connection::add_commands(std::string const & commands)
  *
  * \sa has_commands()
  */
-bool base_connection::understand_command(std::string const & command)
+bool base_connection::understand_command(std::string const & command) const
+{
+    return understand_command(find_command(command), command);
+}
+
+
+/** \brief Check whether a certain command is understood by this connection.
+ *
+ * This function is the same as the understand_command() taking a string
+ * except that the caller already converted the command name to its
+ * identifier. This is useful when the same command is checked against
+ * many connections (i.e. when broadcasting a message).
+ *
+ * \param[in] command  The identifier of the command to check for.
+ *
+ * \return true if the command is supported, false otherwise.
+ *
+ * \sa find_command()
+ */
+bool base_connection::understand_command(command_id_t command) const
+{
+    return command < f_understood_commands.size()
+        && f_understood_commands[command];
+}
+
+
+/** \brief Check whether a certain command is understood by this connection.
+ *
+ * This function is the same as the understand_command() taking an
+ * identifier except that it falls back to searching \p name when the
+ * command did not get an identifier (see intern_command()).
+ *
+ * \param[in] command  The identifier of the command to check for.
+ * \param[in] name  The name of the command to check for.
+ *
+ * \return true if the command is supported, false otherwise.
+ */
+bool base_connection::understand_command(command_id_t command, std::string const & name) const
 {
-    return f_understood_commands.find(command) != f_understood_commands.end();
+    if(command == COMMAND_ID_UNKNOWN)
+    {
+        return f_understood_other_commands.find(name) != f_understood_other_commands.end();
+    }
+    return understand_command(command);
 }
 
 
@@ -442,7 +570,27 @@ bool base_connection::understand_command(std::string const & command)
  */
 bool base_connection::has_commands() const
 {
-    return !f_understood_commands.empty();
+    return f_understood_commands_count != 0;
+}
+
+
+/** \brief Retrieve the list of commands understood by this connection.
+ *
+ * This function adds the names of the commands this connection
+ * understands to \p commands.
+ *
+ * \param[in,out] commands  The set where the command names get added.
+ */
+void base_connection::get_commands(advgetopt::string_set_t & commands) const
+{
+    for(command_id_t id(0); id < f_understood_commands.size(); ++id)
+    {
+        if(f_understood_commands[id])
+        {
+            commands.insert(command_name(id));
+        }
+    }
+    commands.insert(f_understood_other_commands.begin(), f_understood_other_commands.end());
 }
 
 
@@ -459,10 +607,18 @@ bool base_connection::has_commands() const
  */
 void base_connection::remove_command(std::string const & command)
 {
-    auto it(f_understood_commands.find(command));
-    if(it != f_understood_commands.end())
+    command_id_t const id(find_command(command));
+    if(id == COMMAND_ID_UNKNOWN)
     {
-        f_understood_commands.erase(it);
+        if(f_understood_other_commands.erase(command) != 0)
+        {
+            --f_understood_commands_count;
+        }
+    }
+    else if(understand_command(id))
+    {
+        f_understood_commands[id] = false;
+        --f_understood_commands_count;
     }
 }
 
@@ -540,6 +696,753 @@ bool base_connection::wants_loadavg() const
 }
 
 
+/** \brief Save the last load average received from this connection.
+ *
+ * Remote communicator daemons we registered with send us a LOADAVG
+ * message once per second. The server saves the average here so it
+ * can quickly choose the least busy computer when sending a message
+ * to a service running on several computers.
+ *
+ * \param[in] avg  The load average of the remote computer.
+ * \param[in] received_on  The time when the LOADAVG was received.
+ */
+void base_connection::set_loadavg(float avg, time_t received_on)
+{
+    f_loadavg = avg;
+    f_loadavg_received_on = received_on;
+}
+
+
+/** \brief Retrieve the last load average of this connection.
+ *
+ * The load average is considered valid for 10 seconds. After that, the
+ * remote computer may be stuck or have stopped sending LOADAVG messages
+ * so this function returns -1.0 instead.
+ *
+ * \param[in] now  The current time.
+ *
+ * \return The load average or -1.0 if unknown.
+ */
+float base_connection::get_loadavg(time_t now) const
+{
+    if(f_loadavg < 0.0f
+    || now - f_loadavg_received_on > 10)
+    {
+        return -1.0f;
+    }
+
+    return f_loadavg;
+}
+
+
+/** \brief Mark that we requested the load average of this connection.
+ *
+ * The server sends a REGISTER_FOR_LOADAVG to a remote communicator the
+ * first time it needs its load average. This function returns true only
+ * the first time it gets called so that message is sent only once.
+ *
+ * \return true if the REGISTER_FOR_LOADAVG has to be sent.
+ */
+bool base_connection::request_loadavg()
+{
+    if(f_loadavg_requested)
+    {
+        return false;
+    }
+    f_loadavg_requested = true;
+    return true;
+}
+
+
+/** \brief Start batching the output of this connection.
+ *
+ * This function sets the TCP_CORK option on the socket of this
+ * connection. While set, the kernel only sends full packets. The
+ * server calls uncork_output() once the batch is complete, which sends
+ * whatever remains.
+ *
+ * \note
+ * The kernel also sends the data if the socket stays corked for more
+ * than 200ms.
+ *
+ * \return true if the connection was not yet corked and now is.
+ */
+bool base_connection::cork_output()
+{
+    if(f_corked)
+    {
+        return false;
+    }
+
+    int const s(get_socket());
+    if(s < 0)
+    {
+        return false;
+    }
+
+    int const optval(1);
+    if(setsockopt(s, IPPROTO_TCP, TCP_CORK, &optval, sizeof(optval)) != 0)
+    {
+        return false;
+    }
+
+    f_corked = true;
+    f_corked_bytes = 0;
+    return true;
+}
+
+
+/** \brief Send the batched output of this connection.
+ *
+ * This function removes the TCP_CORK option so the kernel sends the
+ * data batched so far.
+ */
+void base_connection::uncork_output()
+{
+    if(!f_corked)
+    {
+        return;
+    }
+    f_corked = false;
+    f_corked_bytes = 0;
+
+    int const s(get_socket());
+    if(s >= 0)
+    {
+        int const optval(0);
+        setsockopt(s, IPPROTO_TCP, TCP_CORK, &optval, sizeof(optval));
+    }
+}
+
+
+/** \brief Check whether the output of this connection is being batched.
+ *
+ * \return true if cork_output() was called and uncork_output() was not.
+ */
+bool base_connection::is_corked() const
+{
+    return f_corked;
+}
+
+
+/** \brief Add a message to the batch of this connection.
+ *
+ * This function counts the bytes written since cork_output() and
+ * checks whether the batch is complete.
+ *
+ * \param[in] size  The size of the message just written.
+ * \param[in] flush  Whether the message has to be sent immediately.
+ * \param[in] max_bytes  The size of a complete batch, 0 for no limit.
+ *
+ * \return true if the connection is corked and the batch has to be sent
+ * now, false otherwise.
+ */
+bool base_connection::batch_output(std::size_t size, bool flush, std::size_t max_bytes)
+{
+    if(!f_corked)
+    {
+        return false;
+    }
+
+    f_corked_bytes += size;
+    return flush
+        || (max_bytes != 0 && f_corked_bytes >= max_bytes);
+}
+
+
+/** \brief Define how the messages sent to this link get compressed.
+ *
+ * The server calls this function once it knows that the remote
+ * communicatord supports the compression and that the link goes
+ * through a network where it is worth it.
+ *
+ * \param[in] level  The zstd compression level, 0 to not compress.
+ * \param[in] threshold  The minimum size of a message to compress it.
+ */
+void base_connection::set_compression(int level, std::size_t threshold)
+{
+    f_compression_level = level;
+    f_compression_threshold = threshold;
+}
+
+
+/** \brief Retrieve the compression level of this link.
+ *
+ * \return The zstd compression level, 0 when messages are not compressed.
+ */
+int base_connection::get_compression_level() const
+{
+    return f_compression_level;
+}
+
+
+/** \brief Retrieve the compression threshold of this link.
+ *
+ * \return The minimum size of a message to get it compressed.
+ */
+std::size_t base_connection::get_compression_threshold() const
+{
+    return f_compression_threshold;
+}
+
+
+/** \brief Define the watermarks of the output queue.
+ *
+ * The server calls this function once a local service registered. Until
+ * then, the output of the connection is not limited.
+ *
+ * \param[in] high_bytes  The number of bytes making the queue congested.
+ * \param[in] high_messages  The number of messages making the queue congested.
+ * \param[in] low_bytes  The number of bytes under which it recovers.
+ * \param[in] low_messages  The number of messages under which it recovers.
+ *
+ * \sa output_queue::set_limits()
+ */
+void base_connection::set_output_limits(
+      std::size_t high_bytes
+    , std::size_t high_messages
+    , std::size_t low_bytes
+    , std::size_t low_messages)
+{
+    f_output_queue.set_limits(high_bytes, high_messages, low_bytes, low_messages);
+}
+
+
+/** \brief Define what happens when this connection is congested.
+ *
+ * \param[in] policy  Whether to drop messages or disconnect the service.
+ */
+void base_connection::set_slow_consumer_policy(slow_consumer_policy_t policy)
+{
+    f_slow_consumer_policy = policy;
+}
+
+
+/** \brief Retrieve the slow consumer policy of this connection.
+ *
+ * \return The policy applied once the output queue is congested.
+ */
+slow_consumer_policy_t base_connection::get_slow_consumer_policy() const
+{
+    return f_slow_consumer_policy;
+}
+
+
+/** \brief Check whether the output queue reached its high watermark.
+ *
+ * While congested, the messages sent to this connection are cached,
+ * dropped, or the connection gets removed, depending on the policy.
+ *
+ * \return true if the output queue of this connection is congested.
+ */
+bool base_connection::is_output_congested() const
+{
+    return f_output_queue.is_congested();
+}
+
+
+/** \brief Retrieve the number of bytes waiting in the output queue.
+ *
+ * \return The number of bytes not yet given to the eventdispatcher buffer.
+ */
+std::size_t base_connection::get_queued_bytes() const
+{
+    return f_output_queue.get_bytes();
+}
+
+
+/** \brief Retrieve the number of messages waiting in the output queue.
+ *
+ * \return The number of messages not yet given to the eventdispatcher
+ * buffer.
+ */
+std::size_t base_connection::get_queued_messages() const
+{
+    return f_output_queue.get_messages();
+}
+
+
+/** \brief Retrieve the number of messages dropped on this connection.
+ *
+ * \return The number of messages dropped because the connection was
+ * congested.
+ */
+std::size_t base_connection::get_dropped_messages() const
+{
+    return f_output_queue.get_dropped();
+}
+
+
+/** \brief Count a message received on this connection.
+ *
+ * The server calls this function each time it receives a message from
+ * this connection. The counter is reported by the metrics.
+ */
+void base_connection::count_message_in()
+{
+    ++f_messages_in;
+}
+
+
+/** \brief Retrieve the number of messages received on this connection.
+ *
+ * \return The number of messages received so far.
+ */
+std::uint64_t base_connection::get_messages_in() const
+{
+    return f_messages_in;
+}
+
+
+/** \brief Retrieve the number of messages written to this connection.
+ *
+ * This counts the calls to write() going through queue_output(), whether
+ * the data was queued or written to the eventdispatcher buffer.
+ *
+ * \return The number of messages written so far.
+ */
+std::uint64_t base_connection::get_messages_out() const
+{
+    return f_messages_out;
+}
+
+
+/** \brief Retrieve the number of bytes written to this connection.
+ *
+ * \return The number of bytes written so far.
+ */
+std::uint64_t base_connection::get_bytes_out() const
+{
+    return f_bytes_out;
+}
+
+
+/** \brief Count a message dropped because this connection is congested.
+ *
+ * \return The number of messages dropped so far.
+ */
+std::size_t base_connection::add_dropped_message()
+{
+    return f_output_queue.add_dropped();
+}
+
+
+/** \brief Remember a service which was told to slow down.
+ *
+ * When a message is sent to this connection while congested, the sender
+ * gets a FLOW_CONTROL message once. This function returns true the first
+ * time \p producer is added so the server knows to send that message.
+ *
+ * \param[in] producer  The connection which sent a message to this one.
+ *
+ * \return true if \p producer was not yet throttled.
+ */
+bool base_connection::add_throttled_producer(pointer_t producer)
+{
+    for(auto const & p : f_throttled_producers)
+    {
+        if(p.lock() == producer)
+        {
+            return false;
+        }
+    }
+    f_throttled_producers.push_back(producer);
+    return true;
+}
+
+
+/** \brief Retrieve the services which were told to slow down.
+ *
+ * This function returns the producers still connected and clears the
+ * list. It is called once the congestion is over.
+ *
+ * \return The vector of throttled producers.
+ */
+base_connection::vector_t base_connection::get_throttled_producers()
+{
+    vector_t result;
+    for(auto const & p : f_throttled_producers)
+    {
+        pointer_t producer(p.lock());
+        if(producer != nullptr)
+        {
+            result.push_back(producer);
+        }
+    }
+    f_throttled_producers.clear();
+    return result;
+}
+
+
+/** \brief Retrieve the failure detector of this connection.
+ *
+ * Remote communicators supporting the heartbeat capability send us a
+ * HEARTBEAT at regular intervals. The server records their arrival in
+ * this detector and regularly checks the suspicion level.
+ *
+ * \return A reference to the failure detector of this connection.
+ */
+failure_detector & base_connection::get_failure_detector()
+{
+    return f_failure_detector;
+}
+
+
+/** \brief Retrieve the clock offset estimator of this connection.
+ *
+ * The HEARTBEAT messages exchanged with a remote communicator include
+ * timestamps used to estimate the offset between its clock and ours.
+ *
+ * \return A reference to the clock offset estimator of this connection.
+ */
+clock_offset & base_connection::get_clock_offset()
+{
+    return f_clock_offset;
+}
+
+
+/** \brief Retrieve the ingress rate limiter of this connection.
+ *
+ * The messages received on this connection take tokens from the buckets
+ * of this limiter. The messages delayed because they went over the
+ * limits are also kept here.
+ *
+ * \return A reference to the ingress limiter of this connection.
+ */
+ingress_limiter & base_connection::get_ingress_limiter()
+{
+    return f_ingress_limiter;
+}
+
+
+/** \brief Save the admission ticket of this connection.
+ *
+ * The listener which accepted this connection got a ticket from the
+ * admission control. The connection keeps it so its slot in the budget
+ * of that listener is given back when the connection is destroyed.
+ *
+ * \param[in] ticket  The admission ticket of this connection.
+ */
+void base_connection::set_admission_ticket(admission_control::ticket && ticket)
+{
+    f_admission_ticket = std::move(ticket);
+}
+
+
+/** \brief Save the gateway mode of a remote communicator.
+ *
+ * Remote communicators supporting the gateway capability send their
+ * mode in their CONNECT or ACCEPT message. The communicators of our own
+ * site use it to elect the gateways of the site.
+ *
+ * A remote communicator which did not send its mode is never elected.
+ *
+ * \param[in] mode  The gateway mode of the remote communicator.
+ */
+void base_connection::set_gateway_mode(gateway_mode_t mode)
+{
+    f_gateway_mode = mode;
+}
+
+
+/** \brief Get the gateway mode of a remote communicator.
+ *
+ * \return The mode set with set_gateway_mode(), "never" by default.
+ */
+gateway_mode_t base_connection::get_gateway_mode() const
+{
+    return f_gateway_mode;
+}
+
+
+/** \brief Mark whether the remote communicator is a gateway.
+ *
+ * The communicators of other sites tell us whether they are currently
+ * a gateway of their site in their CONNECT or ACCEPT message and then
+ * with a GATEWAY message each time that changes.
+ *
+ * \param[in] gateway  true if the remote communicator is a gateway.
+ */
+void base_connection::set_gateway(bool gateway)
+{
+    f_gateway = gateway;
+}
+
+
+/** \brief Check whether the remote communicator is a gateway.
+ *
+ * \return true if the remote communicator said it is a gateway.
+ */
+bool base_connection::is_gateway() const
+{
+    return f_gateway;
+}
+
+
+/** \brief Hand the I/O of this connection to an I/O shard.
+ *
+ * The connection gets disabled so the main thread stops polling its
+ * socket. From now on, the shard reads the messages and hands them back
+ * through shard_message() and the data sent to this connection goes to
+ * the shard through shard_write().
+ *
+ * \param[in] shard  The shard which is to handle this connection.
+ *
+ * \return true if the shard accepted the connection.
+ */
+bool base_connection::attach_shard(io_shard::pointer_t shard)
+{
+    ed::connection * conn(dynamic_cast<ed::connection *>(this));
+    if(conn == nullptr)
+    {
+        throw communicatord::logic_error("somehow a dynamic_cast<ed::connection *> on our base_connection failed.");
+    }
+    if(f_shard != nullptr
+    || !shard->attach(std::dynamic_pointer_cast<base_connection>(conn->shared_from_this()), f_shard_id))
+    {
+        return false;
+    }
+    f_shard = shard;
+    conn->set_enable(false);
+    return true;
+}
+
+
+/** \brief Take this connection back from its I/O shard.
+ *
+ * This function is called when the connection gets removed from the
+ * ed::communicator. The data still waiting in the output queue is handed
+ * to the shard which closes the socket once it was sent.
+ */
+void base_connection::detach_shard()
+{
+    if(f_shard == nullptr)
+    {
+        return;
+    }
+
+    for(;;)
+    {
+        std::string data(dequeue_output());
+        if(data.empty())
+        {
+            break;
+        }
+        f_shard->write(f_shard_id, std::move(data));
+    }
+    f_shard->detach(f_shard_id);
+    f_shard.reset();
+    f_shard_id = 0;
+    f_shard_busy = false;
+}
+
+
+/** \brief Check whether this connection is handled by an I/O shard.
+ *
+ * \return true if attach_shard() was successful.
+ */
+bool base_connection::is_sharded() const
+{
+    return f_shard != nullptr;
+}
+
+
+/** \brief Get the I/O shard of this connection.
+ *
+ * \return The shard handling this connection or nullptr.
+ */
+io_shard::pointer_t base_connection::get_shard() const
+{
+    return f_shard;
+}
+
+
+/** \brief Handle a message read by the I/O shard.
+ *
+ * The connections which can be sharded override this function and
+ * process the message as if they had read it themselves. The default
+ * implementation ignores the message.
+ *
+ * \param[in] msg  The message received.
+ */
+void base_connection::shard_message(ed::message & msg)
+{
+    snapdev::NOT_USED(msg);
+}
+
+
+/** \brief Write data through the I/O shard.
+ *
+ * The shard gets one chunk at a time. While it writes it, the data goes
+ * to the output queue as it would wait in the eventdispatcher buffer
+ * of a connection which is not sharded.
+ *
+ * \param[in] data  The data to write.
+ * \param[in] length  The size of \p data in bytes.
+ *
+ * \return The number of bytes written or queued.
+ */
+ssize_t base_connection::shard_write(void const * data, std::size_t length)
+{
+    if(queue_output(data, length, f_shard_busy))
+    {
+        return length;
+    }
+    f_shard_busy = true;
+    f_shard->write(f_shard_id, std::string(reinterpret_cast<char const *>(data), length));
+    return length;
+}
+
+
+/** \brief The I/O shard wrote the last chunk.
+ *
+ * The next chunk of the output queue is handed to the shard. Once
+ * nothing is left and the connection was marked done, it gets removed
+ * as the eventdispatcher does once the buffer of such a connection is
+ * empty.
+ */
+void base_connection::shard_drained()
+{
+    f_shard_busy = false;
+    std::string data(dequeue_output());
+    if(!data.empty())
+    {
+        f_shard_busy = true;
+        f_shard->write(f_shard_id, std::move(data));
+    }
+    output_progressed();
+
+    ed::connection * conn(dynamic_cast<ed::connection *>(this));
+    if(!f_shard_busy
+    && conn != nullptr
+    && conn->is_done())
+    {
+        conn->remove_from_communicator();
+    }
+}
+
+
+/** \brief Define the priority of the data written next.
+ *
+ * The connections call this function before sending a message so the
+ * queue_output() function knows in which lane to save it. The priority
+ * is expected to be reset to normal once the message was written.
+ *
+ * \param[in] priority  The priority of the message being sent.
+ */
+void base_connection::set_output_priority(message_priority_t priority)
+{
+    f_output_priority = priority;
+}
+
+
+/** \brief Queue data instead of writing it to the socket buffer.
+ *
+ * The connections call this function from their write() function. When
+ * the eventdispatcher buffer (\p has_output) or the output queue are not
+ * empty, the data is added to the output queue and the function returns
+ * true. Otherwise the caller writes the data to its buffer as usual.
+ *
+ * The data goes in the lane defined by set_output_priority().
+ *
+ * \param[in] data  The data to write.
+ * \param[in] length  The size of \p data in bytes.
+ * \param[in] has_output  Whether the eventdispatcher buffer has data.
+ *
+ * \return true if the data was queued.
+ */
+bool base_connection::queue_output(void const * data, std::size_t length, bool has_output)
+{
+    ++f_messages_out;
+    f_bytes_out += length;
+
+    if(!has_output
+    && f_output_queue.empty())
+    {
+        return false;
+    }
+
+    f_output_queue.push(data, length, f_output_priority);
+    output_progressed();
+    return true;
+}
+
+
+/** \brief Retrieve the next chunk of data from the output queue.
+ *
+ * The connections call this function once their eventdispatcher buffer
+ * is empty and write the result to it.
+ *
+ * The time the oldest message of the chunk spent in the queue is saved
+ * in the metrics.
+ *
+ * \return The data to write, an empty string if the queue is empty.
+ */
+std::string base_connection::dequeue_output()
+{
+    std::int64_t queued_on(-1);
+    std::string result(f_output_queue.pop(output_queue::WRITE_CHUNK_SIZE, &queued_on));
+    if(queued_on >= 0
+    && f_server != nullptr)
+    {
+        std::int64_t const now(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+        f_server->output_latency(now - queued_on);
+    }
+    return result;
+}
+
+
+/** \brief Update the congestion state of the output queue.
+ *
+ * When the state changes, the server is told so it can request the
+ * producers to slow down and later to resume.
+ *
+ * \param[in] extra_bytes  Bytes waiting outside of the queue.
+ * \param[in] extra_messages  Messages waiting outside of the queue.
+ */
+void base_connection::output_progressed(std::size_t extra_bytes, std::size_t extra_messages)
+{
+    if(!f_output_queue.update_congestion(extra_bytes, extra_messages))
+    {
+        return;
+    }
+
+    ed::connection * conn(dynamic_cast<ed::connection *>(this));
+    if(conn == nullptr)
+    {
+        throw communicatord::logic_error("somehow a dynamic_cast<ed::connection *> on our base_connection failed.");
+    }
+    if(f_output_queue.is_congested())
+    {
+        SNAP_LOG_WARNING
+            << "connection \""
+            << conn->get_name()
+            << "\" is not reading its messages fast enough ("
+            << f_output_queue.get_bytes() + extra_bytes
+            << " bytes waiting)."
+            << SNAP_LOG_SEND;
+    }
+    else
+    {
+        f_server->consumer_recovered(std::dynamic_pointer_cast<base_connection>(conn->shared_from_this()));
+    }
+}
+
+
+/** \brief Send a message to this connection.
+ *
+ * This function sends \p msg to this connection. The default
+ * implementation searches for the ed::connection_with_send_message
+ * interface of this connection. The connections managed by the server
+ * override this function and directly call their send_message()
+ * function instead.
+ *
+ * \param[in] msg  The message to send.
+ * \param[in] cache  Whether the message can be cached if not sent now.
+ *
+ * \return true if the message was sent (or cached).
+ */
 bool base_connection::send_message_to_connection(ed::message & msg, bool cache)
 {
     ed::connection * conn(dynamic_cast<ed::connection *>(this));
@@ -556,6 +1459,30 @@ bool base_connection::send_message_to_connection(ed::message & msg, bool cache)
 }
 
 
+/** \brief Send an already serialized message to this connection.
+ *
+ * When the same message is sent to many connections (i.e. a broadcast),
+ * the server serializes it once and calls this function with the result
+ * on each connection. The connections which can write a buffer to their
+ * socket override this function and send \p serialized as is.
+ *
+ * The default implementation ignores \p serialized and sends \p msg
+ * with send_message_to_connection().
+ *
+ * \param[in] msg  The message being sent.
+ * \param[in] serialized  The message already converted to a string,
+ * including the ending newline character.
+ *
+ * \return true if the message was sent.
+ */
+bool base_connection::send_serialized_message(ed::message & msg, std::string const & serialized)
+{
+    snapdev::NOT_USED(serialized);
+
+    return send_message_to_connection(msg);
+}
+
+
 
 } // namespace communicator_daemon
 // vim: ts=4 sw=4 et
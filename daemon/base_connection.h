@@ -29,6 +29,14 @@
 
 // self
 //
+#include    "admission_control.h"
+#include    "clock_offset.h"
+#include    "command_ids.h"
+#include    "failure_detector.h"
+#include    "gateway.h"
+#include    "io_shard.h"
+#include    "output_queue.h"
+#include    "rate_limiter.h"
 #include    "server.h"
 
 
@@ -37,6 +45,11 @@
 #include    <eventdispatcher/connection.h>
 
 
+// C++
+//
+#include    <cstdint>
+
+
 
 namespace communicator_daemon
 {
@@ -80,28 +93,85 @@ public:
     void                        set_services(std::string const & services);
     void                        get_services(advgetopt::string_set_t & services);
     bool                        has_service(std::string const & name);
+    void                        set_capabilities(std::string const & capabilities);
+    bool                        has_capability(std::string const & capability) const;
     void                        set_services_heard_of(std::string const & services);
+    void                        set_services_heard_of(advgetopt::string_set_t const & services);
     void                        get_services_heard_of(advgetopt::string_set_t & services);
     void                        add_commands(std::string const & commands);
-    bool                        understand_command(std::string const & command);
+    bool                        understand_command(std::string const & command) const;
+    bool                        understand_command(command_id_t command) const;
+    bool                        understand_command(command_id_t command, std::string const & name) const;
     bool                        has_commands() const;
+    void                        get_commands(advgetopt::string_set_t & commands) const;
     void                        remove_command(std::string const & command);
     void                        mark_as_remote();
     bool                        is_remote() const;
     bool                        is_udp() const;
     void                        set_wants_loadavg(bool wants_loadavg);
     bool                        wants_loadavg() const;
+    void                        set_loadavg(float avg, time_t received_on);
+    float                       get_loadavg(time_t now) const;
+    bool                        request_loadavg();
+    bool                        cork_output();
+    void                        uncork_output();
+    bool                        is_corked() const;
+    bool                        batch_output(std::size_t size, bool flush, std::size_t max_bytes);
+    void                        set_compression(int level, std::size_t threshold);
+    int                         get_compression_level() const;
+    std::size_t                 get_compression_threshold() const;
+    void                        set_output_limits(
+                                      std::size_t high_bytes
+                                    , std::size_t high_messages
+                                    , std::size_t low_bytes
+                                    , std::size_t low_messages);
+    void                        set_slow_consumer_policy(slow_consumer_policy_t policy);
+    slow_consumer_policy_t      get_slow_consumer_policy() const;
+    bool                        is_output_congested() const;
+    std::size_t                 get_queued_bytes() const;
+    std::size_t                 get_queued_messages() const;
+    std::size_t                 get_dropped_messages() const;
+    void                        count_message_in();
+    std::uint64_t               get_messages_in() const;
+    std::uint64_t               get_messages_out() const;
+    std::uint64_t               get_bytes_out() const;
+    std::size_t                 add_dropped_message();
+    bool                        add_throttled_producer(pointer_t producer);
+    void                        set_output_priority(message_priority_t priority);
+    vector_t                    get_throttled_producers();
+    failure_detector &          get_failure_detector();
+    clock_offset &              get_clock_offset();
+    ingress_limiter &           get_ingress_limiter();
+    void                        set_admission_ticket(admission_control::ticket && ticket);
+    void                        set_gateway_mode(gateway_mode_t mode);
+    gateway_mode_t              get_gateway_mode() const;
+    void                        set_gateway(bool gateway);
+    bool                        is_gateway() const;
+    bool                        attach_shard(io_shard::pointer_t shard);
+    void                        detach_shard();
+    bool                        is_sharded() const;
+    io_shard::pointer_t         get_shard() const;
+    virtual void                shard_message(ed::message & msg);
+    void                        shard_drained();
 
     // allows us to send messages directly from the base_connection class
-    bool                        send_message_to_connection(ed::message & msg, bool cache = false);
+    virtual bool                send_message_to_connection(ed::message & msg, bool cache = false);
+    virtual bool                send_serialized_message(ed::message & msg, std::string const & serialized);
 
     virtual int                 get_socket() const = 0;
 
 protected:
+    bool                        queue_output(void const * data, std::size_t length, bool has_output);
+    std::string                 dequeue_output();
+    void                        output_progressed(std::size_t extra_bytes = 0, std::size_t extra_messages = 0);
+    ssize_t                     shard_write(void const * data, std::size_t length);
+
     server::pointer_t           f_server = server::pointer_t();
 
 private:
-    advgetopt::string_set_t     f_understood_commands = advgetopt::string_set_t();
+    std::vector<bool>           f_understood_commands = std::vector<bool>();    // indexed by command_id_t
+    advgetopt::string_set_t     f_understood_other_commands = advgetopt::string_set_t();    // commands without an identifier
+    std::size_t                 f_understood_commands_count = 0;
     time_t                      f_started_on = -1;
     time_t                      f_ended_on = -1;
     connection_type_t           f_type = connection_type_t::CONNECTION_TYPE_DOWN;
@@ -109,11 +179,36 @@ private:
     addr::addr                  f_connection_address = addr::addr();
     advgetopt::string_set_t     f_services = advgetopt::string_set_t();
     advgetopt::string_set_t     f_services_heard_of = advgetopt::string_set_t();
+    advgetopt::string_set_t     f_capabilities = advgetopt::string_set_t();
     std::string                 f_username = std::string();
     std::string                 f_password = std::string();
     bool                        f_remote_connection = false;
     bool                        f_wants_loadavg = false;
+    bool                        f_loadavg_requested = false;
+    bool                        f_corked = false;
+    std::size_t                 f_corked_bytes = 0;
+    int                         f_compression_level = 0;
+    std::size_t                 f_compression_threshold = 0;
+    output_queue                f_output_queue = output_queue();
+    slow_consumer_policy_t      f_slow_consumer_policy = slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DROP;
+    message_priority_t          f_output_priority = message_priority_t::MESSAGE_PRIORITY_NORMAL;
+    std::vector<std::weak_ptr<base_connection>>
+                                f_throttled_producers = std::vector<std::weak_ptr<base_connection>>();
+    float                       f_loadavg = -1.0f;
+    time_t                      f_loadavg_received_on = 0;
     bool                        f_is_udp = false;
+    std::uint64_t               f_messages_in = 0;
+    std::uint64_t               f_messages_out = 0;
+    std::uint64_t               f_bytes_out = 0;
+    failure_detector            f_failure_detector = failure_detector();
+    clock_offset                f_clock_offset = clock_offset();
+    ingress_limiter             f_ingress_limiter = ingress_limiter();
+    admission_control::ticket   f_admission_ticket = admission_control::ticket();
+    gateway_mode_t              f_gateway_mode = gateway_mode_t::GATEWAY_MODE_NEVER;
+    bool                        f_gateway = false;
+    io_shard::pointer_t         f_shard = io_shard::pointer_t();
+    std::uint32_t               f_shard_id = 0;
+    bool                        f_shard_busy = false;
 };
 
 
@@ -0,0 +1,224 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the Bloom filter.
+ *
+ * The broadcast messages include the list of neighbors which were
+ * already informed of that message. In a large cluster, that list
+ * becomes several kilobytes. Peers which support it receive a Bloom
+ * filter instead, which has a size proportional to the number of
+ * neighbors but much smaller than the list of IP addresses.
+ *
+ * The filter is transmitted as an hexadecimal string. The hashes are
+ * computed with our own FNV-1a implementation so all the daemons
+ * generate the exact same bits whatever the compiler or library used.
+ *
+ * A Bloom filter can return false positives. With 16 bits per entry and
+ * 8 hashes the probability is about 0.05%. A false positive means one
+ * neighbor is considered informed when it is not. The gossip broadcast
+ * sends the message through several paths so that neighbor is still
+ * expected to receive it.
+ */
+
+// self
+//
+#include    "bloom_filter.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+namespace
+{
+
+
+
+std::uint64_t fnv1a(std::string const & key, std::uint64_t seed)
+{
+    std::uint64_t h(14695981039346656037ULL ^ seed);
+    for(auto const c : key)
+    {
+        h ^= static_cast<std::uint8_t>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+
+
+} // no name namespace
+
+
+
+/** \brief Initialize a Bloom filter.
+ *
+ * The size of the filter is computed from the number of entries
+ * expected to be added to it. The number of bits is always a multiple
+ * of 64, at least MINIMUM_BITS and at most MAXIMUM_BITS.
+ *
+ * \param[in] expected_entries  The number of entries expected in the filter.
+ */
+bloom_filter::bloom_filter(std::size_t expected_entries)
+{
+    std::size_t bits(MAXIMUM_BITS);
+    if(expected_entries < MAXIMUM_BITS / BITS_PER_ENTRY)
+    {
+        bits = expected_entries * BITS_PER_ENTRY;
+        if(bits < MINIMUM_BITS)
+        {
+            bits = MINIMUM_BITS;
+        }
+    }
+    f_bits.resize((bits + 63) / 64);
+}
+
+
+/** \brief Add a key to the filter.
+ *
+ * \param[in] key  The key to add.
+ */
+void bloom_filter::add(std::string const & key)
+{
+    std::size_t const count(bit_count());
+    std::uint64_t const h1(fnv1a(key, 0));
+    std::uint64_t const h2(fnv1a(key, h1) | 1);
+    for(std::size_t i(0); i < HASH_COUNT; ++i)
+    {
+        std::size_t const bit((h1 + i * h2) % count);
+        f_bits[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+
+/** \brief Check whether a key is in the filter.
+ *
+ * \param[in] key  The key to search.
+ *
+ * \return true if the key is possibly in the filter, false if it
+ * definitely is not.
+ */
+bool bloom_filter::contains(std::string const & key) const
+{
+    std::size_t const count(bit_count());
+    std::uint64_t const h1(fnv1a(key, 0));
+    std::uint64_t const h2(fnv1a(key, h1) | 1);
+    for(std::size_t i(0); i < HASH_COUNT; ++i)
+    {
+        std::size_t const bit((h1 + i * h2) % count);
+        if((f_bits[bit / 64] & (1ULL << (bit % 64))) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** \brief Return the number of bits in this filter.
+ *
+ * \return The size of the filter in bits.
+ */
+std::size_t bloom_filter::bit_count() const
+{
+    return f_bits.size() * 64;
+}
+
+
+/** \brief Convert the filter to a string.
+ *
+ * The filter is converted to an hexadecimal string so it can be used
+ * as a message parameter.
+ *
+ * \return The filter as a string.
+ */
+std::string bloom_filter::to_string() const
+{
+    static char const g_hex[] = "0123456789abcdef";
+
+    std::string result;
+    result.reserve(f_bits.size() * 16);
+    for(auto const word : f_bits)
+    {
+        for(int shift(60); shift >= 0; shift -= 4)
+        {
+            result += g_hex[(word >> shift) & 15];
+        }
+    }
+    return result;
+}
+
+
+/** \brief Load a filter from a string.
+ *
+ * This function replaces the current filter with the one defined in
+ * \p encoded, a string as generated by to_string().
+ *
+ * The string comes from a peer so it is validated: it must be a
+ * multiple of 16 lowercase hexadecimal digits (64 bits) and define
+ * between MINIMUM_BITS and MAXIMUM_BITS bits.
+ *
+ * \param[in] encoded  The hexadecimal representation of the filter.
+ *
+ * \return true if the string was valid, false otherwise, in which case
+ * the filter is not modified.
+ */
+bool bloom_filter::from_string(std::string const & encoded)
+{
+    if(encoded.length() < MINIMUM_BITS / 4
+    || encoded.length() > MAXIMUM_BITS / 4
+    || encoded.length() % 16 != 0)
+    {
+        return false;
+    }
+
+    std::vector<std::uint64_t> bits(encoded.length() / 16);
+    for(std::size_t idx(0); idx < encoded.length(); ++idx)
+    {
+        char const c(encoded[idx]);
+        std::uint64_t digit(0);
+        if(c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if(c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        bits[idx / 16] = (bits[idx / 16] << 4) | digit;
+    }
+    f_bits.swap(bits);
+
+    return true;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,63 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of a Bloom filter.
+ *
+ * The Communicator uses a Bloom filter to send a compact representation
+ * of the list of neighbors already informed of a broadcast message.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <string>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+class bloom_filter
+{
+public:
+    static std::size_t const    BITS_PER_ENTRY = 16;
+    static std::size_t const    HASH_COUNT = 8;
+    static std::size_t const    MINIMUM_BITS = 256;
+    static std::size_t const    MAXIMUM_BITS = 1'048'576;    // 128Kb, 256Kb once encoded
+
+                        bloom_filter(std::size_t expected_entries = 0);
+
+    void                add(std::string const & key);
+    bool                contains(std::string const & key) const;
+    std::size_t         bit_count() const;
+    std::string         to_string() const;
+    bool                from_string(std::string const & encoded);
+
+private:
+    std::vector<std::uint64_t>
+                        f_bits = std::vector<std::uint64_t>();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -22,6 +22,16 @@
  * The Communicator is able to memorize messages it receives when the
  * destination is not yet known. The structure here is used to manage that
  * cache.
+ *
+ * Messages are kept in buckets, one per destination service, so when a
+ * service registers only its own messages are checked. A heap sorted by
+ * timeout is used to find messages that have to be removed. The server
+ * uses a timer to call remove_old_messages() when the next message times
+ * out (see get_next_timeout()).
+ *
+ * When a limit is reached, the oldest messages are evicted first, from
+ * the same service when the per service limit is reached and from any
+ * service when the total limit is reached.
  */
 
 // self
@@ -32,12 +42,7 @@
 
 // communicatord
 //
-#include    <communicatord/names.h>
-
-
-// advgetopt
-//
-#include    <advgetopt/validator_duration.h>
+#include    <communicatord/cache_parameter.h>
 
 
 // snaplogger
@@ -45,11 +50,6 @@
 #include    <snaplogger/message.h>
 
 
-// snapdev
-//
-#include    <snapdev/tokenize_string.h>
-
-
 // last include
 //
 #include    <snapdev/poison.h>
@@ -61,6 +61,68 @@ namespace communicator_daemon
 
 
 
+/** \brief Define the limits of the cache.
+ *
+ * The cache limits the number of messages and the total number of bytes
+ * it holds for each service and overall. Once a limit is reached, the
+ * oldest messages get evicted to make space for the new message.
+ *
+ * A limit of zero is viewed as "no limit".
+ *
+ * \note
+ * Changing the limits does not evict messages already cached. The new
+ * limits apply the next time a message is added.
+ *
+ * \param[in] max_messages  The maximum number of messages in the cache.
+ * \param[in] max_bytes  The maximum number of bytes in the cache.
+ * \param[in] max_service_messages  The maximum number of messages per service.
+ * \param[in] max_service_bytes  The maximum number of bytes per service.
+ */
+void cache::set_limits(
+      std::size_t max_messages
+    , std::size_t max_bytes
+    , std::size_t max_service_messages
+    , std::size_t max_service_bytes)
+{
+    f_max_messages = max_messages;
+    f_max_bytes = max_bytes;
+    f_max_service_messages = max_service_messages;
+    f_max_service_bytes = max_service_bytes;
+}
+
+
+/** \brief Save the cache in a journal.
+ *
+ * This function creates a journal so the messages in the cache survive
+ * a restart of the daemon. The messages found in an existing journal
+ * which did not yet time out are added back to the cache.
+ *
+ * This function is expected to be called once on startup, before any
+ * message gets cached.
+ *
+ * \param[in] filename  The path to the journal file.
+ */
+void cache::set_journal(std::string const & filename)
+{
+    f_journal = std::make_shared<cache_journal>(filename);
+    cache_journal::entry::vector_t entries(f_journal->recover());
+    for(auto & e : entries)
+    {
+        ed::message msg;
+        if(!msg.from_message(e.f_message))
+        {
+            f_journal->remove(e.f_serial);
+            continue;
+        }
+        insert(e.f_serial, e.f_timeout_timestamp, std::move(msg), std::move(e.f_message));
+        if(e.f_serial >= f_next_serial)
+        {
+            f_next_serial = e.f_serial + 1;
+        }
+    }
+}
+
+
 /** \brief Cache the specified message.
  *
  * This function caches the specified message.
@@ -74,12 +136,15 @@ namespace communicator_daemon
  *   is an approximation; the default is 60 seconds; durations can be defined
  *   with a time such as 1m for one minute and 3h for three hours
  *
+ * The parameter is parsed by communicatord::parse_cache_parameter() so the
+ * client outbound queue interprets it the same way.
+ *
  * \warning
  * The `reply=true` has no effect if the message gets cached. In that case,
  * the function always returns cache_message_t::CACHE_MESSAGE_CACHED.
  *
- * \todo
- * Limit the cache size.
+ * If the message is larger than the per service or total limit in
+ * bytes, then it does not get cached at all.
  *
  * \todo
  * Do not cache more than one signal message (i.e. PING, STOP, LOG...)
@@ -91,95 +156,90 @@ namespace communicator_daemon
  */
 cache_message_t cache::cache_message(ed::message & msg)
 {
-    std::string cache_value;
-    if(msg.has_parameter(communicatord::g_name_communicatord_param_cache))
+    communicatord::cache_parameter const parameter(communicatord::parse_cache_parameter(msg));
+
+    // should we send a reply to the sender?
+    //
+    cache_message_t const response(parameter.f_reply
+                ? cache_message_t::CACHE_MESSAGE_REPLY
+                : cache_message_t::CACHE_MESSAGE_IGNORE);
+
+    // are we allowed to cache this message?
+    //
+    if(parameter.f_no_cache)
     {
-        cache_value = msg.get_parameter(communicatord::g_name_communicatord_param_cache);
+        return response;
     }
 
-    // convert `cache` in a map of name/value parameters
+    // the size is an approximation of the memory used by this message
     //
-    std::list<std::string> cache_parameters;
-    snapdev::tokenize_string(cache_parameters, cache_value, { ";" }, true);
-    std::map<std::string, std::string> params;
-    for(auto const & p : cache_parameters)
+    std::string serialized(msg.to_message());
+    std::size_t const size(serialized.length());
+    if((f_max_service_bytes != 0 && size > f_max_service_bytes)
+    || (f_max_bytes != 0 && size > f_max_bytes))
     {
-        std::string::size_type pos(p.find('='));
-        if(pos == std::string::npos)
-        {
-            params[p] = "true"; // a.k.a. defined
-        }
-        else if(pos == 0)
-        {
-            SNAP_LOG_NOTICE
-                << "invalid cache parameter \""
-                << p
-                << "\"; expected \"<name>[=<value>]\"; \"<name>\" is missing, it cannot be empty."
-                << SNAP_LOG_SEND;
-        }
-        else
-        {
-            params[p.substr(0, pos)] = p.substr(pos + 1);
-        }
+        SNAP_LOG_WARNING
+            << "message \""
+            << msg.get_command()
+            << "\" for service \""
+            << msg.get_service()
+            << "\" is too large to be cached ("
+            << size
+            << " bytes)."
+            << SNAP_LOG_SEND;
+        return response;
     }
 
-    // should we send a reply to the sender?
+    // make room in the service bucket
+    //
+    // note: the bucket only gets created by insert() and erase() removes
+    //       it once empty so we have to search it again after each erase
     //
-    cache_message_t response(cache_message_t::CACHE_MESSAGE_IGNORE);
+    for(;;)
     {
-        auto it(params.find("reply"));
-        if(it != params.end())
+        auto b(f_buckets.find(msg.get_service()));
+        if(b == f_buckets.end()
+        || ((f_max_service_messages == 0 || b->second.f_messages.size() < f_max_service_messages)
+         && (f_max_service_bytes == 0 || b->second.f_bytes + size <= f_max_service_bytes)))
         {
-            response = cache_message_t::CACHE_MESSAGE_REPLY;
+            break;
         }
+        ++f_evicted;
+        erase(b, b->second.f_messages.begin());
     }
 
-    // are we allowed to cache this message?
+    // make room in the cache as a whole
+    //
+    while(f_count > 0
+       && ((f_max_messages != 0 && f_count >= f_max_messages)
+        || (f_max_bytes != 0 && f_bytes + size > f_max_bytes)))
     {
-        auto it(params.find("no"));
-        if(it != params.end())
-        {
-            return response;
-        }
+        evict_oldest();
     }
 
-    std::int64_t ttl(60);
+    // save the message
+    //
+    time_t const timeout(time(nullptr) + parameter.f_ttl);
+    std::uint64_t const serial(f_next_serial++);
+
+    if(f_journal != nullptr)
     {
-        // get TTL if defined (1 min. per default)
-        //
-        auto it(params.find("ttl"));
-        if(it != params.end())
-        {
-            double value(0.0);
-            if(!advgetopt::validator_duration::convert_string(
-                      it->second
-                    , advgetopt::validator_duration::VALIDATOR_DURATION_DEFAULT_FLAGS
-                    , value))
-            {
-                SNAP_LOG_ERROR
-                    << "cache TTL parameter is not a valid integer ("
-                    << it->second
-                    << ")."
-                    << SNAP_LOG_SEND;
-            }
-            else if(value < 10.0 || value > 86400.0)
-            {
-                SNAP_LOG_UNIMPORTANT
-                    << "cache TTL is out of range ("
-                    << it->second
-                    << "); expected a number between 10 and 86400."
-                    << SNAP_LOG_SEND;
-            }
-            else
-            {
-                ttl = static_cast<std::int64_t>(ceil(value));
-            }
-        }
+        cache_journal::entry e;
+        e.f_serial = serial;
+        e.f_timeout_timestamp = timeout;
+        e.f_message = serialized;
+        f_journal->add(e);
     }
 
-    // save the message
+    // the caller still uses msg so it gets copied, the serialized
+    // version is moved
     //
-    f_message_cache.emplace_back(time(nullptr) + ttl, msg);
+    insert(serial, timeout, ed::message(msg), std::move(serialized));
+
+    if(f_journal != nullptr)
+    {
+        check_compaction();
+    }
 
 //#ifdef _DEBUG
 //    // to make sure we get messages cached as expected
@@ -189,7 +249,7 @@ cache_message_t cache::cache_message(ed::message & msg)
 //        << "], server_name=[" << server_name
 //        << "], service=[" << service
 //        << "], message=[" << msg.to_message()
-//        << "], ttl=[" << ttl
+//        << "], ttl=[" << parameter.f_ttl
 //        << "]"
 //        << SNAP_LOG_SEND;
 //#endif
@@ -198,40 +258,309 @@ cache_message_t cache::cache_message(ed::message & msg)
 }
 
 
-void cache::remove_old_messages()
+/** \brief Remove messages that timed out.
+ *
+ * This function removes all the messages with a timeout smaller than
+ * \p now. The expiry heap is used so only messages that timed out
+ * are visited.
+ *
+ * Messages that were already sent or evicted leave an entry in the heap.
+ * These are simply ignored when they reach the top.
+ *
+ * \param[in] now  The current time.
+ */
+void cache::remove_old_messages(time_t now)
+{
+    while(!f_expiry.empty()
+       && now > f_expiry.top().f_timeout_timestamp)
+    {
+        expiry const & e(f_expiry.top());
+        auto b(f_buckets.find(e.f_service));
+        if(b != f_buckets.end())
+        {
+            auto m(b->second.f_messages.find(e.f_serial));
+            if(m != b->second.f_messages.end())
+            {
+                erase(b, m);
+            }
+        }
+        f_expiry.pop();
+    }
+}
+
+
+/** \brief Get the time when the next message times out.
+ *
+ * This function returns the timeout of the message at the top of the
+ * expiry heap. That message may already be gone in which case calling
+ * remove_old_messages() at that time has no other effect than cleaning
+ * up the heap.
+ *
+ * \return The next timeout or -1 if the cache is empty.
+ */
+time_t cache::get_next_timeout() const
+{
+    if(f_expiry.empty())
+    {
+        return -1;
+    }
+
+    return f_expiry.top().f_timeout_timestamp;
+}
+
+
+/** \brief Send the messages cached for the specified service.
+ *
+ * This function calls \p callback with each message cached for
+ * \p service, oldest first. When the callback returns true, the message
+ * is considered sent and it gets removed from the cache. Messages that
+ * timed out are removed without calling the callback.
+ *
+ * The callback may add messages to the cache or evict some (i.e. the
+ * connection gets congested again and the message is cached back). To
+ * support that, no iterator is kept between two calls and only the
+ * messages present on entry are visited.
+ *
+ * \param[in] service  The name of the service which just registered.
+ * \param[in] callback  The function called to send each message.
+ */
+void cache::process_messages(
+      std::string const & service
+    , std::function<bool(ed::message & msg)> callback)
 {
+    auto b(f_buckets.find(service));
+    if(b == f_buckets.end())
+    {
+        return;
+    }
+
+    // messages cached by the callback get a larger serial number
+    //
+    std::uint64_t const last(b->second.f_messages.rbegin()->first);
+    std::uint64_t serial(b->second.f_messages.begin()->first);
+
     time_t const now(time(nullptr));
-    auto it(f_message_cache.begin());
-    while(it != f_message_cache.end())
+    for(;;)
     {
-        if(now > it->f_timeout_timestamp)
+        b = f_buckets.find(service);
+        if(b == f_buckets.end())
         {
-            it = f_message_cache.erase(it);
+            return;
         }
-        else
+        auto m(b->second.f_messages.lower_bound(serial));
+        if(m == b->second.f_messages.end()
+        || m->first > last)
         {
-            ++it;
+            return;
+        }
+        serial = m->first + 1;
+
+        if(now > m->second.f_timeout_timestamp)
+        {
+            erase(b, m);
+            continue;
+        }
+        if(callback(m->second.f_message))
+        {
+            // the callback may have evicted that message
+            //
+            b = f_buckets.find(service);
+            if(b != f_buckets.end())
+            {
+                m = b->second.f_messages.find(serial - 1);
+                if(m != b->second.f_messages.end())
+                {
+                    erase(b, m);
+                }
+            }
         }
     }
 }
 
 
-void cache::process_messages(std::function<bool(ed::message & msg)> callback)
+/** \brief Get the total number of messages in the cache.
+ *
+ * \return The number of messages currently cached.
+ */
+std::size_t cache::size() const
 {
-    time_t const now(time(nullptr));
-    auto it(f_message_cache.begin());
-    while(it != f_message_cache.end())
+    return f_count;
+}
+
+
+/** \brief Get the number of messages cached for the specified service.
+ *
+ * \param[in] service  The name of the service.
+ *
+ * \return The number of messages cached for that service.
+ */
+std::size_t cache::size(std::string const & service) const
+{
+    auto const b(f_buckets.find(service));
+    if(b == f_buckets.end())
     {
-        if(callback(it->f_message)
-        || now > it->f_timeout_timestamp)
+        return 0;
+    }
+    return b->second.f_messages.size();
+}
+
+
+/** \brief Get the total number of bytes in the cache.
+ *
+ * \return The sum of the size of all the serialized messages.
+ */
+std::size_t cache::get_bytes() const
+{
+    return f_bytes;
+}
+
+
+/** \brief Get the number of messages evicted so far.
+ *
+ * This counter is incremented each time a message gets removed from the
+ * cache because a limit was reached.
+ *
+ * \return The number of evicted messages.
+ */
+std::size_t cache::get_evicted() const
+{
+    return f_evicted;
+}
+
+
+/** \brief Insert a message in the cache.
+ *
+ * This function adds \p msg to the bucket of its service and to the
+ * expiry heap. The limits must already have been enforced.
+ *
+ * \param[in] serial  The serial number of the message.
+ * \param[in] timeout  When the message times out.
+ * \param[in] msg  The message, moved to the cache.
+ * \param[in] serialized  The serialized version of \p msg, moved to the
+ * cache when journaling.
+ */
+void cache::insert(
+      std::uint64_t serial
+    , time_t timeout
+    , ed::message && msg
+    , std::string && serialized)
+{
+    // note: the bucket may have been removed by evict_oldest() so we
+    //       cannot reuse the one found by our caller
+    //
+    auto b(f_buckets.emplace(msg.get_service(), bucket()).first);
+    message_cache & m(b->second.f_messages[serial]);
+    m.f_timeout_timestamp = timeout;
+    m.f_size = serialized.length();
+    if(f_journal != nullptr)
+    {
+        m.f_serialized = std::move(serialized);
+    }
+    b->second.f_bytes += m.f_size;
+    ++f_count;
+    f_bytes += m.f_size;
+
+    expiry e;
+    e.f_timeout_timestamp = timeout;
+    e.f_serial = serial;
+    e.f_service = b->first;
+    f_expiry.push(std::move(e));
+    m.f_message = std::move(msg);
+}
+
+
+/** \brief Start a compaction of the journal if necessary.
+ *
+ * The journal only grows. Once it is much larger than the cache, this
+ * function gives it a copy of the messages still in the cache so it can
+ * write a new, smaller journal in the background.
+ */
+void cache::check_compaction()
+{
+    if(!f_journal->needs_compaction(f_bytes))
+    {
+        return;
+    }
+
+    cache_journal::entry::vector_t live;
+    live.reserve(f_count);
+    for(auto const & b : f_buckets)
+    {
+        for(auto const & m : b.second.f_messages)
+        {
+            cache_journal::entry e;
+            e.f_serial = m.first;
+            e.f_timeout_timestamp = m.second.f_timeout_timestamp;
+            e.f_message = m.second.f_serialized;
+            live.push_back(std::move(e));
+        }
+    }
+    f_journal->compact(std::move(live));
+}
+
+
+/** \brief Erase one message from the cache.
+ *
+ * This function removes message \p m from bucket \p b and updates the
+ * counters. If the bucket becomes empty, it gets removed too.
+ *
+ * The expiry heap is not updated. The corresponding entry is ignored
+ * once it reaches the top of the heap.
+ *
+ * \param[in] b  The bucket holding the message.
+ * \param[in] m  The message to erase.
+ */
+void cache::erase(
+      bucket::map_t::iterator b
+    , message_cache::map_t::iterator m)
+{
+    if(f_journal != nullptr)
+    {
+        f_journal->remove(m->first);
+    }
+
+    b->second.f_bytes -= m->second.f_size;
+    f_bytes -= m->second.f_size;
+    --f_count;
+    b->second.f_messages.erase(m);
+    if(b->second.f_messages.empty())
+    {
+        f_buckets.erase(b);
+    }
+
+    if(f_journal != nullptr)
+    {
+        check_compaction();
+    }
+}
+
+
+/** \brief Evict the oldest message of the cache.
+ *
+ * The oldest message is the one with the smallest serial number. Each
+ * bucket is sorted by serial number so only the first message of each
+ * bucket needs to be checked.
+ */
+void cache::evict_oldest()
+{
+    auto oldest(f_buckets.end());
+    for(auto b(f_buckets.begin()); b != f_buckets.end(); ++b)
+    {
+        if(b->second.f_messages.empty())
         {
-            it = f_message_cache.erase(it);
+            continue;
         }
-        else
+        if(oldest == f_buckets.end()
+        || b->second.f_messages.begin()->first < oldest->second.f_messages.begin()->first)
         {
-            ++it;
+            oldest = b;
         }
     }
+    if(oldest != f_buckets.end())
+    {
+        ++f_evicted;
+        erase(oldest, oldest->second.f_messages.begin());
+    }
 }
 
 
@@ -23,8 +23,18 @@
  * The Communicator is able to memorize messages it receives when the
  * destination is not yet available. The class here is used to manage that
  * cache.
+ *
+ * The messages are saved in one bucket per destination service and
+ * an expiry heap is used to remove messages as soon as they timed out.
+ * The cache is limited in number of messages and bytes, per service
+ * and overall.
  */
 
+// self
+//
+#include    "cache_journal.h"
+
+
 // eventdispatcher
 //
 #include    <eventdispatcher/message.h>
@@ -32,8 +42,11 @@
 
 // C++
 //
+#include    <ctime>
 #include    <functional>
-#include    <list>
+#include    <map>
+#include    <queue>
+#include    <vector>
 
 
 
@@ -52,22 +65,88 @@ enum class cache_message_t
 class cache
 {
 public:
+    static std::size_t const    DEFAULT_MAX_MESSAGES = 10'000;
+    static std::size_t const    DEFAULT_MAX_BYTES = 16 * 1024 * 1024;
+    static std::size_t const    DEFAULT_MAX_SERVICE_MESSAGES = 1'000;
+    static std::size_t const    DEFAULT_MAX_SERVICE_BYTES = 1024 * 1024;
+
+    void                set_limits(
+                              std::size_t max_messages
+                            , std::size_t max_bytes
+                            , std::size_t max_service_messages
+                            , std::size_t max_service_bytes);
+    void                set_journal(std::string const & filename);
     cache_message_t     cache_message(ed::message & msg);
-    void                remove_old_messages();
-    void                process_messages(std::function<bool(ed::message & msg)> callback);
+    void                remove_old_messages(time_t now = time(nullptr));
+    time_t              get_next_timeout() const;
+    void                process_messages(
+                              std::string const & service
+                            , std::function<bool(ed::message & msg)> callback);
+    std::size_t         size() const;
+    std::size_t         size(std::string const & service) const;
+    std::size_t         get_bytes() const;
+    std::size_t         get_evicted() const;
 
 private:
     class message_cache
     {
     public:
-        typedef std::list<message_cache>  list_t;
+        typedef std::map<std::uint64_t, message_cache>  map_t;   // indexed by serial number, i.e. oldest first
 
         time_t              f_timeout_timestamp = 0;            // when that message is to be removed from the cache even if it wasn't sent to its destination
+        std::size_t         f_size = 0;                         // size of the message once serialized
         ed::message         f_message = ed::message();          // the message
+        std::string         f_serialized = std::string();       // the serialized message, only kept when journaling
+    };
+
+    class bucket
+    {
+    public:
+        typedef std::map<std::string, bucket>   map_t;          // indexed by service name
+
+        message_cache::map_t
+                            f_messages = message_cache::map_t();
+        std::size_t         f_bytes = 0;
+    };
+
+    class expiry
+    {
+    public:
+        typedef std::vector<expiry>             vector_t;
+
+        bool                operator > (expiry const & rhs) const { return f_timeout_timestamp > rhs.f_timeout_timestamp; }
+
+        time_t              f_timeout_timestamp = 0;
+        std::uint64_t       f_serial = 0;
+        std::string         f_service = std::string();
     };
 
-    message_cache::list_t
-                        f_message_cache = message_cache::list_t();
+    typedef std::priority_queue<expiry, expiry::vector_t, std::greater<expiry>>
+                        expiry_heap_t;
+
+    void                insert(
+                              std::uint64_t serial
+                            , time_t timeout
+                            , ed::message && msg
+                            , std::string && serialized);
+    void                check_compaction();
+    void                erase(
+                              bucket::map_t::iterator b
+                            , message_cache::map_t::iterator m);
+    void                evict_oldest();
+
+    bucket::map_t       f_buckets = bucket::map_t();
+    expiry_heap_t       f_expiry = expiry_heap_t();
+    cache_journal::pointer_t
+                        f_journal = cache_journal::pointer_t();
+    std::uint64_t       f_next_serial = 0;
+    std::size_t         f_count = 0;
+    std::size_t         f_bytes = 0;
+    std::size_t         f_evicted = 0;
+    std::size_t         f_max_messages = DEFAULT_MAX_MESSAGES;
+    std::size_t         f_max_bytes = DEFAULT_MAX_BYTES;
+    std::size_t         f_max_service_messages = DEFAULT_MAX_SERVICE_MESSAGES;
+    std::size_t         f_max_service_bytes = DEFAULT_MAX_SERVICE_BYTES;
 };
 
 
@@ -0,0 +1,746 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the cache journal.
+ *
+ * The journal is an append-only file saved under the data path. Each
+ * message added to the cache generates an "add" record and each message
+ * removed from the cache (sent, evicted or timed out) generates a
+ * "remove" record:
+ *
+ * \code
+ *     +<serial> <timeout> <size>\n<message>\n
+ *     -<serial>\n
+ * \endcode
+ *
+ * On startup, the journal is memory mapped and parsed. The messages that
+ * were added and not removed and which did not yet time out are given
+ * back to the cache. A partially written record at the end of the file
+ * (i.e. the daemon was killed while writing) is ignored.
+ *
+ * The records are not written by the main thread. add() and remove()
+ * append them to a buffer and a background thread writes that buffer
+ * and calls fdatasync() once per batch. The batches are at least
+ * cache_journal::SYNC_INTERVAL apart, so a crash loses at most the
+ * records of the last SYNC_INTERVAL plus the time of one fdatasync().
+ *
+ * Since the file only grows, it gets compacted once it is much larger
+ * than the messages still in the cache. The same thread writes the new
+ * file: the messages still in the cache followed by the records appended
+ * since. Records which were already applied to that snapshot do no harm
+ * when replayed since the serial numbers are never reused. The new file
+ * is synced before it replaces the old one.
+ */
+
+// self
+//
+#include    "cache_journal.h"
+
+
+// cppthread
+//
+#include    <cppthread/guard.h>
+#include    <cppthread/mutex.h>
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <chrono>
+#include    <cstring>
+#include    <map>
+
+
+// C
+//
+#include    <fcntl.h>
+#include    <sys/mman.h>
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace
+{
+
+
+
+char const g_journal_header[] = "CACHE-JOURNAL 1\n";
+
+
+std::string add_record(cache_journal::entry const & e)
+{
+    std::string record("+");
+    record += std::to_string(e.f_serial);
+    record += ' ';
+    record += std::to_string(e.f_timeout_timestamp);
+    record += ' ';
+    record += std::to_string(e.f_message.length());
+    record += '\n';
+    record += e.f_message;
+    record += '\n';
+    return record;
+}
+
+
+bool write_all(int fd, std::string const & data)
+{
+    char const * s(data.data());
+    std::size_t size(data.length());
+    while(size > 0)
+    {
+        ssize_t const r(::write(fd, s, size));
+        if(r < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        s += r;
+        size -= r;
+    }
+    return true;
+}
+
+
+std::int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/** \brief Make a rename() durable.
+ *
+ * The new name of a file is only on disk once its directory was synced.
+ *
+ * \param[in] filename  The name of the file which was renamed.
+ */
+void sync_directory(std::string const & filename)
+{
+    std::string::size_type const pos(filename.rfind('/'));
+    std::string const dir(pos == std::string::npos ? std::string(".") : filename.substr(0, pos + 1));
+    int const fd(::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if(fd >= 0)
+    {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+
+/** \brief Write a new journal and replace \p filename with it.
+ *
+ * \param[in] filename  The journal to replace.
+ * \param[in] entries  The messages to save in the new journal.
+ * \param[in] records  Records to append after the messages.
+ *
+ * \return true if the new journal replaced the old one.
+ */
+bool replace_journal(
+      std::string const & filename
+    , cache_journal::entry::vector_t const & entries
+    , std::string const & records)
+{
+    std::string const tmp(filename + ".tmp");
+    int const fd(::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+    bool valid(fd >= 0 && write_all(fd, g_journal_header));
+    for(auto const & e : entries)
+    {
+        if(!valid)
+        {
+            break;
+        }
+        valid = write_all(fd, add_record(e));
+    }
+    if(valid)
+    {
+        valid = write_all(fd, records)
+             && ::fdatasync(fd) == 0;
+    }
+    if(fd >= 0)
+    {
+        ::close(fd);
+    }
+    if(!valid
+    || rename(tmp.c_str(), filename.c_str()) != 0)
+    {
+        int const e(errno);
+        unlink(tmp.c_str());
+        errno = e;
+        return false;
+    }
+    sync_directory(filename);
+    return true;
+}
+
+
+bool read_number(char const * & s, char const * end, char stop, std::uint64_t & value)
+{
+    value = 0;
+    char const * start(s);
+    for(; s < end && *s >= '0' && *s <= '9'; ++s)
+    {
+        value = value * 10 + (*s - '0');
+    }
+    if(s == start || s >= end || *s != stop)
+    {
+        return false;
+    }
+    ++s;
+    return true;
+}
+
+
+
+} // no name namespace
+
+
+
+namespace detail
+{
+
+
+
+class journal_writer
+    : public cppthread::runner
+{
+public:
+    typedef std::shared_ptr<journal_writer>     pointer_t;
+
+                        journal_writer(std::string const & filename, int fd);
+                        journal_writer(journal_writer const &) = delete;
+                        ~journal_writer();
+    journal_writer &    operator = (journal_writer const &) = delete;
+
+    void                append(std::string const & record);
+    bool                compact(cache_journal::entry::vector_t && live);
+    bool                is_compacting() const;
+    std::size_t         get_size() const;
+
+    // implementation of runner
+    //
+    virtual void        run() override;
+
+private:
+    void                write_batch(std::string const & batch);
+    void                write_compaction(cache_journal::entry::vector_t const & live, std::string const & batch);
+
+    std::string const               f_filename;
+    int                             f_fd = -1;          // only used by the thread
+    bool                            f_failed = false;   // only used by the thread
+    mutable cppthread::mutex        f_mutex = cppthread::mutex();
+    std::string                     f_buffer = std::string();
+    cache_journal::entry::vector_t  f_live = cache_journal::entry::vector_t();
+    bool                            f_compacting = false;
+    std::size_t                     f_size = 0;
+};
+
+
+journal_writer::journal_writer(std::string const & filename, int fd)
+    : runner("cache-journal")
+    , f_filename(filename)
+    , f_fd(fd)
+{
+    struct stat st;
+    if(fstat(f_fd, &st) == 0)
+    {
+        f_size = st.st_size;
+    }
+}
+
+
+journal_writer::~journal_writer()
+{
+    if(f_fd >= 0)
+    {
+        ::close(f_fd);
+    }
+}
+
+
+/** \brief Give a record to the writer thread.
+ *
+ * \param[in] record  The record to append to the journal.
+ */
+void journal_writer::append(std::string const & record)
+{
+    cppthread::guard lock(f_mutex);
+    f_buffer += record;
+    f_size += record.length();
+    f_mutex.signal();
+}
+
+
+/** \brief Ask the writer thread to compact the journal.
+ *
+ * \param[in] live  The messages currently in the cache.
+ *
+ * \return false if a compaction is already in progress.
+ */
+bool journal_writer::compact(cache_journal::entry::vector_t && live)
+{
+    cppthread::guard lock(f_mutex);
+    if(f_compacting)
+    {
+        return false;
+    }
+    f_live = std::move(live);
+    f_compacting = true;
+    f_mutex.signal();
+    return true;
+}
+
+
+bool journal_writer::is_compacting() const
+{
+    cppthread::guard lock(f_mutex);
+    return f_compacting;
+}
+
+
+std::size_t journal_writer::get_size() const
+{
+    cppthread::guard lock(f_mutex);
+    return f_size;
+}
+
+
+void journal_writer::run()
+{
+    std::int64_t last_sync(0);
+    for(;;)
+    {
+        std::string batch;
+        cache_journal::entry::vector_t live;
+        bool compacting(false);
+        {
+            cppthread::guard lock(f_mutex);
+            while(f_buffer.empty()
+               && !f_compacting)
+            {
+                // the records appended before the stop still get written
+                //
+                if(!continue_running())
+                {
+                    return;
+                }
+                f_mutex.timed_wait(100'000);
+            }
+
+            // let the next records accumulate so we call fdatasync()
+            // at most once per SYNC_INTERVAL
+            //
+            for(;;)
+            {
+                std::int64_t const wait(last_sync + cache_journal::SYNC_INTERVAL - now_us());
+                if(wait <= 0
+                || !continue_running())
+                {
+                    break;
+                }
+                f_mutex.timed_wait(wait);
+            }
+
+            batch.swap(f_buffer);
+            if(f_compacting)
+            {
+                live.swap(f_live);
+                compacting = true;
+            }
+        }
+
+        if(compacting)
+        {
+            write_compaction(live, batch);
+        }
+        else
+        {
+            write_batch(batch);
+        }
+        last_sync = now_us();
+    }
+}
+
+
+void journal_writer::write_batch(std::string const & batch)
+{
+    if(f_fd < 0
+    || f_failed)
+    {
+        return;
+    }
+
+    if(!write_all(f_fd, batch)
+    || ::fdatasync(f_fd) != 0)
+    {
+        // avoid flooding the logs, the next compaction tries again
+        //
+        int const e(errno);
+        f_failed = true;
+        SNAP_LOG_ERROR
+            << "could not write to cache journal \""
+            << f_filename
+            << "\" (errno: "
+            << e
+            << ", "
+            << strerror(e)
+            << ")."
+            << SNAP_LOG_SEND;
+    }
+}
+
+
+/** \brief Replace the journal with a compacted one.
+ *
+ * The \p batch is first saved in the current journal so nothing is lost
+ * if the compaction fails. The new journal includes \p live and \p batch
+ * since \p batch may include records appended after \p live was created.
+ *
+ * \param[in] live  The messages in the cache when the compaction started.
+ * \param[in] batch  The records appended since the last batch.
+ */
+void journal_writer::write_compaction(cache_journal::entry::vector_t const & live, std::string const & batch)
+{
+    write_batch(batch);
+
+    bool const valid(replace_journal(f_filename, live, batch));
+    if(valid)
+    {
+        int const fd(::open(f_filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC));
+        if(fd >= 0)
+        {
+            if(f_fd >= 0)
+            {
+                ::close(f_fd);
+            }
+            f_fd = fd;
+            f_failed = false;
+        }
+    }
+    else
+    {
+        SNAP_LOG_WARNING
+            << "compaction of cache journal \""
+            << f_filename
+            << "\" failed; keeping the existing journal."
+            << SNAP_LOG_SEND;
+    }
+
+    struct stat st;
+    bool const has_size(fstat(f_fd, &st) == 0);
+
+    cppthread::guard lock(f_mutex);
+    if(has_size)
+    {
+        // the records appended during the compaction are not yet in
+        // the file
+        //
+        f_size = st.st_size + f_buffer.length();
+    }
+    f_compacting = false;
+}
+
+
+
+} // namespace detail
+
+
+
+/** \class cache_journal
+ * \brief Save the cached messages in a file.
+ *
+ * This class manages the journal of the cache. The cache calls add()
+ * and remove() each time it adds or removes a message and calls
+ * recover() once on startup to retrieve the messages that were still
+ * cached when the daemon stopped.
+ */
+
+
+/** \brief Initialize the journal.
+ *
+ * The constructor only saves the filename. The file gets opened by the
+ * recover() function which has to be called first.
+ *
+ * \param[in] filename  The path to the journal file.
+ */
+cache_journal::cache_journal(std::string const & filename)
+    : f_filename(filename)
+{
+}
+
+
+/** \brief Clean up the journal.
+ *
+ * The destructor stops the writer thread which first writes and syncs
+ * the records still in its buffer. If a compaction is still running,
+ * the destructor waits for it to be done.
+ */
+cache_journal::~cache_journal()
+{
+    if(f_thread != nullptr)
+    {
+        f_thread->stop();
+    }
+}
+
+
+/** \brief Read the journal and return the messages to restore.
+ *
+ * This function memory maps the journal and parses all the records. The
+ * messages which were added and not removed and which did not yet time
+ * out are returned, sorted by serial number.
+ *
+ * The function then rewrites the journal so it only includes those
+ * messages and starts the thread which appends the new records.
+ *
+ * \param[in] now  The current time, used to ignore timed out messages.
+ *
+ * \return The messages to put back in the cache.
+ */
+cache_journal::entry::vector_t cache_journal::recover(time_t now)
+{
+    std::map<std::uint64_t, entry> entries;
+
+    int const fd(::open(f_filename.c_str(), O_RDONLY | O_CLOEXEC));
+    if(fd >= 0)
+    {
+        struct stat st;
+        if(fstat(fd, &st) == 0
+        && static_cast<std::size_t>(st.st_size) >= sizeof(g_journal_header) - 1)
+        {
+            void * data(mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+            if(data != MAP_FAILED)
+            {
+                char const * s(reinterpret_cast<char const *>(data));
+                char const * end(s + st.st_size);
+                if(memcmp(s, g_journal_header, sizeof(g_journal_header) - 1) == 0)
+                {
+                    s += sizeof(g_journal_header) - 1;
+                    while(s < end)
+                    {
+                        char const type(*s++);
+                        std::uint64_t serial(0);
+                        if(type == '-')
+                        {
+                            if(!read_number(s, end, '\n', serial))
+                            {
+                                break;
+                            }
+                            entries.erase(serial);
+                            continue;
+                        }
+                        std::uint64_t timeout(0);
+                        std::uint64_t size(0);
+                        if(type != '+'
+                        || !read_number(s, end, ' ', serial)
+                        || !read_number(s, end, ' ', timeout)
+                        || !read_number(s, end, '\n', size)
+                        || static_cast<std::uint64_t>(end - s) < size + 1
+                        || s[size] != '\n')
+                        {
+                            break;
+                        }
+                        entry & e(entries[serial]);
+                        e.f_serial = serial;
+                        e.f_timeout_timestamp = static_cast<time_t>(timeout);
+                        e.f_message = std::string(s, size);
+                        s += size + 1;
+                    }
+                    if(s < end)
+                    {
+                        SNAP_LOG_WARNING
+                            << "cache journal \""
+                            << f_filename
+                            << "\" ends with an invalid or partial record; it was ignored."
+                            << SNAP_LOG_SEND;
+                    }
+                }
+                else
+                {
+                    SNAP_LOG_WARNING
+                        << "cache journal \""
+                        << f_filename
+                        << "\" has an invalid header; it was ignored."
+                        << SNAP_LOG_SEND;
+                }
+                munmap(data, st.st_size);
+            }
+        }
+        ::close(fd);
+    }
+
+    entry::vector_t result;
+    result.reserve(entries.size());
+    for(auto & e : entries)
+    {
+        if(e.second.f_timeout_timestamp >= now)
+        {
+            result.push_back(std::move(e.second));
+        }
+    }
+
+    // rewrite the journal with only the messages we keep
+    //
+    int out(-1);
+    if(replace_journal(f_filename, result, std::string()))
+    {
+        out = ::open(f_filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    if(out < 0)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "could not create cache journal \""
+            << f_filename
+            << "\" (errno: "
+            << e
+            << ", "
+            << strerror(e)
+            << "); messages will not be saved."
+            << SNAP_LOG_SEND;
+        return result;
+    }
+
+    f_writer = std::make_shared<detail::journal_writer>(f_filename, out);
+    f_thread = std::make_shared<cppthread::thread>("cache-journal", f_writer);
+    f_thread->start();
+
+    SNAP_LOG_INFO
+        << "recovered "
+        << result.size()
+        << " message(s) from cache journal \""
+        << f_filename
+        << "\"."
+        << SNAP_LOG_SEND;
+
+    return result;
+}
+
+
+/** \brief Append a message to the journal.
+ *
+ * \param[in] e  The message being added to the cache.
+ */
+void cache_journal::add(entry const & e)
+{
+    append(add_record(e));
+}
+
+
+/** \brief Mark a message as removed from the cache.
+ *
+ * \param[in] serial  The serial number of the message that was removed.
+ */
+void cache_journal::remove(std::uint64_t serial)
+{
+    std::string record("-");
+    record += std::to_string(serial);
+    record += '\n';
+    append(record);
+}
+
+
+/** \brief Check whether the journal should be compacted.
+ *
+ * The journal is compacted once it is at least COMPACTION_MINIMUM_SIZE
+ * bytes and more than twice the size of the messages still cached.
+ *
+ * \param[in] live_bytes  The number of bytes of the messages still cached.
+ *
+ * \return true if compact() should be called.
+ */
+bool cache_journal::needs_compaction(std::size_t live_bytes) const
+{
+    if(f_writer == nullptr
+    || f_writer->is_compacting())
+    {
+        return false;
+    }
+    std::size_t const size(f_writer->get_size());
+    return size > COMPACTION_MINIMUM_SIZE
+        && size > live_bytes * 2;
+}
+
+
+/** \brief Check whether a compaction is currently running.
+ *
+ * \return true if the writer thread was asked to compact the journal and
+ * is not yet done.
+ */
+bool cache_journal::is_compacting() const
+{
+    return f_writer != nullptr
+        && f_writer->is_compacting();
+}
+
+
+/** \brief Start the compaction of the journal.
+ *
+ * This function gives \p live to the writer thread which writes a new
+ * journal with those messages and the records appended in the meantime
+ * and then replaces the current journal with it.
+ *
+ * \param[in] live  The messages currently in the cache.
+ */
+void cache_journal::compact(entry::vector_t && live)
+{
+    if(f_writer == nullptr)
+    {
+        return;
+    }
+    f_writer->compact(std::move(live));
+}
+
+
+/** \brief Append one record to the journal.
+ *
+ * The record is written by the writer thread with the next batch.
+ *
+ * \param[in] record  The record to append.
+ */
+void cache_journal::append(std::string const & record)
+{
+    if(f_writer == nullptr)
+    {
+        return;
+    }
+    f_writer->append(record);
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,104 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the cache journal.
+ *
+ * The cache of messages waiting for a local service can optionally be
+ * saved in a journal so it survives a restart of the Communicator.
+ *
+ * The records are written and synced to disk by a background thread, in
+ * batches. A record reaches the disk at most SYNC_INTERVAL plus the time
+ * of one fdatasync() after add() or remove() returned. A crash loses the
+ * records of that window: a message cached just before is lost and a
+ * message sent just before may be sent again after the restart.
+ */
+
+// cppthread
+//
+#include    <cppthread/runner.h>
+#include    <cppthread/thread.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <ctime>
+#include    <memory>
+#include    <string>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace detail
+{
+class journal_writer;
+typedef std::shared_ptr<journal_writer>     journal_writer_pointer_t;
+}
+
+
+class cache_journal
+{
+public:
+    typedef std::shared_ptr<cache_journal>  pointer_t;
+
+    static std::size_t const    COMPACTION_MINIMUM_SIZE = 1024 * 1024;
+    static std::int64_t const   SYNC_INTERVAL = 100'000;    // microseconds between two fdatasync()
+
+    class entry
+    {
+    public:
+        typedef std::vector<entry>          vector_t;
+
+        std::uint64_t       f_serial = 0;
+        time_t              f_timeout_timestamp = 0;
+        std::string         f_message = std::string();          // the serialized message
+    };
+
+                        cache_journal(std::string const & filename);
+                        cache_journal(cache_journal const &) = delete;
+                        ~cache_journal();
+    cache_journal &     operator = (cache_journal const &) = delete;
+
+    entry::vector_t     recover(time_t now = time(nullptr));
+    void                add(entry const & e);
+    void                remove(std::uint64_t serial);
+    bool                needs_compaction(std::size_t live_bytes) const;
+    bool                is_compacting() const;
+    void                compact(entry::vector_t && live);
+
+private:
+    void                append(std::string const & record);
+
+    std::string         f_filename = std::string();
+    detail::journal_writer_pointer_t
+                        f_writer = detail::journal_writer_pointer_t();
+    cppthread::thread::pointer_t
+                        f_thread = cppthread::thread::pointer_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,78 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of cache_timer object.
+ *
+ * We use a timer to remove the cached messages which timed out before
+ * their destination service registered.
+ */
+
+// self
+//
+#include    "cache_timer.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \class cache_timer
+ * \brief Wake up when the next cached message times out.
+ *
+ * This class is an implementation of a timer used to remove messages
+ * from the cache once they timed out. The server sets the timeout date
+ * of this timer to the timeout of the next message to expire.
+ */
+
+
+/** \brief The timer initialization.
+ *
+ * The timer is created disabled. It gets enabled by the server whenever
+ * a message is added to the cache.
+ *
+ * \param[in] cs  The communicatord server we are listening for.
+ */
+cache_timer::cache_timer(server::pointer_t cs)
+    : timer(-1)  // no delay, we use a timeout date instead
+    , f_server(cs)
+{
+    set_enable(false);
+}
+
+
+void cache_timer::process_timeout()
+{
+    f_server->process_cache_timeout();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
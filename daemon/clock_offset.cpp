@@ -0,0 +1,253 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the clock offset estimator.
+ *
+ * Each HEARTBEAT includes the time at which it was sent (t3 from the
+ * point of view of the receiver). It also echoes the time at which the
+ * last HEARTBEAT of the peer was sent (t1) and the time at which we
+ * received it (t2). When we receive that HEARTBEAT at t4, we have the
+ * four NTP timestamps and compute:
+ *
+ * \code
+ *     offset = ((t2 - t1) + (t3 - t4)) / 2
+ *     rtt    = (t4 - t1) - (t3 - t2)
+ * \endcode
+ *
+ * The offset is the clock of the peer minus our clock. The error on the
+ * offset is at most half the RTT, so like the NTP clock filter, the
+ * estimate is the sample with the smallest RTT in the last few samples.
+ * Samples with a negative or very large RTT are ignored since they can
+ * only be the result of a clock being changed in between.
+ */
+
+// self
+//
+#include    "clock_offset.h"
+
+
+// C++
+//
+#include    <algorithm>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize the clock offset estimator.
+ *
+ * \param[in] window  The number of samples kept to select the estimate.
+ */
+clock_offset::clock_offset(std::size_t window)
+    : f_window(std::max(window, static_cast<std::size_t>(1)))
+{
+}
+
+
+/** \brief Record the reception of a timestamp from the peer.
+ *
+ * This function saves the time at which the peer sent its HEARTBEAT
+ * and the time at which we received it. These are echoed back in our
+ * next HEARTBEAT so the peer can compute its own sample.
+ *
+ * \param[in] peer_sent  The time at which the peer sent the message, in
+ * microseconds, in the peer clock.
+ * \param[in] now  The time at which we received the message, in
+ * microseconds.
+ */
+void clock_offset::received(std::int64_t peer_sent, std::int64_t now)
+{
+    f_peer_sent = peer_sent;
+    f_received = now;
+}
+
+
+/** \brief Get the timestamps to echo back to the peer.
+ *
+ * \param[out] peer_sent  The last time at which the peer sent a message.
+ * \param[out] received  The time at which we received that message.
+ *
+ * \return true if received() was called since the last reset().
+ */
+bool clock_offset::get_echo(std::int64_t & peer_sent, std::int64_t & received) const
+{
+    if(f_received == 0)
+    {
+        return false;
+    }
+    peer_sent = f_peer_sent;
+    received = f_received;
+    return true;
+}
+
+
+/** \brief Add a sample.
+ *
+ * \param[in] origin  The time at which we sent the message the peer
+ * echoed, in our clock (t1).
+ * \param[in] peer_received  The time at which the peer received that
+ * message, in the peer clock (t2).
+ * \param[in] peer_sent  The time at which the peer sent its reply, in
+ * the peer clock (t3).
+ * \param[in] now  The time at which we received the reply (t4).
+ *
+ * \return true if the sample was accepted.
+ */
+bool clock_offset::sample(
+      std::int64_t origin
+    , std::int64_t peer_received
+    , std::int64_t peer_sent
+    , std::int64_t now)
+{
+    std::int64_t const rtt((now - origin) - (peer_sent - peer_received));
+    if(rtt < 0
+    || rtt > MAX_RTT)
+    {
+        return false;
+    }
+
+    sample_t s;
+    s.f_offset = ((peer_received - origin) + (peer_sent - now)) / 2;
+    s.f_rtt = rtt;
+    f_samples.push_back(s);
+    while(f_samples.size() > f_window)
+    {
+        f_samples.pop_front();
+    }
+
+    f_estimate = *std::min_element(
+          f_samples.begin()
+        , f_samples.end()
+        , [](sample_t const & a, sample_t const & b)
+          {
+              return a.f_rtt < b.f_rtt;
+          });
+
+    return true;
+}
+
+
+/** \brief Check whether an estimate is available.
+ *
+ * \return true if at least one sample was accepted.
+ */
+bool clock_offset::has_estimate() const
+{
+    return !f_samples.empty();
+}
+
+
+/** \brief Get the estimated offset.
+ *
+ * \return The clock of the peer minus our clock in microseconds, 0 when
+ * no estimate is available.
+ */
+std::int64_t clock_offset::get_offset() const
+{
+    return f_estimate.f_offset;
+}
+
+
+/** \brief Get the round trip time of the estimate.
+ *
+ * \return The round trip time in microseconds, 0 when no estimate is
+ * available.
+ */
+std::int64_t clock_offset::get_rtt() const
+{
+    return f_estimate.f_rtt;
+}
+
+
+/** \brief Convert a time of the peer to our clock.
+ *
+ * \param[in] peer_time  A time in microseconds in the peer clock.
+ *
+ * \return The same time in our clock.
+ */
+std::int64_t clock_offset::to_local(std::int64_t peer_time) const
+{
+    return peer_time - f_estimate.f_offset;
+}
+
+
+/** \brief Check whether the clock of the peer is off.
+ *
+ * The offset is known within half the RTT, so the peer is only viewed
+ * as skewed if the offset is over \p threshold by more than that.
+ *
+ * \param[in] threshold  The offset accepted, in microseconds.
+ *
+ * \return true if the clock of the peer is off by more than \p threshold.
+ */
+bool clock_offset::is_skewed(std::int64_t threshold) const
+{
+    if(!has_estimate())
+    {
+        return false;
+    }
+    std::int64_t const offset(f_estimate.f_offset < 0 ? -f_estimate.f_offset : f_estimate.f_offset);
+    return offset - f_estimate.f_rtt / 2 > threshold;
+}
+
+
+/** \brief Get the number of samples in the window.
+ *
+ * \return The number of samples.
+ */
+std::size_t clock_offset::size() const
+{
+    return f_samples.size();
+}
+
+
+/** \brief Get the samples in the window.
+ *
+ * \return The samples, oldest first.
+ */
+clock_offset::sample_deque_t const & clock_offset::get_samples() const
+{
+    return f_samples;
+}
+
+
+/** \brief Forget the samples and timestamps.
+ *
+ * This is used when the connection to the peer is reestablished.
+ */
+void clock_offset::reset()
+{
+    f_samples.clear();
+    f_peer_sent = 0;
+    f_received = 0;
+    f_estimate = sample_t();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
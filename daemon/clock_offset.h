@@ -0,0 +1,87 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the clock offset estimator.
+ *
+ * The communicator daemons compare timestamps (broadcast timeouts,
+ * LOADAVG timestamps) which were generated on another computer. When
+ * the clocks of those computers do not agree, these comparisons are
+ * wrong. The clock offset estimator uses the timestamps exchanged in
+ * the HEARTBEAT messages to evaluate the offset between the clock of
+ * a peer and ours, the same way NTP does it.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <deque>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class clock_offset
+{
+public:
+    static constexpr std::size_t const  DEFAULT_WINDOW = 8;
+    static constexpr std::int64_t const MAX_RTT = 10'000'000;                   // 10 seconds
+    static constexpr std::int64_t const DEFAULT_SKEW_THRESHOLD = 1'000'000;     // 1 second
+
+    struct sample_t
+    {
+        std::int64_t            f_offset = 0;       // peer clock minus our clock
+        std::int64_t            f_rtt = 0;
+    };
+
+    typedef std::deque<sample_t>    sample_deque_t;
+
+                                clock_offset(std::size_t window = DEFAULT_WINDOW);
+
+    void                        received(std::int64_t peer_sent, std::int64_t now);
+    bool                        get_echo(std::int64_t & peer_sent, std::int64_t & received) const;
+    bool                        sample(
+                                      std::int64_t origin
+                                    , std::int64_t peer_received
+                                    , std::int64_t peer_sent
+                                    , std::int64_t now);
+    bool                        has_estimate() const;
+    std::int64_t                get_offset() const;
+    std::int64_t                get_rtt() const;
+    std::int64_t                to_local(std::int64_t peer_time) const;
+    bool                        is_skewed(std::int64_t threshold = DEFAULT_SKEW_THRESHOLD) const;
+    std::size_t                 size() const;
+    sample_deque_t const &      get_samples() const;
+    void                        reset();
+
+private:
+    std::size_t                 f_window = DEFAULT_WINDOW;
+    sample_deque_t              f_samples = sample_deque_t();
+    std::int64_t                f_peer_sent = 0;
+    std::int64_t                f_received = 0;
+    sample_t                    f_estimate = sample_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,361 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the command identifiers.
+ *
+ * Each command name gets assigned a unique identifier the first time it
+ * is seen. The commands defined by the communicatord and the
+ * eventdispatcher are assigned an identifier on the first use of the
+ * table so the most used commands have the smallest numbers. The
+ * commands found in the message definitions are seeded at startup.
+ *
+ * Any other command received in a COMMANDS message gets added to the
+ * table up to a limit. Those names come from other processes, including
+ * remote communicator daemons, so without a limit the table would grow
+ * without bounds. Once the limit is reached, intern_command() returns
+ * COMMAND_ID_UNKNOWN and the connections fall back to saving the name
+ * of the command as is (see base_connection::add_commands()).
+ *
+ * The identifiers are only valid within this process. They are never
+ * sent to another process.
+ */
+
+// self
+//
+#include    "command_ids.h"
+
+
+// communicatord
+//
+#include    <communicatord/names.h>
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/names.h>
+
+
+// snapdev
+//
+#include    <snapdev/glob_to_list.h>
+#include    <snapdev/pathinfo.h>
+#include    <snapdev/tokenize_string.h>
+
+
+// C++
+//
+#include    <list>
+#include    <set>
+#include    <unordered_map>
+#include    <vector>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+namespace
+{
+
+
+
+typedef std::unordered_map<std::string, command_id_t>   command_map_t;
+typedef std::vector<std::string const *>                command_names_t;
+
+
+char const * const g_known_commands[] =
+{
+    // eventdispatcher
+    //
+    ed::g_name_ed_cmd_commands,
+    ed::g_name_ed_cmd_help,
+    ed::g_name_ed_cmd_quit,
+    ed::g_name_ed_cmd_quitting,
+    ed::g_name_ed_cmd_ready,
+    ed::g_name_ed_cmd_service_unavailable,
+    ed::g_name_ed_cmd_stop,
+    ed::g_name_ed_cmd_unknown,
+
+    // communicatord
+    //
+    communicatord::g_name_communicatord_cmd_accept,
+    communicatord::g_name_communicatord_cmd_block,
+    communicatord::g_name_communicatord_cmd_clock_stable,
+    communicatord::g_name_communicatord_cmd_clock_status,
+    communicatord::g_name_communicatord_cmd_clock_unstable,
+    communicatord::g_name_communicatord_cmd_cluster_complete,
+    communicatord::g_name_communicatord_cmd_cluster_current_status,
+    communicatord::g_name_communicatord_cmd_cluster_down,
+    communicatord::g_name_communicatord_cmd_cluster_get_status,
+    communicatord::g_name_communicatord_cmd_cluster_incomplete,
+    communicatord::g_name_communicatord_cmd_cluster_status,
+    communicatord::g_name_communicatord_cmd_cluster_up,
+    communicatord::g_name_communicatord_cmd_connect,
+    communicatord::g_name_communicatord_cmd_disconnect,
+    communicatord::g_name_communicatord_cmd_disconnected,
+    communicatord::g_name_communicatord_cmd_disconnecting,
+    communicatord::g_name_communicatord_cmd_flag_down,
+    communicatord::g_name_communicatord_cmd_flag_up,
+    communicatord::g_name_communicatord_cmd_flags,
+    communicatord::g_name_communicatord_cmd_flow_control,
+    communicatord::g_name_communicatord_cmd_forget,
+    communicatord::g_name_communicatord_cmd_gateway,
+    communicatord::g_name_communicatord_cmd_gossip,
+    communicatord::g_name_communicatord_cmd_hangup,
+    communicatord::g_name_communicatord_cmd_heard_of,
+    communicatord::g_name_communicatord_cmd_heartbeat,
+    communicatord::g_name_communicatord_cmd_interest,
+    communicatord::g_name_communicatord_cmd_list_services,
+    communicatord::g_name_communicatord_cmd_listen_flags,
+    communicatord::g_name_communicatord_cmd_listen_loadavg,
+    communicatord::g_name_communicatord_cmd_loadavg,
+    communicatord::g_name_communicatord_cmd_metrics,
+    communicatord::g_name_communicatord_cmd_metrics_report,
+    communicatord::g_name_communicatord_cmd_new_remote_connection,
+    communicatord::g_name_communicatord_cmd_public_ip,
+    communicatord::g_name_communicatord_cmd_received,
+    communicatord::g_name_communicatord_cmd_refuse,
+    communicatord::g_name_communicatord_cmd_register,
+    communicatord::g_name_communicatord_cmd_register_for_flags,
+    communicatord::g_name_communicatord_cmd_register_for_loadavg,
+    communicatord::g_name_communicatord_cmd_server_public_ip,
+    communicatord::g_name_communicatord_cmd_service_status,
+    communicatord::g_name_communicatord_cmd_shm_active,
+    communicatord::g_name_communicatord_cmd_shm_ready,
+    communicatord::g_name_communicatord_cmd_shm_request,
+    communicatord::g_name_communicatord_cmd_shutdown,
+    communicatord::g_name_communicatord_cmd_status,
+    communicatord::g_name_communicatord_cmd_throttle,
+    communicatord::g_name_communicatord_cmd_transmission_report,
+    communicatord::g_name_communicatord_cmd_unreachable,
+    communicatord::g_name_communicatord_cmd_unregister,
+    communicatord::g_name_communicatord_cmd_unregister_from_loadavg,
+};
+
+
+command_names_t g_command_names = command_names_t();
+std::size_t     g_dynamic_command_count = 0;
+std::size_t     g_dynamic_command_limit = DEFAULT_DYNAMIC_COMMAND_LIMIT;
+
+
+command_map_t & get_commands()
+{
+    static command_map_t g_commands;
+
+    if(g_commands.empty())
+    {
+        for(auto const * name : g_known_commands)
+        {
+            auto const r(g_commands.emplace(name, static_cast<command_id_t>(g_commands.size())));
+            if(r.second)
+            {
+                g_command_names.push_back(&r.first->first);
+            }
+        }
+    }
+
+    return g_commands;
+}
+
+
+
+} // no name namespace
+
+
+
+/** \brief Get the identifier of a trusted command, creating it if necessary.
+ *
+ * This function returns the identifier of \p command. If the command
+ * was not yet known, a new identifier is allocated.
+ *
+ * This function is used with the commands found in our own definitions
+ * and configuration so it is not limited. The names received from other
+ * processes must go through intern_command() instead.
+ *
+ * \param[in] command  The name of the command.
+ *
+ * \return The identifier of \p command.
+ */
+command_id_t seed_command(std::string const & command)
+{
+    command_map_t & commands(get_commands());
+    auto const r(commands.emplace(command, static_cast<command_id_t>(commands.size())));
+    if(r.second)
+    {
+        // the keys of an unordered_map do not move on a rehash
+        //
+        g_command_names.push_back(&r.first->first);
+    }
+    return r.first->second;
+}
+
+
+/** \brief Seed the table with the commands of the message definitions.
+ *
+ * This function searches the .conf files found in the colon separated
+ * list of directories \p paths. The name of each file is the name of a
+ * command which gets an identifier. This is done at startup, whether the
+ * messages get validated or not, so the commands of the services we
+ * expect do not count against the dynamic limit.
+ *
+ * \param[in] paths  A colon separated list of directories.
+ *
+ * \return The number of commands found in the definitions.
+ */
+std::size_t seed_commands(std::string const & paths)
+{
+    std::list<std::string> dirs;
+    snapdev::tokenize_string(dirs, paths, { ":" }, true);
+
+    std::size_t count(0);
+    for(auto const & d : dirs)
+    {
+        typedef std::set<std::string> definition_files_t;
+        snapdev::glob_to_list<definition_files_t> files;
+        if(!files.read_path<snapdev::glob_to_list_flag_t::GLOB_FLAG_NO_ESCAPE>(d + "/*.conf"))
+        {
+            continue;
+        }
+        for(auto const & f : files)
+        {
+            std::string const command(snapdev::pathinfo::basename(f, ".conf"));
+            if(!command.empty())
+            {
+                seed_command(command);
+                ++count;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+/** \brief Get the identifier of a command, creating it if possible.
+ *
+ * This function returns the identifier of \p command. If the command
+ * was not yet known and the dynamic limit was not yet reached, a new
+ * identifier is allocated.
+ *
+ * \param[in] command  The name of the command.
+ *
+ * \return The identifier of \p command or COMMAND_ID_UNKNOWN if the
+ * command is not known and the limit was reached.
+ */
+command_id_t intern_command(std::string const & command)
+{
+    command_id_t const id(find_command(command));
+    if(id != COMMAND_ID_UNKNOWN)
+    {
+        return id;
+    }
+    if(g_dynamic_command_count >= g_dynamic_command_limit)
+    {
+        return COMMAND_ID_UNKNOWN;
+    }
+    ++g_dynamic_command_count;
+    return seed_command(command);
+}
+
+
+/** \brief Search for the identifier of a command.
+ *
+ * This function returns the identifier of \p command. If the command
+ * was never interned, then the function returns COMMAND_ID_UNKNOWN.
+ * No connection can understand such a command.
+ *
+ * \param[in] command  The name of the command.
+ *
+ * \return The identifier of \p command or COMMAND_ID_UNKNOWN.
+ */
+command_id_t find_command(std::string const & command)
+{
+    command_map_t const & commands(get_commands());
+    auto const it(commands.find(command));
+    if(it == commands.end())
+    {
+        return COMMAND_ID_UNKNOWN;
+    }
+    return it->second;
+}
+
+
+/** \brief Change the maximum number of commands interned dynamically.
+ *
+ * The commands seeded with seed_command() or seed_commands() are not
+ * counted. Lowering the limit does not remove the commands already
+ * interned.
+ *
+ * \param[in] limit  The maximum number of commands intern_command() adds.
+ */
+void set_dynamic_command_limit(std::size_t limit)
+{
+    g_dynamic_command_limit = limit;
+}
+
+
+/** \brief Return the number of commands interned dynamically.
+ *
+ * \return The number of commands added by intern_command().
+ */
+std::size_t dynamic_command_count()
+{
+    return g_dynamic_command_count;
+}
+
+
+/** \brief Return the number of commands currently interned.
+ *
+ * \return The number of command identifiers allocated so far.
+ */
+std::size_t command_count()
+{
+    return get_commands().size();
+}
+
+
+/** \brief Return the name of a command from its identifier.
+ *
+ * This function is the reverse of intern_command().
+ *
+ * \param[in] command  The identifier of the command.
+ *
+ * \return The name of the command or an empty string if \p command is
+ * not a valid identifier.
+ */
+std::string command_name(command_id_t command)
+{
+    get_commands();
+    if(command >= g_command_names.size())
+    {
+        return std::string();
+    }
+    return *g_command_names[command];
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
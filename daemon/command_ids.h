@@ -0,0 +1,57 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the command identifiers.
+ *
+ * The Communicator converts the names of the commands to small integers
+ * so connections can save the list of commands they understand in a
+ * bitset.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <string>
+
+
+
+namespace communicator_daemon
+{
+
+
+typedef std::uint32_t           command_id_t;
+
+constexpr command_id_t const    COMMAND_ID_UNKNOWN = static_cast<command_id_t>(-1);
+constexpr std::size_t const     DEFAULT_DYNAMIC_COMMAND_LIMIT = 1'024;
+
+
+command_id_t                    seed_command(std::string const & command);
+std::size_t                     seed_commands(std::string const & paths);
+command_id_t                    intern_command(std::string const & command);
+command_id_t                    find_command(std::string const & command);
+void                            set_dynamic_command_limit(std::size_t limit);
+std::size_t                     dynamic_command_count();
+std::size_t                     command_count();
+std::string                     command_name(command_id_t command);
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,251 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the datagram batch.
+ *
+ * The buffers and headers used by recvmmsg() are allocated once, when
+ * the batch is created, so receiving datagrams does not allocate memory.
+ *
+ * The number of datagrams dropped because the socket buffer was full
+ * comes from the SO_RXQ_OVFL option. The kernel attaches its drop
+ * counter to each datagram once that option is turned on.
+ */
+
+// self
+//
+#include    "datagram_batch.h"
+
+
+// C++
+//
+#include    <algorithm>
+#include    <cerrno>
+#include    <cstring>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Allocate the buffers of a batch.
+ *
+ * \param[in] batch_size  The maximum number of datagrams read at once.
+ * \param[in] datagram_size  The maximum size of one datagram. Larger
+ * datagrams are truncated.
+ */
+datagram_batch::datagram_batch(std::size_t batch_size, std::size_t datagram_size)
+    : f_datagram_size(datagram_size)
+    , f_buffer(batch_size * datagram_size)
+    , f_control(batch_size * CMSG_SPACE(sizeof(std::uint32_t)))
+    , f_iovecs(batch_size)
+    , f_headers(batch_size)
+{
+}
+
+
+/** \brief Ask the kernel to report the datagrams it dropped.
+ *
+ * \param[in] socket  The UDP socket.
+ *
+ * \return true if the option is supported.
+ */
+bool datagram_batch::enable_drop_counter(int socket)
+{
+    int const optval(1);
+    return setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, &optval, sizeof(optval)) == 0;
+}
+
+
+/** \brief Change the size of the receive buffer of a socket.
+ *
+ * A larger buffer absorbs larger bursts of datagrams. The function
+ * first tries SO_RCVBUFFORCE which ignores the rmem_max limit when the
+ * process has the CAP_NET_ADMIN capability.
+ *
+ * \param[in] socket  The UDP socket.
+ * \param[in] size  The new size in bytes.
+ *
+ * \return true if the size was changed.
+ */
+bool datagram_batch::set_receive_buffer_size(int socket, int size)
+{
+    if(setsockopt(socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0)
+    {
+        return true;
+    }
+    return setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == 0;
+}
+
+
+/** \brief Read the next batch of datagrams.
+ *
+ * This function reads up to get_batch_size() datagrams without blocking.
+ *
+ * \param[in] socket  The UDP socket to read.
+ *
+ * \return The number of datagrams read, 0 if none were waiting, or -1
+ * on errors (see errno).
+ */
+int datagram_batch::receive(int socket)
+{
+    f_count = 0;
+
+    std::size_t const control_size(CMSG_SPACE(sizeof(std::uint32_t)));
+    for(std::size_t idx(0); idx < f_headers.size(); ++idx)
+    {
+        f_iovecs[idx].iov_base = f_buffer.data() + idx * f_datagram_size;
+        f_iovecs[idx].iov_len = f_datagram_size;
+
+        msghdr & h(f_headers[idx].msg_hdr);
+        memset(&h, 0, sizeof(h));
+        h.msg_iov = &f_iovecs[idx];
+        h.msg_iovlen = 1;
+        h.msg_control = f_control.data() + idx * control_size;
+        h.msg_controllen = control_size;
+        f_headers[idx].msg_len = 0;
+    }
+
+    int const r(recvmmsg(socket, f_headers.data(), f_headers.size(), MSG_DONTWAIT, nullptr));
+    if(r < 0)
+    {
+        if(errno == EAGAIN
+        || errno == EWOULDBLOCK
+        || errno == EINTR)
+        {
+            return 0;
+        }
+        return -1;
+    }
+
+    f_count = r;
+    f_received += r;
+    for(std::size_t idx(0); idx < f_count; ++idx)
+    {
+        msghdr & h(f_headers[idx].msg_hdr);
+        if((h.msg_flags & MSG_TRUNC) != 0)
+        {
+            ++f_truncated;
+        }
+        for(cmsghdr * c(CMSG_FIRSTHDR(&h)); c != nullptr; c = CMSG_NXTHDR(&h, c))
+        {
+            if(c->cmsg_level == SOL_SOCKET
+            && c->cmsg_type == SO_RXQ_OVFL)
+            {
+                std::uint32_t drops(0);
+                memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+
+                // the kernel counter wraps around
+                //
+                f_dropped += static_cast<std::uint32_t>(drops - f_kernel_drops);
+                f_kernel_drops = drops;
+            }
+        }
+    }
+
+    return r;
+}
+
+
+/** \brief Number of datagrams read by the last receive().
+ *
+ * \return The number of datagrams in the batch.
+ */
+std::size_t datagram_batch::size() const
+{
+    return f_count;
+}
+
+
+/** \brief Maximum number of datagrams read at once.
+ *
+ * \return The batch size defined in the constructor.
+ */
+std::size_t datagram_batch::get_batch_size() const
+{
+    return f_headers.size();
+}
+
+
+/** \brief Check whether a datagram was larger than the buffer.
+ *
+ * \param[in] idx  The index of the datagram, from 0 to size() - 1.
+ *
+ * \return true if the datagram was truncated.
+ */
+bool datagram_batch::is_truncated(std::size_t idx) const
+{
+    return (f_headers[idx].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+}
+
+
+/** \brief Retrieve the content of a datagram.
+ *
+ * \param[in] idx  The index of the datagram, from 0 to size() - 1.
+ *
+ * \return The datagram as a string.
+ */
+std::string datagram_batch::get_datagram(std::size_t idx) const
+{
+    std::size_t const length(std::min<std::size_t>(f_headers[idx].msg_len, f_datagram_size));
+    return std::string(f_buffer.data() + idx * f_datagram_size, length);
+}
+
+
+/** \brief Total number of datagrams received.
+ *
+ * \return The number of datagrams read so far, including truncated ones.
+ */
+std::uint64_t datagram_batch::get_received() const
+{
+    return f_received;
+}
+
+
+/** \brief Total number of datagrams dropped by the kernel.
+ *
+ * This counter only works once enable_drop_counter() was called.
+ *
+ * \return The number of datagrams lost because the socket buffer was full.
+ */
+std::uint64_t datagram_batch::get_dropped() const
+{
+    return f_dropped;
+}
+
+
+/** \brief Total number of truncated datagrams.
+ *
+ * \return The number of datagrams larger than the buffer.
+ */
+std::uint64_t datagram_batch::get_truncated() const
+{
+    return f_truncated;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
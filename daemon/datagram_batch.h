@@ -0,0 +1,85 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the datagram batch.
+ *
+ * The UDP signal endpoint can receive bursts of datagrams. The batch
+ * reads many of them with one recvmmsg() call and keeps counters of the
+ * datagrams received, dropped by the kernel, and truncated.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <string>
+#include    <vector>
+
+
+// C
+//
+#include    <sys/socket.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class datagram_batch
+{
+public:
+    static std::size_t const    DEFAULT_BATCH_SIZE = 64;
+    static std::size_t const    DEFAULT_DATAGRAM_SIZE = 4096;
+
+                        datagram_batch(
+                              std::size_t batch_size = DEFAULT_BATCH_SIZE
+                            , std::size_t datagram_size = DEFAULT_DATAGRAM_SIZE);
+
+    static bool         enable_drop_counter(int socket);
+    static bool         set_receive_buffer_size(int socket, int size);
+
+    int                 receive(int socket);
+    std::size_t         size() const;
+    std::size_t         get_batch_size() const;
+    bool                is_truncated(std::size_t idx) const;
+    std::string         get_datagram(std::size_t idx) const;
+    std::uint64_t       get_received() const;
+    std::uint64_t       get_dropped() const;
+    std::uint64_t       get_truncated() const;
+
+private:
+    std::size_t         f_datagram_size = DEFAULT_DATAGRAM_SIZE;
+    std::vector<char>   f_buffer = std::vector<char>();
+    std::vector<char>   f_control = std::vector<char>();
+    std::vector<iovec>  f_iovecs = std::vector<iovec>();
+    std::vector<mmsghdr>
+                        f_headers = std::vector<mmsghdr>();
+    std::size_t         f_count = 0;
+    std::uint64_t       f_received = 0;
+    std::uint64_t       f_dropped = 0;
+    std::uint64_t       f_truncated = 0;
+    std::uint32_t       f_kernel_drops = 0;     // last value of SO_RXQ_OVFL
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,476 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the deferred file writer.
+ *
+ * A call to save() records the new contents and arms a timer. When the
+ * timer times out, the latest contents get written by a thread to a
+ * temporary file which is then renamed over the destination so the file
+ * is always complete. Changes made while the thread runs are written on
+ * the next round.
+ */
+
+// self
+//
+#include    "deferred_file.h"
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/communicator.h>
+#include    <eventdispatcher/thread_done_signal.h>
+#include    <eventdispatcher/timer.h>
+
+
+// cppthread
+//
+#include    <cppthread/guard.h>
+#include    <cppthread/mutex.h>
+
+
+// C
+//
+#include    <fcntl.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace detail
+{
+
+
+
+class deferred_file_timer
+    : public ed::timer
+{
+public:
+    typedef std::shared_ptr<deferred_file_timer>   pointer_t;
+
+                        deferred_file_timer(deferred_file * file);
+
+    virtual void        process_timeout() override;
+
+private:
+    deferred_file *     f_file = nullptr;
+};
+
+
+deferred_file_timer::deferred_file_timer(deferred_file * file)
+    : timer(-1)  // the delay is set on each save()
+    , f_file(file)
+{
+    set_name("deferred file timer");
+    set_enable(false);
+}
+
+
+void deferred_file_timer::process_timeout()
+{
+    set_enable(false);
+    f_file->process_timeout();
+}
+
+
+
+class deferred_file_done
+    : public ed::thread_done_signal
+{
+public:
+    typedef std::shared_ptr<deferred_file_done>   pointer_t;
+
+                        deferred_file_done(deferred_file * file);
+
+    virtual void        process_read() override;
+
+private:
+    deferred_file *     f_file = nullptr;
+};
+
+
+deferred_file_done::deferred_file_done(deferred_file * file)
+    : f_file(file)
+{
+    set_name("deferred file write done");
+}
+
+
+void deferred_file_done::process_read()
+{
+    // the deferred file releases this object
+    //
+    pointer_t keep(std::static_pointer_cast<deferred_file_done>(shared_from_this()));
+
+    remove_from_communicator();
+    f_file->write_done();
+}
+
+
+
+class deferred_file_writer
+    : public cppthread::runner
+{
+public:
+    typedef std::shared_ptr<deferred_file_writer>  pointer_t;
+
+                        deferred_file_writer(
+                              std::string const & filename
+                            , std::string const & contents
+                            , deferred_file_done * done);
+                        deferred_file_writer(deferred_file_writer const &) = delete;
+    deferred_file_writer &
+                        operator = (deferred_file_writer const &) = delete;
+
+    bool                succeeded() const;
+
+    // implementation of runner
+    //
+    virtual void        run() override;
+
+private:
+    std::string                     f_filename = std::string();
+    std::string                     f_contents = std::string();
+    deferred_file_done *            f_done = nullptr;
+    mutable cppthread::mutex        f_mutex = cppthread::mutex();
+    bool                            f_succeeded = false;
+};
+
+
+deferred_file_writer::deferred_file_writer(
+          std::string const & filename
+        , std::string const & contents
+        , deferred_file_done * done)
+    : runner("deferred-file")
+    , f_filename(filename)
+    , f_contents(contents)
+    , f_done(done)
+{
+}
+
+
+bool deferred_file_writer::succeeded() const
+{
+    cppthread::guard lock(f_mutex);
+    return f_succeeded;
+}
+
+
+void deferred_file_writer::run()
+{
+    bool const result(deferred_file::write_file(f_filename, f_contents));
+
+    {
+        cppthread::guard lock(f_mutex);
+        f_succeeded = result;
+    }
+
+    f_done->thread_done();
+}
+
+
+
+} // namespace detail
+
+
+
+/** \class deferred_file
+ * \brief Write a file in the background.
+ *
+ * This class coalesces the changes made to a file within a short delay
+ * and writes the file in a separate thread.
+ *
+ * The callback, if defined, is called in the main thread after each
+ * write with the result of that write.
+ */
+
+
+/** \brief Initialize the deferred file.
+ *
+ * \param[in] filename  The path to the file to write.
+ * \param[in] delay  The number of microseconds to wait for more changes
+ * before writing the file.
+ */
+deferred_file::deferred_file(
+          std::string const & filename
+        , std::int64_t delay)
+    : f_filename(filename)
+    , f_delay(delay)
+{
+}
+
+
+/** \brief Clean up the deferred file.
+ *
+ * If a write is still running, the destructor waits for the thread to
+ * be done. Pending changes are lost; call flush() first to save them.
+ */
+deferred_file::~deferred_file()
+{
+    if(f_thread != nullptr)
+    {
+        f_thread->stop();
+    }
+    if(f_timer != nullptr)
+    {
+        ed::communicator::instance()->remove_connection(f_timer);
+    }
+    if(f_done != nullptr)
+    {
+        ed::communicator::instance()->remove_connection(f_done);
+    }
+}
+
+
+/** \brief Define a function called after each write.
+ *
+ * \param[in] callback  The function to call with true if the file was
+ * written successfully.
+ */
+void deferred_file::set_callback(callback_t callback)
+{
+    f_callback = callback;
+}
+
+
+/** \brief Save new contents.
+ *
+ * The contents are written after the delay unless more changes happen
+ * in the meantime, in which case only the latest contents get written.
+ * The delay is not extended by further changes so a file that keeps
+ * changing still gets written regularly.
+ *
+ * \param[in] contents  The new contents of the file.
+ */
+void deferred_file::save(std::string const & contents)
+{
+    f_contents = contents;
+    f_dirty = true;
+
+    if(f_thread != nullptr)
+    {
+        // write_done() restarts the timer
+        //
+        return;
+    }
+
+    if(f_timer == nullptr)
+    {
+        f_timer = std::make_shared<detail::deferred_file_timer>(this);
+        if(!ed::communicator::instance()->add_connection(f_timer))
+        {
+            f_timer.reset();
+            start_write();
+            return;
+        }
+    }
+    if(!f_timer->is_enabled())
+    {
+        f_timer->set_timeout_delay(f_delay);
+        f_timer->set_enable(true);
+    }
+}
+
+
+/** \brief Write the pending changes now.
+ *
+ * This function is called on shutdown. It waits for the thread if a
+ * write is running and then writes the latest contents from the calling
+ * thread.
+ */
+void deferred_file::flush()
+{
+    if(f_timer != nullptr)
+    {
+        f_timer->set_enable(false);
+    }
+    if(f_thread != nullptr)
+    {
+        ed::communicator::instance()->remove_connection(f_done);
+        finish_write();
+    }
+    if(f_dirty)
+    {
+        f_dirty = false;
+        bool const result(write_file(f_filename, f_contents));
+        if(f_callback)
+        {
+            f_callback(result);
+        }
+    }
+}
+
+
+/** \brief Check whether changes were not yet written.
+ *
+ * \return true if save() was called since the last write started.
+ */
+bool deferred_file::is_pending() const
+{
+    return f_dirty;
+}
+
+
+/** \brief The delay elapsed, write the file.
+ *
+ * This function is called by the timer.
+ */
+void deferred_file::process_timeout()
+{
+    start_write();
+}
+
+
+/** \brief The thread is done writing the file.
+ *
+ * This function is called in the main thread once the write is done. If
+ * more changes happened in the meantime, the timer is started again.
+ */
+void deferred_file::write_done()
+{
+    finish_write();
+
+    if(f_dirty
+    && f_timer != nullptr)
+    {
+        f_timer->set_timeout_delay(f_delay);
+        f_timer->set_enable(true);
+    }
+}
+
+
+/** \brief Write a file atomically.
+ *
+ * The contents are written to "<filename>.tmp" which is then renamed to
+ * \p filename. This way the file is never left half written.
+ *
+ * \param[in] filename  The file to write.
+ * \param[in] contents  The contents of the file.
+ *
+ * \return true if the file was written successfully.
+ */
+bool deferred_file::write_file(
+      std::string const & filename
+    , std::string const & contents)
+{
+    std::string const tmp(filename + ".tmp");
+    int const fd(::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    bool result(true);
+    char const * s(contents.data());
+    std::size_t size(contents.length());
+    while(size > 0)
+    {
+        ssize_t const r(::write(fd, s, size));
+        if(r < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            result = false;
+            break;
+        }
+        s += r;
+        size -= r;
+    }
+    if(result)
+    {
+        result = ::fdatasync(fd) == 0;
+    }
+    if(::close(fd) != 0)
+    {
+        result = false;
+    }
+
+    if(!result
+    || ::rename(tmp.c_str(), filename.c_str()) != 0)
+    {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+void deferred_file::start_write()
+{
+    if(f_thread != nullptr
+    || !f_dirty)
+    {
+        return;
+    }
+
+    f_done = std::make_shared<detail::deferred_file_done>(this);
+    if(!ed::communicator::instance()->add_connection(f_done))
+    {
+        // no event loop, write synchronously
+        //
+        f_done.reset();
+        f_dirty = false;
+        bool const result(write_file(f_filename, f_contents));
+        if(f_callback)
+        {
+            f_callback(result);
+        }
+        return;
+    }
+
+    f_dirty = false;
+    f_writer = std::make_shared<detail::deferred_file_writer>(
+                          f_filename
+                        , f_contents
+                        , f_done.get());
+    f_thread = std::make_shared<cppthread::thread>("deferred-file", f_writer);
+    f_thread->start();
+}
+
+
+void deferred_file::finish_write()
+{
+    f_thread->stop();
+    f_thread.reset();
+
+    bool const result(f_writer->succeeded());
+    f_writer.reset();
+    f_done.reset();
+
+    if(f_callback)
+    {
+        f_callback(result);
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
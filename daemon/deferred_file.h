@@ -0,0 +1,108 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the deferred file writer.
+ *
+ * Some files, such as the list of neighbors, change many times in a row
+ * (i.e. while a cluster forms). The deferred file waits a little before
+ * writing so all the changes get coalesced, and then writes the file in
+ * a separate thread so the event loop never blocks on disk.
+ */
+
+// cppthread
+//
+#include    <cppthread/runner.h>
+#include    <cppthread/thread.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <functional>
+#include    <memory>
+#include    <string>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace detail
+{
+class deferred_file_timer;
+typedef std::shared_ptr<deferred_file_timer>    deferred_file_timer_pointer_t;
+class deferred_file_writer;
+typedef std::shared_ptr<deferred_file_writer>   deferred_file_writer_pointer_t;
+class deferred_file_done;
+typedef std::shared_ptr<deferred_file_done>     deferred_file_done_pointer_t;
+}
+
+
+class deferred_file
+{
+public:
+    typedef std::shared_ptr<deferred_file>      pointer_t;
+    typedef std::function<void(bool succeeded)> callback_t;
+
+    static std::int64_t const   DEFAULT_DELAY = 1'000'000;     // in microseconds
+
+                        deferred_file(
+                              std::string const & filename
+                            , std::int64_t delay = DEFAULT_DELAY);
+                        deferred_file(deferred_file const &) = delete;
+                        ~deferred_file();
+    deferred_file &     operator = (deferred_file const &) = delete;
+
+    void                set_callback(callback_t callback);
+    void                save(std::string const & contents);
+    void                flush();
+    bool                is_pending() const;
+    void                process_timeout();
+    void                write_done();
+
+    static bool         write_file(
+                              std::string const & filename
+                            , std::string const & contents);
+
+private:
+    void                start_write();
+    void                finish_write();
+
+    std::string         f_filename = std::string();
+    std::int64_t        f_delay = DEFAULT_DELAY;
+    callback_t          f_callback = callback_t();
+    std::string         f_contents = std::string();
+    bool                f_dirty = false;
+    detail::deferred_file_timer_pointer_t
+                        f_timer = detail::deferred_file_timer_pointer_t();
+    detail::deferred_file_writer_pointer_t
+                        f_writer = detail::deferred_file_writer_pointer_t();
+    detail::deferred_file_done_pointer_t
+                        f_done = detail::deferred_file_done_pointer_t();
+    cppthread::thread::pointer_t
+                        f_thread = cppthread::thread::pointer_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
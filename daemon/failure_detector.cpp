@@ -0,0 +1,286 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the phi-accrual failure detector.
+ *
+ * The intervals between heartbeats are assumed to follow a normal
+ * distribution. Given the mean and standard deviation of the last
+ * intervals, phi is -log10() of the probability that a heartbeat
+ * arrives later than the time elapsed since the last one. A phi of 1
+ * means a 10% chance of being wrong when declaring the peer gone, a
+ * phi of 2 means 1%, etc.
+ *
+ * The normal CDF is approximated with a logistic function, as described
+ * in the Akka implementation of the detector, which is accurate enough
+ * and much cheaper than erf().
+ *
+ * The acceptable pause is added to the mean so a peer busy with a
+ * garbage collection or a long message does not look gone, and the
+ * standard deviation never goes below MIN_STDDEV so a very regular link
+ * does not get declared down on the smallest delay.
+ */
+
+// self
+//
+#include    "failure_detector.h"
+
+
+// C++
+//
+#include    <algorithm>
+#include    <cmath>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize the failure detector.
+ *
+ * \param[in] window  The number of intervals used to compute the mean
+ * and standard deviation.
+ */
+failure_detector::failure_detector(std::size_t window)
+    : f_window(std::max(window, static_cast<std::size_t>(2)))
+{
+}
+
+
+/** \brief Define the suspect and down thresholds.
+ *
+ * \param[in] suspect_phi  The phi over which the peer is suspected.
+ * \param[in] down_phi  The phi over which the peer is considered down.
+ */
+void failure_detector::set_thresholds(double suspect_phi, double down_phi)
+{
+    f_suspect_phi = suspect_phi;
+    f_down_phi = std::max(suspect_phi, down_phi);
+}
+
+
+/** \brief Define the pause accepted without suspecting the peer.
+ *
+ * \param[in] pause  The pause in microseconds.
+ */
+void failure_detector::set_acceptable_pause(std::int64_t pause)
+{
+    f_acceptable_pause = std::max(pause, static_cast<std::int64_t>(0));
+}
+
+
+/** \brief Start watching a peer.
+ *
+ * Before we receive the first heartbeats, the history is seeded with
+ * the \p expected_interval so the detector works from the start.
+ *
+ * \param[in] now  The current time in microseconds.
+ * \param[in] expected_interval  The interval at which the peer sends
+ * its heartbeats, in microseconds.
+ */
+void failure_detector::start(std::int64_t now, std::int64_t expected_interval)
+{
+    reset();
+
+    std::int64_t const deviation(expected_interval / 4);
+    add_interval(expected_interval - deviation);
+    add_interval(expected_interval + deviation);
+    f_last_heartbeat = now;
+}
+
+
+/** \brief Check whether start() was called.
+ *
+ * \return true if the detector is watching a peer.
+ */
+bool failure_detector::is_started() const
+{
+    return f_last_heartbeat != 0;
+}
+
+
+/** \brief Record the arrival of a heartbeat.
+ *
+ * \param[in] now  The current time in microseconds.
+ */
+void failure_detector::heartbeat(std::int64_t now)
+{
+    if(f_last_heartbeat != 0
+    && now > f_last_heartbeat)
+    {
+        add_interval(now - f_last_heartbeat);
+    }
+    f_last_heartbeat = now;
+}
+
+
+/** \brief Compute the suspicion level.
+ *
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return The current phi, 0.0 if the detector was not started.
+ */
+double failure_detector::phi(std::int64_t now) const
+{
+    if(f_last_heartbeat == 0
+    || f_intervals.empty())
+    {
+        return 0.0;
+    }
+
+    double const count(static_cast<double>(f_intervals.size()));
+    double const mean(f_sum / count + static_cast<double>(f_acceptable_pause));
+    double const stddev(std::max(get_stddev(), static_cast<double>(MIN_STDDEV)));
+
+    double const elapsed(static_cast<double>(now - f_last_heartbeat));
+    double const y((elapsed - mean) / stddev);
+    double const e(std::exp(-y * (1.5976 + 0.070566 * y * y)));
+    if(elapsed > mean)
+    {
+        return -std::log10(e / (1.0 + e));
+    }
+    return -std::log10(1.0 - 1.0 / (1.0 + e));
+}
+
+
+/** \brief Compute the state of the peer.
+ *
+ * This function compares phi to the thresholds and saves the resulting
+ * state. A heartbeat brings a suspect peer back up. A peer which is down
+ * stays down until the detector gets started again.
+ *
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return The new state of the peer.
+ */
+peer_state_t failure_detector::evaluate(std::int64_t now)
+{
+    if(f_state == peer_state_t::PEER_STATE_DOWN)
+    {
+        return f_state;
+    }
+
+    double const p(phi(now));
+    if(p >= f_down_phi)
+    {
+        f_state = peer_state_t::PEER_STATE_DOWN;
+    }
+    else if(p >= f_suspect_phi)
+    {
+        f_state = peer_state_t::PEER_STATE_SUSPECT;
+    }
+    else
+    {
+        f_state = peer_state_t::PEER_STATE_UP;
+    }
+
+    return f_state;
+}
+
+
+/** \brief Get the state computed by the last evaluate().
+ *
+ * \return The state of the peer.
+ */
+peer_state_t failure_detector::get_state() const
+{
+    return f_state;
+}
+
+
+/** \brief Get the mean of the intervals.
+ *
+ * \return The mean in microseconds, 0.0 without history.
+ */
+double failure_detector::get_mean() const
+{
+    if(f_intervals.empty())
+    {
+        return 0.0;
+    }
+    return f_sum / static_cast<double>(f_intervals.size());
+}
+
+
+/** \brief Get the standard deviation of the intervals.
+ *
+ * \return The standard deviation in microseconds, 0.0 without history.
+ */
+double failure_detector::get_stddev() const
+{
+    if(f_intervals.empty())
+    {
+        return 0.0;
+    }
+    double const count(static_cast<double>(f_intervals.size()));
+    double const mean(f_sum / count);
+    return std::sqrt(std::max(f_sum_squares / count - mean * mean, 0.0));
+}
+
+
+/** \brief Get the number of intervals in the history.
+ *
+ * \return The number of intervals.
+ */
+std::size_t failure_detector::size() const
+{
+    return f_intervals.size();
+}
+
+
+/** \brief Forget the history.
+ *
+ * After this call, the detector is stopped and the peer is up.
+ */
+void failure_detector::reset()
+{
+    f_intervals.clear();
+    f_sum = 0.0;
+    f_sum_squares = 0.0;
+    f_last_heartbeat = 0;
+    f_state = peer_state_t::PEER_STATE_UP;
+}
+
+
+void failure_detector::add_interval(std::int64_t interval)
+{
+    double const v(static_cast<double>(interval));
+    f_intervals.push_back(interval);
+    f_sum += v;
+    f_sum_squares += v * v;
+
+    while(f_intervals.size() > f_window)
+    {
+        double const old(static_cast<double>(f_intervals.front()));
+        f_intervals.pop_front();
+        f_sum -= old;
+        f_sum_squares -= old * old;
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,92 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the phi-accrual failure detector.
+ *
+ * The communicator daemons send each other a HEARTBEAT at regular
+ * intervals. The failure detector keeps the recent intervals between
+ * the heartbeats received from one peer and computes the suspicion
+ * level (phi) that this peer is gone. The level grows continuously as
+ * time passes without a heartbeat, which makes the detection adapt to
+ * the jitter of each link instead of depending on a fixed timeout.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <deque>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+enum class peer_state_t
+{
+    PEER_STATE_UP,
+    PEER_STATE_SUSPECT,     // phi went over the suspect threshold
+    PEER_STATE_DOWN,        // phi went over the down threshold
+};
+
+
+class failure_detector
+{
+public:
+    static constexpr std::size_t const  DEFAULT_WINDOW = 100;
+    static constexpr std::int64_t const MIN_STDDEV = 100'000;                   // 100ms
+    static constexpr std::int64_t const DEFAULT_ACCEPTABLE_PAUSE = 3'000'000;   // 3 seconds
+    static constexpr double const       DEFAULT_SUSPECT_PHI = 5.0;
+    static constexpr double const       DEFAULT_DOWN_PHI = 10.0;
+
+                                failure_detector(std::size_t window = DEFAULT_WINDOW);
+
+    void                        set_thresholds(double suspect_phi, double down_phi);
+    void                        set_acceptable_pause(std::int64_t pause);
+    void                        start(std::int64_t now, std::int64_t expected_interval);
+    bool                        is_started() const;
+    void                        heartbeat(std::int64_t now);
+    double                      phi(std::int64_t now) const;
+    peer_state_t                evaluate(std::int64_t now);
+    peer_state_t                get_state() const;
+    double                      get_mean() const;
+    double                      get_stddev() const;
+    std::size_t                 size() const;
+    void                        reset();
+
+private:
+    void                        add_interval(std::int64_t interval);
+
+    std::size_t                 f_window = DEFAULT_WINDOW;
+    double                      f_suspect_phi = DEFAULT_SUSPECT_PHI;
+    double                      f_down_phi = DEFAULT_DOWN_PHI;
+    std::int64_t                f_acceptable_pause = DEFAULT_ACCEPTABLE_PAUSE;
+    std::deque<std::int64_t>    f_intervals = std::deque<std::int64_t>();
+    double                      f_sum = 0.0;
+    double                      f_sum_squares = 0.0;
+    std::int64_t                f_last_heartbeat = 0;
+    peer_state_t                f_state = peer_state_t::PEER_STATE_UP;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,101 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the flag watcher.
+ *
+ * The connection polls the inotify file descriptor of the flag index.
+ * Each time a flag changes, the index reloads that one file and the
+ * snapshot used by the other tools is saved again. The changes are then
+ * published to the flag listeners by the server.
+ */
+
+// self
+//
+#include    "flag_watcher.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize the flag watcher.
+ *
+ * The \p index is expected to already be watching the flag directory.
+ *
+ * \param[in] cs  The communicatord server to inform of the changes.
+ * \param[in] index  The index of the flags to keep up to date.
+ */
+flag_watcher::flag_watcher(
+          server::pointer_t cs
+        , communicatord::flag_index::pointer_t index)
+    : f_server(cs)
+    , f_index(index)
+{
+    set_name("flag watcher");
+}
+
+
+/** \brief Return the inotify file descriptor of the flag index.
+ *
+ * \return The file descriptor to poll.
+ */
+int flag_watcher::get_socket() const
+{
+    return f_index->get_socket();
+}
+
+
+/** \brief The flag watcher only waits for inotify events.
+ *
+ * \return Always true.
+ */
+bool flag_watcher::is_reader() const
+{
+    return true;
+}
+
+
+/** \brief Process the changes of the flag files.
+ *
+ * The index reloads the files which changed. If the set of flags is not
+ * the same anymore, the snapshot gets saved again so flag::load_flags()
+ * does not have to read each file and the server sends the changes to
+ * the services listening to flags.
+ */
+void flag_watcher::process_read()
+{
+    communicatord::flag::list_t changes;
+    if(f_index->process_events(&changes))
+    {
+        f_index->save_snapshot();
+        f_server->flags_changed(changes);
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
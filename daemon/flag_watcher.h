@@ -0,0 +1,70 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the flag watcher.
+ *
+ * This connection wakes up when a flag file gets raised, updated, or
+ * lowered and updates the in-memory index of the flags accordingly.
+ */
+
+// self
+//
+#include    "server.h"
+
+
+// communicatord
+//
+#include    <communicatord/flags.h>
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/connection.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+class flag_watcher
+    : public ed::connection
+{
+public:
+    typedef std::shared_ptr<flag_watcher>       pointer_t;
+
+                        flag_watcher(
+                              server::pointer_t cs
+                            , communicatord::flag_index::pointer_t index);
+
+    // ed::connection implementation
+    virtual int         get_socket() const override;
+    virtual bool        is_reader() const override;
+    virtual void        process_read() override;
+
+private:
+    server::pointer_t   f_server = server::pointer_t();
+    communicatord::flag_index::pointer_t
+                        f_index = communicatord::flag_index::pointer_t();
+};
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,83 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of flush_timer object.
+ *
+ * We use a timer to know when to send the messages batched on the
+ * connections between Communicators.
+ */
+
+// self
+//
+#include    "flush_timer.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \class flush_timer
+ * \brief Flush the batched output of the Communicator links.
+ *
+ * This class is an implementation of a timer used to send the messages
+ * batched on the connections between Communicators. The timer gets
+ * enabled when the first message of a batch is written and times out
+ * after the --link-batch-delay.
+ */
+
+
+/** \brief The timer initialization.
+ *
+ * The timer is created disabled. It gets enabled by the server whenever
+ * a connection starts batching its output.
+ *
+ * The timer gets the lowest priority so that when it times out, the
+ * connections first write their output to their corked socket.
+ *
+ * \param[in] cs  The communicatord server we are listening for.
+ */
+flush_timer::flush_timer(server::pointer_t cs)
+    : timer(-1)  // the delay is set by the server
+    , f_server(cs)
+{
+    set_enable(false);
+    set_priority(EVENT_MAX_PRIORITY);
+}
+
+
+void flush_timer::process_timeout()
+{
+    f_server->process_flush_timeout();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,148 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the gateway election.
+ *
+ * The election does not require any vote. Each communicator daemon
+ * applies the same rules to the list of daemons of its site it is
+ * connected to, itself included, so they all come up with the same
+ * gateways. When a gateway goes down, its links get removed and the
+ * next election picks another daemon.
+ */
+
+// self
+//
+#include    "gateway.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Convert the name of a gateway mode.
+ *
+ * \param[in] name  The name of the mode: "auto", "always" or "never".
+ * \param[out] mode  The resulting mode.
+ *
+ * \return true if \p name is valid.
+ */
+bool parse_gateway_mode(std::string const & name, gateway_mode_t & mode)
+{
+    if(name == "auto")
+    {
+        mode = gateway_mode_t::GATEWAY_MODE_AUTO;
+        return true;
+    }
+    if(name == "always")
+    {
+        mode = gateway_mode_t::GATEWAY_MODE_ALWAYS;
+        return true;
+    }
+    if(name == "never")
+    {
+        mode = gateway_mode_t::GATEWAY_MODE_NEVER;
+        return true;
+    }
+    return false;
+}
+
+
+/** \brief Get the name of a gateway mode.
+ *
+ * \param[in] mode  The mode to convert.
+ *
+ * \return The name as understood by parse_gateway_mode().
+ */
+char const * gateway_mode_to_string(gateway_mode_t mode)
+{
+    switch(mode)
+    {
+    case gateway_mode_t::GATEWAY_MODE_AUTO:
+        return "auto";
+
+    case gateway_mode_t::GATEWAY_MODE_ALWAYS:
+        return "always";
+
+    case gateway_mode_t::GATEWAY_MODE_NEVER:
+        return "never";
+
+    }
+
+    return "auto";
+}
+
+
+/** \brief Elect the gateways of a site.
+ *
+ * The daemons configured as gateways ("always") are all elected, even
+ * if there are more than \p count of them. If there are fewer, the
+ * "auto" daemons with the smallest server names are added until
+ * \p count gateways are elected. The "never" daemons are ignored.
+ *
+ * \param[in] candidates  The daemons of the site and their mode.
+ * \param[in] count  The number of gateways expected.
+ *
+ * \return The server names of the gateways.
+ */
+advgetopt::string_set_t select_gateways(
+      gateway_candidates_t const & candidates
+    , std::size_t count)
+{
+    advgetopt::string_set_t result;
+    if(count == 0)
+    {
+        return result;
+    }
+
+    for(auto const & c : candidates)
+    {
+        if(c.second == gateway_mode_t::GATEWAY_MODE_ALWAYS)
+        {
+            result.insert(c.first);
+        }
+    }
+
+    // the map is sorted by server name
+    //
+    for(auto const & c : candidates)
+    {
+        if(result.size() >= count)
+        {
+            break;
+        }
+        if(c.second == gateway_mode_t::GATEWAY_MODE_AUTO)
+        {
+            result.insert(c.first);
+        }
+    }
+
+    return result;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,66 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the gateway election.
+ *
+ * In hierarchical mode, each site (the communicator daemons reaching
+ * each other through private addresses) has one or two gateways. Only
+ * the gateways send the public broadcasts to the other sites, which
+ * avoids sending the same message over the WAN once per remote
+ * computer.
+ */
+
+// advgetopt
+//
+#include    <advgetopt/utils.h>
+
+
+// C++
+//
+#include    <map>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+enum class gateway_mode_t
+{
+    GATEWAY_MODE_AUTO,          // may get elected
+    GATEWAY_MODE_ALWAYS,        // configured as a gateway
+    GATEWAY_MODE_NEVER,         // never a gateway
+};
+
+
+typedef std::map<std::string, gateway_mode_t>   gateway_candidates_t;       // server name -> mode
+
+
+bool                        parse_gateway_mode(std::string const & name, gateway_mode_t & mode);
+char const *                gateway_mode_to_string(gateway_mode_t mode);
+advgetopt::string_set_t     select_gateways(
+                                  gateway_candidates_t const & candidates
+                                , std::size_t count);
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
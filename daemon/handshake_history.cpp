@@ -0,0 +1,231 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the TLS handshake history.
+ *
+ * The history is keyed by the IP address of the peer (the port is
+ * ignored since a client uses a new port on each connection). Each
+ * entry keeps the dates of the handshakes which happened within the
+ * window. Once a peer goes over its budget, record() returns a delay
+ * which doubles with each extra handshake, up to the window.
+ *
+ * The number of peers is bounded. When full, the peer whose last
+ * handshake is the oldest gets forgotten.
+ */
+
+// self
+//
+#include    "handshake_history.h"
+
+
+// C++
+//
+#include    <algorithm>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize the handshake history.
+ *
+ * \param[in] max_peers  The maximum number of peers to remember.
+ */
+handshake_history::handshake_history(std::size_t max_peers)
+    : f_max_peers(std::max(max_peers, static_cast<std::size_t>(1)))
+{
+}
+
+
+/** \brief Define the number of handshakes allowed per window.
+ *
+ * A peer can do up to \p burst handshakes within \p window microseconds
+ * before it is considered to be flapping.
+ *
+ * \param[in] burst  The number of handshakes allowed, at least 1.
+ * \param[in] window  The duration of the window in microseconds.
+ */
+void handshake_history::set_budget(std::size_t burst, std::int64_t window)
+{
+    f_burst = std::max(burst, static_cast<std::size_t>(1));
+    f_window = std::max(window, FIRST_DELAY);
+}
+
+
+/** \brief Record a full handshake with a peer.
+ *
+ * This function saves the date of a handshake with \p peer. If that
+ * peer went over its budget, the function returns the minimum delay
+ * to wait before the next connection attempt.
+ *
+ * \param[in] peer  The address of the peer.
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return 0 if the peer is within its budget, otherwise the delay in
+ * microseconds.
+ */
+std::int64_t handshake_history::record(addr::addr const & peer, std::int64_t now)
+{
+    ++f_handshakes;
+
+    addr::addr const k(key(peer));
+    auto it(f_peers.find(k));
+    if(it == f_peers.end())
+    {
+        if(f_peers.size() >= f_max_peers)
+        {
+            evict();
+        }
+        it = f_peers.emplace(k, handshake_history::peer()).first;
+    }
+
+    expire(it->second, now);
+    std::deque<std::int64_t> & dates(it->second.f_dates);
+    dates.push_back(now);
+    if(dates.size() <= f_burst)
+    {
+        return 0;
+    }
+
+    // the window is at least FIRST_DELAY so the loop ends
+    //
+    ++f_throttled;
+    std::int64_t delay(FIRST_DELAY);
+    for(std::size_t extra(dates.size() - f_burst); extra > 1 && delay < f_window; --extra)
+    {
+        delay *= 2;
+    }
+    return std::min(delay, f_window);
+}
+
+
+/** \brief Get the number of recent handshakes with a peer.
+ *
+ * \param[in] peer  The address of the peer.
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return The number of handshakes within the window.
+ */
+std::size_t handshake_history::recent(addr::addr const & peer, std::int64_t now) const
+{
+    auto const it(f_peers.find(key(peer)));
+    if(it == f_peers.end())
+    {
+        return 0;
+    }
+    return std::count_if(
+              it->second.f_dates.begin()
+            , it->second.f_dates.end()
+            , [this, now](std::int64_t date) { return date > now - f_window; });
+}
+
+
+/** \brief Forget about a peer.
+ *
+ * \param[in] peer  The address of the peer.
+ *
+ * \return true if the peer was known.
+ */
+bool handshake_history::forget(addr::addr const & peer)
+{
+    return f_peers.erase(key(peer)) != 0;
+}
+
+
+/** \brief Get the total number of handshakes recorded.
+ *
+ * \return The number of calls to record().
+ */
+std::uint64_t handshake_history::get_handshakes() const
+{
+    return f_handshakes;
+}
+
+
+/** \brief Get the number of handshakes which went over the budget.
+ *
+ * \return The number of times record() returned a delay.
+ */
+std::uint64_t handshake_history::get_throttled() const
+{
+    return f_throttled;
+}
+
+
+/** \brief Get the number of peers remembered.
+ *
+ * \return The number of peers in the history.
+ */
+std::size_t handshake_history::size() const
+{
+    return f_peers.size();
+}
+
+
+addr::addr handshake_history::key(addr::addr const & peer)
+{
+    addr::addr k(peer);
+    k.set_port(0);
+    return k;
+}
+
+
+void handshake_history::expire(peer & p, std::int64_t now) const
+{
+    while(!p.f_dates.empty()
+       && p.f_dates.front() <= now - f_window)
+    {
+        p.f_dates.pop_front();
+    }
+}
+
+
+void handshake_history::evict()
+{
+    auto oldest(f_peers.end());
+    for(auto it(f_peers.begin()); it != f_peers.end(); ++it)
+    {
+        if(it->second.f_dates.empty())
+        {
+            oldest = it;
+            break;
+        }
+        if(oldest == f_peers.end()
+        || it->second.f_dates.back() < oldest->second.f_dates.back())
+        {
+            oldest = it;
+        }
+    }
+    if(oldest != f_peers.end())
+    {
+        f_peers.erase(oldest);
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,89 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the TLS handshake history.
+ *
+ * Every new secure connection costs a full TLS handshake. The history
+ * remembers, per peer address, when the last handshakes happened so a
+ * flapping link can be detected and its reconnections spaced out
+ * instead of causing a storm of handshakes.
+ */
+
+// libaddr
+//
+#include    <libaddr/addr.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <deque>
+#include    <map>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class handshake_history
+{
+public:
+    static constexpr std::size_t const  DEFAULT_MAX_PEERS = 1'024;
+    static constexpr std::size_t const  DEFAULT_BURST = 3;
+    static constexpr std::int64_t const DEFAULT_WINDOW = 10LL * 60LL * 1'000'000LL;     // 10 minutes
+    static constexpr std::int64_t const FIRST_DELAY = 1LL * 60LL * 1'000'000LL;         // 1 minute
+
+                                handshake_history(std::size_t max_peers = DEFAULT_MAX_PEERS);
+
+    void                        set_budget(std::size_t burst, std::int64_t window);
+    std::int64_t                record(addr::addr const & peer, std::int64_t now);
+    std::size_t                 recent(addr::addr const & peer, std::int64_t now) const;
+    bool                        forget(addr::addr const & peer);
+    std::uint64_t               get_handshakes() const;
+    std::uint64_t               get_throttled() const;
+    std::size_t                 size() const;
+
+private:
+    struct peer
+    {
+        std::deque<std::int64_t>
+                        f_dates = std::deque<std::int64_t>();   // handshakes within the window
+    };
+
+    typedef std::map<addr::addr, peer>  peer_map_t;
+
+    static addr::addr           key(addr::addr const & peer);
+    void                        expire(peer & p, std::int64_t now) const;
+    void                        evict();
+
+    std::size_t                 f_max_peers = DEFAULT_MAX_PEERS;
+    std::size_t                 f_burst = DEFAULT_BURST;
+    std::int64_t                f_window = DEFAULT_WINDOW;
+    peer_map_t                  f_peers = peer_map_t();
+    std::uint64_t               f_handshakes = 0;
+    std::uint64_t               f_throttled = 0;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,558 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the table of services heard of.
+ *
+ * For each service, the table keeps the number of hops needed to reach
+ * it through each one of our peers. A service offered by a peer is at
+ * one hop. A service that peer heard of at N hops is at N + 1 hops.
+ *
+ * What we advertise to a peer is, for each service, the smallest number
+ * of hops through any of our other peers (split horizon: we never tell
+ * a peer about services we only know through that very peer). Services
+ * further than MAX_HOPS are not advertised, which bounds the time it
+ * takes for a service that disappeared to be forgotten in a cluster
+ * with loops.
+ *
+ * Each peer gets its own list of pending changes and its own version
+ * number. The version is incremented each time a set of changes is
+ * sent so the receiver can detect a missing update and request the
+ * full list instead.
+ */
+
+// self
+//
+#include    "heard_of_table.h"
+
+
+// snapdev
+//
+#include    <snapdev/join_strings.h>
+#include    <snapdev/tokenize_string.h>
+
+
+// C++
+//
+#include    <algorithm>
+#include    <cstdlib>
+#include    <vector>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Define the services offered by this computer.
+ *
+ * Our own services are advertised in the list of services, not the list
+ * of services heard of, so they are never sent as heard of.
+ *
+ * \param[in] services  The services running on this computer.
+ */
+void heard_of_table::set_local_services(advgetopt::string_set_t const & services)
+{
+    advgetopt::string_set_t changed(services);
+    changed.insert(f_local_services.begin(), f_local_services.end());
+    f_local_services = services;
+    for(auto const & s : changed)
+    {
+        refresh(s);
+    }
+}
+
+
+/** \brief Add or reset a peer.
+ *
+ * This function is called when a CONNECT or an ACCEPT gives us the full
+ * list of services and services heard of of a remote communicator daemon.
+ * That list does not include the number of hops so we assume the
+ * services heard of are one hop away from that peer.
+ *
+ * The list of services advertised to that peer is reset to everything
+ * we know about since it receives the full list on a (re)connection.
+ *
+ * \param[in] peer  The connection to the remote communicator daemon.
+ * \param[in] services  The services running on that peer.
+ * \param[in] heard_of  The services that peer heard of.
+ */
+void heard_of_table::set_peer(
+      base_connection const * peer
+    , advgetopt::string_set_t const & services
+    , advgetopt::string_set_t const & heard_of)
+{
+    peer_info info;
+    info.f_services = services;
+    for(auto const & s : heard_of)
+    {
+        info.f_heard_of[s] = 1;
+    }
+    replace_peer(peer, info);
+
+    peer_info & p(f_peers[peer]);
+    p.f_received_version = 0;
+    p.f_sent_version = 0;
+    p.f_advertised.clear();
+    p.f_pending.clear();
+    for(auto const & d : f_distances)
+    {
+        if(f_local_services.find(d.first) != f_local_services.end())
+        {
+            continue;
+        }
+        std::uint32_t const hops(best(d.first, peer));
+        if(hops != 0
+        && hops <= MAX_HOPS)
+        {
+            p.f_advertised[d.first] = hops;
+        }
+    }
+}
+
+
+/** \brief Replace the list of services a peer heard of.
+ *
+ * This function is used when a peer sends us its full list along the
+ * number of hops to each service.
+ *
+ * \param[in] peer  The connection to the remote communicator daemon.
+ * \param[in] version  The version of that list.
+ * \param[in] heard_of  The services heard of and their number of hops.
+ *
+ * \return false if \p peer is not known.
+ */
+bool heard_of_table::set_peer_heard_of(
+      base_connection const * peer
+    , std::int64_t version
+    , distance_map_t const & heard_of)
+{
+    auto const it(f_peers.find(peer));
+    if(it == f_peers.end())
+    {
+        return false;
+    }
+
+    peer_info info(it->second);
+    info.f_heard_of = heard_of;
+    replace_peer(peer, info);
+    f_peers[peer].f_received_version = version;
+
+    return true;
+}
+
+
+/** \brief Apply changes to the list of services a peer heard of.
+ *
+ * The changes are applied only if they are based on the last version we
+ * received from that peer. A change with 0 hops removes that service.
+ *
+ * \param[in] peer  The connection to the remote communicator daemon.
+ * \param[in] base_version  The version the changes apply to.
+ * \param[in] version  The new version.
+ * \param[in] changes  The services which changed.
+ *
+ * \return false if the peer is unknown or the base version does not
+ * match, in which case the full list has to be requested.
+ */
+bool heard_of_table::update_peer_heard_of(
+      base_connection const * peer
+    , std::int64_t base_version
+    , std::int64_t version
+    , distance_map_t const & changes)
+{
+    auto const it(f_peers.find(peer));
+    if(it == f_peers.end()
+    || it->second.f_received_version != base_version)
+    {
+        return false;
+    }
+
+    peer_info & p(it->second);
+    p.f_received_version = version;
+    for(auto const & c : changes)
+    {
+        if(c.second == 0)
+        {
+            p.f_heard_of.erase(c.first);
+        }
+        else
+        {
+            p.f_heard_of[c.first] = c.second;
+        }
+        set_distance(c.first, peer, distance(p, c.first));
+    }
+
+    return true;
+}
+
+
+/** \brief Forget about a peer.
+ *
+ * The services reached through that peer get removed or advertised with
+ * a larger number of hops if another peer also leads to them.
+ *
+ * \param[in] peer  The connection to the remote communicator daemon.
+ */
+void heard_of_table::remove_peer(base_connection const * peer)
+{
+    auto const it(f_peers.find(peer));
+    if(it == f_peers.end())
+    {
+        return;
+    }
+
+    advgetopt::string_set_t names(it->second.f_services);
+    for(auto const & h : it->second.f_heard_of)
+    {
+        names.insert(h.first);
+    }
+    f_peers.erase(it);
+
+    for(auto const & s : names)
+    {
+        set_distance(s, peer, 0);
+    }
+}
+
+
+/** \brief Check whether a peer is known.
+ *
+ * \param[in] peer  The connection to check.
+ *
+ * \return true if set_peer() was called for \p peer.
+ */
+bool heard_of_table::has_peer(base_connection const * peer) const
+{
+    return f_peers.find(peer) != f_peers.end();
+}
+
+
+/** \brief Retrieve the services heard of by a peer.
+ *
+ * \param[in] peer  The connection to the remote communicator daemon.
+ * \param[in,out] services  The set where the services get added.
+ */
+void heard_of_table::get_peer_heard_of(
+      base_connection const * peer
+    , advgetopt::string_set_t & services) const
+{
+    auto const it(f_peers.find(peer));
+    if(it == f_peers.end())
+    {
+        return;
+    }
+    for(auto const & h : it->second.f_heard_of)
+    {
+        services.insert(h.first);
+    }
+}
+
+
+/** \brief Retrieve the full list of services advertised to a peer.
+ *
+ * This function is used for the initial synchronization and whenever the
+ * peer lost track of our updates. The pending changes of that peer are
+ * dropped since the full list includes them.
+ *
+ * \param[in] peer  The connection to the remote communicator daemon.
+ * \param[out] version  The version of the returned list.
+ *
+ * \return The services we advertise to \p peer and their number of hops.
+ */
+heard_of_table::distance_map_t heard_of_table::get_advertised(
+      base_connection const * peer
+    , std::int64_t & version)
+{
+    auto const it(f_peers.find(peer));
+    if(it == f_peers.end())
+    {
+        version = 0;
+        return distance_map_t();
+    }
+
+    it->second.f_pending.clear();
+    version = ++it->second.f_sent_version;
+    return it->second.f_advertised;
+}
+
+
+/** \brief Retrieve the changes to send to each peer.
+ *
+ * Each peer with pending changes gets one entry in \p updates with the
+ * version its last update was based on and the new version.
+ *
+ * \param[out] updates  The map where the updates get saved.
+ */
+void heard_of_table::take_updates(update_map_t & updates)
+{
+    for(auto & p : f_peers)
+    {
+        if(p.second.f_pending.empty())
+        {
+            continue;
+        }
+
+        update & u(updates[p.first]);
+        u.f_base_version = p.second.f_sent_version;
+        u.f_version = ++p.second.f_sent_version;
+        u.f_changes.swap(p.second.f_pending);
+        p.second.f_pending.clear();
+    }
+}
+
+
+/** \brief Get the list of all the services we heard of.
+ *
+ * This is the list sent in the heard_of parameter of the CONNECT and
+ * ACCEPT messages. When \p peer is defined, the services only reached
+ * through that peer are not included.
+ *
+ * \param[in] peer  The peer receiving the list or nullptr.
+ *
+ * \return The comma separated list of services.
+ */
+std::string heard_of_table::get_list(base_connection const * peer) const
+{
+    std::vector<std::string> names;
+    for(auto const & d : f_distances)
+    {
+        if(f_local_services.find(d.first) != f_local_services.end())
+        {
+            continue;
+        }
+        std::uint32_t const hops(best(d.first, peer));
+        if(hops != 0
+        && hops <= MAX_HOPS)
+        {
+            names.push_back(d.first);
+        }
+    }
+    return snapdev::join_strings(names, ",");
+}
+
+
+/** \brief Return the number of services heard of.
+ *
+ * \return The number of services reachable through our peers, excluding
+ * our own services.
+ */
+std::size_t heard_of_table::size() const
+{
+    std::size_t count(0);
+    for(auto const & d : f_distances)
+    {
+        if(f_local_services.find(d.first) == f_local_services.end())
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+
+/** \brief Convert a list of services and hops to a string.
+ *
+ * The format is "<service>:<hops>" separated by commas. Entries with 0
+ * hops (removed services) are skipped.
+ *
+ * \param[in] services  The services to convert.
+ *
+ * \return The string representation of \p services.
+ */
+std::string heard_of_table::to_string(distance_map_t const & services)
+{
+    std::string result;
+    for(auto const & s : services)
+    {
+        if(s.second == 0)
+        {
+            continue;
+        }
+        if(!result.empty())
+        {
+            result += ',';
+        }
+        result += s.first;
+        result += ':';
+        result += std::to_string(s.second);
+    }
+    return result;
+}
+
+
+/** \brief Parse a list of services and hops.
+ *
+ * This function parses the output of to_string(). A service without a
+ * number of hops is considered to be one hop away.
+ *
+ * \param[in] services  The string to parse.
+ *
+ * \return The services and their number of hops.
+ */
+heard_of_table::distance_map_t heard_of_table::from_string(std::string const & services)
+{
+    distance_map_t result;
+    std::vector<std::string> entries;
+    snapdev::tokenize_string(entries, services, { "," }, true);
+    for(auto const & e : entries)
+    {
+        std::string::size_type const pos(e.find(':'));
+        if(pos == std::string::npos)
+        {
+            result[e] = 1;
+            continue;
+        }
+        std::uint32_t const hops(static_cast<std::uint32_t>(std::strtoul(e.c_str() + pos + 1, nullptr, 10)));
+        result[e.substr(0, pos)] = std::max(hops, static_cast<std::uint32_t>(1));
+    }
+    return result;
+}
+
+
+std::uint32_t heard_of_table::distance(peer_info const & info, std::string const & service)
+{
+    if(info.f_services.find(service) != info.f_services.end())
+    {
+        return 1;
+    }
+    auto const it(info.f_heard_of.find(service));
+    if(it == info.f_heard_of.end())
+    {
+        return 0;
+    }
+    return it->second + 1;
+}
+
+
+std::uint32_t heard_of_table::best(std::string const & service, base_connection const * excluded) const
+{
+    auto const it(f_distances.find(service));
+    if(it == f_distances.end())
+    {
+        return 0;
+    }
+
+    std::uint32_t result(0);
+    for(auto const & c : it->second)
+    {
+        if(c.first != excluded
+        && (result == 0 || c.second < result))
+        {
+            result = c.second;
+        }
+    }
+    return result;
+}
+
+
+void heard_of_table::set_distance(
+      std::string const & service
+    , base_connection const * peer
+    , std::uint32_t hops)
+{
+    contribution_map_t & contributions(f_distances[service]);
+    auto const it(contributions.find(peer));
+    std::uint32_t const previous(it == contributions.end() ? 0 : it->second);
+    if(hops == 0)
+    {
+        if(it != contributions.end())
+        {
+            contributions.erase(it);
+        }
+    }
+    else
+    {
+        contributions[peer] = hops;
+    }
+    if(contributions.empty())
+    {
+        f_distances.erase(service);
+    }
+
+    if(hops != previous)
+    {
+        refresh(service);
+    }
+}
+
+
+void heard_of_table::refresh(std::string const & service)
+{
+    bool const local(f_local_services.find(service) != f_local_services.end());
+    for(auto & p : f_peers)
+    {
+        std::uint32_t hops(local ? 0 : best(service, p.first));
+        if(hops > MAX_HOPS)
+        {
+            hops = 0;
+        }
+        auto const it(p.second.f_advertised.find(service));
+        std::uint32_t const previous(it == p.second.f_advertised.end() ? 0 : it->second);
+        if(hops == previous)
+        {
+            continue;
+        }
+        if(hops == 0)
+        {
+            p.second.f_advertised.erase(it);
+        }
+        else
+        {
+            p.second.f_advertised[service] = hops;
+        }
+        p.second.f_pending[service] = hops;
+    }
+}
+
+
+void heard_of_table::replace_peer(
+      base_connection const * peer
+    , peer_info const & info)
+{
+    peer_info & p(f_peers[peer]);
+
+    advgetopt::string_set_t names(p.f_services);
+    for(auto const & h : p.f_heard_of)
+    {
+        names.insert(h.first);
+    }
+    names.insert(info.f_services.begin(), info.f_services.end());
+    for(auto const & h : info.f_heard_of)
+    {
+        names.insert(h.first);
+    }
+
+    p.f_services = info.f_services;
+    p.f_heard_of = info.f_heard_of;
+    for(auto const & s : names)
+    {
+        set_distance(s, peer, distance(p, s));
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,130 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the table of services heard of.
+ *
+ * The Communicator tells its peers which services it can reach through
+ * its other peers (the services it "heard of"). This table maintains
+ * that list incrementally: each (service, peer) pair holds the number
+ * of hops to reach that service through that peer. A change only
+ * affects the services involved and generates a small update per peer.
+ */
+
+// advgetopt
+//
+#include    <advgetopt/utils.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <map>
+
+
+
+namespace communicator_daemon
+{
+
+
+class base_connection;
+
+
+class heard_of_table
+{
+public:
+    static std::uint32_t const  MAX_HOPS = 16;
+
+    typedef std::map<std::string, std::uint32_t>    distance_map_t;     // service name -> hops (0 means removed in an update)
+
+    struct update
+    {
+        std::int64_t            f_base_version = 0;
+        std::int64_t            f_version = 0;
+        distance_map_t          f_changes = distance_map_t();
+    };
+    typedef std::map<base_connection const *, update>
+                                                    update_map_t;
+
+    void                    set_local_services(advgetopt::string_set_t const & services);
+    void                    set_peer(
+                                  base_connection const * peer
+                                , advgetopt::string_set_t const & services
+                                , advgetopt::string_set_t const & heard_of);
+    bool                    set_peer_heard_of(
+                                  base_connection const * peer
+                                , std::int64_t version
+                                , distance_map_t const & heard_of);
+    bool                    update_peer_heard_of(
+                                  base_connection const * peer
+                                , std::int64_t base_version
+                                , std::int64_t version
+                                , distance_map_t const & changes);
+    void                    remove_peer(base_connection const * peer);
+    bool                    has_peer(base_connection const * peer) const;
+    void                    get_peer_heard_of(
+                                  base_connection const * peer
+                                , advgetopt::string_set_t & services) const;
+    distance_map_t          get_advertised(
+                                  base_connection const * peer
+                                , std::int64_t & version);
+    void                    take_updates(update_map_t & updates);
+    std::string             get_list(base_connection const * peer = nullptr) const;
+    std::size_t             size() const;
+
+    static std::string      to_string(distance_map_t const & services);
+    static distance_map_t   from_string(std::string const & services);
+
+private:
+    typedef std::map<base_connection const *, std::uint32_t>
+                                                    contribution_map_t;
+
+    struct peer_info
+    {
+        advgetopt::string_set_t f_services = advgetopt::string_set_t();
+        distance_map_t          f_heard_of = distance_map_t();
+        std::int64_t            f_received_version = 0;
+        std::int64_t            f_sent_version = 0;
+        distance_map_t          f_advertised = distance_map_t();
+        distance_map_t          f_pending = distance_map_t();
+    };
+    typedef std::map<base_connection const *, peer_info>
+                                                    peer_map_t;
+
+    static std::uint32_t    distance(peer_info const & info, std::string const & service);
+    std::uint32_t           best(std::string const & service, base_connection const * excluded) const;
+    void                    set_distance(
+                                  std::string const & service
+                                , base_connection const * peer
+                                , std::uint32_t hops);
+    void                    refresh(std::string const & service);
+    void                    replace_peer(
+                                  base_connection const * peer
+                                , peer_info const & info);
+
+    advgetopt::string_set_t f_local_services = advgetopt::string_set_t();
+    peer_map_t              f_peers = peer_map_t();
+    std::map<std::string, contribution_map_t>
+                            f_distances = std::map<std::string, contribution_map_t>();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
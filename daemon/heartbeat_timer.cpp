@@ -0,0 +1,76 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of heartbeat_timer object.
+ *
+ * We use a timer to send the HEARTBEAT messages to the other
+ * Communicators and evaluate their failure detectors.
+ */
+
+// self
+//
+#include    "heartbeat_timer.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \class heartbeat_timer
+ * \brief Tick at the heartbeat interval.
+ *
+ * This class is an implementation of a timer which ticks once per
+ * --heartbeat-interval. On each tick, the server sends a HEARTBEAT to
+ * the remote communicators supporting it and checks the suspicion level
+ * of each one of them.
+ */
+
+
+/** \brief The timer initialization.
+ *
+ * \param[in] cs  The communicatord server we are listening for.
+ * \param[in] interval  The heartbeat interval in microseconds.
+ */
+heartbeat_timer::heartbeat_timer(server::pointer_t cs, std::int64_t interval)
+    : timer(interval)
+    , f_server(cs)
+{
+}
+
+
+void heartbeat_timer::process_timeout()
+{
+    f_server->process_heartbeat();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,353 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the table of interests.
+ *
+ * The table holds one summary per communicator daemon, including our
+ * own. A summary is the list of commands understood by the local
+ * services of that daemon along a version. The version of a summary
+ * is initialized from the clock in microseconds so it keeps growing
+ * when a daemon restarts. It is then incremented by one on each change
+ * which allows for incremental updates: a peer receiving the list of
+ * commands added and removed along the base version applies them only
+ * if it has that exact base version. Otherwise it has to request the
+ * full summary.
+ *
+ * A summary is marked "opaque" when that daemon is connected to a peer
+ * which does not advertise its own interests. In that case, anything
+ * may be consumed behind that daemon.
+ */
+
+// self
+//
+#include    "interest_table.h"
+
+
+// snapdev
+//
+#include    <snapdev/join_strings.h>
+#include    <snapdev/tokenize_string.h>
+
+
+// C++
+//
+#include    <chrono>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace
+{
+
+
+
+void tokenize_commands(advgetopt::string_set_t & commands, std::string const & list)
+{
+    snapdev::tokenize_string(commands, list, { "," }, true);
+}
+
+
+
+} // no name namespace
+
+
+
+/** \brief Define the summary of this communicator daemon.
+ *
+ * This function replaces our own summary with \p commands. If the
+ * summary changed, its version is incremented and the commands added
+ * and removed are returned so they can be sent to our peers.
+ *
+ * The very first summary gets a version based on the current time.
+ *
+ * \param[in] server_name  The name of this server.
+ * \param[in] commands  The commands understood by our local services.
+ * \param[in] opaque  Whether one of our peers does not advertise its
+ * interests.
+ * \param[out] added  The commands which were added.
+ * \param[out] removed  The commands which were removed.
+ *
+ * \return true if the summary changed.
+ */
+bool interest_table::set_local(
+      std::string const & server_name
+    , advgetopt::string_set_t const & commands
+    , bool opaque
+    , advgetopt::string_set_t & added
+    , advgetopt::string_set_t & removed)
+{
+    auto it(f_summaries.find(server_name));
+    if(it == f_summaries.end())
+    {
+        summary s;
+        s.f_version = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        s.f_commands = commands;
+        s.f_opaque = opaque;
+        f_summaries[server_name] = s;
+        added = commands;
+        return true;
+    }
+
+    summary & s(it->second);
+    for(auto const & c : commands)
+    {
+        if(s.f_commands.find(c) == s.f_commands.end())
+        {
+            added.insert(c);
+        }
+    }
+    for(auto const & c : s.f_commands)
+    {
+        if(commands.find(c) == commands.end())
+        {
+            removed.insert(c);
+        }
+    }
+    if(added.empty()
+    && removed.empty()
+    && s.f_opaque == opaque)
+    {
+        return false;
+    }
+
+    ++s.f_version;
+    s.f_commands = commands;
+    s.f_opaque = opaque;
+    return true;
+}
+
+
+/** \brief Replace the summary of a remote communicator daemon.
+ *
+ * This function saves the full summary of \p server_name unless we
+ * already have that version or a newer one.
+ *
+ * \param[in] server_name  The name of the remote server.
+ * \param[in] version  The version of this summary.
+ * \param[in] commands  The comma separated list of commands.
+ * \param[in] opaque  Whether that server has a peer which does not
+ * advertise its interests.
+ *
+ * \return INTEREST_UPDATE_APPLIED if the summary was saved and
+ * INTEREST_UPDATE_IGNORED otherwise.
+ */
+interest_update_t interest_table::update(
+      std::string const & server_name
+    , std::int64_t version
+    , std::string const & commands
+    , bool opaque)
+{
+    auto const it(f_summaries.find(server_name));
+    if(it != f_summaries.end()
+    && it->second.f_version >= version)
+    {
+        return interest_update_t::INTEREST_UPDATE_IGNORED;
+    }
+
+    summary s;
+    s.f_version = version;
+    tokenize_commands(s.f_commands, commands);
+    s.f_opaque = opaque;
+    f_summaries[server_name] = s;
+
+    return interest_update_t::INTEREST_UPDATE_APPLIED;
+}
+
+
+/** \brief Apply an incremental update to the summary of a remote daemon.
+ *
+ * The \p added and \p removed commands are applied only if our copy of
+ * the summary of \p server_name is at \p base_version. If we have a
+ * different version that is older than \p version, the function returns
+ * INTEREST_UPDATE_MISMATCH and the caller has to request the full
+ * summary.
+ *
+ * \param[in] server_name  The name of the remote server.
+ * \param[in] base_version  The version the changes apply to.
+ * \param[in] version  The new version of the summary.
+ * \param[in] added  The comma separated list of commands added.
+ * \param[in] removed  The comma separated list of commands removed.
+ * \param[in] opaque  The new opaque flag of that summary.
+ *
+ * \return The result of the update.
+ */
+interest_update_t interest_table::apply(
+      std::string const & server_name
+    , std::int64_t base_version
+    , std::int64_t version
+    , std::string const & added
+    , std::string const & removed
+    , bool opaque)
+{
+    auto const it(f_summaries.find(server_name));
+    if(it != f_summaries.end()
+    && it->second.f_version >= version)
+    {
+        return interest_update_t::INTEREST_UPDATE_IGNORED;
+    }
+    if(it == f_summaries.end()
+    || it->second.f_version != base_version)
+    {
+        return interest_update_t::INTEREST_UPDATE_MISMATCH;
+    }
+
+    summary & s(it->second);
+    tokenize_commands(s.f_commands, added);
+    advgetopt::string_set_t gone;
+    tokenize_commands(gone, removed);
+    for(auto const & c : gone)
+    {
+        s.f_commands.erase(c);
+    }
+    s.f_version = version;
+    s.f_opaque = opaque;
+
+    return interest_update_t::INTEREST_UPDATE_APPLIED;
+}
+
+
+/** \brief Retrieve the full summary of a server.
+ *
+ * \param[in] server_name  The name of the server.
+ * \param[out] version  The version of the summary.
+ * \param[out] commands  The comma separated list of commands.
+ * \param[out] opaque  The opaque flag of that summary.
+ *
+ * \return true if the summary of \p server_name is known.
+ */
+bool interest_table::get_summary(
+      std::string const & server_name
+    , std::int64_t & version
+    , std::string & commands
+    , bool & opaque) const
+{
+    auto const it(f_summaries.find(server_name));
+    if(it == f_summaries.end())
+    {
+        return false;
+    }
+
+    version = it->second.f_version;
+    commands = snapdev::join_strings(it->second.f_commands, ",");
+    opaque = it->second.f_opaque;
+    return true;
+}
+
+
+/** \brief Retrieve the name of all the servers with a summary.
+ *
+ * \param[in,out] servers  The set where the server names get added.
+ */
+void interest_table::get_servers(advgetopt::string_set_t & servers) const
+{
+    for(auto const & s : f_summaries)
+    {
+        servers.insert(s.first);
+    }
+}
+
+
+/** \brief Check whether we have the summary of a server.
+ *
+ * \param[in] server_name  The name of the server.
+ *
+ * \return true if the summary of \p server_name is known.
+ */
+bool interest_table::is_known(std::string const & server_name) const
+{
+    return f_summaries.find(server_name) != f_summaries.end();
+}
+
+
+/** \brief Check whether a server may consume a command.
+ *
+ * This function returns false only if we know the summary of
+ * \p server_name, it is not opaque, and it does not include \p command.
+ *
+ * \param[in] server_name  The name of the server.
+ * \param[in] command  The name of the command.
+ *
+ * \return true if \p server_name may consume \p command.
+ */
+bool interest_table::wants(
+      std::string const & server_name
+    , std::string const & command) const
+{
+    auto const it(f_summaries.find(server_name));
+    if(it == f_summaries.end())
+    {
+        return true;
+    }
+    return it->second.f_opaque
+        || it->second.f_commands.find(command) != it->second.f_commands.end();
+}
+
+
+/** \brief Check whether a server other than those excluded consumes a command.
+ *
+ * A broadcast sent to a peer may be relayed to servers we are not
+ * directly connected to. This function returns true if any server not
+ * listed in \p excluded (i.e. ourselves and our direct peers) may
+ * consume \p command, in which case the broadcast can't be filtered.
+ *
+ * \param[in] command  The name of the command.
+ * \param[in] excluded  The servers to ignore.
+ *
+ * \return true if another server may consume \p command.
+ */
+bool interest_table::wanted_beyond(
+      std::string const & command
+    , advgetopt::string_set_t const & excluded) const
+{
+    for(auto const & s : f_summaries)
+    {
+        if(excluded.find(s.first) == excluded.end()
+        && (s.second.f_opaque
+            || s.second.f_commands.find(command) != s.second.f_commands.end()))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** \brief Return the number of summaries.
+ *
+ * \return The number of servers with a known summary, including ourselves.
+ */
+std::size_t interest_table::size() const
+{
+    return f_summaries.size();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,107 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the table of interests.
+ *
+ * Each communicator daemon advertises the list of commands its local
+ * services understand (its "interest summary") to the other daemons.
+ * The summaries are versioned and flooded through the cluster so each
+ * daemon knows which commands each node consumes. This is used to avoid
+ * broadcasting a message to a remote communicator daemon when nobody
+ * on or behind it understands that message.
+ */
+
+// advgetopt
+//
+#include    <advgetopt/utils.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <map>
+
+
+
+namespace communicator_daemon
+{
+
+
+enum class interest_update_t
+{
+    INTEREST_UPDATE_APPLIED,        // the summary changed
+    INTEREST_UPDATE_IGNORED,        // we already have that version or a newer one
+    INTEREST_UPDATE_MISMATCH,       // incremental update on the wrong version, need the full summary
+};
+
+
+class interest_table
+{
+public:
+    bool                    set_local(
+                                  std::string const & server_name
+                                , advgetopt::string_set_t const & commands
+                                , bool opaque
+                                , advgetopt::string_set_t & added
+                                , advgetopt::string_set_t & removed);
+    interest_update_t       update(
+                                  std::string const & server_name
+                                , std::int64_t version
+                                , std::string const & commands
+                                , bool opaque);
+    interest_update_t       apply(
+                                  std::string const & server_name
+                                , std::int64_t base_version
+                                , std::int64_t version
+                                , std::string const & added
+                                , std::string const & removed
+                                , bool opaque);
+    bool                    get_summary(
+                                  std::string const & server_name
+                                , std::int64_t & version
+                                , std::string & commands
+                                , bool & opaque) const;
+    void                    get_servers(advgetopt::string_set_t & servers) const;
+    bool                    is_known(std::string const & server_name) const;
+    bool                    wants(
+                                  std::string const & server_name
+                                , std::string const & command) const;
+    bool                    wanted_beyond(
+                                  std::string const & command
+                                , advgetopt::string_set_t const & excluded) const;
+    std::size_t             size() const;
+
+private:
+    struct summary
+    {
+        std::int64_t            f_version = 0;
+        advgetopt::string_set_t f_commands = advgetopt::string_set_t();
+        bool                    f_opaque = false;   // a peer of that node does not advertise its interests
+    };
+
+    typedef std::map<std::string, summary>  summary_map_t;
+
+    summary_map_t           f_summaries = summary_map_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,885 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the I/O shards.
+ *
+ * The connections attached to a shard stay in the ed::communicator but
+ * are disabled so the main thread does not poll their socket anymore.
+ * The shard thread polls a duplicate of the socket instead. The
+ * duplicate is closed by the shard once the connection was detached and
+ * its output sent, so the main thread can destroy the connection at any
+ * time.
+ *
+ * The main thread sends ATTACH, WRITE and DETACH commands to the shard.
+ * A connection has at most one WRITE in flight; the following data waits
+ * in its output_queue until the shard reports that it was sent
+ * (DRAINED). This keeps the slow consumer detection of the output queue
+ * working as before.
+ *
+ * The shard sends the messages it parsed to the main thread along the
+ * DRAINED, HUP and ERROR events. When the main thread is too slow and
+ * the queue is full, the shard stops reading its sockets until there is
+ * room again.
+ */
+
+// self
+//
+#include    "io_shard.h"
+
+#include    "base_connection.h"
+
+
+// communicatord
+//
+#include    <communicatord/exception.h>
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <chrono>
+#include    <cstring>
+
+
+// C
+//
+#include    <fcntl.h>
+#include    <poll.h>
+#include    <sys/eventfd.h>
+#include    <sys/socket.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+namespace detail
+{
+
+
+
+class io_shard_runner
+    : public cppthread::runner
+{
+public:
+    typedef std::shared_ptr<io_shard_runner>    pointer_t;
+
+                        io_shard_runner(io_shard * shard);
+                        io_shard_runner(io_shard_runner const &) = delete;
+    io_shard_runner &   operator = (io_shard_runner const &) = delete;
+
+    // implementation of runner
+    virtual void        run() override;
+
+private:
+    struct shard_socket
+    {
+        int             f_socket = -1;
+        std::string     f_input = std::string();
+        std::string     f_output = std::string();
+        bool            f_write_pending = false;
+        bool            f_detached = false;
+        bool            f_dead = false;
+    };
+    typedef std::map<std::uint32_t, shard_socket>   socket_map_t;
+
+    void                process_commands();
+    void                read_socket(std::uint32_t id, shard_socket & s);
+    void                write_socket(std::uint32_t id, shard_socket & s);
+    void                close_socket(socket_map_t::iterator it);
+    void                post_event(shard_event & event);
+    void                flush_backlog();
+    void                flush_on_exit();
+
+    io_shard *          f_shard = nullptr;
+    socket_map_t        f_sockets = socket_map_t();
+    std::deque<shard_event>
+                        f_backlog = std::deque<shard_event>();
+};
+
+
+
+io_shard_runner::io_shard_runner(io_shard * shard)
+    : runner("io-shard-" + std::to_string(shard->get_index()))
+    , f_shard(shard)
+{
+}
+
+
+void io_shard_runner::run()
+{
+    std::vector<struct pollfd> fds;
+    std::vector<std::uint32_t> ids;
+    while(continue_running())
+    {
+        fds.clear();
+        ids.clear();
+
+        struct pollfd wakeup = {};
+        wakeup.fd = f_shard->f_wakeup.get();
+        wakeup.events = POLLIN;
+        fds.push_back(wakeup);
+        ids.push_back(0);
+
+        for(auto const & s : f_sockets)
+        {
+            if(s.second.f_dead)
+            {
+                continue;
+            }
+            struct pollfd fd = {};
+            fd.fd = s.second.f_socket;
+
+            // stop reading while the main thread is not keeping up
+            //
+            if(f_backlog.empty()
+            && !s.second.f_detached)
+            {
+                fd.events |= POLLIN | POLLRDHUP;
+            }
+            if(!s.second.f_output.empty())
+            {
+                fd.events |= POLLOUT;
+            }
+            if(fd.events == 0)
+            {
+                // poll() would still report a hang up, over and over
+                //
+                continue;
+            }
+            fds.push_back(fd);
+            ids.push_back(s.first);
+        }
+
+        // wake up regularly to check whether we have to stop
+        //
+        int const r(poll(fds.data(), fds.size(), 100));
+        if(r < 0)
+        {
+            if(errno != EINTR)
+            {
+                int const e(errno);
+                SNAP_LOG_ERROR
+                    << "poll() of I/O shard "
+                    << f_shard->get_index()
+                    << " failed with errno: "
+                    << e
+                    << " -- "
+                    << strerror(e)
+                    << SNAP_LOG_SEND;
+                break;
+            }
+            continue;
+        }
+
+        if((fds[0].revents & POLLIN) != 0)
+        {
+            eventfd_t value(0);
+            eventfd_read(f_shard->f_wakeup.get(), &value);
+        }
+        process_commands();
+
+        for(std::size_t idx(1); idx < fds.size(); ++idx)
+        {
+            if(fds[idx].revents == 0)
+            {
+                continue;
+            }
+            auto it(f_sockets.find(ids[idx]));
+            if(it == f_sockets.end()
+            || it->second.f_dead)
+            {
+                continue;
+            }
+            if((fds[idx].revents & POLLOUT) != 0)
+            {
+                write_socket(it->first, it->second);
+            }
+            if((fds[idx].revents & (POLLIN | POLLRDHUP | POLLHUP | POLLERR)) != 0
+            && !it->second.f_dead)
+            {
+                if(it->second.f_detached)
+                {
+                    // nobody reads this connection anymore
+                    //
+                    it->second.f_dead = (fds[idx].revents & (POLLHUP | POLLERR)) != 0;
+                }
+                else
+                {
+                    read_socket(it->first, it->second);
+                }
+            }
+            if(it->second.f_detached
+            && (it->second.f_dead || it->second.f_output.empty()))
+            {
+                close_socket(it);
+            }
+        }
+
+        flush_backlog();
+    }
+
+    process_commands();
+    flush_on_exit();
+}
+
+
+void io_shard_runner::process_commands()
+{
+    shard_command command;
+    while(f_shard->f_outbound.pop(command))
+    {
+        switch(command.f_type)
+        {
+        case shard_command::type_t::SHARD_COMMAND_ATTACH:
+            f_sockets[command.f_id].f_socket = command.f_socket;
+            break;
+
+        case shard_command::type_t::SHARD_COMMAND_WRITE:
+            {
+                auto it(f_sockets.find(command.f_id));
+                if(it != f_sockets.end()
+                && !it->second.f_dead)
+                {
+                    it->second.f_output += command.f_data;
+                    it->second.f_write_pending = true;
+                    write_socket(it->first, it->second);
+                }
+            }
+            break;
+
+        case shard_command::type_t::SHARD_COMMAND_DETACH:
+            {
+                auto it(f_sockets.find(command.f_id));
+                if(it != f_sockets.end())
+                {
+                    it->second.f_detached = true;
+                    if(it->second.f_dead
+                    || it->second.f_output.empty())
+                    {
+                        close_socket(it);
+                    }
+                }
+            }
+            break;
+
+        }
+    }
+
+    // the main thread waits for room to send more commands
+    //
+    if(f_shard->f_core_waiting.exchange(false))
+    {
+        f_shard->thread_done();
+    }
+}
+
+
+void io_shard_runner::read_socket(std::uint32_t id, shard_socket & s)
+{
+    shard_event::type_t end_event(shard_event::type_t::SHARD_EVENT_MESSAGE);
+    char buf[64 * 1024];
+    for(;;)
+    {
+        ssize_t const r(::recv(s.f_socket, buf, sizeof(buf), 0));
+        if(r > 0)
+        {
+            s.f_input.append(buf, r);
+            continue;
+        }
+        if(r == 0)
+        {
+            end_event = shard_event::type_t::SHARD_EVENT_HUP;
+        }
+        else if(errno != EAGAIN
+             && errno != EWOULDBLOCK
+             && errno != EINTR)
+        {
+            end_event = shard_event::type_t::SHARD_EVENT_ERROR;
+        }
+        break;
+    }
+
+    std::string::size_type start(0);
+    for(;;)
+    {
+        std::string::size_type const end(s.f_input.find('\n', start));
+        if(end == std::string::npos)
+        {
+            break;
+        }
+        shard_event event;
+        event.f_type = shard_event::type_t::SHARD_EVENT_MESSAGE;
+        event.f_id = id;
+        if(event.f_message.from_message(s.f_input.substr(start, end - start)))
+        {
+            post_event(event);
+        }
+        else
+        {
+            SNAP_LOG_ERROR
+                << "invalid message received by I/O shard "
+                << f_shard->get_index()
+                << "."
+                << SNAP_LOG_SEND;
+        }
+        start = end + 1;
+    }
+    s.f_input.erase(0, start);
+
+    // the HUP or ERROR goes after the messages received before it
+    //
+    if(end_event != shard_event::type_t::SHARD_EVENT_MESSAGE)
+    {
+        shard_event event;
+        event.f_type = end_event;
+        event.f_id = id;
+        post_event(event);
+        s.f_dead = true;
+    }
+}
+
+
+void io_shard_runner::write_socket(std::uint32_t id, shard_socket & s)
+{
+    while(!s.f_output.empty())
+    {
+        ssize_t const r(::send(s.f_socket, s.f_output.data(), s.f_output.length(), MSG_NOSIGNAL));
+        if(r > 0)
+        {
+            s.f_output.erase(0, r);
+            continue;
+        }
+        if(r < 0
+        && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            return;
+        }
+        if(!s.f_detached)
+        {
+            shard_event event;
+            event.f_type = shard_event::type_t::SHARD_EVENT_ERROR;
+            event.f_id = id;
+            post_event(event);
+        }
+        s.f_output.clear();
+        s.f_dead = true;
+        return;
+    }
+
+    if(s.f_write_pending)
+    {
+        s.f_write_pending = false;
+        if(!s.f_detached)
+        {
+            shard_event event;
+            event.f_type = shard_event::type_t::SHARD_EVENT_DRAINED;
+            event.f_id = id;
+            post_event(event);
+        }
+    }
+}
+
+
+void io_shard_runner::close_socket(socket_map_t::iterator it)
+{
+    close(it->second.f_socket);
+    f_sockets.erase(it);
+}
+
+
+void io_shard_runner::post_event(shard_event & event)
+{
+    if(f_backlog.empty())
+    {
+        bool was_empty(false);
+        if(f_shard->f_inbound.push(event, &was_empty))
+        {
+            if(was_empty)
+            {
+                f_shard->thread_done();
+            }
+            return;
+        }
+    }
+    f_backlog.push_back(std::move(event));
+}
+
+
+void io_shard_runner::flush_backlog()
+{
+    bool wakeup(false);
+    while(!f_backlog.empty())
+    {
+        bool was_empty(false);
+        if(!f_shard->f_inbound.push(f_backlog.front(), &was_empty))
+        {
+            // ask the main thread to wake us up once it made room, then
+            // try once more in case it did so in between
+            //
+            f_shard->f_shard_waiting = true;
+            if(!f_shard->f_inbound.push(f_backlog.front(), &was_empty))
+            {
+                break;
+            }
+        }
+        f_backlog.pop_front();
+        wakeup = wakeup || was_empty;
+    }
+    if(wakeup)
+    {
+        f_shard->thread_done();
+    }
+}
+
+
+/** \brief Send the last data and close all the sockets.
+ *
+ * The DISCONNECTING messages sent by server::stop() are still in the
+ * output buffers when the thread is asked to stop. This function gives
+ * them up to one second to go out.
+ */
+void io_shard_runner::flush_on_exit()
+{
+    std::int64_t const deadline(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count() + 1'000);
+    for(;;)
+    {
+        std::vector<struct pollfd> fds;
+        for(auto const & s : f_sockets)
+        {
+            if(!s.second.f_dead
+            && !s.second.f_output.empty())
+            {
+                struct pollfd fd = {};
+                fd.fd = s.second.f_socket;
+                fd.events = POLLOUT;
+                fds.push_back(fd);
+            }
+        }
+        std::int64_t const now(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+        if(fds.empty()
+        || now >= deadline
+        || poll(fds.data(), fds.size(), static_cast<int>(deadline - now)) <= 0)
+        {
+            break;
+        }
+        for(auto & s : f_sockets)
+        {
+            s.second.f_detached = true;
+            write_socket(s.first, s.second);
+        }
+    }
+
+    for(auto const & s : f_sockets)
+    {
+        close(s.second.f_socket);
+    }
+    f_sockets.clear();
+}
+
+
+
+} // namespace detail
+
+
+
+/** \class io_shard
+ * \brief Read, parse and write local connections in a separate thread.
+ *
+ * This class is the main thread side of an I/O shard. It gets woken up
+ * each time the thread has messages or events for the connections it
+ * handles and calls those connections.
+ */
+
+
+/** \brief Initialize an I/O shard.
+ *
+ * \param[in] index  The index of this shard, used in its name and in
+ * the metrics.
+ */
+io_shard::io_shard(int index)
+    : f_index(index)
+    , f_wakeup(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+{
+    set_name("io shard " + std::to_string(index));
+    if(f_wakeup.get() == -1)
+    {
+        throw communicatord::runtime_error("could not create the eventfd of an I/O shard.");
+    }
+}
+
+
+/** \brief Make sure the thread is stopped.
+ */
+io_shard::~io_shard()
+{
+    stop();
+}
+
+
+/** \brief Start the thread of this shard.
+ *
+ * The io_shard must be added to the ed::communicator before this
+ * function gets called.
+ */
+void io_shard::start()
+{
+    if(f_thread != nullptr)
+    {
+        return;
+    }
+
+    f_runner = std::make_shared<detail::io_shard_runner>(this);
+    f_thread = std::make_shared<cppthread::thread>("io-shard-" + std::to_string(f_index), f_runner);
+    f_thread->start();
+}
+
+
+/** \brief Stop the thread of this shard.
+ *
+ * The commands still waiting are handed to the thread first. The thread
+ * then gives the output of its sockets up to one second to be sent
+ * before closing them.
+ */
+void io_shard::stop()
+{
+    if(f_thread == nullptr)
+    {
+        return;
+    }
+
+    for(int retry(0); retry < 1'000 && !f_overflow.empty(); ++retry)
+    {
+        flush_commands();
+        if(!f_overflow.empty())
+        {
+            usleep(1'000);
+        }
+    }
+
+    f_thread->stop();
+    f_thread.reset();
+    f_runner.reset();
+}
+
+
+/** \brief Get the index of this shard.
+ *
+ * \return The index given to the constructor.
+ */
+int io_shard::get_index() const
+{
+    return f_index;
+}
+
+
+/** \brief Hand a connection to this shard.
+ *
+ * The socket of \p conn is duplicated and the duplicate is sent to the
+ * shard thread. The caller is expected to disable the connection so the
+ * main thread stops polling its socket.
+ *
+ * \param[in] conn  The connection to attach.
+ * \param[out] id  The identifier of the connection in this shard.
+ *
+ * \return true if the connection is now handled by this shard.
+ */
+bool io_shard::attach(std::shared_ptr<base_connection> conn, std::uint32_t & id)
+{
+    if(f_thread == nullptr)
+    {
+        return false;
+    }
+
+    int const s(fcntl(conn->get_socket(), F_DUPFD_CLOEXEC, 0));
+    if(s == -1)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "could not duplicate a socket for I/O shard "
+            << f_index
+            << ", errno: "
+            << e
+            << " -- "
+            << strerror(e)
+            << SNAP_LOG_SEND;
+        return false;
+    }
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+    // 0 is never used so a connection which was not attached is obvious
+    //
+    do
+    {
+        ++f_next_id;
+    }
+    while(f_next_id == 0 || f_connections.contains(f_next_id));
+    id = f_next_id;
+    f_connections[id] = conn;
+
+    detail::shard_command command;
+    command.f_type = detail::shard_command::type_t::SHARD_COMMAND_ATTACH;
+    command.f_id = id;
+    command.f_socket = s;
+    send_command(command);
+    return true;
+}
+
+
+/** \brief Send data to a connection of this shard.
+ *
+ * The shard sends a DRAINED event once \p data was written.
+ *
+ * \param[in] id  The identifier returned by attach().
+ * \param[in] data  The data to write.
+ */
+void io_shard::write(std::uint32_t id, std::string && data)
+{
+    detail::shard_command command;
+    command.f_type = detail::shard_command::type_t::SHARD_COMMAND_WRITE;
+    command.f_id = id;
+    command.f_data = std::move(data);
+    send_command(command);
+}
+
+
+/** \brief Forget about a connection.
+ *
+ * The shard closes its socket once the data already sent to it was
+ * written.
+ *
+ * \param[in] id  The identifier returned by attach().
+ */
+void io_shard::detach(std::uint32_t id)
+{
+    if(f_connections.erase(id) == 0)
+    {
+        return;
+    }
+
+    detail::shard_command command;
+    command.f_type = detail::shard_command::type_t::SHARD_COMMAND_DETACH;
+    command.f_id = id;
+    send_command(command);
+}
+
+
+/** \brief Remove all the connections of this shard.
+ *
+ * The server calls this function when it stops, before it stops the
+ * shard, since the connections are disabled and would otherwise never
+ * leave the ed::communicator.
+ */
+void io_shard::remove_connections()
+{
+    std::vector<std::shared_ptr<base_connection>> connections;
+    for(auto const & c : f_connections)
+    {
+        std::shared_ptr<base_connection> conn(c.second.lock());
+        if(conn != nullptr)
+        {
+            connections.push_back(conn);
+        }
+    }
+    for(auto const & c : connections)
+    {
+        ed::connection * conn(dynamic_cast<ed::connection *>(c.get()));
+        if(conn != nullptr)
+        {
+            conn->remove_from_communicator();
+        }
+    }
+}
+
+
+/** \brief Number of connections handled by this shard.
+ *
+ * \return The number of connections attached and not yet detached.
+ */
+std::size_t io_shard::get_connection_count() const
+{
+    return f_connections.size();
+}
+
+
+/** \brief Number of events waiting for the main thread.
+ *
+ * \return The depth of the queue from the shard to the main thread.
+ */
+std::size_t io_shard::get_inbound_depth() const
+{
+    return f_inbound.size();
+}
+
+
+/** \brief Number of commands waiting for the shard thread.
+ *
+ * \return The depth of the queue from the main thread to the shard,
+ * including the commands which did not fit in it.
+ */
+std::size_t io_shard::get_outbound_depth() const
+{
+    return f_outbound.size() + f_overflow.size();
+}
+
+
+/** \brief Number of messages received through this shard.
+ *
+ * \return The number of messages handed to the connections.
+ */
+std::uint64_t io_shard::get_messages() const
+{
+    return f_messages;
+}
+
+
+/** \brief Number of commands which did not fit in the queue.
+ *
+ * \return The number of commands sent to the overflow list.
+ */
+std::uint64_t io_shard::get_overflow() const
+{
+    return f_overflow_count;
+}
+
+
+/** \brief Handle the events sent by the shard thread.
+ *
+ * This function runs in the main thread. The messages are handed to
+ * their connection which dispatches them as if it had read them itself.
+ */
+void io_shard::process_read()
+{
+    thread_done_signal::process_read();
+
+    // a STOP received here ends up calling stop() on this very shard
+    //
+    pointer_t keep(std::static_pointer_cast<io_shard>(shared_from_this()));
+
+    detail::shard_event event;
+    while(f_thread != nullptr
+       && f_inbound.pop(event))
+    {
+        auto it(f_connections.find(event.f_id));
+        if(it == f_connections.end())
+        {
+            continue;
+        }
+        std::shared_ptr<base_connection> conn(it->second.lock());
+        if(conn == nullptr)
+        {
+            continue;
+        }
+        switch(event.f_type)
+        {
+        case detail::shard_event::type_t::SHARD_EVENT_MESSAGE:
+            ++f_messages;
+            conn->shard_message(event.f_message);
+            break;
+
+        case detail::shard_event::type_t::SHARD_EVENT_DRAINED:
+            conn->shard_drained();
+            break;
+
+        case detail::shard_event::type_t::SHARD_EVENT_HUP:
+            dynamic_cast<ed::connection &>(*conn).process_hup();
+            break;
+
+        case detail::shard_event::type_t::SHARD_EVENT_ERROR:
+            dynamic_cast<ed::connection &>(*conn).process_error();
+            break;
+
+        }
+    }
+
+    if(f_shard_waiting.exchange(false))
+    {
+        wakeup_shard();
+    }
+    flush_commands();
+}
+
+
+void io_shard::send_command(detail::shard_command & command)
+{
+    if(f_overflow.empty())
+    {
+        bool was_empty(false);
+        if(f_outbound.push(command, &was_empty))
+        {
+            if(was_empty)
+            {
+                wakeup_shard();
+            }
+            return;
+        }
+    }
+    ++f_overflow_count;
+    f_overflow.push_back(std::move(command));
+    flush_commands();
+}
+
+
+void io_shard::flush_commands()
+{
+    bool wakeup(false);
+    while(!f_overflow.empty())
+    {
+        bool was_empty(false);
+        if(!f_outbound.push(f_overflow.front(), &was_empty))
+        {
+            // ask the shard to wake us up once it made room, then try
+            // once more in case it did so in between
+            //
+            f_core_waiting = true;
+            if(!f_outbound.push(f_overflow.front(), &was_empty))
+            {
+                break;
+            }
+        }
+        f_overflow.pop_front();
+        wakeup = wakeup || was_empty;
+    }
+    if(wakeup)
+    {
+        wakeup_shard();
+    }
+}
+
+
+void io_shard::wakeup_shard()
+{
+    eventfd_write(f_wakeup.get(), 1);
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,177 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Definition of the I/O shards.
+ *
+ * By default, all the connections are read, parsed and written by the
+ * main thread. With the --io-threads option, the local service and Unix
+ * connections are distributed between that many I/O shards. Each shard
+ * runs a thread with its own poll() loop which reads the sockets, parses
+ * the messages and writes the replies. Only the routing decisions happen
+ * in the main thread. The two sides exchange the messages through lock
+ * free single producer single consumer queues.
+ */
+
+// self
+//
+#include    "spsc_queue.h"
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/message.h>
+#include    <eventdispatcher/thread_done_signal.h>
+
+
+// cppthread
+//
+#include    <cppthread/runner.h>
+#include    <cppthread/thread.h>
+
+
+// snapdev
+//
+#include    <snapdev/raii_generic_deleter.h>
+
+
+// C++
+//
+#include    <deque>
+#include    <map>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class base_connection;
+
+
+namespace detail
+{
+
+
+struct shard_command
+{
+    enum class type_t
+    {
+        SHARD_COMMAND_ATTACH,   // start polling f_socket
+        SHARD_COMMAND_WRITE,    // send f_data
+        SHARD_COMMAND_DETACH,   // close the socket once its output was sent
+    };
+
+    type_t              f_type = type_t::SHARD_COMMAND_WRITE;
+    std::uint32_t       f_id = 0;
+    int                 f_socket = -1;
+    std::string         f_data = std::string();
+};
+
+
+struct shard_event
+{
+    enum class type_t
+    {
+        SHARD_EVENT_MESSAGE,    // f_message was received
+        SHARD_EVENT_DRAINED,    // the last SHARD_COMMAND_WRITE was sent
+        SHARD_EVENT_HUP,        // the peer closed the connection
+        SHARD_EVENT_ERROR,      // the socket failed
+    };
+
+    type_t              f_type = type_t::SHARD_EVENT_MESSAGE;
+    std::uint32_t       f_id = 0;
+    ed::message         f_message = ed::message();
+};
+
+
+class io_shard_runner;
+typedef std::shared_ptr<io_shard_runner>    io_shard_runner_pointer_t;
+
+
+}
+
+
+class io_shard
+    : public ed::thread_done_signal
+{
+public:
+    typedef std::shared_ptr<io_shard>   pointer_t;
+    typedef std::vector<pointer_t>      vector_t;
+
+    static constexpr std::size_t const  QUEUE_SIZE = 4096;
+
+                            io_shard(int index);
+                            io_shard(io_shard const &) = delete;
+    virtual                 ~io_shard() override;
+    io_shard &              operator = (io_shard const &) = delete;
+
+    void                    start();
+    void                    stop();
+    int                     get_index() const;
+
+    bool                    attach(std::shared_ptr<base_connection> conn, std::uint32_t & id);
+    void                    write(std::uint32_t id, std::string && data);
+    void                    detach(std::uint32_t id);
+    void                    remove_connections();
+
+    std::size_t             get_connection_count() const;
+    std::size_t             get_inbound_depth() const;
+    std::size_t             get_outbound_depth() const;
+    std::uint64_t           get_messages() const;
+    std::uint64_t           get_overflow() const;
+
+    // ed::thread_done_signal
+    virtual void            process_read() override;
+
+private:
+    friend class detail::io_shard_runner;
+
+    void                    send_command(detail::shard_command & command);
+    void                    flush_commands();
+    void                    wakeup_shard();
+
+    int const               f_index;
+    snapdev::raii_fd_t      f_wakeup = snapdev::raii_fd_t();
+    spsc_queue<detail::shard_command>
+                            f_outbound = spsc_queue<detail::shard_command>(QUEUE_SIZE);
+    spsc_queue<detail::shard_event>
+                            f_inbound = spsc_queue<detail::shard_event>(QUEUE_SIZE);
+    alignas(64) std::atomic<bool>
+                            f_core_waiting = false;     // main thread has f_overflow commands
+    alignas(64) std::atomic<bool>
+                            f_shard_waiting = false;    // shard thread has a backlog of events
+    std::deque<detail::shard_command>
+                            f_overflow = std::deque<detail::shard_command>();
+    std::map<std::uint32_t, std::weak_ptr<base_connection>>
+                            f_connections = std::map<std::uint32_t, std::weak_ptr<base_connection>>();
+    std::uint32_t           f_next_id = 0;
+    std::uint64_t           f_messages = 0;
+    std::uint64_t           f_overflow_count = 0;
+    detail::io_shard_runner_pointer_t
+                            f_runner = detail::io_shard_runner_pointer_t();
+    cppthread::thread::pointer_t
+                            f_thread = cppthread::thread::pointer_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
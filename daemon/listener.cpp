@@ -46,6 +46,12 @@
 #include    <libaddr/addr_parser.h>
 
 
+// C
+//
+#include    <openssl/err.h>
+#include    <sys/socket.h>
+
+
 // last include
 //
 #include    <snapdev/poison.h>
@@ -74,8 +80,10 @@ namespace communicator_daemon
  * The listener creates a new TCP server to listen for incoming
  * TCP connection.
  *
- * \warning
- * At this time the \p max_connections parameter is ignored.
+ * The \p max_connections parameter is the backlog of the socket. The
+ * number of connections accepted is limited by the admission control
+ * of the server which gives local, remote and secure listeners their
+ * own budget (see server::admit_connection()).
  *
  * \param[in] cs  The communicator server pointer.
  * \param[in] address  The address:port to listen on. Most often it is
@@ -107,6 +115,7 @@ listener::listener(
             , true)
     , f_server(cs)
     , f_local(local)
+    , f_secure(!certificate.empty() && !private_key.empty())
     , f_server_name(server_name)
 {
     //set_name(...) -- this is done in the server.cpp because the listener
@@ -122,14 +131,72 @@ void listener::process_accept()
     ed::tcp_bio_client::pointer_t const new_client(accept());
     if(new_client == nullptr)
     {
-        // an error occurred, report in the logs
-        int const e(errno);
-        SNAP_LOG_ERROR
-            << "somehow accept() of a tcp connection failed with errno: "
-            << e
-            << " -- "
-            << strerror(e)
-            << SNAP_LOG_SEND;
+        // an error occurred, report in the logs; the errno is not
+        // meaningful after a failed TLS handshake, use the OpenSSL errors
+        //
+        if(f_secure)
+        {
+            SNAP_LOG_ERROR
+                << "accept() of a secure tcp connection failed: "
+                << get_tls_errors()
+                << SNAP_LOG_SEND;
+        }
+        else
+        {
+            int const e(errno);
+            SNAP_LOG_ERROR
+                << "somehow accept() of a tcp connection failed with errno: "
+                << e
+                << " -- "
+                << strerror(e)
+                << SNAP_LOG_SEND;
+        }
+        return;
+    }
+
+    add_client(new_client);
+}
+
+
+/** \brief Add a newly accepted client.
+ *
+ * This function creates the service_connection of \p new_client and
+ * adds it to the ed::communicator object.
+ *
+ * It is called by process_accept() or, when the TLS handshakes are done
+ * by the secure_acceptor thread, by the secure_acceptor in the main
+ * thread.
+ *
+ * The client is first admitted by the server. If the budget of this
+ * listener or the quota of the client IP address is reached, the
+ * client is closed right away.
+ *
+ * \param[in] new_client  The client that was just accepted.
+ */
+void listener::add_client(ed::tcp_bio_client::pointer_t new_client)
+{
+    // the client inherited the handshake timeout of the listener, the
+    // messages are read when available so it is not necessary anymore
+    //
+    if(f_secure)
+    {
+        struct timeval const no_timeout = {};
+        int const s(new_client->get_socket());
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof(no_timeout));
+        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &no_timeout, sizeof(no_timeout));
+    }
+
+    // over budget, let the client go which closes its socket
+    //
+    admission_control::ticket ticket(f_server->admit_connection(
+              f_local
+                ? admission_budget_t::ADMISSION_BUDGET_LOCAL
+                : (f_secure
+                    ? admission_budget_t::ADMISSION_BUDGET_SECURE
+                    : admission_budget_t::ADMISSION_BUDGET_REMOTE)
+            , new_client->get_remote_address()));
+    if(!ticket.is_admitted())
+    {
         return;
     }
 
@@ -145,6 +212,12 @@ void listener::process_accept()
     //
     addr::addr const remote_addr(service->get_remote_address());
     addr::network_type_t const network_type(remote_addr.get_network_type());
+    if(f_secure)
+    {
+        // the TLS handshake was done by accept()
+        //
+        f_server->tls_handshake(remote_addr, true);
+    }
     if(f_local)
     {
         if(network_type != addr::network_type_t::NETWORK_TYPE_LOOPBACK)
@@ -199,6 +272,8 @@ void listener::process_accept()
         service->mark_as_remote();
     }
 
+    service->set_admission_ticket(std::move(ticket));
+
     if(!ed::communicator::instance()->add_connection(service))
     {
         // this should never happen here since each new creates a
@@ -211,6 +286,65 @@ void listener::process_accept()
 }
 
 
+/** \brief Limit the time a TLS handshake can take.
+ *
+ * The TLS handshake happens inside accept() and reads and writes the
+ * socket in blocking mode. A client which stops in the middle of the
+ * handshake would block the listener (or the secure_acceptor thread)
+ * forever. This function sets a receive and send timeout on the listener
+ * socket. The accepted sockets inherit these timeouts so a stalled
+ * handshake fails after \p timeout. add_client() removes the timeouts
+ * once the handshake succeeded.
+ *
+ * \param[in] timeout  The timeout in microseconds, 0 to wait forever.
+ *
+ * \return true if the timeouts were set.
+ */
+bool listener::set_handshake_timeout(std::int64_t timeout)
+{
+    struct timeval tv = {};
+    tv.tv_sec = timeout / 1'000'000;
+    tv.tv_usec = timeout % 1'000'000;
+    int const s(get_socket());
+    return setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0
+        && setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+
+/** \brief Retrieve the OpenSSL errors of the calling thread.
+ *
+ * When accept() fails on a secure listener, errno does not tell what
+ * happened. This function empties the OpenSSL error queue of the calling
+ * thread and returns the errors it found.
+ *
+ * \return The errors separated by semicolons.
+ */
+std::string listener::get_tls_errors()
+{
+    std::string result;
+    for(;;)
+    {
+        unsigned long const e(ERR_get_error());
+        if(e == 0)
+        {
+            break;
+        }
+        char buf[256];
+        ERR_error_string_n(e, buf, sizeof(buf));
+        if(!result.empty())
+        {
+            result += "; ";
+        }
+        result += buf;
+    }
+    if(result.empty())
+    {
+        result = "no OpenSSL error (the handshake may have timed out)";
+    }
+    return result;
+}
+
+
 /** \brief Set the \p username required to connect on this TCP connection.
  *
  * When accepting connections from remote communicatord, it is best to
@@ -58,6 +58,11 @@ public:
     // ed::tcp_server_connection
     virtual void        process_accept() override;
 
+    void                add_client(ed::tcp_bio_client::pointer_t new_client);
+    bool                set_handshake_timeout(std::int64_t timeout);
+
+    static std::string  get_tls_errors();
+
     void                set_username(std::string const & username);
     std::string         get_username() const;
     void                set_password(std::string const & password);
@@ -66,6 +71,7 @@ public:
 private:
     server::pointer_t   f_server = server::pointer_t();
     bool const          f_local = false;
+    bool const          f_secure = false;
     std::string const   f_server_name;
     std::string         f_username = std::string();
     std::string         f_password = std::string();
@@ -0,0 +1,377 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the load sampler.
+ *
+ * The 1 minute load average reacts far too slowly to be used to balance
+ * requests between computers. Instead, the sampler combines:
+ *
+ * \li the number of running tasks (the run queue, from /proc/loadavg)
+ *     divided by the number of processors;
+ * \li the CPU pressure, the share of time runnable tasks waited for a
+ *     CPU over the last 10 seconds (/proc/pressure/cpu);
+ * \li the memory pressure, the share of time tasks stalled on memory
+ *     over the last 10 seconds (/proc/pressure/memory).
+ *
+ * The raw score is the larger of the run queue and the CPU pressure plus
+ * the memory pressure. It gets smoothed with an exponentially weighted
+ * moving average with a configurable half-life.
+ *
+ * The pressure files are only available on kernels with PSI enabled.
+ * Without them, the score only uses the run queue.
+ */
+
+// self
+//
+#include    "load_sampler.h"
+
+
+// C++
+//
+#include    <algorithm>
+#include    <cmath>
+#include    <cstdlib>
+#include    <cstring>
+
+
+// C
+//
+#include    <fcntl.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+namespace
+{
+
+
+
+/** \brief Read a /proc file from the start.
+ *
+ * The /proc files can be read again from offset 0 without having to
+ * reopen them.
+ *
+ * \param[in] fd  The file descriptor.
+ * \param[out] buf  The buffer receiving the data.
+ * \param[in] size  The size of \p buf.
+ *
+ * \return true if some data was read; \p buf is then null terminated.
+ */
+bool read_proc(int fd, char * buf, std::size_t size)
+{
+    if(fd == -1)
+    {
+        return false;
+    }
+    ssize_t const r(pread(fd, buf, size - 1, 0));
+    if(r <= 0)
+    {
+        return false;
+    }
+    buf[r] = '\0';
+    return true;
+}
+
+
+int open_proc(std::string const & filename)
+{
+    return ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+
+void close_fd(int & fd)
+{
+    if(fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+
+
+} // no name namespace
+
+
+
+/** \brief Initialize the sampler.
+ *
+ * \param[in] processors  The number of processors of this computer.
+ */
+load_sampler::load_sampler(std::size_t processors)
+    : f_processors(std::max(static_cast<std::size_t>(1), processors))
+{
+}
+
+
+/** \brief Close the /proc files.
+ */
+load_sampler::~load_sampler()
+{
+    close();
+}
+
+
+/** \brief Open the /proc files.
+ *
+ * The loadavg file is required. The pressure files are optional.
+ *
+ * \param[in] proc_path  The path to the proc file system.
+ *
+ * \return true if at least the loadavg file could be opened.
+ */
+bool load_sampler::open(std::string const & proc_path)
+{
+    close();
+
+    f_loadavg_fd = open_proc(proc_path + "/loadavg");
+    f_cpu_fd = open_proc(proc_path + "/pressure/cpu");
+    f_memory_fd = open_proc(proc_path + "/pressure/memory");
+    f_first = true;
+
+    return f_loadavg_fd != -1;
+}
+
+
+/** \brief Close all the /proc files.
+ */
+void load_sampler::close()
+{
+    close_fd(f_loadavg_fd);
+    close_fd(f_cpu_fd);
+    close_fd(f_memory_fd);
+}
+
+
+/** \brief Change the half-life of the score.
+ *
+ * After \p seconds, a change in the raw load counts for half of the
+ * score.
+ *
+ * \param[in] seconds  The new half-life, it must be positive.
+ */
+void load_sampler::set_half_life(double seconds)
+{
+    if(seconds > 0.0)
+    {
+        f_half_life = seconds;
+    }
+}
+
+
+/** \brief Read the /proc files and update the score.
+ *
+ * \param[in] elapsed  The number of seconds since the previous sample.
+ *
+ * \return true if the sample worked.
+ */
+bool load_sampler::sample(double elapsed)
+{
+    char buf[256];
+    double running(0.0);
+    if(!read_proc(f_loadavg_fd, buf, sizeof(buf))
+    || !parse_loadavg(buf, f_loadavg, running))
+    {
+        return false;
+    }
+
+    // the count of running tasks includes ourselves
+    //
+    f_loadavg /= static_cast<double>(f_processors);
+    f_run_queue = std::max(0.0, running - 1.0) / static_cast<double>(f_processors);
+
+    double avg10(0.0);
+    f_cpu_pressure = read_proc(f_cpu_fd, buf, sizeof(buf))
+                  && parse_pressure(buf, avg10)
+                        ? avg10 / 100.0
+                        : 0.0;
+    f_memory_pressure = read_proc(f_memory_fd, buf, sizeof(buf))
+                     && parse_pressure(buf, avg10)
+                        ? avg10 / 100.0
+                        : 0.0;
+
+    double const raw(std::max(f_run_queue, f_cpu_pressure) + f_memory_pressure);
+    if(f_first)
+    {
+        f_first = false;
+        f_score = raw;
+    }
+    else
+    {
+        double const alpha(1.0 - std::exp2(-std::max(0.0, elapsed) / f_half_life));
+        f_score += alpha * (raw - f_score);
+    }
+
+    return true;
+}
+
+
+/** \brief Get the smoothed load score.
+ *
+ * A score of 1.0 represents a computer with all of its processors busy.
+ *
+ * \return The current score.
+ */
+double load_sampler::get_score() const
+{
+    return f_score;
+}
+
+
+/** \brief Get the 1 minute load average divided by the processors.
+ *
+ * \return The load average of the last sample.
+ */
+double load_sampler::get_loadavg() const
+{
+    return f_loadavg;
+}
+
+
+/** \brief Get the number of running tasks per processor.
+ *
+ * \return The run queue of the last sample.
+ */
+double load_sampler::get_run_queue() const
+{
+    return f_run_queue;
+}
+
+
+/** \brief Get the CPU pressure.
+ *
+ * \return The CPU pressure of the last sample, from 0.0 to 1.0.
+ */
+double load_sampler::get_cpu_pressure() const
+{
+    return f_cpu_pressure;
+}
+
+
+/** \brief Get the memory pressure.
+ *
+ * \return The memory pressure of the last sample, from 0.0 to 1.0.
+ */
+double load_sampler::get_memory_pressure() const
+{
+    return f_memory_pressure;
+}
+
+
+/** \brief Check whether the pressure files are available.
+ *
+ * \return true if the kernel offers the CPU pressure file.
+ */
+bool load_sampler::has_pressure() const
+{
+    return f_cpu_fd != -1;
+}
+
+
+/** \brief Parse the content of /proc/loadavg.
+ *
+ * The file looks like "0.50 0.40 0.30 3/512 12345". This function
+ * retrieves the 1 minute average and the number of running tasks.
+ *
+ * \param[in] data  The content of the file.
+ * \param[out] loadavg  The 1 minute load average.
+ * \param[out] running  The number of running tasks.
+ *
+ * \return true if the data was valid.
+ */
+bool load_sampler::parse_loadavg(char const * data, double & loadavg, double & running)
+{
+    char * end(nullptr);
+    loadavg = strtod(data, &end);
+    if(end == data)
+    {
+        return false;
+    }
+
+    // skip the 5 and 15 minutes averages
+    //
+    char const * s(end);
+    for(int field(0); field < 2; ++field)
+    {
+        strtod(s, &end);
+        if(end == s)
+        {
+            return false;
+        }
+        s = end;
+    }
+
+    long const r(strtol(s, &end, 10));
+    if(end == s
+    || *end != '/')
+    {
+        return false;
+    }
+    running = static_cast<double>(r);
+
+    return true;
+}
+
+
+/** \brief Parse the content of a /proc/pressure file.
+ *
+ * The file looks like:
+ *
+ * \code
+ *     some avg10=1.53 avg60=0.87 avg300=0.32 total=1234567
+ *     full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ * \endcode
+ *
+ * This function retrieves the "some" avg10 value, a percentage.
+ *
+ * \param[in] data  The content of the file.
+ * \param[out] avg10  The percentage of time some tasks stalled.
+ *
+ * \return true if the data was valid.
+ */
+bool load_sampler::parse_pressure(char const * data, double & avg10)
+{
+    if(strncmp(data, "some ", 5) != 0)
+    {
+        return false;
+    }
+    char const * s(strstr(data, "avg10="));
+    if(s == nullptr)
+    {
+        return false;
+    }
+    s += 6;
+    char * end(nullptr);
+    avg10 = strtod(s, &end);
+    return end != s;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,81 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the load sampler.
+ *
+ * The load sampler computes the load score this communicator daemon
+ * sends to its LOADAVG listeners. It keeps the /proc files open and
+ * reads them with pread() on each sample.
+ */
+
+// C++
+//
+#include    <string>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class load_sampler
+{
+public:
+    static constexpr double const   DEFAULT_HALF_LIFE = 5.0;    // seconds
+
+                                load_sampler(std::size_t processors);
+                                load_sampler(load_sampler const &) = delete;
+                                ~load_sampler();
+    load_sampler &              operator = (load_sampler const &) = delete;
+
+    bool                        open(std::string const & proc_path = "/proc");
+    void                        close();
+    void                        set_half_life(double seconds);
+    bool                        sample(double elapsed);
+
+    double                      get_score() const;
+    double                      get_loadavg() const;
+    double                      get_run_queue() const;
+    double                      get_cpu_pressure() const;
+    double                      get_memory_pressure() const;
+    bool                        has_pressure() const;
+
+    static bool                 parse_loadavg(char const * data, double & loadavg, double & running);
+    static bool                 parse_pressure(char const * data, double & avg10);
+
+private:
+    std::size_t                 f_processors = 1;
+    double                      f_half_life = DEFAULT_HALF_LIFE;
+    int                         f_loadavg_fd = -1;
+    int                         f_cpu_fd = -1;
+    int                         f_memory_fd = -1;
+    bool                        f_first = true;
+    double                      f_score = 0.0;
+    double                      f_loadavg = 0.0;
+    double                      f_run_queue = 0.0;
+    double                      f_cpu_pressure = 0.0;
+    double                      f_memory_pressure = 0.0;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
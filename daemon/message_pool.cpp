@@ -0,0 +1,185 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the message pool.
+ *
+ * The released messages are not cleared. Assigning a message to one of
+ * them reuses its existing parameter nodes and strings, which is what
+ * makes the pool cheaper than a new copy. The user data (i.e. the
+ * connection which received the message) is released though, so a
+ * message waiting in the pool does not keep a connection alive.
+ *
+ * The messages handed out by the pool are expected to be short lived:
+ * the caller acquires one, rewrites the fields which differ from the
+ * model, sends it and lets the message_ptr go out of scope. Since a
+ * message can be acquired while another one is in use (i.e. a nested
+ * broadcast), the pool grows as required and only keeps up to
+ * `max_free` messages once they are released.
+ */
+
+// self
+//
+#include    "message_pool.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize a pointer to a message owned by a pool.
+ *
+ * \param[in] pool  The pool the message returns to.
+ * \param[in] msg  The message.
+ */
+message_pool::message_ptr::message_ptr(message_pool & pool, std::unique_ptr<ed::message> && msg)
+    : f_pool(&pool)
+    , f_message(std::move(msg))
+{
+}
+
+
+/** \brief Move a pointer to a pooled message.
+ *
+ * \param[in] rhs  The pointer to move; it does not own a message anymore.
+ */
+message_pool::message_ptr::message_ptr(message_ptr && rhs)
+    : f_pool(rhs.f_pool)
+    , f_message(std::move(rhs.f_message))
+{
+}
+
+
+/** \brief Return the message to its pool.
+ */
+message_pool::message_ptr::~message_ptr()
+{
+    if(f_message != nullptr)
+    {
+        f_pool->release(std::move(f_message));
+    }
+}
+
+
+/** \brief Access the message.
+ *
+ * \return A reference to the pooled message.
+ */
+ed::message & message_pool::message_ptr::operator * () const
+{
+    return *f_message;
+}
+
+
+/** \brief Access the message.
+ *
+ * \return A pointer to the pooled message.
+ */
+ed::message * message_pool::message_ptr::operator -> () const
+{
+    return f_message.get();
+}
+
+
+/** \brief Initialize the pool.
+ *
+ * \param[in] max_free  The number of released messages kept for reuse.
+ */
+message_pool::message_pool(std::size_t max_free)
+    : f_max_free(max_free)
+{
+}
+
+
+/** \brief Get a copy of a message.
+ *
+ * This function returns a message equal to \p model. When a released
+ * message is available, \p model gets assigned to it so its storage is
+ * reused.
+ *
+ * \param[in] model  The message to copy.
+ *
+ * \return A pointer to the copy, which returns to the pool once destroyed.
+ */
+message_pool::message_ptr message_pool::acquire(ed::message const & model)
+{
+    if(f_free.empty())
+    {
+        ++f_allocated;
+        return message_ptr(*this, std::make_unique<ed::message>(model));
+    }
+
+    ++f_reused;
+    std::unique_ptr<ed::message> msg(std::move(f_free.back()));
+    f_free.pop_back();
+    *msg = model;
+    return message_ptr(*this, std::move(msg));
+}
+
+
+/** \brief Get the number of messages ready for reuse.
+ *
+ * \return The number of released messages kept by the pool.
+ */
+std::size_t message_pool::get_free() const
+{
+    return f_free.size();
+}
+
+
+/** \brief Get the number of messages allocated by the pool.
+ *
+ * \return The number of times acquire() had to allocate a new message.
+ */
+std::uint64_t message_pool::get_allocated() const
+{
+    return f_allocated;
+}
+
+
+/** \brief Get the number of messages reused by the pool.
+ *
+ * \return The number of times acquire() reused a released message.
+ */
+std::uint64_t message_pool::get_reused() const
+{
+    return f_reused;
+}
+
+
+void message_pool::release(std::unique_ptr<ed::message> && msg)
+{
+    if(f_free.size() >= f_max_free)
+    {
+        return;
+    }
+    msg->user_data(std::shared_ptr<void>());
+    f_free.push_back(std::move(msg));
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,93 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the message pool.
+ *
+ * Copying an ed::message allocates one node per parameter plus the
+ * strings of each parameter. The broadcast path makes such a copy for
+ * each message it forwards. The pool keeps the messages it hands out
+ * once they are released so the next copy assigned to them reuses their
+ * nodes and string buffers instead of allocating new ones.
+ */
+
+// eventdispatcher
+//
+#include    <eventdispatcher/message.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <memory>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class message_pool
+{
+public:
+    static constexpr std::size_t const  DEFAULT_MAX_FREE = 16;
+
+    class message_ptr
+    {
+    public:
+                                message_ptr(message_pool & pool, std::unique_ptr<ed::message> && msg);
+                                message_ptr(message_ptr const &) = delete;
+                                message_ptr(message_ptr && rhs);
+                                ~message_ptr();
+
+        message_ptr &           operator = (message_ptr const &) = delete;
+        message_ptr &           operator = (message_ptr &&) = delete;
+
+        ed::message &           operator * () const;
+        ed::message *           operator -> () const;
+
+    private:
+        message_pool *          f_pool = nullptr;
+        std::unique_ptr<ed::message>
+                                f_message = std::unique_ptr<ed::message>();
+    };
+
+                                message_pool(std::size_t max_free = DEFAULT_MAX_FREE);
+
+    message_ptr                 acquire(ed::message const & model);
+    std::size_t                 get_free() const;
+    std::uint64_t               get_allocated() const;
+    std::uint64_t               get_reused() const;
+
+private:
+    void                        release(std::unique_ptr<ed::message> && msg);
+
+    std::size_t                 f_max_free = DEFAULT_MAX_FREE;
+    std::vector<std::unique_ptr<ed::message>>
+                                f_free = std::vector<std::unique_ptr<ed::message>>();
+    std::uint64_t               f_allocated = 0;
+    std::uint64_t               f_reused = 0;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,605 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the message validator.
+ *
+ * The definitions are read once. Each section of a definition file
+ * (i.e. `[name]`) describes one parameter. The `flags` field tells
+ * whether the parameter is required and the `type` field whether the
+ * value has to be an integer or a timespec. Other types are not verified.
+ *
+ * The parameters of a command are saved in a vector and the required
+ * ones in a bit mask so verifying a message is a few map searches in
+ * the message parameters and no allocation.
+ *
+ * The control messages of the communicator daemons are never accepted
+ * as broadcast messages.
+ *
+ * A `delivery = reliable` field found before the first section marks
+ * the command as reliable: the communicator daemons acknowledge it
+ * between each other and send it again after a reconnect. A
+ * `rate = <rate>[/<burst>]` field defines the default ingress rate limit
+ * of the command, per connection.
+ */
+
+// self
+//
+#include    "message_validator.h"
+
+
+// communicatord
+//
+#include    <communicatord/names.h>
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// snapdev
+//
+#include    <snapdev/file_contents.h>
+#include    <snapdev/glob_to_list.h>
+#include    <snapdev/pathinfo.h>
+#include    <snapdev/tokenize_string.h>
+#include    <snapdev/trim_string.h>
+
+
+// C++
+//
+#include    <algorithm>
+#include    <list>
+#include    <set>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace
+{
+
+
+
+char const * const g_no_broadcast[] =
+{
+    communicatord::g_name_communicatord_cmd_accept,
+    communicatord::g_name_communicatord_cmd_connect,
+    communicatord::g_name_communicatord_cmd_disconnect,
+    communicatord::g_name_communicatord_cmd_refuse,
+    communicatord::g_name_communicatord_cmd_register,
+    communicatord::g_name_communicatord_cmd_register_for_flags,
+    communicatord::g_name_communicatord_cmd_register_for_loadavg,
+    communicatord::g_name_communicatord_cmd_shm_request,
+    communicatord::g_name_communicatord_cmd_unregister,
+    communicatord::g_name_communicatord_cmd_unregister_from_loadavg,
+};
+
+
+bool is_integer(std::string const & value)
+{
+    char const * s(value.c_str());
+    if(*s == '-' || *s == '+')
+    {
+        ++s;
+    }
+    if(*s == '\0')
+    {
+        return false;
+    }
+    for(; *s != '\0'; ++s)
+    {
+        if(*s < '0' || *s > '9')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool is_timespec(std::string const & value)
+{
+    std::string::size_type const pos(value.find('.'));
+    if(pos == std::string::npos)
+    {
+        return is_integer(value);
+    }
+    std::string const fraction(value.substr(pos + 1));
+    return is_integer(value.substr(0, pos))
+        && !fraction.empty()
+        && fraction[0] != '-'
+        && fraction[0] != '+'
+        && is_integer(fraction);
+}
+
+
+
+} // no name namespace
+
+
+
+/** \brief Convert a validation mode name to a validation_mode_t.
+ *
+ * \param[in] name  The name of the mode: "off", "count" or "reject".
+ * \param[out] mode  The corresponding mode.
+ *
+ * \return true if \p name is a valid mode name.
+ */
+bool parse_validation_mode(std::string const & name, validation_mode_t & mode)
+{
+    if(name == "off")
+    {
+        mode = validation_mode_t::VALIDATION_MODE_OFF;
+        return true;
+    }
+    if(name == "count")
+    {
+        mode = validation_mode_t::VALIDATION_MODE_COUNT;
+        return true;
+    }
+    if(name == "reject")
+    {
+        mode = validation_mode_t::VALIDATION_MODE_REJECT;
+        return true;
+    }
+    return false;
+}
+
+
+/** \brief Load the message definitions.
+ *
+ * This function reads all the .conf files found in the colon separated
+ * list of directories \p paths. The name of each file is the name of the
+ * command it defines. When the same command is defined in more than one
+ * directory, the first one wins.
+ *
+ * \param[in] paths  A colon separated list of directories.
+ *
+ * \return The number of definitions loaded.
+ */
+std::size_t message_validator::load(std::string const & paths)
+{
+    std::list<std::string> dirs;
+    snapdev::tokenize_string(dirs, paths, { ":" }, true);
+
+    std::size_t count(0);
+    for(auto const & d : dirs)
+    {
+        typedef std::set<std::string> definition_files_t;
+        snapdev::glob_to_list<definition_files_t> files;
+        if(!files.read_path<snapdev::glob_to_list_flag_t::GLOB_FLAG_NO_ESCAPE>(d + "/*.conf"))
+        {
+            continue;
+        }
+        for(auto const & f : files)
+        {
+            std::string const command(snapdev::pathinfo::basename(f, ".conf"));
+            if(find_command(command) != COMMAND_ID_UNKNOWN
+            && get_rules(command).f_defined)
+            {
+                continue;
+            }
+
+            snapdev::file_contents input(f);
+            if(!input.read_all())
+            {
+                SNAP_LOG_WARNING
+                    << "could not read message definition \""
+                    << f
+                    << "\"."
+                    << SNAP_LOG_SEND;
+                continue;
+            }
+            if(add_definition(command, input.contents()))
+            {
+                ++count;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+/** \brief Compile the definition of one command.
+ *
+ * \param[in] command  The name of the command.
+ * \param[in] definition  The contents of the definition file.
+ *
+ * \return true if the definition was compiled.
+ */
+bool message_validator::add_definition(std::string const & command, std::string const & definition)
+{
+    if(command.empty())
+    {
+        return false;
+    }
+
+    command_rules & rules(get_rules(command));
+    if(!rules.f_defined)
+    {
+        rules.f_defined = true;
+        ++f_defined;
+    }
+    rules.f_required = 0;
+    rules.f_reliable = false;
+    rules.f_rate_limit = rate_limit();
+    rules.f_parameters.clear();
+
+    std::list<std::string> lines;
+    snapdev::tokenize_string(lines, definition, { "\n" }, true, " \t\r");
+    parameter_rule * param(nullptr);
+    bool required(false);
+    auto const end_parameter = [&rules, &param, &required, &command]()
+    {
+        if(param == nullptr)
+        {
+            return;
+        }
+        if(required)
+        {
+            if(rules.f_parameters.size() > MAX_PARAMETERS)
+            {
+                SNAP_LOG_WARNING
+                    << "message definition of \""
+                    << command
+                    << "\" has more than "
+                    << MAX_PARAMETERS
+                    << " parameters; \""
+                    << param->f_name
+                    << "\" is not marked as required."
+                    << SNAP_LOG_SEND;
+            }
+            else
+            {
+                rules.f_required |= 1ULL << (rules.f_parameters.size() - 1);
+            }
+        }
+        param = nullptr;
+        required = false;
+    };
+    for(auto const & l : lines)
+    {
+        if(l[0] == '#')
+        {
+            continue;
+        }
+        if(l[0] == '[')
+        {
+            end_parameter();
+            std::string const name(snapdev::trim_string(l.substr(1, l.find(']') - 1)));
+            if(!name.empty())
+            {
+                rules.f_parameters.push_back({ name, parameter_type_t::PARAMETER_TYPE_STRING });
+                param = &rules.f_parameters.back();
+            }
+            continue;
+        }
+        std::string::size_type const equal(l.find('='));
+        if(equal == std::string::npos)
+        {
+            continue;
+        }
+        std::string const field(snapdev::trim_string(l.substr(0, equal)));
+        std::string const value(snapdev::trim_string(l.substr(equal + 1)));
+        if(param == nullptr)
+        {
+            if(field == "delivery")
+            {
+                rules.f_reliable = value == "reliable";
+            }
+            else if(field == "rate")
+            {
+                if(!parse_rate_limit(value, rules.f_rate_limit))
+                {
+                    SNAP_LOG_WARNING
+                        << "message definition of \""
+                        << command
+                        << "\" has an invalid rate \""
+                        << value
+                        << "\"; it is ignored."
+                        << SNAP_LOG_SEND;
+                    rules.f_rate_limit = rate_limit();
+                }
+            }
+            continue;
+        }
+        if(field == "flags")
+        {
+            std::list<std::string> flags;
+            snapdev::tokenize_string(flags, value, { ",", " " }, true);
+            required = std::find(flags.begin(), flags.end(), "required") != flags.end();
+        }
+        else if(field == "type")
+        {
+            if(value == "integer")
+            {
+                param->f_type = parameter_type_t::PARAMETER_TYPE_INTEGER;
+            }
+            else if(value == "timespec")
+            {
+                param->f_type = parameter_type_t::PARAMETER_TYPE_TIMESPEC;
+            }
+        }
+    }
+    end_parameter();
+
+    rules.f_broadcast = std::find_if(
+              std::begin(g_no_broadcast)
+            , std::end(g_no_broadcast)
+            , [&command](char const * name) { return command == name; }) == std::end(g_no_broadcast);
+
+    return true;
+}
+
+
+/** \brief Set the default validation mode.
+ *
+ * This mode applies to the commands without a mode of their own (see
+ * set_command_modes()).
+ *
+ * \param[in] mode  The new default mode.
+ */
+void message_validator::set_mode(validation_mode_t mode)
+{
+    f_mode = mode;
+}
+
+
+/** \brief Set the validation mode of specific commands.
+ *
+ * The \p modes parameter is a comma separated list of
+ * `<command>=<mode>` entries such as `"LOADAVG=off,REGISTER=reject"`.
+ *
+ * \param[in] modes  The list of commands and their mode.
+ *
+ * \return true if all the entries were valid.
+ */
+bool message_validator::set_command_modes(std::string const & modes)
+{
+    std::list<std::string> entries;
+    snapdev::tokenize_string(entries, modes, { "," }, true, " \t");
+
+    bool result(true);
+    for(auto const & e : entries)
+    {
+        std::string::size_type const equal(e.find('='));
+        validation_mode_t mode(validation_mode_t::VALIDATION_MODE_COUNT);
+        if(equal == std::string::npos
+        || equal == 0
+        || !parse_validation_mode(snapdev::trim_string(e.substr(equal + 1)), mode))
+        {
+            SNAP_LOG_ERROR
+                << "invalid message validation entry \""
+                << e
+                << "\"; expected <command>=off|count|reject."
+                << SNAP_LOG_SEND;
+            result = false;
+            continue;
+        }
+        command_rules & rules(get_rules(snapdev::trim_string(e.substr(0, equal))));
+        rules.f_has_mode = true;
+        rules.f_mode = mode;
+    }
+
+    return result;
+}
+
+
+/** \brief Verify a message against its definition.
+ *
+ * Messages without a definition are considered valid.
+ *
+ * This function is called with each message so it does not generate
+ * any diagnostic. Call get_error() once the message was found invalid
+ * to know why.
+ *
+ * \param[in] msg  The message to verify.
+ *
+ * \return VALIDATION_VALID if the message is valid or was not verified,
+ * otherwise VALIDATION_INVALID or VALIDATION_REJECT depending on the mode
+ * of that command.
+ */
+validation_t message_validator::validate(ed::message const & msg) const
+{
+    return check(msg, nullptr);
+}
+
+
+/** \brief Explain why a message is not valid.
+ *
+ * This function verifies \p msg again and returns the reason why it does
+ * not match its definition.
+ *
+ * \param[in] msg  The message found invalid by validate().
+ *
+ * \return The reason why \p msg is not valid or an empty string if it
+ * is valid.
+ */
+std::string message_validator::get_error(ed::message const & msg) const
+{
+    std::string error;
+    check(msg, &error);
+    return error;
+}
+
+
+validation_t message_validator::check(ed::message const & msg, std::string * error) const
+{
+    command_id_t const id(find_command(msg.get_command()));
+    if(id >= f_commands.size())
+    {
+        return validation_t::VALIDATION_VALID;
+    }
+    command_rules const & rules(f_commands[id]);
+    validation_mode_t const mode(rules.f_has_mode ? rules.f_mode : f_mode);
+    if(!rules.f_defined
+    || mode == validation_mode_t::VALIDATION_MODE_OFF)
+    {
+        return validation_t::VALIDATION_VALID;
+    }
+
+    auto const invalid = [mode, error](char const * reason, std::string const & name)
+    {
+        if(error != nullptr)
+        {
+            *error = reason;
+            *error += name;
+            *error += '"';
+        }
+        return mode == validation_mode_t::VALIDATION_MODE_REJECT
+                    ? validation_t::VALIDATION_REJECT
+                    : validation_t::VALIDATION_INVALID;
+    };
+
+    if(!rules.f_broadcast)
+    {
+        std::string const & service(msg.get_service());
+        if(service == communicatord::g_name_communicatord_service_public_broadcast
+        || service == communicatord::g_name_communicatord_service_private_broadcast
+        || service == communicatord::g_name_communicatord_service_local_broadcast)
+        {
+            return invalid("command cannot be broadcast to \"", service);
+        }
+    }
+
+    std::uint64_t present(0);
+    std::size_t const max(rules.f_parameters.size());
+    for(std::size_t idx(0); idx < max; ++idx)
+    {
+        parameter_rule const & p(rules.f_parameters[idx]);
+        if(!msg.has_parameter(p.f_name))
+        {
+            continue;
+        }
+        if(idx < MAX_PARAMETERS)
+        {
+            present |= 1ULL << idx;
+        }
+        switch(p.f_type)
+        {
+        case parameter_type_t::PARAMETER_TYPE_INTEGER:
+            if(!is_integer(msg.get_parameter(p.f_name)))
+            {
+                return invalid("expected an integer in parameter \"", p.f_name);
+            }
+            break;
+
+        case parameter_type_t::PARAMETER_TYPE_TIMESPEC:
+            if(!is_timespec(msg.get_parameter(p.f_name)))
+            {
+                return invalid("expected a timespec in parameter \"", p.f_name);
+            }
+            break;
+
+        case parameter_type_t::PARAMETER_TYPE_STRING:
+            break;
+
+        }
+    }
+
+    std::uint64_t const missing(rules.f_required & ~present);
+    if(missing != 0)
+    {
+        std::size_t idx(0);
+        while((missing & (1ULL << idx)) == 0)
+        {
+            ++idx;
+        }
+        return invalid("missing required parameter \"", rules.f_parameters[idx].f_name);
+    }
+
+    return validation_t::VALIDATION_VALID;
+}
+
+
+/** \brief Check whether a command is delivered reliably.
+ *
+ * A command which definition includes `delivery = reliable` gets
+ * acknowledged by the other communicator daemons and sent again if the
+ * link breaks before that acknowledgement.
+ *
+ * \param[in] command  The name of the command.
+ *
+ * \return true if \p command has to be delivered reliably.
+ */
+bool message_validator::is_reliable(std::string const & command) const
+{
+    command_id_t const id(find_command(command));
+    if(id >= f_commands.size())
+    {
+        return false;
+    }
+    return f_commands[id].f_reliable;
+}
+
+
+/** \brief Get the default rate limit of a command.
+ *
+ * A command which definition includes `rate = <rate>[/<burst>]` is
+ * limited to that many messages per second on each connection unless
+ * the --rate-limits include a rule for that command.
+ *
+ * \param[in] command  The identifier of the command.
+ *
+ * \return The rate limit, unlimited if the definition does not have one.
+ */
+rate_limit message_validator::get_rate_limit(command_id_t command) const
+{
+    if(command >= f_commands.size())
+    {
+        return rate_limit();
+    }
+    return f_commands[command].f_rate_limit;
+}
+
+
+/** \brief Get the number of commands with a definition.
+ *
+ * \return The number of definitions compiled.
+ */
+std::size_t message_validator::size() const
+{
+    return f_defined;
+}
+
+
+message_validator::command_rules & message_validator::get_rules(std::string const & command)
+{
+    command_id_t const id(seed_command(command));
+    if(id >= f_commands.size())
+    {
+        f_commands.resize(id + 1);
+    }
+    return f_commands[id];
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,129 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the message validator.
+ *
+ * The message definitions (the .conf files installed along the
+ * eventdispatcher definitions) are compiled at startup in a table of
+ * rules indexed by command identifier. Each message received by the
+ * Communicator can then be verified cheaply: the required parameters,
+ * the type of the integer and timespec parameters and whether that
+ * command can be broadcast.
+ */
+
+// self
+//
+#include    "command_ids.h"
+#include    "rate_limiter.h"
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/message.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <map>
+#include    <string>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+enum class validation_mode_t
+{
+    VALIDATION_MODE_OFF,        // do not verify
+    VALIDATION_MODE_COUNT,      // count the invalid messages, still process them
+    VALIDATION_MODE_REJECT,     // count and drop the invalid messages
+};
+
+
+enum class validation_t
+{
+    VALIDATION_VALID,
+    VALIDATION_INVALID,         // invalid, but the mode says to process it anyway
+    VALIDATION_REJECT,          // invalid and has to be dropped
+};
+
+
+bool                    parse_validation_mode(std::string const & name, validation_mode_t & mode);
+
+
+class message_validator
+{
+public:
+    static constexpr std::size_t const  MAX_PARAMETERS = 64;
+
+    std::size_t         load(std::string const & paths);
+    bool                add_definition(std::string const & command, std::string const & definition);
+    void                set_mode(validation_mode_t mode);
+    bool                set_command_modes(std::string const & modes);
+    validation_t        validate(ed::message const & msg) const;
+    std::string         get_error(ed::message const & msg) const;
+    bool                is_reliable(std::string const & command) const;
+    rate_limit          get_rate_limit(command_id_t command) const;
+    std::size_t         size() const;
+
+private:
+    validation_t        check(ed::message const & msg, std::string * error) const;
+
+    enum class parameter_type_t : std::uint8_t
+    {
+        PARAMETER_TYPE_STRING,      // anything goes
+        PARAMETER_TYPE_INTEGER,
+        PARAMETER_TYPE_TIMESPEC,
+    };
+
+    struct parameter_rule
+    {
+        std::string         f_name = std::string();
+        parameter_type_t    f_type = parameter_type_t::PARAMETER_TYPE_STRING;
+    };
+
+    struct command_rules
+    {
+        bool                f_defined = false;
+        bool                f_broadcast = true;
+        bool                f_has_mode = false;
+        bool                f_reliable = false;     // delivery = reliable
+        rate_limit          f_rate_limit = rate_limit();    // rate = <rate>[/<burst>]
+        validation_mode_t   f_mode = validation_mode_t::VALIDATION_MODE_COUNT;
+        std::uint64_t       f_required = 0;         // one bit per entry in f_parameters
+        std::vector<parameter_rule>
+                            f_parameters = std::vector<parameter_rule>();
+    };
+
+    command_rules &     get_rules(std::string const & command);
+
+    std::vector<command_rules>
+                        f_commands = std::vector<command_rules>();   // indexed by command_id_t
+    std::size_t         f_defined = 0;
+    validation_mode_t   f_mode = validation_mode_t::VALIDATION_MODE_COUNT;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,466 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the metrics counters.
+ *
+ * The counters of each command are saved in a vector indexed by the
+ * command identifier so counting a message is a vector access. Commands
+ * which were never interned (i.e. no connection understands them) are
+ * counted together under the "<unknown>" name so a peer sending random
+ * commands cannot grow the vector.
+ *
+ * The latency histograms use one bucket per power of two microseconds,
+ * which is precise enough to tell a 100ms stall from the usual few
+ * microseconds and costs a bit_width() to record.
+ */
+
+// self
+//
+#include    "metrics.h"
+
+
+// C++
+//
+#include    <algorithm>
+#include    <bit>
+#include    <iomanip>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace
+{
+
+
+
+char const * const g_route_names[] =
+{
+    "handled",
+    "forwarded",
+    "broadcast",
+    "cached",
+    "dropped",
+    "duplicate",
+    "rejected",
+    "throttled",
+    "shed",
+};
+
+static_assert(std::size(g_route_names) == static_cast<std::size_t>(route_t::ROUTE_max));
+
+
+
+} // no name namespace
+
+
+
+/** \brief Record one duration in the histogram.
+ *
+ * \param[in] us  The duration in microseconds.
+ */
+void latency_histogram::record(std::int64_t us)
+{
+    std::uint64_t const duration(us < 0 ? 0 : static_cast<std::uint64_t>(us));
+    std::size_t const idx(duration <= 1 ? 0 : std::bit_width(duration - 1));
+    ++f_buckets[std::min(idx, BUCKETS)];
+    ++f_count;
+    f_sum += duration;
+}
+
+
+/** \brief Get the number of durations recorded.
+ *
+ * \return The number of calls to record().
+ */
+std::uint64_t latency_histogram::get_count() const
+{
+    return f_count;
+}
+
+
+/** \brief Write the histogram in the Prometheus text format.
+ *
+ * The buckets are cumulative and expressed in seconds as expected by
+ * Prometheus.
+ *
+ * \param[in,out] out  The output stream.
+ * \param[in] name  The name of the metric, without the "_bucket" suffix.
+ * \param[in] labels  Extra labels, empty or ending the list with a comma.
+ */
+void latency_histogram::output(
+      std::ostream & out
+    , char const * name
+    , std::string const & labels) const
+{
+    std::uint64_t total(0);
+    for(std::size_t idx(0); idx <= BUCKETS; ++idx)
+    {
+        total += f_buckets[idx];
+        out << name << "_bucket{" << labels << "le=\"";
+        if(idx == BUCKETS)
+        {
+            out << "+Inf";
+        }
+        else
+        {
+            out << std::fixed << std::setprecision(6) << static_cast<double>(1ULL << idx) / 1'000'000.0 << std::defaultfloat;
+        }
+        out << "\"} " << total << '\n';
+    }
+    out << name << "_sum";
+    if(!labels.empty())
+    {
+        out << '{' << labels.substr(0, labels.length() - 1) << '}';
+    }
+    out << ' ' << std::fixed << std::setprecision(6) << static_cast<double>(f_sum) / 1'000'000.0 << std::defaultfloat << '\n';
+    out << name << "_count";
+    if(!labels.empty())
+    {
+        out << '{' << labels.substr(0, labels.length() - 1) << '}';
+    }
+    out << ' ' << f_count << '\n';
+}
+
+
+/** \brief Count a message received by the daemon.
+ *
+ * \param[in] command  The command of the message.
+ */
+void metrics::message_in(std::string const & command)
+{
+    ++get_counters(command).f_in;
+}
+
+
+/** \brief Count how a message was routed.
+ *
+ * \param[in] command  The command of the message.
+ * \param[in] r  The route taken by the message.
+ */
+void metrics::route(std::string const & command, route_t r)
+{
+    ++get_counters(command).f_routes[static_cast<int>(r)];
+    if(f_decision == route_t::ROUTE_max)
+    {
+        f_decision = r;
+    }
+}
+
+
+/** \brief Start tracking the routing decision of a message.
+ *
+ * The first route() call following this call is the decision taken for
+ * that message. Messages sent by its handler, if any, are routed
+ * afterward and do not change that decision.
+ */
+void metrics::start_decision()
+{
+    f_decision = route_t::ROUTE_max;
+}
+
+
+/** \brief Get the routing decision of the current message.
+ *
+ * \return The first route recorded since start_decision() or
+ * route_t::ROUTE_max if the message was not routed (i.e. it was received
+ * while shutting down).
+ */
+route_t metrics::get_decision() const
+{
+    return f_decision;
+}
+
+
+/** \brief Count a message which does not match its definition.
+ *
+ * \param[in] command  The command of the message.
+ */
+void metrics::invalid_message(std::string const & command)
+{
+    ++get_counters(command).f_invalid;
+}
+
+
+/** \brief Record the time it took to dispatch a message.
+ *
+ * For messages handled by the daemon, this is the time spent in their
+ * msg_...() function. For the others, it is the time spent forwarding.
+ *
+ * \param[in] command  The command of the message.
+ * \param[in] us  The duration in microseconds.
+ */
+void metrics::dispatch_latency(std::string const & command, std::int64_t us)
+{
+    get_counters(command).f_dispatch.record(us);
+}
+
+
+/** \brief Record the time data waited in the output queue of a connection.
+ *
+ * \param[in] us  The duration in microseconds.
+ */
+void metrics::output_latency(std::int64_t us)
+{
+    f_output.record(us);
+}
+
+
+/** \brief Count a TRANSMISSION_REPORT sent back to a service.
+ */
+void metrics::transmission_report()
+{
+    ++f_transmission_reports;
+}
+
+
+/** \brief Write the counters in the Prometheus text format.
+ *
+ * \param[in,out] out  The stream where the counters get written.
+ */
+void metrics::output(std::ostream & out) const
+{
+    header(out, "communicatord_messages_in_total", "counter", "Messages received per command.");
+    for(auto const & c : f_commands)
+    {
+        if(c.f_in != 0)
+        {
+            sample(out, "communicatord_messages_in_total", label("command", c.f_command), c.f_in);
+        }
+    }
+    if(f_unknown.f_in != 0)
+    {
+        sample(out, "communicatord_messages_in_total", label("command", f_unknown.f_command), f_unknown.f_in);
+    }
+
+    header(out, "communicatord_messages_invalid_total", "counter", "Messages which do not match their definition per command.");
+    auto const invalid = [&out](command_counters const & c)
+    {
+        if(c.f_invalid != 0)
+        {
+            sample(out, "communicatord_messages_invalid_total", label("command", c.f_command), c.f_invalid);
+        }
+    };
+    for(auto const & c : f_commands)
+    {
+        invalid(c);
+    }
+    invalid(f_unknown);
+
+    header(out, "communicatord_messages_routed_total", "counter", "Messages per command and route.");
+    auto const routes = [&out](command_counters const & c)
+    {
+        for(std::size_t r(0); r < static_cast<std::size_t>(route_t::ROUTE_max); ++r)
+        {
+            if(c.f_routes[r] != 0)
+            {
+                sample(
+                      out
+                    , "communicatord_messages_routed_total"
+                    , label("command", c.f_command) + ',' + label("route", g_route_names[r])
+                    , c.f_routes[r]);
+            }
+        }
+    };
+    for(auto const & c : f_commands)
+    {
+        routes(c);
+    }
+    routes(f_unknown);
+
+    header(out, "communicatord_transmission_reports_total", "counter", "TRANSMISSION_REPORT messages sent to services.");
+    sample(out, "communicatord_transmission_reports_total", std::string(), f_transmission_reports);
+
+    header(out, "communicatord_dispatch_seconds", "histogram", "Time spent dispatching a message per command.");
+    auto const dispatch = [&out](command_counters const & c)
+    {
+        if(c.f_dispatch.get_count() != 0)
+        {
+            c.f_dispatch.output(out, "communicatord_dispatch_seconds", label("command", c.f_command) + ',');
+        }
+    };
+    for(auto const & c : f_commands)
+    {
+        dispatch(c);
+    }
+    dispatch(f_unknown);
+
+    header(out, "communicatord_output_queue_seconds", "histogram", "Time spent by the output in the queue of a connection before being written.");
+    f_output.output(out, "communicatord_output_queue_seconds", std::string());
+}
+
+
+/** \brief Write the HELP and TYPE lines of a metric.
+ *
+ * \param[in,out] out  The output stream.
+ * \param[in] name  The name of the metric.
+ * \param[in] type  The type of the metric ("counter" or "gauge").
+ * \param[in] help  A short description of the metric.
+ */
+void metrics::header(
+      std::ostream & out
+    , char const * name
+    , char const * type
+    , char const * help)
+{
+    out << "# HELP " << name << ' ' << help << '\n'
+        << "# TYPE " << name << ' ' << type << '\n';
+}
+
+
+/** \brief Write one sample of a metric.
+ *
+ * \param[in,out] out  The output stream.
+ * \param[in] name  The name of the metric.
+ * \param[in] labels  The labels as generated by label(), separated by
+ * commas, or an empty string.
+ * \param[in] value  The value of the sample.
+ */
+void metrics::sample(
+      std::ostream & out
+    , char const * name
+    , std::string const & labels
+    , std::uint64_t value)
+{
+    out << name;
+    if(!labels.empty())
+    {
+        out << '{' << labels << '}';
+    }
+    out << ' ' << value << '\n';
+}
+
+
+/** \brief Write one sample of a metric which can be negative.
+ *
+ * This is a separate function so the callers passing an int or a bool
+ * to sample() do not become ambiguous.
+ *
+ * \param[in,out] out  The output stream.
+ * \param[in] name  The name of the metric.
+ * \param[in] labels  The labels as generated by label(), separated by
+ * commas, or an empty string.
+ * \param[in] value  The value of the sample.
+ */
+void metrics::sample_signed(
+      std::ostream & out
+    , char const * name
+    , std::string const & labels
+    , std::int64_t value)
+{
+    out << name;
+    if(!labels.empty())
+    {
+        out << '{' << labels << '}';
+    }
+    out << ' ' << value << '\n';
+}
+
+
+/** \brief Generate a label with its value properly escaped.
+ *
+ * \param[in] name  The name of the label.
+ * \param[in] value  The value of the label.
+ *
+ * \return The label as `name="value"`.
+ */
+std::string metrics::label(char const * name, std::string const & value)
+{
+    std::string result(name);
+    result += "=\"";
+    for(auto const c : value)
+    {
+        switch(c)
+        {
+        case '\\':
+            result += "\\\\";
+            break;
+
+        case '"':
+            result += "\\\"";
+            break;
+
+        case '\n':
+            result += "\\n";
+            break;
+
+        default:
+            result += c;
+            break;
+
+        }
+    }
+    result += '"';
+    return result;
+}
+
+
+/** \brief Get the name of a route.
+ *
+ * \param[in] r  The route.
+ *
+ * \return The name used in the "route" label, or "none" for
+ * route_t::ROUTE_max.
+ */
+char const * metrics::route_name(route_t r)
+{
+    std::size_t const idx(static_cast<std::size_t>(r));
+    if(idx >= std::size(g_route_names))
+    {
+        return "none";
+    }
+    return g_route_names[idx];
+}
+
+
+metrics::command_counters & metrics::get_counters(std::string const & command)
+{
+    command_id_t const id(find_command(command));
+    if(id == COMMAND_ID_UNKNOWN)
+    {
+        if(f_unknown.f_command.empty())
+        {
+            f_unknown.f_command = "<unknown>";
+        }
+        return f_unknown;
+    }
+    if(id >= f_commands.size())
+    {
+        f_commands.resize(id + 1);
+    }
+    command_counters & c(f_commands[id]);
+    if(c.f_command.empty())
+    {
+        c.f_command = command;
+    }
+    return c;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
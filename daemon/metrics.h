@@ -0,0 +1,143 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the metrics counters.
+ *
+ * The Communicator counts the messages it receives per command and how
+ * each one was routed (handled by the daemon itself, forwarded,
+ * broadcast, cached, dropped or ignored as a duplicate broadcast). The
+ * counters are plain integers since the daemon runs a single event loop.
+ *
+ * The time spent dispatching each command and the time the output spends
+ * in the queue of a connection are saved in latency histograms.
+ *
+ * The metrics are returned in the Prometheus text format through the
+ * METRICS message and the metrics Unix socket.
+ */
+
+// self
+//
+#include    "command_ids.h"
+
+
+// C++
+//
+#include    <cstdint>
+#include    <ostream>
+#include    <string>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+enum class route_t
+{
+    ROUTE_HANDLED,          // message sent to the communicator daemon itself
+    ROUTE_FORWARDED,        // sent to a local service or a remote daemon
+    ROUTE_BROADCAST,
+    ROUTE_CACHED,
+    ROUTE_DROPPED,
+    ROUTE_DUPLICATE,        // broadcast already received or timed out
+    ROUTE_REJECTED,         // does not match its message definition
+    ROUTE_THROTTLED,        // went over its rate limit
+    ROUTE_SHED,             // broadcast not forwarded to the other daemons while overloaded
+
+    ROUTE_max
+};
+
+
+class latency_histogram
+{
+public:
+    static constexpr std::size_t const  BUCKETS = 25;   // 1us to 2^24us (~16.8s)
+
+    void                record(std::int64_t us);
+    std::uint64_t       get_count() const;
+    void                output(
+                              std::ostream & out
+                            , char const * name
+                            , std::string const & labels) const;
+
+private:
+    std::uint64_t       f_buckets[BUCKETS + 1] = {};    // last bucket is +Inf
+    std::uint64_t       f_count = 0;
+    std::uint64_t       f_sum = 0;                      // in microseconds
+};
+
+
+class metrics
+{
+public:
+    void                message_in(std::string const & command);
+    void                route(std::string const & command, route_t r);
+    void                start_decision();
+    route_t             get_decision() const;
+    void                invalid_message(std::string const & command);
+    void                dispatch_latency(std::string const & command, std::int64_t us);
+    void                output_latency(std::int64_t us);
+    void                transmission_report();
+    void                output(std::ostream & out) const;
+
+    static void         header(
+                              std::ostream & out
+                            , char const * name
+                            , char const * type
+                            , char const * help);
+    static void         sample(
+                              std::ostream & out
+                            , char const * name
+                            , std::string const & labels
+                            , std::uint64_t value);
+    static void         sample_signed(
+                              std::ostream & out
+                            , char const * name
+                            , std::string const & labels
+                            , std::int64_t value);
+    static std::string  label(char const * name, std::string const & value);
+    static char const * route_name(route_t r);
+
+private:
+    struct command_counters
+    {
+        std::string     f_command = std::string();
+        std::uint64_t   f_in = 0;
+        std::uint64_t   f_invalid = 0;
+        std::uint64_t   f_routes[static_cast<int>(route_t::ROUTE_max)] = {};
+        latency_histogram
+                        f_dispatch = latency_histogram();
+    };
+
+    command_counters &  get_counters(std::string const & command);
+
+    std::vector<command_counters>
+                        f_commands = std::vector<command_counters>();   // indexed by command_id_t
+    command_counters    f_unknown = command_counters();                 // commands without an identifier
+    std::uint64_t       f_transmission_reports = 0;
+    latency_histogram   f_output = latency_histogram();                 // time spent in the output queues
+    route_t             f_decision = route_t::ROUTE_max;                // first route since start_decision()
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
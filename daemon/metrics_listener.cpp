@@ -0,0 +1,120 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the metrics listener.
+ *
+ * Each client receives a minimal HTTP/1.0 response with the metrics in
+ * the Prometheus text format and the socket is then closed. The request
+ * itself is ignored so a plain `nc -U` works as well as a scraper
+ * using HTTP over a Unix socket.
+ */
+
+// self
+//
+#include    "metrics_listener.h"
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <cstring>
+
+
+// C
+//
+#include    <sys/socket.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize the metrics listener.
+ *
+ * \param[in] cs  The communicator server.
+ * \param[in] address  The path to the Unix socket.
+ * \param[in] max_connections  The maximum number of pending connections.
+ */
+metrics_listener::metrics_listener(
+          server::pointer_t cs
+        , addr::addr_unix const & address
+        , int max_connections)
+    : local_stream_server_connection(address, max_connections, true, true)
+    , f_server(cs)
+{
+}
+
+
+/** \brief Send the metrics to a new client.
+ *
+ * The metrics are small enough to fit in the socket buffer so they are
+ * written at once without blocking. If the client does not read them
+ * fast enough, the rest is lost and a warning is logged.
+ */
+void metrics_listener::process_accept()
+{
+    snapdev::raii_fd_t client(accept());
+    if(client == nullptr)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "somehow accept() failed with errno: "
+            << e
+            << " -- "
+            << strerror(e)
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    std::string const text(f_server->get_metrics());
+    std::string response(
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: ");
+    response += std::to_string(text.length());
+    response += "\r\n\r\n";
+    response += text;
+
+    ssize_t const r(send(client.get(), response.data(), response.length(), MSG_NOSIGNAL | MSG_DONTWAIT));
+    if(r != static_cast<ssize_t>(response.length()))
+    {
+        int const e(errno);
+        SNAP_LOG_WARNING
+            << "could not send the metrics to the client ("
+            << (r < 0 ? strerror(e) : "short write")
+            << ")."
+            << SNAP_LOG_SEND;
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
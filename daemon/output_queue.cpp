@@ -0,0 +1,404 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the output queue.
+ *
+ * The connections write their messages to the eventdispatcher buffer only
+ * while that buffer is empty. Otherwise the messages are kept in this
+ * queue and moved to the buffer in chunks each time it gets emptied. This
+ * way the queue knows exactly how much data is waiting for the service.
+ *
+ * Control messages use their own lane which is always emptied first, so
+ * a STOP reaches a service even when megabytes of bulk messages are
+ * waiting for it.
+ *
+ * The queue becomes congested when it reaches one of its high watermarks
+ * and stays so until it drains below both low watermarks. The hysteresis
+ * avoids sending a flow control message for each message written.
+ */
+
+// self
+//
+#include    "output_queue.h"
+
+#include    "command_ids.h"
+
+
+// communicatord
+//
+#include    <communicatord/names.h>
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/names.h>
+
+
+// C++
+//
+#include    <algorithm>
+#include    <chrono>
+#include    <initializer_list>
+#include    <vector>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+namespace
+{
+
+
+
+/** \brief The commands sent in the control lane.
+ *
+ * These commands manage the services and the cluster. They have to go
+ * through even when a service is slow at reading its bulk messages.
+ */
+char const * const g_control_commands[] =
+{
+    ed::g_name_ed_cmd_quitting,
+    ed::g_name_ed_cmd_stop,
+    communicatord::g_name_communicatord_cmd_clock_stable,
+    communicatord::g_name_communicatord_cmd_clock_status,
+    communicatord::g_name_communicatord_cmd_clock_unstable,
+    communicatord::g_name_communicatord_cmd_disconnect,
+    communicatord::g_name_communicatord_cmd_disconnecting,
+    communicatord::g_name_communicatord_cmd_flow_control,
+    communicatord::g_name_communicatord_cmd_hangup,
+    communicatord::g_name_communicatord_cmd_shutdown,
+    communicatord::g_name_communicatord_cmd_unregister,
+};
+
+
+bool is_control_command(ed::message const & msg)
+{
+    static std::vector<bool> g_control;
+    if(g_control.empty())
+    {
+        for(auto const * name : g_control_commands)
+        {
+            command_id_t const id(seed_command(name));
+            if(id >= g_control.size())
+            {
+                g_control.resize(id + 1);
+            }
+            g_control[id] = true;
+        }
+    }
+
+    command_id_t const id(find_command(msg.get_command()));
+    return id < g_control.size() && g_control[id];
+}
+
+
+
+} // no name namespace
+
+
+
+/** \brief Determine the priority of a message.
+ *
+ * A message can explicitly define its priority with the "priority"
+ * parameter set to "high" or "normal". Otherwise the control commands
+ * (STOP, QUITTING, UNREGISTER, DISCONNECT, CLOCK_..., etc.) are given a
+ * high priority and all the other messages a normal priority.
+ *
+ * The server only lets local services use "priority=high", see
+ * restrict_message_priority().
+ *
+ * \param[in] msg  The message to check.
+ *
+ * \return The priority of \p msg.
+ */
+message_priority_t get_message_priority(ed::message const & msg)
+{
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_priority))
+    {
+        std::string const priority(msg.get_parameter(communicatord::g_name_communicatord_param_priority));
+        if(priority == communicatord::g_name_communicatord_value_high)
+        {
+            return message_priority_t::MESSAGE_PRIORITY_HIGH;
+        }
+        if(priority == communicatord::g_name_communicatord_value_normal)
+        {
+            return message_priority_t::MESSAGE_PRIORITY_NORMAL;
+        }
+    }
+
+    return is_control_command(msg)
+                ? message_priority_t::MESSAGE_PRIORITY_HIGH
+                : message_priority_t::MESSAGE_PRIORITY_NORMAL;
+}
+
+
+/** \brief Ignore the "priority=high" of a message sent by an untrusted peer.
+ *
+ * The control lane bypasses the congestion checks and the link batching
+ * so any sender using "priority=high" on bulk messages could starve the
+ * real control messages. The server calls this function with the
+ * messages received from other communicator daemons and UDP clients.
+ *
+ * A "priority=high" parameter is replaced by "priority=normal" unless
+ * the command is a control command. A "priority=normal" can only lower
+ * the priority so it is kept as is.
+ *
+ * \param[in,out] msg  The message received from an untrusted peer.
+ *
+ * \return true if the priority parameter was changed.
+ */
+bool restrict_message_priority(ed::message & msg)
+{
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_priority)
+    || msg.get_parameter(communicatord::g_name_communicatord_param_priority) != communicatord::g_name_communicatord_value_high
+    || is_control_command(msg))
+    {
+        return false;
+    }
+
+    msg.add_parameter(
+              communicatord::g_name_communicatord_param_priority
+            , communicatord::g_name_communicatord_value_normal);
+    return true;
+}
+
+
+/** \brief Convert the name of a slow consumer policy.
+ *
+ * The policy is named "drop" or "disconnect". Any other name is an
+ * error and \p policy is set to SLOW_CONSUMER_POLICY_DROP.
+ *
+ * \param[in] name  The name of the policy.
+ * \param[out] policy  The corresponding policy.
+ *
+ * \return true if \p name is a valid policy name.
+ */
+bool parse_slow_consumer_policy(std::string const & name, slow_consumer_policy_t & policy)
+{
+    if(name == communicatord::g_name_communicatord_value_disconnect)
+    {
+        policy = slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DISCONNECT;
+        return true;
+    }
+    policy = slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DROP;
+    return name == communicatord::g_name_communicatord_value_drop;
+}
+
+
+/** \brief Define the watermarks of the queue.
+ *
+ * The queue is viewed as congested once it holds \p high_bytes or
+ * \p high_messages. It is not congested anymore once it holds at most
+ * \p low_bytes and \p low_messages.
+ *
+ * A high watermark of zero is viewed as "no limit". A low watermark
+ * larger than its high watermark is clamped to the high watermark.
+ *
+ * \param[in] high_bytes  The number of bytes making the queue congested.
+ * \param[in] high_messages  The number of messages making the queue congested.
+ * \param[in] low_bytes  The number of bytes under which it recovers.
+ * \param[in] low_messages  The number of messages under which it recovers.
+ */
+void output_queue::set_limits(
+      std::size_t high_bytes
+    , std::size_t high_messages
+    , std::size_t low_bytes
+    , std::size_t low_messages)
+{
+    f_high_bytes = high_bytes;
+    f_high_messages = high_messages;
+    f_low_bytes = high_bytes == 0 ? low_bytes : std::min(low_bytes, high_bytes);
+    f_low_messages = high_messages == 0 ? low_messages : std::min(low_messages, high_messages);
+}
+
+
+/** \brief Add data at the end of one of the lanes of the queue.
+ *
+ * Each call is expected to add one complete message.
+ *
+ * \param[in] data  The data to add.
+ * \param[in] length  The number of bytes in \p data.
+ * \param[in] priority  The priority of the message, which selects the lane.
+ */
+void output_queue::push(void const * data, std::size_t length, message_priority_t priority)
+{
+    lane_t & lane(priority == message_priority_t::MESSAGE_PRIORITY_HIGH ? f_control : f_bulk);
+    lane.push_back({
+              std::string(reinterpret_cast<char const *>(data), length)
+            , std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count() });
+    f_bytes += length;
+}
+
+
+/** \brief Remove data from the front of the queue.
+ *
+ * This function concatenates the control messages and then the bulk
+ * messages from the front of the queue up to \p max_bytes. At least one
+ * message is returned when the queue is not empty, even if larger than
+ * \p max_bytes.
+ *
+ * When \p queued_on is not nullptr, it is set to the time when the oldest
+ * of the returned messages was pushed (steady clock, in microseconds).
+ * It is left untouched if the queue is empty.
+ *
+ * \param[in] max_bytes  The maximum number of bytes to return.
+ * \param[out] queued_on  The time when the oldest message was queued.
+ *
+ * \return The data removed from the queue.
+ */
+std::string output_queue::pop(std::size_t max_bytes, std::int64_t * queued_on)
+{
+    std::string result;
+    for(auto * lane : { &f_control, &f_bulk })
+    {
+        while(!lane->empty()
+           && (result.empty()
+               || result.length() + lane->front().f_data.length() <= max_bytes))
+        {
+            if(queued_on != nullptr
+            && (result.empty() || lane->front().f_queued_on < *queued_on))
+            {
+                *queued_on = lane->front().f_queued_on;
+            }
+            if(result.empty())
+            {
+                result.swap(lane->front().f_data);
+            }
+            else
+            {
+                result += lane->front().f_data;
+            }
+            lane->pop_front();
+        }
+    }
+    f_bytes -= result.length();
+    return result;
+}
+
+
+/** \brief Check whether the queue is empty.
+ *
+ * \return true if no message is waiting in the queue.
+ */
+bool output_queue::empty() const
+{
+    return f_control.empty() && f_bulk.empty();
+}
+
+
+/** \brief Retrieve the number of bytes waiting in the queue.
+ *
+ * \return The total size of the queued messages.
+ */
+std::size_t output_queue::get_bytes() const
+{
+    return f_bytes;
+}
+
+
+/** \brief Retrieve the number of messages waiting in the queue.
+ *
+ * \return The number of queued messages.
+ */
+std::size_t output_queue::get_messages() const
+{
+    return f_control.size() + f_bulk.size();
+}
+
+
+/** \brief Compute the congestion state of the queue.
+ *
+ * The \p extra_bytes and \p extra_messages are messages waiting somewhere
+ * else for the same service, such as a shared memory channel.
+ *
+ * \param[in] extra_bytes  Bytes to add to the ones of the queue.
+ * \param[in] extra_messages  Messages to add to the ones of the queue.
+ *
+ * \return true if the congestion state changed.
+ */
+bool output_queue::update_congestion(
+      std::size_t extra_bytes
+    , std::size_t extra_messages)
+{
+    std::size_t const bytes(f_bytes + extra_bytes);
+    std::size_t const messages(get_messages() + extra_messages);
+    bool congested(f_congested);
+    if(f_congested)
+    {
+        congested = (f_high_bytes != 0 && bytes > f_low_bytes)
+                 || (f_high_messages != 0 && messages > f_low_messages);
+    }
+    else
+    {
+        congested = (f_high_bytes != 0 && bytes >= f_high_bytes)
+                 || (f_high_messages != 0 && messages >= f_high_messages);
+    }
+    if(congested == f_congested)
+    {
+        return false;
+    }
+    f_congested = congested;
+    return true;
+}
+
+
+/** \brief Check whether the queue reached its high watermark.
+ *
+ * This flag is updated by update_congestion().
+ *
+ * \return true if the queue is congested.
+ */
+bool output_queue::is_congested() const
+{
+    return f_congested;
+}
+
+
+/** \brief Count one more message dropped because of the congestion.
+ *
+ * \return The number of messages dropped so far.
+ */
+std::size_t output_queue::add_dropped()
+{
+    ++f_dropped;
+    return f_dropped;
+}
+
+
+/** \brief Retrieve the number of messages dropped so far.
+ *
+ * \return The number of messages dropped because the queue was congested.
+ */
+std::size_t output_queue::get_dropped() const
+{
+    return f_dropped;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
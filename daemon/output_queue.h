@@ -0,0 +1,123 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the output queue of a connection.
+ *
+ * The eventdispatcher connections buffer their output without any limit.
+ * A service which stops reading its socket would let that buffer grow
+ * until the daemon runs out of memory. The output queue sits in front of
+ * that buffer so the daemon knows how many bytes and messages are waiting
+ * for each connection and can react once a limit is reached.
+ *
+ * The queue has two lanes. Control messages (STOP, UNREGISTER, CLOCK_...)
+ * go in the first lane and get sent before the bulk messages already
+ * waiting in the second lane.
+ */
+
+// eventdispatcher
+//
+#include    <eventdispatcher/message.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <deque>
+#include    <string>
+
+
+
+namespace communicator_daemon
+{
+
+
+enum class slow_consumer_policy_t
+{
+    SLOW_CONSUMER_POLICY_DROP,          // drop new messages until the queue drains
+    SLOW_CONSUMER_POLICY_DISCONNECT,    // disconnect the service
+};
+
+
+enum class message_priority_t
+{
+    MESSAGE_PRIORITY_NORMAL,            // bulk traffic
+    MESSAGE_PRIORITY_HIGH,              // control messages, sent first
+};
+
+
+bool                    parse_slow_consumer_policy(std::string const & name, slow_consumer_policy_t & policy);
+message_priority_t      get_message_priority(ed::message const & msg);
+bool                    restrict_message_priority(ed::message & msg);
+
+
+class output_queue
+{
+public:
+    static std::size_t const    DEFAULT_HIGH_BYTES = 4 * 1024 * 1024;
+    static std::size_t const    DEFAULT_HIGH_MESSAGES = 10'000;
+    static std::size_t const    DEFAULT_LOW_BYTES = 1024 * 1024;
+    static std::size_t const    DEFAULT_LOW_MESSAGES = 2'500;
+    static std::size_t const    WRITE_CHUNK_SIZE = 64 * 1024;
+
+    void                set_limits(
+                              std::size_t high_bytes
+                            , std::size_t high_messages
+                            , std::size_t low_bytes
+                            , std::size_t low_messages);
+    void                push(
+                              void const * data
+                            , std::size_t length
+                            , message_priority_t priority = message_priority_t::MESSAGE_PRIORITY_NORMAL);
+    std::string         pop(
+                              std::size_t max_bytes = WRITE_CHUNK_SIZE
+                            , std::int64_t * queued_on = nullptr);
+    bool                empty() const;
+    std::size_t         get_bytes() const;
+    std::size_t         get_messages() const;
+    bool                update_congestion(
+                              std::size_t extra_bytes = 0
+                            , std::size_t extra_messages = 0);
+    bool                is_congested() const;
+    std::size_t         add_dropped();
+    std::size_t         get_dropped() const;
+
+private:
+    struct entry
+    {
+        std::string     f_data = std::string();
+        std::int64_t    f_queued_on = 0;            // steady clock, in microseconds
+    };
+    typedef std::deque<entry>   lane_t;
+
+    lane_t              f_control = lane_t();
+    lane_t              f_bulk = lane_t();
+    std::size_t         f_bytes = 0;
+    std::size_t         f_high_bytes = 0;
+    std::size_t         f_high_messages = 0;
+    std::size_t         f_low_bytes = 0;
+    std::size_t         f_low_messages = 0;
+    std::size_t         f_dropped = 0;
+    bool                f_congested = false;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,145 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the overlay peer selection.
+ *
+ * The selection sorts all the known communicator daemons on a ring
+ * (the addr::addr order) and keeps the ones closest to us on each side.
+ * Since this relationship is symmetric, two daemons agree on the fact
+ * that they are neighbors and the ring remains connected as long as
+ * each daemon keeps at least one peer on each side.
+ *
+ * The long links are selected among the remaining daemons using a
+ * pseudo-random generator seeded with our own address. This makes the
+ * selection stable between restarts while different daemons pick
+ * different long links, which is what gives the graph its expander
+ * like properties.
+ */
+
+// self
+//
+#include    "overlay.h"
+
+
+// C++
+//
+#include    <algorithm>
+#include    <functional>
+#include    <random>
+#include    <vector>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Select the peers this communicator daemon connects with.
+ *
+ * This function returns the subset of \p candidates which this daemon
+ * keeps as active peers in overlay mode.
+ *
+ * The first \p near_peers peers are the closest to \p self on the
+ * ring, alternating between the next larger and the next smaller
+ * address. Then \p long_links additional peers are randomly selected
+ * among the remaining candidates.
+ *
+ * If the number of candidates is smaller or equal to the number of
+ * requested peers, all the candidates are returned (i.e. small clusters
+ * remain a full mesh).
+ *
+ * \param[in] candidates  All the known communicator daemons.
+ * \param[in] self  The address of this communicator daemon.
+ * \param[in] near_peers  The number of ring neighbors to keep.
+ * \param[in] long_links  The number of random peers to add.
+ *
+ * \return The set of active peers.
+ */
+addr::addr::set_t select_overlay_peers(
+      addr::addr::set_t const & candidates
+    , addr::addr const & self
+    , std::size_t near_peers
+    , std::size_t long_links)
+{
+    std::vector<addr::addr> ring;
+    ring.reserve(candidates.size());
+    for(auto const & c : candidates)
+    {
+        if(c != self)
+        {
+            ring.push_back(c);
+        }
+    }
+
+    if(ring.size() <= near_peers + long_links)
+    {
+        return addr::addr::set_t(ring.begin(), ring.end());
+    }
+
+    // position of "self" on the ring; the candidates are sorted so the
+    // vector is too
+    //
+    std::size_t const max(ring.size());
+    std::size_t const pos(std::lower_bound(ring.begin(), ring.end(), self) - ring.begin());
+
+    addr::addr::set_t result;
+    std::vector<bool> used(max, false);
+    for(std::size_t i(0); i < near_peers; ++i)
+    {
+        std::size_t const distance(i / 2);
+        std::size_t const idx((i & 1) == 0
+                        ? (pos + distance) % max
+                        : (pos + max - 1 - distance) % max);
+        used[idx] = true;
+        result.insert(ring[idx]);
+    }
+
+    std::vector<std::size_t> cold;
+    for(std::size_t idx(0); idx < max; ++idx)
+    {
+        if(!used[idx])
+        {
+            cold.push_back(idx);
+        }
+    }
+
+    std::mt19937_64 generator(std::hash<std::string>()(self.to_ipv4or6_string(
+                                  addr::STRING_IP_BRACKET_ADDRESS
+                                | addr::STRING_IP_PORT)));
+    for(std::size_t i(0); i < long_links && !cold.empty(); ++i)
+    {
+        std::size_t const r(generator() % cold.size());
+        result.insert(ring[cold[r]]);
+        cold[r] = cold.back();
+        cold.pop_back();
+    }
+
+    return result;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
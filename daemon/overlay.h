@@ -0,0 +1,54 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the overlay peer selection.
+ *
+ * By default, the communicator daemons create a full mesh: each daemon
+ * connects to all the others. With large clusters, this means each
+ * daemon handles N - 1 connections and a broadcast is sent N - 1 times
+ * by its originator.
+ *
+ * The overlay mode limits the number of active peers. Each daemon
+ * connects to its nearest neighbors on a ring sorted by address and
+ * to a few random peers (long links) so the resulting graph has a small
+ * diameter. The other neighbors remain known but are not connected.
+ */
+
+// libaddr
+//
+#include    <libaddr/addr.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+addr::addr::set_t           select_overlay_peers(
+                                  addr::addr::set_t const & candidates
+                                , addr::addr const & self
+                                , std::size_t near_peers
+                                , std::size_t long_links);
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,225 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the overload monitor.
+ *
+ * The monitor gets one sample at a regular interval. The lag is how
+ * late the timer giving that sample fired and the queue depth is the
+ * number of messages waiting in the output queues of all the
+ * connections.
+ *
+ * One sample over either limit is enough to start shedding. To avoid
+ * switching back and forth, shedding only stops once both values went
+ * under half of their limit for a few samples in a row.
+ */
+
+// self
+//
+#include    "overload_monitor.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Set the limits defining an overload.
+ *
+ * \param[in] max_lag  The maximum lag of the event loop in microseconds,
+ * 0 to ignore the lag.
+ * \param[in] max_queue_depth  The maximum number of messages waiting to
+ * be sent, 0 to ignore the queues.
+ */
+void overload_monitor::set_limits(std::int64_t max_lag, std::size_t max_queue_depth)
+{
+    f_max_lag = max_lag < 0 ? 0 : max_lag;
+    f_max_queue_depth = max_queue_depth;
+}
+
+
+/** \brief Get the maximum lag of the event loop.
+ *
+ * \return The maximum lag in microseconds, 0 if the lag is ignored.
+ */
+std::int64_t overload_monitor::get_max_lag() const
+{
+    return f_max_lag;
+}
+
+
+/** \brief Get the maximum number of messages waiting to be sent.
+ *
+ * \return The maximum queue depth, 0 if the queues are ignored.
+ */
+std::size_t overload_monitor::get_max_queue_depth() const
+{
+    return f_max_queue_depth;
+}
+
+
+/** \brief Check whether the monitor can detect an overload.
+ *
+ * \return true if at least one of the limits is defined.
+ */
+bool overload_monitor::is_enabled() const
+{
+    return f_max_lag != 0 || f_max_queue_depth != 0;
+}
+
+
+/** \brief Add a sample.
+ *
+ * \param[in] lag  How late the sampling timer fired, in microseconds.
+ * \param[in] queue_depth  The number of messages waiting to be sent.
+ *
+ * \return true if the shedding mode changed with this sample.
+ */
+bool overload_monitor::sample(std::int64_t lag, std::size_t queue_depth)
+{
+    f_lag = lag < 0 ? 0 : lag;
+    f_queue_depth = queue_depth;
+
+    if(!f_shedding)
+    {
+        if(is_over(f_lag, f_queue_depth))
+        {
+            f_shedding = true;
+            f_calm_samples = 0;
+            ++f_shedding_count;
+            return true;
+        }
+        return false;
+    }
+
+    if(!is_calm(f_lag, f_queue_depth))
+    {
+        f_calm_samples = 0;
+        return false;
+    }
+
+    ++f_calm_samples;
+    if(f_calm_samples < DEFAULT_RECOVERY_SAMPLES)
+    {
+        return false;
+    }
+
+    f_shedding = false;
+    return true;
+}
+
+
+/** \brief Check whether the daemon is overloaded.
+ *
+ * \return true while the work which can wait has to be shed.
+ */
+bool overload_monitor::is_shedding() const
+{
+    return f_shedding;
+}
+
+
+/** \brief Check whether a message should not be forwarded.
+ *
+ * While overloaded, the broadcasts are not forwarded to the other
+ * communicators unless they are critical. A message sent to a specific
+ * service on a remote communicator is always forwarded since nothing
+ * else would deliver it.
+ *
+ * \param[in] broadcast  Whether the message is a broadcast ("*", "?" or ".").
+ * \param[in] critical  Whether the message is a high priority or reliable
+ * message.
+ *
+ * \return true if the message should not be sent to the other
+ * communicators.
+ */
+bool overload_monitor::shed_forward(bool broadcast, bool critical) const
+{
+    return f_shedding
+        && broadcast
+        && !critical;
+}
+
+
+/** \brief Get the lag of the last sample.
+ *
+ * \return The lag in microseconds.
+ */
+std::int64_t overload_monitor::get_lag() const
+{
+    return f_lag;
+}
+
+
+/** \brief Get the queue depth of the last sample.
+ *
+ * \return The number of messages which were waiting to be sent.
+ */
+std::size_t overload_monitor::get_queue_depth() const
+{
+    return f_queue_depth;
+}
+
+
+/** \brief Get the number of times shedding started.
+ *
+ * \return The number of overloads detected so far.
+ */
+std::uint64_t overload_monitor::get_shedding_count() const
+{
+    return f_shedding_count;
+}
+
+
+/** \brief Check whether a sample is over one of the limits.
+ *
+ * \param[in] lag  The lag in microseconds.
+ * \param[in] queue_depth  The number of messages waiting to be sent.
+ *
+ * \return true if the sample represents an overload.
+ */
+bool overload_monitor::is_over(std::int64_t lag, std::size_t queue_depth) const
+{
+    return (f_max_lag != 0 && lag > f_max_lag)
+        || (f_max_queue_depth != 0 && queue_depth > f_max_queue_depth);
+}
+
+
+/** \brief Check whether a sample is well under the limits.
+ *
+ * \param[in] lag  The lag in microseconds.
+ * \param[in] queue_depth  The number of messages waiting to be sent.
+ *
+ * \return true if both values are at most half of their limit.
+ */
+bool overload_monitor::is_calm(std::int64_t lag, std::size_t queue_depth) const
+{
+    return (f_max_lag == 0 || lag <= f_max_lag / 2)
+        && (f_max_queue_depth == 0 || queue_depth <= f_max_queue_depth / 2);
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
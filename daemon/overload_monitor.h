@@ -0,0 +1,76 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the overload monitor.
+ *
+ * When the daemon receives more work than it can process, the event
+ * loop falls behind (timers fire late) and the output queues grow.
+ * The overload monitor watches both and decides when the daemon should
+ * shed the work which can wait, such as new remote CONNECTs and the
+ * non-critical broadcasts, so the local services keep getting their
+ * messages.
+ */
+
+// C++
+//
+#include    <cstdint>
+#include    <cstddef>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class overload_monitor
+{
+public:
+    static constexpr std::size_t const  DEFAULT_RECOVERY_SAMPLES = 3;
+
+    void                set_limits(std::int64_t max_lag, std::size_t max_queue_depth);
+    std::int64_t        get_max_lag() const;
+    std::size_t         get_max_queue_depth() const;
+    bool                is_enabled() const;
+
+    bool                sample(std::int64_t lag, std::size_t queue_depth);
+    bool                is_shedding() const;
+    bool                shed_forward(bool broadcast, bool critical) const;
+    std::int64_t        get_lag() const;
+    std::size_t         get_queue_depth() const;
+    std::uint64_t       get_shedding_count() const;
+
+private:
+    bool                is_over(std::int64_t lag, std::size_t queue_depth) const;
+    bool                is_calm(std::int64_t lag, std::size_t queue_depth) const;
+
+    std::int64_t        f_max_lag = 0;              // microseconds, 0 for no limit
+    std::size_t         f_max_queue_depth = 0;      // messages, 0 for no limit
+    std::int64_t        f_lag = 0;
+    std::size_t         f_queue_depth = 0;
+    bool                f_shedding = false;
+    std::size_t         f_calm_samples = 0;
+    std::uint64_t       f_shedding_count = 0;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
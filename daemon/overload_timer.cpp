@@ -0,0 +1,78 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of overload_timer object.
+ *
+ * We use a timer to measure how late the event loop processes its
+ * events. A timer which fires much later than expected means the loop
+ * spends too much time handling the other connections.
+ */
+
+// self
+//
+#include    "overload_timer.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \class overload_timer
+ * \brief Sample the load of the event loop.
+ *
+ * This class is an implementation of a timer ticking at a short
+ * interval. Each tick, the server compares the time elapsed since the
+ * previous tick with the interval and gives the difference and the
+ * depth of the output queues to its overload monitor.
+ */
+
+
+/** \brief The timer initialization.
+ *
+ * The timer ticks every OVERLOAD_SAMPLE_INTERVAL microseconds.
+ *
+ * \param[in] cs  The communicatord server we are listening for.
+ */
+overload_timer::overload_timer(server::pointer_t cs)
+    : timer(OVERLOAD_SAMPLE_INTERVAL)
+    , f_server(cs)
+{
+}
+
+
+void overload_timer::process_timeout()
+{
+    f_server->process_overload_sample();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
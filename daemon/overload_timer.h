@@ -0,0 +1,61 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Definition of the overload_timer class.
+ *
+ * The overload monitor needs regular samples of the event loop lag and
+ * of the output queue depth. This timer provides those samples.
+ */
+
+// self
+//
+#include    "server.h"
+
+
+// eventdispatcher
+//
+#include    "eventdispatcher/timer.h"
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class overload_timer
+    : public ed::timer
+{
+public:
+    static constexpr std::int64_t const     OVERLOAD_SAMPLE_INTERVAL = 100'000LL;  // 100ms in microseconds
+
+                        overload_timer(server::pointer_t cs);
+
+    // ed::timer implementation
+    virtual void        process_timeout() override;
+
+private:
+    server::pointer_t   f_server = server::pointer_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
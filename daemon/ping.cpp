@@ -19,6 +19,9 @@
 /** \file
  * \brief Implementation of the ping connection.
  *
+ * The ping connection drains its UDP socket in batches with recvmmsg()
+ * instead of reading one datagram per wake up. This avoids losing
+ * signals when bursts fill the socket buffer.
  */
 
 // self
@@ -26,6 +29,27 @@
 #include    "ping.h"
 
 
+// communicatord
+//
+#include    <communicatord/names.h>
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <cerrno>
+#include    <cstring>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
 
 namespace communicator_daemon
 {
@@ -57,6 +81,12 @@ ping::ping(server::pointer_t cs, addr::addr const & address)
     : udp_server_message_connection(address)
     , base_connection(cs, true)
 {
+    if(!datagram_batch::enable_drop_counter(get_socket()))
+    {
+        SNAP_LOG_WARNING
+            << "could not turn on the drop counter of the UDP signal socket."
+            << SNAP_LOG_SEND;
+    }
 }
 
 
@@ -66,6 +96,189 @@ int ping::get_socket() const
 }
 
 
+/** \brief Change the size of the socket receive buffer.
+ *
+ * \param[in] size  The new size in bytes, 0 to keep the system default.
+ */
+void ping::set_receive_buffer_size(int size)
+{
+    if(size <= 0)
+    {
+        return;
+    }
+
+    if(!datagram_batch::set_receive_buffer_size(get_socket(), size))
+    {
+        int const e(errno);
+        SNAP_LOG_WARNING
+            << "could not set the receive buffer of the UDP signal socket to "
+            << size
+            << " bytes (errno: "
+            << e
+            << ", "
+            << strerror(e)
+            << ")."
+            << SNAP_LOG_SEND;
+    }
+}
+
+
+/** \brief Retrieve the number of datagrams received.
+ *
+ * \return The number of datagrams read from the socket so far.
+ */
+std::uint64_t ping::get_received() const
+{
+    return f_batch.get_received();
+}
+
+
+/** \brief Retrieve the number of datagrams dropped by the kernel.
+ *
+ * \return The number of datagrams lost because the socket buffer was full.
+ */
+std::uint64_t ping::get_dropped() const
+{
+    return f_batch.get_dropped();
+}
+
+
+/** \brief Retrieve the number of truncated datagrams.
+ *
+ * \return The number of datagrams ignored because they were too large.
+ */
+std::uint64_t ping::get_truncated() const
+{
+    return f_batch.get_truncated();
+}
+
+
+/** \brief Read all the datagrams waiting in the socket.
+ *
+ * This function reads the datagrams in batches and dispatches each
+ * batch before reading the next one. To not starve the other
+ * connections, it stops after MAX_BATCHES_PER_READ batches; the poll()
+ * wakes us up again if more datagrams are waiting.
+ */
+void ping::process_read()
+{
+    for(std::size_t count(0); count < MAX_BATCHES_PER_READ; ++count)
+    {
+        int const r(f_batch.receive(get_socket()));
+        if(r < 0)
+        {
+            int const e(errno);
+            SNAP_LOG_ERROR
+                << "recvmmsg() failed on the UDP signal socket (errno: "
+                << e
+                << ", "
+                << strerror(e)
+                << ")."
+                << SNAP_LOG_SEND;
+            break;
+        }
+
+        for(std::size_t idx(0); idx < f_batch.size(); ++idx)
+        {
+            if(!f_batch.is_truncated(idx))
+            {
+                process_datagram(f_batch.get_datagram(idx));
+            }
+        }
+
+        if(static_cast<std::size_t>(r) < f_batch.get_batch_size())
+        {
+            break;
+        }
+    }
+
+    report_losses();
+}
+
+
+/** \brief Convert one datagram to a message and dispatch it.
+ *
+ * The secret code is verified the same way the eventdispatcher UDP
+ * connections do it.
+ *
+ * \param[in] datagram  The datagram as received.
+ */
+void ping::process_datagram(std::string const & datagram)
+{
+    ed::message msg;
+    if(!msg.from_message(datagram))
+    {
+        SNAP_LOG_ERROR
+            << "invalid message received on the UDP signal socket."
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    std::string const expected(get_secret_code());
+    if(!expected.empty())
+    {
+        if(!msg.has_parameter(communicatord::g_name_communicatord_param_udp_secret))
+        {
+            SNAP_LOG_ERROR
+                << "the incoming message was expected to have a \""
+                << communicatord::g_name_communicatord_param_udp_secret
+                << "\" code."
+                << SNAP_LOG_SEND;
+            return;
+        }
+        if(msg.get_parameter(communicatord::g_name_communicatord_param_udp_secret) != expected)
+        {
+            SNAP_LOG_ERROR
+                << "the incoming message has an unexpected \""
+                << communicatord::g_name_communicatord_param_udp_secret
+                << "\" code."
+                << SNAP_LOG_SEND;
+            return;
+        }
+    }
+
+    process_message(msg);
+}
+
+
+/** \brief Log the datagrams lost since the last report.
+ *
+ * The report is sent at most once per second.
+ */
+void ping::report_losses()
+{
+    if(f_batch.get_dropped() == f_reported_dropped
+    && f_batch.get_truncated() == f_reported_truncated)
+    {
+        return;
+    }
+
+    time_t const now(time(nullptr));
+    if(now == f_reported_on)
+    {
+        return;
+    }
+    f_reported_on = now;
+
+    SNAP_LOG_WARNING
+        << "UDP signal socket lost "
+        << f_batch.get_dropped() - f_reported_dropped
+        << " datagram(s) because its buffer was full and ignored "
+        << f_batch.get_truncated() - f_reported_truncated
+        << " truncated datagram(s) (totals: "
+        << f_batch.get_received()
+        << " received, "
+        << f_batch.get_dropped()
+        << " dropped, "
+        << f_batch.get_truncated()
+        << " truncated)."
+        << SNAP_LOG_SEND;
+
+    f_reported_dropped = f_batch.get_dropped();
+    f_reported_truncated = f_batch.get_truncated();
+}
+
+
 void ping::process_message(ed::message & msg)
 {
     //f_server->process_message(shared_from_this(), msg, true);
@@ -30,6 +30,7 @@
 // self
 //
 #include    "base_connection.h"
+#include    "datagram_batch.h"
 
 
 // eventdispatcher
@@ -54,10 +55,26 @@ public:
                               server::pointer_t cs
                             , addr::addr const & address);
 
+    static std::size_t const    MAX_BATCHES_PER_READ = 4;
+
     virtual int         get_socket() const;
+    void                set_receive_buffer_size(int size);
+    std::uint64_t       get_received() const;
+    std::uint64_t       get_dropped() const;
+    std::uint64_t       get_truncated() const;
 
     // ed::udp_server_message_connection implementation
+    virtual void        process_read() override;
     virtual void        process_message(ed::message & msg) override;
+
+private:
+    void                process_datagram(std::string const & datagram);
+    void                report_losses();
+
+    datagram_batch      f_batch = datagram_batch();
+    std::uint64_t       f_reported_dropped = 0;
+    std::uint64_t       f_reported_truncated = 0;
+    time_t              f_reported_on = 0;
 };
 
 
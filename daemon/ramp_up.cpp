@@ -0,0 +1,215 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the connection ramp-up.
+ *
+ * The ramp-up keeps track of the connection attempts in progress. When
+ * the concurrency limit is reached, further attempts are queued and
+ * started one by one as the previous attempts succeed or fail.
+ *
+ * The retry delays grow exponentially from FIRST_RETRY to MAX_RETRY.
+ * Each delay is picked randomly between half and the full value so
+ * daemons restarted at the same time do not retry in lockstep.
+ */
+
+// self
+//
+#include    "ramp_up.h"
+
+
+// C++
+//
+#include    <algorithm>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize the ramp-up.
+ *
+ * The ramp-up is inactive until start() gets called.
+ */
+ramp_up::ramp_up()
+    : f_generator(std::random_device()())
+{
+}
+
+
+/** \brief Start the ramp-up phase.
+ *
+ * This function starts the ramp-up phase which lasts \p duration
+ * microseconds from \p now.
+ *
+ * \param[in] now  The current time in microseconds.
+ * \param[in] concurrency  The maximum number of attempts in parallel,
+ * 0 for no limit.
+ * \param[in] duration  The duration of the phase in microseconds, 0 to
+ * disable the ramp-up.
+ */
+void ramp_up::start(
+      std::int64_t now
+    , std::size_t concurrency
+    , std::int64_t duration)
+{
+    f_concurrency = concurrency;
+    f_end_date = duration <= 0 ? 0 : now + duration;
+}
+
+
+/** \brief Check whether the ramp-up phase is still going.
+ *
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return true if \p now is before the end of the ramp-up phase.
+ */
+bool ramp_up::is_active(std::int64_t now) const
+{
+    return now < f_end_date;
+}
+
+
+/** \brief Request a slot to start a connection attempt.
+ *
+ * If the number of attempts in progress is under the concurrency
+ * limit, the attempt can start immediately. Otherwise the address
+ * gets queued and release() returns it once a slot frees up.
+ *
+ * \param[in] address  The address of the remote communicator.
+ *
+ * \return true if the attempt can start now.
+ */
+bool ramp_up::acquire(addr::addr const & address)
+{
+    if(f_in_flight.contains(address))
+    {
+        return true;
+    }
+    if(f_concurrency == 0
+    || f_in_flight.size() < f_concurrency)
+    {
+        f_in_flight.insert(address);
+        return true;
+    }
+    if(std::find(f_queue.begin(), f_queue.end(), address) == f_queue.end())
+    {
+        f_queue.push_back(address);
+    }
+    return false;
+}
+
+
+/** \brief Release the slot of a connection attempt.
+ *
+ * This function is called once an attempt succeeded, failed or got
+ * canceled. If another address is waiting for a slot, it is saved in
+ * \p next and it receives the slot.
+ *
+ * \param[in] address  The address of the remote communicator.
+ * \param[out] next  The next address to start, if any.
+ *
+ * \return true if \p next was set.
+ */
+bool ramp_up::release(addr::addr const & address, addr::addr & next)
+{
+    auto const it(std::find(f_queue.begin(), f_queue.end(), address));
+    if(it != f_queue.end())
+    {
+        f_queue.erase(it);
+    }
+
+    if(f_in_flight.erase(address) == 0
+    || f_queue.empty())
+    {
+        return false;
+    }
+
+    next = f_queue.front();
+    f_queue.pop_front();
+    f_in_flight.insert(next);
+    return true;
+}
+
+
+/** \brief Compute the delay before the next attempt.
+ *
+ * Each call increases the number of attempts made with \p address so
+ * the delay doubles each time, up to MAX_RETRY.
+ *
+ * \param[in] address  The address of the remote communicator.
+ *
+ * \return The delay in microseconds.
+ */
+std::int64_t ramp_up::retry_delay(addr::addr const & address)
+{
+    int & attempts(f_attempts[address]);
+    std::int64_t delay(FIRST_RETRY << std::min(attempts, 4));
+    if(delay > MAX_RETRY)
+    {
+        delay = MAX_RETRY;
+    }
+    ++attempts;
+
+    std::uniform_int_distribution<std::int64_t> jitter(delay / 2, delay);
+    return jitter(f_generator);
+}
+
+
+/** \brief Forget about the retries of a remote communicator.
+ *
+ * \param[in] address  The address of the remote communicator.
+ *
+ * \return true if retry_delay() was used with that \p address.
+ */
+bool ramp_up::forget(addr::addr const & address)
+{
+    return f_attempts.erase(address) != 0;
+}
+
+
+/** \brief Get the number of attempts in progress.
+ *
+ * \return The number of slots currently in use.
+ */
+std::size_t ramp_up::in_flight() const
+{
+    return f_in_flight.size();
+}
+
+
+/** \brief Get the number of attempts waiting for a slot.
+ *
+ * \return The number of queued addresses.
+ */
+std::size_t ramp_up::queued() const
+{
+    return f_queue.size();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
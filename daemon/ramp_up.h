@@ -0,0 +1,81 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the connection ramp-up.
+ *
+ * On a cold start, the communicator daemon has to connect to all of its
+ * neighbors. The ramp-up is a startup phase during which connection
+ * attempts start in parallel, up to a concurrency limit, and failed
+ * attempts get retried after a short jittered delay. Once the phase is
+ * over, the connections fall back to their usual backoff.
+ */
+
+// libaddr
+//
+#include    <libaddr/addr.h>
+
+
+// C++
+//
+#include    <deque>
+#include    <map>
+#include    <random>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+class ramp_up
+{
+public:
+    static std::size_t const    DEFAULT_CONCURRENCY = 16;
+    static std::int64_t const   FIRST_RETRY = 1LL * 1'000'000LL;        // 1 second
+    static std::int64_t const   MAX_RETRY = 15LL * 1'000'000LL;         // 15 seconds
+
+                                ramp_up();
+
+    void                        start(
+                                      std::int64_t now
+                                    , std::size_t concurrency
+                                    , std::int64_t duration);
+    bool                        is_active(std::int64_t now) const;
+    bool                        acquire(addr::addr const & address);
+    bool                        release(addr::addr const & address, addr::addr & next);
+    std::int64_t                retry_delay(addr::addr const & address);
+    bool                        forget(addr::addr const & address);
+    std::size_t                 in_flight() const;
+    std::size_t                 queued() const;
+
+private:
+    std::size_t                 f_concurrency = DEFAULT_CONCURRENCY;    // 0 means no limit
+    std::int64_t                f_end_date = 0;
+    addr::addr::set_t           f_in_flight = addr::addr::set_t();
+    std::deque<addr::addr>      f_queue = std::deque<addr::addr>();
+    std::map<addr::addr, int>   f_attempts = std::map<addr::addr, int>();
+    std::mt19937_64             f_generator = std::mt19937_64();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
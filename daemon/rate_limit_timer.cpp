@@ -0,0 +1,79 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of rate_limit_timer object.
+ *
+ * We use a timer to know when to process the messages delayed by the
+ * ingress rate limiter.
+ */
+
+// self
+//
+#include    "rate_limit_timer.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \class rate_limit_timer
+ * \brief Process the messages delayed by the rate limiter.
+ *
+ * This class is an implementation of a timer used to process the
+ * messages which were received faster than the --rate-limits allow.
+ * The timer gets enabled when a message is delayed and times out when
+ * the next token of the oldest delayed message becomes available.
+ */
+
+
+/** \brief The timer initialization.
+ *
+ * The timer is created disabled. It gets enabled by the server whenever
+ * a message gets delayed.
+ *
+ * \param[in] cs  The communicatord server we are listening for.
+ */
+rate_limit_timer::rate_limit_timer(server::pointer_t cs)
+    : timer(-1)  // the delay is set by the server
+    , f_server(cs)
+{
+    set_enable(false);
+}
+
+
+void rate_limit_timer::process_timeout()
+{
+    f_server->process_rate_limit_timeout();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
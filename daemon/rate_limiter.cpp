@@ -0,0 +1,662 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the ingress rate limiter.
+ *
+ * The limits are token buckets: a bucket holds up to `burst` tokens
+ * and gets `rate` tokens per second. Each message takes one token from
+ * the bucket of its connection and one from the bucket of its command
+ * when that command is limited. A message is only accepted when both
+ * buckets have a token.
+ *
+ * The rules are written as a comma separated list of
+ * `<scope>:<name>=<rate>[/<burst>]` where the scope is "service",
+ * "type" or "command". The service limits have priority over the type
+ * limits. The types are "unix", "tcp", "udp" and "remote". The
+ * message definitions can include a `rate = <rate>[/<burst>]` field
+ * which is used for commands without an explicit rule.
+ *
+ * The buckets are refilled lazily, when a message arrives, so there is
+ * no timer involved unless messages are delayed.
+ */
+
+// self
+//
+#include    "rate_limiter.h"
+
+
+// communicatord
+//
+#include    <communicatord/names.h>
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/names.h>
+
+
+// snapdev
+//
+#include    <snapdev/tokenize_string.h>
+#include    <snapdev/trim_string.h>
+
+
+// C++
+//
+#include    <algorithm>
+#include    <cmath>
+#include    <cstdlib>
+#include    <list>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+namespace
+{
+
+
+
+/** \brief The commands communicator daemons send to each other.
+ *
+ * The links between communicatord's depend on these commands. Throttling
+ * them would, for example, make the failure detector believe that a
+ * peer stopped sending heartbeats.
+ */
+char const * const g_link_control_commands[] =
+{
+    ed::g_name_ed_cmd_commands,
+    communicatord::g_name_communicatord_cmd_accept,
+    communicatord::g_name_communicatord_cmd_connect,
+    communicatord::g_name_communicatord_cmd_disconnect,
+    communicatord::g_name_communicatord_cmd_flow_control,
+    communicatord::g_name_communicatord_cmd_forget,
+    communicatord::g_name_communicatord_cmd_gateway,
+    communicatord::g_name_communicatord_cmd_gossip,
+    communicatord::g_name_communicatord_cmd_heard_of,
+    communicatord::g_name_communicatord_cmd_heartbeat,
+    communicatord::g_name_communicatord_cmd_interest,
+    communicatord::g_name_communicatord_cmd_received,
+    communicatord::g_name_communicatord_cmd_refuse,
+};
+
+
+
+} // no name namespace
+
+
+
+/** \brief Check whether a message bypasses the rate limits.
+ *
+ * Two kinds of messages received from another communicatord are never
+ * rate limited:
+ *
+ * \li the reliable messages, since their sequence number gets recorded
+ * and acknowledged before they are delivered; dropping one would lose a
+ * message the sender believes was received;
+ * \li the commands the communicator daemons use to manage their links.
+ *
+ * \param[in] command  The identifier of the command of the message.
+ * \param[in] remote  Whether the message was sent by another communicatord.
+ * \param[in] reliable  Whether the message has a reliable sequence number.
+ *
+ * \return true if the rate limits do not apply to this message.
+ */
+bool is_rate_limit_exempt(command_id_t command, bool remote, bool reliable)
+{
+    if(!remote)
+    {
+        return false;
+    }
+    if(reliable)
+    {
+        return true;
+    }
+
+    static std::vector<bool> g_link_control;
+    if(g_link_control.empty())
+    {
+        for(auto const * name : g_link_control_commands)
+        {
+            command_id_t const id(seed_command(name));
+            if(id >= g_link_control.size())
+            {
+                g_link_control.resize(id + 1);
+            }
+            g_link_control[id] = true;
+        }
+    }
+
+    return command < g_link_control.size()
+        && g_link_control[command];
+}
+
+
+/** \brief Convert the name of a rate limit action.
+ *
+ * \param[in] name  The name of the action: "drop", "delay" or "throttle".
+ * \param[out] action  The resulting action.
+ *
+ * \return true if \p name is valid.
+ */
+bool parse_rate_limit_action(std::string const & name, rate_limit_action_t & action)
+{
+    if(name == "drop")
+    {
+        action = rate_limit_action_t::RATE_LIMIT_ACTION_DROP;
+        return true;
+    }
+    if(name == "delay")
+    {
+        action = rate_limit_action_t::RATE_LIMIT_ACTION_DELAY;
+        return true;
+    }
+    if(name == "throttle")
+    {
+        action = rate_limit_action_t::RATE_LIMIT_ACTION_THROTTLE;
+        return true;
+    }
+    return false;
+}
+
+
+/** \brief Check whether this limit applies.
+ *
+ * \return true if the rate is not unlimited.
+ */
+bool rate_limit::is_limited() const
+{
+    return f_rate > 0.0;
+}
+
+
+/** \brief Parse a rate limit.
+ *
+ * The limit is written as `<rate>[/<burst>]` where the rate is a number
+ * of messages per second. When the burst is not specified, it is the
+ * same as the rate with a minimum of one message. A rate of 0 means
+ * unlimited.
+ *
+ * \param[in] value  The limit to parse.
+ * \param[out] limit  The resulting limit.
+ *
+ * \return true if \p value is a valid limit.
+ */
+bool parse_rate_limit(std::string const & value, rate_limit & limit)
+{
+    std::string::size_type const slash(value.find('/'));
+    std::string const rate_str(snapdev::trim_string(value.substr(0, slash)));
+    if(rate_str.empty())
+    {
+        return false;
+    }
+    char * end(nullptr);
+    double const rate(std::strtod(rate_str.c_str(), &end));
+    if(*end != '\0'
+    || !std::isfinite(rate)
+    || rate < 0.0)
+    {
+        return false;
+    }
+
+    double burst(std::max(rate, 1.0));
+    if(slash != std::string::npos)
+    {
+        std::string const burst_str(snapdev::trim_string(value.substr(slash + 1)));
+        if(burst_str.empty())
+        {
+            return false;
+        }
+        burst = std::strtod(burst_str.c_str(), &end);
+        if(*end != '\0'
+        || !std::isfinite(burst)
+        || burst < 1.0)
+        {
+            return false;
+        }
+    }
+
+    limit.f_rate = rate;
+    limit.f_burst = burst;
+    return true;
+}
+
+
+/** \brief Change the limit of this bucket.
+ *
+ * The bucket starts full so a connection can immediately send a burst
+ * of messages.
+ *
+ * \param[in] limit  The new limit.
+ * \param[in] now  The current time in microseconds.
+ */
+void token_bucket::set_limit(rate_limit const & limit, std::int64_t now)
+{
+    f_limit = limit;
+    f_tokens = limit.f_burst;
+    f_last_refill = now;
+}
+
+
+/** \brief Retrieve the limit of this bucket.
+ *
+ * \return The limit as defined by set_limit().
+ */
+rate_limit const & token_bucket::get_limit() const
+{
+    return f_limit;
+}
+
+
+/** \brief Check whether a token is available.
+ *
+ * This function first adds the tokens earned since the last call, up
+ * to the size of the bucket.
+ *
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return true if consume() can be called.
+ */
+bool token_bucket::available(std::int64_t now)
+{
+    if(!f_limit.is_limited())
+    {
+        return true;
+    }
+
+    if(now > f_last_refill)
+    {
+        f_tokens = std::min(
+                      f_limit.f_burst
+                    , f_tokens + static_cast<double>(now - f_last_refill) * f_limit.f_rate / 1'000'000.0);
+        f_last_refill = now;
+    }
+    return f_tokens >= 1.0;
+}
+
+
+/** \brief Take one token from the bucket.
+ *
+ * Call available() first to know whether a token is there.
+ */
+void token_bucket::consume()
+{
+    if(f_limit.is_limited())
+    {
+        f_tokens -= 1.0;
+    }
+}
+
+
+/** \brief Compute how long until the next token becomes available.
+ *
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return The number of microseconds to wait, 0 if a token is available.
+ */
+std::int64_t token_bucket::next_token(std::int64_t now) const
+{
+    if(!f_limit.is_limited())
+    {
+        return 0;
+    }
+
+    double tokens(f_tokens);
+    if(now > f_last_refill)
+    {
+        tokens += static_cast<double>(now - f_last_refill) * f_limit.f_rate / 1'000'000.0;
+    }
+    if(tokens >= 1.0)
+    {
+        return 0;
+    }
+    return static_cast<std::int64_t>(std::ceil((1.0 - tokens) * 1'000'000.0 / f_limit.f_rate));
+}
+
+
+/** \brief Define the rate limits.
+ *
+ * The \p rules are a comma separated list of
+ * `<scope>:<name>=<rate>[/<burst>]` entries. The valid entries are
+ * kept even if the function returns false.
+ *
+ * \param[in] rules  The list of rules.
+ *
+ * \return true if all the rules are valid.
+ */
+bool rate_limit_rules::set_rules(std::string const & rules)
+{
+    bool result(true);
+    std::list<std::string> entries;
+    snapdev::tokenize_string(entries, rules, { "," }, true, " \t");
+    for(auto const & e : entries)
+    {
+        std::string::size_type const colon(e.find(':'));
+        std::string::size_type const equal(e.find('='));
+        rate_limit limit;
+        if(colon == std::string::npos
+        || equal == std::string::npos
+        || equal < colon
+        || !parse_rate_limit(e.substr(equal + 1), limit))
+        {
+            result = false;
+            continue;
+        }
+        std::string const scope(snapdev::trim_string(e.substr(0, colon)));
+        std::string const name(snapdev::trim_string(e.substr(colon + 1, equal - colon - 1)));
+        if(name.empty())
+        {
+            result = false;
+            continue;
+        }
+        if(scope == "service")
+        {
+            f_services[name] = limit;
+        }
+        else if(scope == "type")
+        {
+            if(name != "unix"
+            && name != "tcp"
+            && name != "udp"
+            && name != "remote")
+            {
+                result = false;
+                continue;
+            }
+            f_types[name] = limit;
+        }
+        else if(scope == "command")
+        {
+            command_id_t const id(seed_command(name));
+            if(id >= f_commands.size())
+            {
+                f_commands.resize(id + 1, rate_limit{ -1.0, 0.0 });
+            }
+            f_commands[id] = limit;
+        }
+        else
+        {
+            result = false;
+            continue;
+        }
+        ++f_limits;
+    }
+    return result;
+}
+
+
+/** \brief Define the limit of a command found in its definition.
+ *
+ * An explicit "command:" rule has priority over this limit.
+ *
+ * \param[in] command  The command concerned.
+ * \param[in] limit  The limit found in the message definition.
+ */
+void rate_limit_rules::set_default_command_limit(command_id_t command, rate_limit const & limit)
+{
+    if(command == COMMAND_ID_UNKNOWN
+    || !limit.is_limited())
+    {
+        return;
+    }
+    if(command >= f_default_commands.size())
+    {
+        f_default_commands.resize(command + 1);
+    }
+    f_default_commands[command] = limit;
+    ++f_limits;
+}
+
+
+/** \brief Get the limit of a connection.
+ *
+ * \param[in] service  The name of the service on the other side.
+ * \param[in] type  The type of the connection.
+ *
+ * \return The limit of that service or, if none, of that connection type.
+ */
+rate_limit rate_limit_rules::get_connection_limit(std::string const & service, std::string const & type) const
+{
+    auto const service_it(f_services.find(service));
+    if(service_it != f_services.end())
+    {
+        return service_it->second;
+    }
+    auto const type_it(f_types.find(type));
+    if(type_it != f_types.end())
+    {
+        return type_it->second;
+    }
+    return rate_limit();
+}
+
+
+/** \brief Get the limit of a command.
+ *
+ * \param[in] command  The command concerned.
+ *
+ * \return The explicit limit of that command, its default limit, or an
+ * unlimited rate.
+ */
+rate_limit rate_limit_rules::get_command_limit(command_id_t command) const
+{
+    if(command < f_commands.size()
+    && f_commands[command].f_rate >= 0.0)
+    {
+        return f_commands[command];
+    }
+    if(command < f_default_commands.size())
+    {
+        return f_default_commands[command];
+    }
+    return rate_limit();
+}
+
+
+/** \brief Check whether any limit is defined.
+ *
+ * \return true when no message can be limited.
+ */
+bool rate_limit_rules::empty() const
+{
+    return f_limits == 0;
+}
+
+
+/** \brief Check whether a message can be processed now.
+ *
+ * The bucket of the connection is reset whenever the name of the service
+ * or the type of the connection changes (i.e. a service registers or a
+ * connection is found to be a remote communicator daemon).
+ *
+ * \param[in] rules  The rate limits.
+ * \param[in] service  The name of the service which sent the message.
+ * \param[in] type  The type of the connection.
+ * \param[in] command  The command of the message.
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return true if the message is accepted, in which case the tokens
+ * were taken.
+ */
+bool ingress_limiter::accept(
+      rate_limit_rules const & rules
+    , std::string const & service
+    , std::string const & type
+    , command_id_t command
+    , std::int64_t now)
+{
+    if(!f_configured
+    || service != f_service
+    || type != f_type)
+    {
+        configure(rules, service, type, now);
+    }
+
+    token_bucket * command_bucket(nullptr);
+    rate_limit const limit(rules.get_command_limit(command));
+    if(limit.is_limited())
+    {
+        auto it(f_commands.find(command));
+        if(it == f_commands.end())
+        {
+            it = f_commands.emplace(command, token_bucket()).first;
+            it->second.set_limit(limit, now);
+        }
+        command_bucket = &it->second;
+    }
+
+    if(!f_connection.available(now)
+    || (command_bucket != nullptr && !command_bucket->available(now)))
+    {
+        return false;
+    }
+
+    f_connection.consume();
+    if(command_bucket != nullptr)
+    {
+        command_bucket->consume();
+    }
+    return true;
+}
+
+
+/** \brief Compute how long until a message with \p command is accepted.
+ *
+ * \param[in] command  The command of the message.
+ * \param[in] now  The current time in microseconds.
+ *
+ * \return The number of microseconds to wait.
+ */
+std::int64_t ingress_limiter::next_token(command_id_t command, std::int64_t now) const
+{
+    std::int64_t result(f_connection.next_token(now));
+    auto const it(f_commands.find(command));
+    if(it != f_commands.end())
+    {
+        result = std::max(result, it->second.next_token(now));
+    }
+    return result;
+}
+
+
+/** \brief Keep a message until a token is available.
+ *
+ * The time the message was received is kept along the message so it
+ * can be restored when the message finally gets delivered. Otherwise
+ * the trace of that message would show the time of whichever message
+ * was received last.
+ *
+ * \param[in] msg  The message to delay.
+ * \param[in] max_messages  The maximum number of messages to keep.
+ * \param[in] received_on  The time \p msg was received, in microseconds.
+ *
+ * \return false if too many messages are already delayed.
+ */
+bool ingress_limiter::delay(ed::message const & msg, std::size_t max_messages, std::int64_t received_on)
+{
+    if(f_delayed.size() >= max_messages)
+    {
+        return false;
+    }
+    f_delayed.push_back({ msg, received_on });
+    return true;
+}
+
+
+/** \brief Check whether messages are waiting for a token.
+ *
+ * The messages received after a delayed message have to wait too so
+ * they are processed in order.
+ *
+ * \return true if at least one message is delayed.
+ */
+bool ingress_limiter::has_delayed() const
+{
+    return !f_delayed.empty();
+}
+
+
+/** \brief Retrieve the oldest delayed message.
+ *
+ * \return A reference to the oldest delayed message.
+ */
+ed::message & ingress_limiter::front()
+{
+    return f_delayed.front().f_message;
+}
+
+
+/** \brief Retrieve the time the oldest delayed message was received.
+ *
+ * \return The \p received_on parameter given to delay().
+ */
+std::int64_t ingress_limiter::front_received_on() const
+{
+    return f_delayed.front().f_received_on;
+}
+
+
+/** \brief Forget about the oldest delayed message.
+ */
+void ingress_limiter::pop_front()
+{
+    f_delayed.pop_front();
+}
+
+
+/** \brief Mark the sender as throttled.
+ *
+ * The THROTTLE message is only sent once each time the sender goes over
+ * its limit.
+ *
+ * \param[in] throttled  Whether the last message was limited.
+ *
+ * \return true if the sender just went over its limit.
+ */
+bool ingress_limiter::set_throttled(bool throttled)
+{
+    bool const result(throttled && !f_throttled);
+    f_throttled = throttled;
+    return result;
+}
+
+
+void ingress_limiter::configure(
+      rate_limit_rules const & rules
+    , std::string const & service
+    , std::string const & type
+    , std::int64_t now)
+{
+    f_configured = true;
+    f_service = service;
+    f_type = type;
+    f_connection.set_limit(rules.get_connection_limit(service, type), now);
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
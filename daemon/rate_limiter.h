@@ -0,0 +1,163 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the ingress rate limiter.
+ *
+ * A service sending messages in a loop, or a flood of datagrams on the
+ * UDP port, would otherwise take all the time of the event loop and
+ * delay the messages of every other connection. The ingress rate
+ * limiter gives each connection a token bucket, selected by the name
+ * of the service or the type of the connection, and optionally one
+ * bucket per command. A message arriving when a bucket is empty gets
+ * dropped, delayed or answered with a THROTTLE message.
+ */
+
+// self
+//
+#include    "command_ids.h"
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/message.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <deque>
+#include    <map>
+#include    <string>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+enum class rate_limit_action_t
+{
+    RATE_LIMIT_ACTION_DROP,         // ignore the message
+    RATE_LIMIT_ACTION_DELAY,        // process the message once a token is available
+    RATE_LIMIT_ACTION_THROTTLE,     // ignore the message and send a THROTTLE to the sender
+};
+
+
+bool                    parse_rate_limit_action(std::string const & name, rate_limit_action_t & action);
+bool                    is_rate_limit_exempt(command_id_t command, bool remote, bool reliable);
+
+
+struct rate_limit
+{
+    double              f_rate = 0.0;       // messages per second, 0 for unlimited
+    double              f_burst = 0.0;      // size of the bucket
+
+    bool                is_limited() const;
+};
+
+
+bool                    parse_rate_limit(std::string const & value, rate_limit & limit);
+
+
+class token_bucket
+{
+public:
+    void                set_limit(rate_limit const & limit, std::int64_t now);
+    rate_limit const &  get_limit() const;
+    bool                available(std::int64_t now);
+    void                consume();
+    std::int64_t        next_token(std::int64_t now) const;
+
+private:
+    rate_limit          f_limit = rate_limit();
+    double              f_tokens = 0.0;
+    std::int64_t        f_last_refill = 0;
+};
+
+
+class rate_limit_rules
+{
+public:
+    bool                set_rules(std::string const & rules);
+    void                set_default_command_limit(command_id_t command, rate_limit const & limit);
+    rate_limit          get_connection_limit(std::string const & service, std::string const & type) const;
+    rate_limit          get_command_limit(command_id_t command) const;
+    bool                empty() const;
+
+private:
+    typedef std::map<std::string, rate_limit>   limit_map_t;
+
+    limit_map_t         f_services = limit_map_t();
+    limit_map_t         f_types = limit_map_t();
+    std::vector<rate_limit>
+                        f_commands = std::vector<rate_limit>();         // indexed by command_id_t
+    std::vector<rate_limit>
+                        f_default_commands = std::vector<rate_limit>(); // from the message definitions
+    std::size_t         f_limits = 0;
+};
+
+
+class ingress_limiter
+{
+public:
+    bool                accept(
+                              rate_limit_rules const & rules
+                            , std::string const & service
+                            , std::string const & type
+                            , command_id_t command
+                            , std::int64_t now);
+    std::int64_t        next_token(command_id_t command, std::int64_t now) const;
+    bool                delay(ed::message const & msg, std::size_t max_messages, std::int64_t received_on = 0);
+    bool                has_delayed() const;
+    ed::message &       front();
+    std::int64_t        front_received_on() const;
+    void                pop_front();
+    bool                set_throttled(bool throttled);
+
+private:
+    void                configure(
+                              rate_limit_rules const & rules
+                            , std::string const & service
+                            , std::string const & type
+                            , std::int64_t now);
+
+    std::string         f_service = std::string();
+    std::string         f_type = std::string();
+    bool                f_configured = false;
+    bool                f_throttled = false;
+    token_bucket        f_connection = token_bucket();
+    std::map<command_id_t, token_bucket>
+                        f_commands = std::map<command_id_t, token_bucket>();
+    struct delayed_message
+    {
+        ed::message     f_message = ed::message();
+        std::int64_t    f_received_on = 0;      // time the message was first received, in microseconds
+    };
+
+    std::deque<delayed_message>
+                        f_delayed = std::deque<delayed_message>();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,142 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the received broadcast messages table.
+ *
+ * Each broadcast message has a unique identifier and a timeout. The
+ * identifiers are saved in a hash set so checking whether a message was
+ * already received is O(1). The identifiers are also saved in a timing
+ * wheel with one bucket per second so expired entries can be removed
+ * without going through the entire table.
+ */
+
+// self
+//
+#include    "received_broadcasts.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Check whether a message was already received.
+ *
+ * \param[in] msgid  The broadcast message identifier.
+ *
+ * \return true if the message identifier is in the table.
+ */
+bool received_broadcasts::contains(std::string const & msgid) const
+{
+    return f_msgids.find(msgid) != f_msgids.end();
+}
+
+
+/** \brief Add a message identifier to the table.
+ *
+ * This function first removes the entries that timed out and then
+ * adds \p msgid unless it is already present.
+ *
+ * The entry is saved in the bucket of the wheel corresponding to its
+ * \p timeout. If the timeout is further away than the size of the wheel,
+ * the entry is kept in its bucket until a later round.
+ *
+ * \param[in] msgid  The broadcast message identifier.
+ * \param[in] timeout  The time when the broadcast message times out.
+ * \param[in] now  The current time.
+ *
+ * \return true if the message was added, false if it was already present.
+ */
+bool received_broadcasts::add(std::string const & msgid, time_t timeout, time_t now)
+{
+    expire(now);
+
+    if(!f_msgids.insert(msgid).second)
+    {
+        return false;
+    }
+
+    received_message m;
+    m.f_timeout = timeout;
+    m.f_msgid = msgid;
+    f_wheel[static_cast<std::size_t>(timeout) % WHEEL_SIZE].push_back(m);
+
+    return true;
+}
+
+
+/** \brief Remove the entries that timed out.
+ *
+ * This function goes through the buckets of the seconds that elapsed
+ * since the last call and removes entries with a timeout smaller than
+ * \p now.
+ *
+ * \param[in] now  The current time.
+ */
+void received_broadcasts::expire(time_t now)
+{
+    if(now - f_next_expiry > static_cast<time_t>(WHEEL_SIZE))
+    {
+        // we did not run in a while, one round is enough
+        //
+        f_next_expiry = now - static_cast<time_t>(WHEEL_SIZE);
+    }
+
+    for(; f_next_expiry < now; ++f_next_expiry)
+    {
+        received_message::vector_t & bucket(f_wheel[static_cast<std::size_t>(f_next_expiry) % WHEEL_SIZE]);
+        for(auto it(bucket.begin()); it != bucket.end(); )
+        {
+            if(it->f_timeout < now)
+            {
+                f_msgids.erase(it->f_msgid);
+
+                // order does not matter within a bucket
+                //
+                *it = std::move(bucket.back());
+                bucket.pop_back();
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+}
+
+
+/** \brief Return the number of message identifiers in the table.
+ *
+ * \return The number of broadcast messages currently remembered.
+ */
+std::size_t received_broadcasts::size() const
+{
+    return f_msgids.size();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,70 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the received broadcast messages table.
+ *
+ * The Communicator remembers the identifier of each broadcast message
+ * it receives so it can ignore duplicates. The class here is used to
+ * manage that table.
+ */
+
+// C++
+//
+#include    <string>
+#include    <unordered_set>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+class received_broadcasts
+{
+public:
+    static std::size_t const    WHEEL_SIZE = 64;    // one bucket per second
+
+    bool                contains(std::string const & msgid) const;
+    bool                add(std::string const & msgid, time_t timeout, time_t now);
+    void                expire(time_t now);
+    std::size_t         size() const;
+
+private:
+    class received_message
+    {
+    public:
+        typedef std::vector<received_message>   vector_t;
+
+        time_t              f_timeout = 0;                  // when the broadcast message times out
+        std::string         f_msgid = std::string();        // the broadcast message identifier
+    };
+
+    std::unordered_set<std::string>
+                        f_msgids = std::unordered_set<std::string>();
+    received_message::vector_t
+                        f_wheel[WHEEL_SIZE] = {};
+    time_t              f_next_expiry = 0;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
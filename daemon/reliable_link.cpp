@@ -0,0 +1,258 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the reliable link state.
+ *
+ * The state is kept per remote communicator daemon (by server name) and
+ * not per connection since a new connection object gets created each
+ * time a remote daemon connects to us.
+ *
+ * The acknowledgements are cumulative: acknowledging sequence N means
+ * that all the messages up to and including N were received. They get
+ * piggybacked on the next message sent to that peer.
+ *
+ * The number of messages waiting for an acknowledgement is bounded.
+ * When full, the oldest message is dropped and counted as an overflow;
+ * the receiver sees a gap in the sequence numbers.
+ */
+
+// self
+//
+#include    "reliable_link.h"
+
+
+// communicatord
+//
+#include    <communicatord/names.h>
+
+
+// C++
+//
+#include    <algorithm>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Define the maximum number of messages kept for a replay.
+ *
+ * If more messages are already waiting for an acknowledgement, the
+ * oldest ones get dropped.
+ *
+ * \param[in] max_messages  The maximum number of messages, at least 1.
+ */
+void reliable_link::set_max_messages(std::size_t max_messages)
+{
+    f_max_messages = std::max(max_messages, static_cast<std::size_t>(1));
+    while(f_unacknowledged.size() > f_max_messages)
+    {
+        f_unacknowledged.pop_front();
+        ++f_overflow;
+    }
+}
+
+
+/** \brief Assign the next sequence number to a message.
+ *
+ * This function adds the "reliable_sequence" parameter to \p msg and
+ * keeps a copy of it until it gets acknowledged.
+ *
+ * \param[in,out] msg  The message about to be sent.
+ *
+ * \return The sequence number assigned to \p msg.
+ */
+std::uint64_t reliable_link::send(ed::message & msg)
+{
+    std::uint64_t const sequence(f_next_sequence);
+    ++f_next_sequence;
+
+    msg.add_parameter(communicatord::g_name_communicatord_param_reliable_sequence, sequence);
+    if(f_unacknowledged.size() >= f_max_messages)
+    {
+        f_unacknowledged.pop_front();
+        ++f_overflow;
+    }
+    f_unacknowledged.push_back({ sequence, msg });
+
+    return sequence;
+}
+
+
+/** \brief Forget about the messages the peer received.
+ *
+ * The acknowledgement is cumulative so all the messages up to and
+ * including \p sequence get released.
+ *
+ * \param[in] sequence  The last sequence number received by the peer.
+ *
+ * \return The number of messages released.
+ */
+std::size_t reliable_link::acknowledge(std::uint64_t sequence)
+{
+    std::size_t count(0);
+    while(!f_unacknowledged.empty()
+       && f_unacknowledged.front().f_sequence <= sequence)
+    {
+        f_unacknowledged.pop_front();
+        ++count;
+    }
+    return count;
+}
+
+
+/** \brief Retrieve the messages to send again.
+ *
+ * Once a link reconnects, the messages which were not acknowledged
+ * yet are sent again, in order. They already have their sequence
+ * number so the receiver can ignore those it already received.
+ *
+ * \param[in,out] messages  The vector where the messages get added.
+ */
+void reliable_link::get_unacknowledged(std::vector<ed::message> & messages) const
+{
+    for(auto const & m : f_unacknowledged)
+    {
+        messages.push_back(m.f_message);
+    }
+}
+
+
+/** \brief Return the number of messages waiting for an acknowledgement.
+ *
+ * \return The number of messages which would be replayed.
+ */
+std::size_t reliable_link::pending() const
+{
+    return f_unacknowledged.size();
+}
+
+
+/** \brief Return the number of messages dropped from a full buffer.
+ *
+ * \return The number of messages which cannot be replayed anymore.
+ */
+std::uint64_t reliable_link::get_overflow() const
+{
+    return f_overflow;
+}
+
+
+/** \brief Define the session of the peer.
+ *
+ * Each communicator daemon starts a new session when it starts. Its
+ * sequence numbers restart at 1 so when the session changes, what we
+ * received from the previous session gets forgotten.
+ *
+ * \param[in] session  The session of the peer, as found in its CONNECT
+ * or ACCEPT message.
+ *
+ * \return true if the session changed.
+ */
+bool reliable_link::set_peer_session(std::int64_t session)
+{
+    if(session == f_peer_session)
+    {
+        return false;
+    }
+    f_peer_session = session;
+    f_received = 0;
+    f_acknowledged = 0;
+    return true;
+}
+
+
+/** \brief Return the session of the peer.
+ *
+ * \return The session last set with set_peer_session(), 0 if none yet.
+ */
+std::int64_t reliable_link::get_peer_session() const
+{
+    return f_peer_session;
+}
+
+
+/** \brief Check a sequence number received from the peer.
+ *
+ * Messages sent again after a reconnect may already have been received.
+ * Those have a sequence number which is not larger than the last one
+ * received and have to be ignored.
+ *
+ * A sequence number larger than the next expected one means the peer
+ * had to drop messages from its buffer. The message is still new.
+ *
+ * \param[in] sequence  The "reliable_sequence" of the message.
+ *
+ * \return Whether the message is new or a duplicate.
+ */
+receive_t reliable_link::receive(std::uint64_t sequence)
+{
+    if(sequence <= f_received)
+    {
+        return receive_t::RECEIVE_DUPLICATE;
+    }
+
+    bool const gap(f_received != 0 && sequence != f_received + 1);
+    f_received = sequence;
+    return gap ? receive_t::RECEIVE_GAP : receive_t::RECEIVE_NEW;
+}
+
+
+/** \brief Return the last sequence number received from the peer.
+ *
+ * \return The sequence number to acknowledge.
+ */
+std::uint64_t reliable_link::get_received() const
+{
+    return f_received;
+}
+
+
+/** \brief Get the acknowledgement to piggyback on a message.
+ *
+ * If messages were received since the last acknowledgement was sent,
+ * this function returns true and sets \p sequence to the last sequence
+ * number received.
+ *
+ * \param[out] sequence  The sequence number to acknowledge.
+ *
+ * \return true if an acknowledgement has to be sent.
+ */
+bool reliable_link::take_ack(std::uint64_t & sequence)
+{
+    if(f_received == f_acknowledged)
+    {
+        return false;
+    }
+    f_acknowledged = f_received;
+    sequence = f_received;
+    return true;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
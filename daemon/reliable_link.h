@@ -0,0 +1,98 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the reliable link state.
+ *
+ * Messages marked as reliable and sent to another communicator daemon
+ * get a sequence number. The sender keeps a copy of each one of them
+ * until the other side acknowledges it so they can be sent again once
+ * the link reconnects. The receiver uses the sequence numbers to ignore
+ * the messages it already received.
+ */
+
+// eventdispatcher
+//
+#include    <eventdispatcher/message.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <deque>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+enum class receive_t
+{
+    RECEIVE_NEW,
+    RECEIVE_DUPLICATE,
+    RECEIVE_GAP,            // new, but some messages before it were lost
+};
+
+
+class reliable_link
+{
+public:
+    static constexpr std::size_t const  DEFAULT_MAX_MESSAGES = 1'000;
+
+    void                        set_max_messages(std::size_t max_messages);
+
+    // sending side
+    //
+    std::uint64_t               send(ed::message & msg);
+    std::size_t                 acknowledge(std::uint64_t sequence);
+    void                        get_unacknowledged(std::vector<ed::message> & messages) const;
+    std::size_t                 pending() const;
+    std::uint64_t               get_overflow() const;
+
+    // receiving side
+    //
+    bool                        set_peer_session(std::int64_t session);
+    std::int64_t                get_peer_session() const;
+    receive_t                   receive(std::uint64_t sequence);
+    std::uint64_t               get_received() const;
+    bool                        take_ack(std::uint64_t & sequence);
+
+private:
+    struct sent_message
+    {
+        std::uint64_t           f_sequence = 0;
+        ed::message             f_message = ed::message();
+    };
+
+    std::size_t                 f_max_messages = DEFAULT_MAX_MESSAGES;
+    std::uint64_t               f_next_sequence = 1;
+    std::deque<sent_message>    f_unacknowledged = std::deque<sent_message>();
+    std::uint64_t               f_overflow = 0;
+    std::int64_t                f_peer_session = 0;
+    std::uint64_t               f_received = 0;         // last sequence received from that peer
+    std::uint64_t               f_acknowledged = 0;     // last sequence we acknowledged to that peer
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -37,6 +37,7 @@
 #include    "remote_communicators.h"
 
 #include    "gossip_connection.h"
+#include    "overlay.h"
 #include    "remote_connection.h"
 
 
@@ -95,7 +96,75 @@ addr::addr const & remote_communicators::get_connection_address() const
 }
 
 
-void remote_communicators::add_remote_communicator(std::string const & addr_port)
+/** \brief Switch to the overlay mode.
+ *
+ * By default, this communicator connects to all the other communicators
+ * (full mesh). When \p near_peers is not zero, it instead keeps only
+ * \p near_peers ring neighbors and \p long_links random peers as
+ * active peers. The other communicators remain known but cold.
+ *
+ * This function is expected to be called before any remote communicator
+ * gets added.
+ *
+ * \param[in] near_peers  The number of ring neighbors, 0 for a full mesh.
+ * \param[in] long_links  The number of random long links.
+ *
+ * \sa select_overlay_peers()
+ */
+void remote_communicators::set_overlay(std::size_t near_peers, std::size_t long_links)
+{
+    f_overlay_near_peers = near_peers;
+    f_overlay_long_links = near_peers == 0 ? 0 : long_links;
+}
+
+
+/** \brief Start the connection ramp-up phase.
+ *
+ * For \p duration microseconds from now, the connections to the remote
+ * communicators get started in parallel instead of one per second, with
+ * at most \p concurrency attempts at a time. Failed attempts are retried
+ * after a short jittered delay. After that phase, the connections use
+ * their usual timeouts.
+ *
+ * This function is expected to be called before any remote communicator
+ * gets added.
+ *
+ * \param[in] concurrency  The maximum number of attempts in parallel
+ * (0 for no limit).
+ * \param[in] duration  The duration of the ramp-up in microseconds
+ * (0 to disable the ramp-up).
+ */
+void remote_communicators::set_ramp_up(std::size_t concurrency, std::int64_t duration)
+{
+    f_ramp_up.start(time(nullptr) * 1'000'000LL, concurrency, duration);
+}
+
+
+/** \brief Check whether the overlay mode is in use.
+ *
+ * \return true if this communicator does not create a full mesh.
+ */
+bool remote_communicators::is_overlay() const
+{
+    return f_overlay_near_peers != 0;
+}
+
+
+/** \brief Get the number of active peers.
+ *
+ * This function returns the number of communicators this communicator
+ * tries to keep a link with. In full mesh mode, this is all the known
+ * communicators.
+ *
+ * \return The number of active peers.
+ */
+std::size_t remote_communicators::get_overlay_size() const
+{
+    return f_active_ips.size();
+}
+
+
+void remote_communicators::add_remote_communicator(std::string const & addr_port, bool requested)
 {
     // no default address for neighbors
     //
@@ -105,11 +174,25 @@ void remote_communicators::add_remote_communicator(std::string const & addr_port
                 , communicatord::REMOTE_PORT
                 , "tcp"));
 
-    add_remote_communicator(remote_addr);
+    add_remote_communicator(remote_addr, requested);
 }
 
 
-void remote_communicators::add_remote_communicator(addr::addr const & remote_addr)
+/** \brief Add a remote communicator.
+ *
+ * This function adds the communicator at \p remote_addr to the list
+ * of known communicators and, unless it is a cold neighbor in overlay
+ * mode, starts a connection or a GOSSIP with it.
+ *
+ * The \p requested flag is set when the remote communicator sent us a
+ * GOSSIP. In overlay mode, this means it selected us as one of its
+ * active peers so we have to link with it even if our own selection
+ * did not include it.
+ *
+ * \param[in] remote_addr  The address of the remote communicator.
+ * \param[in] requested  Whether the remote communicator asked for a link.
+ */
+void remote_communicators::add_remote_communicator(addr::addr const & remote_addr, bool requested)
 {
     std::string const addr_str(remote_addr.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT));
 
@@ -126,10 +209,27 @@ void remote_communicators::add_remote_communicator(addr::addr const & remote_add
         return;
     }
 
+    if(requested
+    && is_overlay())
+    {
+        f_requested_ips.insert(remote_addr);
+        f_failures.erase(remote_addr);
+        f_failed_ips.erase(remote_addr);
+    }
+
     // was this address already added?
     //
     if(f_all_ips.find(remote_addr) != f_all_ips.end())
     {
+        if(is_overlay()
+        && !f_active_ips.contains(remote_addr))
+        {
+            // a cold neighbor becomes active if it got requested
+            //
+            update_overlay();
+            return;
+        }
+
         if(remote_addr < f_connection_address)
         {
             // make sure it is defined!
@@ -179,6 +279,32 @@ void remote_communicators::add_remote_communicator(addr::addr const & remote_add
     //
     f_all_ips.insert(remote_addr);
 
+    if(is_overlay())
+    {
+        // the new address may or may not be part of our active peers
+        //
+        update_overlay();
+        return;
+    }
+
+    activate(remote_addr);
+}
+
+
+/** \brief Start the connection with a remote communicator.
+ *
+ * This function creates the remote connection (smaller IPs) or the
+ * GOSSIP connection (larger IPs) used to link with the communicator
+ * at \p remote_addr.
+ *
+ * \param[in] remote_addr  The address of the remote communicator.
+ */
+void remote_communicators::activate(addr::addr const & remote_addr)
+{
+    std::string const addr_str(remote_addr.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT));
+
+    f_active_ips.insert(remote_addr);
+
     // if this new IP is smaller than ours, then we start a connection
     //
     if(remote_addr < f_connection_address)
@@ -193,21 +319,31 @@ void remote_communicators::add_remote_communicator(addr::addr const & remote_add
         remote_connection::pointer_t remote_conn(std::make_shared<remote_connection>(f_server, remote_addr, false));
         f_smaller_ips[remote_addr] = remote_conn;
 
-        // make sure not to try to connect to all remote communicators
-        // all at once
-        //
         time_t const now(time(nullptr));
-        if(now > f_last_start_date)
+        if(f_ramp_up.is_active(now * 1'000'000LL))
         {
-            f_last_start_date = now;
+            // on startup, connect in parallel (up to the concurrency
+            // limit) so the cluster forms quickly
+            //
+            start_attempt(remote_conn, remote_addr);
         }
-        remote_conn->set_timeout_date(f_last_start_date * 1'000'000LL);
+        else
+        {
+            // make sure not to try to connect to all remote communicators
+            // all at once
+            //
+            if(now > f_last_start_date)
+            {
+                f_last_start_date = now;
+            }
+            remote_conn->set_timeout_date(f_last_start_date * 1'000'000LL);
 
-        // TBD: 1 second between attempts for each remote communicator,
-        //      should that be smaller? (i.e. not the same connection but
-        //      between all the remote connection attempts.)
-        //
-        f_last_start_date += 1LL;
+            // TBD: 1 second between attempts for each remote communicator,
+            //      should that be smaller? (i.e. not the same connection but
+            //      between all the remote connection attempts.)
+            //
+            f_last_start_date += 1LL;
+        }
 
         if(!f_communicator->add_connection(remote_conn))
         {
@@ -248,6 +384,249 @@ void remote_communicators::add_remote_communicator(addr::addr const & remote_add
 }
 
 
+/** \brief Stop the connection with a remote communicator.
+ *
+ * In overlay mode, a communicator which is not selected anymore becomes
+ * a cold neighbor: it remains in the list of known communicators but
+ * we remove the connection or GOSSIP we had with it.
+ *
+ * \param[in] remote_addr  The address of the remote communicator.
+ */
+void remote_communicators::deactivate(addr::addr const & remote_addr)
+{
+    f_active_ips.erase(remote_addr);
+    release_attempt(remote_addr);
+    f_ramp_up.forget(remote_addr);
+
+    auto smaller(f_smaller_ips.find(remote_addr));
+    if(smaller != f_smaller_ips.end())
+    {
+        f_communicator->remove_connection(smaller->second);
+        f_smaller_ips.erase(smaller);
+    }
+
+    auto gossip(f_gossip_ips.find(remote_addr));
+    if(gossip != f_gossip_ips.end())
+    {
+        f_communicator->remove_connection(gossip->second);
+        f_gossip_ips.erase(gossip);
+    }
+
+    SNAP_LOG_DEBUG
+        << "remote communicator "
+        << remote_addr.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT)
+        << " is now a cold neighbor."
+        << SNAP_LOG_SEND;
+}
+
+
+/** \brief Select the active peers in overlay mode.
+ *
+ * This function computes the set of peers we want to link with: our
+ * selection (see select_overlay_peers()) among the known communicators
+ * which did not fail, plus the communicators which requested a link
+ * with us. Then it deactivates the peers which are not wanted anymore
+ * and activates the new ones.
+ *
+ * If all the known communicators failed, they all become candidates
+ * again so we never end up without any peer.
+ */
+void remote_communicators::update_overlay()
+{
+    addr::addr::set_t candidates;
+    for(auto const & a : f_all_ips)
+    {
+        if(!f_failed_ips.contains(a))
+        {
+            candidates.insert(a);
+        }
+    }
+    if(candidates.empty())
+    {
+        f_failed_ips.clear();
+        candidates = f_all_ips;
+    }
+
+    addr::addr::set_t wanted(select_overlay_peers(
+                  candidates
+                , f_connection_address
+                , f_overlay_near_peers
+                , f_overlay_long_links));
+    wanted.insert(f_requested_ips.begin(), f_requested_ips.end());
+
+    addr::addr::set_t const active(f_active_ips);
+    for(auto const & a : active)
+    {
+        if(!wanted.contains(a))
+        {
+            deactivate(a);
+        }
+    }
+
+    for(auto const & a : wanted)
+    {
+        if(!f_active_ips.contains(a))
+        {
+            activate(a);
+        }
+    }
+}
+
+
+/** \brief Start a connection attempt during the ramp-up.
+ *
+ * If a ramp-up slot is available, the attempt starts immediately.
+ * Otherwise the connection gets disabled until release_attempt() gives
+ * it a slot.
+ *
+ * \param[in] conn  The remote or gossip connection.
+ * \param[in] remote_addr  The address of the remote communicator.
+ */
+void remote_communicators::start_attempt(
+      ed::connection::pointer_t conn
+    , addr::addr const & remote_addr)
+{
+    if(f_ramp_up.acquire(remote_addr))
+    {
+        conn->set_timeout_date(time(nullptr) * 1'000'000LL);
+    }
+    else
+    {
+        conn->set_enable(false);
+    }
+}
+
+
+/** \brief Release the ramp-up slot of a remote communicator.
+ *
+ * Once an attempt succeeded or failed, its slot goes to the next
+ * connection waiting for one, if any, which then starts immediately.
+ *
+ * \param[in] remote_addr  The address of the remote communicator.
+ */
+void remote_communicators::release_attempt(addr::addr const & remote_addr)
+{
+    addr::addr next;
+    if(!f_ramp_up.release(remote_addr, next))
+    {
+        return;
+    }
+
+    ed::connection::pointer_t conn;
+    auto smaller(f_smaller_ips.find(next));
+    if(smaller != f_smaller_ips.end())
+    {
+        conn = smaller->second;
+    }
+    else
+    {
+        auto gossip(f_gossip_ips.find(next));
+        if(gossip != f_gossip_ips.end())
+        {
+            conn = gossip->second;
+        }
+    }
+    if(conn == nullptr)
+    {
+        // that connection is gone, try the one after
+        //
+        release_attempt(next);
+        return;
+    }
+
+    conn->set_enable(true);
+    conn->set_timeout_date(time(nullptr) * 1'000'000LL);
+}
+
+
+/** \brief A connection with a remote communicator succeeded.
+ *
+ * The ramp-up slot used by that connection is released.
+ *
+ * \param[in] remote_addr  The address of the remote communicator.
+ */
+void remote_communicators::connection_established(addr::addr const & remote_addr)
+{
+    release_attempt(remote_addr);
+    f_ramp_up.forget(remote_addr);
+}
+
+
+/** \brief A connection with a remote communicator failed.
+ *
+ * During the ramp-up, the slot of that connection gets released and
+ * the next attempt is scheduled after a short jittered delay. Once the
+ * ramp-up is over, the connection goes back to its usual timeout.
+ *
+ * In overlay mode, a peer which failed OVERLAY_MAX_FAILURES times in a
+ * row gets replaced by a cold neighbor. The counter is reset when we
+ * hear from that peer again.
+ *
+ * In full mesh mode, no peer gets replaced since we anyway keep trying
+ * to connect with all the communicators.
+ *
+ * \param[in] remote_addr  The address of the remote communicator.
+ */
+void remote_communicators::connection_failed(addr::addr const & remote_addr)
+{
+    release_attempt(remote_addr);
+
+    auto smaller(f_smaller_ips.find(remote_addr));
+    if(f_ramp_up.is_active(time(nullptr) * 1'000'000LL))
+    {
+        std::int64_t const delay(f_ramp_up.retry_delay(remote_addr));
+        if(smaller != f_smaller_ips.end())
+        {
+            smaller->second->set_timeout_delay(delay);
+        }
+        else
+        {
+            auto gossip(f_gossip_ips.find(remote_addr));
+            if(gossip != f_gossip_ips.end())
+            {
+                gossip->second->set_timeout_delay(delay);
+            }
+        }
+
+        // peers may not all be started yet, do not replace them so soon
+        //
+        return;
+    }
+
+    if(f_ramp_up.forget(remote_addr)
+    && smaller != f_smaller_ips.end())
+    {
+        smaller->second->set_timeout_delay(remote_connection::REMOTE_CONNECTION_DEFAULT_TIMEOUT);
+    }
+
+    if(!is_overlay()
+    || !f_active_ips.contains(remote_addr)
+    || f_requested_ips.contains(remote_addr))
+    {
+        return;
+    }
+
+    int & failures(f_failures[remote_addr]);
+    ++failures;
+    if(failures < OVERLAY_MAX_FAILURES)
+    {
+        return;
+    }
+    f_failures.erase(remote_addr);
+
+    SNAP_LOG_INFO
+        << "remote communicator "
+        << remote_addr.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT)
+        << " failed "
+        << OVERLAY_MAX_FAILURES
+        << " times; replacing it with a cold neighbor."
+        << SNAP_LOG_SEND;
+
+    f_failed_ips.insert(remote_addr);
+    update_overlay();
+}
+
+
 /** \brief Stop all gossiping at once.
  *
  * This function can be called to remove all the gossip connections
@@ -301,6 +680,16 @@ void remote_communicators::too_busy(addr::addr const & remote_addr)
             << " was marked as too busy. Pause for 1 day before trying to connect again."
             << SNAP_LOG_SEND;
     }
+
+    if(is_overlay()
+    && f_active_ips.contains(remote_addr))
+    {
+        // no need to wait 1 day, use a cold neighbor instead
+        //
+        f_failures.erase(remote_addr);
+        f_failed_ips.insert(remote_addr);
+        update_overlay();
+    }
 }
 
 
@@ -343,6 +732,8 @@ void remote_communicators::server_unreachable(addr::addr const & remote_addr)
     unreachable.set_service(communicatord::g_name_communicatord_service_local_broadcast);
     unreachable.add_parameter(communicatord::g_name_communicatord_param_who, remote_addr.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT));
     f_server->broadcast_message(unreachable);
+
+    connection_failed(remote_addr);
 }
 
 
@@ -360,6 +751,16 @@ void remote_communicators::server_unreachable(addr::addr const & remote_addr)
  */
 void remote_communicators::gossip_received(addr::addr const & remote_addr)
 {
+    // we heard from that communicator, it is not failing anymore
+    //
+    release_attempt(remote_addr);
+    f_ramp_up.forget(remote_addr);
+    f_failures.erase(remote_addr);
+    if(f_failed_ips.erase(remote_addr) != 0)
+    {
+        update_overlay();
+    }
+
     auto it(f_gossip_ips.find(remote_addr));
     if(it != f_gossip_ips.end())
     {
@@ -386,6 +787,15 @@ void remote_communicators::gossip_received(addr::addr const & remote_addr)
  */
 void remote_communicators::connection_lost(addr::addr const & remote_addr)
 {
+    if(is_overlay()
+    && !f_active_ips.contains(remote_addr))
+    {
+        // a cold neighbor or a peer which selected us, it will
+        // reconnect by itself if it still wants a link with us
+        //
+        return;
+    }
+
     if(f_gossip_ips.contains(remote_addr))
     {
         // this should not happen since the connection_lost() call
@@ -423,6 +833,13 @@ void remote_communicators::connection_lost(addr::addr const & remote_addr)
             << "new gossip connection added for "
             << addr_str
             << SNAP_LOG_SEND;
+
+        if(f_ramp_up.is_active(time(nullptr) * 1'000'000LL))
+        {
+            // do not wait for the first timeout on startup
+            //
+            start_attempt(f_gossip_ips[remote_addr], remote_addr);
+        }
     }
 }
 
@@ -447,6 +864,20 @@ void remote_communicators::forget_remote_connection(addr::addr const & remote_ad
             f_gossip_ips.erase(it);
         }
     }
+
+    release_attempt(remote_addr);
+    f_ramp_up.forget(remote_addr);
+    f_active_ips.erase(remote_addr);
+    f_requested_ips.erase(remote_addr);
+    f_failed_ips.erase(remote_addr);
+    f_failures.erase(remote_addr);
+    if(is_overlay())
+    {
+        // replace that peer with a cold neighbor
+        //
+        f_all_ips.erase(remote_addr);
+        update_overlay();
+    }
 }
 
 
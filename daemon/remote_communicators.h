@@ -28,10 +28,15 @@
  * instead connect to send a GOSSIP message. The GOSSIP is a mean to
  * connect to new servers without the need to define them on all your
  * servers. Defining it on one server is enough to get things started.
+ *
+ * In overlay mode, only a subset of the communicators are connected
+ * (see overlay.h). The others are known (cold) and get used as a
+ * replacement whenever an active peer fails.
  */
 
 // self
 //
+#include    "ramp_up.h"
 #include    "server.h"
 
 
@@ -57,19 +62,27 @@ class remote_communicators
 public:
     typedef std::shared_ptr<remote_communicators>    pointer_t;
 
+    static int const                        OVERLAY_MAX_FAILURES = 3;   // failures before an active peer gets replaced
+
                                             remote_communicators(
                                                   server::pointer_t communicator
                                                 , addr::addr const & my_addr);
 
     addr::addr const &                      get_connection_address() const;
-    void                                    add_remote_communicator(std::string const & addr_port);
-    void                                    add_remote_communicator(addr::addr const & address);
+    void                                    set_overlay(std::size_t near_peers, std::size_t long_links);
+    void                                    set_ramp_up(std::size_t concurrency, std::int64_t duration);
+    bool                                    is_overlay() const;
+    std::size_t                             get_overlay_size() const;
+    void                                    add_remote_communicator(std::string const & addr_port, bool requested = false);
+    void                                    add_remote_communicator(addr::addr const & address, bool requested = false);
     void                                    stop_gossiping();
     void                                    too_busy(addr::addr const & address);
     void                                    shutting_down(addr::addr const & address);
     void                                    server_unreachable(addr::addr const & address);
     void                                    gossip_received(addr::addr const & address);
     void                                    connection_lost(addr::addr const & address);
+    void                                    connection_failed(addr::addr const & address);
+    void                                    connection_established(addr::addr const & address);
     void                                    forget_remote_connection(addr::addr const & address);
     size_t                                  count_live_connections() const;
 
@@ -79,6 +92,12 @@ private:
     typedef std::map<addr::addr, std::shared_ptr<gossip_connection>>
                                             sorted_gossip_connections_by_address_t;
 
+    void                                    activate(addr::addr const & address);
+    void                                    deactivate(addr::addr const & address);
+    void                                    update_overlay();
+    void                                    start_attempt(ed::connection::pointer_t conn, addr::addr const & address);
+    void                                    release_attempt(addr::addr const & address);
+
     ed::communicator::pointer_t             f_communicator = ed::communicator::pointer_t();
     server::pointer_t                       f_server = server::pointer_t();
     addr::addr const &                      f_connection_address;
@@ -86,6 +105,13 @@ private:
     addr::addr::set_t                       f_all_ips = addr::addr::set_t();
     sorted_remote_connections_by_address_t  f_smaller_ips = sorted_remote_connections_by_address_t();   // we connect to smaller IPs
     sorted_gossip_connections_by_address_t  f_gossip_ips = sorted_gossip_connections_by_address_t();    // we gossip with larger IPs
+    std::size_t                             f_overlay_near_peers = 0;       // 0 means full mesh
+    std::size_t                             f_overlay_long_links = 0;
+    addr::addr::set_t                       f_active_ips = addr::addr::set_t();     // overlay: peers we keep a link with
+    addr::addr::set_t                       f_requested_ips = addr::addr::set_t();  // overlay: peers which asked us for a link
+    addr::addr::set_t                       f_failed_ips = addr::addr::set_t();     // overlay: peers replaced by a cold neighbor
+    std::map<addr::addr, int>               f_failures = std::map<addr::addr, int>();
+    ramp_up                                 f_ramp_up = ramp_up();
 
     // larger IPs connect to us so they end up in the local-connection list
     //service_connection_list_t               f_larger_ips = service_connection_list_t();       // larger IPs connect to us
@@ -28,6 +28,8 @@
 //
 #include    "remote_connection.h"
 
+#include    "wire_format.h"
+
 
 
 // communicatord
@@ -102,6 +104,7 @@ remote_connection::remote_connection(
             , REMOTE_CONNECTION_DEFAULT_TIMEOUT)
     , base_connection(cs, false)
     , f_address(address)
+    , f_secure(secure)
 {
     std::string const addr_str(address.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT));
     set_name(communicatord::g_name_communicatord_connection_remote_communicator_out + (": " + addr_str));
@@ -241,6 +244,19 @@ void remote_connection::process_connection_failed(std::string const & error_mess
         flag->add_tag("network");
         flag->save();
     }
+
+    // a flapping secure link costs one TLS handshake per reconnection,
+    // wait longer before the next attempt if we did too many recently
+    //
+    if(f_handshake_delay > get_timeout_delay())
+    {
+        set_timeout_delay(f_handshake_delay);
+    }
+
+    // in overlay mode, this may replace this connection with one to a
+    // cold neighbor so it has to be last
+    //
+    f_server->connection_failed(f_address);
 }
 
 
@@ -283,6 +299,11 @@ void remote_connection::process_connected()
     // slowdown over time
     //
     set_timeout_delay(REMOTE_CONNECTION_DEFAULT_TIMEOUT);
+
+    if(f_secure)
+    {
+        f_handshake_delay = f_server->tls_handshake(f_address, false);
+    }
 }
 
 
@@ -292,6 +313,42 @@ bool remote_connection::send_message(ed::message & msg, bool cache)
 }
 
 
+bool remote_connection::send_message_to_connection(ed::message & msg, bool cache)
+{
+    base_connection::pointer_t self(std::static_pointer_cast<remote_connection>(shared_from_this()));
+    ed::message copy;
+    ed::message & out(f_server->reliable_output(self, msg, copy));
+    f_server->prepare_link_output(self, out);
+    ed::message wire;
+    ed::message & sent(has_capability(communicatord::g_name_communicatord_value_wire_format)
+                    && encode_wire_message(out, wire, get_compression_level(), get_compression_threshold())
+                            ? wire
+                            : out);
+    bool const result(tcp_client_permanent_message_connection::send_message(sent, cache));
+
+    // the size only matters while the output is batched
+    //
+    f_server->link_output_done(self, out, is_corked() ? sent.to_message().length() + 1 : 0);
+    return result;
+}
+
+
+void remote_connection::connection_added()
+{
+    tcp_client_permanent_message_connection::connection_added();
+
+    f_server->add_connection(std::static_pointer_cast<remote_connection>(shared_from_this()));
+}
+
+
+void remote_connection::connection_removed()
+{
+    tcp_client_permanent_message_connection::connection_removed();
+
+    f_server->connection_removed(this);
+}
+
+
 addr::addr const & remote_connection::get_address() const
 {
     return f_address;
@@ -66,6 +66,11 @@ public:
     virtual void                    process_connection_failed(std::string const & error_message) override;
     virtual void                    process_connected() override;
     virtual bool                    send_message(ed::message & msg, bool cache = false);
+    virtual void                    connection_added() override;
+    virtual void                    connection_removed() override;
+
+    // base_connection implementation
+    virtual bool                    send_message_to_connection(ed::message & msg, bool cache = false) override;
 
     addr::addr const &              get_address() const;
 
@@ -75,6 +80,8 @@ private:
     time_t                          f_failure_start_time = 0;
     bool                            f_flagged = false;
     bool                            f_connected = false;
+    bool const                      f_secure = false;
+    std::int64_t                    f_handshake_delay = 0;
     std::string                     f_server_name = std::string();
 };
 
@@ -0,0 +1,371 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the routing table.
+ *
+ * The routing table maps a (server name, service name) pair to the
+ * connection one has to use to send a message to that service. Local
+ * services are added when they REGISTER and removed when they UNREGISTER
+ * or their connection goes away. Remote communicator daemons add a
+ * "link" (a route with an empty service name) along the list of services
+ * they advertise when we receive their CONNECT or ACCEPT message.
+ *
+ * The table also maps each service to the remote communicator daemons
+ * leading to it (the "next hops"). Those running the service are direct
+ * next hops. Those which only heard of it are used when no direct next
+ * hop exists.
+ *
+ * The table only keeps weak pointers so a connection that gets removed
+ * from the ed::communicator without us being told is simply ignored.
+ */
+
+// self
+//
+#include    "routing_table.h"
+
+#include    "base_connection.h"
+
+
+// C++
+//
+#include    <functional>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Compute the hash of a route key.
+ *
+ * The key is composed of the server name and the service name. This
+ * function combines the hash of both strings.
+ *
+ * \param[in] key  The key to hash.
+ *
+ * \return The hash of \p key.
+ */
+std::size_t routing_table::key_hash::operator () (key_t const & key) const
+{
+    std::size_t const h(std::hash<std::string>()(key.first));
+    return h ^ (std::hash<std::string>()(key.second) + 0x9e3779b9 + (h << 6) + (h >> 2));
+}
+
+
+/** \brief Add a route to a service.
+ *
+ * This function saves \p conn as the connection to use to reach the
+ * service named \p service_name running on \p server_name.
+ *
+ * If a route to that service already exists, it gets replaced.
+ *
+ * \param[in] server_name  The name of the server running the service.
+ * \param[in] service_name  The name of the service.
+ * \param[in] conn  The connection used to reach that service.
+ */
+void routing_table::add_route(
+      std::string const & server_name
+    , std::string const & service_name
+    , connection_pointer_t conn)
+{
+    f_routes[key_t(server_name, service_name)] = conn;
+}
+
+
+/** \brief Add a link to a remote communicator daemon.
+ *
+ * A remote communicator daemon is reached through one connection. This
+ * function adds a route to that daemon (i.e. a route with an empty
+ * service name) and one route per service it advertised.
+ *
+ * The connection also becomes a next hop for each one of its
+ * \p services and each one of the services it \p heard_of.
+ *
+ * Any route previously attached to \p conn is first removed since the
+ * list of services of a remote daemon may change between connections.
+ *
+ * \param[in] server_name  The name of the remote server.
+ * \param[in] services  The list of services running on that server.
+ * \param[in] conn  The connection to that remote communicator daemon.
+ * \param[in] heard_of  The list of services that server heard of.
+ */
+void routing_table::add_link(
+      std::string const & server_name
+    , advgetopt::string_set_t const & services
+    , connection_pointer_t conn
+    , advgetopt::string_set_t const & heard_of)
+{
+    remove_connection(conn.get());
+
+    add_route(server_name, std::string(), conn);
+    for(auto const & s : services)
+    {
+        add_route(server_name, s, conn);
+        f_next_hops[s].push_back({ conn, true });
+    }
+    for(auto const & s : heard_of)
+    {
+        if(services.find(s) == services.end())
+        {
+            f_next_hops[s].push_back({ conn, false });
+        }
+    }
+}
+
+
+/** \brief Add a service heard of through a remote communicator daemon.
+ *
+ * When a remote communicator daemon tells us about a new service it
+ * heard of, \p conn becomes an indirect next hop for that service. If
+ * \p conn already leads to that service, nothing happens.
+ *
+ * \param[in] service_name  The name of the service.
+ * \param[in] conn  The connection to that remote communicator daemon.
+ */
+void routing_table::add_heard_of(
+      std::string const & service_name
+    , connection_pointer_t conn)
+{
+    std::vector<next_hop> & hops(f_next_hops[service_name]);
+    for(auto const & h : hops)
+    {
+        if(h.f_connection.lock() == conn)
+        {
+            return;
+        }
+    }
+    hops.push_back({ conn, false });
+}
+
+
+/** \brief Remove a service heard of through a remote communicator daemon.
+ *
+ * This function removes \p conn as an indirect next hop for
+ * \p service_name. If that service runs on that remote daemon, the
+ * direct next hop is kept.
+ *
+ * \param[in] service_name  The name of the service.
+ * \param[in] conn  The connection to that remote communicator daemon.
+ */
+void routing_table::remove_heard_of(
+      std::string const & service_name
+    , base_connection const * conn)
+{
+    auto const it(f_next_hops.find(service_name));
+    if(it == f_next_hops.end())
+    {
+        return;
+    }
+
+    std::vector<next_hop> & hops(it->second);
+    for(auto h(hops.begin()); h != hops.end(); ++h)
+    {
+        if(!h->f_direct
+        && h->f_connection.lock().get() == conn)
+        {
+            hops.erase(h);
+            break;
+        }
+    }
+    if(hops.empty())
+    {
+        f_next_hops.erase(it);
+    }
+}
+
+
+/** \brief Remove all the routes going through the specified connection.
+ *
+ * When a connection is lost or a service unregisters, all the routes
+ * pointing to that connection have to be removed. This function also
+ * removes routes whose connection was already released.
+ *
+ * \param[in] conn  The connection being removed.
+ */
+void routing_table::remove_connection(base_connection const * conn)
+{
+    for(auto it(f_routes.begin()); it != f_routes.end(); )
+    {
+        connection_pointer_t const c(it->second.lock());
+        if(c == nullptr
+        || c.get() == conn)
+        {
+            it = f_routes.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    for(auto it(f_next_hops.begin()); it != f_next_hops.end(); )
+    {
+        std::vector<next_hop> & hops(it->second);
+        for(auto h(hops.begin()); h != hops.end(); )
+        {
+            connection_pointer_t const c(h->f_connection.lock());
+            if(c == nullptr
+            || c.get() == conn)
+            {
+                h = hops.erase(h);
+            }
+            else
+            {
+                ++h;
+            }
+        }
+        if(hops.empty())
+        {
+            it = f_next_hops.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+
+/** \brief Search for the connection to a service.
+ *
+ * This function searches the connection to use to reach \p service_name
+ * on \p server_name.
+ *
+ * \param[in] server_name  The name of the server running the service.
+ * \param[in] service_name  The name of the service.
+ *
+ * \return The connection or nullptr if no such route exists.
+ */
+routing_table::connection_pointer_t routing_table::find_route(
+      std::string const & server_name
+    , std::string const & service_name) const
+{
+    auto const it(f_routes.find(key_t(server_name, service_name)));
+    if(it == f_routes.end())
+    {
+        return connection_pointer_t();
+    }
+    return it->second.lock();
+}
+
+
+/** \brief Search for the connection to a remote communicator daemon.
+ *
+ * This function returns the connection to the communicator daemon
+ * running on \p server_name.
+ *
+ * \param[in] server_name  The name of the remote server.
+ *
+ * \return The connection or nullptr if we are not directly connected to
+ * that server.
+ */
+routing_table::connection_pointer_t routing_table::find_link(std::string const & server_name) const
+{
+    return find_route(server_name, std::string());
+}
+
+
+/** \brief Retrieve all the links to remote communicator daemons.
+ *
+ * This function adds all the connections to remote communicator daemons
+ * to the \p links vector.
+ *
+ * \param[in,out] links  The vector where the links get added.
+ */
+void routing_table::get_links(connection_vector_t & links) const
+{
+    for(auto const & r : f_routes)
+    {
+        if(r.first.second.empty())
+        {
+            connection_pointer_t c(r.second.lock());
+            if(c != nullptr)
+            {
+                links.push_back(c);
+            }
+        }
+    }
+}
+
+
+/** \brief Retrieve the remote communicator daemons leading to a service.
+ *
+ * This function adds to \p hops the connections to the remote
+ * communicator daemons running \p service_name. If none runs that
+ * service, it adds the connections to those which heard of it instead.
+ *
+ * If \p hops is still empty on return, no route to that service is
+ * known.
+ *
+ * \param[in] service_name  The name of the service.
+ * \param[in,out] hops  The vector where the next hops get added.
+ */
+void routing_table::find_next_hops(
+      std::string const & service_name
+    , connection_vector_t & hops) const
+{
+    auto const it(f_next_hops.find(service_name));
+    if(it == f_next_hops.end())
+    {
+        return;
+    }
+
+    for(int pass(0); pass < 2; ++pass)
+    {
+        bool const direct(pass == 0);
+        for(auto const & h : it->second)
+        {
+            if(h.f_direct == direct)
+            {
+                connection_pointer_t c(h.f_connection.lock());
+                if(c != nullptr)
+                {
+                    hops.push_back(c);
+                }
+            }
+        }
+        if(!hops.empty())
+        {
+            return;
+        }
+    }
+}
+
+
+/** \brief Return the number of routes.
+ *
+ * This function returns the number of routes including the links.
+ *
+ * \return The number of routes currently defined.
+ */
+std::size_t routing_table::size() const
+{
+    return f_routes.size();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,114 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the routing table.
+ *
+ * The Communicator keeps a table of the services it knows about and
+ * the connection used to reach each one of them. This allows the
+ * daemon to forward a message without having to search the entire
+ * list of connections.
+ *
+ * It also knows which remote communicator daemon leads to a service,
+ * either because that service runs there or because that daemon heard
+ * of it. This is used to avoid sending a message to all the remote
+ * communicator daemons.
+ */
+
+// advgetopt
+//
+#include    <advgetopt/utils.h>
+
+
+// C++
+//
+#include    <memory>
+#include    <unordered_map>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+class base_connection;
+
+
+class routing_table
+{
+public:
+    typedef std::shared_ptr<base_connection>    connection_pointer_t;
+    typedef std::vector<connection_pointer_t>   connection_vector_t;
+
+    void                    add_route(
+                                  std::string const & server_name
+                                , std::string const & service_name
+                                , connection_pointer_t conn);
+    void                    add_link(
+                                  std::string const & server_name
+                                , advgetopt::string_set_t const & services
+                                , connection_pointer_t conn
+                                , advgetopt::string_set_t const & heard_of = advgetopt::string_set_t());
+    void                    add_heard_of(
+                                  std::string const & service_name
+                                , connection_pointer_t conn);
+    void                    remove_heard_of(
+                                  std::string const & service_name
+                                , base_connection const * conn);
+    void                    remove_connection(base_connection const * conn);
+    connection_pointer_t    find_route(
+                                  std::string const & server_name
+                                , std::string const & service_name) const;
+    connection_pointer_t    find_link(std::string const & server_name) const;
+    void                    get_links(connection_vector_t & links) const;
+    void                    find_next_hops(
+                                  std::string const & service_name
+                                , connection_vector_t & hops) const;
+    std::size_t             size() const;
+
+private:
+    typedef std::pair<std::string, std::string>     key_t;
+
+    struct key_hash
+    {
+        std::size_t         operator () (key_t const & key) const;
+    };
+
+    typedef std::unordered_map<key_t, std::weak_ptr<base_connection>, key_hash>
+                                                    route_map_t;
+
+    struct next_hop
+    {
+        std::weak_ptr<base_connection>
+                            f_connection = std::weak_ptr<base_connection>();
+        bool                f_direct = false;       // the service runs on that server (opposed to "heard of")
+    };
+
+    typedef std::unordered_map<std::string, std::vector<next_hop>>
+                                                    next_hop_map_t;
+
+    route_map_t             f_routes = route_map_t();
+    next_hop_map_t          f_next_hops = next_hop_map_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
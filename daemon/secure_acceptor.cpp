@@ -0,0 +1,268 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the secure acceptor.
+ *
+ * The thread waits for new connections on the secure listener socket
+ * and calls accept(), which includes the TLS handshake. The accepted
+ * clients are saved in a queue and the main thread gets woken up
+ * through the thread_done_signal pipe. The main thread then creates
+ * the service_connection objects as usual.
+ *
+ * The listener is not added to the ed::communicator in this mode.
+ */
+
+// self
+//
+#include    "secure_acceptor.h"
+
+
+// cppthread
+//
+#include    <cppthread/guard.h>
+#include    <cppthread/mutex.h>
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <deque>
+
+
+// C
+//
+#include    <poll.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+namespace detail
+{
+
+
+
+class secure_accept_runner
+    : public cppthread::runner
+{
+public:
+    typedef std::shared_ptr<secure_accept_runner>   pointer_t;
+
+                        secure_accept_runner(
+                              listener::pointer_t l
+                            , secure_acceptor * acceptor);
+                        secure_accept_runner(secure_accept_runner const &) = delete;
+    secure_accept_runner &
+                        operator = (secure_accept_runner const &) = delete;
+
+    bool                pop_client(ed::tcp_bio_client::pointer_t & client);
+
+    // implementation of runner
+    virtual void        run() override;
+
+private:
+    listener::pointer_t f_listener = listener::pointer_t();
+    secure_acceptor *   f_acceptor = nullptr;
+    mutable cppthread::mutex
+                        f_clients_mutex = cppthread::mutex();
+    std::deque<ed::tcp_bio_client::pointer_t>
+                        f_clients = std::deque<ed::tcp_bio_client::pointer_t>();
+};
+
+
+
+secure_accept_runner::secure_accept_runner(
+          listener::pointer_t l
+        , secure_acceptor * acceptor)
+    : runner("secure-acceptor")
+    , f_listener(l)
+    , f_acceptor(acceptor)
+{
+}
+
+
+bool secure_accept_runner::pop_client(ed::tcp_bio_client::pointer_t & client)
+{
+    cppthread::guard lock(f_clients_mutex);
+    if(f_clients.empty())
+    {
+        return false;
+    }
+    client = f_clients.front();
+    f_clients.pop_front();
+    return true;
+}
+
+
+void secure_accept_runner::run()
+{
+    int const s(f_listener->get_socket());
+    while(continue_running())
+    {
+        // wake up regularly to check whether we have to stop
+        //
+        struct pollfd fd = {};
+        fd.fd = s;
+        fd.events = POLLIN;
+        int const r(poll(&fd, 1, 100));
+        if(r <= 0)
+        {
+            continue;
+        }
+
+        // the handshake timeout of the listener (see
+        // listener::set_handshake_timeout()) makes sure a stalled client
+        // does not block the other clients or stop() forever
+        //
+        ed::tcp_bio_client::pointer_t new_client;
+        try
+        {
+            new_client = f_listener->accept();
+        }
+        catch(std::exception const & e)
+        {
+            SNAP_LOG_ERROR
+                << "accept() of a secure tcp connection threw: "
+                << e.what()
+                << SNAP_LOG_SEND;
+            continue;
+        }
+        if(new_client == nullptr)
+        {
+            SNAP_LOG_ERROR
+                << "accept() of a secure tcp connection failed: "
+                << listener::get_tls_errors()
+                << SNAP_LOG_SEND;
+            continue;
+        }
+
+        {
+            cppthread::guard lock(f_clients_mutex);
+            f_clients.push_back(new_client);
+        }
+        f_acceptor->thread_done();
+    }
+}
+
+
+
+} // namespace detail
+
+
+
+/** \class secure_acceptor
+ * \brief Accept the secure connections in a separate thread.
+ *
+ * This class is the main thread side of the secure acceptor. It gets
+ * woken up each time the thread accepted a new client and adds that
+ * client to the listener.
+ */
+
+
+/** \brief Initialize the secure acceptor.
+ *
+ * \param[in] l  The secure listener. It must not be added to the
+ * ed::communicator.
+ */
+secure_acceptor::secure_acceptor(listener::pointer_t l)
+    : f_listener(l)
+{
+    set_name("secure acceptor");
+}
+
+
+/** \brief Make sure the thread is stopped.
+ */
+secure_acceptor::~secure_acceptor()
+{
+    stop();
+}
+
+
+/** \brief Start the thread accepting connections.
+ *
+ * The secure_acceptor must be added to the ed::communicator before
+ * this function gets called.
+ */
+void secure_acceptor::start()
+{
+    if(f_thread != nullptr)
+    {
+        return;
+    }
+
+    f_runner = std::make_shared<detail::secure_accept_runner>(f_listener, this);
+    f_thread = std::make_shared<cppthread::thread>("secure-acceptor", f_runner);
+    f_thread->start();
+}
+
+
+/** \brief Stop the thread accepting connections.
+ *
+ * The clients accepted but not yet handed to the main thread are
+ * dropped. If a handshake is in progress, this function waits for it
+ * to end, which takes at most the handshake timeout.
+ */
+void secure_acceptor::stop()
+{
+    if(f_thread == nullptr)
+    {
+        return;
+    }
+
+    f_thread->stop();
+    f_thread.reset();
+    f_runner.reset();
+}
+
+
+/** \brief Add the clients accepted by the thread.
+ *
+ * This function runs in the main thread. It adds all the clients
+ * the thread accepted so far.
+ */
+void secure_acceptor::process_read()
+{
+    thread_done_signal::process_read();
+
+    if(f_runner == nullptr)
+    {
+        return;
+    }
+
+    ed::tcp_bio_client::pointer_t client;
+    while(f_runner->pop_client(client))
+    {
+        f_listener->add_client(client);
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,86 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Definition of the secure acceptor.
+ *
+ * The TLS handshake of a new connection on the secure listener happens
+ * in the accept() call. A slow remote peer would block the main loop
+ * and thus the delivery of all the local messages for that long. The
+ * secure acceptor runs the accept() calls in a separate thread and
+ * hands the new clients back to the main thread.
+ */
+
+// self
+//
+#include    "listener.h"
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/thread_done_signal.h>
+
+
+// cppthread
+//
+#include    <cppthread/runner.h>
+#include    <cppthread/thread.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace detail
+{
+class secure_accept_runner;
+typedef std::shared_ptr<secure_accept_runner>   secure_accept_runner_pointer_t;
+}
+
+
+class secure_acceptor
+    : public ed::thread_done_signal
+{
+public:
+    typedef std::shared_ptr<secure_acceptor>    pointer_t;
+
+                            secure_acceptor(listener::pointer_t l);
+                            secure_acceptor(secure_acceptor const &) = delete;
+    virtual                 ~secure_acceptor() override;
+    secure_acceptor &       operator = (secure_acceptor const &) = delete;
+
+    void                    start();
+    void                    stop();
+
+    // ed::thread_done_signal
+    virtual void            process_read() override;
+
+private:
+    listener::pointer_t             f_listener = listener::pointer_t();
+    detail::secure_accept_runner_pointer_t
+                                    f_runner = detail::secure_accept_runner_pointer_t();
+    cppthread::thread::pointer_t    f_thread = cppthread::thread::pointer_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -32,17 +32,30 @@
 //
 #include    "server.h"
 
+#include    "activated_listener.h"
+#include    "bloom_filter.h"
+#include    "cache_timer.h"
+#include    "flag_watcher.h"
+#include    "flush_timer.h"
 #include    "gossip_connection.h"
+#include    "heartbeat_timer.h"
 #include    "interrupt.h"
 #include    "listener.h"
 #include    "load_timer.h"
+#include    "metrics_listener.h"
+#include    "overload_timer.h"
 #include    "ping.h"
+#include    "rate_limit_timer.h"
 #include    "remote_connection.h"
 #include    "remote_communicators.h"
+#include    "secure_acceptor.h"
 #include    "service_connection.h"
+#include    "shm_listener.h"
 #include    "stable_clock.h"
+#include    "startup_timer.h"
 #include    "unix_connection.h"
 #include    "unix_listener.h"
+#include    "wire_format.h"
 
 
 // communicatord
@@ -107,7 +120,16 @@
 
 // C++
 //
+#include    <algorithm>
+#include    <charconv>
 #include    <cmath>
+#include    <cstring>
+#include    <functional>
+#include    <iomanip>
+#include    <map>
+#include    <optional>
+#include    <random>
+#include    <sstream>
 #include    <thread>
 
 
@@ -115,6 +137,7 @@
 //
 #include    <grp.h>
 #include    <pwd.h>
+#include    <sys/socket.h>
 
 
 // last include
@@ -158,10 +181,152 @@ char const *        g_status_filename = "/var/lib/communicatord/cluster-status.t
 int64_t             g_broadcast_sequence = 0;
 
 
+/** \brief Serialize a message once for many connections.
+ *
+ * When the same message is sent to many connections, converting it to
+ * a string for each connection is a waste. This class converts the
+ * message the first time it gets sent and then sends that same buffer
+ * to all the other connections.
+ *
+ * \warning
+ * The message must not be modified while this object exists.
+ */
+class serialized_message
+{
+public:
+    serialized_message(ed::message & msg)
+        : f_message(msg)
+    {
+    }
+
+    bool send(base_connection::pointer_t const & conn)
+    {
+        // peers supporting the wire format get the packed version
+        // (compressed or not depending on the link)
+        //
+        if(conn->has_capability(communicatord::g_name_communicatord_value_wire_format))
+        {
+            int const level(conn->get_compression_level());
+            std::size_t const threshold(conn->get_compression_threshold());
+            std::string & wire_serialized(f_wire_serialized[wire_key_t(level, threshold)]);
+            if(wire_serialized.empty())
+            {
+                ed::message wire;
+                if(encode_wire_message(f_message, wire, level, threshold))
+                {
+                    wire_serialized = wire.to_message();
+                }
+                if(wire_serialized.empty())
+                {
+                    // not worth it or it failed, use the text version
+                    //
+                    wire_serialized = "-";
+                }
+                else
+                {
+                    wire_serialized += '\n';
+                }
+            }
+            if(wire_serialized != "-")
+            {
+                return conn->send_serialized_message(f_message, wire_serialized);
+            }
+        }
+
+        if(f_serialized.empty())
+        {
+            f_serialized = f_message.to_message();
+            if(f_serialized.empty())
+            {
+                return conn->send_message_to_connection(f_message);
+            }
+            f_serialized += '\n';
+        }
+        return conn->send_serialized_message(f_message, f_serialized);
+    }
+
+private:
+    typedef std::pair<int, std::size_t>         wire_key_t;     // compression level and threshold
+
+    ed::message &       f_message;
+    std::string         f_serialized = std::string();
+    std::map<wire_key_t, std::string>
+                        f_wire_serialized = std::map<wire_key_t, std::string>();
+};
+
+
 
 
 const advgetopt::option g_options[] =
 {
+    advgetopt::define_option(
+          advgetopt::Name("anycast-services")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("comma separated list of services running on several computers and expecting each message to be delivered to only one of them.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("broadcast-interest")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("true")
+        , advgetopt::Help("whether to skip remote communicators which advertised that nobody on or behind them understands a broadcast message (true or false).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("cache-journal")
+        , advgetopt::Flags(advgetopt::standalone_all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("save the messages cached for local services in a journal under the --data-path so they survive a restart.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("cache-max-bytes")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("16777216")
+        , advgetopt::Help("maximum number of bytes used by messages cached while waiting for their local service to register (0 for no limit).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("cache-max-messages")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("10000")
+        , advgetopt::Help("maximum number of messages cached while waiting for their local service to register (0 for no limit).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("cache-max-service-bytes")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1048576")
+        , advgetopt::Help("maximum number of bytes cached for one service (0 for no limit).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("cache-max-service-messages")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1000")
+        , advgetopt::Help("maximum number of messages cached for one service (0 for no limit).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("capture-file")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("save each message dispatched by the communicator in this capture file so it can be replayed with `message --replay`.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("capture-max-bytes")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1073741824")
+        , advgetopt::Help("maximum size of the --capture-file; further messages are not captured (0 for no limit).")
+    ),
     advgetopt::define_option(
           advgetopt::Name("certificate")
         , advgetopt::Flags(advgetopt::all_flags<
@@ -188,6 +353,23 @@ const advgetopt::option g_options[] =
         , advgetopt::Help("verify the incoming messages (as per the COMMAND message).")
 #endif
     ),
+    advgetopt::define_option(
+          advgetopt::Name("gateway")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("auto")
+        , advgetopt::Help("whether this communicatord relays the messages of its site to the other sites in hierarchical mode: \"auto\" (may get elected), \"always\" or \"never\".")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("gateway-count")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("0")
+        , advgetopt::Validator("integer(0...16)")
+        , advgetopt::Help("number of gateways elected per site; only the gateways send messages to the other sites (0 to turn off the hierarchical mode).")
+    ),
     advgetopt::define_option(
           advgetopt::Name("group-name")
         , advgetopt::Flags(advgetopt::all_flags<
@@ -196,6 +378,64 @@ const advgetopt::option g_options[] =
         , advgetopt::DefaultValue("communicatord")
         , advgetopt::Help("drop privileges to this group.")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("heartbeat-interval")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1")
+        , advgetopt::Validator("duration")
+        , advgetopt::Help("number of seconds between two HEARTBEAT messages sent to the other communicators (0 to turn off the failure detection).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("io-threads")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("0")
+        , advgetopt::Validator("integer(0...256)")
+        , advgetopt::Help("number of threads reading, parsing and writing the local service connections (0 to do it all in the main thread).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("link-batch-bytes")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("65536")
+        , advgetopt::Help("number of bytes written to a link to another communicatord before the batch is sent.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("link-batch-delay")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("500")
+        , advgetopt::Help("number of microseconds messages sent to another communicatord get batched before being sent (0 to turn off batching).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("link-compression")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("public")
+        , advgetopt::Help("compress the messages sent to other communicatord's: \"none\", \"public\" (links over public networks) or \"all\".")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("link-compression-level")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("3")
+        , advgetopt::Help("zstd compression level used on compressed links (1 to 19).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("link-compression-threshold")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1024")
+        , advgetopt::Help("messages with fewer bytes of packed parameters are not compressed.")
+    ),
     advgetopt::define_option(
           advgetopt::Name("local-listen")
         , advgetopt::Flags(advgetopt::all_flags<
@@ -204,6 +444,24 @@ const advgetopt::option g_options[] =
         , advgetopt::DefaultValue("127.0.0.1:4040")
         , advgetopt::Help("<IP:port> to open a local TCP connection (no encryption).")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("load-sample-interval")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1")
+        , advgetopt::Validator("duration")
+        , advgetopt::Help("number of seconds between two samples of the load of this computer.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("load-score-half-life")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("5")
+        , advgetopt::Validator("duration")
+        , advgetopt::Help("number of seconds after which a change in load counts for half of the load score.")
+    ),
     advgetopt::define_option(
           advgetopt::Name("max-connections")
         , advgetopt::Flags(advgetopt::all_flags<
@@ -212,6 +470,14 @@ const advgetopt::option g_options[] =
         , advgetopt::DefaultValue("100")
         , advgetopt::Help("maximum number of connections allowed by this communicatord.")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("max-connections-per-address")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("10")
+        , advgetopt::Help("maximum number of remote and secure connections accepted from the same IP address (0 for no limit).")
+    ),
     advgetopt::define_option(
           advgetopt::Name("max-gossip-timeout")
         , advgetopt::Flags(advgetopt::all_flags<
@@ -221,6 +487,14 @@ const advgetopt::option g_options[] =
         , advgetopt::Validator("duration")
         , advgetopt::Help("maximum number of seconds to wait between GOSSIP messages.")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("max-local-connections")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1000")
+        , advgetopt::Help("maximum number of connections accepted on the local and Unix listeners (0 for no limit).")
+    ),
     advgetopt::define_option(
           advgetopt::Name("max-pending-connections")
         , advgetopt::Flags(advgetopt::all_flags<
@@ -229,6 +503,53 @@ const advgetopt::option g_options[] =
         , advgetopt::DefaultValue("25")
         , advgetopt::Help("maximum number of client connections waiting to be accepted.")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("max-remote-connections")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("100")
+        , advgetopt::Help("maximum number of connections accepted on the plain remote listener (0 for no limit).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("max-secure-connections")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("100")
+        , advgetopt::Help("maximum number of connections accepted on the secure listener (0 for no limit).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("message-definitions")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("/usr/share/eventdispatcher/messages")
+        , advgetopt::Help("a colon separated list of directories with the message definitions used to validate the messages.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("message-validation")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("count")
+        , advgetopt::Help("what to do with messages which do not match their definition: \"off\", \"count\" or \"reject\".")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("message-validation-commands")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("a comma separated list of <command>=off|count|reject to change the message validation of specific commands.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("metrics-listen")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("/run/communicatord/communicatord-metrics.sock")
+        , advgetopt::Help("a path to a Unix socket returning the metrics in the Prometheus text format (empty to turn off).")
+    ),
     advgetopt::define_option(
           advgetopt::Name("my-address")
         , advgetopt::Flags(advgetopt::all_flags<
@@ -245,123 +566,328 @@ const advgetopt::option g_options[] =
         , advgetopt::Help("define a comma separated list of communicatord neighbors.")
     ),
     advgetopt::define_option(
-          advgetopt::Name("private-key")
+          advgetopt::Name("output-high-watermark-bytes")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::DefaultValue("")
-        , advgetopt::Help("private key for --secure-listen connections.")
+        , advgetopt::DefaultValue("4194304")
+        , advgetopt::Help("number of bytes waiting to be read by a local service at which point it is viewed as a slow consumer (0 for no limit).")
     ),
     advgetopt::define_option(
-          advgetopt::Name("remote-listen")
+          advgetopt::Name("output-high-watermark-messages")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::Help("<IP:port> to open a remote TCP connection (no encryption). If 127.0.0.1, ignore (no remote access).")
+        , advgetopt::DefaultValue("10000")
+        , advgetopt::Help("number of messages waiting to be read by a local service at which point it is viewed as a slow consumer (0 for no limit).")
     ),
     advgetopt::define_option(
-          advgetopt::Name("secure-listen")
+          advgetopt::Name("output-low-watermark-bytes")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::Help("<user:password>@<IP:port> to open a remote TCP connection (with encryption, requires the --certificate & --private-key).")
+        , advgetopt::DefaultValue("1048576")
+        , advgetopt::Help("number of bytes under which a slow consumer recovers.")
     ),
     advgetopt::define_option(
-          advgetopt::Name("server-name")
+          advgetopt::Name("output-low-watermark-messages")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::Help("name of this server, defaults to `hostname` if undefined here.")
+        , advgetopt::DefaultValue("2500")
+        , advgetopt::Help("number of messages under which a slow consumer recovers.")
     ),
     advgetopt::define_option(
-          advgetopt::Name("services")
+          advgetopt::Name("overlay-long-links")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::DefaultValue("/usr/share/communicatord/services")
-        , advgetopt::Help("path to the list of service files.")
+        , advgetopt::DefaultValue("2")
+        , advgetopt::Help("number of random communicators to connect with in overlay mode.")
     ),
     advgetopt::define_option(
-          advgetopt::Name("signal")
+          advgetopt::Name("overlay-peers")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::DefaultValue("127.0.0.1:4041")
-        , advgetopt::Help("an address accepting UDP messages (signals); these messages do not get acknowledged.")
+        , advgetopt::DefaultValue("0")
+        , advgetopt::Help("number of nearest communicators to connect with (0 to connect with all of them, a full mesh).")
     ),
     advgetopt::define_option(
-          advgetopt::Name("signal-secret")
+          advgetopt::Name("overload-max-loop-lag")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::Help("a secret key used to verify that UDP packets are acceptable.")
+        , advgetopt::DefaultValue("0.25")
+        , advgetopt::Validator("duration")
+        , advgetopt::Help("how late the event loop can be before remote CONNECTs and non-critical broadcasts get shed (0 to ignore the lag).")
     ),
     advgetopt::define_option(
-          advgetopt::Name("unix-group")
+          advgetopt::Name("overload-max-queue-depth")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::DefaultValue("communicator-group")
-        , advgetopt::Help("the group to assign to this Unix socket.")
+        , advgetopt::DefaultValue("50000")
+        , advgetopt::Help("number of messages waiting in the output queues before remote CONNECTs and non-critical broadcasts get shed (0 to ignore the queues).")
     ),
     advgetopt::define_option(
-          advgetopt::Name("unix-listen")
+          advgetopt::Name("phi-down-threshold")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::DefaultValue("/run/communicatord/communicatord.sock")
-        , advgetopt::Help("a Unix socket name to listen for local connections.")
+        , advgetopt::DefaultValue("10")
+        , advgetopt::Validator("integer(1...100)")
+        , advgetopt::Help("suspicion level (phi) at which a silent remote communicator is considered down and disconnected.")
     ),
     advgetopt::define_option(
-          advgetopt::Name("user-name")
+          advgetopt::Name("phi-suspect-threshold")
         , advgetopt::Flags(advgetopt::all_flags<
               advgetopt::GETOPT_FLAG_REQUIRED
             , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
-        , advgetopt::DefaultValue("communicatord")
-        , advgetopt::Help("drop privileges to this user.")
+        , advgetopt::DefaultValue("5")
+        , advgetopt::Validator("integer(1...100)")
+        , advgetopt::Help("suspicion level (phi) at which a silent remote communicator is reported as suspect.")
     ),
-    advgetopt::end_options()
-};
-
-advgetopt::group_description const g_group_descriptions[] =
-{
-    advgetopt::define_group(
-          advgetopt::GroupNumber(advgetopt::GETOPT_FLAG_GROUP_COMMANDS)
-        , advgetopt::GroupName("command")
-        , advgetopt::GroupDescription("Commands:")
+    advgetopt::define_option(
+          advgetopt::Name("private-key")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("")
+        , advgetopt::Help("private key for --secure-listen connections.")
     ),
-    advgetopt::define_group(
-          advgetopt::GroupNumber(advgetopt::GETOPT_FLAG_GROUP_OPTIONS)
-        , advgetopt::GroupName("option")
-        , advgetopt::GroupDescription("Options:")
+    advgetopt::define_option(
+          advgetopt::Name("ramp-up-concurrency")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("16")
+        , advgetopt::Help("maximum number of connection attempts started in parallel on startup (0 for no limit).")
     ),
-    advgetopt::end_groups()
-};
-
-constexpr char const * const g_configuration_files[] =
-{
-    "/etc/communicatord/communicatord.conf",
-    nullptr
-};
-
-// TODO: once we have stdc++20, remove all defaults & pragma
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wpedantic"
-advgetopt::options_environment const g_options_environment =
-{
-    .f_project_name = "communicatord",
-    .f_group_name = "communicatord",
-    .f_options = g_options,
-    .f_options_files_directory = nullptr,
-    .f_environment_variable_name = "COMMUNICATORD",
-    .f_environment_variable_intro = nullptr,
-    .f_section_variables_name = nullptr,
-    .f_configuration_files = g_configuration_files,
-    .f_configuration_filename = nullptr,
-    .f_configuration_directories = nullptr,
-    .f_environment_flags = advgetopt::GETOPT_ENVIRONMENT_FLAG_PROCESS_SYSTEM_PARAMETERS,
-    .f_help_header = "Usage: %p [-<opt>]\n"
-                     "where -<opt> is one or more of:",
+    advgetopt::define_option(
+          advgetopt::Name("ramp-up-duration")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("60")
+        , advgetopt::Validator("duration")
+        , advgetopt::Help("number of seconds during which connections are attempted in parallel with short retries on startup (0 to disable).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("rate-limit-action")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("drop")
+        , advgetopt::Help("what to do with messages received over their rate limit: \"drop\", \"delay\" or \"throttle\".")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("rate-limit-delay-messages")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1000")
+        , advgetopt::Validator("integer(1...1000000)")
+        , advgetopt::Help("maximum number of messages delayed per connection when the --rate-limit-action is \"delay\"; further messages are dropped.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("rate-limits")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("a comma separated list of service:<name>=<rate>[/<burst>], type:unix|tcp|udp|remote=<rate>[/<burst>] or command:<name>=<rate>[/<burst>] limiting the number of messages per second received on each connection.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("reliable-buffer-messages")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1000")
+        , advgetopt::Validator("integer(1...1000000)")
+        , advgetopt::Help("maximum number of reliable messages kept per remote communicator until it acknowledges them.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("remote-listen")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("<IP:port> to open a remote TCP connection (no encryption). If 127.0.0.1, ignore (no remote access).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("save-delay")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1000")
+        , advgetopt::Validator("integer(0...60000)")
+        , advgetopt::Help("number of milliseconds to wait for more changes before saving the list of neighbors to disk.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("secure-accept-thread")
+        , advgetopt::Flags(advgetopt::standalone_all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("accept the --secure-listen connections, including their TLS handshake, in a separate thread.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("secure-handshake-timeout")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("5")
+        , advgetopt::Validator("duration")
+        , advgetopt::Help("maximum number of seconds a TLS handshake of a --secure-listen connection can take (0 to wait forever).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("secure-listen")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("<user:password>@<IP:port> to open a remote TCP connection (with encryption, requires the --certificate & --private-key).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("server-name")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("name of this server, defaults to `hostname` if undefined here.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("services")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("/usr/share/communicatord/services")
+        , advgetopt::Help("path to the list of service files.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("shm-listen")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("/run/communicatord/communicatord-shm.sock")
+        , advgetopt::Help("a path to a Unix socket used by the \"cdm:\" services to retrieve their shared memory channel (empty to turn off).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("shm-ring-size")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("1048576")
+        , advgetopt::Help("size in bytes of each one of the two rings of a shared memory channel.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("signal")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("127.0.0.1:4041")
+        , advgetopt::Help("an address accepting UDP messages (signals); these messages do not get acknowledged.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("signal-receive-buffer")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("0")
+        , advgetopt::Help("size in bytes of the receive buffer of the --signal UDP socket (0 to use the system default).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("signal-secret")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::Help("a secret key used to verify that UDP packets are acceptable.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("slow-consumer-policy")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("drop")
+        , advgetopt::Help("what to do with the messages sent to a slow consumer: \"drop\" them or \"disconnect\" the service.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("slow-dispatch-threshold")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("100")
+        , advgetopt::Help("log a warning when dispatching a message takes this number of milliseconds or more (0 to turn off).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("trace-sample-rate")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("0")
+        , advgetopt::Help("trace one out of that many messages sent by the local services (0 to turn off).")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("unix-group")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("communicator-group")
+        , advgetopt::Help("the group to assign to this Unix socket.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("unix-listen")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("/run/communicatord/communicatord.sock")
+        , advgetopt::Help("a Unix socket name to listen for local connections.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("user-name")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_GROUP_OPTIONS>())
+        , advgetopt::DefaultValue("communicatord")
+        , advgetopt::Help("drop privileges to this user.")
+    ),
+    advgetopt::end_options()
+};
+
+advgetopt::group_description const g_group_descriptions[] =
+{
+    advgetopt::define_group(
+          advgetopt::GroupNumber(advgetopt::GETOPT_FLAG_GROUP_COMMANDS)
+        , advgetopt::GroupName("command")
+        , advgetopt::GroupDescription("Commands:")
+    ),
+    advgetopt::define_group(
+          advgetopt::GroupNumber(advgetopt::GETOPT_FLAG_GROUP_OPTIONS)
+        , advgetopt::GroupName("option")
+        , advgetopt::GroupDescription("Options:")
+    ),
+    advgetopt::end_groups()
+};
+
+constexpr char const * const g_configuration_files[] =
+{
+    "/etc/communicatord/communicatord.conf",
+    nullptr
+};
+
+// TODO: once we have stdc++20, remove all defaults & pragma
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+advgetopt::options_environment const g_options_environment =
+{
+    .f_project_name = "communicatord",
+    .f_group_name = "communicatord",
+    .f_options = g_options,
+    .f_options_files_directory = nullptr,
+    .f_environment_variable_name = "COMMUNICATORD",
+    .f_environment_variable_intro = nullptr,
+    .f_section_variables_name = nullptr,
+    .f_configuration_files = g_configuration_files,
+    .f_configuration_filename = nullptr,
+    .f_configuration_directories = nullptr,
+    .f_environment_flags = advgetopt::GETOPT_ENVIRONMENT_FLAG_PROCESS_SYSTEM_PARAMETERS,
+    .f_help_header = "Usage: %p [-<opt>]\n"
+                     "where -<opt> is one or more of:",
     .f_help_footer = "%c",
     .f_version = COMMUNICATORD_VERSION_STRING,
     .f_license = "GPL v2 or newer",
@@ -429,26 +955,39 @@ server::server(int argc, char * argv[])
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_accept, &server::msg_accept),
         // default in dispatcher: ALIVE
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_clock_status, &server::msg_clock_status),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_cluster_get_status, &server::msg_cluster_get_status),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_cluster_status, &server::msg_cluster_status),
         DISPATCHER_MATCH(ed::g_name_ed_cmd_commands, &server::msg_commands),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_connect, &server::msg_connect),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_disconnect, &server::msg_disconnect),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_flag_down, &server::msg_flag_change),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_flag_up, &server::msg_flag_change),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_flags, &server::msg_flags),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_forget, &server::msg_forget),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_gateway, &server::msg_gateway),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_gossip, &server::msg_gossip),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_heard_of, &server::msg_heard_of),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_heartbeat, &server::msg_heartbeat),
         // default in dispatcher: HELP
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_interest, &server::msg_interest),
         // default in dispatcher: LEAK
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_listen_flags, &server::msg_listen_flags),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_listen_loadavg, &server::msg_listen_loadavg),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_list_services, &server::msg_list_services),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_loadavg, &server::msg_save_loadavg),
         // default in dispatcher: LOG_ROTATE
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_metrics, &server::msg_metrics),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_public_ip, &server::msg_public_ip),
         // default in dispatcher: QUITTING -- the default is not valid for us, we have it overridden, but no need to do anything here
         // default in dispatcher: READY
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_refuse, &server::msg_refuse),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_register, &server::msg_register),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_register_for_flags, &server::msg_register_for_flags),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_register_for_loadavg, &server::msg_register_for_loadavg),
         // default in dispatcher: RESTART
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_service_status, &server::msg_service_status),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_shm_active, &server::msg_shm_active),
+        DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_shm_request, &server::msg_shm_request),
         // default in dispatcher: SERVICE_UNAVAILABLE
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_shutdown, &server::msg_shutdown),
         DISPATCHER_MATCH(communicatord::g_name_communicatord_cmd_unregister, &server::msg_unregister),
@@ -485,6 +1024,8 @@ server::~server()
  */
 int server::init()
 {
+    f_startup_time = std::chrono::steady_clock::now();
+
     // keep a copy of the server name handy
     //
     if(f_opts.is_defined("server-name"))
@@ -525,59 +1066,282 @@ int server::init()
 
     f_number_of_processors = std::max(1U, std::thread::hardware_concurrency());
 
+    // the load sampler keeps the /proc files open
+    //
+    f_load_sampler = std::make_shared<load_sampler>(f_number_of_processors);
+    if(!f_load_sampler->open())
+    {
+        SNAP_LOG_ERROR
+            << "error opening file \"/proc/loadavg\"."
+            << SNAP_LOG_SEND;
+    }
+    double half_life(0.0);
+    if(advgetopt::validator_duration::convert_string(
+                  f_opts.get_string("load-score-half-life")
+                , advgetopt::validator_duration::VALIDATOR_DURATION_DEFAULT_FLAGS
+                , half_life))
+    {
+        f_load_sampler->set_half_life(half_life);
+    }
+    double interval(0.0);
+    if(advgetopt::validator_duration::convert_string(
+                  f_opts.get_string("load-sample-interval")
+                , advgetopt::validator_duration::VALIDATOR_DURATION_DEFAULT_FLAGS
+                , interval)
+    && interval >= 0.1)
+    {
+        f_load_sample_interval = interval;
+    }
+
     // check a user defined maximum number of connections
     // by default this is set to COMMUNICATORD_MAX_CONNECTIONS,
     // which at this time is 100
     //
     f_max_connections = f_opts.get_long("max-connections");
 
-    communicatord::set_loadavg_path(f_opts.get_string("data-path"));
-
-    // read the list of available services
+    // budgets of the connections accepted by each type of listener
+    //
+    f_admission_control = std::make_shared<admission_control>();
+    f_admission_control->set_limit(
+              admission_budget_t::ADMISSION_BUDGET_LOCAL
+            , f_opts.get_long("max-local-connections"));
+    f_admission_control->set_limit(
+              admission_budget_t::ADMISSION_BUDGET_REMOTE
+            , f_opts.get_long("max-remote-connections"));
+    f_admission_control->set_limit(
+              admission_budget_t::ADMISSION_BUDGET_SECURE
+            , f_opts.get_long("max-secure-connections"));
+    f_admission_control->set_address_limit(f_opts.get_long("max-connections-per-address"));
+
+    // limits defining an overload of the event loop
     //
+    double max_loop_lag(0.0);
+    if(!advgetopt::validator_duration::convert_string(
+                  f_opts.get_string("overload-max-loop-lag")
+                , advgetopt::validator_duration::VALIDATOR_DURATION_DEFAULT_FLAGS
+                , max_loop_lag))
     {
-        std::string path_to_services(f_opts.get_string("services"));
-        path_to_services += "/*.service";
-        typedef std::set<std::string> service_files_t;
-        snapdev::glob_to_list<service_files_t> dir;
-        if(dir.read_path<snapdev::glob_to_list_flag_t::GLOB_FLAG_NO_ESCAPE>(path_to_services))
-        {
-            // we have some local services (note that communicatord is
-            // not added as a local service)
-            //
-            // at the moment we do not load those files, these could include
-            // data such as the service description
-            //
-            for(auto const & p : dir)
-            {
-                std::string const service_name(snapdev::pathinfo::basename(p, ".service"));
-                f_local_services_list.insert(service_name);
+        SNAP_LOG_ERROR
+            << "invalid --overload-max-loop-lag \""
+            << f_opts.get_string("overload-max-loop-lag")
+            << "\"; the event loop lag is ignored."
+            << SNAP_LOG_SEND;
+        max_loop_lag = 0.0;
+    }
+    f_overload.set_limits(
+              static_cast<std::int64_t>(max_loop_lag * 1'000'000.0)
+            , f_opts.get_long("overload-max-queue-depth"));
 
-                SNAP_LOG_DEBUG
-                    << "Known local service: \""
-                    << service_name
-                    << "\"."
-                    << SNAP_LOG_SEND;
-            }
-        }
-        else
+    // limits of the cache of messages sent to local services which
+    // are not yet registered
+    //
+    f_local_message_cache.set_limits(
+              f_opts.get_long("cache-max-messages")
+            , f_opts.get_long("cache-max-bytes")
+            , f_opts.get_long("cache-max-service-messages")
+            , f_opts.get_long("cache-max-service-bytes"));
+
+    // batching of the messages sent to other communicators
+    //
+    f_link_batch_delay = f_opts.get_long("link-batch-delay");
+    f_slow_dispatch_threshold = f_opts.get_long("slow-dispatch-threshold") * 1000;
+    f_trace_sample_rate = f_opts.get_long("trace-sample-rate");
+
+    f_link_batch_bytes = f_opts.get_long("link-batch-bytes");
+
+    // compression of the messages sent to other communicators
+    //
+    std::string const link_compression(f_opts.get_string("link-compression"));
+    if(link_compression == "none")
+    {
+        f_link_compression = link_compression_t::LINK_COMPRESSION_NONE;
+    }
+    else if(link_compression == "all")
+    {
+        f_link_compression = link_compression_t::LINK_COMPRESSION_ALL;
+    }
+    else
+    {
+        if(link_compression != "public")
         {
-            SNAP_LOG_ERROR
-                << "search of services failed: "
-                << dir.get_last_error_message()
+            SNAP_LOG_CONFIGURATION
+                << "unknown --link-compression \""
+                << link_compression
+                << "\", using \"public\" instead."
                 << SNAP_LOG_SEND;
         }
+        f_link_compression = link_compression_t::LINK_COMPRESSION_PUBLIC;
+    }
+    f_link_compression_level = std::clamp(static_cast<int>(f_opts.get_long("link-compression-level")), 1, 19);
+    f_link_compression_threshold = f_opts.get_long("link-compression-threshold");
 
-        // the list of local services cannot (currently) change while
-        // communicatord is running so generate the corresponding
-        // string once
-        //
-        f_local_services = snapdev::join_strings(f_local_services_list, ",");
+    // limits of the output queue of local services
+    //
+    f_output_high_bytes = f_opts.get_long("output-high-watermark-bytes");
+    f_output_high_messages = f_opts.get_long("output-high-watermark-messages");
+    f_output_low_bytes = f_opts.get_long("output-low-watermark-bytes");
+    f_output_low_messages = f_opts.get_long("output-low-watermark-messages");
+    std::string const slow_consumer_policy(f_opts.get_string("slow-consumer-policy"));
+    if(!parse_slow_consumer_policy(slow_consumer_policy, f_slow_consumer_policy))
+    {
+        SNAP_LOG_CONFIGURATION
+            << "unknown --slow-consumer-policy \""
+            << slow_consumer_policy
+            << "\", using \"drop\" instead."
+            << SNAP_LOG_SEND;
     }
 
-    f_communicator = ed::communicator::instance();
+    // services running on several computers which expect each message
+    // to be delivered to only one of them
+    //
+    if(f_opts.is_defined("anycast-services"))
+    {
+        f_anycast_services = canonicalize_services(f_opts.get_string("anycast-services"));
+    }
 
-    // capture Ctrl-C (SIGINT)
+    // we always advertise our interests, but may still send all the
+    // broadcasts to all the remote communicators
+    //
+    std::string const broadcast_interest(f_opts.get_string("broadcast-interest"));
+    f_broadcast_interest = broadcast_interest != "false";
+    if(f_broadcast_interest
+    && broadcast_interest != "true")
+    {
+        SNAP_LOG_CONFIGURATION
+            << "unknown --broadcast-interest \""
+            << broadcast_interest
+            << "\", using \"true\" instead."
+            << SNAP_LOG_SEND;
+    }
+
+    // the remote communicators send each other a HEARTBEAT to detect
+    // silent failures (i.e. a network partition)
+    //
+    double heartbeat_interval(0.0);
+    if(advgetopt::validator_duration::convert_string(
+                  f_opts.get_string("heartbeat-interval")
+                , advgetopt::validator_duration::VALIDATOR_DURATION_DEFAULT_FLAGS
+                , heartbeat_interval))
+    {
+        f_heartbeat_interval = heartbeat_interval <= 0.0
+                    ? 0
+                    : std::max(static_cast<std::int64_t>(heartbeat_interval * 1'000'000.0), static_cast<std::int64_t>(100'000));
+    }
+    f_phi_suspect_threshold = static_cast<double>(f_opts.get_long("phi-suspect-threshold"));
+    f_phi_down_threshold = static_cast<double>(f_opts.get_long("phi-down-threshold"));
+
+    // reliable messages get a sequence number which is only valid
+    // until we restart
+    //
+    f_reliable_max_messages = f_opts.get_long("reliable-buffer-messages");
+    f_reliable_session = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+
+    // in hierarchical mode, only the gateways of each site send
+    // messages to the other sites
+    //
+    f_gateway_count = f_opts.get_long("gateway-count");
+    if(!parse_gateway_mode(f_opts.get_string("gateway"), f_gateway_mode))
+    {
+        SNAP_LOG_CONFIGURATION
+            << "unknown --gateway \""
+            << f_opts.get_string("gateway")
+            << "\", using \"auto\" instead."
+            << SNAP_LOG_SEND;
+        f_gateway_mode = gateway_mode_t::GATEWAY_MODE_AUTO;
+    }
+
+    // limit the number of messages each connection can send us so one
+    // service cannot take all the time of the event loop
+    //
+    if(f_opts.is_defined("rate-limits")
+    && !f_rate_limits.set_rules(f_opts.get_string("rate-limits")))
+    {
+        SNAP_LOG_CONFIGURATION
+            << "some of the --rate-limits \""
+            << f_opts.get_string("rate-limits")
+            << "\" are not valid and were ignored."
+            << SNAP_LOG_SEND;
+    }
+    if(!parse_rate_limit_action(f_opts.get_string("rate-limit-action"), f_rate_limit_action))
+    {
+        SNAP_LOG_CONFIGURATION
+            << "unknown --rate-limit-action \""
+            << f_opts.get_string("rate-limit-action")
+            << "\", using \"drop\" instead."
+            << SNAP_LOG_SEND;
+        f_rate_limit_action = rate_limit_action_t::RATE_LIMIT_ACTION_DROP;
+    }
+    f_rate_limit_delay_messages = f_opts.get_long("rate-limit-delay-messages");
+
+    // optional features we support when talking to other communicators
+    //
+    if(f_gateway_count > 0)
+    {
+        f_capabilities.insert(communicatord::g_name_communicatord_value_gateway);
+    }
+    f_capabilities.insert(communicatord::g_name_communicatord_value_heard_of_updates);
+    if(f_heartbeat_interval > 0)
+    {
+        f_capabilities.insert(communicatord::g_name_communicatord_value_heartbeat);
+    }
+    f_capabilities.insert(communicatord::g_name_communicatord_value_informed_filter);
+    f_capabilities.insert(communicatord::g_name_communicatord_value_interest);
+    f_capabilities.insert(communicatord::g_name_communicatord_value_reliable);
+    f_capabilities.insert(communicatord::g_name_communicatord_value_wire_format);
+    if(f_link_compression != link_compression_t::LINK_COMPRESSION_NONE)
+    {
+        f_capabilities.insert(communicatord::g_name_communicatord_value_zstd);
+    }
+
+    communicatord::set_loadavg_path(f_opts.get_string("data-path"));
+
+    // read the list of available services
+    //
+    {
+        std::string path_to_services(f_opts.get_string("services"));
+        path_to_services += "/*.service";
+        typedef std::set<std::string> service_files_t;
+        snapdev::glob_to_list<service_files_t> dir;
+        if(dir.read_path<snapdev::glob_to_list_flag_t::GLOB_FLAG_NO_ESCAPE>(path_to_services))
+        {
+            // we have some local services (note that communicatord is
+            // not added as a local service)
+            //
+            // at the moment we do not load those files, these could include
+            // data such as the service description
+            //
+            for(auto const & p : dir)
+            {
+                std::string const service_name(snapdev::pathinfo::basename(p, ".service"));
+                f_local_services_list.insert(service_name);
+
+                SNAP_LOG_DEBUG
+                    << "Known local service: \""
+                    << service_name
+                    << "\"."
+                    << SNAP_LOG_SEND;
+            }
+        }
+        else
+        {
+            SNAP_LOG_ERROR
+                << "search of services failed: "
+                << dir.get_last_error_message()
+                << SNAP_LOG_SEND;
+        }
+
+        // the list of local services cannot (currently) change while
+        // communicatord is running so generate the corresponding
+        // string once
+        //
+        f_local_services = snapdev::join_strings(f_local_services_list, ",");
+        f_heard_of.set_local_services(f_local_services_list);
+    }
+
+    f_communicator = ed::communicator::instance();
+
+    // capture Ctrl-C (SIGINT)
     //
     ed::connection::pointer_t ctrl_c(std::make_shared<interrupt>(shared_from_this()));
     f_communicator->add_connection(ctrl_c);
@@ -586,6 +1350,36 @@ int server::init()
     ed::connection::pointer_t check_clock_status(std::make_shared<stable_clock>(shared_from_this()));
     f_communicator->add_connection(check_clock_status);
 
+    // keep the flags in memory and share them in a snapshot so tools
+    // do not have to parse each flag file each time
+    //
+    // the session changes each time we restart so listeners know that
+    // the flags version restarted too
+    //
+    {
+        std::random_device rd;
+        std::stringstream ss;
+        ss << std::hex;
+        for(int i(0); i < 2; ++i)
+        {
+            ss << std::setw(8) << std::setfill('0') << rd();
+        }
+        f_flags_session = ss.str();
+    }
+    f_flag_index = std::make_shared<communicatord::flag_index>();
+    if(f_flag_index->watch())
+    {
+        f_flag_watcher = std::make_shared<flag_watcher>(shared_from_this(), f_flag_index);
+        f_communicator->add_connection(f_flag_watcher);
+        f_flag_index->save_snapshot();
+    }
+    else
+    {
+        SNAP_LOG_WARNING
+            << "could not watch the flag files; tools will read each flag file instead of a snapshot."
+            << SNAP_LOG_SEND;
+    }
+
     int const max_pending_connections(f_opts.get_long("max-pending-connections"));
     if(max_pending_connections < 5
     || max_pending_connections > 1000)
@@ -612,6 +1406,21 @@ int server::init()
     // * TCP secure (optional) -- a public TCP/IP connection on the Internet
     //   to allow other communicatord servers to connect from anywhere
 
+    // I/O SHARDS
+    //
+    // the local and Unix connections get distributed between these
+    // threads as they get added (see add_connection())
+    {
+        long const io_threads(f_opts.get_long("io-threads"));
+        for(long idx(0); idx < io_threads; ++idx)
+        {
+            io_shard::pointer_t shard(std::make_shared<io_shard>(static_cast<int>(idx)));
+            f_communicator->add_connection(shard);
+            shard->start();
+            f_io_shards.push_back(shard);
+        }
+    }
+
     // TCP LOCAL
     {
         addr::addr local_listen(addr::string_to_addr(
@@ -661,19 +1470,79 @@ int server::init()
         unix_listen.set_mode(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
         unix_listen.set_group(f_opts.get_string("unix-group"));
 
-        f_unix_listener = std::make_shared<unix_listener>(
-                  shared_from_this()
-                , unix_listen
-                , max_pending_connections
-                , f_server_name);
+        // when started through communicatord.socket, systemd keeps the
+        // socket open between restarts and passes it to us
+        //
+        snapdev::raii_fd_t activated(activated_listener::get_activated_socket(f_opts.get_string("unix-listen")));
+        if(activated != nullptr)
+        {
+            f_unix_listener = std::make_shared<activated_listener>(
+                      shared_from_this()
+                    , std::move(activated)
+                    , f_server_name);
+        }
+        else
+        {
+            f_unix_listener = std::make_shared<unix_listener>(
+                      shared_from_this()
+                    , unix_listen
+                    , max_pending_connections
+                    , f_server_name);
+        }
         f_unix_listener->set_name("communicator unix listener");
         f_communicator->add_connection(f_unix_listener);
 
         SNAP_LOG_CONFIGURATION
             << "listening to Unix socket \""
             << unix_listen.to_string()
-            << "\"."
+            << (std::dynamic_pointer_cast<activated_listener>(f_unix_listener) != nullptr
+                    ? "\" (socket activation)."
+                    : "\".")
             << SNAP_LOG_SEND;
+
+        // the "cdm:" services retrieve their shared memory channel
+        // through this other socket
+        //
+        std::string const shm_path(f_opts.get_string("shm-listen"));
+        if(!shm_path.empty())
+        {
+            addr::addr_unix shm_listen(shm_path);
+            shm_listen.set_scheme(communicatord::g_name_communicatord_scheme_cdm);
+            shm_listen.set_mode(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+            shm_listen.set_group(f_opts.get_string("unix-group"));
+
+            f_shm_listener = std::make_shared<shm_listener>(
+                      shared_from_this()
+                    , shm_listen
+                    , max_pending_connections);
+            f_shm_listener->set_name("communicator shm listener");
+            f_communicator->add_connection(f_shm_listener);
+            f_shm_path = shm_path;
+            f_shm_ring_size = f_opts.get_long("shm-ring-size");
+        }
+
+        // monitoring agents retrieve the metrics through this socket
+        //
+        std::string const metrics_path(f_opts.get_string("metrics-listen"));
+        if(!metrics_path.empty())
+        {
+            addr::addr_unix metrics_listen(metrics_path);
+            metrics_listen.set_mode(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+            metrics_listen.set_group(f_opts.get_string("unix-group"));
+
+            f_metrics_listener = std::make_shared<metrics_listener>(
+                      shared_from_this()
+                    , metrics_listen
+                    , max_pending_connections);
+            f_metrics_listener->set_name("communicator metrics listener");
+            f_communicator->add_connection(f_metrics_listener);
+
+            SNAP_LOG_CONFIGURATION
+                << "metrics available on Unix socket \""
+                << metrics_listen.to_string()
+                << "\"."
+                << SNAP_LOG_SEND;
+        }
     }
 
     // PLAIN REMOTE
@@ -885,9 +1754,46 @@ int server::init()
             sl->set_name("communicator secure listener");
             sl->set_username(username);
             sl->set_password(password);
-            f_communicator->add_connection(sl);
             f_secure_listener = sl;
 
+            // a client stalling in the middle of the TLS handshake must
+            // not block the accept() (and stop()) forever
+            //
+            double handshake_timeout(0.0);
+            if(!advgetopt::validator_duration::convert_string(
+                          f_opts.get_string("secure-handshake-timeout")
+                        , advgetopt::validator_duration::VALIDATOR_DURATION_DEFAULT_FLAGS
+                        , handshake_timeout))
+            {
+                SNAP_LOG_ERROR
+                    << "invalid --secure-handshake-timeout \""
+                    << f_opts.get_string("secure-handshake-timeout")
+                    << "\"; using 5 seconds."
+                    << SNAP_LOG_SEND;
+                handshake_timeout = 5.0;
+            }
+            if(handshake_timeout > 0.0
+            && !sl->set_handshake_timeout(static_cast<std::int64_t>(handshake_timeout * 1'000'000.0)))
+            {
+                SNAP_LOG_WARNING
+                    << "could not set the TLS handshake timeout of the secure listener."
+                    << SNAP_LOG_SEND;
+            }
+
+            if(f_opts.is_defined("secure-accept-thread"))
+            {
+                // the TLS handshakes happen in the acceptor thread
+                // so the listener itself is not added to the communicator
+                //
+                f_secure_acceptor = std::make_shared<secure_acceptor>(sl);
+                f_communicator->add_connection(f_secure_acceptor);
+                f_secure_acceptor->start();
+            }
+            else
+            {
+                f_communicator->add_connection(sl);
+            }
+
             SNAP_LOG_CONFIGURATION
                 << "listening to public secure connection \""
                 << f_secure_ip
@@ -922,6 +1828,7 @@ int server::init()
         {
             p->set_secret_code(f_opts.get_string("signal-secret"));
         }
+        p->set_receive_buffer_size(f_opts.get_long("signal-receive-buffer"));
         p->set_name("communicator messenger (UDP)");
         f_ping = p;
         if(!f_communicator->add_connection(f_ping))
@@ -943,9 +1850,75 @@ int server::init()
     {
         f_loadavg_timer = std::make_shared<load_timer>(shared_from_this());
         f_loadavg_timer->set_name("communicator load balancer timer");
+        f_loadavg_timer->set_timeout_delay(static_cast<std::int64_t>(f_load_sample_interval * 1'000'000.0));
         f_communicator->add_connection(f_loadavg_timer);
     }
 
+    {
+        f_cache_timer = std::make_shared<cache_timer>(shared_from_this());
+        f_cache_timer->set_name("communicator cache timer");
+        f_communicator->add_connection(f_cache_timer);
+    }
+
+    {
+        f_flush_timer = std::make_shared<flush_timer>(shared_from_this());
+        f_flush_timer->set_name("communicator link flush timer");
+        f_communicator->add_connection(f_flush_timer);
+    }
+
+    if(f_rate_limit_action == rate_limit_action_t::RATE_LIMIT_ACTION_DELAY)
+    {
+        f_rate_limit_timer = std::make_shared<rate_limit_timer>(shared_from_this());
+        f_rate_limit_timer->set_name("communicator rate limit timer");
+        f_communicator->add_connection(f_rate_limit_timer);
+    }
+
+    if(f_overload.is_enabled())
+    {
+        f_overload_timer = std::make_shared<overload_timer>(shared_from_this());
+        f_overload_timer->set_name("communicator overload timer");
+        f_communicator->add_connection(f_overload_timer);
+    }
+
+    if(f_heartbeat_interval > 0)
+    {
+        f_heartbeat_timer = std::make_shared<heartbeat_timer>(shared_from_this(), f_heartbeat_interval);
+        f_heartbeat_timer->set_name("communicator heartbeat timer");
+        f_communicator->add_connection(f_heartbeat_timer);
+    }
+
+    if(f_opts.is_defined("cache-journal"))
+    {
+        f_local_message_cache.set_journal(f_opts.get_string("data-path") + "/cache.journal");
+        update_cache_timer();
+    }
+
+    if(f_opts.is_defined("capture-file"))
+    {
+        std::vector<std::string> route_names;
+        for(int r(0); r < static_cast<int>(route_t::ROUTE_max); ++r)
+        {
+            route_names.push_back(metrics::route_name(static_cast<route_t>(r)));
+        }
+        f_capture = std::make_shared<traffic_capture>(
+                  f_opts.get_string("capture-file")
+                , f_opts.get_long("capture-max-bytes"));
+        if(!f_capture->open(route_names))
+        {
+            int const e(errno);
+            SNAP_LOG_ERROR
+                << "could not create traffic capture \""
+                << f_opts.get_string("capture-file")
+                << "\" (errno: "
+                << e
+                << " -- "
+                << strerror(e)
+                << "); the messages are not captured."
+                << SNAP_LOG_SEND;
+            f_capture.reset();
+        }
+    }
+
     // transform the --my-address to an addr::addr object
     //
     // note that the default port is not important if the listen_addr is not
@@ -981,9 +1954,96 @@ int server::init()
         }
     }
 
+    f_start_date = time(nullptr);
     f_remote_communicators = std::make_shared<remote_communicators>(
                                           shared_from_this()
                                         , f_connection_address);
+    f_remote_communicators->set_overlay(
+                  f_opts.get_long("overlay-peers")
+                , f_opts.get_long("overlay-long-links"));
+
+    double ramp_up_duration(0.0);
+    if(!advgetopt::validator_duration::convert_string(
+                  f_opts.get_string("ramp-up-duration")
+                , advgetopt::validator_duration::VALIDATOR_DURATION_DEFAULT_FLAGS
+                , ramp_up_duration))
+    {
+        ramp_up_duration = 0.0;
+    }
+    f_remote_communicators->set_ramp_up(
+                  f_opts.get_long("ramp-up-concurrency")
+                , static_cast<std::int64_t>(ramp_up_duration * 1'000'000.0));
+
+    f_user_name = f_opts.get_string("user-name");
+    f_group_name = f_opts.get_string("group-name");
+
+    // the rest of the startup happens once the event loop runs so the
+    // local services can REGISTER in the meantime
+    //
+    f_startup_timer = std::make_shared<startup_timer>(shared_from_this());
+    f_startup_timer->set_name("communicator startup timer");
+    f_communicator->add_connection(f_startup_timer);
+
+    startup_phase("listeners");
+
+    return 0;
+}
+
+
+/** \brief Run the second stage of the startup.
+ *
+ * The init() function only creates the listeners and timers. The local
+ * services can connect and REGISTER as soon as the event loop runs.
+ * This function, called by the startup_timer on the first iteration of
+ * the loop, loads the message definitions, reads the neighbors and
+ * starts the connections to the remote communicator daemons.
+ *
+ * The clock verification runs in its own thread since init().
+ */
+void server::process_startup()
+{
+    startup_phase("running");
+
+    // compile the message definitions to validate the messages we receive
+    // and get the default rate limits of the commands
+    //
+    validation_mode_t validation_mode(validation_mode_t::VALIDATION_MODE_COUNT);
+    if(!parse_validation_mode(f_opts.get_string("message-validation"), validation_mode))
+    {
+        SNAP_LOG_ERROR
+            << "unknown message validation mode \""
+            << f_opts.get_string("message-validation")
+            << "\"; using \"count\"."
+            << SNAP_LOG_SEND;
+    }
+    f_message_validator.set_mode(validation_mode);
+
+    // the commands of the definitions are known whether we validate or
+    // not, so they do not count against the dynamic command limit
+    //
+    seed_commands(f_opts.get_string("message-definitions"));
+
+    if(validation_mode != validation_mode_t::VALIDATION_MODE_OFF
+    || f_opts.is_defined("message-validation-commands")
+    || f_opts.is_defined("rate-limits"))
+    {
+        std::size_t const count(f_message_validator.load(f_opts.get_string("message-definitions")));
+        SNAP_LOG_CONFIGURATION
+            << "loaded "
+            << count
+            << " message definitions to validate messages."
+            << SNAP_LOG_SEND;
+        if(f_opts.is_defined("message-validation-commands"))
+        {
+            f_message_validator.set_command_modes(f_opts.get_string("message-validation-commands"));
+        }
+        std::size_t const max_commands(command_count());
+        for(command_id_t id(0); id < max_commands; ++id)
+        {
+            f_rate_limits.set_default_command_limit(id, f_message_validator.get_rate_limit(id));
+        }
+    }
+    startup_phase("definitions");
 
     if(f_connection_address.get_network_type() != addr::network_type_t::NETWORK_TYPE_LOOPBACK
     && !f_connection_address.is_default())
@@ -997,16 +2057,36 @@ int server::init()
         add_neighbors(f_explicit_neighbors);
     }
 
-    f_user_name = f_opts.get_string("user-name");
-    f_group_name = f_opts.get_string("group-name");
-
     // if we are in a one computer environment this call would never happen
     // unless someone sends us a CLUSTER_STATUS, but that does not have the
     // exact same effect
     //
     cluster_status(nullptr);
 
-    return 0;
+    startup_phase("remote");
+}
+
+
+/** \brief Record the time at which a startup phase was reached.
+ *
+ * The times are logged and available in the metrics as the number of
+ * seconds since init() was called.
+ *
+ * \param[in] phase  The name of the phase.
+ */
+void server::startup_phase(char const * phase)
+{
+    std::int64_t const us(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - f_startup_time).count());
+    f_startup_phases.emplace_back(phase, us);
+
+    SNAP_LOG_INFO
+        << "startup phase \""
+        << phase
+        << "\" reached after "
+        << us / 1000
+        << "ms."
+        << SNAP_LOG_SEND;
 }
 
 
@@ -1281,10 +2361,10 @@ SNAP_LOG_VERBOSE
             return false;
         }
         broadcast_message(msg);
+        f_metrics.route(msg.get_command(), route_t::ROUTE_BROADCAST);
         return true;
     }
 
-    base_connection::vector_t accepting_remote_connections;
     bool const all_servers(server_name.empty()
                 || server_name == communicatord::g_name_communicatord_server_any);
     bool const remote_servers(server_name == communicatord::g_name_communicatord_server_remote);
@@ -1292,172 +2372,114 @@ SNAP_LOG_VERBOSE
     // service is local, check whether the service is registered,
     // if registered, forward the message immediately
     //
-    ed::connection::vector_t const & connections(f_communicator->get_connections());
-    for(auto const & nc : connections)
+    if(all_servers
+    || server_name == f_server_name)
     {
-        base_connection::pointer_t base_conn(std::dynamic_pointer_cast<base_connection>(nc));
-        if(base_conn == nullptr)
+        base_connection::pointer_t base_conn(f_routes.find_route(f_server_name, service));
+        if(base_conn != nullptr
+        && base_conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_LOCAL)
         {
-            continue;
+            base_conn.reset();
         }
 
-        // verify that there is a server name in all connections
-        // (if not we have a bug somewhere else)
+        // in debug mode, make sure the routing table agrees with the
+        // list of connections
         //
-        if(base_conn->get_server_name().empty())
+        if(is_debug())
+        {
+            verify_route(service, base_conn);
+        }
+
+        if(base_conn != nullptr)
         {
-            if(!is_debug())
+            // we have such a service, just forward to it now
+            //
+            // TBD: should we remove the service name from the
+            //      message before forwarding?
+            //
+            try
             {
-                // ignore in non-debug versions because a throw
-                // completely breaks communicatord... and it
-                // is not that important at this point without
-                // a programmer debugging this software
+                // helper message for programmers with attention
+                // span having issues
                 //
-                continue;
+                base_connection::pointer_t sender(msg.user_data<base_connection>());
+                if(base_conn == sender)
+                {
+                    SNAP_LOG_WARNING
+                        << "service \""
+                        << service
+                        << "\" just tried to send itself a message. Forgot to change the destination service name?"
+                        << SNAP_LOG_SEND;
+                    return false;
+                }
+
+                if(verify_command(base_conn, msg))
+                {
+                    add_trace_hop(msg);
+                    base_conn->send_message_to_connection(msg);
+                    f_metrics.route(msg.get_command(), route_t::ROUTE_FORWARDED);
+                }
+                else
+                {
+                    f_metrics.route(msg.get_command(), route_t::ROUTE_DROPPED);
+                }
             }
-            if(base_conn->get_connection_type() == connection_type_t::CONNECTION_TYPE_DOWN)
+            catch(std::runtime_error const & e)
             {
-                // not connected yet, forget about it
+                // ignore the error because this can come from an
+                // external source (i.e. ed-signal) where an end
+                // user may try to break the whole system!
                 //
-                continue;
-            }
-
-            service_connection::pointer_t conn(std::dynamic_pointer_cast<service_connection>(nc));
-            if(conn != nullptr)
-            {
-                throw communicatord::missing_name(
-                          "DEBUG: server name missing in service connection \""
-                        + conn->get_name()
-                        + "\"...");
-            }
-            unix_connection::pointer_t unix_conn(std::dynamic_pointer_cast<unix_connection>(nc));
-            if(unix_conn != nullptr)
-            {
-                throw communicatord::missing_name(
-                          "DEBUG: server name missing in unix connection \""
-                        + unix_conn->get_name()
-                        + "\"...");
-            }
-
-            switch(base_conn->get_connection_type())
-            {
-            case connection_type_t::CONNECTION_TYPE_DOWN:
-                // already handled above
-                continue;
-
-            case connection_type_t::CONNECTION_TYPE_LOCAL:
-                throw communicatord::missing_name(
-                          "DEBUG: server name missing in connection \"local service\"...");
-
-            case connection_type_t::CONNECTION_TYPE_REMOTE:
-                throw communicatord::missing_name(
-                          "DEBUG: server name missing in connection \"remote communicatord\"...");
-
+                SNAP_LOG_DEBUG
+                    << "communicatord failed to send a message to connection \""
+                    << service
+                    << "\" (error: "
+                    << e.what()
+                    << ")"
+                    << SNAP_LOG_SEND;
             }
+            // we found a specific service to which we could
+            // forward the message so we can stop here
+            //
+            return false;
         }
+    }
 
-        bool try_remote(true);
-        if(all_servers
-        || server_name == base_conn->get_server_name())
+    // if we cannot find a local service, forward the message to the
+    // remote connections running that service, or if none, to those
+    // which heard of it, or if none, to all of them; or to the one
+    // specified remote server
+    //
+    // anycast messages are further limited to one connection (see
+    // select_anycast_connection())
+    //
+    base_connection::vector_t links;
+    if(all_servers
+    || remote_servers)
+    {
+        // only send the message to the remote communicators leading to
+        // that service; if no route is known, try them all
+        //
+        f_routes.find_next_hops(service, links);
+        if(links.empty())
         {
-            bool is_service(false);
-            {
-                service_connection::pointer_t conn(std::dynamic_pointer_cast<service_connection>(nc));
-                if(conn != nullptr)
-                {
-                    is_service = true;
-                }
-                else
-                {
-                    unix_connection::pointer_t unix_conn(std::dynamic_pointer_cast<unix_connection>(nc));
-                    if(unix_conn != nullptr)
-                    {
-                        is_service = true;
-                    }
-                }
-            }
-            if(is_service)
-            {
-                ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(nc));
-                if(c->get_name() == service)
-                {
-                    // we have such a service, just forward to it now
-                    //
-                    // TBD: should we remove the service name from the
-                    //      message before forwarding?
-                    //
-                    try
-                    {
-                        // helper message for programmers with attention
-                        // span having issues
-                        //
-                        base_connection::pointer_t sender(msg.user_data<base_connection>());
-                        if(base_conn == sender)
-                        {
-                            SNAP_LOG_WARNING
-                                << "service \""
-                                << service
-                                << "\" just tried to send itself a message. Forgot to change the destination service name?"
-                                << SNAP_LOG_SEND;
-                            return false;
-                        }
-
-                        if(verify_command(base_conn, msg))
-                        {
-                            base_conn->send_message_to_connection(msg);
-                        }
-                    }
-                    catch(std::runtime_error const & e)
-                    {
-                        // ignore the error because this can come from an
-                        // external source (i.e. ed-signal) where an end
-                        // user may try to break the whole system!
-                        //
-                        SNAP_LOG_DEBUG
-                            << "communicatord failed to send a message to connection \""
-                            << c->get_name()
-                            << "\" (error: "
-                            << e.what()
-                            << ")"
-                            << SNAP_LOG_SEND;
-                    }
-                    // we found a specific service to which we could
-                    // forward the message so we can stop here
-                    //
-                    return false;
-                }
-            }
+            f_routes.get_links(links);
         }
-        else
+    }
+    else if(server_name != f_server_name)
+    {
+        base_connection::pointer_t link(f_routes.find_link(server_name));
+        if(link != nullptr)
         {
-            try_remote = remote_servers;
-        }
-        if(try_remote)
-        {
-            // TODO: limit sending to remote only if they have that service?
-            //       (if we have the 'all_servers' set, otherwise it is not
-            //       required, for sure... also, if we have multiple remote
-            //       connections that support the same service we should
-            //       randomize which one is to receive that message--or
-            //       even better, check the current server load--but
-            //       seriously, if none of our direct connections know
-            //       of that service, we need to check for those that heard
-            //       of that service, and if that is also empty, send to
-            //       all... for now we send to all anyway--plus this section
-            //       is about broadcasting. What we really need is the graph
-            //       and whether we want to send to any one service or
-            //       broadcast)
-            //
-
-            // if this is a remote connection add it to our list of remote
-            // connections and if we cannot find a local service, forward
-            // the message to all our remote connections
-            //
-            connection_type_t const type(base_conn->get_connection_type());
-            if(type == connection_type_t::CONNECTION_TYPE_REMOTE)
-            {
-                accepting_remote_connections.push_back(base_conn);
-            }
+            links.push_back(link);
+        }
+    }
+    base_connection::vector_t accepting_remote_connections;
+    for(auto const & l : links)
+    {
+        if(l->get_connection_type() == connection_type_t::CONNECTION_TYPE_REMOTE)
+        {
+            accepting_remote_connections.push_back(l);
         }
     }
 
@@ -1480,6 +2502,7 @@ SNAP_LOG_VERBOSE
             {
                 reply.add_parameter(communicatord::g_name_communicatord_param_destination_service, service);
                 reply.add_parameter(communicatord::g_name_communicatord_param_unsent_command, msg.get_command());
+                communicatord::copy_correlation_id(msg, reply);
                 sender->send_message_to_connection(reply);
             }
             else
@@ -1491,6 +2514,15 @@ SNAP_LOG_VERBOSE
                     << SNAP_LOG_SEND;
             }
         }
+        if(cached == cache_message_t::CACHE_MESSAGE_CACHED)
+        {
+            update_cache_timer();
+            f_metrics.route(msg.get_command(), route_t::ROUTE_CACHED);
+        }
+        else
+        {
+            f_metrics.route(msg.get_command(), route_t::ROUTE_DROPPED);
+        }
         transmission_report(msg, cached == cache_message_t::CACHE_MESSAGE_CACHED);
         return true;
     }
@@ -1508,10 +2540,26 @@ SNAP_LOG_VERBOSE
                " communicatord. Dropping message."
             << SNAP_LOG_SEND;
 
+        f_metrics.route(msg.get_command(), route_t::ROUTE_DROPPED);
         transmission_report(msg, false);
         return false;
     }
 
+    // anycast messages are sent to a single computer, the least busy one
+    //
+    if(accepting_remote_connections.size() > 1
+    && is_anycast(msg))
+    {
+        base_connection::pointer_t const conn(select_anycast_connection(accepting_remote_connections, service));
+        accepting_remote_connections.clear();
+        accepting_remote_connections.push_back(conn);
+    }
+
+    // in hierarchical mode, the messages for the other sites go through
+    // a gateway of our site
+    //
+    relay_to_site_gateways(accepting_remote_connections);
+
     if(!accepting_remote_connections.empty())
     {
         // TODO: if the server is "?", then we need to fix it at the moment
@@ -1524,12 +2572,86 @@ SNAP_LOG_VERBOSE
             msg.set_server(communicatord::g_name_communicatord_server_any);
         }
         broadcast_message(msg, accepting_remote_connections);
+        f_metrics.route(msg.get_command(), route_t::ROUTE_FORWARDED);
+    }
+    else
+    {
+        f_metrics.route(msg.get_command(), route_t::ROUTE_DROPPED);
     }
 
     return true;
 }
 
 
+/** \brief Add this communicatord to the trace of a message.
+ *
+ * When a message has a "trace" parameter, each communicatord forwarding
+ * it appends its name, the time it received the message and the time it
+ * sends it further, in microseconds since the Unix epoch. When the
+ * message comes from a remote communicator with a clock offset estimate,
+ * that offset is appended too. The recipient uses
+ * communicatord::get_trace() to retrieve the list.
+ *
+ * Once a trace reaches MAX_TRACE_HOPS, further hops are not recorded.
+ *
+ * \param[in,out] msg  The message about to be sent.
+ */
+void server::add_trace_hop(ed::message & msg)
+{
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_trace))
+    {
+        return;
+    }
+
+    std::string trace(msg.get_parameter(communicatord::g_name_communicatord_param_trace));
+    if(!trace.empty())
+    {
+        if(static_cast<std::size_t>(std::count(trace.begin(), trace.end(), ',')) + 1 >= MAX_TRACE_HOPS)
+        {
+            return;
+        }
+        trace += ',';
+    }
+    std::int64_t const now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+    trace += f_server_name;
+    trace += ':';
+    trace += std::to_string(f_received_on);
+    trace += ':';
+    trace += std::to_string(now);
+    std::int64_t const offset(get_peer_clock_offset(msg));
+    if(offset != 0)
+    {
+        trace += ':';
+        trace += std::to_string(offset);
+    }
+    msg.add_parameter(communicatord::g_name_communicatord_param_trace, trace);
+}
+
+
+/** \brief Get the clock offset of the communicator a message came from.
+ *
+ * When \p msg was received from a remote communicator daemon for which
+ * we have a clock offset estimate, this function returns that offset.
+ * It is used to convert the times found in that message to our clock.
+ *
+ * \param[in] msg  The message to check.
+ *
+ * \return The clock of the sender minus our clock in microseconds, 0 if
+ * unknown or the message did not come from a remote communicator.
+ */
+std::int64_t server::get_peer_clock_offset(ed::message const & msg) const
+{
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr
+    || conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_REMOTE)
+    {
+        return 0;
+    }
+    return conn->get_clock_offset().get_offset();
+}
+
+
 void server::transmission_report(ed::message & msg, bool cached)
 {
     base_connection::pointer_t conn(msg.user_data<base_connection>());
@@ -1557,12 +2679,111 @@ void server::transmission_report(ed::message & msg, bool cached)
         , cached
             ? communicatord::g_name_communicatord_value_cached
             : communicatord::g_name_communicatord_value_failed);
+    communicatord::copy_correlation_id(msg, reply);
     //verify_command(conn, reply);
+    f_metrics.transmission_report();
     conn->send_message_to_connection(reply);
 }
 
 
-bool server::check_broadcast_message(ed::message const & msg)
+/** \brief Verify the route found in the routing table.
+ *
+ * In debug mode, this function searches the list of connections for
+ * the local \p service the way the forward_message() used to do it
+ * and compares the result with the \p route that was found in the
+ * routing table. If the two do not agree, an error is logged.
+ *
+ * The function also verifies that all the connections have a server
+ * name and throws if not.
+ *
+ * \param[in] service  The name of the local service being searched.
+ * \param[in] route  The connection found in the routing table.
+ */
+void server::verify_route(
+      std::string const & service
+    , base_connection::pointer_t route)
+{
+    base_connection::pointer_t found;
+    ed::connection::vector_t const & connections(f_communicator->get_connections());
+    for(auto const & nc : connections)
+    {
+        base_connection::pointer_t base_conn(std::dynamic_pointer_cast<base_connection>(nc));
+        if(base_conn == nullptr)
+        {
+            continue;
+        }
+
+        // verify that there is a server name in all connections
+        // (if not we have a bug somewhere else)
+        //
+        if(base_conn->get_server_name().empty())
+        {
+            if(base_conn->get_connection_type() == connection_type_t::CONNECTION_TYPE_DOWN)
+            {
+                // not connected yet, forget about it
+                //
+                continue;
+            }
+
+            service_connection::pointer_t conn(std::dynamic_pointer_cast<service_connection>(nc));
+            if(conn != nullptr)
+            {
+                throw communicatord::missing_name(
+                          "DEBUG: server name missing in service connection \""
+                        + conn->get_name()
+                        + "\"...");
+            }
+            unix_connection::pointer_t unix_conn(std::dynamic_pointer_cast<unix_connection>(nc));
+            if(unix_conn != nullptr)
+            {
+                throw communicatord::missing_name(
+                          "DEBUG: server name missing in unix connection \""
+                        + unix_conn->get_name()
+                        + "\"...");
+            }
+
+            switch(base_conn->get_connection_type())
+            {
+            case connection_type_t::CONNECTION_TYPE_DOWN:
+                // already handled above
+                continue;
+
+            case connection_type_t::CONNECTION_TYPE_LOCAL:
+                throw communicatord::missing_name(
+                          "DEBUG: server name missing in connection \"local service\"...");
+
+            case connection_type_t::CONNECTION_TYPE_REMOTE:
+                throw communicatord::missing_name(
+                          "DEBUG: server name missing in connection \"remote communicatord\"...");
+
+            }
+        }
+
+        if(found == nullptr
+        && base_conn->get_connection_type() == connection_type_t::CONNECTION_TYPE_LOCAL
+        && base_conn->get_server_name() == f_server_name
+        && nc->get_name() == service)
+        {
+            found = base_conn;
+        }
+    }
+
+    if(found != route)
+    {
+        SNAP_LOG_ERROR
+            << "DEBUG: the routing table "
+            << (route == nullptr ? "has no route" : "has a different route")
+            << " to local service \""
+            << service
+            << "\" than the list of connections ("
+            << (found == nullptr ? "not found" : "found")
+            << ")."
+            << SNAP_LOG_SEND;
+    }
+}
+
+
+bool server::check_broadcast_message(ed::message & msg)
 {
     // messages being broadcast to us have a unique ID, if that ID is
     // one we already received we must ignore the message altogether;
@@ -1580,7 +2801,18 @@ bool server::check_broadcast_message(ed::message const & msg)
     // which should rarely be activated unless you have multiple
     // data center locations
     //
-    time_t const timeout(msg.get_integer_parameter(communicatord::g_name_communicatord_param_broadcast_timeout));
+    // the timeout was computed with the clock of the sender, convert it
+    // to our clock; the message then gets forwarded with our own clock
+    // so the next hop only has to correct for the offset with us
+    //
+    time_t timeout(msg.get_integer_parameter(communicatord::g_name_communicatord_param_broadcast_timeout));
+    std::int64_t const offset(get_peer_clock_offset(msg));
+    time_t const delta((offset + (offset < 0 ? -500'000 : 500'000)) / 1'000'000);
+    if(delta != 0)
+    {
+        timeout -= delta;
+        msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_timeout, timeout);
+    }
     time_t const now(time(nullptr));
     if(timeout < now)
     {
@@ -1592,8 +2824,7 @@ bool server::check_broadcast_message(ed::message const & msg)
     // neighbors included in the message, but just in case...)
     //
     std::string const broadcast_msgid(msg.get_parameter(communicatord::g_name_communicatord_param_broadcast_msgid));
-    auto const received_it(f_received_broadcast_messages.find(broadcast_msgid));
-    if(received_it != f_received_broadcast_messages.cend())     // message arrived again?
+    if(f_received_broadcast_messages.contains(broadcast_msgid))     // message arrived again?
     {
         // note that although we include neighbors it is normal that
         // this happens in a cluster where some computers are not
@@ -1681,62 +2912,553 @@ bool server::shutting_down(ed::message & msg)
  * services except the communicatord which wants to know whether a message
  * was being broadcasted, whether it is actively shutting down, or whether
  * the message is for the communicatord service itself or another service.
+ *
+ * The time spent routing the message, which includes the msg_...()
+ * handler of the messages sent to the communicatord itself, is saved in
+ * the metrics. A warning is logged when it goes over the
+ * --slow-dispatch-threshold.
+ *
+ * With a --capture-file, the message is saved as received along its
+ * source connection and the first routing decision taken for it.
+ *
+ * \param[in] msg  The message to dispatch.
+ *
+ * \return true if the message was dispatched.
  */
 bool server::dispatch_message(ed::message & msg)
 {
-    // check whether this is a timed out or already processed broadcast
-    // message
-    //
-    if(check_broadcast_message(msg))
-    {
-        // pretend the message was processed
-        //
-        return true;
-    }
+    std::chrono::steady_clock::time_point const start(std::chrono::steady_clock::now());
+    f_received_on = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
 
-    // we are shutting down, ignore further messages
-    //
-    if(shutting_down(msg))
+    communicatord::capture_record record;
+    if(f_capture != nullptr)
     {
-        // pretend the message was processed
-        //
-        return true;
+        record.f_timestamp = f_received_on;
+        record.f_message = msg.to_message();
+        base_connection::pointer_t conn(msg.user_data<base_connection>());
+        if(conn == nullptr)
+        {
+            record.f_source_type = "none";
+        }
+        else
+        {
+            if(conn->is_udp())
+            {
+                record.f_source_type = "udp";
+            }
+            else if(conn->is_remote()
+                 || conn->get_connection_type() == connection_type_t::CONNECTION_TYPE_REMOTE)
+            {
+                record.f_source_type = "remote";
+            }
+            else
+            {
+                record.f_source_type = "local";
+            }
+            record.f_connection = conn->get_socket();
+            ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
+            if(c != nullptr)
+            {
+                record.f_source = c->get_name();
+            }
+        }
+        f_metrics.start_decision();
     }
 
-    // if this message is directed to the communicator daemon itself
-    // then dispatcher it through our own dispatcher
-    //
-    if(communicator_message(msg))
+    bool const result(route_message(msg));
+
+    if(f_capture != nullptr)
     {
-        return dispatcher_support::dispatch_message(msg);
+        route_t const decision(f_metrics.get_decision());
+        if(decision != route_t::ROUTE_max)
+        {
+            record.f_route = static_cast<std::uint8_t>(decision);
+        }
+        f_capture->record(record);
     }
 
-    // otherwise call `forward_message()`
-    //
-    return forward_message(msg);
-}
-
-
-bool server::is_tcp_connection(ed::message & msg)
-{
-    if(msg.user_data<base_connection>()->is_udp())
+    std::int64_t const us(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count());
+    f_metrics.dispatch_latency(msg.get_command(), us);
+    if(f_slow_dispatch_threshold > 0
+    && us >= f_slow_dispatch_threshold)
     {
-        SNAP_LOG_ERROR
+        SNAP_LOG_WARNING
+            << "dispatching message \""
             << msg.get_command()
-            << " is only accepted over a TCP connection."
+            << "\" took "
+            << us / 1000
+            << "ms."
             << SNAP_LOG_SEND;
-        return false;
     }
 
-    return true;
+    return result;
 }
 
 
-void server::msg_accept(ed::message & msg)
-{
-    if(!is_tcp_connection(msg))
-    {
-        return;
+/** \brief Route a message to its handler or destination.
+ *
+ * This function decodes the wire format, ignores duplicate reliable
+ * messages and applies the rate limits, then calls deliver_message().
+ *
+ * The reliable messages and the control commands received from other
+ * communicators are not rate limited (see is_rate_limit_exempt()).
+ *
+ * \param[in] msg  The message to route.
+ *
+ * \return true if the message was processed.
+ */
+bool server::route_message(ed::message & msg)
+{
+    // messages from other communicators may have their parameters packed
+    //
+    {
+        ed::message decoded;
+        if(decode_wire_message(msg, decoded))
+        {
+            base_connection::pointer_t conn(msg.user_data<base_connection>());
+            msg = decoded;
+            msg.user_data(conn);
+        }
+    }
+
+    {
+        base_connection::pointer_t conn(msg.user_data<base_connection>());
+        if(conn != nullptr)
+        {
+            conn->count_message_in();
+        }
+    }
+    f_metrics.message_in(msg.get_command());
+
+    // reliable_input() removes the sequence number
+    //
+    bool const reliable(msg.has_parameter(communicatord::g_name_communicatord_param_reliable_sequence));
+
+    // reliable messages sent again after a reconnect may already have
+    // been received
+    //
+    if(!reliable_input(msg))
+    {
+        f_metrics.route(msg.get_command(), route_t::ROUTE_DUPLICATE);
+        return true;
+    }
+
+    // do not let one connection flood the event loop; the reliable
+    // messages were just acknowledged and the communicator links need
+    // their control messages so those are not limited
+    //
+    bool remote(false);
+    {
+        base_connection::pointer_t conn(msg.user_data<base_connection>());
+        remote = conn != nullptr
+              && conn->get_connection_type() == connection_type_t::CONNECTION_TYPE_REMOTE;
+
+        // only the local services may send bulk messages in the
+        // control lane
+        //
+        if(conn != nullptr
+        && (remote || conn->is_remote() || conn->is_udp()))
+        {
+            restrict_message_priority(msg);
+        }
+    }
+    if(!is_rate_limit_exempt(find_command(msg.get_command()), remote, reliable)
+    && rate_limited(msg))
+    {
+        return true;
+    }
+
+    return deliver_message(msg);
+}
+
+
+/** \brief Deliver a message to its handler or destination.
+ *
+ * This function ignores invalid messages, duplicate broadcasts and the
+ * messages received while shutting down, then either calls the
+ * handler of messages sent to the communicatord or forwards the message.
+ *
+ * The messages delayed by the rate limits are directly sent to this
+ * function once their connection gets new tokens.
+ *
+ * \param[in] msg  The message to deliver.
+ *
+ * \return true if the message was processed.
+ */
+bool server::deliver_message(ed::message & msg)
+{
+    // verify the message against its definition
+    //
+    {
+        validation_t const validation(f_message_validator.validate(msg));
+        if(validation != validation_t::VALIDATION_VALID)
+        {
+            f_metrics.invalid_message(msg.get_command());
+            SNAP_LOG_DEBUG
+                << "message \""
+                << msg.get_command()
+                << "\" does not match its definition: "
+                << f_message_validator.get_error(msg)
+                << '.'
+                << SNAP_LOG_SEND;
+            if(validation == validation_t::VALIDATION_REJECT)
+            {
+                f_metrics.route(msg.get_command(), route_t::ROUTE_REJECTED);
+                return true;
+            }
+        }
+    }
+
+    // check whether this is a timed out or already processed broadcast
+    // message
+    //
+    if(check_broadcast_message(msg))
+    {
+        // pretend the message was processed
+        //
+        f_metrics.route(msg.get_command(), route_t::ROUTE_DUPLICATE);
+        return true;
+    }
+
+    // we are shutting down, ignore further messages
+    //
+    if(shutting_down(msg))
+    {
+        // pretend the message was processed
+        //
+        return true;
+    }
+
+    // if this message is directed to the communicator daemon itself
+    // then dispatcher it through our own dispatcher
+    //
+    if(communicator_message(msg))
+    {
+        f_metrics.route(msg.get_command(), route_t::ROUTE_HANDLED);
+        return dispatcher_support::dispatch_message(msg);
+    }
+
+    // trace a sample of the messages sent by our local services
+    //
+    if(f_trace_sample_rate > 0
+    && !msg.has_parameter(communicatord::g_name_communicatord_param_trace))
+    {
+        base_connection::pointer_t conn(msg.user_data<base_connection>());
+        if(conn != nullptr
+        && conn->get_connection_type() == connection_type_t::CONNECTION_TYPE_LOCAL)
+        {
+            ++f_trace_counter;
+            if(f_trace_counter >= f_trace_sample_rate)
+            {
+                f_trace_counter = 0;
+                communicatord::request_trace(msg);
+            }
+        }
+    }
+
+    // otherwise call `forward_message()`
+    //
+    return forward_message(msg);
+}
+
+
+/** \brief Get the name of the type of a connection.
+ *
+ * This is the type used by the "type:" entries of the --rate-limits.
+ *
+ * \param[in] conn  The connection concerned.
+ *
+ * \return "udp", "remote", "unix" or "tcp".
+ */
+char const * server::get_connection_type_name(base_connection::pointer_t const & conn) const
+{
+    if(conn->is_udp())
+    {
+        return "udp";
+    }
+    if(conn->get_connection_type() == connection_type_t::CONNECTION_TYPE_REMOTE)
+    {
+        return "remote";
+    }
+    if(f_unix_connections.find(conn.get()) != f_unix_connections.end())
+    {
+        return "unix";
+    }
+    return "tcp";
+}
+
+
+/** \brief Apply the rate limits to a message.
+ *
+ * This function takes a token from the buckets of the connection which
+ * sent \p msg. When no token is available, the --rate-limit-action
+ * decides what happens to the message:
+ *
+ * \li "drop" -- the message is ignored;
+ * \li "delay" -- the message is kept until a token is available, up to
+ * --rate-limit-delay-messages per connection, then they get dropped;
+ * \li "throttle" -- the message is ignored and the sender receives a
+ * THROTTLE message, once each time it goes over the limit, if it
+ * understands that command.
+ *
+ * While a connection has delayed messages, its new messages are delayed
+ * too so they are processed in order.
+ *
+ * \param[in] msg  The message to check.
+ *
+ * \return true if the message was dropped or delayed.
+ */
+bool server::rate_limited(ed::message & msg)
+{
+    if(f_rate_limits.empty())
+    {
+        return false;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
+    if(c == nullptr)
+    {
+        return false;
+    }
+
+    ingress_limiter & limiter(conn->get_ingress_limiter());
+    command_id_t const command(find_command(msg.get_command()));
+    std::int64_t const now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    bool const delayed(f_rate_limit_action == rate_limit_action_t::RATE_LIMIT_ACTION_DELAY
+                    && limiter.has_delayed());
+    if(!delayed
+    && limiter.accept(f_rate_limits, c->get_name(), get_connection_type_name(conn), command, now))
+    {
+        limiter.set_throttled(false);
+        return false;
+    }
+
+    f_metrics.route(msg.get_command(), route_t::ROUTE_THROTTLED);
+
+    if(f_rate_limit_action == rate_limit_action_t::RATE_LIMIT_ACTION_DELAY
+    && limiter.delay(msg, f_rate_limit_delay_messages, f_received_on))
+    {
+        ++f_rate_limit_delayed;
+        f_delayed_connections[conn.get()] = conn;
+        update_rate_limit_timer();
+        return true;
+    }
+
+    if(f_rate_limit_action == rate_limit_action_t::RATE_LIMIT_ACTION_THROTTLE
+    && limiter.set_throttled(true)
+    && !conn->is_udp()
+    && conn->understand_command(communicatord::g_name_communicatord_cmd_throttle))
+    {
+        ++f_throttle_sent;
+        ed::message throttle;
+        throttle.set_command(communicatord::g_name_communicatord_cmd_throttle);
+        throttle.add_parameter(communicatord::g_name_communicatord_param_command, msg.get_command());
+        throttle.add_parameter(
+                  communicatord::g_name_communicatord_param_retry_after
+                , (limiter.next_token(command, now) + 999) / 1'000);
+        conn->send_message_to_connection(throttle);
+    }
+
+    ++f_rate_limit_dropped;
+    if(f_rate_limit_dropped == 1
+    || f_rate_limit_dropped % 1'000 == 0)
+    {
+        SNAP_LOG_WARNING
+            << "dropped "
+            << f_rate_limit_dropped
+            << " message(s) so far because they went over their rate limit; last one was \""
+            << msg.get_command()
+            << "\" from \""
+            << c->get_name()
+            << "\"."
+            << SNAP_LOG_SEND;
+    }
+    return true;
+}
+
+
+/** \brief Wake up when the next delayed message can be processed.
+ *
+ * This function computes the time until the oldest delayed message of
+ * each connection gets a token and sets the rate limit timer to the
+ * smallest one. The timer is disabled when no message is delayed.
+ */
+void server::update_rate_limit_timer()
+{
+    if(f_rate_limit_timer == nullptr)
+    {
+        return;
+    }
+
+    std::int64_t const now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    std::int64_t wait(-1);
+    for(auto const & d : f_delayed_connections)
+    {
+        ingress_limiter & limiter(d.second->get_ingress_limiter());
+        if(limiter.has_delayed())
+        {
+            std::int64_t const next(limiter.next_token(find_command(limiter.front().get_command()), now));
+            if(wait < 0
+            || next < wait)
+            {
+                wait = next;
+            }
+        }
+    }
+
+    if(wait < 0)
+    {
+        f_rate_limit_timer->set_enable(false);
+        return;
+    }
+
+    // avoid spinning on tokens available in a few microseconds
+    //
+    f_rate_limit_timer->set_timeout_delay(std::max(wait, static_cast<std::int64_t>(1'000)));
+    f_rate_limit_timer->set_enable(true);
+}
+
+
+/** \brief Process the messages delayed by the rate limits.
+ *
+ * The delayed messages of each connection are delivered in order, as
+ * long as a token is available. The messages which already went through
+ * the reliable delivery verification are not verified again.
+ *
+ * The time each message was received is restored before it gets
+ * delivered so its trace hop includes the time it was delayed.
+ */
+void server::process_rate_limit_timeout()
+{
+    std::int64_t const now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+
+    // delivering a message may remove connections
+    //
+    base_connection_map_t const delayed(f_delayed_connections);
+    for(auto const & d : delayed)
+    {
+        base_connection::pointer_t conn(d.second);
+        ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
+        ingress_limiter & limiter(conn->get_ingress_limiter());
+        while(c != nullptr
+           && limiter.has_delayed()
+           && f_delayed_connections.find(d.first) != f_delayed_connections.end())
+        {
+            ed::message msg(limiter.front());
+            if(!limiter.accept(
+                      f_rate_limits
+                    , c->get_name()
+                    , get_connection_type_name(conn)
+                    , find_command(msg.get_command())
+                    , now))
+            {
+                break;
+            }
+            // the trace of this message shows when it was received, not
+            // when the last message was dispatched
+            //
+            f_received_on = limiter.front_received_on();
+            limiter.pop_front();
+            deliver_message(msg);
+        }
+        if(!limiter.has_delayed())
+        {
+            f_delayed_connections.erase(d.first);
+        }
+    }
+
+    update_rate_limit_timer();
+}
+
+
+/** \brief Check whether the daemon is overloaded.
+ *
+ * The overload timer calls this function at a regular interval. The
+ * lag is how much later than expected the timer fired. The queue
+ * depth is the total number of messages waiting in the output queues
+ * of all the connections.
+ *
+ * While the overload monitor says the daemon is overloaded, the new
+ * remote CONNECTs get refused and the non-critical broadcasts are not
+ * forwarded to the other communicator daemons (see msg_connect() and
+ * broadcast_message()).
+ */
+void server::process_overload_sample()
+{
+    std::chrono::steady_clock::time_point const now(std::chrono::steady_clock::now());
+    std::int64_t lag(0);
+    if(f_last_overload_sample != std::chrono::steady_clock::time_point())
+    {
+        lag = std::chrono::duration_cast<std::chrono::microseconds>(now - f_last_overload_sample).count()
+            - overload_timer::OVERLOAD_SAMPLE_INTERVAL;
+    }
+    f_last_overload_sample = now;
+
+    std::size_t queue_depth(0);
+    ed::connection::vector_t const & all_connections(f_communicator->get_connections());
+    for(auto const & c : all_connections)
+    {
+        base_connection::pointer_t conn(std::dynamic_pointer_cast<base_connection>(c));
+        if(conn != nullptr)
+        {
+            queue_depth += conn->get_queued_messages();
+        }
+    }
+
+    if(!f_overload.sample(lag, queue_depth))
+    {
+        return;
+    }
+
+    if(f_overload.is_shedding())
+    {
+        SNAP_LOG_WARNING
+            << "communicatord is overloaded (event loop lag: "
+            << f_overload.get_lag()
+            << "us, messages waiting: "
+            << f_overload.get_queue_depth()
+            << "); remote CONNECTs and non-critical broadcasts are now shed."
+            << SNAP_LOG_SEND;
+    }
+    else
+    {
+        SNAP_LOG_INFO
+            << "communicatord recovered from its overload; "
+            << f_connect_deferred
+            << " CONNECTs deferred and "
+            << f_broadcast_shed
+            << " broadcasts shed so far."
+            << SNAP_LOG_SEND;
+    }
+}
+
+
+bool server::is_tcp_connection(ed::message & msg)
+{
+    if(msg.user_data<base_connection>()->is_udp())
+    {
+        SNAP_LOG_ERROR
+            << msg.get_command()
+            << " is only accepted over a TCP connection."
+            << SNAP_LOG_SEND;
+        return false;
+    }
+
+    return true;
+}
+
+
+void server::msg_accept(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
     }
 
     base_connection::pointer_t conn(msg.user_data<base_connection>());
@@ -1791,11 +3513,36 @@ void server::msg_accept(ed::message & msg)
     {
         add_neighbors(msg.get_parameter(communicatord::g_name_communicatord_param_neighbors));
     }
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_capabilities))
+    {
+        conn->set_capabilities(msg.get_parameter(communicatord::g_name_communicatord_param_capabilities));
+    }
+    setup_link_compression(conn);
+    reliable_link_started(conn, msg);
+    set_peer_gateway(conn, msg);
+
+    // the remote server and its services are now reachable through
+    // this connection
+    //
+    advgetopt::string_set_t remote_services;
+    conn->get_services(remote_services);
+    advgetopt::string_set_t remote_heard_of;
+    conn->get_services_heard_of(remote_heard_of);
+    f_routes.add_link(remote_server_name, remote_services, conn, remote_heard_of);
+
+    // the heartbeats of a previous connection to that peer do not count
+    //
+    conn->get_failure_detector().reset();
+    conn->get_clock_offset().reset();
+
+    // that daemon may be a better gateway for our site
+    //
+    update_gateways();
 
-    // we just got some new services information,
-    // refresh our cache
+    // we just got some new services information, let our other peers
+    // know about the changes
     //
-    refresh_heard_of();
+    add_heard_of_peer(conn);
 
     // also request the COMMANDS of this connection with a HELP message
     //
@@ -1804,15 +3551,33 @@ void server::msg_accept(ed::message & msg)
     //verify_command(base, help); -- precisely
     conn->send_message_to_connection(help);
 
+    // tell that daemon which commands are consumed where and which
+    // services it can reach through us
+    //
+    send_interest_table(conn);
+    send_heard_of_table(conn);
+
+    // send the reliable messages that daemon did not acknowledge yet
+    //
+    replay_reliable_messages(conn);
+
     // if a local service was interested in this specific
     // computer, then we have to start receiving LOADAVG
     // messages from it
     //
     register_for_loadavg(his_address_str);
 
-    // now let local services know that we have a new
-    // remote connections (which may be of interest
-    // for that service--see snapmanagerdaemon)
+    // and if a local service listens to flags, receive the flag
+    // changes of that computer
+    //
+    if(!f_flag_listeners.empty())
+    {
+        register_for_flags(conn, false);
+    }
+
+    // now let local services know that we have a new
+    // remote connections (which may be of interest
+    // for that service--see snapmanagerdaemon)
     //
     // TODO: to be symmetrical, we should also have
     //       a message telling us when a remote
@@ -1838,6 +3603,38 @@ void server::msg_clock_status(ed::message & msg)
 }
 
 
+/** \brief Reply with the current cluster status.
+ *
+ * The CLUSTER_GET_STATUS message replaces the CLUSTER_STATUS message.
+ * The reply is a single CLUSTER_CURRENT_STATUS message including the
+ * up/down and complete/incomplete status. That message is the one
+ * broadcast whenever the status changes so the reply does not require
+ * the live connections to be counted again.
+ *
+ * \param[in] msg  The CLUSTER_GET_STATUS message.
+ */
+void server::msg_cluster_get_status(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr
+    || f_cluster_current_status.get_command().empty())
+    {
+        return;
+    }
+
+    ed::message reply(f_cluster_current_status);
+    if(verify_command(conn, reply))
+    {
+        conn->send_message_to_connection(reply);
+    }
+}
+
+
 void server::msg_cluster_status(ed::message & msg)
 {
     if(!is_tcp_connection(msg))
@@ -1881,6 +3678,26 @@ void server::msg_commands(ed::message & msg)
     }
     conn->add_commands(msg.get_parameter(communicatord::g_name_communicatord_param_list));
 
+    // the commands of our local services are advertised to our peers
+    //
+    if(std::dynamic_pointer_cast<remote_connection>(conn) == nullptr
+    && !conn->is_remote())
+    {
+        publish_interest();
+    }
+
+    // local services which understand CLUSTER_CURRENT_STATUS get the
+    // current status pushed immediately so they never have to ask
+    //
+    if(std::dynamic_pointer_cast<remote_connection>(conn) == nullptr
+    && !conn->is_remote()
+    && !f_cluster_current_status.get_command().empty()
+    && conn->understand_command(communicatord::g_name_communicatord_cmd_cluster_current_status))
+    {
+        ed::message current_status(f_cluster_current_status);
+        conn->send_message_to_connection(current_status);
+    }
+
     // in normal circumstances, we're done
     //
     if(!is_debug())
@@ -2135,7 +3952,16 @@ void server::msg_connect(ed::message & msg)
             // with us, make sure we did not reach the maximum
             // number of connections though...
             //
+            // also defer new links while overloaded, the remote
+            // communicatord views us as too busy and tries again later
+            //
             refuse = all_connections.size() >= f_max_connections;
+            if(!refuse
+            && f_overload.is_shedding())
+            {
+                refuse = true;
+                ++f_connect_deferred;
+            }
             if(refuse)
             {
                 // too many connections already, refuse this new
@@ -2166,11 +3992,32 @@ void server::msg_connect(ed::message & msg)
                 {
                     add_neighbors(msg.get_parameter(communicatord::g_name_communicatord_param_neighbors));
                 }
+                if(msg.has_parameter(communicatord::g_name_communicatord_param_capabilities))
+                {
+                    conn->set_capabilities(msg.get_parameter(communicatord::g_name_communicatord_param_capabilities));
+                }
+                reliable_link_started(conn, msg);
+                set_peer_gateway(conn, msg);
+
+                // the remote server and its services are now reachable
+                // through this connection
+                //
+                advgetopt::string_set_t remote_services;
+                conn->get_services(remote_services);
+                advgetopt::string_set_t remote_heard_of;
+                conn->get_services_heard_of(remote_heard_of);
+                f_routes.add_link(remote_server_name, remote_services, conn, remote_heard_of);
+
+                // the heartbeats of a previous connection to that peer
+                // do not count
+                //
+                conn->get_failure_detector().reset();
+                conn->get_clock_offset().reset();
 
-                // we just got some new services information,
-                // refresh our cache
+                // we just got some new services information, let our
+                // other peers know about the changes
                 //
-                refresh_heard_of();
+                add_heard_of_peer(conn);
 
                 // the message expects the ACCEPT reply
                 //
@@ -2189,9 +4036,39 @@ void server::msg_connect(ed::message & msg)
 
                 // heard of
                 //
-                if(!f_services_heard_of.empty())
+                std::string const heard_of(f_heard_of.get_list(conn.get()));
+                if(!heard_of.empty())
+                {
+                    reply.add_parameter(communicatord::g_name_communicatord_param_heard_of, heard_of);
+                }
+
+                // optional features
+                //
+                reply.add_parameter(
+                          communicatord::g_name_communicatord_param_capabilities
+                        , snapdev::join_strings(f_capabilities, ","));
+
+                // tell that daemon which of its reliable messages we
+                // already received
+                //
+                reply.add_parameter(communicatord::g_name_communicatord_param_reliable_session, f_reliable_session);
+                if(conn->has_capability(communicatord::g_name_communicatord_value_reliable))
+                {
+                    reply.add_parameter(
+                              communicatord::g_name_communicatord_param_reliable_ack
+                            , get_reliable_link(remote_server_name).get_received());
+                }
+
+                // our gateway mode and status
+                //
+                if(f_gateway_count > 0)
                 {
-                    reply.add_parameter(communicatord::g_name_communicatord_param_heard_of, f_services_heard_of);
+                    reply.add_parameter(communicatord::g_name_communicatord_param_gateway_mode, gateway_mode_to_string(f_gateway_mode));
+                    reply.add_parameter(
+                              communicatord::g_name_communicatord_param_gateway
+                            , f_gateway
+                                ? communicatord::g_name_communicatord_value_true
+                                : communicatord::g_name_communicatord_value_false);
                 }
 
                 std::string const his_address_str(msg.get_parameter(communicatord::g_name_communicatord_param_my_address));
@@ -2202,6 +4079,7 @@ void server::msg_connect(ed::message & msg)
                         , "tcp"));
 
                 conn->set_connection_address(his_address);
+                setup_link_compression(conn);
 
                 // if a local service was interested in this specific
                 // computer, then we have to start receiving LOADAVG
@@ -2209,6 +4087,14 @@ void server::msg_connect(ed::message & msg)
                 //
                 register_for_loadavg(his_address_str);
 
+                // and if a local service listens to flags, receive the
+                // flag changes of that computer
+                //
+                if(!f_flag_listeners.empty())
+                {
+                    register_for_flags(conn, false);
+                }
+
                 // he is a neighbor too, make sure to add it
                 // in our list of neighbors (useful on a restart
                 // to connect quickly)
@@ -2257,6 +4143,9 @@ void server::msg_connect(ed::message & msg)
         help.set_command(ed::g_name_ed_cmd_help);
         //verify_command(base, help); -- precisely
         conn->send_message_to_connection(help);
+        send_interest_table(conn);
+        send_heard_of_table(conn);
+        replay_reliable_messages(conn);
         broadcast_message(new_remote_connection);
     }
 
@@ -2301,6 +4190,7 @@ void server::msg_disconnect(ed::message & msg)
         // connection item (unconnected)
         //
         conn->set_connection_type(connection_type_t::CONNECTION_TYPE_DOWN);
+        f_routes.remove_connection(conn.get());
 
         remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(conn));
         if(remote_conn == nullptr)
@@ -2336,9 +4226,9 @@ SNAP_LOG_TODO
         }
 
         // we may have lost some services information,
-        // refresh our cache
+        // let our other peers know
         //
-        refresh_heard_of();
+        remove_heard_of_peer(conn.get());
 
         if(!conn->get_server_name().empty())
         {
@@ -2415,6 +4305,33 @@ void server::msg_forget(ed::message & msg)
 }
 
 
+/** \brief A communicator of another site changed its gateway status.
+ *
+ * In hierarchical mode, the gateways only send public broadcasts to the
+ * gateways of the other sites. This message tells us whether the sender
+ * is currently one of them.
+ *
+ * \param[in] msg  The GATEWAY message.
+ */
+void server::msg_gateway(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr
+    || conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_REMOTE
+    || !msg.has_parameter(communicatord::g_name_communicatord_param_gateway))
+    {
+        return;
+    }
+
+    conn->set_gateway(msg.get_parameter(communicatord::g_name_communicatord_param_gateway) == communicatord::g_name_communicatord_value_true);
+}
+
+
 void server::msg_gossip(ed::message & msg)
 {
     if(!is_tcp_connection(msg))
@@ -2522,7 +4439,10 @@ void server::msg_gossip(ed::message & msg)
         // as long as remote_connection::REMOTE_CONNECTION_RECONNECT_TIMEOUT
         // which is currently 5 minutes
         //
-        f_remote_communicators->add_remote_communicator(reply_to);
+        // in overlay mode, the GOSSIP also means that this remote
+        // communicator selected us as one of its active peers
+        //
+        f_remote_communicators->add_remote_communicator(reply_to, true);
         return;
     }
 
@@ -2550,163 +4470,219 @@ void server::msg_gossip(ed::message & msg)
 }
 
 
-void server::msg_list_services(ed::message & msg)
+/** \brief Receive the services heard of by a remote communicator daemon.
+ *
+ * The message either includes the full list (\c heard_of parameter) or
+ * the changes since \c base_version (\c added and \c removed
+ * parameters). The services are written as "<name>:<hops>".
+ *
+ * When the changes are not based on the last version we received, the
+ * full list is requested by replying with a HEARD_OF without a version.
+ * A HEARD_OF without a version is such a request.
+ *
+ * \param[in] msg  The HEARD_OF message.
+ */
+void server::msg_heard_of(ed::message & msg)
 {
-    snapdev::NOT_USED(msg);
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
 
-    ed::connection::vector_t const & all_connections(f_communicator->get_connections());
-    std::string list;
-    std::for_each(
-            all_connections.begin(),
-            all_connections.end(),
-            [&list](auto const & c)
-            {
-                if(!list.empty())
-                {
-                    list += ", ";
-                }
-                list += c->get_name();
-            });
-    SNAP_LOG_INFO
-        << "current list of connections: "
-        << list
-        << SNAP_LOG_SEND;
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr
+    || conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_REMOTE
+    || !f_heard_of.has_peer(conn.get()))
+    {
+        return;
+    }
 
-    // TODO: send a reply so communicators can know of discrepancies
-}
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_version))
+    {
+        send_heard_of_table(conn);
+        return;
+    }
 
+    advgetopt::string_set_t before;
+    f_heard_of.get_peer_heard_of(conn.get(), before);
 
-void server::msg_log_unknown(ed::message & msg)
-{
-    // we sent a command that the other end did not understand
-    // and got an UNKNOWN reply
-    //
-    std::string name("<unknown-connection>");
-    base_connection::pointer_t conn(msg.user_data<base_connection>());
-    if(conn != nullptr)
+    std::int64_t const version(msg.get_integer_parameter(communicatord::g_name_communicatord_param_version));
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_heard_of))
     {
-        ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
-        if(c != nullptr)
+        f_heard_of.set_peer_heard_of(
+                  conn.get()
+                , version
+                , heard_of_table::from_string(msg.get_parameter(communicatord::g_name_communicatord_param_heard_of)));
+    }
+    else
+    {
+        heard_of_table::distance_map_t changes;
+        if(msg.has_parameter(communicatord::g_name_communicatord_param_added))
         {
-            name = c->get_name();
+            changes = heard_of_table::from_string(msg.get_parameter(communicatord::g_name_communicatord_param_added));
+        }
+        if(msg.has_parameter(communicatord::g_name_communicatord_param_removed))
+        {
+            advgetopt::string_set_t removed;
+            snapdev::tokenize_string(
+                      removed
+                    , msg.get_parameter(communicatord::g_name_communicatord_param_removed)
+                    , { "," }
+                    , true);
+            for(auto const & r : removed)
+            {
+                changes[r] = 0;
+            }
+        }
+        std::int64_t const base_version(msg.has_parameter(communicatord::g_name_communicatord_param_base_version)
+                ? msg.get_integer_parameter(communicatord::g_name_communicatord_param_base_version)
+                : -1);
+        if(!f_heard_of.update_peer_heard_of(conn.get(), base_version, version, changes))
+        {
+            // we missed an update, get the full list
+            //
+            ed::message request;
+            request.set_command(communicatord::g_name_communicatord_cmd_heard_of);
+            conn->send_message_to_connection(request);
+            return;
         }
     }
 
-    if(msg.has_parameter(communicatord::g_name_communicatord_param_command))
+    // update the next hops of the services which changed
+    //
+    advgetopt::string_set_t after;
+    f_heard_of.get_peer_heard_of(conn.get(), after);
+    for(auto const & s : before)
     {
-        SNAP_LOG_ERROR
-            << "we sent command \""
-            << msg.get_parameter(communicatord::g_name_communicatord_param_command)
-            << "\" to \""
-            << name
-            << "\" which told us it does not know that command"
-               " so we probably did not get the expected result."
-            << SNAP_LOG_SEND;
+        if(after.find(s) == after.end())
+        {
+            f_routes.remove_heard_of(s, conn.get());
+        }
     }
-    else
+    for(auto const & s : after)
     {
-        SNAP_LOG_ERROR
-            << "we sent a command (name of which was not reported in"
-               " the \"command\" paramter) to "
-            << msg.get_parameter(communicatord::g_name_communicatord_param_command)
-            << "\" to \""
-            << name
-            << "\" which told us it does not know that command"
-               " so we probably did not get the expected result."
-            << SNAP_LOG_SEND;
+        if(before.find(s) == before.end())
+        {
+            f_routes.add_heard_of(s, conn);
+        }
     }
+    conn->set_services_heard_of(after);
+
+    send_heard_of_updates();
 }
 
 
-void server::msg_public_ip(ed::message & msg)
+/** \brief Receive a heartbeat from a remote communicator daemon.
+ *
+ * The arrival time is recorded in the failure detector of that
+ * connection. The first heartbeat starts the detector.
+ *
+ * The heartbeat also includes the time at which it was sent and the
+ * echo of the timestamps of our last heartbeat. Together, these give
+ * one more sample of the offset between the clock of that peer and ours.
+ *
+ * \param[in] msg  The HEARTBEAT message.
+ */
+void server::msg_heartbeat(ed::message & msg)
 {
-    base_connection::pointer_t conn(msg.user_data<base_connection>());
-    if(conn == nullptr)
+    if(!is_tcp_connection(msg))
     {
         return;
     }
 
-    ed::message reply;
-    reply.set_command(communicatord::g_name_communicatord_cmd_server_public_ip);
-    if(!f_public_ip.empty())
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr
+    || conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_REMOTE
+    || f_heartbeat_interval <= 0)
     {
-        reply.add_parameter(communicatord::g_name_communicatord_param_public_ip, f_public_ip);
+        return;
     }
-    if(!f_secure_ip.empty())
+
+    std::int64_t const now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    failure_detector & detector(conn->get_failure_detector());
+    if(detector.is_started())
     {
-        reply.add_parameter(communicatord::g_name_communicatord_param_secure_ip, f_secure_ip);
+        detector.heartbeat(now);
     }
-    if(verify_command(conn, reply))
+    else
     {
-        conn->send_message_to_connection(reply);
+        detector.set_thresholds(f_phi_suspect_threshold, f_phi_down_threshold);
+        detector.start(now, f_heartbeat_interval);
     }
-}
-
-
-void server::msg_quitting(ed::message & msg)
-{
-    snapdev::NOT_USED(msg);
 
-    // the other services will call their stop() function, but the
-    // communicatord does not do that on this message; just inform
-    // the admin with a quick log message
-    //
-    SNAP_LOG_INFO
-        << "Received a "
-        << ed::g_name_ed_cmd_quitting
-        << " as a reply to a message."
-        << SNAP_LOG_SEND;
-}
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_clock_sent))
+    {
+        // peer does not support the clock offset estimation
+        //
+        return;
+    }
 
+    std::int64_t const clock_now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+    std::int64_t const peer_sent(msg.get_integer_parameter(communicatord::g_name_communicatord_param_clock_sent));
+    clock_offset & offset(conn->get_clock_offset());
+    offset.received(peer_sent, clock_now);
 
-void server::msg_refuse(ed::message & msg)
-{
-    if(!is_tcp_connection(msg))
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_clock_echo)
+    || !msg.has_parameter(communicatord::g_name_communicatord_param_clock_received))
     {
         return;
     }
 
-    base_connection::pointer_t conn(msg.user_data<base_connection>());
-    if(conn == nullptr)
+    bool const skewed(offset.is_skewed());
+    if(!offset.sample(
+              msg.get_integer_parameter(communicatord::g_name_communicatord_param_clock_echo)
+            , msg.get_integer_parameter(communicatord::g_name_communicatord_param_clock_received)
+            , peer_sent
+            , clock_now))
     {
         return;
     }
-
-    remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(conn));
-    if(remote_conn == nullptr)
+    if(offset.is_skewed() == skewed)
     {
-        // we have to have a remote connection
-        //
-        SNAP_LOG_ERROR
-            << "REFUSE sent on a connection which is not a remote connection (another communicatord)."
-            << SNAP_LOG_SEND;
         return;
     }
 
-    // we were not connected so we do not have to
-    // disconnect; mark that corresponding server
-    // as too busy or as shutting down and try
-    // connecting again later...
-    //
-    addr::addr peer_addr(remote_conn->get_address());
-    if(msg.has_parameter(communicatord::g_name_communicatord_param_shutdown))
+    if(skewed)
     {
-        f_remote_communicators->shutting_down(peer_addr);
+        SNAP_LOG_INFO
+            << "the clock of remote communicator \""
+            << conn->get_server_name()
+            << "\" is in sync with ours again (offset: "
+            << offset.get_offset()
+            << "us)."
+            << SNAP_LOG_SEND;
     }
     else
     {
-        f_remote_communicators->too_busy(peer_addr);
+        SNAP_LOG_WARNING
+            << "the clock of remote communicator \""
+            << conn->get_server_name()
+            << "\" is off by "
+            << offset.get_offset()
+            << "us (rtt: "
+            << offset.get_rtt()
+            << "us); its timestamps get corrected."
+            << SNAP_LOG_SEND;
     }
-
-    // we are responsible to try again later, so we do not
-    // lose the connection (i.e. it stays in the ed::communicator list),
-    // but we need to disconnect
-    //
-    remote_conn->disconnect();
 }
 
 
-void server::msg_register(ed::message & msg)
+/** \brief Receive the interest summary of a communicator daemon.
+ *
+ * A remote communicator daemon sends the list of commands understood by
+ * the local services of a server (which may be itself or another server
+ * it heard from). The list is either complete (the \c list parameter)
+ * or an incremental update (\c base_version, \c added and \c removed).
+ *
+ * New versions get forwarded to our other peers. When an incremental
+ * update does not apply to the version we have, we request all the
+ * summaries from that peer by sending an INTEREST without a server name.
+ *
+ * \param[in] msg  The INTEREST message.
+ */
+void server::msg_interest(ed::message & msg)
 {
     if(!is_tcp_connection(msg))
     {
@@ -2714,133 +4690,152 @@ void server::msg_register(ed::message & msg)
     }
 
     base_connection::pointer_t conn(msg.user_data<base_connection>());
-    if(conn == nullptr)
+    if(conn == nullptr
+    || conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_REMOTE)
     {
         return;
     }
 
-    if(!msg.has_parameter(communicatord::g_name_communicatord_param_service)
-    || !msg.has_parameter(communicatord::g_name_communicatord_param_version))
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_server_name))
+    {
+        send_interest_table(conn);
+        return;
+    }
+
+    std::string const server_name(msg.get_parameter(communicatord::g_name_communicatord_param_server_name));
+    if(server_name == f_server_name)
+    {
+        // our own summary coming back
+        //
+        return;
+    }
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_version))
     {
         SNAP_LOG_ERROR
-            << communicatord::g_name_communicatord_cmd_register
-            << " was called without a \""
-            << communicatord::g_name_communicatord_param_service
-            << "\" and/or a \""
+            << communicatord::g_name_communicatord_cmd_interest
+            << " for \""
+            << server_name
+            << "\" was sent without a \""
             << communicatord::g_name_communicatord_param_version
-            << "\" parameter, both are mandatory."
+            << "\" parameter."
             << SNAP_LOG_SEND;
         return;
     }
 
-    if(!msg.check_version_parameter())
+    std::int64_t const version(msg.get_integer_parameter(communicatord::g_name_communicatord_param_version));
+    bool const opaque(msg.has_parameter(communicatord::g_name_communicatord_param_opaque)
+                   && msg.get_parameter(communicatord::g_name_communicatord_param_opaque) == communicatord::g_name_communicatord_value_true);
+
+    interest_update_t result(interest_update_t::INTEREST_UPDATE_IGNORED);
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_list))
     {
-        SNAP_LOG_ERROR
-            << communicatord::g_name_communicatord_cmd_register
-            << " was called with an incompatible version; expected "
-            << ed::MESSAGE_VERSION
-            << ", received "
-            << msg.get_message_version()
-            << '.'
-            << SNAP_LOG_SEND;
-        return;
+        result = f_interests.update(
+                  server_name
+                , version
+                , msg.get_parameter(communicatord::g_name_communicatord_param_list)
+                , opaque);
     }
-
-    // the "service" parameter is the name of the service,
-    // now we can process messages for this service
-    //
-    std::string const service_name(msg.get_parameter(communicatord::g_name_communicatord_param_service));
-    if(service_name.empty())
+    else if(msg.has_parameter(communicatord::g_name_communicatord_param_base_version))
+    {
+        result = f_interests.apply(
+                  server_name
+                , msg.get_integer_parameter(communicatord::g_name_communicatord_param_base_version)
+                , version
+                , msg.has_parameter(communicatord::g_name_communicatord_param_added)
+                    ? msg.get_parameter(communicatord::g_name_communicatord_param_added)
+                    : std::string()
+                , msg.has_parameter(communicatord::g_name_communicatord_param_removed)
+                    ? msg.get_parameter(communicatord::g_name_communicatord_param_removed)
+                    : std::string()
+                , opaque);
+    }
+    else
     {
         SNAP_LOG_ERROR
-            << communicatord::g_name_communicatord_cmd_register
-            << " had a \""
-            << communicatord::g_name_communicatord_param_service
-            << "\" parameter, but it is empty, which is not valid."
+            << communicatord::g_name_communicatord_cmd_interest
+            << " for \""
+            << server_name
+            << "\" was sent without a \""
+            << communicatord::g_name_communicatord_param_list
+            << "\" or a \""
+            << communicatord::g_name_communicatord_param_base_version
+            << "\" parameter."
             << SNAP_LOG_SEND;
         return;
     }
 
+    switch(result)
     {
-        unix_connection::pointer_t unix_conn(std::dynamic_pointer_cast<unix_connection>(conn));
-        if(unix_conn == nullptr)
-        {
-            service_connection::pointer_t service_conn(std::dynamic_pointer_cast<service_connection>(conn));
-            if(service_conn == nullptr)
-            {
-                SNAP_LOG_ERROR
-                    << "only local services are expected to "
-                    << communicatord::g_name_communicatord_cmd_register
-                    << " with the communicatord service."
-                    << SNAP_LOG_SEND;
-                return;
-            }
-            service_conn->properly_named();
-        }
-        else
+    case interest_update_t::INTEREST_UPDATE_IGNORED:
+        return;
+
+    case interest_update_t::INTEREST_UPDATE_MISMATCH:
         {
-            unix_conn->properly_named();
+            ed::message request;
+            request.set_command(communicatord::g_name_communicatord_cmd_interest);
+            conn->send_message_to_connection(request);
         }
-    }
-
-    ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
-    if(c == nullptr)
-    {
-        throw communicatord::logic_error("the service_connection and unix_connection are both derived from ed::connection, c == nullptr should never happen.");
-    }
-
-    SNAP_LOG_VERBOSE
-        << "service named \""
-        << service_name
-        << "\" just registered."
-        << SNAP_LOG_SEND;
-
-    c->set_name(service_name);
+        return;
 
-    conn->set_connection_type(connection_type_t::CONNECTION_TYPE_LOCAL);
+    case interest_update_t::INTEREST_UPDATE_APPLIED:
+        break;
 
-    // connection is up now
-    //
-    conn->connection_started();
+    }
 
-    // request the COMMANDS of this connection
+    // the version changed, let our other peers know
     //
-    ed::message help;
-    help.set_command(ed::g_name_ed_cmd_help);
-    //verify_command(base, help); -- we cannot do that here since we did not yet get the COMMANDS reply
-    conn->send_message_to_connection(help);
+    routing_table::connection_vector_t links;
+    f_routes.get_links(links);
+    for(auto const & l : links)
+    {
+        if(l != conn
+        && l->has_capability(communicatord::g_name_communicatord_value_interest))
+        {
+            ed::message forward(msg);
+            l->send_message_to_connection(forward);
+        }
+    }
+}
 
-    // tell the connection we are ready
-    // (many connections use that as a trigger to start work)
-    //
-    ed::message reply;
-    reply.set_command(ed::g_name_ed_cmd_ready);
-    reply.add_parameter(communicatord::g_name_communicatord_param_my_address, f_connection_address);
-    //verify_command(base, reply); -- we cannot do that here since we did not yet get the COMMANDS reply
-    conn->send_message_to_connection(reply);
 
-    // status changed for this connection
-    //
-    send_status(c);
+void server::msg_list_services(ed::message & msg)
+{
+    snapdev::NOT_USED(msg);
 
-    // if we have local messages that were cached, then
-    // forward them now
-    //
-    f_local_message_cache.process_messages(
-        [service_name, conn](ed::message & cached_msg)
-        {
-            if(cached_msg.get_service() != service_name)
+    ed::connection::vector_t const & all_connections(f_communicator->get_connections());
+    std::string list;
+    std::for_each(
+            all_connections.begin(),
+            all_connections.end(),
+            [&list](auto const & c)
             {
-                return false;
-            }
+                if(!list.empty())
+                {
+                    list += ", ";
+                }
+                list += c->get_name();
+            });
+    SNAP_LOG_INFO
+        << "current list of connections: "
+        << list
+        << " ("
+        << f_received_broadcast_messages.size()
+        << " broadcast message identifiers remembered)"
+        << SNAP_LOG_SEND;
 
-            conn->send_message_to_connection(cached_msg);
-            return true;
-        });
+    // TODO: send a reply so communicators can know of discrepancies
 }
 
 
-void server::msg_register_for_loadavg(ed::message & msg)
+/** \brief Reply with the current metrics.
+ *
+ * A service can send the METRICS message to get the daemon counters.
+ * The reply is a METRICS_REPORT message with the metrics in the
+ * Prometheus text format (see get_metrics()).
+ *
+ * \param[in] msg  The METRICS message.
+ */
+void server::msg_metrics(ed::message & msg)
 {
     if(!is_tcp_connection(msg))
     {
@@ -2853,77 +4848,102 @@ void server::msg_register_for_loadavg(ed::message & msg)
         return;
     }
 
-    conn->set_wants_loadavg(true);
-    f_loadavg_timer->set_enable(true);
+    ed::message reply;
+    reply.set_command(communicatord::g_name_communicatord_cmd_metrics_report);
+    reply.add_parameter(communicatord::g_name_communicatord_param_metrics, get_metrics());
+    communicatord::copy_correlation_id(msg, reply);
+    if(verify_command(conn, reply))
+    {
+        conn->send_message_to_connection(reply);
+    }
 }
 
 
-void server::msg_service_status(ed::message & msg)
+void server::msg_log_unknown(ed::message & msg)
 {
-    if(!msg.has_parameter(communicatord::g_name_communicatord_param_service))
+    // we sent a command that the other end did not understand
+    // and got an UNKNOWN reply
+    //
+    std::string name("<unknown-connection>");
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn != nullptr)
+    {
+        ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
+        if(c != nullptr)
+        {
+            name = c->get_name();
+        }
+    }
+
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_command))
     {
         SNAP_LOG_ERROR
-            << "The "
-            << communicatord::g_name_communicatord_cmd_service_status
-            << " command must have a \""
-            << communicatord::g_name_communicatord_param_service
-            << "\" parameter."
+            << "we sent command \""
+            << msg.get_parameter(communicatord::g_name_communicatord_param_command)
+            << "\" to \""
+            << name
+            << "\" which told us it does not know that command"
+               " so we probably did not get the expected result."
             << SNAP_LOG_SEND;
-        return;
     }
-    std::string const & service_name(msg.get_parameter(communicatord::g_name_communicatord_param_service));
-    if(service_name.empty())
+    else
     {
         SNAP_LOG_ERROR
-            << "The "
-            << communicatord::g_name_communicatord_cmd_service_status
-            << "'s service parameter cannot be an empty string."
+            << "we sent a command (name of which was not reported in"
+               " the \"command\" paramter) to "
+            << msg.get_parameter(communicatord::g_name_communicatord_param_command)
+            << "\" to \""
+            << name
+            << "\" which told us it does not know that command"
+               " so we probably did not get the expected result."
             << SNAP_LOG_SEND;
-        return;
     }
+}
+
 
+void server::msg_public_ip(ed::message & msg)
+{
     base_connection::pointer_t conn(msg.user_data<base_connection>());
     if(conn == nullptr)
     {
         return;
     }
 
-    ed::connection::vector_t const & named_connections(f_communicator->get_connections());
-    auto const named_service(std::find_if(
-                  named_connections.begin()
-                , named_connections.end()
-                , [service_name](auto const & named_connection)
-                {
-                    return named_connection->get_name() == service_name;
-                }));
-    ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
-    if(named_service == named_connections.end())
+    ed::message reply;
+    reply.set_command(communicatord::g_name_communicatord_cmd_server_public_ip);
+    if(!f_public_ip.empty())
     {
-        // service is totally unknown
-        //
-        // create a fake connection so we can call the
-        // send_status() function
-        //
-        ed::connection::pointer_t fake_connection(std::make_shared<ed::timer>(0));
-        fake_connection->set_name(service_name);
-        send_status(fake_connection, &c);
+        reply.add_parameter(communicatord::g_name_communicatord_param_public_ip, f_public_ip);
     }
-    else
+    if(!f_secure_ip.empty())
     {
-        send_status(*named_service, &c);
+        reply.add_parameter(communicatord::g_name_communicatord_param_secure_ip, f_secure_ip);
+    }
+    communicatord::copy_correlation_id(msg, reply);
+    if(verify_command(conn, reply))
+    {
+        conn->send_message_to_connection(reply);
     }
 }
 
 
-void server::msg_shutdown(ed::message & msg)
+void server::msg_quitting(ed::message & msg)
 {
     snapdev::NOT_USED(msg);
 
-    stop(true);
+    // the other services will call their stop() function, but the
+    // communicatord does not do that on this message; just inform
+    // the admin with a quick log message
+    //
+    SNAP_LOG_INFO
+        << "Received a "
+        << ed::g_name_ed_cmd_quitting
+        << " as a reply to a message."
+        << SNAP_LOG_SEND;
 }
 
 
-void server::msg_unregister(ed::message & msg)
+void server::msg_refuse(ed::message & msg)
 {
     if(!is_tcp_connection(msg))
     {
@@ -2936,998 +4956,2902 @@ void server::msg_unregister(ed::message & msg)
         return;
     }
 
-    if(!msg.has_parameter(communicatord::g_name_communicatord_param_service))
+    remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(conn));
+    if(remote_conn == nullptr)
     {
+        // we have to have a remote connection
+        //
         SNAP_LOG_ERROR
-            << communicatord::g_name_communicatord_cmd_unregister
-            << " was called without a \""
-            << communicatord::g_name_communicatord_param_service
-            << "\" parameter, which is mandatory."
+            << "REFUSE sent on a connection which is not a remote connection (another communicatord)."
             << SNAP_LOG_SEND;
         return;
     }
 
-    // mark connection as being DOWN
-    //
-    conn->set_connection_type(connection_type_t::CONNECTION_TYPE_DOWN);
-
-    // connection is down now
-    //
-    conn->connection_ended();
-
-    // status changed for this connection
+    // we were not connected so we do not have to
+    // disconnect; mark that corresponding server
+    // as too busy or as shutting down and try
+    // connecting again later...
     //
-    ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
-    if(c != nullptr)
+    addr::addr peer_addr(remote_conn->get_address());
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_shutdown))
     {
-        send_status(c);
-
-        // now remove the service name
-        // (send_status() above needs the name to still be in place!)
-        //
-        c->set_name(std::string());
-
-        // get rid of that connection now (it is faster than
-        // waiting for the HUP because it will not be in the
-        // list of connections on the next loop).
-        //
-        f_communicator->remove_connection(c);
+        f_remote_communicators->shutting_down(peer_addr);
     }
-}
-
-
-void server::msg_unregister_from_loadavg(ed::message & msg)
-{
-    if(!is_tcp_connection(msg))
+    else
     {
-        return;
+        f_remote_communicators->too_busy(peer_addr);
     }
 
-    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    // we are responsible to try again later, so we do not
+    // lose the connection (i.e. it stays in the ed::communicator list),
+    // but we need to disconnect
+    //
+    remote_conn->disconnect();
+}
+
+
+void server::msg_register(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr)
+    {
+        return;
+    }
+
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_service)
+    || !msg.has_parameter(communicatord::g_name_communicatord_param_version))
+    {
+        SNAP_LOG_ERROR
+            << communicatord::g_name_communicatord_cmd_register
+            << " was called without a \""
+            << communicatord::g_name_communicatord_param_service
+            << "\" and/or a \""
+            << communicatord::g_name_communicatord_param_version
+            << "\" parameter, both are mandatory."
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    if(!msg.check_version_parameter())
+    {
+        SNAP_LOG_ERROR
+            << communicatord::g_name_communicatord_cmd_register
+            << " was called with an incompatible version; expected "
+            << ed::MESSAGE_VERSION
+            << ", received "
+            << msg.get_message_version()
+            << '.'
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    // the "service" parameter is the name of the service,
+    // now we can process messages for this service
+    //
+    std::string const service_name(msg.get_parameter(communicatord::g_name_communicatord_param_service));
+    if(service_name.empty())
+    {
+        SNAP_LOG_ERROR
+            << communicatord::g_name_communicatord_cmd_register
+            << " had a \""
+            << communicatord::g_name_communicatord_param_service
+            << "\" parameter, but it is empty, which is not valid."
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    ed::connection::pointer_t c;
+    {
+        auto const unix_it(f_unix_connections.find(conn.get()));
+        if(unix_it != f_unix_connections.end())
+        {
+            unix_it->second->properly_named();
+            c = unix_it->second;
+        }
+        else
+        {
+            auto service_it(f_local_connections.find(conn.get()));
+            if(service_it == f_local_connections.end())
+            {
+                service_it = f_inbound_connections.find(conn.get());
+                if(service_it == f_inbound_connections.end())
+                {
+                    SNAP_LOG_ERROR
+                        << "only local services are expected to "
+                        << communicatord::g_name_communicatord_cmd_register
+                        << " with the communicatord service."
+                        << SNAP_LOG_SEND;
+                    return;
+                }
+            }
+            service_it->second->properly_named();
+            c = service_it->second;
+        }
+    }
+
+    SNAP_LOG_VERBOSE
+        << "service named \""
+        << service_name
+        << "\" just registered."
+        << SNAP_LOG_SEND;
+
+    c->set_name(service_name);
+
+    // limit the output queue; the service may choose what happens once
+    // it is reached
+    //
+    conn->set_output_limits(
+              f_output_high_bytes
+            , f_output_high_messages
+            , f_output_low_bytes
+            , f_output_low_messages);
+    slow_consumer_policy_t policy(f_slow_consumer_policy);
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_slow_consumer))
+    {
+        std::string const name(msg.get_parameter(communicatord::g_name_communicatord_param_slow_consumer));
+        if(!parse_slow_consumer_policy(name, policy))
+        {
+            SNAP_LOG_ERROR
+                << "unknown \""
+                << communicatord::g_name_communicatord_param_slow_consumer
+                << "\" policy \""
+                << name
+                << "\" in REGISTER of \""
+                << service_name
+                << "\"."
+                << SNAP_LOG_SEND;
+            policy = f_slow_consumer_policy;
+        }
+    }
+    conn->set_slow_consumer_policy(policy);
+
+    conn->set_connection_type(connection_type_t::CONNECTION_TYPE_LOCAL);
+    f_routes.add_route(f_server_name, service_name, conn);
+
+    // connection is up now
+    //
+    conn->connection_started();
+
+    // request the COMMANDS of this connection
+    //
+    ed::message help;
+    help.set_command(ed::g_name_ed_cmd_help);
+    //verify_command(base, help); -- we cannot do that here since we did not yet get the COMMANDS reply
+    conn->send_message_to_connection(help);
+
+    // tell the connection we are ready
+    // (many connections use that as a trigger to start work)
+    //
+    ed::message reply;
+    reply.set_command(ed::g_name_ed_cmd_ready);
+    reply.add_parameter(communicatord::g_name_communicatord_param_my_address, f_connection_address);
+    //verify_command(base, reply); -- we cannot do that here since we did not yet get the COMMANDS reply
+    conn->send_message_to_connection(reply);
+
+    // status changed for this connection
+    //
+    send_status(c);
+
+    // if we have local messages that were cached, then
+    // forward them now; stop once the connection is congested, the
+    // rest gets sent by consumer_recovered() (sending to a congested
+    // connection would cache the message again)
+    //
+    f_local_message_cache.process_messages(
+          service_name
+        , [conn](ed::message & cached_msg)
+        {
+            return !conn->is_output_congested()
+                && conn->send_message_to_connection(cached_msg);
+        });
+    update_cache_timer();
+}
+
+
+void server::msg_register_for_loadavg(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr)
+    {
+        return;
+    }
+
+    conn->set_wants_loadavg(true);
+    f_loadavg_connections[conn.get()] = conn;
+    f_loadavg_timer->set_enable(true);
+}
+
+
+void server::msg_service_status(ed::message & msg)
+{
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_service))
+    {
+        SNAP_LOG_ERROR
+            << "The "
+            << communicatord::g_name_communicatord_cmd_service_status
+            << " command must have a \""
+            << communicatord::g_name_communicatord_param_service
+            << "\" parameter."
+            << SNAP_LOG_SEND;
+        return;
+    }
+    std::string const & service_name(msg.get_parameter(communicatord::g_name_communicatord_param_service));
+    if(service_name.empty())
+    {
+        SNAP_LOG_ERROR
+            << "The "
+            << communicatord::g_name_communicatord_cmd_service_status
+            << "'s service parameter cannot be an empty string."
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr)
+    {
+        return;
+    }
+
+    ed::connection::vector_t const & named_connections(f_communicator->get_connections());
+    auto const named_service(std::find_if(
+                  named_connections.begin()
+                , named_connections.end()
+                , [service_name](auto const & named_connection)
+                {
+                    return named_connection->get_name() == service_name;
+                }));
+    ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
+    if(named_service == named_connections.end())
+    {
+        // service is totally unknown
+        //
+        // create a fake connection so we can call the
+        // send_status() function
+        //
+        ed::connection::pointer_t fake_connection(std::make_shared<ed::timer>(0));
+        fake_connection->set_name(service_name);
+        send_status(fake_connection, &c);
+    }
+    else
+    {
+        send_status(*named_service, &c);
+    }
+}
+
+
+/** \brief A "cdm:" service requests a shared memory channel.
+ *
+ * The channel gets created immediately and kept along a random token.
+ * The SHM_READY reply includes that token and the path to the shared
+ * memory socket. The service then connects to that socket and sends
+ * the token to retrieve the channel descriptors (see
+ * send_shm_channel()).
+ *
+ * If the shared memory socket is turned off, the request is ignored
+ * and the service keeps using its Unix socket.
+ *
+ * \param[in] msg  The SHM_REQUEST message.
+ */
+void server::msg_shm_request(ed::message & msg)
+{
+    unix_connection::pointer_t conn(std::dynamic_pointer_cast<unix_connection>(msg.user_data<base_connection>()));
+    if(conn == nullptr
+    || f_shm_listener == nullptr)
+    {
+        SNAP_LOG_NOTICE
+            << "ignoring "
+            << communicatord::g_name_communicatord_cmd_shm_request
+            << " since shared memory channels are not available on this connection."
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    communicatord::shm_channel::pointer_t channel(communicatord::shm_channel::create(f_shm_ring_size));
+    if(channel == nullptr)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "could not create a shared memory channel (errno: "
+            << e
+            << " -- "
+            << strerror(e)
+            << ")."
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    // forget about the requests which were never completed
+    //
+    time_t const now(time(nullptr));
+    for(auto it(f_pending_shm_channels.begin()); it != f_pending_shm_channels.end(); )
+    {
+        if(it->second.f_requested_on + 10 < now)
+        {
+            it = f_pending_shm_channels.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    std::random_device rd;
+    std::stringstream ss;
+    ss << std::hex;
+    for(int i(0); i < 4; ++i)
+    {
+        ss << std::setw(8) << std::setfill('0') << rd();
+    }
+    std::string const token(ss.str());
+
+    pending_shm_channel & pending(f_pending_shm_channels[token]);
+    pending.f_channel = channel;
+    pending.f_connection = conn;
+    pending.f_requested_on = now;
+
+    ed::message reply;
+    reply.set_command(communicatord::g_name_communicatord_cmd_shm_ready);
+    reply.set_service(conn->get_name());
+    reply.add_parameter(communicatord::g_name_communicatord_param_path, f_shm_path);
+    reply.add_parameter(communicatord::g_name_communicatord_param_token, token);
+    conn->send_message_to_connection(reply);
+}
+
+
+/** \brief A "cdm:" service starts using its shared memory channel.
+ *
+ * \param[in] msg  The SHM_ACTIVE message.
+ */
+void server::msg_shm_active(ed::message & msg)
+{
+    unix_connection::pointer_t conn(std::dynamic_pointer_cast<unix_connection>(msg.user_data<base_connection>()));
+    if(conn != nullptr)
+    {
+        conn->start_shm_input();
+    }
+}
+
+
+/** \brief Send the descriptors of a shared memory channel.
+ *
+ * This function is called by the shm_listener once a client sent its
+ * token. The client must be the same process as the one which sent the
+ * SHM_REQUEST message.
+ *
+ * \param[in] token  The token the client sent.
+ * \param[in] socket  The socket connected to that client.
+ */
+void server::send_shm_channel(std::string const & token, int socket)
+{
+    auto it(f_pending_shm_channels.find(token));
+    if(it == f_pending_shm_channels.end())
+    {
+        SNAP_LOG_WARNING
+            << "received an unknown shared memory channel token."
+            << SNAP_LOG_SEND;
+        return;
+    }
+    pending_shm_channel const pending(it->second);
+    f_pending_shm_channels.erase(it);
+
+    unix_connection::pointer_t conn(pending.f_connection.lock());
+    if(conn == nullptr)
+    {
+        return;
+    }
+
+    ucred client_cred = {};
+    ucred service_cred = {};
+    socklen_t client_size(sizeof(client_cred));
+    socklen_t service_size(sizeof(service_cred));
+    if(getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &client_cred, &client_size) != 0
+    || getsockopt(conn->get_socket(), SOL_SOCKET, SO_PEERCRED, &service_cred, &service_size) != 0
+    || client_cred.pid != service_cred.pid)
+    {
+        SNAP_LOG_WARNING
+            << "a shared memory channel token was sent by the wrong process."
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    if(pending.f_channel->send_descriptors(socket))
+    {
+        conn->attach_shm(pending.f_channel);
+    }
+}
+
+
+void server::msg_shutdown(ed::message & msg)
+{
+    snapdev::NOT_USED(msg);
+
+    stop(true);
+}
+
+
+void server::msg_unregister(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr)
+    {
+        return;
+    }
+
+    if(!msg.has_parameter(communicatord::g_name_communicatord_param_service))
+    {
+        SNAP_LOG_ERROR
+            << communicatord::g_name_communicatord_cmd_unregister
+            << " was called without a \""
+            << communicatord::g_name_communicatord_param_service
+            << "\" parameter, which is mandatory."
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    // mark connection as being DOWN
+    //
+    conn->set_connection_type(connection_type_t::CONNECTION_TYPE_DOWN);
+    f_routes.remove_connection(conn.get());
+
+    // connection is down now
+    //
+    conn->connection_ended();
+
+    // status changed for this connection
+    //
+    ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
+    if(c != nullptr)
+    {
+        send_status(c);
+
+        // now remove the service name
+        // (send_status() above needs the name to still be in place!)
+        //
+        c->set_name(std::string());
+
+        // get rid of that connection now (it is faster than
+        // waiting for the HUP because it will not be in the
+        // list of connections on the next loop).
+        //
+        f_communicator->remove_connection(c);
+    }
+}
+
+
+void server::msg_unregister_from_loadavg(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr)
+    {
+        return;
+    }
+
+    conn->set_wants_loadavg(false);
+    f_loadavg_connections.erase(conn.get());
+
+    // check whether all connections are now unregistered
+    //
+    if(f_loadavg_connections.empty())
+    {
+        // no more connections requiring LOADAVG messages
+        // so stop the timer
+        //
+        f_loadavg_timer->set_enable(false);
+    }
+}
+
+
+
+
+void server::broadcast_message(
+      ed::message & msg
+    , base_connection::vector_t const & accepting_remote_connections)
+{
+    std::string broadcast_msgid;
+    std::string informed_neighbors;
+    std::string informed_filter_str;
+    int hops(0);
+    time_t timeout(0);
+
+    // note: the "broacast_msgid" is required when we end up sending that
+    //       message forward to some other computers; so we have to go
+    //       through that if() block; however, the timeout was already
+    //       already checked, so we probably would not need it to do
+    //       it again?
+    //
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_broadcast_msgid))
+    {
+        // check whether the message already timed out
+        //
+        // this is a safety feature of our broadcasting capability
+        // which should rarely be activated unless you have multiple
+        // data center locations
+        //
+        timeout = msg.get_integer_parameter(communicatord::g_name_communicatord_param_broadcast_timeout);
+        time_t const now(time(nullptr));
+        if(timeout < now)
+        {
+            return;
+        }
+
+        // check whether we already received that message, if so ignore
+        // the second instance (it should not happen with the list of
+        // neighbors included in the message, but just in case...)
+        //
+        // the add() function also deletes "received messages" that have
+        // now timed out (because such are not going to be forwarded since
+        // we check the timeout of a message early and prevent the
+        // broadcasting in that case)
+        //
+        broadcast_msgid = msg.get_parameter(communicatord::g_name_communicatord_param_broadcast_msgid);
+        if(!f_received_broadcast_messages.add(broadcast_msgid, timeout, now))     // message arrived again?
+        {
+            // note that although we include neighbors it is normal that
+            // this happens in a cluster where some computers are not
+            // aware of certain nodes; for example, if A sends a
+            // message to B and C, both B and C know of a node D
+            // which is unknown to A, then both B and C will end
+            // up forward that same message to D, so D will discard
+            // the second instance it receives.
+            //
+            return;
+        }
+
+        // Note: we skip the canonicalization on this list of neighbors
+        //       because we assume only us (communicatord) handles
+        //       that message and we know that it is already
+        //       canonicalized here
+        //
+        if(msg.has_parameter(communicatord::g_name_communicatord_param_broadcast_informed_neighbors))
+        {
+            informed_neighbors = msg.get_parameter(communicatord::g_name_communicatord_param_broadcast_informed_neighbors);
+        }
+
+        // peers which support it send a Bloom filter of the informed
+        // neighbors instead of the list
+        //
+        if(msg.has_parameter(communicatord::g_name_communicatord_param_broadcast_informed_filter))
+        {
+            informed_filter_str = msg.get_parameter(communicatord::g_name_communicatord_param_broadcast_informed_filter);
+        }
+
+        // get the number of hops this message already performed
+        //
+        hops = msg.get_integer_parameter("broadcast_hops");
+    }
+
+    add_trace_hop(msg);
+
+    advgetopt::string_set_t informed_neighbors_list;
+    snapdev::tokenize_string(
+              informed_neighbors_list
+            , informed_neighbors
+            , { "," }
+            , true);
+
+    bloom_filter informed_filter(std::max(f_all_neighbors.size(), informed_neighbors_list.size()) + 1);
+    bool const has_informed_filter(!informed_filter_str.empty()
+                                && informed_filter.from_string(informed_filter_str));
+
+    // we always broadcast to all local services
+    //
+    base_connection::vector_t broadcast_connection;
+
+    // add a remote connection to the list of connections receiving
+    // the broadcast unless that neighbor was already informed
+    //
+    auto add_neighbor = [&broadcast_connection, &informed_neighbors_list, &informed_filter, has_informed_filter](
+                  base_connection::pointer_t const & conn
+                , addr::addr const & remote_address)
+    {
+        std::string const address(remote_address.to_ipv4or6_string(addr::STRING_IP_ADDRESS));
+        auto it(informed_neighbors_list.find(address));
+        if(it == informed_neighbors_list.end()
+        && (!has_informed_filter || !informed_filter.contains(address)))
+        {
+            // not in the list of informed neighbors, add it and
+            // keep conn in a list that we can use to actually send
+            // the broadcast message
+            //
+            informed_neighbors_list.insert(address);
+            broadcast_connection.push_back(conn);
+        }
+    };
+
+    if(accepting_remote_connections.empty())
+    {
+        std::string destination(communicatord::g_name_communicatord_service_private_broadcast);
+        std::string const service(msg.get_service());
+        if(service != communicatord::g_name_communicatord_service_local_broadcast
+        && service != communicatord::g_name_communicatord_service_private_broadcast
+        && service != communicatord::g_name_communicatord_service_public_broadcast)
+        {
+            // try with the server name instead (which may be "." or "*")
+            // TODO: clean this up; I think only "*" is valid here...
+            //
+            destination = msg.get_server();
+            if(destination.empty())
+            {
+                destination = communicatord::g_name_communicatord_service_private_broadcast;
+            }
+        }
+        else
+        {
+            destination = service;
+        }
+        bool const all(hops < 5 && destination == communicatord::g_name_communicatord_service_public_broadcast);
+        bool const remote(hops < 5 && (all || destination == communicatord::g_name_communicatord_service_private_broadcast));
+
+        // the same message is sent to all the local services
+        //
+        serialized_message local_msg(msg);
+
+        // search the command identifier only once
+        //
+        command_id_t const command_id(find_command(msg.get_command()));
+
+        // a remote communicator which advertised that nobody on it
+        // understands this command still needs the broadcast if it
+        // may relay it to a server we are not directly connected to
+        //
+        bool wanted_beyond(true);
+        if(remote
+        && f_broadcast_interest)
+        {
+            advgetopt::string_set_t direct;
+            direct.insert(f_server_name);
+            routing_table::connection_vector_t links;
+            f_routes.get_links(links);
+            for(auto const & l : links)
+            {
+                direct.insert(l->get_server_name());
+            }
+            wanted_beyond = f_interests.wanted_beyond(msg.get_command(), direct);
+        }
+        auto add_interested_neighbor = [this, &msg, &add_neighbor, wanted_beyond](
+                  base_connection::pointer_t const & conn
+                , addr::addr const & remote_address)
+        {
+            if(peer_wants_broadcast(conn, msg.get_command(), wanted_beyond))
+            {
+                add_neighbor(conn, remote_address);
+            }
+            else
+            {
+                ++f_broadcast_skipped;
+            }
+        };
+
+        // the peers in other data centers are selected last since in
+        // hierarchical mode only the gateways send messages to them
+        //
+        public_peer_vector_t public_peers;
+
+        // a service or communicatord that connected to us
+        //
+        auto process_service_connection = [command_id, &msg, &local_msg, &add_interested_neighbor, &public_peers, all, remote](
+                    service_connection::pointer_t const & conn)
+        {
+            bool broadcast(false);
+            switch(conn->get_address().get_network_type())
+            {
+            case addr::network_type_t::NETWORK_TYPE_LOOPBACK:
+                // these are localhost services, avoid sending the
+                // message is the destination does not know the
+                // command
+                //
+                if(conn->understand_command(command_id, msg.get_command())) // destination: "*" or "?" or "."
+                {
+                    //verify_command(conn, message); -- we reach this line only if the command is understood, it is therefore good
+                    local_msg.send(conn);
+                }
+                break;
+
+            case addr::network_type_t::NETWORK_TYPE_PRIVATE:
+                // these are computers within the same local network (LAN)
+                // we forward messages if at least 'remote' is true
+                //
+                broadcast = remote; // destination: "*" or "?"
+                break;
+
+            case addr::network_type_t::NETWORK_TYPE_PUBLIC:
+                // these are computers in another data center
+                // we forward messages only when 'all' is true
+                //
+                if(all) // destination: "*"
+                {
+                    public_peers.emplace_back(conn, conn->get_address());
+                }
+                break;
+
+            default:
+                // unknown/unexpected type of IP address, totally ignore
+                break;
+
+            }
+            if(broadcast)
+            {
+                add_interested_neighbor(conn, conn->get_address());
+            }
+        };
+        for(auto const & c : f_local_connections)
+        {
+            process_service_connection(c.second);
+        }
+        for(auto const & c : f_inbound_connections)
+        {
+            process_service_connection(c.second);
+        }
+
+        // services connected through the Unix socket are always local
+        //
+        for(auto const & c : f_unix_connections)
+        {
+            if(c.second->understand_command(command_id, msg.get_command()))
+            {
+                local_msg.send(c.second);
+            }
+        }
+
+        // another communicatord we connected to
+        //
+        for(auto const & c : f_outbound_connections)
+        {
+            remote_connection::pointer_t const & remote_conn(c.second);
+            bool broadcast(false);
+            switch(remote_conn->get_address().get_network_type())
+            {
+            case addr::network_type_t::NETWORK_TYPE_LOOPBACK:
+                {
+                    static bool warned(false);
+                    if(!warned)
+                    {
+                        warned = true;
+                        SNAP_LOG_WARNING
+                            << "remote communicator was connected on a LOOPBACK IP address..."
+                            << SNAP_LOG_SEND;
+                    }
+                }
+                break;
+
+            case addr::network_type_t::NETWORK_TYPE_PRIVATE:
+                // these are computers within the same local network (LAN)
+                // we forward messages if at least 'remote' is true
+                //
+                broadcast = remote; // destination: "*" or "?"
+                break;
+
+            case addr::network_type_t::NETWORK_TYPE_PUBLIC:
+                // these are computers in another data center
+                // we forward messages only when 'all' is true
+                //
+                if(all) // destination: "*"
+                {
+                    public_peers.emplace_back(remote_conn, remote_conn->get_address());
+                }
+                break;
+
+            default:
+                // unknown/unexpected type of IP address, totally ignore
+                break;
+
+            }
+            if(broadcast)
+            {
+                add_interested_neighbor(remote_conn, remote_conn->get_address());
+            }
+        }
+
+        // in hierarchical mode, the gateways of our site relay the
+        // message to the other sites
+        //
+        base_connection::vector_t relays;
+        select_public_peers(public_peers, relays);
+        for(auto const & p : public_peers)
+        {
+            add_interested_neighbor(p.first, p.second);
+        }
+        for(auto const & r : relays)
+        {
+            add_neighbor(r, r->get_connection_address());
+        }
+    }
+    else
+    {
+        // we already have a list, copy that list only as it is already
+        // well defined
+        //
+        for(auto const & nc : accepting_remote_connections)
+        {
+            auto const inbound(f_inbound_connections.find(nc.get()));
+            if(inbound != f_inbound_connections.end())
+            {
+                add_neighbor(nc, inbound->second->get_address());
+                continue;
+            }
+            auto const outbound(f_outbound_connections.find(nc.get()));
+            if(outbound != f_outbound_connections.end())
+            {
+                add_neighbor(nc, outbound->second->get_address());
+                continue;
+            }
+            auto const local(f_local_connections.find(nc.get()));
+            if(local != f_local_connections.end())
+            {
+                add_neighbor(nc, local->second->get_address());
+            }
+        }
+    }
+
+    // while overloaded, only the critical broadcasts are forwarded to
+    // the other communicators; the local services already got theirs
+    //
+    // a non-empty accepting_remote_connections means forward_message()
+    // is sending the message to a specific service, which is never shed
+    //
+    if(!broadcast_connection.empty()
+    && f_overload.shed_forward(
+              accepting_remote_connections.empty()
+            , get_message_priority(msg) == message_priority_t::MESSAGE_PRIORITY_HIGH
+                    || is_reliable_message(msg)))
+    {
+        f_broadcast_shed += broadcast_connection.size();
+        f_metrics.route(msg.get_command(), route_t::ROUTE_SHED);
+        broadcast_connection.clear();
+    }
+
+    if(!broadcast_connection.empty())
+    {
+        // we are broadcasting now (Gossiping a regular message);
+        // for the gossiping to work, we include additional
+        // information in the message
+        //
+        std::string const originator(f_connection_address.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS));
+        auto it(informed_neighbors_list.find(originator));
+        if(it == informed_neighbors_list.end())
+        {
+            // include self since we already know of the message too!
+            // (no need for others to send it back to us)
+            //
+            informed_neighbors_list.insert(originator);
+        }
+
+        // message is considered 'const', so we need to create a copy;
+        // the pool reuses the storage of a previous copy
+        //
+        message_pool::message_ptr pooled_broadcast_msg(f_message_pool.acquire(msg));
+        ed::message & broadcast_msg(*pooled_broadcast_msg);
+
+        // generate a unique broadcast message identifier if we did not
+        // yet have one, it is very important to NOT generate a new message
+        // in a many to many broadcasting system because you must block
+        // duplicates here
+        //
+        if(broadcast_msgid.empty())
+        {
+            ++g_broadcast_sequence;
+            broadcast_msgid += f_server_name;
+            broadcast_msgid += '-';
+            broadcast_msgid += std::to_string(g_broadcast_sequence);
+        }
+        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_msgid, broadcast_msgid);
+
+        // TODO: mark true if we are sending the message through a secure
+        //       connection
+        //
+        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_secure_remote, "false");
+
+        // increase the number of hops; if we reach the limit, we still
+        // want to forward the message, the destination will not forward
+        // (broadcast) more, but it will possibly send that to its own
+        // services
+        //
+        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_hops, hops + 1);
+
+        // mainly noise at this point, but I include the originator so
+        // we can track that back if needed for debug purposes
+        //
+        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_originator, originator);
+
+        // define a timeout if this is the originator
+        //
+        if(timeout == 0)
+        {
+            // give message 10 seconds to arrive to any and all destinations
+            timeout = time(nullptr) + 10;
+        }
+        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_timeout, timeout);
+
+        // peers which support the informed_filter capability receive
+        // a Bloom filter instead of the list of informed neighbors
+        //
+        bool const use_filter(std::any_of(
+                  broadcast_connection.begin()
+                , broadcast_connection.end()
+                , [](auto const & bc)
+                {
+                    return bc->has_capability(communicatord::g_name_communicatord_value_informed_filter);
+                }));
+        std::optional<message_pool::message_ptr> pooled_filter_msg;
+        if(use_filter)
+        {
+            for(auto const & address : informed_neighbors_list)
+            {
+                informed_filter.add(address);
+            }
+            pooled_filter_msg.emplace(f_message_pool.acquire(broadcast_msg));
+            (*pooled_filter_msg)->add_parameter(
+                      communicatord::g_name_communicatord_param_broadcast_informed_filter
+                    , informed_filter.to_string());
+
+            // broadcast_msg is a copy of msg so it still has the list of
+            // informed neighbors we received; the filter now represents
+            // the current list so do not forward that stale list with it
+            //
+            (*pooled_filter_msg)->add_parameter(
+                      communicatord::g_name_communicatord_param_broadcast_informed_neighbors
+                    , std::string());
+        }
+
+        // note that we currently define the list of neighbors BEFORE
+        // sending the message (anyway the send_message() just adds the
+        // message to a memory cache at this point, so whether it will
+        // be sent is not known until later.)
+        //
+        broadcast_msg.add_parameter(
+                  communicatord::g_name_communicatord_param_broadcast_informed_neighbors
+                , snapdev::join_strings(informed_neighbors_list, ","));
+
+        // serialize each version of the message only once
+        //
+        // reliable messages are numbered per link so they cannot share
+        // the serialized buffer
+        //
+        bool const reliable(is_reliable_message(msg));
+        ed::message & filter_msg(use_filter ? **pooled_filter_msg : broadcast_msg);
+        serialized_message serialized_broadcast_msg(broadcast_msg);
+        serialized_message serialized_filter_msg(filter_msg);
+        for(auto const & bc : broadcast_connection)
+        {
+            if(reliable
+            && bc->has_capability(communicatord::g_name_communicatord_value_reliable))
+            {
+                message_pool::message_ptr copy(f_message_pool.acquire(
+                            use_filter
+                            && bc->has_capability(communicatord::g_name_communicatord_value_informed_filter)
+                                    ? filter_msg
+                                    : broadcast_msg));
+                bc->send_message_to_connection(*copy);
+            }
+            else if(use_filter
+            && bc->has_capability(communicatord::g_name_communicatord_value_informed_filter))
+            {
+                serialized_filter_msg.send(bc);
+            }
+            else
+            {
+                serialized_broadcast_msg.send(bc);
+            }
+        }
+    }
+}
+
+
+void server::set_clock_status(clock_status_t status)
+{
+    if(f_clock_status == status)
+    {
+        // status did not change, do nothing
+        //
+        return;
+    }
+    f_clock_status = status;
+    send_clock_status(ed::connection::pointer_t());
+}
+
+
+void server::send_clock_status(ed::connection::pointer_t reply_connection)
+{
+    ed::message clock_status_msg;
+
+    clock_status_msg.set_command(communicatord::g_name_communicatord_cmd_clock_unstable);
+    switch(f_clock_status)
+    {
+    case clock_status_t::CLOCK_STATUS_STABLE:
+        clock_status_msg.set_command(communicatord::g_name_communicatord_cmd_clock_stable);
+        clock_status_msg.add_parameter(
+                  communicatord::g_name_communicatord_param_clock_resolution
+                , communicatord::g_name_communicatord_value_verified);
+        break;
+
+    case clock_status_t::CLOCK_STATUS_NO_NTP:
+        clock_status_msg.set_command(communicatord::g_name_communicatord_cmd_clock_stable);
+        clock_status_msg.add_parameter(
+                  communicatord::g_name_communicatord_param_clock_resolution
+                , communicatord::g_name_communicatord_value_no_ntp);
+        break;
+
+    case clock_status_t::CLOCK_STATUS_INVALID:
+        clock_status_msg.add_parameter(
+                  communicatord::g_name_communicatord_param_clock_error
+                , communicatord::g_name_communicatord_value_invalid);
+        break;
+
+    default:
+        clock_status_msg.add_parameter(
+                  communicatord::g_name_communicatord_param_clock_error
+                , communicatord::g_name_communicatord_value_checking);
+        break;
+
+    }
+
+    if(reply_connection != nullptr)
+    {
+        // reply to a direct CLOCK_STATUS
+        //
+        service_connection::pointer_t r(std::dynamic_pointer_cast<service_connection>(reply_connection));
+        if(r->understand_command(clock_status_msg.get_command()))
+        {
+            r->send_message(clock_status_msg);
+        }
+    }
+    else
+    {
+        clock_status_msg.set_service(communicatord::g_name_communicatord_service_local_broadcast);
+        broadcast_message(clock_status_msg);
+    }
+}
+
+
+/** \brief Send the current status of a client to connections.
+ *
+ * Some connections (the sitter, the cluck, ...) may be interested
+ * by the STATUS event. Any connection that understands the STATUS
+ * event will be sent that event whenever the status of a connection
+ * changes (specifically, on a REGISTER, CONNECT and on an UNREGISTER,
+ * DISCONNECT or equivalent).
+ *
+ * \param[in] connection  The connection that just had its status changed.
+ * \param[in] reply_connection  If not nullptr, the connection where the
+ *                              STATUS message gets sent.
+ */
+void server::send_status(
+      ed::connection::pointer_t connection
+    , ed::connection::pointer_t * reply_connection)
+{
+    if(f_status_template.get_command().empty())
+    {
+        f_status_template.set_command(communicatord::g_name_communicatord_cmd_status);
+        f_status_template.add_parameter(communicatord::g_name_communicatord_param_cache, communicatord::g_name_communicatord_value_no);
+    }
+    message_pool::message_ptr pooled_reply(f_message_pool.acquire(f_status_template));
+    ed::message & reply(*pooled_reply);
+
+    // the name of the service is the name of the connection
+    //
+    reply.add_parameter(communicatord::g_name_communicatord_param_service, connection->get_name());
+
+    base_connection::pointer_t base_connection(std::dynamic_pointer_cast<base_connection>(connection));
+    if(base_connection != nullptr)
+    {
+        // include the server name
+        //
+        std::string const server_name(base_connection->get_server_name());
+        if(!server_name.empty())
+        {
+            reply.add_parameter(communicatord::g_name_communicatord_param_server_name, server_name);
+        }
+
+        // check whether the connection is now up or down
+        //
+        connection_type_t const type(base_connection->get_connection_type());
+        reply.add_parameter(
+                  communicatord::g_name_communicatord_param_status
+                , type == connection_type_t::CONNECTION_TYPE_DOWN
+                        ? communicatord::g_name_communicatord_value_down
+                        : communicatord::g_name_communicatord_value_up);
+
+        // get the time when it was considered up
+        //
+        time_t const up_since(base_connection->get_connection_started());
+        if(up_since != -1)
+        {
+            reply.add_parameter(communicatord::g_name_communicatord_param_up_since, up_since);
+        }
+
+        // get the time when it was considered down (if not up yet, this will be skipped)
+        //
+        time_t const down_since(base_connection->get_connection_ended());
+        if(down_since != -1)
+        {
+            reply.add_parameter(communicatord::g_name_communicatord_param_down_since, down_since);
+        }
+    }
+    else
+    {
+        reply.add_parameter(
+                  communicatord::g_name_communicatord_param_status
+                , communicatord::g_name_communicatord_value_unknown);
+    }
+
+    if(reply_connection != nullptr)
+    {
+        service_connection::pointer_t sc(std::dynamic_pointer_cast<service_connection>(*reply_connection));
+        if(sc)
+        {
+            // if the verify_command() fails then it means the caller has to
+            // create a handler for the STATUS message
+            //
+            if(verify_command(sc, reply))
+            {
+                sc->send_message(reply);
+            }
+        }
+        else
+        {
+            unix_connection::pointer_t unix_conn(std::dynamic_pointer_cast<unix_connection>(*reply_connection));
+            if(unix_conn != nullptr)
+            {
+                if(unix_conn->understand_command(communicatord::g_name_communicatord_cmd_status))
+                {
+                    // send that STATUS message
+                    //
+                    //verify_command(sc, reply); -- we reach this line only if the command is understood
+                    unix_conn->send_message(reply);
+                }
+            }
+        }
+    }
+    else
+    {
+        // we have the message, now we need to find the list of connections
+        // interested by the STATUS event
+        //
+        // TODO: use the broadcast_message() function instead? (with service set to ".")
+        //
+        serialized_message serialized_reply(reply);
+        command_id_t const status_id(find_command(communicatord::g_name_communicatord_cmd_status));
+        auto send_to = [&serialized_reply, status_id](base_connection::pointer_t const & conn)
+        {
+            if(conn->understand_command(status_id))
+            {
+                // send that STATUS message
+                //
+                //verify_command(conn, reply); -- we reach this line only if the command is understood
+                serialized_reply.send(conn);
+            }
+        };
+        for(auto const & c : f_local_connections)
+        {
+            send_to(c.second);
+        }
+        for(auto const & c : f_inbound_connections)
+        {
+            send_to(c.second);
+        }
+        for(auto const & c : f_unix_connections)
+        {
+            send_to(c.second);
+        }
+    }
+}
+
+
+/** \brief Check our current cluster status.
+ *
+ * We received or lost a connection with a remote computer and
+ * need to determine (again) whether we are part of a cluster
+ * or not.
+ *
+ * This function is also called when we receive the CLUSTER_STATUS
+ * which is a query to know now what the status of the cluster is.
+ * This is generally sent by daemons who need to know and may have
+ * missed our previous broadcasts.
+ *
+ * When the status changes, a CLUSTER_CURRENT_STATUS message with the
+ * combined status is also broadcast. The communicator library caches
+ * that message so services do not need to poll.
+ *
+ * \param[in] reply_connection  A connection to reply to directly.
+ */
+void server::cluster_status(ed::connection::pointer_t reply_connection)
+{
+    // the links changed, which may change the gateways of our site
+    //
+    update_gateways();
+
+    // the count_live_connections() counts all the other communicators,
+    // not ourself, this is why we have a +1 here (it is very important
+    // if you have a single computer like many developers would have when
+    // writing code and testing quickly.)
+    //
+    size_t count(f_remote_communicators->count_live_connections() + 1);
+
+    // calculate the quorum, minimum number of computers that have to be
+    // interconnected to be able to say we have a live cluster
+    //
+    // in overlay mode, we are not expected to be connected to all the
+    // other communicators; we only know about our active peers so the
+    // status reflects whether we are linked with those
+    //
+    size_t const total_count(f_all_neighbors.size());
+    size_t expected_count(total_count);
+    if(f_remote_communicators->is_overlay())
+    {
+        expected_count = std::min(total_count, f_remote_communicators->get_overlay_size() + 1);
+        count = std::min(count, expected_count);
+    }
+    size_t const quorum(expected_count / 2 + 1);
+    bool modified = false;
+    bool const changed_count(f_total_count_sent != total_count);
+
+    std::string const new_status(count >= quorum
+                    ? communicatord::g_name_communicatord_cmd_cluster_up
+                    : communicatord::g_name_communicatord_cmd_cluster_down);
+    if(new_status != f_cluster_status
+    || f_total_count_sent != total_count
+    || reply_connection != nullptr)
+    {
+        if(reply_connection == nullptr)
+        {
+            f_cluster_status = new_status;
+            modified = true;
+        }
+
+        // send the results to either the requesting connection or broadcast
+        // the status to everyone
+        //
+        ed::message cluster_status_msg;
+        cluster_status_msg.set_command(new_status);
+        cluster_status_msg.set_service(communicatord::g_name_communicatord_service_local_broadcast);
+        cluster_status_msg.add_parameter(communicatord::g_name_communicatord_param_neighbors_count, total_count);
+        if(reply_connection != nullptr)
+        {
+            // reply to a direct CLUSTER_STATUS
+            //
+            service_connection::pointer_t r(std::dynamic_pointer_cast<service_connection>(reply_connection));
+            if(r->understand_command(cluster_status_msg.get_command()))
+            {
+                r->send_message(cluster_status_msg);
+            }
+        }
+        else
+        {
+            broadcast_message(cluster_status_msg);
+        }
+    }
+
+    std::string const new_complete(count == expected_count
+                    ? communicatord::g_name_communicatord_cmd_cluster_complete
+                    : communicatord::g_name_communicatord_cmd_cluster_incomplete);
+    if(new_complete != f_cluster_complete
+    || f_total_count_sent != total_count
+    || reply_connection != nullptr)
+    {
+        if(reply_connection == nullptr)
+        {
+            f_cluster_complete = new_complete;
+            modified = true;
+
+            if(f_time_to_cluster_complete < 0
+            && new_complete == communicatord::g_name_communicatord_cmd_cluster_complete)
+            {
+                f_time_to_cluster_complete = time(nullptr) - f_start_date;
+                SNAP_LOG_INFO
+                    << "cluster of "
+                    << total_count
+                    << " computers complete "
+                    << f_time_to_cluster_complete
+                    << " seconds after startup."
+                    << SNAP_LOG_SEND;
+            }
+        }
+
+        // send the results to either the requesting connection or broadcast
+        // the complete to everyone
+        //
+        ed::message cluster_complete_msg;
+        cluster_complete_msg.set_command(new_complete);
+        cluster_complete_msg.set_service(communicatord::g_name_communicatord_service_local_broadcast);
+        cluster_complete_msg.add_parameter(communicatord::g_name_communicatord_param_neighbors_count, total_count);
+        if(reply_connection != nullptr)
+        {
+            // reply to a direct CLUSTER_STATUS
+            //
+            service_connection::pointer_t r(std::dynamic_pointer_cast<service_connection>(reply_connection));
+            if(r->understand_command(cluster_complete_msg.get_command()))
+            {
+                r->send_message(cluster_complete_msg);
+            }
+        }
+        else
+        {
+            broadcast_message(cluster_complete_msg);
+        }
+    }
+
+    if(reply_connection == nullptr)
+    {
+        f_total_count_sent = total_count;
+
+        if(modified
+        || changed_count
+        || f_cluster_current_status.get_command().empty())
+        {
+            f_cluster_current_status = ed::message();
+            f_cluster_current_status.set_command(communicatord::g_name_communicatord_cmd_cluster_current_status);
+            f_cluster_current_status.set_service(communicatord::g_name_communicatord_service_local_broadcast);
+            f_cluster_current_status.add_parameter(
+                      communicatord::g_name_communicatord_param_status
+                    , new_status == communicatord::g_name_communicatord_cmd_cluster_up
+                        ? communicatord::g_name_communicatord_value_up
+                        : communicatord::g_name_communicatord_value_down);
+            f_cluster_current_status.add_parameter(
+                      communicatord::g_name_communicatord_param_complete
+                    , new_complete == communicatord::g_name_communicatord_cmd_cluster_complete
+                        ? communicatord::g_name_communicatord_value_true
+                        : communicatord::g_name_communicatord_value_false);
+            f_cluster_current_status.add_parameter(communicatord::g_name_communicatord_param_neighbors_count, total_count);
+
+            ed::message current_status(f_cluster_current_status);
+            broadcast_message(current_status);
+        }
+    }
+
+    if(modified)
+    {
+        std::ofstream status_file;
+        status_file.open(g_status_filename);
+        if(status_file.is_open())
+        {
+            status_file << f_cluster_status << std::endl
+                        << f_cluster_complete << std::endl;
+        }
+    }
+
+    SNAP_LOG_INFO
+        << "cluster status is \""
+        << new_status
+        << "\" and \""
+        << new_complete
+        << "\" (count: "
+        << count
+        << ", total count: "
+        << total_count
+        << ", quorum: "
+        << quorum
+        << ")"
+        << SNAP_LOG_SEND;
+}
+
+
+/** \brief Request LOADAVG messages from a communicatord.
+ *
+ * This function gets called whenever a local service sends us a
+ * request to listen to the LOADAVG messages of a specific
+ * communicatord.
+ *
+ * \param[in] msg  The LISTEN_LOADAVG message.
+ */
+void server::msg_listen_loadavg(ed::message & msg)
+{
+    std::string const ips(msg.get_parameter(communicatord::g_name_communicatord_param_ips));
+
+    std::vector<std::string> ip_list;
+    snapdev::tokenize_string(ip_list, ips, { "," });
+
+    // we have to save those as IP addresses since the remote
+    // communicators come and go and we have to make sure
+    // that all get our REGISER_FOR_LOADAVG message when they
+    // come back after a broken link
+    //
+    for(auto const & ip : ip_list)
+    {
+        auto it(f_registered_neighbors_for_loadavg.find(ip));
+        if(it == f_registered_neighbors_for_loadavg.end())
+        {
+            // add this one, it was not there yet
+            //
+            f_registered_neighbors_for_loadavg.insert(ip);
+
+            register_for_loadavg(ip);
+        }
+    }
+}
+
+
+void server::register_for_loadavg(std::string const & ip)
+{
+    addr::addr address(addr::string_to_addr(
+              ip
+            , "127.0.0.1"
+            , communicatord::LOCAL_PORT  // the port is ignore, use a safe default
+            , "tcp"));
+    base_connection::pointer_t conn;
+    for(auto const & c : f_outbound_connections)
+    {
+        if(c.second->get_connection_address() == address)
+        {
+            conn = c.second;
+            break;
+        }
+    }
+    if(conn == nullptr)
+    {
+        for(auto const & c : f_inbound_connections)
+        {
+            if(c.second->get_connection_address() == address)
+            {
+                conn = c.second;
+                break;
+            }
+        }
+    }
+
+    if(conn != nullptr)
+    {
+        // there is such a connection, send it a request for
+        // LOADAVG message
+        //
+        ed::message register_message;
+        register_message.set_command(communicatord::g_name_communicatord_cmd_register_for_loadavg);
+        conn->send_message_to_connection(register_message);
+    }
+}
+
+
+/** \brief Create a FLAGS message with all the flags raised on this server.
+ *
+ * The message includes the current version of our flags and our session
+ * so the receiver can then apply the FLAG_UP and FLAG_DOWN changes.
+ *
+ * \return The FLAGS message.
+ */
+ed::message server::get_flags_snapshot() const
+{
+    ed::message snapshot;
+    snapshot.set_command(communicatord::g_name_communicatord_cmd_flags);
+    snapshot.add_parameter(communicatord::g_name_communicatord_param_server_name, f_server_name);
+    snapshot.add_parameter(communicatord::g_name_communicatord_param_session, f_flags_session);
+    snapshot.add_parameter(communicatord::g_name_communicatord_param_flags_version, f_flag_index->get_version());
+    snapshot.add_parameter(communicatord::g_name_communicatord_param_list, f_flag_index->get_snapshot());
+    return snapshot;
+}
+
+
+/** \brief Publish the changes of our flags.
+ *
+ * The flag watcher calls this function with the flags which were just
+ * raised, updated, or lowered. Each change is sent as one FLAG_UP or
+ * FLAG_DOWN message to the local services which sent LISTEN_FLAGS and
+ * to the remote communicators which sent REGISTER_FOR_FLAGS.
+ *
+ * Each change increments the version of our flags by one. A receiver
+ * which notices a gap in the versions has to request a new snapshot.
+ *
+ * \param[in] changes  The flags which changed, in order.
+ */
+void server::flags_changed(communicatord::flag::list_t const & changes)
+{
+    if(f_flag_listeners.empty()
+    && f_flag_registrations.empty())
+    {
+        return;
+    }
+
+    std::uint64_t version(f_flag_index->get_version() - changes.size());
+    for(auto const & f : changes)
+    {
+        ++version;
+
+        bool const up(f->get_state() == communicatord::flag::state_t::STATE_UP);
+        ed::message change;
+        change.set_command(up
+                    ? communicatord::g_name_communicatord_cmd_flag_up
+                    : communicatord::g_name_communicatord_cmd_flag_down);
+        if(up)
+        {
+            for(auto const & p : f->get_parameters())
+            {
+                change.add_parameter(p.first, p.second);
+            }
+        }
+        else
+        {
+            change.add_parameter(communicatord::g_name_communicatord_param_unit, f->get_unit());
+            change.add_parameter(communicatord::g_name_communicatord_param_section, f->get_section());
+            change.add_parameter(communicatord::g_name_communicatord_param_name, f->get_name());
+        }
+        change.add_parameter(communicatord::g_name_communicatord_param_server_name, f_server_name);
+        change.add_parameter(communicatord::g_name_communicatord_param_session, f_flags_session);
+        change.add_parameter(communicatord::g_name_communicatord_param_flags_version, version);
+
+        serialized_message serialized_change(change);
+        for(auto const & c : f_flag_listeners)
+        {
+            serialized_change.send(c.second);
+        }
+        for(auto const & c : f_flag_registrations)
+        {
+            serialized_change.send(c.second);
+        }
+    }
+}
+
+
+/** \brief Ask a remote communicator for its flag changes.
+ *
+ * When \p snapshot is false and we already received flags from that
+ * communicator, the request includes the last session and version we
+ * received. If still current, the remote communicator only sends the
+ * changes from now on. Otherwise it first sends a FLAGS snapshot.
+ *
+ * \param[in] conn  The connection to the remote communicator.
+ * \param[in] snapshot  Whether a FLAGS snapshot is required.
+ */
+void server::register_for_flags(base_connection::pointer_t conn, bool snapshot)
+{
+    ed::message register_message;
+    register_message.set_command(communicatord::g_name_communicatord_cmd_register_for_flags);
+    if(!snapshot)
+    {
+        auto const it(f_remote_flags_versions.find(conn->get_server_name()));
+        if(it != f_remote_flags_versions.end())
+        {
+            register_message.add_parameter(communicatord::g_name_communicatord_param_session, it->second.f_session);
+            register_message.add_parameter(communicatord::g_name_communicatord_param_flags_version, it->second.f_version);
+        }
+    }
+    conn->send_message_to_connection(register_message);
+}
+
+
+void server::msg_listen_flags(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr)
+    {
+        return;
+    }
+
+    f_flag_listeners[conn.get()] = conn;
+
+    // the new listener needs one snapshot of each server, ours first
+    //
+    ed::message snapshot(get_flags_snapshot());
+    conn->send_message_to_connection(snapshot);
+
+    routing_table::connection_vector_t links;
+    f_routes.get_links(links);
+    for(auto const & l : links)
+    {
+        register_for_flags(l, true);
+    }
+}
+
+
+void server::msg_register_for_flags(ed::message & msg)
+{
+    if(!is_tcp_connection(msg))
+    {
+        return;
+    }
+
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
     if(conn == nullptr)
     {
         return;
     }
 
-    conn->set_wants_loadavg(false);
-
-    // check whether all connections are now unregistered
-    //
-    ed::connection::vector_t const & all_connections(f_communicator->get_connections());
-    if(all_connections.end() == std::find_if(
-            all_connections.begin(),
-            all_connections.end(),
-            [](auto const & c)
-            {
-                base_connection::pointer_t b(std::dynamic_pointer_cast<base_connection>(c));
-                return b->wants_loadavg();
-            }))
+    f_flag_registrations[conn.get()] = conn;
+
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_session)
+    && msg.has_parameter(communicatord::g_name_communicatord_param_flags_version)
+    && msg.get_parameter(communicatord::g_name_communicatord_param_session) == f_flags_session
+    && static_cast<std::uint64_t>(msg.get_integer_parameter(communicatord::g_name_communicatord_param_flags_version)) == f_flag_index->get_version())
+    {
+        // that communicator is up to date, only send the changes
+        //
+        return;
+    }
+
+    ed::message snapshot(get_flags_snapshot());
+    conn->send_message_to_connection(snapshot);
+}
+
+
+/** \brief Forward a FLAGS snapshot received from a remote communicator.
+ *
+ * The snapshot gets forwarded to our local flag listeners and its
+ * version is saved so the following changes can be verified.
+ *
+ * \param[in] msg  The FLAGS message.
+ */
+void server::msg_flags(ed::message & msg)
+{
+    flags_version & v(f_remote_flags_versions[msg.get_parameter(communicatord::g_name_communicatord_param_server_name)]);
+    v.f_session = msg.get_parameter(communicatord::g_name_communicatord_param_session);
+    v.f_version = static_cast<std::uint64_t>(msg.get_integer_parameter(communicatord::g_name_communicatord_param_flags_version));
+
+    serialized_message serialized_snapshot(msg);
+    for(auto const & c : f_flag_listeners)
+    {
+        serialized_snapshot.send(c.second);
+    }
+}
+
+
+/** \brief Forward a FLAG_UP or FLAG_DOWN received from a remote communicator.
+ *
+ * The change is only forwarded if it directly follows the last version
+ * we received from that server. Otherwise some changes were missed and
+ * a new snapshot gets requested instead. That snapshot includes this
+ * change.
+ *
+ * \param[in] msg  The FLAG_UP or FLAG_DOWN message.
+ */
+void server::msg_flag_change(ed::message & msg)
+{
+    if(f_flag_listeners.empty())
+    {
+        // nobody is listening; a new listener gets new snapshots anyway
+        //
+        return;
+    }
+
+    std::string const session(msg.get_parameter(communicatord::g_name_communicatord_param_session));
+    std::uint64_t const version(static_cast<std::uint64_t>(msg.get_integer_parameter(communicatord::g_name_communicatord_param_flags_version)));
+
+    auto it(f_remote_flags_versions.find(msg.get_parameter(communicatord::g_name_communicatord_param_server_name)));
+    if(it == f_remote_flags_versions.end()
+    || it->second.f_session != session
+    || it->second.f_version + 1 != version)
+    {
+        base_connection::pointer_t conn(msg.user_data<base_connection>());
+        if(conn != nullptr)
+        {
+            register_for_flags(conn, true);
+        }
+        return;
+    }
+    it->second.f_version = version;
+
+    serialized_message serialized_change(msg);
+    for(auto const & c : f_flag_listeners)
     {
-        // no more connections requiring LOADAVG messages
-        // so stop the timer
-        //
-        f_loadavg_timer->set_enable(false);
+        serialized_change.send(c.second);
     }
 }
 
 
+void server::msg_save_loadavg(ed::message & msg)
+{
+    std::string const avg_str(msg.get_parameter(communicatord::g_name_communicatord_param_avg));
+    std::string const my_address(msg.get_parameter(communicatord::g_name_communicatord_param_my_address));
+    snapdev::timespec_ex const timestamp_str(msg.get_timespec_parameter(communicatord::g_name_communicatord_param_timestamp));
 
+    communicatord::loadavg_item item;
 
-void server::broadcast_message(
-      ed::message & msg
-    , base_connection::vector_t const & accepting_remote_connections)
-{
-    std::string broadcast_msgid;
-    std::string informed_neighbors;
-    int hops(0);
-    time_t timeout(0);
+    // Note: we do not use the port so whatever number here is fine
+    addr::addr a(addr::string_to_addr(
+                  my_address
+                , "127.0.0.1"
+                , communicatord::LOCAL_PORT  // the port is ignore, use a safe default
+                , "tcp"));
+    a.set_port(communicatord::LOCAL_PORT); // actually force the port so in effect it is ignored
+    a.get_ipv6(item.f_address);
 
-    // note: the "broacast_msgid" is required when we end up sending that
-    //       message forward to some other computers; so we have to go
-    //       through that if() block; however, the timeout was already
-    //       already checked, so we probably would not need it to do
-    //       it again?
+    item.f_avg = std::stof(avg_str);
+    if(item.f_avg < 0.0)
+    {
+        return;
+    }
+
+    // the timestamp comes from the clock of the sender, the table is
+    // expected to only include timestamps of our clock
     //
-    if(msg.has_parameter(communicatord::g_name_communicatord_param_broadcast_msgid))
+    item.f_timestamp = timestamp_str;
+    std::int64_t const offset(get_peer_clock_offset(msg));
+    if(offset != 0)
     {
-        // check whether the message already timed out
-        //
-        // this is a safety feature of our broadcasting capability
-        // which should rarely be activated unless you have multiple
-        // data center locations
-        //
-        timeout = msg.get_integer_parameter(communicatord::g_name_communicatord_param_broadcast_timeout);
-        time_t const now(time(nullptr));
-        if(timeout < now)
-        {
-            return;
-        }
+        item.f_timestamp = snapdev::timespec_ex(timestamp_str) - snapdev::timespec_ex(offset * 1'000LL);
+    }
+    if(snapdev::timespec_ex(item.f_timestamp) < snapdev::timespec_ex(SERVERPLUGINS_UNIX_TIMESTAMP(UTC_BUILD_YEAR, 1, 1, 0, 0, 0), 0))
+    {
+        return;
+    }
 
-        // check whether we already received that message, if so ignore
-        // the second instance (it should not happen with the list of
-        // neighbors included in the message, but just in case...)
-        //
-        broadcast_msgid = msg.get_parameter(communicatord::g_name_communicatord_param_broadcast_msgid);
-        auto const received_it(f_received_broadcast_messages.find(broadcast_msgid));
-        if(received_it != f_received_broadcast_messages.cend())     // message arrived again?
+    // the table is updated in place, readers see the new value at once
+    //
+    if(!f_loadavg_table.is_open()
+    && !f_loadavg_table.open(true))
+    {
+        SNAP_LOG_ERROR
+            << "could not open the load average table \""
+            << communicatord::get_loadavg_path()
+            << "\" for writing."
+            << SNAP_LOG_SEND;
+    }
+    else if(!f_loadavg_table.update(item))
+    {
+        SNAP_LOG_WARNING
+            << "the load average table is full ("
+            << f_loadavg_table.get_slots()
+            << " computers); load of "
+            << my_address
+            << " not saved."
+            << SNAP_LOG_SEND;
+    }
+
+    // also keep the load in memory for anycast messages
+    //
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn != nullptr)
+    {
+        conn->set_loadavg(item.f_avg, time(nullptr));
+    }
+}
+
+
+/** \brief Check whether a message is expected to reach a single service.
+ *
+ * A message is anycast when its "delivery" parameter is set to "anycast"
+ * or when its destination service is defined in the --anycast-services
+ * list. Such a message is sent to only one of the computers running that
+ * service instead of all of them.
+ *
+ * \param[in] msg  The message to check.
+ *
+ * \return true if the message has to be delivered to a single service.
+ */
+bool server::is_anycast(ed::message const & msg) const
+{
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_delivery))
+    {
+        return msg.get_parameter(communicatord::g_name_communicatord_param_delivery)
+                            == communicatord::g_name_communicatord_value_anycast;
+    }
+
+    return f_anycast_services.find(msg.get_service()) != f_anycast_services.end();
+}
+
+
+/** \brief Choose the connection to use to send an anycast message.
+ *
+ * This function first keeps the connections to communicators which
+ * directly offer \p service. If none do, all the \p candidates are
+ * kept, since they may know where to find that service.
+ *
+ * Among those, the one with the smallest load average wins. The load
+ * average is the one received in the last LOADAVG message. If we never
+ * requested it, a REGISTER_FOR_LOADAVG is sent so the next call has that
+ * information. Connections without a known load are only used when no
+ * load is known at all, in which case they get selected in turn.
+ *
+ * \param[in] candidates  The connections that accept the message.
+ * \param[in] service  The name of the destination service.
+ *
+ * \return The connection to use, never nullptr.
+ */
+base_connection::pointer_t server::select_anycast_connection(
+      base_connection::vector_t const & candidates
+    , std::string const & service)
+{
+    base_connection::vector_t providers;
+    for(auto const & c : candidates)
+    {
+        if(c->has_service(service))
         {
-            // note that although we include neighbors it is normal that
-            // this happens in a cluster where some computers are not
-            // aware of certain nodes; for example, if A sends a
-            // message to B and C, both B and C know of a node D
-            // which is unknown to A, then both B and C will end
-            // up forward that same message to D, so D will discard
-            // the second instance it receives.
-            //
-            return;
+            providers.push_back(c);
         }
+    }
+    if(providers.empty())
+    {
+        providers = candidates;
+    }
 
-        // delete "received messages" that have now timed out (because
-        // such are not going to be forwarded since we check the timeout
-        // of a message early and prevent the broadcasting in that case)
-        //
-        // XXX: I am thinking that this loop should probably be run before
-        //      the "broadcast_timeout" test above...
-        //
-        for(auto it(f_received_broadcast_messages.cbegin()); it != f_received_broadcast_messages.cend(); )
+    time_t const now(time(nullptr));
+    base_connection::pointer_t best;
+    float best_load(0.0f);
+    for(auto const & c : providers)
+    {
+        float const load(c->get_loadavg(now));
+        if(load < 0.0f)
         {
-            if(it->second < now)
-            {
-                // this one timed out, we do not need to keep it in this
-                // list, so erase
-                //
-                it = f_received_broadcast_messages.erase(it);
-            }
-            else
+            if(c->request_loadavg())
             {
-                ++it;
+                ed::message register_message;
+                register_message.set_command(communicatord::g_name_communicatord_cmd_register_for_loadavg);
+                c->send_message_to_connection(register_message);
             }
+            continue;
+        }
+        if(best == nullptr
+        || load < best_load)
+        {
+            best = c;
+            best_load = load;
         }
+    }
 
-        // add the new message after we check for timed out entries
-        // so that way we avoid going through this new entry within
-        // the previous loop
-        //
-        f_received_broadcast_messages[broadcast_msgid] = timeout;
+    if(best == nullptr)
+    {
+        best = providers[f_anycast_counter % providers.size()];
+        ++f_anycast_counter;
+    }
 
-        // Note: we skip the canonicalization on this list of neighbors
-        //       because we assume only us (communicatord) handles
-        //       that message and we know that it is already
-        //       canonicalized here
-        //
-        informed_neighbors = msg.get_parameter(communicatord::g_name_communicatord_param_broadcast_informed_neighbors);
+    return best;
+}
 
-        // get the number of hops this message already performed
-        //
-        hops = msg.get_integer_parameter("broadcast_hops");
+
+/** \brief Remove the cached messages which timed out.
+ *
+ * This function is called by the cache timer when the next message in
+ * the cache times out. It removes all the messages that timed out and
+ * then sets the timer to wake up for the next one.
+ */
+void server::process_cache_timeout()
+{
+    f_local_message_cache.remove_old_messages();
+    update_cache_timer();
+}
+
+
+/** \brief Set the cache timer to the next message timeout.
+ *
+ * The cache timer is enabled only while messages are cached. Its timeout
+ * date is set to the timeout of the next message to expire.
+ */
+void server::update_cache_timer()
+{
+    if(f_cache_timer == nullptr)
+    {
+        return;
     }
 
-    advgetopt::string_set_t informed_neighbors_list;
-    snapdev::tokenize_string(
-              informed_neighbors_list
-            , informed_neighbors
-            , { "," }
-            , true);
+    time_t const next_timeout(f_local_message_cache.get_next_timeout());
+    if(next_timeout < 0)
+    {
+        f_cache_timer->set_enable(false);
+        return;
+    }
 
-    // we always broadcast to all local services
+    // the cache removes messages once "now > timeout"
     //
-    ed::connection::vector_t broadcast_connection;
+    f_cache_timer->set_timeout_date((next_timeout + 1) * 1'000'000LL);
+    f_cache_timer->set_enable(true);
+}
 
-    if(accepting_remote_connections.empty())
+
+/** \brief Prepare a link to another communicator for a message.
+ *
+ * Messages sent between communicators are batched: the first message
+ * corks the connection and the flush timer uncorks it after
+ * --link-batch-delay microseconds. In between, the kernel only sends
+ * full packets.
+ *
+ * Control messages are not batched. These are the messages the
+ * communicators send each other, such as CONNECT or GOSSIP, which have
+ * no destination service, and the high priority messages such as STOP
+ * or UNREGISTER.
+ *
+ * \param[in] conn  The link about to send \p msg.
+ * \param[in] msg  The message being sent.
+ */
+void server::prepare_link_output(
+      base_connection::pointer_t const & conn
+    , ed::message const & msg)
+{
+    if(f_link_batch_delay <= 0
+    || f_flush_timer == nullptr
+    || msg.get_service().empty()
+    || get_message_priority(msg) == message_priority_t::MESSAGE_PRIORITY_HIGH)
     {
-        std::string destination(communicatord::g_name_communicatord_service_private_broadcast);
-        std::string const service(msg.get_service());
-        if(service != communicatord::g_name_communicatord_service_local_broadcast
-        && service != communicatord::g_name_communicatord_service_private_broadcast
-        && service != communicatord::g_name_communicatord_service_public_broadcast)
-        {
-            // try with the server name instead (which may be "." or "*")
-            // TODO: clean this up; I think only "*" is valid here...
-            //
-            destination = msg.get_server();
-            if(destination.empty())
-            {
-                destination = communicatord::g_name_communicatord_service_private_broadcast;
-            }
-        }
-        else
+        return;
+    }
+
+    if(conn->cork_output())
+    {
+        if(f_corked_connections.empty())
         {
-            destination = service;
+            f_flush_timer->set_timeout_delay(f_link_batch_delay);
+            f_flush_timer->set_enable(true);
         }
-        bool const all(hops < 5 && destination == communicatord::g_name_communicatord_service_public_broadcast);
-        bool const remote(hops < 5 && (all || destination == communicatord::g_name_communicatord_service_private_broadcast));
+        f_corked_connections[conn.get()] = conn;
+    }
+}
 
-        ed::connection::vector_t const & connections(f_communicator->get_connections());
-        for(auto const & nc : connections)
-        {
-            // try for a service or communicatord that connected to us
-            //
-            service_connection::pointer_t conn(std::dynamic_pointer_cast<service_connection>(nc));
-            remote_connection::pointer_t remote_conn;
-            if(!conn)
-            {
-                remote_conn = std::dynamic_pointer_cast<remote_connection>(nc);
-            }
-            bool broadcast(false);
-            if(conn != nullptr)
-            {
-                switch(conn->get_address().get_network_type())
-                {
-                case addr::network_type_t::NETWORK_TYPE_LOOPBACK:
-                    // these are localhost services, avoid sending the
-                    // message is the destination does not know the
-                    // command
-                    //
-                    if(conn->understand_command(msg.get_command())) // destination: "*" or "?" or "."
-                    {
-                        //verify_command(conn, message); -- we reach this line only if the command is understood, it is therefore good
-                        conn->send_message(msg);
-                    }
-                    break;
 
-                case addr::network_type_t::NETWORK_TYPE_PRIVATE:
-                    // these are computers within the same local network (LAN)
-                    // we forward messages if at least 'remote' is true
-                    //
-                    broadcast = remote; // destination: "*" or "?"
-                    break;
+/** \brief Check whether a batch has to be sent now.
+ *
+ * After a message was added to the output of a link, this function sends
+ * the batch as soon as possible if the message was a control or high
+ * priority message or if the batch reached --link-batch-bytes.
+ *
+ * The message is still in the output buffer of the connection at this
+ * point. Removing TCP_CORK now would let that message go out on its own
+ * once the connection writes it. Instead, the flush timer is set to time
+ * out immediately. It has the lowest priority so the event loop calls
+ * it after the connections wrote their output.
+ *
+ * \param[in] conn  The link which sent \p msg.
+ * \param[in] msg  The message that was sent.
+ * \param[in] size  The size of the serialized message.
+ */
+void server::link_output_done(
+      base_connection::pointer_t const & conn
+    , ed::message const & msg
+    , std::size_t size)
+{
+    if(conn->batch_output(
+              size
+            , msg.get_service().empty()
+                || get_message_priority(msg) == message_priority_t::MESSAGE_PRIORITY_HIGH
+            , f_link_batch_bytes))
+    {
+        f_flush_timer->set_timeout_date(time(nullptr) * 1'000'000LL);
+    }
+}
+
+
+/** \brief Add the reliable delivery parameters to a message.
+ *
+ * This function is called by the links to other communicators before
+ * they send a message. A reliable message (see is_reliable_message())
+ * is given the next sequence number of that link and a copy is kept
+ * until the other side acknowledges it. The last sequence number we
+ * received from that daemon gets piggybacked on the message if it was
+ * not acknowledged yet.
+ *
+ * Messages which already have a sequence number are being sent again
+ * after a reconnect. They only get the acknowledgement.
+ *
+ * \param[in] conn  The link about to send \p msg.
+ * \param[in] msg  The message being sent.
+ * \param[out] copy  A message used when parameters need to be added.
+ *
+ * \return \p msg if it is sent as is, \p copy otherwise.
+ */
+ed::message & server::reliable_output(
+      base_connection::pointer_t const & conn
+    , ed::message & msg
+    , ed::message & copy)
+{
+    if(conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_REMOTE
+    || conn->get_server_name().empty()
+    || !conn->has_capability(communicatord::g_name_communicatord_value_reliable))
+    {
+        return msg;
+    }
+
+    bool const reliable(!msg.has_parameter(communicatord::g_name_communicatord_param_reliable_sequence)
+                            && is_reliable_message(msg));
+    std::uint64_t ack(0);
+    auto it(f_reliable_links.find(conn->get_server_name()));
+    bool const has_ack(it != f_reliable_links.end() && it->second.take_ack(ack));
+    if(!reliable
+    && !has_ack)
+    {
+        return msg;
+    }
+
+    copy = msg;
+    if(reliable)
+    {
+        get_reliable_link(conn->get_server_name()).send(copy);
+        ++f_reliable_sent;
+    }
+    if(has_ack)
+    {
+        copy.add_parameter(communicatord::g_name_communicatord_param_reliable_ack, ack);
+    }
+    return copy;
+}
+
+
+/** \brief Get the reliable delivery state of a remote communicator.
+ *
+ * The state is created the first time it is needed.
+ *
+ * \param[in] server_name  The name of the remote server.
+ *
+ * \return A reference to the state of that server.
+ */
+reliable_link & server::get_reliable_link(std::string const & server_name)
+{
+    auto it(f_reliable_links.find(server_name));
+    if(it == f_reliable_links.end())
+    {
+        it = f_reliable_links.emplace(server_name, reliable_link()).first;
+        it->second.set_max_messages(f_reliable_max_messages);
+    }
+    return it->second;
+}
+
+
+/** \brief Check whether a message has to be delivered reliably.
+ *
+ * A message is delivered reliably when it includes the "reliable"
+ * parameter or when its definition says `delivery = reliable`.
+ *
+ * Broadcast messages are never handled here. They already go through
+ * several paths and get de-duplicated by their identifier. Messages
+ * forwarded to a remote service also get a broadcast identifier, but
+ * they follow a single path so they can be reliable.
+ *
+ * \param[in] msg  The message to check.
+ *
+ * \return true if \p msg has to be acknowledged by the other side.
+ */
+bool server::is_reliable_message(ed::message const & msg) const
+{
+    std::string const & service(msg.get_service());
+    if(service.empty()
+    || service == communicatord::g_name_communicatord_service_public_broadcast
+    || service == communicatord::g_name_communicatord_service_private_broadcast
+    || service == communicatord::g_name_communicatord_service_local_broadcast)
+    {
+        return false;
+    }
+
+    return msg.has_parameter(communicatord::g_name_communicatord_param_reliable)
+        || f_message_validator.is_reliable(msg.get_command());
+}
 
-                case addr::network_type_t::NETWORK_TYPE_PUBLIC:
-                    // these are computers in another data center
-                    // we forward messages only when 'all' is true
-                    //
-                    broadcast = all; // destination: "*"
-                    break;
 
-                default:
-                    // unknown/unexpected type of IP address, totally ignore
-                    break;
+/** \brief Handle the reliable delivery parameters of a message.
+ *
+ * This function applies the acknowledgement found in \p msg and checks
+ * its sequence number. The parameters are then removed so the message
+ * looks the same to the services whether it came directly or not. If
+ * it gets forwarded to another communicator, that link assigns its own
+ * sequence number.
+ *
+ * \param[in,out] msg  The message received.
+ *
+ * \return false if \p msg was already received and has to be ignored.
+ */
+bool server::reliable_input(ed::message & msg)
+{
+    bool const has_sequence(msg.has_parameter(communicatord::g_name_communicatord_param_reliable_sequence));
+    bool const has_ack(msg.has_parameter(communicatord::g_name_communicatord_param_reliable_ack));
+    if(!has_sequence
+    && !has_ack)
+    {
+        return true;
+    }
 
-                }
-            }
-            else if(remote_conn != nullptr)
-            {
-                // another communicatord that connected to us
-                //
-                switch(remote_conn->get_address().get_network_type())
-                {
-                case addr::network_type_t::NETWORK_TYPE_LOOPBACK:
-                    {
-                        static bool warned(false);
-                        if(!warned)
-                        {
-                            warned = true;
-                            SNAP_LOG_WARNING
-                                << "remote communicator was connected on a LOOPBACK IP address..."
-                                << SNAP_LOG_SEND;
-                        }
-                    }
-                    break;
+    // the ACCEPT of a new link arrives before we know who sent it,
+    // reliable_link_started() handles its acknowledgement
+    //
+    base_connection::pointer_t conn(msg.user_data<base_connection>());
+    if(conn == nullptr
+    || conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_REMOTE
+    || conn->get_server_name().empty())
+    {
+        return true;
+    }
 
-                case addr::network_type_t::NETWORK_TYPE_PRIVATE:
-                    // these are computers within the same local network (LAN)
-                    // we forward messages if at least 'remote' is true
-                    //
-                    broadcast = remote; // destination: "*" or "?"
-                    break;
+    reliable_link & link(get_reliable_link(conn->get_server_name()));
+    if(has_ack)
+    {
+        link.acknowledge(msg.get_integer_parameter(communicatord::g_name_communicatord_param_reliable_ack));
+    }
+    if(has_sequence)
+    {
+        std::uint64_t const sequence(msg.get_integer_parameter(communicatord::g_name_communicatord_param_reliable_sequence));
+        switch(link.receive(sequence))
+        {
+        case receive_t::RECEIVE_NEW:
+            break;
 
-                case addr::network_type_t::NETWORK_TYPE_PUBLIC:
-                    // these are computers in another data center
-                    // we forward messages only when 'all' is true
-                    //
-                    broadcast = all; // destination: "*"
-                    break;
+        case receive_t::RECEIVE_DUPLICATE:
+            ++f_reliable_duplicates;
+            return false;
 
-                default:
-                    // unknown/unexpected type of IP address, totally ignore
-                    break;
+        case receive_t::RECEIVE_GAP:
+            ++f_reliable_gaps;
+            SNAP_LOG_WARNING
+                << "reliable message \""
+                << msg.get_command()
+                << "\" from \""
+                << conn->get_server_name()
+                << "\" has sequence number "
+                << sequence
+                << "; some earlier messages were lost."
+                << SNAP_LOG_SEND;
+            break;
 
-                }
-            }
-            if(broadcast)
-            {
-                // get the IP address of the remote communicatord
-                //
-                std::string const address((conn != nullptr
-                            ? conn->get_address()
-                            : remote_conn->get_address()).to_ipv4or6_string(addr::STRING_IP_ADDRESS));
-                auto it(informed_neighbors_list.find(address));
-                if(it == informed_neighbors_list.end())
-                {
-                    // not in the list of informed neighbors, add it and
-                    // keep nc in a list that we can use to actually send
-                    // the broadcast message
-                    //
-                    informed_neighbors_list.insert(address);
-                    broadcast_connection.push_back(nc);
-                }
-            }
         }
     }
-    else
-    {
-        // we already have a list, copy that list only as it is already
-        // well defined
-        //
-        std::for_each(
-            accepting_remote_connections.begin(),
-            accepting_remote_connections.end(),
-            [&broadcast_connection, &informed_neighbors_list](auto const & nc)
-            {
-                // the dynamic_cast<>() should always work in this direction
-                //
-                service_connection::pointer_t conn(std::dynamic_pointer_cast<service_connection>(nc));
-                if(conn != nullptr)
-                {
-                    std::string const address(conn->get_address().to_ipv4or6_string(addr::STRING_IP_ADDRESS));
-                    auto it(informed_neighbors_list.find(address));
-                    if(it == informed_neighbors_list.end())
-                    {
-                        // not in the list of informed neighbors, add it and
-                        // keep conn in a list that we can use to actually
-                        // send the broadcast message
-                        //
-                        informed_neighbors_list.insert(address);
-                        broadcast_connection.push_back(conn);
-                    }
-                }
-                else
-                {
-                    remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(nc));
-                    if(remote_conn != nullptr)
-                    {
-                        std::string const address(remote_conn->get_address().to_ipv4or6_string(addr::STRING_IP_ADDRESS));
-                        auto it(informed_neighbors_list.find(address));
-                        if(it == informed_neighbors_list.end())
-                        {
-                            // not in the list of informed neighbors, add it and
-                            // keep conn in a list that we can use to actually
-                            // send the broadcast message
-                            //
-                            informed_neighbors_list.insert(address);
-                            broadcast_connection.push_back(remote_conn);
-                        }
-                    }
-                }
-            });
-    }
 
-    if(!broadcast_connection.empty())
+    ed::message result;
+    result.set_command(msg.get_command());
+    result.set_server(msg.get_server());
+    result.set_service(msg.get_service());
+    result.set_sent_from_server(msg.get_sent_from_server());
+    result.set_sent_from_service(msg.get_sent_from_service());
+    for(auto const & p : msg.get_all_parameters())
     {
-        // we are broadcasting now (Gossiping a regular message);
-        // for the gossiping to work, we include additional
-        // information in the message
-        //
-        std::string const originator(f_connection_address.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS));
-        auto it(informed_neighbors_list.find(originator));
-        if(it != informed_neighbors_list.end())
+        if(p.first != communicatord::g_name_communicatord_param_reliable_sequence
+        && p.first != communicatord::g_name_communicatord_param_reliable_ack)
         {
-            // include self since we already know of the message too!
-            // (no need for others to send it back to us)
-            //
-            informed_neighbors_list.insert(originator);
+            result.add_parameter(p.first, p.second);
         }
+    }
+    msg = result;
+    msg.user_data(conn);
 
-        // message is considered 'const', so we need to create a copy
-        //
-        ed::message broadcast_msg(msg);
+    return true;
+}
 
-        // generate a unique broadcast message identifier if we did not
-        // yet have one, it is very important to NOT generate a new message
-        // in a many to many broadcasting system because you must block
-        // duplicates here
-        //
-        if(broadcast_msgid.empty())
-        {
-            ++g_broadcast_sequence;
-            broadcast_msgid += f_server_name;
-            broadcast_msgid += '-';
-            broadcast_msgid += std::to_string(g_broadcast_sequence);
-        }
-        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_msgid, broadcast_msgid);
 
-        // TODO: mark true if we are sending the message through a secure
-        //       connection
-        //
-        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_secure_remote, "false");
+/** \brief A link to a remote communicator was established.
+ *
+ * The CONNECT and ACCEPT messages include the session of the remote
+ * daemon. If it changed, that daemon restarted and the sequence numbers
+ * we received from it are not valid anymore.
+ *
+ * The ACCEPT message also includes the last sequence number that daemon
+ * received from us so we do not send those messages again.
+ *
+ * \param[in] conn  The link to the remote communicator.
+ * \param[in] msg  The CONNECT or ACCEPT message.
+ */
+void server::reliable_link_started(
+      base_connection::pointer_t conn
+    , ed::message const & msg)
+{
+    if(!conn->has_capability(communicatord::g_name_communicatord_value_reliable)
+    || !msg.has_parameter(communicatord::g_name_communicatord_param_reliable_session))
+    {
+        return;
+    }
 
-        // increase the number of hops; if we reach the limit, we still
-        // want to forward the message, the destination will not forward
-        // (broadcast) more, but it will possibly send that to its own
-        // services
-        //
-        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_hops, hops + 1);
+    reliable_link & link(get_reliable_link(msg.get_parameter(communicatord::g_name_communicatord_param_server_name)));
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_reliable_ack))
+    {
+        link.acknowledge(msg.get_integer_parameter(communicatord::g_name_communicatord_param_reliable_ack));
+    }
+    std::int64_t const previous_session(link.get_peer_session());
+    if(link.set_peer_session(msg.get_integer_parameter(communicatord::g_name_communicatord_param_reliable_session))
+    && previous_session != 0)
+    {
+        SNAP_LOG_VERBOSE
+            << "remote communicator \""
+            << msg.get_parameter(communicatord::g_name_communicatord_param_server_name)
+            << "\" restarted, its reliable sequence numbers start over."
+            << SNAP_LOG_SEND;
+    }
+}
 
-        // mainly noise at this point, but I include the originator so
-        // we can track that back if needed for debug purposes
-        //
-        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_originator, originator);
 
-        // define a timeout if this is the originator
-        //
-        if(timeout == 0)
-        {
-            // give message 10 seconds to arrive to any and all destinations
-            timeout = time(nullptr) + 10;
-        }
-        broadcast_msg.add_parameter(communicatord::g_name_communicatord_param_broadcast_timeout, timeout);
+/** \brief Send the reliable messages which were not acknowledged.
+ *
+ * Once a link to a remote communicator is established again, the
+ * messages it did not acknowledge are sent again, in order. That daemon
+ * ignores those it already received.
+ *
+ * \param[in] conn  The link to the remote communicator.
+ */
+void server::replay_reliable_messages(base_connection::pointer_t conn)
+{
+    if(!conn->has_capability(communicatord::g_name_communicatord_value_reliable))
+    {
+        return;
+    }
 
-        // note that we currently define the list of neighbors BEFORE
-        // sending the message (anyway the send_message() just adds the
-        // message to a memory cache at this point, so whether it will
-        // be sent is not known until later.)
-        //
-        broadcast_msg.add_parameter(
-                  communicatord::g_name_communicatord_param_broadcast_informed_neighbors
-                , snapdev::join_strings(informed_neighbors_list, ","));
+    auto it(f_reliable_links.find(conn->get_server_name()));
+    if(it == f_reliable_links.end()
+    || it->second.pending() == 0)
+    {
+        return;
+    }
 
-        for(auto const & bc : broadcast_connection)
+    // the forwarded messages would otherwise time out by the time
+    // they get there again
+    //
+    time_t const timeout(time(nullptr) + 10);
+
+    std::vector<ed::message> messages;
+    it->second.get_unacknowledged(messages);
+    for(auto & m : messages)
+    {
+        if(m.has_parameter(communicatord::g_name_communicatord_param_broadcast_timeout))
         {
-            service_connection::pointer_t conn(std::dynamic_pointer_cast<service_connection>(bc));
-            if(conn != nullptr)
-            {
-                conn->send_message(broadcast_msg);
-            }
-            else
-            {
-                remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(bc));
-                if(remote_conn != nullptr) // this should always be true, but to be double sure...
-                {
-                    remote_conn->send_message(broadcast_msg);
-                }
-            }
+            m.add_parameter(communicatord::g_name_communicatord_param_broadcast_timeout, timeout);
         }
+        conn->send_message_to_connection(m);
     }
+    f_reliable_replayed += messages.size();
+
+    SNAP_LOG_VERBOSE
+        << "sent "
+        << messages.size()
+        << " unacknowledged reliable message(s) to \""
+        << conn->get_server_name()
+        << "\" again."
+        << SNAP_LOG_SEND;
 }
 
 
-void server::set_clock_status(clock_status_t status)
+/** \brief Save the gateway mode and status of a remote communicator.
+ *
+ * The CONNECT and ACCEPT messages of the communicators supporting the
+ * gateway capability include their gateway mode, used to elect the
+ * gateways of our site, and whether they currently are a gateway of
+ * their own site.
+ *
+ * \param[in] conn  The link to the remote communicator.
+ * \param[in] msg  The CONNECT or ACCEPT message.
+ */
+void server::set_peer_gateway(
+      base_connection::pointer_t conn
+    , ed::message const & msg)
 {
-    if(f_clock_status == status)
+    if(!conn->has_capability(communicatord::g_name_communicatord_value_gateway))
     {
-        // status did not change, do nothing
-        //
         return;
     }
-    f_clock_status = status;
-    send_clock_status(ed::connection::pointer_t());
+
+    gateway_mode_t mode(gateway_mode_t::GATEWAY_MODE_NEVER);
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_gateway_mode)
+    && !parse_gateway_mode(msg.get_parameter(communicatord::g_name_communicatord_param_gateway_mode), mode))
+    {
+        mode = gateway_mode_t::GATEWAY_MODE_NEVER;
+    }
+    conn->set_gateway_mode(mode);
+    conn->set_gateway(msg.has_parameter(communicatord::g_name_communicatord_param_gateway)
+                && msg.get_parameter(communicatord::g_name_communicatord_param_gateway) == communicatord::g_name_communicatord_value_true);
 }
 
 
-void server::send_clock_status(ed::connection::pointer_t reply_connection)
+/** \brief Elect the gateways of our site.
+ *
+ * In hierarchical mode (--gateway-count larger than 0), the communicators
+ * of a site, i.e. those we reach through a private address, elect the
+ * gateways which send the messages to the other sites. All the
+ * communicators of a site use the same rules on the same list of
+ * daemons so no vote is necessary (see select_gateways()).
+ *
+ * This function is called each time a link gets established or lost,
+ * which makes another daemon take over when a gateway goes down.
+ *
+ * When our own status changes, the communicators of the other sites get
+ * a GATEWAY message so they know whether to send us their messages.
+ */
+void server::update_gateways()
 {
-    ed::message clock_status_msg;
+    if(f_gateway_count == 0)
+    {
+        return;
+    }
 
-    clock_status_msg.set_command(communicatord::g_name_communicatord_cmd_clock_unstable);
-    switch(f_clock_status)
+    gateway_candidates_t candidates;
+    candidates[f_server_name] = f_gateway_mode;
+    auto const add_candidate = [&candidates](base_connection::pointer_t const & conn)
     {
-    case clock_status_t::CLOCK_STATUS_STABLE:
-        clock_status_msg.set_command(communicatord::g_name_communicatord_cmd_clock_stable);
-        clock_status_msg.add_parameter(
-                  communicatord::g_name_communicatord_param_clock_resolution
-                , communicatord::g_name_communicatord_value_verified);
-        break;
+        if(conn->get_connection_type() == connection_type_t::CONNECTION_TYPE_REMOTE
+        && !conn->get_server_name().empty()
+        && conn->has_capability(communicatord::g_name_communicatord_value_gateway)
+        && conn->get_connection_address().get_network_type() == addr::network_type_t::NETWORK_TYPE_PRIVATE)
+        {
+            candidates[conn->get_server_name()] = conn->get_gateway_mode();
+        }
+    };
+    for(auto const & c : f_inbound_connections)
+    {
+        add_candidate(c.second);
+    }
+    for(auto const & c : f_outbound_connections)
+    {
+        if(c.second->is_connected())
+        {
+            add_candidate(c.second);
+        }
+    }
 
-    case clock_status_t::CLOCK_STATUS_NO_NTP:
-        clock_status_msg.set_command(communicatord::g_name_communicatord_cmd_clock_stable);
-        clock_status_msg.add_parameter(
-                  communicatord::g_name_communicatord_param_clock_resolution
-                , communicatord::g_name_communicatord_value_no_ntp);
-        break;
+    advgetopt::string_set_t gateways(select_gateways(candidates, f_gateway_count));
+    bool const gateway(gateways.erase(f_server_name) > 0);
+    f_site_gateways.swap(gateways);
+    if(gateway == f_gateway)
+    {
+        return;
+    }
+    f_gateway = gateway;
+    ++f_gateway_changes;
 
-    case clock_status_t::CLOCK_STATUS_INVALID:
-        clock_status_msg.add_parameter(
-                  communicatord::g_name_communicatord_param_clock_error
-                , communicatord::g_name_communicatord_value_invalid);
-        break;
+    SNAP_LOG_INFO
+        << "this communicator daemon "
+        << (gateway ? "is now" : "is not anymore")
+        << " a gateway of its site."
+        << SNAP_LOG_SEND;
+
+    ed::message status;
+    status.set_command(communicatord::g_name_communicatord_cmd_gateway);
+    status.add_parameter(
+              communicatord::g_name_communicatord_param_gateway
+            , gateway
+                ? communicatord::g_name_communicatord_value_true
+                : communicatord::g_name_communicatord_value_false);
+    routing_table::connection_vector_t links;
+    f_routes.get_links(links);
+    for(auto const & l : links)
+    {
+        if(l->get_connection_type() == connection_type_t::CONNECTION_TYPE_REMOTE
+        && l->has_capability(communicatord::g_name_communicatord_value_gateway)
+        && l->get_connection_address().get_network_type() == addr::network_type_t::NETWORK_TYPE_PUBLIC)
+        {
+            l->send_message_to_connection(status);
+        }
+    }
+}
 
-    default:
-        clock_status_msg.add_parameter(
-                  communicatord::g_name_communicatord_param_clock_error
-                , communicatord::g_name_communicatord_value_checking);
-        break;
 
+/** \brief Get the links to the other gateways of our site.
+ *
+ * \param[in,out] links  The vector where the links get added.
+ */
+void server::get_site_gateway_links(base_connection::vector_t & links) const
+{
+    for(auto const & name : f_site_gateways)
+    {
+        base_connection::pointer_t link(f_routes.find_link(name));
+        if(link != nullptr
+        && link->get_connection_type() == connection_type_t::CONNECTION_TYPE_REMOTE)
+        {
+            links.push_back(link);
+        }
     }
+}
 
-    if(reply_connection != nullptr)
+
+/** \brief Select the peers of other sites receiving a public broadcast.
+ *
+ * Without the hierarchical mode, a public broadcast is sent to each
+ * peer of the other sites, which means the same message crosses the WAN
+ * once per remote computer.
+ *
+ * In hierarchical mode, a communicator which is not a gateway removes
+ * those peers and returns the gateways of its site in \p relays instead.
+ * A gateway only keeps the peers which are gateways of their own site,
+ * unless none of them is, in which case all the peers are kept. The
+ * gateway receiving the message relays it over its LAN.
+ *
+ * Peers which do not support the gateway capability are always kept.
+ *
+ * \param[in,out] peers  The peers of other sites and their address.
+ * \param[out] relays  The gateways of our site to send the message to.
+ */
+void server::select_public_peers(
+      public_peer_vector_t & peers
+    , base_connection::vector_t & relays)
+{
+    if(f_gateway_count == 0
+    || peers.empty())
     {
-        // reply to a direct CLOCK_STATUS
-        //
-        service_connection::pointer_t r(std::dynamic_pointer_cast<service_connection>(reply_connection));
-        if(r->understand_command(clock_status_msg.get_command()))
+        return;
+    }
+
+    auto const capable = [](public_peer_vector_t::value_type const & p)
+    {
+        return p.first->has_capability(communicatord::g_name_communicatord_value_gateway);
+    };
+
+    if(!f_gateway)
+    {
+        get_site_gateway_links(relays);
+        if(!relays.empty())
         {
-            r->send_message(clock_status_msg);
+            std::size_t const size(peers.size());
+            peers.erase(std::remove_if(peers.begin(), peers.end(), capable), peers.end());
+            f_gateway_skipped += size - peers.size();
         }
+        return;
     }
-    else
+
+    auto const other_gateway = [&capable](public_peer_vector_t::value_type const & p)
     {
-        clock_status_msg.set_service(communicatord::g_name_communicatord_service_local_broadcast);
-        broadcast_message(clock_status_msg);
+        return capable(p) && p.first->is_gateway();
+    };
+    if(std::any_of(peers.begin(), peers.end(), other_gateway))
+    {
+        std::size_t const size(peers.size());
+        peers.erase(std::remove_if(
+                      peers.begin()
+                    , peers.end()
+                    , [&capable, &other_gateway](public_peer_vector_t::value_type const & p)
+                    {
+                        return capable(p) && !other_gateway(p);
+                    })
+                , peers.end());
+        f_gateway_skipped += size - peers.size();
     }
 }
 
 
-/** \brief Send the current status of a client to connections.
+/** \brief Send the messages for other sites through a gateway.
  *
- * Some connections (the sitter, the cluck, ...) may be interested
- * by the STATUS event. Any connection that understands the STATUS
- * event will be sent that event whenever the status of a connection
- * changes (specifically, on a REGISTER, CONNECT and on an UNREGISTER,
- * DISCONNECT or equivalent).
+ * In hierarchical mode, a communicator which is not a gateway does not
+ * send messages to the other sites itself. The links to other sites
+ * get replaced by one gateway of our site, which forwards the message.
  *
- * \param[in] connection  The connection that just had its status changed.
- * \param[in] reply_connection  If not nullptr, the connection where the
- *                              STATUS message gets sent.
+ * \param[in,out] links  The links the message is about to be sent to.
  */
-void server::send_status(
-      ed::connection::pointer_t connection
-    , ed::connection::pointer_t * reply_connection)
+void server::relay_to_site_gateways(base_connection::vector_t & links)
 {
-    ed::message reply;
-    reply.set_command(communicatord::g_name_communicatord_cmd_status);
-    reply.add_parameter(communicatord::g_name_communicatord_param_cache, communicatord::g_name_communicatord_value_no);
+    if(f_gateway_count == 0
+    || f_gateway
+    || links.empty())
+    {
+        return;
+    }
 
-    // the name of the service is the name of the connection
+    auto const other_site = [](base_connection::pointer_t const & l)
+    {
+        return l->has_capability(communicatord::g_name_communicatord_value_gateway)
+            && l->get_connection_address().get_network_type() == addr::network_type_t::NETWORK_TYPE_PUBLIC;
+    };
+    if(std::none_of(links.begin(), links.end(), other_site))
+    {
+        return;
+    }
+
+    base_connection::vector_t gateways;
+    get_site_gateway_links(gateways);
+    if(gateways.empty())
+    {
+        return;
+    }
+
+    std::size_t const size(links.size());
+    links.erase(std::remove_if(links.begin(), links.end(), other_site), links.end());
+    f_gateway_skipped += size - links.size();
+
+    // this is not a broadcast, one gateway is enough
     //
-    reply.add_parameter(communicatord::g_name_communicatord_param_service, connection->get_name());
+    if(std::find(links.begin(), links.end(), gateways[0]) == links.end())
+    {
+        links.push_back(gateways[0]);
+    }
+}
 
-    base_connection::pointer_t base_connection(std::dynamic_pointer_cast<base_connection>(connection));
-    if(base_connection != nullptr)
+
+/** \brief Decide whether the messages sent to a link get compressed.
+ *
+ * This function is called once we received the CONNECT or ACCEPT
+ * message of another communicatord. If that communicatord supports
+ * the compression and the link goes over a network selected by the
+ * --link-compression option, the link compresses the messages of at
+ * least --link-compression-threshold bytes.
+ *
+ * By default, only links to public IP addresses get compressed since
+ * those are the ones between data centers.
+ *
+ * \param[in] conn  The link to another communicatord.
+ */
+void server::setup_link_compression(base_connection::pointer_t conn)
+{
+    bool compress(false);
+    if(conn->has_capability(communicatord::g_name_communicatord_value_wire_format)
+    && conn->has_capability(communicatord::g_name_communicatord_value_zstd))
     {
-        // include the server name
-        //
-        std::string const server_name(base_connection->get_server_name());
-        if(!server_name.empty())
+        switch(f_link_compression)
         {
-            reply.add_parameter(communicatord::g_name_communicatord_param_server_name, server_name);
-        }
+        case link_compression_t::LINK_COMPRESSION_NONE:
+            break;
 
-        // check whether the connection is now up or down
-        //
-        connection_type_t const type(base_connection->get_connection_type());
-        reply.add_parameter(
-                  communicatord::g_name_communicatord_param_status
-                , type == connection_type_t::CONNECTION_TYPE_DOWN
-                        ? communicatord::g_name_communicatord_value_down
-                        : communicatord::g_name_communicatord_value_up);
+        case link_compression_t::LINK_COMPRESSION_PUBLIC:
+            compress = conn->get_connection_address().get_network_type() == addr::network_type_t::NETWORK_TYPE_PUBLIC;
+            break;
 
-        // get the time when it was considered up
-        //
-        time_t const up_since(base_connection->get_connection_started());
-        if(up_since != -1)
-        {
-            reply.add_parameter(communicatord::g_name_communicatord_param_up_since, up_since);
-        }
+        case link_compression_t::LINK_COMPRESSION_ALL:
+            compress = true;
+            break;
 
-        // get the time when it was considered down (if not up yet, this will be skipped)
-        //
-        time_t const down_since(base_connection->get_connection_ended());
-        if(down_since != -1)
-        {
-            reply.add_parameter(communicatord::g_name_communicatord_param_down_since, down_since);
         }
     }
-    else
-    {
-        reply.add_parameter(
-                  communicatord::g_name_communicatord_param_status
-                , communicatord::g_name_communicatord_value_unknown);
-    }
 
-    if(reply_connection != nullptr)
+    if(compress)
     {
-        service_connection::pointer_t sc(std::dynamic_pointer_cast<service_connection>(*reply_connection));
-        if(sc)
-        {
-            // if the verify_command() fails then it means the caller has to
-            // create a handler for the STATUS message
-            //
-            if(verify_command(sc, reply))
-            {
-                sc->send_message(reply);
-            }
-        }
-        else
-        {
-            unix_connection::pointer_t unix_conn(std::dynamic_pointer_cast<unix_connection>(*reply_connection));
-            if(unix_conn != nullptr)
-            {
-                if(unix_conn->understand_command(communicatord::g_name_communicatord_cmd_status))
-                {
-                    // send that STATUS message
-                    //
-                    //verify_command(sc, reply); -- we reach this line only if the command is understood
-                    unix_conn->send_message(reply);
-                }
-            }
-        }
+        conn->set_compression(f_link_compression_level, f_link_compression_threshold);
     }
     else
     {
-        // we have the message, now we need to find the list of connections
-        // interested by the STATUS event
-        //
-        // TODO: use the broadcast_message() function instead? (with service set to ".")
-        //
-        ed::connection::vector_t const & all_connections(f_communicator->get_connections());
-        for(auto const & conn : all_connections)
-        {
-            service_connection::pointer_t sc(std::dynamic_pointer_cast<service_connection>(conn));
-            if(sc != nullptr)
-            {
-                if(sc->understand_command(communicatord::g_name_communicatord_cmd_status))
-                {
-                    // send that STATUS message
-                    //
-                    //verify_command(sc, reply); -- we reach this line only if the command is understood
-                    sc->send_message(reply);
-                }
-                continue;
-            }
-
-            unix_connection::pointer_t unix_conn(std::dynamic_pointer_cast<unix_connection>(conn));
-            if(unix_conn != nullptr)
-            {
-                if(unix_conn->understand_command(communicatord::g_name_communicatord_cmd_status))
-                {
-                    // send that STATUS message
-                    //
-                    //verify_command(sc, reply); -- we reach this line only if the command is understood
-                    unix_conn->send_message(reply);
-                }
-                continue;
-            }
-        }
+        conn->set_compression(0, 0);
     }
 }
 
 
-/** \brief Check our current cluster status.
+/** \brief Handle a message sent to a congested local service.
  *
- * We received or lost a connection with a remote computer and
- * need to determine (again) whether we are part of a cluster
- * or not.
+ * The output queue of \p conn reached its high watermark. The service
+ * which sent \p msg is told to slow down with a FLOW_CONTROL message,
+ * once per congestion and only if it understands that message.
  *
- * This function is also called when we receive the CLUSTER_STATUS
- * which is a query to know now what the status of the cluster is.
- * This is generally sent by daemons who need to know and may have
- * missed our previous broadcasts.
+ * Then, if \p conn uses the disconnect policy, it gets removed. Otherwise
+ * \p msg is saved in the cache if it has a "cache" parameter and dropped
+ * if not. The cached messages are sent once the queue drained.
  *
- * \param[in] reply_connection  A connection to reply to directly.
+ * \param[in] conn  The congested connection.
+ * \param[in] msg  The message that could not be sent.
+ *
+ * \return true if the message was cached.
  */
-void server::cluster_status(ed::connection::pointer_t reply_connection)
+bool server::slow_consumer(base_connection::pointer_t conn, ed::message & msg)
 {
-    // the count_live_connections() counts all the other communicators,
-    // not ourself, this is why we have a +1 here (it is very important
-    // if you have a single computer like many developers would have when
-    // writing code and testing quickly.)
-    //
-    size_t const count(f_remote_communicators->count_live_connections() + 1);
-
-    // calculate the quorum, minimum number of computers that have to be
-    // interconnected to be able to say we have a live cluster
-    //
-    size_t const total_count(f_all_neighbors.size());
-    size_t const quorum(total_count / 2 + 1);
-    bool modified = false;
-
-    std::string const new_status(count >= quorum
-                    ? communicatord::g_name_communicatord_cmd_cluster_up
-                    : communicatord::g_name_communicatord_cmd_cluster_down);
-    if(new_status != f_cluster_status
-    || f_total_count_sent != total_count
-    || reply_connection != nullptr)
+    ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
+    if(c == nullptr)
     {
-        if(reply_connection == nullptr)
-        {
-            f_cluster_status = new_status;
-            modified = true;
-        }
-
-        // send the results to either the requesting connection or broadcast
-        // the status to everyone
-        //
-        ed::message cluster_status_msg;
-        cluster_status_msg.set_command(new_status);
-        cluster_status_msg.set_service(communicatord::g_name_communicatord_service_local_broadcast);
-        cluster_status_msg.add_parameter(communicatord::g_name_communicatord_param_neighbors_count, total_count);
-        if(reply_connection != nullptr)
-        {
-            // reply to a direct CLUSTER_STATUS
-            //
-            service_connection::pointer_t r(std::dynamic_pointer_cast<service_connection>(reply_connection));
-            if(r->understand_command(cluster_status_msg.get_command()))
-            {
-                r->send_message(cluster_status_msg);
-            }
-        }
-        else
-        {
-            broadcast_message(cluster_status_msg);
-        }
+        return false;
     }
 
-    std::string const new_complete(count == total_count
-                    ? communicatord::g_name_communicatord_cmd_cluster_complete
-                    : communicatord::g_name_communicatord_cmd_cluster_incomplete);
-    if(new_complete != f_cluster_complete
-    || f_total_count_sent != total_count
-    || reply_connection != nullptr)
+    base_connection::pointer_t producer(msg.user_data<base_connection>());
+    if(producer != nullptr
+    && producer != conn
+    && producer->understand_command(communicatord::g_name_communicatord_cmd_flow_control)
+    && conn->add_throttled_producer(producer))
     {
-        if(reply_connection == nullptr)
-        {
-            f_cluster_complete = new_complete;
-            modified = true;
-        }
+        ed::message flow_control;
+        flow_control.set_command(communicatord::g_name_communicatord_cmd_flow_control);
+        flow_control.add_parameter(communicatord::g_name_communicatord_param_destination_service, c->get_name());
+        flow_control.add_parameter(communicatord::g_name_communicatord_param_status, communicatord::g_name_communicatord_value_pause);
+        producer->send_message_to_connection(flow_control);
+    }
 
-        // send the results to either the requesting connection or broadcast
-        // the complete to everyone
-        //
-        ed::message cluster_complete_msg;
-        cluster_complete_msg.set_command(new_complete);
-        cluster_complete_msg.set_service(communicatord::g_name_communicatord_service_local_broadcast);
-        cluster_complete_msg.add_parameter(communicatord::g_name_communicatord_param_neighbors_count, total_count);
-        if(reply_connection != nullptr)
-        {
-            // reply to a direct CLUSTER_STATUS
-            //
-            service_connection::pointer_t r(std::dynamic_pointer_cast<service_connection>(reply_connection));
-            if(r->understand_command(cluster_complete_msg.get_command()))
-            {
-                r->send_message(cluster_complete_msg);
-            }
-        }
-        else
+    if(conn->get_slow_consumer_policy() == slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DISCONNECT)
+    {
+        conn->set_connection_type(connection_type_t::CONNECTION_TYPE_DOWN);
+        if(f_communicator->remove_connection(c))
         {
-            broadcast_message(cluster_complete_msg);
+            SNAP_LOG_ERROR
+                << "disconnecting \""
+                << c->get_name()
+                << "\" since it does not read its messages fast enough."
+                << SNAP_LOG_SEND;
+            send_status(c);
         }
+        return false;
     }
 
-    if(reply_connection == nullptr)
+    if(msg.has_parameter(communicatord::g_name_communicatord_param_cache)
+    && msg.get_service() == c->get_name()
+    && f_local_message_cache.cache_message(msg) == cache_message_t::CACHE_MESSAGE_CACHED)
     {
-        f_total_count_sent = total_count;
+        update_cache_timer();
+        return true;
     }
 
-    if(modified)
+    std::size_t const dropped(conn->add_dropped_message());
+    if(dropped == 1
+    || dropped % 1'000 == 0)
     {
-        std::ofstream status_file;
-        status_file.open(g_status_filename);
-        if(status_file.is_open())
-        {
-            status_file << f_cluster_status << std::endl
-                        << f_cluster_complete << std::endl;
-        }
-    }
-
-    SNAP_LOG_INFO
-        << "cluster status is \""
-        << new_status
-        << "\" and \""
-        << new_complete
-        << "\" (count: "
-        << count
-        << ", total count: "
-        << total_count
-        << ", quorum: "
-        << quorum
-        << ")"
-        << SNAP_LOG_SEND;
+        SNAP_LOG_WARNING
+            << "dropped "
+            << dropped
+            << " message(s) sent to \""
+            << c->get_name()
+            << "\" so far since it does not read them fast enough."
+            << SNAP_LOG_SEND;
+    }
+    return false;
 }
 
 
-/** \brief Request LOADAVG messages from a communicatord.
+/** \brief A congested local service caught up.
  *
- * This function gets called whenever a local service sends us a
- * request to listen to the LOADAVG messages of a specific
- * communicatord.
+ * The output queue of \p conn went under its low watermarks. The
+ * services which were told to slow down receive a FLOW_CONTROL message
+ * to resume and the messages cached in the meantime get sent.
  *
- * \param[in] msg  The LISTEN_LOADAVG message.
+ * \param[in] conn  The connection which is not congested anymore.
  */
-void server::msg_listen_loadavg(ed::message & msg)
+void server::consumer_recovered(base_connection::pointer_t conn)
 {
-    std::string const ips(msg.get_parameter(communicatord::g_name_communicatord_param_ips));
+    ed::connection::pointer_t c(std::dynamic_pointer_cast<ed::connection>(conn));
+    if(c == nullptr)
+    {
+        return;
+    }
 
-    std::vector<std::string> ip_list;
-    snapdev::tokenize_string(ip_list, ips, { "," });
+    SNAP_LOG_INFO
+        << "connection \""
+        << c->get_name()
+        << "\" caught up with its messages."
+        << SNAP_LOG_SEND;
 
-    // we have to save those as IP addresses since the remote
-    // communicators come and go and we have to make sure
-    // that all get our REGISER_FOR_LOADAVG message when they
-    // come back after a broken link
-    //
-    for(auto const & ip : ip_list)
+    for(auto const & producer : conn->get_throttled_producers())
     {
-        auto it(f_registered_neighbors_for_loadavg.find(ip));
-        if(it == f_registered_neighbors_for_loadavg.end())
+        ed::message flow_control;
+        flow_control.set_command(communicatord::g_name_communicatord_cmd_flow_control);
+        flow_control.add_parameter(communicatord::g_name_communicatord_param_destination_service, c->get_name());
+        flow_control.add_parameter(communicatord::g_name_communicatord_param_status, communicatord::g_name_communicatord_value_resume);
+        producer->send_message_to_connection(flow_control);
+    }
+
+    f_local_message_cache.process_messages(
+          c->get_name()
+        , [conn](ed::message & cached_msg)
         {
-            // add this one, it was not there yet
-            //
-            f_registered_neighbors_for_loadavg.insert(ip);
+            return !conn->is_output_congested()
+                && conn->send_message_to_connection(cached_msg);
+        });
+    update_cache_timer();
+}
 
-            register_for_loadavg(ip);
-        }
+
+/** \brief Send all the batched messages.
+ *
+ * This function is called by the flush timer once the batching delay
+ * is over or a batch is complete (see link_output_done()). It uncorks
+ * all the links.
+ */
+void server::process_flush_timeout()
+{
+    for(auto const & c : f_corked_connections)
+    {
+        c.second->uncork_output();
     }
+    f_corked_connections.clear();
+    f_flush_timer->set_enable(false);
 }
 
 
-void server::register_for_loadavg(std::string const & ip)
+/** \brief Send the heartbeats and check the remote communicators.
+ *
+ * This function is called by the heartbeat timer. It sends a HEARTBEAT
+ * to each remote communicator supporting the heartbeat capability and
+ * then evaluates the suspicion level of each one of them.
+ *
+ * A peer going over the suspect threshold is only reported. A peer going
+ * over the down threshold is disconnected as if the network had told us
+ * the connection was lost (see peer_down()).
+ */
+void server::process_heartbeat()
 {
-    addr::addr address(addr::string_to_addr(
-              ip
-            , "127.0.0.1"
-            , communicatord::LOCAL_PORT  // the port is ignore, use a safe default
-            , "tcp"));
-    ed::connection::vector_t const & all_connections(f_communicator->get_connections());
-    auto const & it(std::find_if(
-            all_connections.begin(),
-            all_connections.end(),
-            [address](auto const & connection)
-            {
-                remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(connection));
-                if(remote_conn != nullptr)
-                {
-                    return remote_conn->get_connection_address() == address;
-                }
-                else
-                {
-                    service_connection::pointer_t service_conn(std::dynamic_pointer_cast<service_connection>(connection));
-                    if(service_conn != nullptr)
-                    {
-                        return service_conn->get_connection_address() == address;
-                    }
-                }
+    if(f_shutdown)
+    {
+        return;
+    }
 
-                return false;
-            }));
+    std::int64_t const now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    std::int64_t const clock_now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
 
-    if(it != all_connections.end())
+    routing_table::connection_vector_t links;
+    f_routes.get_links(links);
+    for(auto const & conn : links)
     {
-        // there is such a connection, send it a request for
-        // LOADAVG message
+        if(conn->get_connection_type() != connection_type_t::CONNECTION_TYPE_REMOTE
+        || !conn->has_capability(communicatord::g_name_communicatord_value_heartbeat))
+        {
+            continue;
+        }
+
+        // the timestamps let the peer estimate the offset between its
+        // clock and ours (see msg_heartbeat())
         //
-        ed::message register_message;
-        register_message.set_command(communicatord::g_name_communicatord_cmd_register_for_loadavg);
+        ed::message heartbeat;
+        heartbeat.set_command(communicatord::g_name_communicatord_cmd_heartbeat);
+        heartbeat.add_parameter(communicatord::g_name_communicatord_param_clock_sent, clock_now);
+        std::int64_t peer_sent(0);
+        std::int64_t received(0);
+        if(conn->get_clock_offset().get_echo(peer_sent, received))
+        {
+            heartbeat.add_parameter(communicatord::g_name_communicatord_param_clock_echo, peer_sent);
+            heartbeat.add_parameter(communicatord::g_name_communicatord_param_clock_received, received);
+        }
+        conn->send_message_to_connection(heartbeat);
 
-        remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(*it));
-        if(remote_conn != nullptr)
+        failure_detector & detector(conn->get_failure_detector());
+        if(!detector.is_started())
         {
-            remote_conn->send_message(register_message);
+            // no heartbeat received yet, start counting from now
+            //
+            detector.set_thresholds(f_phi_suspect_threshold, f_phi_down_threshold);
+            detector.start(now, f_heartbeat_interval);
+            continue;
         }
-        else
+
+        peer_state_t const previous(detector.get_state());
+        peer_state_t const state(detector.evaluate(now));
+        if(state == previous)
         {
-            service_connection::pointer_t service_conn(std::dynamic_pointer_cast<service_connection>(*it));
-            if(service_conn != nullptr)
-            {
-                service_conn->send_message(register_message);
-            }
+            continue;
+        }
+
+        switch(state)
+        {
+        case peer_state_t::PEER_STATE_UP:
+            SNAP_LOG_INFO
+                << "remote communicator \""
+                << conn->get_server_name()
+                << "\" is sending heartbeats again."
+                << SNAP_LOG_SEND;
+            break;
+
+        case peer_state_t::PEER_STATE_SUSPECT:
+            ++f_peers_suspected;
+            SNAP_LOG_WARNING
+                << "remote communicator \""
+                << conn->get_server_name()
+                << "\" is suspected to be down (phi: "
+                << detector.phi(now)
+                << ")."
+                << SNAP_LOG_SEND;
+            break;
+
+        case peer_state_t::PEER_STATE_DOWN:
+            ++f_peers_down;
+            SNAP_LOG_ERROR
+                << "remote communicator \""
+                << conn->get_server_name()
+                << "\" stopped sending heartbeats (phi: "
+                << detector.phi(now)
+                << "), disconnecting."
+                << SNAP_LOG_SEND;
+            peer_down(conn);
+            break;
+
         }
     }
 }
 
 
-void server::msg_save_loadavg(ed::message & msg)
+/** \brief A remote communicator stopped answering.
+ *
+ * The failure detector determined that \p conn is gone although the
+ * socket did not report any error (i.e. a silent network partition).
+ * The connection is handled as if it had been lost: its routes and the
+ * services heard of through it are removed, a HANGUP is broadcast and
+ * the cluster status gets updated.
+ *
+ * A connection we initiated is disconnected and will reconnect later.
+ * A connection the peer initiated is removed; a GOSSIP tells the peer
+ * to connect again once it can reach us.
+ *
+ * \param[in] conn  The connection to the silent remote communicator.
+ */
+void server::peer_down(base_connection::pointer_t conn)
 {
-    std::string const avg_str(msg.get_parameter(communicatord::g_name_communicatord_param_avg));
-    std::string const my_address(msg.get_parameter(communicatord::g_name_communicatord_param_my_address));
-    snapdev::timespec_ex const timestamp_str(msg.get_timespec_parameter(communicatord::g_name_communicatord_param_timestamp));
-
-    communicatord::loadavg_item item;
-
-    // Note: we do not use the port so whatever number here is fine
-    addr::addr a(addr::string_to_addr(
-                  my_address
-                , "127.0.0.1"
-                , communicatord::LOCAL_PORT  // the port is ignore, use a safe default
-                , "tcp"));
-    a.set_port(communicatord::LOCAL_PORT); // actually force the port so in effect it is ignored
-    a.get_ipv6(item.f_address);
+    conn->connection_ended();
+    conn->set_connection_type(connection_type_t::CONNECTION_TYPE_DOWN);
+    f_routes.remove_connection(conn.get());
+    remove_heard_of_peer(conn.get());
 
-    item.f_avg = std::stof(avg_str);
-    if(item.f_avg < 0.0)
+    remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(conn));
+    if(remote_conn != nullptr)
     {
-        return;
+        // the failure handling sends the HANGUP and, in overlay mode,
+        // may replace that peer by a cold neighbor
+        //
+        remote_conn->disconnect();
+        remote_conn->process_connection_failed("the remote communicator stopped sending heartbeats");
     }
-
-    item.f_timestamp = timestamp_str;
-    if(snapdev::timespec_ex(item.f_timestamp) < snapdev::timespec_ex(SERVERPLUGINS_UNIX_TIMESTAMP(UTC_BUILD_YEAR, 1, 1, 0, 0, 0), 0))
+    else
     {
-        return;
+        if(!conn->get_server_name().empty())
+        {
+            ed::message hangup;
+            hangup.set_command(communicatord::g_name_communicatord_cmd_hangup);
+            hangup.set_service(communicatord::g_name_communicatord_service_local_broadcast);
+            hangup.add_parameter(communicatord::g_name_communicatord_param_server_name, conn->get_server_name());
+            broadcast_message(hangup);
+        }
+
+        // this calls connection_lost() which starts the GOSSIP
+        //
+        f_communicator->remove_connection(std::dynamic_pointer_cast<ed::connection>(conn));
     }
 
-    communicatord::loadavg_file file;
-    file.load();
-    file.add(item);
-    file.save();
+    cluster_status(nullptr);
 }
 
 
 void server::process_load_balancing()
 {
-    std::ifstream in;
-    in.open("/proc/loadavg", std::ios::in | std::ios::binary);
-    if(in.is_open())
+    std::chrono::steady_clock::time_point const now(std::chrono::steady_clock::now());
+    double elapsed(f_load_sample_interval);
+    if(f_last_load_sample != std::chrono::steady_clock::time_point())
     {
-        std::string avg_str;
-        for(;;)
-        {
-            char c;
-            in.read(&c, 1);
-            if(in.fail())
-            {
-                SNAP_LOG_ERROR
-                    << "error reading the /proc/loadavg data."
-                    << SNAP_LOG_SEND;
-                return;
-            }
-            if(std::isspace(c))
-            {
-                // we only read the first number (1 min. load avg.)
-                break;
-            }
-            avg_str += c;
-        }
+        elapsed = std::chrono::duration<double>(now - f_last_load_sample).count();
+    }
+    f_last_load_sample = now;
 
-        // we really only need the first number, we would not know what
-        // to do with the following ones at this time...
-        // (although that could help know whether the load average is
-        // going up or down, but it's not that easy, really.)
-        //
-        // we divide by the number of processors because each computer
-        // could have a different number of processors and a load
-        // average of 1 on a computer with 16 processors really
-        // represents 1/16th of the machine capacity.
-        //
-        float const avg(std::stof(avg_str) / f_number_of_processors);
+    if(!f_load_sampler->sample(elapsed))
+    {
+        SNAP_LOG_ERROR
+            << "error reading the /proc/loadavg data."
+            << SNAP_LOG_SEND;
+        return;
+    }
 
-        // TODO: see whether the current epsilon is good enough
-        if(std::fabs(f_last_loadavg - avg) < 0.1f)
-        {
-            // do not send if it did not change lately
-            return;
-        }
-        f_last_loadavg = avg;
+    // the score is already divided by the number of processors because
+    // each computer could have a different number of processors and a
+    // load of 1 on a computer with 16 processors really represents
+    // 1/16th of the machine capacity.
+    //
+    float const avg(static_cast<float>(f_load_sampler->get_score()));
+
+    // TODO: see whether the current epsilon is good enough
+    if(std::fabs(f_last_loadavg - avg) < 0.1f)
+    {
+        // do not send if it did not change lately
+        return;
+    }
+    f_last_loadavg = avg;
 
-        ed::message load_avg;
+    // the message is built once, then only the values get rewritten
+    // which reuses the parameters already allocated
+    //
+    ed::message & load_avg(f_loadavg_message);
+    if(load_avg.get_command().empty())
+    {
         load_avg.set_command(communicatord::g_name_communicatord_cmd_loadavg);
-        std::stringstream ss;
-        ss << avg;
-        load_avg.add_parameter(communicatord::g_name_communicatord_param_avg, ss.str());
         load_avg.add_parameter(
                   communicatord::g_name_communicatord_param_my_address
                 , f_connection_address.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT));
-        load_avg.add_parameter(communicatord::g_name_communicatord_param_timestamp, snapdev::now());
+    }
 
-        ed::connection::vector_t const & all_connections(f_communicator->get_connections());
-        std::for_each(
-                all_connections.begin(),
-                all_connections.end(),
-                [&load_avg](auto const & connection)
-                {
-                    base_connection::pointer_t base(std::dynamic_pointer_cast<base_connection>(connection));
-                    if(base
-                    && base->wants_loadavg())
-                    {
-                        remote_connection::pointer_t remote_conn(std::dynamic_pointer_cast<remote_connection>(connection));
-                        if(remote_conn != nullptr)
-                        {
-                            remote_conn->send_message(load_avg);
-                        }
-                        else
-                        {
-                            service_connection::pointer_t service_conn(std::dynamic_pointer_cast<service_connection>(connection));
-                            if(service_conn != nullptr)
-                            {
-                                service_conn->send_message(load_avg);
-                            }
-                        }
-                    }
-                });
+    // same format as `std::ostream << float`
+    //
+    char avg_buf[32];
+    std::to_chars_result const avg_result(std::to_chars(
+              avg_buf
+            , avg_buf + sizeof(avg_buf)
+            , avg
+            , std::chars_format::general
+            , 6));
+    load_avg.add_parameter(
+              communicatord::g_name_communicatord_param_avg
+            , std::string(avg_buf, avg_result.ptr));
+    load_avg.add_parameter(
+              communicatord::g_name_communicatord_param_score
+            , static_cast<std::int64_t>(f_load_sampler->get_score() * 1000.0));
+    load_avg.add_parameter(
+              communicatord::g_name_communicatord_param_run_queue
+            , static_cast<std::int64_t>(f_load_sampler->get_run_queue() * 1000.0));
+    if(f_load_sampler->has_pressure())
+    {
+        load_avg.add_parameter(
+                  communicatord::g_name_communicatord_param_cpu_pressure
+                , static_cast<std::int64_t>(f_load_sampler->get_cpu_pressure() * 1000.0));
+        load_avg.add_parameter(
+                  communicatord::g_name_communicatord_param_memory_pressure
+                , static_cast<std::int64_t>(f_load_sampler->get_memory_pressure() * 1000.0));
     }
-    else
+    load_avg.add_parameter(communicatord::g_name_communicatord_param_timestamp, snapdev::now());
+
+    serialized_message serialized_load_avg(load_avg);
+    for(auto const & c : f_loadavg_connections)
     {
-        SNAP_LOG_ERROR
-            << "error opening file \"/proc/loadavg\"."
-            << SNAP_LOG_SEND;
+        serialized_load_avg.send(c.second);
     }
 }
 
@@ -3944,7 +7868,271 @@ std::string server::get_local_services() const
  */
 std::string server::get_services_heard_of() const
 {
-    return f_services_heard_of;
+    return f_heard_of.get_list();
+}
+
+
+/** \brief Generate the metrics in the Prometheus text format.
+ *
+ * This function writes the message counters followed by gauges about
+ * the cache, the broadcast deduplication table and each connection.
+ * The connections are labelled with their name.
+ *
+ * The bytes received are not included: the eventdispatcher reads and
+ * splits the input of our connections before we get the messages.
+ *
+ * \return The metrics as a string.
+ */
+/** \brief Save the time output waited in the queue of a connection.
+ *
+ * \param[in] us  The time in microseconds.
+ */
+void server::output_latency(std::int64_t us)
+{
+    f_metrics.output_latency(us);
+}
+
+
+std::string server::get_metrics() const
+{
+    std::stringstream out;
+    f_metrics.output(out);
+
+    metrics::header(out, "communicatord_cache_messages", "gauge", "Messages waiting in the local cache.");
+    metrics::sample(out, "communicatord_cache_messages", std::string(), static_cast<std::uint64_t>(f_local_message_cache.size()));
+    metrics::header(out, "communicatord_cache_bytes", "gauge", "Bytes used by the messages in the local cache.");
+    metrics::sample(out, "communicatord_cache_bytes", std::string(), static_cast<std::uint64_t>(f_local_message_cache.get_bytes()));
+    metrics::header(out, "communicatord_cache_evicted_total", "counter", "Messages evicted from the local cache.");
+    metrics::sample(out, "communicatord_cache_evicted_total", std::string(), static_cast<std::uint64_t>(f_local_message_cache.get_evicted()));
+    metrics::header(out, "communicatord_broadcast_ids", "gauge", "Broadcast message identifiers remembered to ignore duplicates.");
+    metrics::sample(out, "communicatord_broadcast_ids", std::string(), static_cast<std::uint64_t>(f_received_broadcast_messages.size()));
+    metrics::header(out, "communicatord_startup_phase_seconds", "gauge", "Time at which each startup phase was reached since the daemon started.");
+    for(auto const & p : f_startup_phases)
+    {
+        out << "communicatord_startup_phase_seconds{"
+            << metrics::label("phase", p.first)
+            << "} "
+            << std::fixed << std::setprecision(6) << static_cast<double>(p.second) / 1'000'000.0 << std::defaultfloat
+            << '\n';
+    }
+    metrics::header(out, "communicatord_tls_handshakes_total", "counter", "Full TLS handshakes of secure connections.");
+    metrics::sample(out, "communicatord_tls_handshakes_total", metrics::label("side", "accept"), f_tls_accepted);
+    metrics::sample(out, "communicatord_tls_handshakes_total", metrics::label("side", "connect"), f_tls_connected);
+    metrics::header(out, "communicatord_tls_handshakes_throttled_total", "counter", "TLS handshakes with a peer which went over its handshake budget.");
+    metrics::sample(out, "communicatord_tls_handshakes_throttled_total", std::string(), f_tls_handshakes.get_throttled());
+    metrics::header(out, "communicatord_tls_handshake_peers", "gauge", "Peers with a recent TLS handshake.");
+    metrics::sample(out, "communicatord_tls_handshake_peers", std::string(), static_cast<std::uint64_t>(f_tls_handshakes.size()));
+    metrics::header(out, "communicatord_peers_suspected_total", "counter", "Remote communicators which went over the suspect threshold of the failure detector.");
+    metrics::sample(out, "communicatord_peers_suspected_total", std::string(), f_peers_suspected);
+    metrics::header(out, "communicatord_peers_down_total", "counter", "Remote communicators disconnected because they stopped sending heartbeats.");
+    metrics::sample(out, "communicatord_peers_down_total", std::string(), f_peers_down);
+    routing_table::connection_vector_t links;
+    f_routes.get_links(links);
+    metrics::header(out, "communicatord_peer_clock_offset_microseconds", "gauge", "Estimated clock of the remote communicator minus our clock.");
+    for(auto const & l : links)
+    {
+        if(l->get_clock_offset().has_estimate())
+        {
+            metrics::sample_signed(out, "communicatord_peer_clock_offset_microseconds", metrics::label("server", l->get_server_name()), l->get_clock_offset().get_offset());
+        }
+    }
+    metrics::header(out, "communicatord_peer_clock_rtt_microseconds", "gauge", "Round trip time of the clock offset estimate of the remote communicator.");
+    for(auto const & l : links)
+    {
+        if(l->get_clock_offset().has_estimate())
+        {
+            metrics::sample(out, "communicatord_peer_clock_rtt_microseconds", metrics::label("server", l->get_server_name()), static_cast<std::uint64_t>(l->get_clock_offset().get_rtt()));
+        }
+    }
+    std::uint64_t reliable_pending(0);
+    std::uint64_t reliable_overflow(0);
+    for(auto const & l : f_reliable_links)
+    {
+        reliable_pending += l.second.pending();
+        reliable_overflow += l.second.get_overflow();
+    }
+    metrics::header(out, "communicatord_reliable_sent_total", "counter", "Reliable messages sent to remote communicators.");
+    metrics::sample(out, "communicatord_reliable_sent_total", std::string(), f_reliable_sent);
+    metrics::header(out, "communicatord_reliable_replayed_total", "counter", "Reliable messages sent again after a remote communicator reconnected.");
+    metrics::sample(out, "communicatord_reliable_replayed_total", std::string(), f_reliable_replayed);
+    metrics::header(out, "communicatord_reliable_duplicates_total", "counter", "Reliable messages received more than once and ignored.");
+    metrics::sample(out, "communicatord_reliable_duplicates_total", std::string(), f_reliable_duplicates);
+    metrics::header(out, "communicatord_reliable_gaps_total", "counter", "Reliable messages received after some messages were lost.");
+    metrics::sample(out, "communicatord_reliable_gaps_total", std::string(), f_reliable_gaps);
+    metrics::header(out, "communicatord_reliable_overflow_total", "counter", "Reliable messages dropped because too many were waiting for an acknowledgement.");
+    metrics::sample(out, "communicatord_reliable_overflow_total", std::string(), reliable_overflow);
+    metrics::header(out, "communicatord_reliable_pending", "gauge", "Reliable messages waiting for an acknowledgement.");
+    metrics::sample(out, "communicatord_reliable_pending", std::string(), reliable_pending);
+    metrics::header(out, "communicatord_routes", "gauge", "Entries in the routing table.");
+    metrics::sample(out, "communicatord_routes", std::string(), static_cast<std::uint64_t>(f_routes.size()));
+    metrics::header(out, "communicatord_services_heard_of", "gauge", "Services reachable through other communicator daemons.");
+    metrics::sample(out, "communicatord_services_heard_of", std::string(), static_cast<std::uint64_t>(f_heard_of.size()));
+    metrics::header(out, "communicatord_interest_summaries", "gauge", "Servers with a known interest summary, including this one.");
+    metrics::sample(out, "communicatord_interest_summaries", std::string(), static_cast<std::uint64_t>(f_interests.size()));
+    metrics::header(out, "communicatord_broadcast_skipped_total", "counter", "Broadcasts not sent to a remote communicator because nobody on or behind it consumes them.");
+    metrics::sample(out, "communicatord_broadcast_skipped_total", std::string(), f_broadcast_skipped);
+    metrics::header(out, "communicatord_gateway", "gauge", "Whether this communicator is a gateway of its site (hierarchical mode).");
+    metrics::sample(out, "communicatord_gateway", std::string(), static_cast<std::uint64_t>(f_gateway ? 1 : 0));
+    metrics::header(out, "communicatord_site_gateways", "gauge", "Other communicators elected as gateways of our site.");
+    metrics::sample(out, "communicatord_site_gateways", std::string(), static_cast<std::uint64_t>(f_site_gateways.size()));
+    metrics::header(out, "communicatord_gateway_changes_total", "counter", "Times this communicator became or stopped being a gateway.");
+    metrics::sample(out, "communicatord_gateway_changes_total", std::string(), f_gateway_changes);
+    metrics::header(out, "communicatord_gateway_skipped_total", "counter", "Messages not sent to another site directly because a gateway relays them.");
+    metrics::sample(out, "communicatord_gateway_skipped_total", std::string(), f_gateway_skipped);
+    metrics::header(out, "communicatord_rate_limit_dropped_total", "counter", "Messages dropped because they went over their rate limit.");
+    metrics::sample(out, "communicatord_rate_limit_dropped_total", std::string(), f_rate_limit_dropped);
+    metrics::header(out, "communicatord_rate_limit_delayed_total", "counter", "Messages delayed because they went over their rate limit.");
+    metrics::sample(out, "communicatord_rate_limit_delayed_total", std::string(), f_rate_limit_delayed);
+    metrics::header(out, "communicatord_rate_limit_delayed_connections", "gauge", "Connections with messages waiting for their rate limit.");
+    metrics::sample(out, "communicatord_rate_limit_delayed_connections", std::string(), static_cast<std::uint64_t>(f_delayed_connections.size()));
+    metrics::header(out, "communicatord_throttle_sent_total", "counter", "THROTTLE messages sent to services going over their rate limit.");
+    metrics::sample(out, "communicatord_throttle_sent_total", std::string(), f_throttle_sent);
+    metrics::header(out, "communicatord_message_pool_allocated_total", "counter", "Messages allocated by the pool used to copy the messages being sent.");
+    metrics::sample(out, "communicatord_message_pool_allocated_total", std::string(), f_message_pool.get_allocated());
+    metrics::header(out, "communicatord_message_pool_reused_total", "counter", "Message copies which reused the storage of a previous copy.");
+    metrics::sample(out, "communicatord_message_pool_reused_total", std::string(), f_message_pool.get_reused());
+    metrics::header(out, "communicatord_admission_connections", "gauge", "Connections currently admitted by each type of listener.");
+    for(int b(0); b < static_cast<int>(admission_budget_t::ADMISSION_BUDGET_COUNT); ++b)
+    {
+        admission_budget_t const budget(static_cast<admission_budget_t>(b));
+        metrics::sample(
+                  out
+                , "communicatord_admission_connections"
+                , metrics::label("listener", admission_budget_name(budget))
+                , static_cast<std::uint64_t>(f_admission_control->get_count(budget)));
+    }
+    metrics::header(out, "communicatord_admission_refused_total", "counter", "Connections closed because the budget of their listener was full.");
+    for(int b(0); b < static_cast<int>(admission_budget_t::ADMISSION_BUDGET_COUNT); ++b)
+    {
+        admission_budget_t const budget(static_cast<admission_budget_t>(b));
+        metrics::sample(
+                  out
+                , "communicatord_admission_refused_total"
+                , metrics::label("listener", admission_budget_name(budget))
+                , f_admission_control->get_refused(budget));
+    }
+    metrics::header(out, "communicatord_admission_address_refused_total", "counter", "Connections closed because their IP address had too many connections.");
+    metrics::sample(out, "communicatord_admission_address_refused_total", std::string(), f_admission_control->get_address_refused());
+    metrics::header(out, "communicatord_overload_shedding", "gauge", "Whether the communicator currently sheds remote CONNECTs and non-critical broadcasts.");
+    metrics::sample(out, "communicatord_overload_shedding", std::string(), f_overload.is_shedding() ? 1 : 0);
+    metrics::header(out, "communicatord_overload_total", "counter", "Times the communicator started shedding.");
+    metrics::sample(out, "communicatord_overload_total", std::string(), f_overload.get_shedding_count());
+    metrics::header(out, "communicatord_event_loop_lag_microseconds", "gauge", "How late the overload timer fired on its last tick.");
+    metrics::sample(out, "communicatord_event_loop_lag_microseconds", std::string(), static_cast<std::uint64_t>(f_overload.get_lag()));
+    metrics::header(out, "communicatord_queued_messages", "gauge", "Messages waiting in the output queues of all the connections on the last tick of the overload timer.");
+    metrics::sample(out, "communicatord_queued_messages", std::string(), static_cast<std::uint64_t>(f_overload.get_queue_depth()));
+    metrics::header(out, "communicatord_connect_deferred_total", "counter", "Remote CONNECTs refused because the communicator was overloaded.");
+    metrics::sample(out, "communicatord_connect_deferred_total", std::string(), f_connect_deferred);
+    metrics::header(out, "communicatord_broadcast_shed_total", "counter", "Broadcasts not forwarded to a communicator because this one was overloaded.");
+    metrics::sample(out, "communicatord_broadcast_shed_total", std::string(), f_broadcast_shed);
+    if(!f_io_shards.empty())
+    {
+        metrics::header(out, "communicatord_io_shard_connections", "gauge", "Connections read and written by each I/O shard.");
+        for(auto const & s : f_io_shards)
+        {
+            metrics::sample(out, "communicatord_io_shard_connections", metrics::label("shard", std::to_string(s->get_index())), static_cast<std::uint64_t>(s->get_connection_count()));
+        }
+        metrics::header(out, "communicatord_io_shard_inbound_depth", "gauge", "Messages and events of each I/O shard waiting for the main thread.");
+        for(auto const & s : f_io_shards)
+        {
+            metrics::sample(out, "communicatord_io_shard_inbound_depth", metrics::label("shard", std::to_string(s->get_index())), static_cast<std::uint64_t>(s->get_inbound_depth()));
+        }
+        metrics::header(out, "communicatord_io_shard_outbound_depth", "gauge", "Writes of the main thread waiting for each I/O shard.");
+        for(auto const & s : f_io_shards)
+        {
+            metrics::sample(out, "communicatord_io_shard_outbound_depth", metrics::label("shard", std::to_string(s->get_index())), static_cast<std::uint64_t>(s->get_outbound_depth()));
+        }
+        metrics::header(out, "communicatord_io_shard_messages_total", "counter", "Messages read by each I/O shard.");
+        for(auto const & s : f_io_shards)
+        {
+            metrics::sample(out, "communicatord_io_shard_messages_total", metrics::label("shard", std::to_string(s->get_index())), s->get_messages());
+        }
+        metrics::header(out, "communicatord_io_shard_overflow_total", "counter", "Writes which did not fit in the queue of an I/O shard.");
+        for(auto const & s : f_io_shards)
+        {
+            metrics::sample(out, "communicatord_io_shard_overflow_total", metrics::label("shard", std::to_string(s->get_index())), s->get_overflow());
+        }
+    }
+    if(f_capture != nullptr)
+    {
+        metrics::header(out, "communicatord_capture_records_total", "counter", "Messages saved in the --capture-file.");
+        metrics::sample(out, "communicatord_capture_records_total", std::string(), f_capture->get_records());
+        metrics::header(out, "communicatord_capture_dropped_total", "counter", "Messages not saved in the --capture-file because the disk was too slow or the file full.");
+        metrics::sample(out, "communicatord_capture_dropped_total", std::string(), f_capture->get_dropped());
+        metrics::header(out, "communicatord_capture_bytes", "gauge", "Size of the --capture-file.");
+        metrics::sample(out, "communicatord_capture_bytes", std::string(), f_capture->get_bytes());
+    }
+
+    ed::connection::vector_t const & all_connections(f_communicator->get_connections());
+    std::vector<std::pair<std::string, base_connection::pointer_t>> connections;
+    for(auto const & c : all_connections)
+    {
+        base_connection::pointer_t conn(std::dynamic_pointer_cast<base_connection>(c));
+        if(conn != nullptr)
+        {
+            connections.emplace_back(metrics::label("connection", c->get_name()), conn);
+        }
+    }
+    metrics::header(out, "communicatord_connections", "gauge", "Connections with services and other communicator daemons.");
+    metrics::sample(out, "communicatord_connections", std::string(), static_cast<std::uint64_t>(connections.size()));
+
+    struct connection_metric
+    {
+        char const *    f_name = nullptr;
+        char const *    f_type = nullptr;
+        char const *    f_help = nullptr;
+        std::function<std::uint64_t(base_connection const &)>
+                        f_value = std::function<std::uint64_t(base_connection const &)>();
+    };
+    connection_metric const connection_metrics[] =
+    {
+        {
+            "communicatord_connection_messages_in_total",
+            "counter",
+            "Messages received on the connection.",
+            [](base_connection const & c) { return static_cast<std::uint64_t>(c.get_messages_in()); },
+        },
+        {
+            "communicatord_connection_messages_out_total",
+            "counter",
+            "Messages written to the connection.",
+            [](base_connection const & c) { return static_cast<std::uint64_t>(c.get_messages_out()); },
+        },
+        {
+            "communicatord_connection_bytes_out_total",
+            "counter",
+            "Bytes written to the connection.",
+            [](base_connection const & c) { return static_cast<std::uint64_t>(c.get_bytes_out()); },
+        },
+        {
+            "communicatord_connection_queued_bytes",
+            "gauge",
+            "Bytes waiting in the output queue of the connection.",
+            [](base_connection const & c) { return static_cast<std::uint64_t>(c.get_queued_bytes()); },
+        },
+        {
+            "communicatord_connection_queued_messages",
+            "gauge",
+            "Messages waiting in the output queue of the connection.",
+            [](base_connection const & c) { return static_cast<std::uint64_t>(c.get_queued_messages()); },
+        },
+        {
+            "communicatord_connection_dropped_total",
+            "counter",
+            "Messages dropped because the connection was congested.",
+            [](base_connection const & c) { return static_cast<std::uint64_t>(c.get_dropped_messages()); },
+        },
+    };
+    for(auto const & m : connection_metrics)
+    {
+        metrics::header(out, m.f_name, m.f_type, m.f_help);
+        for(auto const & c : connections)
+        {
+            metrics::sample(out, m.f_name, c.first, m.f_value(*c.second));
+        }
+    }
+
+    return out.str();
 }
 
 
@@ -4175,26 +8363,66 @@ void server::read_neighbors()
 }
 
 
-/** \brief Save the current list of neighbors to disk.
+/** \brief Save the current list of neighbors to disk.
+ *
+ * Whenever the list of neighbors changes, this function gets called
+ * so the changes can get save on disk and reused on a restart.
+ *
+ * The file is not written immediately. The deferred file waits for the
+ * "save-delay" so a burst of changes (i.e. a cluster forming) results
+ * in a single write, which then happens in a separate thread.
+ */
+void server::save_neighbors()
+{
+    if(f_neighbors_cache_filename.empty())
+    {
+        throw communicatord::logic_error("Somehow save_neighbors() was called when f_neighbors_cache_filename was not set yet.");
+    }
+
+    if(f_neighbors_file == nullptr)
+    {
+        f_neighbors_file = std::make_shared<deferred_file>(
+                  f_neighbors_cache_filename
+                , f_opts.get_long("save-delay") * 1'000);
+        f_neighbors_file->set_callback([this](bool succeeded)
+            {
+                neighbors_saved(succeeded);
+            });
+    }
+
+    std::ostringstream out;
+    out << addr::setaddrmode(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT)
+        << addr::setaddrsep("\n")
+        << f_all_neighbors
+        << '\n';
+
+    f_neighbors_file->save(out.str());
+}
+
+
+/** \brief Called once the neighbors file was written.
  *
- * Whenever the list of neighbors changes, this function gets called
- * so the changes can get save on disk and reused on a restart.
+ * This function raises the "file-write" flag when the neighbors file
+ * could not be written and lowers it once a write succeeds again. The
+ * flag only gets saved when the state changes.
+ *
+ * \param[in] succeeded  Whether the neighbors file was written.
  */
-void server::save_neighbors()
+void server::neighbors_saved(bool succeeded)
 {
-    if(f_neighbors_cache_filename.empty())
+    int const state(succeeded ? 1 : 0);
+    if(state == f_neighbors_file_state)
     {
-        throw communicatord::logic_error("Somehow save_neighbors() was called when f_neighbors_cache_filename was not set yet.");
+        return;
     }
+    f_neighbors_file_state = state;
 
-    std::ofstream out;
-    out.open(f_neighbors_cache_filename);
-    if(!out.is_open())
+    if(!succeeded)
     {
         SNAP_LOG_ERROR
-            << "could not open \""
+            << "could not write neighbors to \""
             << f_neighbors_cache_filename
-            << "\" for writing."
+            << "\"."
             << SNAP_LOG_SEND;
 
         // if the folder is missing or not writable by communicatord, then
@@ -4205,7 +8433,7 @@ void server::save_neighbors()
                 "communicatord",
                 "neighbors",
                 "file-write",
-                "could not open neighbor cache file for writing."));
+                "could not write the neighbor cache file."));
         flag->set_priority(97);
         flag->add_tag("cache");
         flag->add_tag("file-system");
@@ -4214,71 +8442,302 @@ void server::save_neighbors()
         return;
     }
 
-    // cancel the flag if it was created above
+    // cancel the flag if it was raised earlier
     //
     communicatord::flag::pointer_t flag(COMMUNICATORD_FLAG_DOWN(
             "communicatord",
             "neighbors",
             "file-write"));
     flag->save();
+}
+
+
+/** \brief Add a remote communicator daemon to the services heard of.
+ *
+ * The services and services heard of by \p conn were just received in
+ * a CONNECT or an ACCEPT message. This function adds them to our table
+ * and sends the resulting changes to our other peers.
+ *
+ * Our own services are never included since they are sent in the list
+ * of services instead.
+ *
+ * \param[in] conn  The connection to the remote communicator daemon.
+ */
+void server::add_heard_of_peer(base_connection::pointer_t conn)
+{
+    advgetopt::string_set_t services;
+    conn->get_services(services);
+    advgetopt::string_set_t heard_of;
+    conn->get_services_heard_of(heard_of);
+    f_heard_of.set_peer(conn.get(), services, heard_of);
+
+    send_heard_of_updates();
+}
 
-    out << addr::setaddrmode(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT)
-        << addr::setaddrsep("\n")
-        << f_all_neighbors
-        << std::endl;
 
-    if(!out)
+/** \brief Remove a remote communicator daemon from the services heard of.
+ *
+ * The services we could only reach through \p conn are removed and our
+ * other peers are told about the changes.
+ *
+ * \param[in] conn  The connection which went away.
+ */
+void server::remove_heard_of_peer(base_connection const * conn)
+{
+    if(!f_heard_of.has_peer(conn))
     {
-        SNAP_LOG_ERROR
-            << "could not properly write all neighbors to \""
-            << f_neighbors_cache_filename
-            << "\"."
-            << SNAP_LOG_SEND;
         return;
     }
+
+    f_heard_of.remove_peer(conn);
+    send_heard_of_updates();
 }
 
 
-/** \brief The list of services we know about from other communicators.
+/** \brief Send the pending changes of the services heard of.
  *
- * This function gathers the list of services that this communicatord
- * heard of. This means, the list of all the services offered by other
- * communicators, heard of or not, minus our own services (because
- * these other servers will return our own services as heard of!)
+ * Each peer supporting the heard_of_updates capability receives a
+ * HEARD_OF message with the services which changed since the last
+ * version it received. The others only get the full list in the CONNECT
+ * or ACCEPT message.
  */
-void server::refresh_heard_of()
+void server::send_heard_of_updates()
 {
-    // reset the list
-    f_services_heard_of_list.clear();
+    heard_of_table::update_map_t updates;
+    f_heard_of.take_updates(updates);
+    if(updates.empty()
+    || f_shutdown)
+    {
+        return;
+    }
 
-    // first gather all the services we have access to
-    ed::connection::vector_t const & all_connections(f_communicator->get_connections());
-    for(auto const & connection : all_connections)
+    routing_table::connection_vector_t links;
+    f_routes.get_links(links);
+    for(auto const & l : links)
     {
-        service_connection::pointer_t c(std::dynamic_pointer_cast<service_connection>(connection));
-        if(c != nullptr)
+        auto const it(updates.find(l.get()));
+        if(it == updates.end()
+        || !l->has_capability(communicatord::g_name_communicatord_value_heard_of_updates))
         {
-            // get list of services and heard services
-            //
-            c->get_services(f_services_heard_of_list);
-            c->get_services_heard_of(f_services_heard_of_list);
+            continue;
+        }
+
+        advgetopt::string_set_t removed;
+        for(auto const & c : it->second.f_changes)
+        {
+            if(c.second == 0)
+            {
+                removed.insert(c.first);
+            }
+        }
+
+        ed::message heard_of;
+        heard_of.set_command(communicatord::g_name_communicatord_cmd_heard_of);
+        heard_of.add_parameter(communicatord::g_name_communicatord_param_base_version, it->second.f_base_version);
+        heard_of.add_parameter(communicatord::g_name_communicatord_param_version, it->second.f_version);
+        std::string const added(heard_of_table::to_string(it->second.f_changes));
+        if(!added.empty())
+        {
+            heard_of.add_parameter(communicatord::g_name_communicatord_param_added, added);
+        }
+        if(!removed.empty())
+        {
+            heard_of.add_parameter(communicatord::g_name_communicatord_param_removed, snapdev::join_strings(removed, ","));
         }
+        l->send_message_to_connection(heard_of);
     }
+}
 
-    // now remove services we are in control of
-    //
-    for(auto const & service : f_local_services_list)
+
+/** \brief Send the full list of services heard of to a peer.
+ *
+ * This is the initial synchronization sent after the CONNECT/ACCEPT
+ * handshake, and the reply to a HEARD_OF without a version, which a
+ * peer sends when it missed one of our updates.
+ *
+ * \param[in] conn  The connection to the remote communicator daemon.
+ */
+void server::send_heard_of_table(base_connection::pointer_t conn)
+{
+    if(!conn->has_capability(communicatord::g_name_communicatord_value_heard_of_updates)
+    || !f_heard_of.has_peer(conn.get()))
+    {
+        return;
+    }
+
+    std::int64_t version(0);
+    heard_of_table::distance_map_t const advertised(f_heard_of.get_advertised(conn.get(), version));
+
+    ed::message heard_of;
+    heard_of.set_command(communicatord::g_name_communicatord_cmd_heard_of);
+    heard_of.add_parameter(communicatord::g_name_communicatord_param_version, version);
+    heard_of.add_parameter(communicatord::g_name_communicatord_param_heard_of, heard_of_table::to_string(advertised));
+    conn->send_message_to_connection(heard_of);
+}
+
+
+/** \brief Advertise the commands understood by our local services.
+ *
+ * This function computes the list of commands understood by the
+ * services connected to us. If it changed, the new version is sent to
+ * our peers. The very first time, the full summary is sent. After that,
+ * only the commands added and removed are sent.
+ *
+ * Our summary is marked opaque when one of our peers does not advertise
+ * its own interests since then we may have to relay any broadcast.
+ *
+ * \param[in] skip  A connection which is about to receive the full table.
+ */
+void server::publish_interest(base_connection const * skip)
+{
+    if(f_shutdown)
+    {
+        return;
+    }
+
+    advgetopt::string_set_t commands;
+    for(auto const & c : f_unix_connections)
+    {
+        c.second->get_commands(commands);
+    }
+    for(auto const & c : f_local_connections)
+    {
+        if(!c.second->is_remote())
+        {
+            c.second->get_commands(commands);
+        }
+    }
+
+    routing_table::connection_vector_t links;
+    f_routes.get_links(links);
+    bool const opaque(std::any_of(
+              links.begin()
+            , links.end()
+            , [](auto const & l)
+            {
+                return !l->has_capability(communicatord::g_name_communicatord_value_interest);
+            }));
+
+    bool const first(!f_interests.is_known(f_server_name));
+    advgetopt::string_set_t added;
+    advgetopt::string_set_t removed;
+    if(!f_interests.set_local(f_server_name, commands, opaque, added, removed))
+    {
+        return;
+    }
+
+    std::int64_t version(0);
+    std::string list;
+    bool o(false);
+    f_interests.get_summary(f_server_name, version, list, o);
+
+    ed::message interest;
+    interest.set_command(communicatord::g_name_communicatord_cmd_interest);
+    interest.add_parameter(communicatord::g_name_communicatord_param_server_name, f_server_name);
+    interest.add_parameter(communicatord::g_name_communicatord_param_version, version);
+    if(first)
+    {
+        interest.add_parameter(communicatord::g_name_communicatord_param_list, list);
+    }
+    else
+    {
+        interest.add_parameter(communicatord::g_name_communicatord_param_base_version, version - 1);
+        if(!added.empty())
+        {
+            interest.add_parameter(communicatord::g_name_communicatord_param_added, snapdev::join_strings(added, ","));
+        }
+        if(!removed.empty())
+        {
+            interest.add_parameter(communicatord::g_name_communicatord_param_removed, snapdev::join_strings(removed, ","));
+        }
+    }
+    if(opaque)
     {
-        auto it(f_services_heard_of_list.find(service));
-        if(it != f_services_heard_of_list.end())
+        interest.add_parameter(communicatord::g_name_communicatord_param_opaque, communicatord::g_name_communicatord_value_true);
+    }
+
+    for(auto const & l : links)
+    {
+        if(l.get() != skip
+        && l->has_capability(communicatord::g_name_communicatord_value_interest))
         {
-            f_services_heard_of_list.erase(it);
+            ed::message copy(interest);
+            l->send_message_to_connection(copy);
         }
     }
+}
 
-    // generate a string we can send in a CONNECT or an ACCEPT
+
+/** \brief Send all the interest summaries we know about to a peer.
+ *
+ * This function is called when a new remote communicator daemon
+ * connects with us and when a peer requests the full table because
+ * an incremental update did not apply.
+ *
+ * \param[in] conn  The connection to the remote communicator daemon.
+ */
+void server::send_interest_table(base_connection::pointer_t conn)
+{
+    // our own summary may not exist yet or its opacity may have changed
     //
-    f_services_heard_of = snapdev::join_strings(f_services_heard_of_list, ",");
+    publish_interest(conn.get());
+
+    if(!conn->has_capability(communicatord::g_name_communicatord_value_interest))
+    {
+        return;
+    }
+
+    advgetopt::string_set_t servers;
+    f_interests.get_servers(servers);
+    for(auto const & name : servers)
+    {
+        if(name == conn->get_server_name())
+        {
+            continue;
+        }
+
+        std::int64_t version(0);
+        std::string list;
+        bool opaque(false);
+        f_interests.get_summary(name, version, list, opaque);
+
+        ed::message interest;
+        interest.set_command(communicatord::g_name_communicatord_cmd_interest);
+        interest.add_parameter(communicatord::g_name_communicatord_param_server_name, name);
+        interest.add_parameter(communicatord::g_name_communicatord_param_version, version);
+        interest.add_parameter(communicatord::g_name_communicatord_param_list, list);
+        if(opaque)
+        {
+            interest.add_parameter(communicatord::g_name_communicatord_param_opaque, communicatord::g_name_communicatord_value_true);
+        }
+        conn->send_message_to_connection(interest);
+    }
+}
+
+
+/** \brief Check whether a broadcast has to be sent to a remote daemon.
+ *
+ * A remote communicator daemon which advertised its interests and does
+ * not understand \p command does not need the broadcast unless it has
+ * to relay it to a server which we are not directly connected to and
+ * which may consume it (\p wanted_beyond).
+ *
+ * \param[in] conn  The connection to the remote communicator daemon.
+ * \param[in] command  The command being broadcast.
+ * \param[in] wanted_beyond  Whether a server which is not one of our
+ * direct peers may consume that command.
+ *
+ * \return true if the broadcast has to be sent to \p conn.
+ */
+bool server::peer_wants_broadcast(
+      base_connection::pointer_t const & conn
+    , std::string const & command
+    , bool wanted_beyond) const
+{
+    return !f_broadcast_interest
+        || wanted_beyond
+        || !conn->has_capability(communicatord::g_name_communicatord_value_interest)
+        || f_interests.wants(conn->get_server_name(), command);
 }
 
 
@@ -4327,6 +8786,21 @@ void server::stop(bool quitting)
         f_remote_communicators->stop_gossiping();
     }
 
+    // write the latest list of neighbors now, the deferred write would
+    // not happen once the event loop exits
+    //
+    if(f_neighbors_file != nullptr)
+    {
+        f_neighbors_file->flush();
+    }
+
+    // same with the last records of the traffic capture
+    //
+    if(f_capture != nullptr)
+    {
+        f_capture->close();
+    }
+
     // DO NOT USE THE REFERENCE -- we need a copy of the vector
     // because the loop below uses remove_connection() on the
     // original vector!
@@ -4489,9 +8963,40 @@ void server::stop(bool quitting)
     f_communicator->remove_connection(f_local_listener);    // TCP/IP
     f_communicator->remove_connection(f_remote_listener);   // TCP/IP
     f_communicator->remove_connection(f_secure_listener);   // TCP/IP
+    if(f_secure_acceptor != nullptr)
+    {
+        f_secure_acceptor->stop();
+        f_communicator->remove_connection(f_secure_acceptor);
+    }
+
+    // the sharded connections which were marked done still wait for
+    // their last message to be written; the shards send it before
+    // closing the sockets
+    //
+    for(auto const & s : f_io_shards)
+    {
+        s->remove_connections();
+        s->stop();
+        f_communicator->remove_connection(s);
+    }
+    f_io_shards.clear();
     f_communicator->remove_connection(f_unix_listener);     // Unix Stream
+    f_communicator->remove_connection(f_shm_listener);      // Unix Stream
+    f_communicator->remove_connection(f_metrics_listener);  // Unix Stream
+    f_pending_shm_channels.clear();
     f_communicator->remove_connection(f_ping);              // UDP/IP
     f_communicator->remove_connection(f_loadavg_timer);     // load balancer timer
+    f_communicator->remove_connection(f_cache_timer);       // cache timer
+    f_communicator->remove_connection(f_flush_timer);       // link flush timer
+    f_communicator->remove_connection(f_heartbeat_timer);   // heartbeat timer
+    f_communicator->remove_connection(f_rate_limit_timer);  // delayed messages timer
+    f_communicator->remove_connection(f_overload_timer);    // event loop lag
+    f_communicator->remove_connection(f_startup_timer);     // second stage of the startup
+    f_communicator->remove_connection(f_flag_watcher);      // flag files inotify
+    if(f_flag_watcher != nullptr)
+    {
+        f_flag_index->remove_snapshot();
+    }
 
 //#ifdef _DEBUG
     {
@@ -4524,8 +9029,43 @@ bool server::is_debug() const
 }
 
 
+/** \brief Return the number of broadcast messages remembered.
+ *
+ * The communicator daemon remembers the identifier of each broadcast
+ * message it received until that message times out. This function
+ * returns the number of identifiers currently in that table.
+ *
+ * \return The size of the received broadcast messages table.
+ */
+std::size_t server::get_received_broadcast_count() const
+{
+    return f_received_broadcast_messages.size();
+}
+
+
+/** \brief Return the time it took for the cluster to be complete.
+ *
+ * This function returns the number of seconds between the start of
+ * the communicator daemon and the first time it found the cluster to
+ * be complete (i.e. the first CLUSTER_COMPLETE). This is used to track
+ * the cluster formation time across deployments.
+ *
+ * \return The number of seconds or -1 if the cluster was not complete yet.
+ */
+std::int64_t server::get_time_to_cluster_complete() const
+{
+    return f_time_to_cluster_complete;
+}
+
+
 void server::process_connected(ed::connection::pointer_t conn)
 {
+    remote_connection::pointer_t remote(std::dynamic_pointer_cast<remote_connection>(conn));
+    if(remote != nullptr)
+    {
+        f_remote_communicators->connection_established(remote->get_address());
+    }
+
     base_connection::pointer_t base(std::dynamic_pointer_cast<base_connection>(conn));
     if(base != nullptr)
     {
@@ -4542,9 +9082,23 @@ void server::process_connected(ed::connection::pointer_t conn)
         {
             connect.add_parameter(communicatord::g_name_communicatord_param_services, f_local_services);
         }
-        if(!f_services_heard_of.empty())
+        std::string const heard_of(f_heard_of.get_list());
+        if(!heard_of.empty())
+        {
+            connect.add_parameter(communicatord::g_name_communicatord_param_heard_of, heard_of);
+        }
+        connect.add_parameter(
+                  communicatord::g_name_communicatord_param_capabilities
+                , snapdev::join_strings(f_capabilities, ","));
+        connect.add_parameter(communicatord::g_name_communicatord_param_reliable_session, f_reliable_session);
+        if(f_gateway_count > 0)
         {
-            connect.add_parameter(communicatord::g_name_communicatord_param_heard_of, f_services_heard_of);
+            connect.add_parameter(communicatord::g_name_communicatord_param_gateway_mode, gateway_mode_to_string(f_gateway_mode));
+            connect.add_parameter(
+                      communicatord::g_name_communicatord_param_gateway
+                    , f_gateway
+                        ? communicatord::g_name_communicatord_value_true
+                        : communicatord::g_name_communicatord_value_false);
         }
         base->send_message_to_connection(connect);
     }
@@ -4561,6 +9115,233 @@ void server::connection_lost(addr::addr const & remote_addr)
 }
 
 
+/** \brief A connection to a remote communicator failed.
+ *
+ * In overlay mode, the remote communicators may decide to replace that
+ * peer by one of the cold neighbors. In hierarchical mode, the gateways
+ * of our site get elected again.
+ *
+ * \param[in] remote_addr  The address of the remote communicator.
+ */
+void server::connection_failed(addr::addr const & remote_addr)
+{
+    f_remote_communicators->connection_failed(remote_addr);
+
+    // that connection may have been to a gateway of our site
+    //
+    update_gateways();
+}
+
+
+/** \brief A TLS handshake with a peer completed.
+ *
+ * This function is called each time a secure connection gets
+ * established, either by our secure listener (\p accepted is true) or
+ * by one of our remote connections. The handshake gets recorded in the
+ * history of that peer.
+ *
+ * A peer doing more handshakes than its budget allows is flapping. For
+ * our own remote connections, the returned delay is used to space out
+ * the next reconnection so a flapping link does not cost one handshake
+ * per blip.
+ *
+ * \param[in] peer  The address of the peer.
+ * \param[in] accepted  Whether the connection was accepted by our listener.
+ *
+ * \return The minimum delay in microseconds before reconnecting, 0 if
+ * the peer is within its budget.
+ */
+std::int64_t server::tls_handshake(addr::addr const & peer, bool accepted)
+{
+    if(accepted)
+    {
+        ++f_tls_accepted;
+    }
+    else
+    {
+        ++f_tls_connected;
+    }
+
+    std::int64_t const now(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    std::int64_t const delay(f_tls_handshakes.record(peer, now));
+    if(delay > 0
+    && f_tls_handshakes.recent(peer, now) == handshake_history::DEFAULT_BURST + 1)
+    {
+        SNAP_LOG_WARNING
+            << "secure link with "
+            << peer.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT)
+            << " is flapping, "
+            << handshake_history::DEFAULT_BURST + 1
+            << " TLS handshakes within "
+            << handshake_history::DEFAULT_WINDOW / 60'000'000LL
+            << " minutes."
+            << SNAP_LOG_SEND;
+    }
+    return delay;
+}
+
+
+/** \brief Admit a connection accepted by one of the listeners.
+ *
+ * The listeners call this function before creating the connection
+ * object of a new client. When the returned ticket is not admitted, the
+ * listener closes the client connection immediately. Otherwise the
+ * ticket is saved in the new connection so its slot gets released with
+ * it.
+ *
+ * \param[in] budget  The budget of the listener.
+ * \param[in] peer  The address of the client.
+ *
+ * \return The admission ticket of the new connection.
+ */
+admission_control::ticket server::admit_connection(
+      admission_budget_t budget
+    , addr::addr const & peer)
+{
+    std::string const address(peer.to_ipv4or6_string(addr::STRING_IP_ADDRESS));
+    std::uint64_t const refused(f_admission_control->get_refused(budget)
+                              + f_admission_control->get_address_refused());
+    admission_control::ticket ticket(f_admission_control->admit(budget, address));
+    if(!ticket.is_admitted()
+    && refused % 100 == 0)
+    {
+        // do not flood the logs if a client keeps trying
+        //
+        SNAP_LOG_WARNING
+            << "refused "
+            << admission_budget_name(budget)
+            << " connection from \""
+            << peer.to_ipv4or6_string(addr::STRING_IP_BRACKET_ADDRESS | addr::STRING_IP_PORT)
+            << "\" ("
+            << f_admission_control->get_count(budget)
+            << " connections on that listener, "
+            << f_admission_control->get_address_count(address)
+            << " from that address)."
+            << SNAP_LOG_SEND;
+    }
+    return ticket;
+}
+
+
+/** \brief Add a TCP connection to the server registries.
+ *
+ * This function is called whenever a service_connection gets added to
+ * the ed::communicator. It is saved in the list of local connections or
+ * in the list of inbound remote communicators. These lists are used to
+ * send messages to a specific type of connections without having to go
+ * through all the connections.
+ *
+ * \param[in] connection  The connection being added.
+ */
+void server::add_connection(service_connection::pointer_t connection)
+{
+    if(connection->is_remote())
+    {
+        f_inbound_connections[connection.get()] = connection;
+    }
+    else
+    {
+        f_local_connections[connection.get()] = connection;
+        attach_to_shard(connection);
+    }
+}
+
+
+/** \brief Add a Unix connection to the server registries.
+ *
+ * This function is called whenever a unix_connection gets added to
+ * the ed::communicator.
+ *
+ * \param[in] connection  The connection being added.
+ */
+void server::add_connection(unix_connection::pointer_t connection)
+{
+    f_unix_connections[connection.get()] = connection;
+    attach_to_shard(connection);
+}
+
+
+/** \brief Hand a local connection to the least busy I/O shard.
+ *
+ * When the --io-threads option is used, the local service connections
+ * are read, parsed and written by one of the I/O shards. The connection
+ * goes to the shard with the fewest connections. If that fails, the
+ * connection stays in the main thread.
+ *
+ * \param[in] connection  The connection being added.
+ */
+void server::attach_to_shard(base_connection::pointer_t connection)
+{
+    if(f_io_shards.empty()
+    || f_shutdown)
+    {
+        return;
+    }
+
+    io_shard::pointer_t best;
+    for(auto const & s : f_io_shards)
+    {
+        if(best == nullptr
+        || s->get_connection_count() < best->get_connection_count())
+        {
+            best = s;
+        }
+    }
+    connection->attach_shard(best);
+}
+
+
+/** \brief Add a remote connection to the server registries.
+ *
+ * This function is called whenever a remote_connection (i.e. a connection
+ * from this communicator daemon to another) gets added to the
+ * ed::communicator.
+ *
+ * \param[in] connection  The connection being added.
+ */
+void server::add_connection(remote_connection::pointer_t connection)
+{
+    f_outbound_connections[connection.get()] = connection;
+}
+
+
+/** \brief Forget about a connection.
+ *
+ * This function is called whenever a connection is removed from the
+ * ed::communicator. It removes all the routes going through that
+ * connection from the routing table and removes the connection from
+ * all the registries.
+ *
+ * \param[in] connection  The connection being removed.
+ */
+void server::connection_removed(base_connection const * connection)
+{
+    f_routes.remove_connection(connection);
+
+    f_local_connections.erase(connection);
+    f_unix_connections.erase(connection);
+    f_inbound_connections.erase(connection);
+    f_outbound_connections.erase(connection);
+    f_corked_connections.erase(connection);
+    f_delayed_connections.erase(connection);
+    f_flag_listeners.erase(connection);
+    f_flag_registrations.erase(connection);
+    if(f_loadavg_connections.erase(connection) > 0
+    && f_loadavg_connections.empty()
+    && f_loadavg_timer != nullptr)
+    {
+        f_loadavg_timer->set_enable(false);
+    }
+
+    // a local service or a peer without interests may be gone
+    //
+    publish_interest();
+    remove_heard_of_peer(connection);
+    update_gateways();
+}
+
+
 
 
 } // namespace communicator_daemon
@@ -26,7 +26,26 @@
 
 // self
 //
+#include    "admission_control.h"
 #include    "cache.h"
+#include    "deferred_file.h"
+#include    "failure_detector.h"
+#include    "gateway.h"
+#include    "handshake_history.h"
+#include    "heard_of_table.h"
+#include    "interest_table.h"
+#include    "io_shard.h"
+#include    "load_sampler.h"
+#include    "message_pool.h"
+#include    "message_validator.h"
+#include    "metrics.h"
+#include    "output_queue.h"
+#include    "overload_monitor.h"
+#include    "rate_limiter.h"
+#include    "received_broadcasts.h"
+#include    "reliable_link.h"
+#include    "routing_table.h"
+#include    "traffic_capture.h"
 #include    "utils.h"
 
 
@@ -39,6 +58,13 @@
 #include    <eventdispatcher/dispatcher_support.h>
 
 
+// communicatord
+//
+#include    <communicatord/flags.h>
+#include    <communicatord/loadavg.h>
+#include    <communicatord/shm_channel.h>
+
+
 // advgetopt
 //
 #include    <advgetopt/advgetopt.h>
@@ -49,6 +75,11 @@
 #include    <libaddr/addr.h>
 
 
+// C++
+//
+#include    <chrono>
+
+
 
 namespace communicator_daemon
 {
@@ -56,6 +87,19 @@ namespace communicator_daemon
 
 class base_connection;
 class remote_communicators;
+class remote_connection;
+class secure_acceptor;
+class service_connection;
+class shm_listener;
+class unix_connection;
+
+
+enum class link_compression_t
+{
+    LINK_COMPRESSION_NONE,
+    LINK_COMPRESSION_PUBLIC,    // only links to public IP addresses (i.e. between data centers)
+    LINK_COMPRESSION_ALL,
+};
 
 
 enum clock_status_t
@@ -79,6 +123,7 @@ public:
     typedef std::shared_ptr<server>     pointer_t;
 
     static std::size_t const    COMMUNICATORD_MAX_CONNECTIONS = 100;
+    static std::size_t const    MAX_TRACE_HOPS = 32;
 
                                 server(int argc, char * argv[]);
                                 server(server const & src) = delete;
@@ -96,66 +141,195 @@ public:
 
     void                        set_clock_status(clock_status_t status);
     void                        send_clock_status(ed::connection::pointer_t reply_connection);
+    void                        send_shm_channel(std::string const & token, int socket);
     void                        send_status(
                                           ed::connection::pointer_t connection
                                         , ed::connection::pointer_t * reply_connection = nullptr);
     std::string                 get_local_services() const;
     std::string                 get_services_heard_of() const;
+    std::string                 get_metrics() const;
+    void                        output_latency(std::int64_t us);
     void                        add_neighbors(std::string const & new_neighbors);
     void                        remove_neighbor(std::string const & neighbor);
     void                        read_neighbors();
     void                        save_neighbors();
+    void                        neighbors_saved(bool succeeded);
     bool                        verify_command(
                                           std::shared_ptr<base_connection> connection
                                         , ed::message const & message);
     void                        process_connected(ed::connection::pointer_t connection);
     void                        connection_lost(addr::addr const & remote_addr);
+    void                        connection_failed(addr::addr const & remote_addr);
+    std::int64_t                tls_handshake(addr::addr const & peer, bool accepted);
+    admission_control::ticket   admit_connection(admission_budget_t budget, addr::addr const & peer);
+    void                        add_connection(std::shared_ptr<service_connection> connection);
+    void                        add_connection(std::shared_ptr<unix_connection> connection);
+    void                        add_connection(std::shared_ptr<remote_connection> connection);
+    void                        connection_removed(base_connection const * connection);
     bool                        forward_message(ed::message & msg);
+    bool                        is_anycast(ed::message const & msg) const;
     void                        broadcast_message(
                                           ed::message & message
                                         , std::vector<std::shared_ptr<base_connection>> const & accepting_remote_connections = std::vector<std::shared_ptr<base_connection>>());
     void                        process_load_balancing();
+    void                        process_cache_timeout();
+    void                        process_startup();
+    void                        process_flush_timeout();
+    void                        process_heartbeat();
+    void                        process_rate_limit_timeout();
+    void                        process_overload_sample();
+    void                        prepare_link_output(
+                                          std::shared_ptr<base_connection> const & conn
+                                        , ed::message const & msg);
+    void                        link_output_done(
+                                          std::shared_ptr<base_connection> const & conn
+                                        , ed::message const & msg
+                                        , std::size_t size);
+    ed::message &               reliable_output(
+                                          std::shared_ptr<base_connection> const & conn
+                                        , ed::message & msg
+                                        , ed::message & copy);
+    bool                        slow_consumer(
+                                          std::shared_ptr<base_connection> conn
+                                        , ed::message & msg);
+    void                        consumer_recovered(std::shared_ptr<base_connection> conn);
     void                        cluster_status(ed::connection::pointer_t reply_connection);
     bool                        is_debug() const;
+    std::size_t                 get_received_broadcast_count() const;
+    std::int64_t                get_time_to_cluster_complete() const;
+    void                        flags_changed(communicatord::flag::list_t const & changes);
     bool                        is_tcp_connection(ed::message & msg); // connection defined in message is TCP (or Unix) opposed to UDP
 
     void                        msg_accept(ed::message & msg);
     void                        msg_clock_status(ed::message & msg);
+    void                        msg_cluster_get_status(ed::message & msg);
     void                        msg_cluster_status(ed::message & msg);
     void                        msg_commands(ed::message & msg);
     void                        msg_connect(ed::message & msg);
     void                        msg_disconnect(ed::message & msg);
+    void                        msg_flag_change(ed::message & msg);
+    void                        msg_flags(ed::message & msg);
     void                        msg_forget(ed::message & msg);
+    void                        msg_gateway(ed::message & msg);
     void                        msg_gossip(ed::message & msg);
+    void                        msg_heard_of(ed::message & msg);
+    void                        msg_heartbeat(ed::message & msg);
+    void                        msg_interest(ed::message & msg);
+    void                        msg_listen_flags(ed::message & msg);
     void                        msg_listen_loadavg(ed::message & msg);
     void                        msg_list_services(ed::message & msg);
+    void                        msg_metrics(ed::message & msg);
     virtual void                msg_log_unknown(ed::message & msg); // reimplementation to indicate the name of the connection when available
     void                        msg_public_ip(ed::message & msg);
     void                        msg_quitting(ed::message & msg);
     void                        msg_refuse(ed::message & msg);
     void                        msg_register(ed::message & msg);
+    void                        msg_register_for_flags(ed::message & msg);
     void                        msg_register_for_loadavg(ed::message & msg);
     void                        msg_save_loadavg(ed::message & msg);
     void                        msg_service_status(ed::message & msg);
+    void                        msg_shm_active(ed::message & msg);
+    void                        msg_shm_request(ed::message & msg);
     void                        msg_shutdown(ed::message & msg);
     void                        msg_unregister(ed::message & msg);
     void                        msg_unregister_from_loadavg(ed::message & msg);
 
 private:
+    typedef std::map<base_connection const *, std::shared_ptr<service_connection>>
+                                service_connection_map_t;
+    typedef std::map<base_connection const *, std::shared_ptr<unix_connection>>
+                                unix_connection_map_t;
+    typedef std::map<base_connection const *, std::shared_ptr<remote_connection>>
+                                remote_connection_map_t;
+    typedef std::map<base_connection const *, std::shared_ptr<base_connection>>
+                                base_connection_map_t;
+
+    struct pending_shm_channel
+    {
+        communicatord::shm_channel::pointer_t
+                                f_channel = communicatord::shm_channel::pointer_t();
+        std::weak_ptr<unix_connection>
+                                f_connection = std::weak_ptr<unix_connection>();
+        time_t                  f_requested_on = 0;
+    };
+    typedef std::map<std::string, pending_shm_channel>
+                                pending_shm_channel_map_t;
+
+    struct flags_version
+    {
+        std::string             f_session = std::string();
+        std::uint64_t           f_version = 0;
+    };
+    typedef std::map<std::string, flags_version>
+                                flags_version_map_t;
+
+    typedef std::vector<std::pair<std::shared_ptr<base_connection>, addr::addr>>
+                                public_peer_vector_t;
+
     int                         init();
     void                        drop_privileges();
-    void                        refresh_heard_of();
+    void                        startup_phase(char const * phase);
+    void                        attach_to_shard(std::shared_ptr<base_connection> connection);
+    void                        add_heard_of_peer(std::shared_ptr<base_connection> conn);
+    void                        remove_heard_of_peer(base_connection const * conn);
+    void                        peer_down(std::shared_ptr<base_connection> conn);
+    reliable_link &             get_reliable_link(std::string const & server_name);
+    bool                        is_reliable_message(ed::message const & msg) const;
+    bool                        reliable_input(ed::message & msg);
+    void                        reliable_link_started(
+                                          std::shared_ptr<base_connection> conn
+                                        , ed::message const & msg);
+    void                        replay_reliable_messages(std::shared_ptr<base_connection> conn);
+    void                        set_peer_gateway(
+                                          std::shared_ptr<base_connection> conn
+                                        , ed::message const & msg);
+    void                        update_gateways();
+    void                        get_site_gateway_links(std::vector<std::shared_ptr<base_connection>> & links) const;
+    void                        select_public_peers(
+                                          public_peer_vector_t & peers
+                                        , std::vector<std::shared_ptr<base_connection>> & relays);
+    void                        relay_to_site_gateways(std::vector<std::shared_ptr<base_connection>> & links);
+    void                        send_heard_of_updates();
+    void                        send_heard_of_table(std::shared_ptr<base_connection> conn);
+    void                        publish_interest(base_connection const * skip = nullptr);
+    void                        send_interest_table(std::shared_ptr<base_connection> conn);
+    bool                        peer_wants_broadcast(
+                                          std::shared_ptr<base_connection> const & conn
+                                        , std::string const & command
+                                        , bool wanted_beyond) const;
     void                        register_for_loadavg(std::string const & ip);
+    void                        register_for_flags(
+                                          std::shared_ptr<base_connection> conn
+                                        , bool snapshot);
+    ed::message                 get_flags_snapshot() const;
     bool                        shutting_down(ed::message & msg);
-    bool                        check_broadcast_message(ed::message const & msg);
+    bool                        check_broadcast_message(ed::message & msg);
     bool                        communicator_message(ed::message & msg);
+    bool                        route_message(ed::message & msg);
+    bool                        deliver_message(ed::message & msg);
+    char const *                get_connection_type_name(std::shared_ptr<base_connection> const & conn) const;
+    bool                        rate_limited(ed::message & msg);
+    void                        update_rate_limit_timer();
     void                        transmission_report(ed::message & msg, bool cached);
+    void                        add_trace_hop(ed::message & msg);
+    std::int64_t                get_peer_clock_offset(ed::message const & msg) const;
+    void                        update_cache_timer();
+    void                        setup_link_compression(std::shared_ptr<base_connection> conn);
+    std::shared_ptr<base_connection>
+                                select_anycast_connection(
+                                          std::vector<std::shared_ptr<base_connection>> const & candidates
+                                        , std::string const & service);
+    void                        verify_route(
+                                          std::string const & service
+                                        , std::shared_ptr<base_connection> route);
 
     advgetopt::getopt               f_opts;
     ed::dispatcher::pointer_t       f_dispatcher = ed::dispatcher::pointer_t();
     std::string                     f_server_name = std::string();
     int                             f_number_of_processors = 1;
     std::string                     f_neighbors_cache_filename = std::string();
+    deferred_file::pointer_t        f_neighbors_file = deferred_file::pointer_t();
+    int                             f_neighbors_file_state = -1;   // -1 unknown, 0 failed, 1 written
     std::string                     f_user_name = std::string();
     std::string                     f_group_name = std::string();
     std::string                     f_public_ip = std::string();        // f_listener IP address for plain connections
@@ -165,19 +339,55 @@ private:
     ed::connection::pointer_t       f_local_listener = ed::connection::pointer_t();   // TCP/IP
     ed::connection::pointer_t       f_remote_listener = ed::connection::pointer_t();  // TCP/IP
     ed::connection::pointer_t       f_secure_listener = ed::connection::pointer_t();  // TCP/IP
+    std::shared_ptr<secure_acceptor>
+                                    f_secure_acceptor = std::shared_ptr<secure_acceptor>(); // accepts f_secure_listener clients in a thread
     ed::connection::pointer_t       f_unix_listener = ed::connection::pointer_t();    // Unix socket
+    ed::connection::pointer_t       f_shm_listener = ed::connection::pointer_t();     // Unix socket for "cdm:" services
+    ed::connection::pointer_t       f_metrics_listener = ed::connection::pointer_t(); // Unix socket for monitoring agents
+    std::string                     f_shm_path = std::string();
+    std::size_t                     f_shm_ring_size = communicatord::shm_channel::DEFAULT_RING_SIZE;
+    pending_shm_channel_map_t       f_pending_shm_channels = pending_shm_channel_map_t();
+    io_shard::vector_t              f_io_shards = io_shard::vector_t();
     ed::connection::pointer_t       f_ping = ed::connection::pointer_t();             // UDP/IP
     ed::connection::pointer_t       f_loadavg_timer = ed::connection::pointer_t();    // a 1 second timer to calculate load (used to load balance)
+    ed::connection::pointer_t       f_cache_timer = ed::connection::pointer_t();      // wakes up when the next cached message times out
+    ed::connection::pointer_t       f_flush_timer = ed::connection::pointer_t();      // sends the output batched on links
+    ed::connection::pointer_t       f_heartbeat_timer = ed::connection::pointer_t();  // sends the HEARTBEAT messages
+    ed::connection::pointer_t       f_rate_limit_timer = ed::connection::pointer_t(); // processes the messages delayed by the rate limits
+    ed::connection::pointer_t       f_overload_timer = ed::connection::pointer_t();   // samples the event loop lag
+    ed::connection::pointer_t       f_startup_timer = ed::connection::pointer_t();    // runs the second stage of the startup
+    ed::connection::pointer_t       f_flag_watcher = ed::connection::pointer_t();     // inotify on the flag files
+    communicatord::flag_index::pointer_t
+                                    f_flag_index = communicatord::flag_index::pointer_t();
+    std::string                     f_flags_session = std::string();
     clock_status_t                  f_clock_status = CLOCK_STATUS_UNKNOWN;
     float                           f_last_loadavg = 0.0f;
+    ed::message                     f_loadavg_message = ed::message();      // LOADAVG template, only the values get rewritten
+    ed::message                     f_status_template = ed::message();      // the fixed part of the STATUS messages
+    std::shared_ptr<load_sampler>   f_load_sampler = std::shared_ptr<load_sampler>();
+    double                          f_load_sample_interval = 1.0;       // seconds
+    std::chrono::steady_clock::time_point
+                                    f_last_load_sample = std::chrono::steady_clock::time_point();
     addr::addr                      f_connection_address = addr::addr();
     std::string                     f_local_services = std::string();
     advgetopt::string_set_t         f_local_services_list = advgetopt::string_set_t();
-    std::string                     f_services_heard_of = std::string();
-    advgetopt::string_set_t         f_services_heard_of_list = advgetopt::string_set_t();
+    heard_of_table                  f_heard_of = heard_of_table();
     std::string                     f_explicit_neighbors = std::string();
     addr::addr::set_t               f_all_neighbors = addr::addr::set_t();
     advgetopt::string_set_t         f_registered_neighbors_for_loadavg = advgetopt::string_set_t();
+    advgetopt::string_set_t         f_capabilities = advgetopt::string_set_t();         // optional features we send in CONNECT/ACCEPT
+    advgetopt::string_set_t         f_anycast_services = advgetopt::string_set_t();     // services expecting a single delivery (see --anycast-services)
+    std::size_t                     f_anycast_counter = 0;
+    std::int64_t                    f_link_batch_delay = 500;                           // in microseconds
+    std::size_t                     f_link_batch_bytes = 65536;
+    link_compression_t              f_link_compression = link_compression_t::LINK_COMPRESSION_PUBLIC;
+    int                             f_link_compression_level = 3;
+    std::size_t                     f_link_compression_threshold = 1024;
+    std::size_t                     f_output_high_bytes = output_queue::DEFAULT_HIGH_BYTES;
+    std::size_t                     f_output_high_messages = output_queue::DEFAULT_HIGH_MESSAGES;
+    std::size_t                     f_output_low_bytes = output_queue::DEFAULT_LOW_BYTES;
+    std::size_t                     f_output_low_messages = output_queue::DEFAULT_LOW_MESSAGES;
+    slow_consumer_policy_t          f_slow_consumer_policy = slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DROP;
     std::shared_ptr<remote_communicators>
                                     f_remote_communicators = std::shared_ptr<remote_communicators>();
     size_t                          f_max_connections = COMMUNICATORD_MAX_CONNECTIONS;
@@ -186,9 +396,73 @@ private:
     bool                            f_debug_all_messages = false;
     bool                            f_force_restart = false;
     cache                           f_local_message_cache = cache();
-    std::map<std::string, time_t>   f_received_broadcast_messages = (std::map<std::string, time_t>());
+    routing_table                   f_routes = routing_table();
+    interest_table                  f_interests = interest_table();
+    bool                            f_broadcast_interest = true;            // skip peers which do not consume a broadcast
+    std::uint64_t                   f_broadcast_skipped = 0;
+    handshake_history               f_tls_handshakes = handshake_history();
+    std::uint64_t                   f_tls_accepted = 0;
+    std::uint64_t                   f_tls_connected = 0;
+    std::int64_t                    f_heartbeat_interval = 1'000'000;       // in microseconds, 0 to turn off
+    double                          f_phi_suspect_threshold = failure_detector::DEFAULT_SUSPECT_PHI;
+    double                          f_phi_down_threshold = failure_detector::DEFAULT_DOWN_PHI;
+    std::uint64_t                   f_peers_suspected = 0;
+    std::uint64_t                   f_peers_down = 0;
+    std::map<std::string, reliable_link>
+                                    f_reliable_links = std::map<std::string, reliable_link>();     // per remote server name
+    std::int64_t                    f_reliable_session = 0;                 // our sequence numbers are only valid within this session
+    std::size_t                     f_reliable_max_messages = reliable_link::DEFAULT_MAX_MESSAGES;
+    std::uint64_t                   f_reliable_sent = 0;
+    std::uint64_t                   f_reliable_replayed = 0;
+    std::uint64_t                   f_reliable_duplicates = 0;
+    std::uint64_t                   f_reliable_gaps = 0;
+    gateway_mode_t                  f_gateway_mode = gateway_mode_t::GATEWAY_MODE_AUTO;
+    std::size_t                     f_gateway_count = 0;                    // gateways per site, 0 to turn off the hierarchical mode
+    bool                            f_gateway = false;                      // we are a gateway of our site
+    advgetopt::string_set_t         f_site_gateways = advgetopt::string_set_t();    // the other gateways of our site
+    std::uint64_t                   f_gateway_changes = 0;
+    std::uint64_t                   f_gateway_skipped = 0;
+    rate_limit_rules                f_rate_limits = rate_limit_rules();
+    rate_limit_action_t             f_rate_limit_action = rate_limit_action_t::RATE_LIMIT_ACTION_DROP;
+    std::size_t                     f_rate_limit_delay_messages = 1'000;    // per connection
+    std::uint64_t                   f_rate_limit_dropped = 0;
+    std::uint64_t                   f_rate_limit_delayed = 0;
+    std::uint64_t                   f_throttle_sent = 0;
+    admission_control::pointer_t    f_admission_control = admission_control::pointer_t();
+    overload_monitor                f_overload = overload_monitor();
+    std::chrono::steady_clock::time_point
+                                    f_last_overload_sample = std::chrono::steady_clock::time_point();
+    std::uint64_t                   f_connect_deferred = 0;                 // CONNECT refused while shedding
+    std::uint64_t                   f_broadcast_shed = 0;                   // broadcasts not forwarded while shedding
+    metrics                         f_metrics = metrics();
+    message_validator               f_message_validator = message_validator();
+    message_pool                    f_message_pool = message_pool();        // copies of the messages being broadcast
+    std::int64_t                    f_slow_dispatch_threshold = 100'000;    // in microseconds, 0 to turn off
+    std::chrono::steady_clock::time_point
+                                    f_startup_time = std::chrono::steady_clock::time_point();
+    std::vector<std::pair<std::string, std::int64_t>>
+                                    f_startup_phases = std::vector<std::pair<std::string, std::int64_t>>();   // phase name and microseconds since init()
+    std::int64_t                    f_received_on = 0;                      // time the current message was received, in microseconds
+    std::size_t                     f_trace_sample_rate = 0;                // trace one out of that many messages, 0 to turn off
+    std::size_t                     f_trace_counter = 0;
+    traffic_capture::pointer_t      f_capture = traffic_capture::pointer_t();   // --capture-file, nullptr when not capturing
+    service_connection_map_t        f_local_connections = service_connection_map_t();       // TCP services connected on the local listener
+    unix_connection_map_t           f_unix_connections = unix_connection_map_t();           // services connected on the Unix listener
+    service_connection_map_t        f_inbound_connections = service_connection_map_t();     // communicators that connected to us
+    remote_connection_map_t         f_outbound_connections = remote_connection_map_t();     // communicators we connect to
+    base_connection_map_t           f_loadavg_connections = base_connection_map_t();        // connections that sent REGISTER_FOR_LOADAVG
+    base_connection_map_t           f_corked_connections = base_connection_map_t();         // links batching their output
+    base_connection_map_t           f_delayed_connections = base_connection_map_t();        // connections with messages delayed by the rate limits
+    base_connection_map_t           f_flag_listeners = base_connection_map_t();             // services that sent LISTEN_FLAGS
+    base_connection_map_t           f_flag_registrations = base_connection_map_t();         // communicators that sent REGISTER_FOR_FLAGS
+    flags_version_map_t             f_remote_flags_versions = flags_version_map_t();        // last flags version received from each communicator
+    received_broadcasts             f_received_broadcast_messages = received_broadcasts();
+    communicatord::loadavg_table    f_loadavg_table = communicatord::loadavg_table();
     std::string                     f_cluster_status = std::string();
     std::string                     f_cluster_complete = std::string();
+    ed::message                     f_cluster_current_status = ed::message();
+    time_t                          f_start_date = 0;
+    std::int64_t                    f_time_to_cluster_complete = -1;    // seconds, -1 until CLUSTER_COMPLETE
 };
 #pragma GCC diagnostic pop
 
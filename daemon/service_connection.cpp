@@ -29,6 +29,8 @@
 //
 #include    "service_connection.h"
 
+#include    "wire_format.h"
+
 
 
 // communicatord
@@ -195,12 +197,135 @@ void service_connection::process_message(ed::message & msg)
 }
 
 
+/** \brief Process a message read by the I/O shard of this connection.
+ *
+ * \param[in] msg  The message received.
+ */
+void service_connection::shard_message(ed::message & msg)
+{
+    process_message(msg);
+}
+
+
 bool service_connection::send_message(ed::message & msg, bool cache)
 {
     return tcp_server_client_message_connection::send_message(msg, cache);
 }
 
 
+/** \brief Write data to the service.
+ *
+ * The data goes to the output queue of the connection when the socket
+ * buffer is not empty. This way we know how much data the peer did not
+ * yet read.
+ *
+ * When the connection is handled by an I/O shard, the data goes
+ * to that shard instead.
+ *
+ * \param[in] data  The data to send.
+ * \param[in] length  The number of bytes in \p data.
+ *
+ * \return The number of bytes written or queued, -1 on error.
+ */
+ssize_t service_connection::write(void const * data, std::size_t length)
+{
+    if(is_sharded())
+    {
+        return shard_write(data, length);
+    }
+    if(queue_output(data, length, has_output()))
+    {
+        return length;
+    }
+    return tcp_server_client_message_connection::write(data, length);
+}
+
+
+/** \brief Send the next chunk of the output queue.
+ *
+ * Once the socket buffer was sent, the next chunk of data is moved from
+ * the output queue to that buffer.
+ */
+void service_connection::process_write()
+{
+    tcp_server_client_message_connection::process_write();
+
+    if(!has_output())
+    {
+        std::string const data(dequeue_output());
+        if(!data.empty())
+        {
+            tcp_server_client_message_connection::write(data.data(), data.length());
+        }
+        output_progressed();
+    }
+}
+
+
+bool service_connection::send_message_to_connection(ed::message & msg, bool cache)
+{
+    message_priority_t const priority(get_message_priority(msg));
+    if(!is_remote())
+    {
+        if(priority != message_priority_t::MESSAGE_PRIORITY_HIGH
+        && is_output_congested())
+        {
+            return f_server->slow_consumer(std::dynamic_pointer_cast<base_connection>(shared_from_this()), msg);
+        }
+        set_output_priority(priority);
+        bool const result(tcp_server_client_message_connection::send_message(msg, cache));
+        set_output_priority(message_priority_t::MESSAGE_PRIORITY_NORMAL);
+        return result;
+    }
+
+    // a link to another communicator, batch the output
+    //
+    base_connection::pointer_t self(std::static_pointer_cast<service_connection>(shared_from_this()));
+    ed::message copy;
+    ed::message & out(f_server->reliable_output(self, msg, copy));
+    f_server->prepare_link_output(self, out);
+    set_output_priority(priority);
+    ed::message wire;
+    ed::message & sent(has_capability(communicatord::g_name_communicatord_value_wire_format)
+                    && encode_wire_message(out, wire, get_compression_level(), get_compression_threshold())
+                            ? wire
+                            : out);
+    bool const result(tcp_server_client_message_connection::send_message(sent, cache));
+    set_output_priority(message_priority_t::MESSAGE_PRIORITY_NORMAL);
+
+    // the size only matters while the output is batched
+    //
+    f_server->link_output_done(self, out, is_corked() ? sent.to_message().length() + 1 : 0);
+    return result;
+}
+
+
+bool service_connection::send_serialized_message(ed::message & msg, std::string const & serialized)
+{
+    message_priority_t const priority(get_message_priority(msg));
+    if(!is_remote())
+    {
+        if(priority != message_priority_t::MESSAGE_PRIORITY_HIGH
+        && is_output_congested())
+        {
+            return f_server->slow_consumer(std::dynamic_pointer_cast<base_connection>(shared_from_this()), msg);
+        }
+        set_output_priority(priority);
+        bool const result(write(serialized.data(), serialized.length()) == static_cast<ssize_t>(serialized.length()));
+        set_output_priority(message_priority_t::MESSAGE_PRIORITY_NORMAL);
+        return result;
+    }
+
+    base_connection::pointer_t self(std::static_pointer_cast<service_connection>(shared_from_this()));
+    f_server->prepare_link_output(self, msg);
+    set_output_priority(priority);
+    bool const result(write(serialized.data(), serialized.length()) == static_cast<ssize_t>(serialized.length()));
+    set_output_priority(message_priority_t::MESSAGE_PRIORITY_NORMAL);
+    f_server->link_output_done(self, msg, serialized.length());
+    return result;
+}
+
+
 
 /** \brief We are losing the connection, send a STATUS message.
  *
@@ -279,10 +404,22 @@ void service_connection::process_invalid()
 }
 
 
+void service_connection::connection_added()
+{
+    tcp_server_client_message_connection::connection_added();
+
+    f_server->add_connection(std::static_pointer_cast<service_connection>(shared_from_this()));
+}
+
+
 void service_connection::connection_removed()
 {
     tcp_server_client_message_connection::connection_removed();
 
+    detach_shard();
+
+    f_server->connection_removed(this);
+
     if(is_remote())
     {
         addr::addr remote_addr(get_address());
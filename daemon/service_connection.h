@@ -58,12 +58,20 @@ public:
     // ed::tcp_server_client_message_connection implementation
     virtual void        process_message(ed::message & msg) override;
     virtual bool        send_message(ed::message & msg, bool cache = false) override;
+    virtual ssize_t     write(void const * data, std::size_t length) override;
+    virtual void        process_write() override;
     virtual void        process_timeout() override;
     virtual void        process_error() override;
     virtual void        process_hup() override;
     virtual void        process_invalid() override;
+    virtual void        connection_added() override;
     virtual void        connection_removed() override;
 
+    // base_connection implementation
+    virtual bool        send_message_to_connection(ed::message & msg, bool cache = false) override;
+    virtual bool        send_serialized_message(ed::message & msg, std::string const & serialized) override;
+    virtual void        shard_message(ed::message & msg) override;
+
     void                send_status();
     void                properly_named();
     addr::addr const &  get_address() const;
@@ -0,0 +1,134 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the shared memory connection.
+ *
+ * The connection polls the eventfd of the daemon side of the channel.
+ * Each message found in the ring is processed as if it had been
+ * received on the Unix socket of that service.
+ */
+
+// self
+//
+#include    "shm_connection.h"
+
+#include    "unix_connection.h"
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize the shared memory connection.
+ *
+ * \param[in] conn  The Unix connection of the service.
+ * \param[in] channel  The channel shared with that service.
+ */
+shm_connection::shm_connection(
+          std::shared_ptr<unix_connection> conn
+        , communicatord::shm_channel::pointer_t channel)
+    : f_connection(conn)
+    , f_channel(channel)
+{
+    set_name("shm connection: " + conn->get_name());
+}
+
+
+int shm_connection::get_socket() const
+{
+    return f_channel->get_wakeup_fd();
+}
+
+
+bool shm_connection::is_reader() const
+{
+    return true;
+}
+
+
+/** \brief Process the messages found in the channel.
+ *
+ * The function also sends the messages which did not fit in the output
+ * ring since the service may have woken us up because it made room.
+ */
+void shm_connection::process_read()
+{
+    // the unix_connection may release this object
+    //
+    pointer_t keep(std::static_pointer_cast<shm_connection>(shared_from_this()));
+
+    std::shared_ptr<unix_connection> conn(f_connection.lock());
+    if(conn == nullptr)
+    {
+        remove_from_communicator();
+        return;
+    }
+
+    do
+    {
+        f_channel->clear_wakeup();
+        std::string data;
+        while(f_channel->receive(data))
+        {
+            ed::message msg;
+            if(msg.from_message(data))
+            {
+                conn->process_message(msg);
+            }
+            else
+            {
+                SNAP_LOG_ERROR
+                    << "invalid message received through the shared memory channel of \""
+                    << conn->get_name()
+                    << "\"."
+                    << SNAP_LOG_SEND;
+            }
+        }
+        f_channel->flush();
+        conn->output_sent();
+    }
+    while(!f_channel->prepare_to_sleep());
+
+    if(!f_channel->is_valid())
+    {
+        SNAP_LOG_ERROR
+            << "the shared memory channel of \""
+            << conn->get_name()
+            << "\" is corrupt, using its Unix socket instead."
+            << SNAP_LOG_SEND;
+        conn->detach_shm();
+    }
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
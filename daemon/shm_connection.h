@@ -0,0 +1,69 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the shared memory connection.
+ *
+ * This connection reads the messages a "cdm:" service writes in its
+ * shared memory channel.
+ */
+
+// communicatord
+//
+#include    <communicatord/shm_channel.h>
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/connection.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+class unix_connection;
+
+
+class shm_connection
+    : public ed::connection
+{
+public:
+    typedef std::shared_ptr<shm_connection>     pointer_t;
+
+                        shm_connection(
+                              std::shared_ptr<unix_connection> conn
+                            , communicatord::shm_channel::pointer_t channel);
+
+    // ed::connection implementation
+    virtual int         get_socket() const override;
+    virtual bool        is_reader() const override;
+    virtual void        process_read() override;
+
+private:
+    std::weak_ptr<unix_connection>
+                        f_connection = std::weak_ptr<unix_connection>();
+    communicatord::shm_channel::pointer_t
+                        f_channel = communicatord::shm_channel::pointer_t();
+};
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
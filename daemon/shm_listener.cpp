@@ -0,0 +1,127 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the shared memory listener.
+ *
+ * The client sends the token it received in the SHM_READY message
+ * followed by a newline. The server verifies the token and sends back
+ * the channel descriptors. The socket is then closed.
+ */
+
+// self
+//
+#include    "shm_listener.h"
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <cstring>
+
+
+// C
+//
+#include    <sys/socket.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \brief Initialize the shared memory listener.
+ *
+ * \param[in] cs  The communicator server.
+ * \param[in] address  The path to the Unix socket.
+ * \param[in] max_connections  The number of pending connections.
+ */
+shm_listener::shm_listener(
+          server::pointer_t cs
+        , addr::addr_unix const & address
+        , int max_connections)
+    : local_stream_server_connection(address, max_connections, true, true)
+    , f_server(cs)
+{
+}
+
+
+/** \brief Send the descriptors of a channel to a client.
+ *
+ * The client writes its token immediately after connecting so we can
+ * read it here with a short timeout instead of adding a connection to
+ * the ed::communicator.
+ */
+void shm_listener::process_accept()
+{
+    snapdev::raii_fd_t client(accept());
+    if(client == nullptr)
+    {
+        int const e(errno);
+        SNAP_LOG_ERROR
+            << "somehow accept() of a shared memory client failed with errno: "
+            << e
+            << " -- "
+            << strerror(e)
+            << SNAP_LOG_SEND;
+        return;
+    }
+
+    timeval timeout = {};
+    timeout.tv_usec = 100'000;
+    setsockopt(client.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string token;
+    for(;;)
+    {
+        char buf[64];
+        ssize_t const r(recv(client.get(), buf, sizeof(buf), 0));
+        if(r <= 0)
+        {
+            return;
+        }
+        token.append(buf, r);
+        std::string::size_type const pos(token.find('\n'));
+        if(pos != std::string::npos)
+        {
+            token.resize(pos);
+            break;
+        }
+        if(token.length() > 256)
+        {
+            return;
+        }
+    }
+
+    f_server->send_shm_channel(token, client.get());
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,62 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the shared memory listener.
+ *
+ * Services connected with the "cdm:" scheme connect to this Unix socket
+ * to retrieve the descriptors of their shared memory channel.
+ */
+
+// self
+//
+#include    "server.h"
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/local_stream_server_connection.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+class shm_listener
+    : public ed::local_stream_server_connection
+{
+public:
+    typedef std::shared_ptr<shm_listener>   pointer_t;
+
+                        shm_listener(
+                              server::pointer_t cs
+                            , addr::addr_unix const & address
+                            , int max_connections);
+
+    // ed::local_stream_server_connection
+    virtual void        process_accept() override;
+
+private:
+    server::pointer_t   f_server = server::pointer_t();
+};
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,162 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of a single producer single consumer queue.
+ *
+ * The I/O shards hand the messages they read to the main thread and the
+ * main thread hands the data to write back to the shards. Each direction
+ * has exactly one producer and one consumer so a ring with two atomic
+ * indexes is enough; no mutex is involved.
+ */
+
+// C++
+//
+#include    <atomic>
+#include    <cstdint>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+template<typename T>
+class spsc_queue
+{
+public:
+    /** \brief Initialize the queue.
+     *
+     * The \p capacity is rounded up to the next power of two.
+     *
+     * \param[in] capacity  The number of items the queue can hold.
+     */
+    explicit spsc_queue(std::size_t capacity)
+    {
+        std::size_t size(2);
+        while(size < capacity)
+        {
+            size <<= 1;
+        }
+        f_items.resize(size);
+        f_mask = size - 1;
+    }
+
+    spsc_queue(spsc_queue const &) = delete;
+    spsc_queue & operator = (spsc_queue const &) = delete;
+
+    /** \brief Add an item at the end of the queue.
+     *
+     * This function must only be called by the producer.
+     *
+     * \param[in] item  The item to add. It is left untouched when the
+     * queue is full.
+     * \param[out] was_empty  Set to true if the consumer may have seen
+     * an empty queue, meaning that it has to be woken up.
+     *
+     * \return false if the queue is full.
+     */
+    bool push(T & item, bool * was_empty = nullptr)
+    {
+        std::size_t const tail(f_tail.load(std::memory_order_relaxed));
+        std::size_t const head(f_head.load(std::memory_order_acquire));
+        if(tail - head > f_mask)
+        {
+            return false;
+        }
+        f_items[tail & f_mask] = std::move(item);
+        f_tail.store(tail + 1, std::memory_order_seq_cst);
+        if(was_empty != nullptr)
+        {
+            *was_empty = f_head.load(std::memory_order_seq_cst) == tail;
+        }
+        return true;
+    }
+
+    /** \brief Remove the first item of the queue.
+     *
+     * This function must only be called by the consumer.
+     *
+     * \param[out] item  The item removed from the queue.
+     *
+     * \return false if the queue is empty.
+     */
+    bool pop(T & item)
+    {
+        std::size_t const head(f_head.load(std::memory_order_relaxed));
+        std::size_t const tail(f_tail.load(std::memory_order_seq_cst));
+        if(head == tail)
+        {
+            return false;
+        }
+        item = std::move(f_items[head & f_mask]);
+        f_items[head & f_mask] = T();
+        f_head.store(head + 1, std::memory_order_seq_cst);
+        return true;
+    }
+
+    /** \brief Get the number of items in the queue.
+     *
+     * The value is exact only when called by the producer or the
+     * consumer while the other side is idle. It is good enough for
+     * the metrics otherwise.
+     *
+     * \return The number of items waiting in the queue.
+     */
+    std::size_t size() const
+    {
+        std::size_t const head(f_head.load(std::memory_order_acquire));
+        std::size_t const tail(f_tail.load(std::memory_order_acquire));
+        return tail - head;
+    }
+
+    /** \brief Check whether the queue is empty.
+     *
+     * \return true if no items are waiting in the queue.
+     */
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /** \brief The maximum number of items the queue can hold.
+     *
+     * \return The capacity of the queue, a power of two.
+     */
+    std::size_t capacity() const
+    {
+        return f_mask + 1;
+    }
+
+private:
+    // the indexes are on their own cache line to avoid false sharing
+    // between the producer and the consumer
+    //
+    alignas(64) std::atomic<std::size_t>    f_head = 0;
+    alignas(64) std::atomic<std::size_t>    f_tail = 0;
+    alignas(64) std::vector<T>              f_items = std::vector<T>();
+    std::size_t                             f_mask = 0;
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,74 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of startup_timer object.
+ *
+ * We use a timer to run the second stage of the startup once the event
+ * loop is running.
+ */
+
+// self
+//
+#include    "startup_timer.h"
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+/** \class startup_timer
+ * \brief Run the second stage of the startup.
+ *
+ * This class is an implementation of a timer which times out immediately
+ * and only once. It calls server::process_startup() and then removes
+ * itself from the communicator.
+ */
+
+
+/** \brief The timer initialization.
+ *
+ * The timer times out as soon as the event loop starts.
+ *
+ * \param[in] cs  The communicatord server we are starting.
+ */
+startup_timer::startup_timer(server::pointer_t cs)
+    : timer(-1)  // no delay, we use a timeout date instead
+    , f_server(cs)
+{
+    set_timeout_date(time(nullptr) * 1'000'000LL);
+}
+
+
+void startup_timer::process_timeout()
+{
+    f_server->process_startup();
+    remove_from_communicator();
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
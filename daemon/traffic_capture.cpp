@@ -0,0 +1,467 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the traffic capture.
+ *
+ * The main thread serializes each record at the end of a buffer. Once
+ * the buffer reaches BUFFER_SIZE bytes or once per FLUSH_DELAY, it gets
+ * handed to the writer thread which appends it to the capture file.
+ *
+ * The capture never slows down the event loop: if the disk cannot keep
+ * up and MAX_PENDING_BUFFERS buffers are already waiting, the new
+ * buffer is dropped and its records counted as such. Once the file
+ * reaches its maximum size, further records are dropped as well.
+ */
+
+// self
+//
+#include    "traffic_capture.h"
+
+
+// eventdispatcher
+//
+#include    <eventdispatcher/communicator.h>
+#include    <eventdispatcher/timer.h>
+
+
+// cppthread
+//
+#include    <cppthread/guard.h>
+#include    <cppthread/mutex.h>
+
+
+// snaplogger
+//
+#include    <snaplogger/message.h>
+
+
+// C++
+//
+#include    <cstring>
+#include    <deque>
+
+
+// C
+//
+#include    <fcntl.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace
+{
+
+
+
+bool write_all(int fd, std::string const & data)
+{
+    char const * s(data.data());
+    std::size_t size(data.length());
+    while(size > 0)
+    {
+        ssize_t const r(::write(fd, s, size));
+        if(r < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        s += r;
+        size -= r;
+    }
+    return true;
+}
+
+
+
+} // no name namespace
+
+
+
+namespace detail
+{
+
+
+
+class capture_flush_timer
+    : public ed::timer
+{
+public:
+    typedef std::shared_ptr<capture_flush_timer>    pointer_t;
+
+                        capture_flush_timer(traffic_capture * capture);
+
+    virtual void        process_timeout() override;
+
+private:
+    traffic_capture *   f_capture = nullptr;
+};
+
+
+capture_flush_timer::capture_flush_timer(traffic_capture * capture)
+    : timer(traffic_capture::FLUSH_DELAY)
+    , f_capture(capture)
+{
+    set_name("traffic capture flush timer");
+}
+
+
+void capture_flush_timer::process_timeout()
+{
+    f_capture->flush();
+}
+
+
+
+class capture_writer
+    : public cppthread::runner
+{
+public:
+    typedef std::shared_ptr<capture_writer>     pointer_t;
+
+                        capture_writer(int fd, std::string const & filename);
+                        capture_writer(capture_writer const &) = delete;
+    capture_writer &    operator = (capture_writer const &) = delete;
+
+    bool                push(std::string && buffer);
+
+    // implementation of runner
+    //
+    virtual void        run() override;
+
+private:
+    int                             f_fd = -1;
+    std::string                     f_filename = std::string();
+    mutable cppthread::mutex        f_mutex = cppthread::mutex();
+    std::deque<std::string>         f_buffers = std::deque<std::string>();
+};
+
+
+capture_writer::capture_writer(int fd, std::string const & filename)
+    : runner("traffic-capture")
+    , f_fd(fd)
+    , f_filename(filename)
+{
+}
+
+
+/** \brief Give a buffer to the writer thread.
+ *
+ * \param[in] buffer  The records to append to the capture file.
+ *
+ * \return false if too many buffers are already waiting; \p buffer is
+ * left untouched in that case.
+ */
+bool capture_writer::push(std::string && buffer)
+{
+    cppthread::guard lock(f_mutex);
+    if(f_buffers.size() >= traffic_capture::MAX_PENDING_BUFFERS)
+    {
+        return false;
+    }
+    f_buffers.push_back(std::move(buffer));
+    f_mutex.signal();
+    return true;
+}
+
+
+void capture_writer::run()
+{
+    bool failed(false);
+    for(;;)
+    {
+        std::string buffer;
+        {
+            cppthread::guard lock(f_mutex);
+            while(f_buffers.empty())
+            {
+                // the buffers pushed before the stop still get written
+                //
+                if(!continue_running())
+                {
+                    return;
+                }
+                f_mutex.timed_wait(100'000);
+            }
+            buffer.swap(f_buffers.front());
+            f_buffers.pop_front();
+        }
+
+        if(!failed
+        && !write_all(f_fd, buffer))
+        {
+            int const e(errno);
+            failed = true;
+            SNAP_LOG_ERROR
+                << "could not write to traffic capture \""
+                << f_filename
+                << "\" (errno: "
+                << e
+                << " -- "
+                << strerror(e)
+                << "); the capture is incomplete."
+                << SNAP_LOG_SEND;
+        }
+    }
+}
+
+
+
+} // namespace detail
+
+
+
+/** \class traffic_capture
+ * \brief Save the dispatched messages in a capture file.
+ *
+ * The server calls record() once per message it dispatches. The file
+ * uses the format defined in communicatord/capture.h so the message
+ * tool can replay it with its --replay command.
+ */
+
+
+/** \brief Initialize the traffic capture.
+ *
+ * The file gets created by open().
+ *
+ * \param[in] filename  The path to the capture file.
+ * \param[in] max_bytes  The maximum size of the capture file; 0 means
+ * no limit.
+ */
+traffic_capture::traffic_capture(
+          std::string const & filename
+        , std::uint64_t max_bytes)
+    : f_filename(filename)
+    , f_max_bytes(max_bytes)
+{
+}
+
+
+/** \brief Write the pending records and close the file.
+ */
+traffic_capture::~traffic_capture()
+{
+    close();
+}
+
+
+/** \brief Create the capture file and start the writer thread.
+ *
+ * An existing file is overwritten. The file is only readable by the
+ * communicatord user since the messages may include private data.
+ *
+ * \param[in] route_names  The names of the routes saved in the header.
+ *
+ * \return true if the file was created.
+ */
+bool traffic_capture::open(std::vector<std::string> const & route_names)
+{
+    if(f_fd >= 0)
+    {
+        return true;
+    }
+
+    f_fd = ::open(f_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if(f_fd < 0)
+    {
+        return false;
+    }
+
+    std::string const header(communicatord::capture_header(route_names));
+    if(!write_all(f_fd, header))
+    {
+        ::close(f_fd);
+        f_fd = -1;
+        return false;
+    }
+    f_bytes = header.length();
+
+    f_writer = std::make_shared<detail::capture_writer>(f_fd, f_filename);
+    f_thread = std::make_shared<cppthread::thread>("traffic-capture", f_writer);
+    f_thread->start();
+
+    // without an event loop, the buffers only get written when full
+    //
+    f_timer = std::make_shared<detail::capture_flush_timer>(this);
+    if(!ed::communicator::instance()->add_connection(f_timer))
+    {
+        f_timer.reset();
+    }
+
+    return true;
+}
+
+
+/** \brief Write the pending records and close the capture file.
+ *
+ * This function waits for the writer thread to be done.
+ */
+void traffic_capture::close()
+{
+    if(f_fd < 0)
+    {
+        return;
+    }
+
+    flush();
+
+    if(f_timer != nullptr)
+    {
+        ed::communicator::instance()->remove_connection(f_timer);
+        f_timer.reset();
+    }
+    f_thread->stop();
+    f_thread.reset();
+    f_writer.reset();
+
+    ::close(f_fd);
+    f_fd = -1;
+}
+
+
+/** \brief Check whether the capture file is open.
+ *
+ * \return true between a successful open() and close().
+ */
+bool traffic_capture::is_open() const
+{
+    return f_fd >= 0;
+}
+
+
+/** \brief Add one record to the capture.
+ *
+ * The record is serialized in memory. It reaches the file once the
+ * buffer is full, on the next flush, or on close().
+ *
+ * \param[in] r  The record to save.
+ */
+void traffic_capture::record(communicatord::capture_record const & r)
+{
+    if(f_fd < 0)
+    {
+        return;
+    }
+
+    f_record.clear();
+    communicatord::append_capture_record(f_record, r);
+    if(f_max_bytes > 0
+    && f_bytes + f_buffer.length() + f_record.length() > f_max_bytes)
+    {
+        if(!f_full)
+        {
+            f_full = true;
+            SNAP_LOG_WARNING
+                << "traffic capture \""
+                << f_filename
+                << "\" reached its maximum size of "
+                << f_max_bytes
+                << " bytes; further messages are not captured."
+                << SNAP_LOG_SEND;
+        }
+        ++f_dropped;
+        return;
+    }
+
+    f_buffer += f_record;
+    ++f_buffer_records;
+    ++f_records;
+
+    if(f_buffer.length() >= BUFFER_SIZE)
+    {
+        flush();
+    }
+}
+
+
+/** \brief Hand the records accumulated so far to the writer thread.
+ *
+ * If the writer is too far behind, the records are dropped.
+ */
+void traffic_capture::flush()
+{
+    if(f_buffer.empty()
+    || f_writer == nullptr)
+    {
+        return;
+    }
+
+    std::size_t const size(f_buffer.length());
+    if(f_writer->push(std::move(f_buffer)))
+    {
+        f_bytes += size;
+    }
+    else
+    {
+        f_records -= f_buffer_records;
+        f_dropped += f_buffer_records;
+    }
+    f_buffer.clear();
+    f_buffer.reserve(BUFFER_SIZE + BUFFER_SIZE / 4);
+    f_buffer_records = 0;
+}
+
+
+/** \brief Get the number of records saved.
+ *
+ * \return The number of records written or waiting to be written.
+ */
+std::uint64_t traffic_capture::get_records() const
+{
+    return f_records;
+}
+
+
+/** \brief Get the number of records which could not be saved.
+ *
+ * \return The number of records dropped because the writer was too far
+ * behind or the file reached its maximum size.
+ */
+std::uint64_t traffic_capture::get_dropped() const
+{
+    return f_dropped;
+}
+
+
+/** \brief Get the size of the capture file.
+ *
+ * \return The number of bytes written or waiting to be written,
+ * including the header.
+ */
+std::uint64_t traffic_capture::get_bytes() const
+{
+    return f_bytes;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
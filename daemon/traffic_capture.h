@@ -0,0 +1,112 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the traffic capture.
+ *
+ * When the --capture-file option is defined, the Communicator saves
+ * each message it dispatches along the connection it came from and the
+ * routing decision it took. The records are accumulated in large
+ * buffers which a separate thread appends to the capture file so the
+ * event loop never blocks on disk.
+ */
+
+// communicatord
+//
+#include    <communicatord/capture.h>
+
+
+// cppthread
+//
+#include    <cppthread/runner.h>
+#include    <cppthread/thread.h>
+
+
+// C++
+//
+#include    <cstdint>
+#include    <memory>
+#include    <string>
+#include    <vector>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+namespace detail
+{
+class capture_writer;
+typedef std::shared_ptr<capture_writer>         capture_writer_pointer_t;
+class capture_flush_timer;
+typedef std::shared_ptr<capture_flush_timer>    capture_flush_timer_pointer_t;
+}
+
+
+class traffic_capture
+{
+public:
+    typedef std::shared_ptr<traffic_capture>    pointer_t;
+
+    static constexpr std::size_t const      BUFFER_SIZE = 64 * 1024;
+    static constexpr std::size_t const      MAX_PENDING_BUFFERS = 256;
+    static constexpr std::int64_t const     FLUSH_DELAY = 1'000'000;       // in microseconds
+
+                        traffic_capture(
+                              std::string const & filename
+                            , std::uint64_t max_bytes = 0);
+                        traffic_capture(traffic_capture const &) = delete;
+                        ~traffic_capture();
+    traffic_capture &   operator = (traffic_capture const &) = delete;
+
+    bool                open(std::vector<std::string> const & route_names);
+    void                close();
+    bool                is_open() const;
+    void                record(communicatord::capture_record const & r);
+    void                flush();
+
+    std::uint64_t       get_records() const;
+    std::uint64_t       get_dropped() const;
+    std::uint64_t       get_bytes() const;
+
+private:
+    std::string         f_filename = std::string();
+    std::uint64_t       f_max_bytes = 0;
+    int                 f_fd = -1;
+    std::string         f_buffer = std::string();
+    std::string         f_record = std::string();
+    std::uint64_t       f_records = 0;
+    std::uint64_t       f_buffer_records = 0;                  // records in f_buffer
+    std::uint64_t       f_dropped = 0;
+    std::uint64_t       f_bytes = 0;
+    bool                f_full = false;
+    detail::capture_writer_pointer_t
+                        f_writer = detail::capture_writer_pointer_t();
+    detail::capture_flush_timer_pointer_t
+                        f_timer = detail::capture_flush_timer_pointer_t();
+    cppthread::thread::pointer_t
+                        f_thread = cppthread::thread::pointer_t();
+};
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -167,6 +167,16 @@ void unix_connection::process_message(ed::message & msg)
 }
 
 
+/** \brief Process a message read by the I/O shard of this connection.
+ *
+ * \param[in] msg  The message received.
+ */
+void unix_connection::shard_message(ed::message & msg)
+{
+    process_message(msg);
+}
+
+
 /** \brief We are losing the connection, send a STATUS message.
  *
  * This function is called in all cases where the connection is
@@ -244,6 +254,125 @@ void unix_connection::process_invalid()
 }
 
 
+void unix_connection::connection_added()
+{
+    local_stream_server_client_message_connection::connection_added();
+
+    f_server->add_connection(std::static_pointer_cast<unix_connection>(shared_from_this()));
+}
+
+
+void unix_connection::connection_removed()
+{
+    local_stream_server_client_message_connection::connection_removed();
+
+    detach_shm();
+    detach_shard();
+
+    f_server->connection_removed(this);
+}
+
+
+bool unix_connection::send_message_to_connection(ed::message & msg, bool cache)
+{
+    message_priority_t const priority(get_message_priority(msg));
+    if(priority != message_priority_t::MESSAGE_PRIORITY_HIGH
+    && is_output_congested())
+    {
+        return f_server->slow_consumer(std::dynamic_pointer_cast<base_connection>(shared_from_this()), msg);
+    }
+
+    if(f_shm_channel != nullptr)
+    {
+        std::string const data(msg.to_message());
+        if(!data.empty()
+        && f_shm_channel->send(data, priority == message_priority_t::MESSAGE_PRIORITY_HIGH))
+        {
+            output_sent();
+            return true;
+        }
+    }
+    set_output_priority(priority);
+    bool const result(local_stream_server_client_message_connection::send_message(msg, cache));
+    set_output_priority(message_priority_t::MESSAGE_PRIORITY_NORMAL);
+    return result;
+}
+
+
+bool unix_connection::send_serialized_message(ed::message & msg, std::string const & serialized)
+{
+    message_priority_t const priority(get_message_priority(msg));
+    if(priority != message_priority_t::MESSAGE_PRIORITY_HIGH
+    && is_output_congested())
+    {
+        return f_server->slow_consumer(std::dynamic_pointer_cast<base_connection>(shared_from_this()), msg);
+    }
+
+    if(f_shm_channel != nullptr
+    && !serialized.empty()
+    && f_shm_channel->send(
+              serialized.substr(0, serialized.length() - 1)     // remove the '\n'
+            , priority == message_priority_t::MESSAGE_PRIORITY_HIGH))
+    {
+        output_sent();
+        return true;
+    }
+    set_output_priority(priority);
+    bool const result(write(serialized.data(), serialized.length()) == static_cast<ssize_t>(serialized.length()));
+    set_output_priority(message_priority_t::MESSAGE_PRIORITY_NORMAL);
+    return result;
+}
+
+
+/** \brief Write data to the service.
+ *
+ * The data goes to the output queue of the connection when the socket
+ * buffer is not empty. This way we know how much data the service did
+ * not yet read and we can apply the slow consumer policy.
+ *
+ * When the connection is handled by an I/O shard, the data goes
+ * to that shard instead.
+ *
+ * \param[in] data  The data to send.
+ * \param[in] length  The number of bytes in \p data.
+ *
+ * \return The number of bytes written or queued, -1 on error.
+ */
+ssize_t unix_connection::write(void const * data, std::size_t length)
+{
+    if(is_sharded())
+    {
+        return shard_write(data, length);
+    }
+    if(queue_output(data, length, has_output()))
+    {
+        return length;
+    }
+    return local_stream_server_client_message_connection::write(data, length);
+}
+
+
+/** \brief Send the next chunk of the output queue.
+ *
+ * Once the socket buffer was sent, the next chunk of data is moved from
+ * the output queue to that buffer.
+ */
+void unix_connection::process_write()
+{
+    local_stream_server_client_message_connection::process_write();
+
+    if(!has_output())
+    {
+        std::string const data(dequeue_output());
+        if(!data.empty())
+        {
+            local_stream_server_client_message_connection::write(data.data(), data.length());
+        }
+        output_sent();
+    }
+}
+
+
 /** \brief Tell that the connection was given a real name.
  *
  * Whenever we receive an event through this connection,
@@ -268,6 +397,86 @@ void unix_connection::properly_named()
 }
 
 
+/** \brief Start sending messages through a shared memory channel.
+ *
+ * This function is called once the service retrieved the descriptors
+ * of \p channel. The SHM_ACTIVE message sent on the Unix socket tells
+ * the service that the following messages go through the channel.
+ *
+ * \param[in] channel  The channel shared with this service.
+ */
+void unix_connection::attach_shm(communicatord::shm_channel::pointer_t channel)
+{
+    detach_shm();
+
+    ed::message active;
+    active.set_command(communicatord::g_name_communicatord_cmd_shm_active);
+    active.set_service(get_name());
+    local_stream_server_client_message_connection::send_message(active);
+
+    f_shm_channel = channel;
+}
+
+
+/** \brief Start reading the messages of the shared memory channel.
+ *
+ * The service sends an SHM_ACTIVE message on the Unix socket just
+ * before it starts using the channel. At that point, we can read the
+ * channel without breaking the order of the messages.
+ */
+void unix_connection::start_shm_input()
+{
+    if(f_shm_channel == nullptr
+    || f_shm_connection != nullptr)
+    {
+        return;
+    }
+
+    f_shm_connection = std::make_shared<shm_connection>(
+                  std::static_pointer_cast<unix_connection>(shared_from_this())
+                , f_shm_channel);
+    if(!ed::communicator::instance()->add_connection(f_shm_connection))
+    {
+        f_shm_connection.reset();
+    }
+}
+
+
+/** \brief Stop using the shared memory channel.
+ *
+ * The messages are sent on the Unix socket again.
+ */
+void unix_connection::detach_shm()
+{
+    if(f_shm_connection != nullptr)
+    {
+        ed::communicator::instance()->remove_connection(f_shm_connection);
+        f_shm_connection.reset();
+    }
+    f_shm_channel.reset();
+}
+
+
+/** \brief Update the congestion state of this connection.
+ *
+ * The messages waiting for room in the shared memory channel count
+ * along the ones of the output queue.
+ */
+void unix_connection::output_sent()
+{
+    if(f_shm_channel != nullptr)
+    {
+        output_progressed(
+                  f_shm_channel->get_pending_bytes()
+                , f_shm_channel->get_pending_messages());
+    }
+    else
+    {
+        output_progressed();
+    }
+}
+
+
 
 } // namespace communicator_daemon
 // vim: ts=4 sw=4 et
@@ -28,6 +28,7 @@
 //
 #include    "base_connection.h"
 #include    "server.h"
+#include    "shm_connection.h"
 
 
 // eventdispatcher
@@ -60,17 +61,34 @@ public:
     // local_stream_server_client_message_connection implementation
     //
     virtual void        process_message(ed::message & msg) override;
+    virtual ssize_t     write(void const * data, std::size_t length) override;
+    virtual void        process_write() override;
 
     void                send_status();
     virtual void        process_timeout() override;
     virtual void        process_error() override;
     virtual void        process_hup() override;
     virtual void        process_invalid() override;
+    virtual void        connection_added() override;
+    virtual void        connection_removed() override;
+
+    // base_connection implementation
+    virtual bool        send_message_to_connection(ed::message & msg, bool cache = false) override;
+    virtual bool        send_serialized_message(ed::message & msg, std::string const & serialized) override;
+    virtual void        shard_message(ed::message & msg) override;
     void                properly_named();
+    void                attach_shm(communicatord::shm_channel::pointer_t channel);
+    void                start_shm_input();
+    void                detach_shm();
+    void                output_sent();
 
 private:
     std::string const   f_server_name;
     bool                f_named = false;
+    communicatord::shm_channel::pointer_t
+                        f_shm_channel = communicatord::shm_channel::pointer_t();
+    shm_connection::pointer_t
+                        f_shm_connection = shm_connection::pointer_t();
 };
 
 
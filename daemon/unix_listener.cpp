@@ -71,8 +71,9 @@ namespace communicator_daemon
  * The listener creates a new TCP server to listen for incoming
  * TCP connection.
  *
- * \warning
- * At this time the \p max_connections parameter is ignored.
+ * The \p max_connections parameter is the backlog of the socket. The
+ * number of connections accepted is limited by the local budget of the
+ * admission control of the server (see server::admit_connection()).
  *
  * \param[in] address  The address:port to listen on. Most often it is
  * 0.0.0.0:4040 (plain connection) or 0.0.0.0:4041 (secure connection).
@@ -117,6 +118,16 @@ void unix_listener::process_accept()
         return;
     }
 
+    // over budget, closing new_client closes the connection
+    //
+    admission_control::ticket ticket(f_server->admit_connection(
+              admission_budget_t::ADMISSION_BUDGET_LOCAL
+            , addr::addr()));
+    if(!ticket.is_admitted())
+    {
+        return;
+    }
+
     unix_connection::pointer_t service(
             std::make_shared<unix_connection>(
                       f_server
@@ -129,6 +140,7 @@ void unix_listener::process_accept()
     service->set_name("client unix connection");
 
     service->set_server_name(f_server_name);
+    service->set_admission_ticket(std::move(ticket));
 
     if(!ed::communicator::instance()->add_connection(service))
     {
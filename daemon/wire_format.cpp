@@ -0,0 +1,739 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Implementation of the packed parameters wire format.
+ *
+ * The text format of a message requires each parameter name and value
+ * to be escaped and parsed. Between communicators, all the parameters
+ * of a message are instead packed in one binary buffer:
+ *
+ * \code
+ *     buffer: version parameter*
+ *     parameter: name value
+ *     name: varint (index + 1 in g_names) | 0 varint(length) bytes
+ *     value: 's' varint(length) bytes
+ *          | 'i' zigzag-varint
+ *          | 't' varint(seconds) varint(nanoseconds)
+ * \endcode
+ *
+ * The buffer is then saved in the "wire" parameter using base64url
+ * without padding, which the text format never needs to escape. The
+ * command, server and service remain as is so the message can be
+ * dispatched and forwarded without being decoded.
+ *
+ * \note
+ * This is not a binary framing. The eventdispatcher connections only
+ * read and write newline terminated text messages, so the packed buffer
+ * travels inside a regular text message and the base64url encoding makes
+ * it 4/3 of its binary size. What this format saves is the escaping and
+ * parsing of each parameter, especially the large lists of names; a
+ * message with short parameters is not necessarily smaller than its text
+ * version. A raw length-prefixed frame would require a connection type
+ * which does not use the eventdispatcher line reader.
+ *
+ * Links to other data centers can also compress that buffer with zstd
+ * when they advertise the "zstd" capability. The compressed buffer starts
+ * with version 2 followed by a zstd frame of the version 1 buffer. The
+ * compressor uses a dictionary built from the communicatord vocabulary
+ * (the g_names table and the g_dictionary_words table) so even small
+ * messages benefit from the compression.
+ *
+ * \warning
+ * The g_names and g_dictionary_words tables are part of the protocol:
+ * new names can only be added at the end.
+ */
+
+// self
+//
+#include    "wire_format.h"
+
+
+// communicatord
+//
+#include    <communicatord/names.h>
+
+
+// C++
+//
+#include    <algorithm>
+#include    <cstdint>
+#include    <cstring>
+#include    <iterator>
+#include    <map>
+
+
+// C
+//
+#include    <zstd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+namespace
+{
+
+
+
+constexpr char const       g_wire_version = 1;
+constexpr char const       g_wire_version_compressed = 2;
+constexpr std::size_t const g_max_decompressed_size = 16 * 1024 * 1024;
+
+
+char const * const g_names[] =
+{
+    communicatord::g_name_communicatord_param_avg,
+    communicatord::g_name_communicatord_param_broadcast_hops,
+    communicatord::g_name_communicatord_param_broadcast_informed_filter,
+    communicatord::g_name_communicatord_param_broadcast_informed_neighbors,
+    communicatord::g_name_communicatord_param_broadcast_msgid,
+    communicatord::g_name_communicatord_param_broadcast_originator,
+    communicatord::g_name_communicatord_param_broadcast_timeout,
+    communicatord::g_name_communicatord_param_cache,
+    communicatord::g_name_communicatord_param_capabilities,
+    communicatord::g_name_communicatord_param_command,
+    communicatord::g_name_communicatord_param_count,
+    communicatord::g_name_communicatord_param_delivery,
+    communicatord::g_name_communicatord_param_destination_service,
+    communicatord::g_name_communicatord_param_heard_of,
+    communicatord::g_name_communicatord_param_list,
+    communicatord::g_name_communicatord_param_message,
+    communicatord::g_name_communicatord_param_my_address,
+    communicatord::g_name_communicatord_param_neighbors,
+    communicatord::g_name_communicatord_param_server_name,
+    communicatord::g_name_communicatord_param_service,
+    communicatord::g_name_communicatord_param_services,
+    communicatord::g_name_communicatord_param_status,
+    communicatord::g_name_communicatord_param_timestamp,
+    communicatord::g_name_communicatord_param_transmission_report,
+    communicatord::g_name_communicatord_param_unsent_command,
+    communicatord::g_name_communicatord_param_version,
+};
+
+
+char const * const g_dictionary_words[] =
+{
+    communicatord::g_name_communicatord_service_communicatord,
+    communicatord::g_name_communicatord_service_cluster,
+    communicatord::g_name_communicatord_value_up,
+    communicatord::g_name_communicatord_value_down,
+    communicatord::g_name_communicatord_value_unknown,
+    communicatord::g_name_communicatord_value_true,
+    communicatord::g_name_communicatord_value_yes,
+    communicatord::g_name_communicatord_value_no,
+    communicatord::g_name_communicatord_value_cached,
+    communicatord::g_name_communicatord_value_failed,
+    communicatord::g_name_communicatord_value_informed_filter,
+    communicatord::g_name_communicatord_value_wire_format,
+    communicatord::g_name_communicatord_value_zstd,
+    "cd://",
+    "cds://",
+    "127.0.0.1:",
+    "192.168.",
+    "10.0.",
+    ":4041",
+    ":4042",
+};
+
+
+/** \brief The zstd dictionary and contexts.
+ *
+ * The dictionary is built once from the vocabulary tables. The contexts
+ * are reused between calls since the communicatord sends all of its
+ * messages from one thread.
+ *
+ * The compression dictionary depends on the compression level so we
+ * keep one per level in use.
+ */
+class zstd_dictionary
+{
+public:
+    zstd_dictionary()
+    {
+        for(auto const & n : g_names)
+        {
+            f_content += n;
+            f_content += 's';
+        }
+        for(auto const & w : g_dictionary_words)
+        {
+            f_content += w;
+            f_content += ',';
+        }
+    }
+
+    zstd_dictionary(zstd_dictionary const &) = delete;
+    zstd_dictionary & operator = (zstd_dictionary const &) = delete;
+
+    ~zstd_dictionary()
+    {
+        for(auto const & c : f_cdicts)
+        {
+            ZSTD_freeCDict(c.second);
+        }
+        ZSTD_freeDDict(f_ddict);
+        ZSTD_freeCCtx(f_cctx);
+        ZSTD_freeDCtx(f_dctx);
+    }
+
+    bool compress(std::string & buffer, int level)
+    {
+        level = std::min(level, ZSTD_maxCLevel());
+        auto it(f_cdicts.find(level));
+        if(it == f_cdicts.end())
+        {
+            ZSTD_CDict * cdict(ZSTD_createCDict(f_content.data(), f_content.length(), level));
+            if(cdict == nullptr)
+            {
+                return false;
+            }
+            it = f_cdicts.insert({ level, cdict }).first;
+        }
+        if(f_cctx == nullptr)
+        {
+            f_cctx = ZSTD_createCCtx();
+            if(f_cctx == nullptr)
+            {
+                return false;
+            }
+        }
+
+        std::string out(1 + ZSTD_compressBound(buffer.length()), '\0');
+        out[0] = g_wire_version_compressed;
+        std::size_t const size(ZSTD_compress_usingCDict(
+                  f_cctx
+                , out.data() + 1
+                , out.length() - 1
+                , buffer.data()
+                , buffer.length()
+                , it->second));
+        if(ZSTD_isError(size)
+        || size + 1 >= buffer.length())
+        {
+            // not worth it
+            //
+            return false;
+        }
+        out.resize(size + 1);
+        buffer.swap(out);
+        return true;
+    }
+
+    bool decompress(std::string & buffer)
+    {
+        if(f_ddict == nullptr)
+        {
+            f_ddict = ZSTD_createDDict(f_content.data(), f_content.length());
+            if(f_ddict == nullptr)
+            {
+                return false;
+            }
+        }
+        if(f_dctx == nullptr)
+        {
+            f_dctx = ZSTD_createDCtx();
+            if(f_dctx == nullptr)
+            {
+                return false;
+            }
+        }
+
+        unsigned long long const expected(ZSTD_getFrameContentSize(buffer.data() + 1, buffer.length() - 1));
+        if(expected == ZSTD_CONTENTSIZE_UNKNOWN
+        || expected == ZSTD_CONTENTSIZE_ERROR
+        || expected == 0
+        || expected > g_max_decompressed_size)
+        {
+            return false;
+        }
+
+        std::string out(expected, '\0');
+        std::size_t const size(ZSTD_decompress_usingDDict(
+                  f_dctx
+                , out.data()
+                , out.length()
+                , buffer.data() + 1
+                , buffer.length() - 1
+                , f_ddict));
+        if(ZSTD_isError(size)
+        || size != expected)
+        {
+            return false;
+        }
+        buffer.swap(out);
+        return true;
+    }
+
+private:
+    std::string                 f_content = std::string();
+    std::map<int, ZSTD_CDict *> f_cdicts = std::map<int, ZSTD_CDict *>();
+    ZSTD_DDict *                f_ddict = nullptr;
+    ZSTD_CCtx *                 f_cctx = nullptr;
+    ZSTD_DCtx *                 f_dctx = nullptr;
+};
+
+
+zstd_dictionary & get_dictionary()
+{
+    static zstd_dictionary g_dictionary;
+    return g_dictionary;
+}
+
+
+char const g_base64url[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "abcdefghijklmnopqrstuvwxyz"
+    "0123456789-_";
+
+
+std::size_t find_name(std::string const & name)
+{
+    for(std::size_t idx(0); idx < std::size(g_names); ++idx)
+    {
+        if(name == g_names[idx])
+        {
+            return idx + 1;
+        }
+    }
+    return 0;
+}
+
+
+void write_varint(std::string & out, std::uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+
+bool read_varint(char const * & s, char const * end, std::uint64_t & value)
+{
+    value = 0;
+    for(int shift(0); shift < 64; shift += 7)
+    {
+        if(s >= end)
+        {
+            return false;
+        }
+        std::uint8_t const c(static_cast<std::uint8_t>(*s++));
+        value |= static_cast<std::uint64_t>(c & 0x7F) << shift;
+        if((c & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void write_string(std::string & out, std::string const & value)
+{
+    write_varint(out, value.length());
+    out += value;
+}
+
+
+bool read_string(char const * & s, char const * end, std::string & value)
+{
+    std::uint64_t length(0);
+    if(!read_varint(s, end, length)
+    || length > static_cast<std::uint64_t>(end - s))
+    {
+        return false;
+    }
+    value.assign(s, length);
+    s += length;
+    return true;
+}
+
+
+/** \brief Check whether a value is an integer in its canonical form.
+ *
+ * Only values which convert back to the exact same string are sent as
+ * integers. So "007" or "+5" remain strings.
+ */
+bool is_integer(std::string const & value, std::int64_t & result)
+{
+    if(value.empty() || value.length() > 18)
+    {
+        return false;
+    }
+    char const * s(value.c_str());
+    bool const negative(*s == '-');
+    if(negative)
+    {
+        ++s;
+    }
+    if(*s == '\0'
+    || (*s == '0' && (s[1] != '\0' || negative)))
+    {
+        return false;
+    }
+    std::int64_t v(0);
+    for(; *s != '\0'; ++s)
+    {
+        if(*s < '0' || *s > '9')
+        {
+            return false;
+        }
+        v = v * 10 + (*s - '0');
+    }
+    result = negative ? -v : v;
+    return true;
+}
+
+
+/** \brief Check whether a value is a timespec as used in our timestamps.
+ *
+ * The timestamps are written as `<seconds>.<nanoseconds>` with exactly
+ * nine digits of nanoseconds.
+ */
+bool is_timespec(std::string const & value, std::uint64_t & sec, std::uint64_t & nsec)
+{
+    std::string::size_type const pos(value.find('.'));
+    if(pos == std::string::npos
+    || pos == 0
+    || pos > 19
+    || value.length() - pos != 10
+    || (value[0] == '0' && pos != 1))
+    {
+        return false;
+    }
+    sec = 0;
+    for(std::string::size_type i(0); i < pos; ++i)
+    {
+        if(value[i] < '0' || value[i] > '9')
+        {
+            return false;
+        }
+        sec = sec * 10 + (value[i] - '0');
+    }
+    nsec = 0;
+    for(std::string::size_type i(pos + 1); i < value.length(); ++i)
+    {
+        if(value[i] < '0' || value[i] > '9')
+        {
+            return false;
+        }
+        nsec = nsec * 10 + (value[i] - '0');
+    }
+    return true;
+}
+
+
+std::string to_base64url(std::string const & in)
+{
+    std::string out;
+    out.reserve((in.length() * 4 + 2) / 3);
+    std::size_t i(0);
+    for(; i + 2 < in.length(); i += 3)
+    {
+        std::uint32_t const v((static_cast<std::uint8_t>(in[i]) << 16)
+                            | (static_cast<std::uint8_t>(in[i + 1]) << 8)
+                            | static_cast<std::uint8_t>(in[i + 2]));
+        out += g_base64url[(v >> 18) & 0x3F];
+        out += g_base64url[(v >> 12) & 0x3F];
+        out += g_base64url[(v >> 6) & 0x3F];
+        out += g_base64url[v & 0x3F];
+    }
+    if(i + 1 == in.length())
+    {
+        std::uint32_t const v(static_cast<std::uint8_t>(in[i]) << 16);
+        out += g_base64url[(v >> 18) & 0x3F];
+        out += g_base64url[(v >> 12) & 0x3F];
+    }
+    else if(i + 2 == in.length())
+    {
+        std::uint32_t const v((static_cast<std::uint8_t>(in[i]) << 16)
+                            | (static_cast<std::uint8_t>(in[i + 1]) << 8));
+        out += g_base64url[(v >> 18) & 0x3F];
+        out += g_base64url[(v >> 12) & 0x3F];
+        out += g_base64url[(v >> 6) & 0x3F];
+    }
+    return out;
+}
+
+
+bool from_base64url(std::string const & in, std::string & out)
+{
+    out.clear();
+    out.reserve(in.length() * 3 / 4);
+    std::uint32_t v(0);
+    int bits(0);
+    for(char const c : in)
+    {
+        int d(-1);
+        if(c >= 'A' && c <= 'Z')
+        {
+            d = c - 'A';
+        }
+        else if(c >= 'a' && c <= 'z')
+        {
+            d = c - 'a' + 26;
+        }
+        else if(c >= '0' && c <= '9')
+        {
+            d = c - '0' + 52;
+        }
+        else if(c == '-')
+        {
+            d = 62;
+        }
+        else if(c == '_')
+        {
+            d = 63;
+        }
+        else
+        {
+            return false;
+        }
+        v = (v << 6) | d;
+        bits += 6;
+        if(bits >= 8)
+        {
+            bits -= 8;
+            out += static_cast<char>((v >> bits) & 0xFF);
+        }
+    }
+    return bits < 6;
+}
+
+
+
+} // no name namespace
+
+
+
+/** \brief Convert a message to the packed parameters wire format.
+ *
+ * This function copies the command, server, service and origin of
+ * \p msg to \p wire and packs all the parameters in the "wire"
+ * parameter.
+ *
+ * When \p compression_level is larger than 0 and the buffer is at
+ * least \p compression_threshold bytes, the buffer also gets compressed.
+ * It is kept uncompressed if the compression does not make it smaller.
+ *
+ * \param[in] msg  The message to convert.
+ * \param[out] wire  The message with its parameters packed.
+ * \param[in] compression_level  The zstd level or 0 to not compress.
+ * \param[in] compression_threshold  The minimum size to compress.
+ *
+ * \return true if \p wire was set, false if \p msg is not worth
+ * converting (i.e. it has no parameters or was already converted).
+ */
+bool encode_wire_message(
+      ed::message const & msg
+    , ed::message & wire
+    , int compression_level
+    , std::size_t compression_threshold)
+{
+    ed::message::parameters_t const & params(msg.get_all_parameters());
+    if(params.empty()
+    || msg.has_parameter(communicatord::g_name_communicatord_param_wire))
+    {
+        return false;
+    }
+
+    std::string buffer;
+    buffer += g_wire_version;
+    for(auto const & p : params)
+    {
+        std::size_t const idx(find_name(p.first));
+        write_varint(buffer, idx);
+        if(idx == 0)
+        {
+            write_string(buffer, p.first);
+        }
+
+        std::int64_t integer(0);
+        std::uint64_t sec(0);
+        std::uint64_t nsec(0);
+        if(is_integer(p.second, integer))
+        {
+            buffer += 'i';
+            write_varint(buffer, (static_cast<std::uint64_t>(integer) << 1) ^ static_cast<std::uint64_t>(integer >> 63));
+        }
+        else if(is_timespec(p.second, sec, nsec))
+        {
+            buffer += 't';
+            write_varint(buffer, sec);
+            write_varint(buffer, nsec);
+        }
+        else
+        {
+            buffer += 's';
+            write_string(buffer, p.second);
+        }
+    }
+
+    if(compression_level > 0
+    && buffer.length() >= compression_threshold)
+    {
+        get_dictionary().compress(buffer, compression_level);
+    }
+
+    wire = ed::message();
+    wire.set_command(msg.get_command());
+    wire.set_server(msg.get_server());
+    wire.set_service(msg.get_service());
+    wire.set_sent_from_server(msg.get_sent_from_server());
+    wire.set_sent_from_service(msg.get_sent_from_service());
+    wire.add_parameter(communicatord::g_name_communicatord_param_wire, to_base64url(buffer));
+
+    return true;
+}
+
+
+/** \brief Convert a message from the packed parameters wire format.
+ *
+ * This function unpacks the "wire" parameter of \p wire and saves the
+ * result in \p msg. The parameter gets decompressed first if the
+ * sender compressed it.
+ *
+ * \param[in] wire  The message with its parameters packed.
+ * \param[out] msg  The message with its parameters restored.
+ *
+ * \return true if \p msg was set, false if \p wire is not in the
+ * packed parameters wire format or is invalid.
+ */
+bool decode_wire_message(ed::message const & wire, ed::message & msg)
+{
+    if(!wire.has_parameter(communicatord::g_name_communicatord_param_wire))
+    {
+        return false;
+    }
+
+    std::string buffer;
+    if(!from_base64url(wire.get_parameter(communicatord::g_name_communicatord_param_wire), buffer)
+    || buffer.empty())
+    {
+        return false;
+    }
+    if(buffer[0] == g_wire_version_compressed
+    && !get_dictionary().decompress(buffer))
+    {
+        return false;
+    }
+    if(buffer.empty()
+    || buffer[0] != g_wire_version)
+    {
+        return false;
+    }
+
+    ed::message result;
+    result.set_command(wire.get_command());
+    result.set_server(wire.get_server());
+    result.set_service(wire.get_service());
+    result.set_sent_from_server(wire.get_sent_from_server());
+    result.set_sent_from_service(wire.get_sent_from_service());
+
+    char const * s(buffer.data() + 1);
+    char const * end(buffer.data() + buffer.length());
+    while(s < end)
+    {
+        std::uint64_t idx(0);
+        if(!read_varint(s, end, idx)
+        || idx > std::size(g_names))
+        {
+            return false;
+        }
+        std::string name;
+        if(idx == 0)
+        {
+            if(!read_string(s, end, name)
+            || name.empty())
+            {
+                return false;
+            }
+        }
+        else
+        {
+            name = g_names[idx - 1];
+        }
+
+        if(s >= end)
+        {
+            return false;
+        }
+        std::string value;
+        switch(*s++)
+        {
+        case 's':
+            if(!read_string(s, end, value))
+            {
+                return false;
+            }
+            break;
+
+        case 'i':
+            {
+                std::uint64_t v(0);
+                if(!read_varint(s, end, v))
+                {
+                    return false;
+                }
+                value = std::to_string(static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1));
+            }
+            break;
+
+        case 't':
+            {
+                std::uint64_t sec(0);
+                std::uint64_t nsec(0);
+                if(!read_varint(s, end, sec)
+                || !read_varint(s, end, nsec)
+                || nsec >= 1'000'000'000)
+                {
+                    return false;
+                }
+                std::string n(std::to_string(nsec));
+                value = std::to_string(sec);
+                value += '.';
+                value += std::string(9 - n.length(), '0');
+                value += n;
+            }
+            break;
+
+        default:
+            return false;
+
+        }
+        result.add_parameter(name, value);
+    }
+
+    msg = result;
+    return true;
+}
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
@@ -0,0 +1,51 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicatord
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+/** \file
+ * \brief Declaration of the packed parameters wire format.
+ *
+ * Communicators which advertise the "wire_format" capability exchange
+ * messages with all their parameters packed in a single base64url "wire"
+ * parameter. The messages remain newline terminated text messages; this
+ * is not a length-prefixed binary framing. Links which also advertise the
+ * "zstd" capability may compress that parameter.
+ */
+
+// eventdispatcher
+//
+#include    <eventdispatcher/message.h>
+
+
+
+namespace communicator_daemon
+{
+
+
+
+bool                        encode_wire_message(
+                                  ed::message const & msg
+                                , ed::message & wire
+                                , int compression_level = 0
+                                , std::size_t compression_threshold = 0);
+bool                        decode_wire_message(ed::message const & wire, ed::message & msg);
+
+
+
+} // namespace communicator_daemon
+// vim: ts=4 sw=4 et
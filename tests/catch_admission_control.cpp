@@ -0,0 +1,125 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the admission control.
+ *
+ * This file implements tests to verify the connection budgets of the
+ * listeners and the limit of connections per IP address.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/admission_control.h>
+
+
+// C++
+//
+#include    <vector>
+
+
+
+CATCH_TEST_CASE("admission_control", "[admission_control]")
+{
+    CATCH_START_SECTION("admission_control: budgets are separate")
+    {
+        auto control(std::make_shared<communicator_daemon::admission_control>());
+        control->set_limit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL, 2);
+        control->set_limit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE, 1);
+
+        std::vector<communicator_daemon::admission_control::ticket> tickets;
+        tickets.push_back(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL, std::string()));
+        tickets.push_back(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL, std::string()));
+        CATCH_REQUIRE(tickets[0].is_admitted());
+        CATCH_REQUIRE(tickets[1].is_admitted());
+        CATCH_REQUIRE_FALSE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL, std::string()).is_admitted());
+        CATCH_REQUIRE(control->get_count(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL) == 2);
+        CATCH_REQUIRE(control->get_refused(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL) == 1);
+
+        // a full local budget does not prevent remote connections
+        //
+        tickets.push_back(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE, "10.0.0.1"));
+        CATCH_REQUIRE(tickets.back().is_admitted());
+        CATCH_REQUIRE_FALSE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE, "10.0.0.2").is_admitted());
+
+        // the secure budget is not limited
+        //
+        for(int i(0); i < 10; ++i)
+        {
+            tickets.push_back(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_SECURE, "10.0.0.3"));
+            CATCH_REQUIRE(tickets.back().is_admitted());
+        }
+        CATCH_REQUIRE(control->get_address_count("10.0.0.3") == 10);
+
+        // destroying the tickets gives the slots back
+        //
+        tickets.clear();
+        CATCH_REQUIRE(control->get_count(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL) == 0);
+        CATCH_REQUIRE(control->get_count(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE) == 0);
+        CATCH_REQUIRE(control->get_count(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_SECURE) == 0);
+        CATCH_REQUIRE(control->get_address_count("10.0.0.3") == 0);
+        CATCH_REQUIRE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE, "10.0.0.2").is_admitted());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("admission_control: per address quota")
+    {
+        auto control(std::make_shared<communicator_daemon::admission_control>());
+        control->set_address_limit(2);
+
+        communicator_daemon::admission_control::ticket a(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE, "10.0.0.1"));
+        communicator_daemon::admission_control::ticket b(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_SECURE, "10.0.0.1"));
+        CATCH_REQUIRE(a.is_admitted());
+        CATCH_REQUIRE(b.is_admitted());
+
+        // the quota is shared by the remote and secure listeners
+        //
+        CATCH_REQUIRE_FALSE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE, "10.0.0.1").is_admitted());
+        CATCH_REQUIRE_FALSE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_SECURE, "10.0.0.1").is_admitted());
+        CATCH_REQUIRE(control->get_address_refused() == 2);
+        CATCH_REQUIRE(control->get_count(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE) == 1);
+
+        // other addresses and local connections are not affected
+        //
+        CATCH_REQUIRE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE, "10.0.0.2").is_admitted());
+        CATCH_REQUIRE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL, "127.0.0.1").is_admitted());
+        CATCH_REQUIRE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL, "127.0.0.1").is_admitted());
+        CATCH_REQUIRE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_LOCAL, "127.0.0.1").is_admitted());
+
+        // moving a ticket keeps a single slot
+        //
+        communicator_daemon::admission_control::ticket c(std::move(a));
+        CATCH_REQUIRE_FALSE(a.is_admitted());
+        CATCH_REQUIRE(c.is_admitted());
+        CATCH_REQUIRE(control->get_address_count("10.0.0.1") == 2);
+
+        c.release();
+        c.release();
+        CATCH_REQUIRE(control->get_address_count("10.0.0.1") == 1);
+        CATCH_REQUIRE(control->admit(communicator_daemon::admission_budget_t::ADMISSION_BUDGET_REMOTE, "10.0.0.1").is_admitted());
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -33,23 +33,80 @@
 #include    <daemon/base_connection.h>
 
 
+// C
+//
+#include    <netinet/in.h>
+#include    <poll.h>
+#include    <sys/socket.h>
+#include    <unistd.h>
+
+
 
 class test_connection
     : public communicator_daemon::base_connection
 {
 public:
-    test_connection(communicator_daemon::server::pointer_t s)
+    test_connection(communicator_daemon::server::pointer_t s, int socket = -1)
         : base_connection(s, false)
+        , f_socket(socket)
     {
     }
 
     virtual int get_socket() const override
     {
-        return -1;
+        return f_socket;
     }
+
+private:
+    int         f_socket = -1;
 };
 
 
+namespace
+{
+
+
+/** \brief Create a pair of connected TCP sockets on the loopback.
+ *
+ * TCP_CORK only works on TCP sockets.
+ *
+ * \param[out] client  The socket which connected.
+ * \param[out] server  The socket which accepted the connection.
+ */
+void tcp_pair(int & client, int & server)
+{
+    int const listener(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    CATCH_REQUIRE(listener >= 0);
+    sockaddr_in a = {};
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CATCH_REQUIRE(bind(listener, reinterpret_cast<sockaddr *>(&a), sizeof(a)) == 0);
+    CATCH_REQUIRE(listen(listener, 1) == 0);
+    socklen_t len(sizeof(a));
+    CATCH_REQUIRE(getsockname(listener, reinterpret_cast<sockaddr *>(&a), &len) == 0);
+
+    client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    CATCH_REQUIRE(client >= 0);
+    CATCH_REQUIRE(connect(client, reinterpret_cast<sockaddr *>(&a), sizeof(a)) == 0);
+    server = accept(listener, nullptr, nullptr);
+    CATCH_REQUIRE(server >= 0);
+    close(listener);
+}
+
+
+bool has_input(int s, int timeout_ms)
+{
+    pollfd p = {};
+    p.fd = s;
+    p.events = POLLIN;
+    return poll(&p, 1, timeout_ms) == 1;
+}
+
+
+} // no name namespace
+
+
+
 CATCH_TEST_CASE("base_connection", "[connection]")
 {
     CATCH_START_SECTION("base_connection: verify default object")
@@ -64,6 +121,106 @@ CATCH_TEST_CASE("base_connection", "[connection]")
         CATCH_REQUIRE(tc.get_server_name().empty());
     }
     CATCH_END_SECTION()
+
+    CATCH_START_SECTION("base_connection: commands without an identifier")
+    {
+        communicator_daemon::server::pointer_t s;
+        test_connection tc(s);
+        CATCH_REQUIRE_FALSE(tc.has_commands());
+
+        // fill the table so the new names do not get an identifier
+        //
+        communicator_daemon::set_dynamic_command_limit(communicator_daemon::dynamic_command_count());
+        tc.add_commands("REGISTER,BASE_CONNECTION_OVERFLOW,BASE_CONNECTION_OVERFLOW");
+        communicator_daemon::set_dynamic_command_limit(communicator_daemon::DEFAULT_DYNAMIC_COMMAND_LIMIT);
+
+        communicator_daemon::command_id_t const id(communicator_daemon::find_command("BASE_CONNECTION_OVERFLOW"));
+        CATCH_REQUIRE(id == communicator_daemon::COMMAND_ID_UNKNOWN);
+        CATCH_REQUIRE(tc.has_commands());
+        CATCH_REQUIRE(tc.understand_command("REGISTER"));
+        CATCH_REQUIRE(tc.understand_command("BASE_CONNECTION_OVERFLOW"));
+        CATCH_REQUIRE(tc.understand_command(id, "BASE_CONNECTION_OVERFLOW"));
+        CATCH_REQUIRE_FALSE(tc.understand_command(id));
+        CATCH_REQUIRE_FALSE(tc.understand_command("BASE_CONNECTION_OTHER"));
+
+        advgetopt::string_set_t commands;
+        tc.get_commands(commands);
+        CATCH_REQUIRE(commands.size() == 2);
+        CATCH_REQUIRE(commands.count("BASE_CONNECTION_OVERFLOW") == 1);
+
+        tc.remove_command("BASE_CONNECTION_OVERFLOW");
+        CATCH_REQUIRE_FALSE(tc.understand_command("BASE_CONNECTION_OVERFLOW"));
+        tc.remove_command("REGISTER");
+        CATCH_REQUIRE_FALSE(tc.has_commands());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("base_connection: output batch byte threshold")
+    {
+        int client(-1);
+        int server(-1);
+        tcp_pair(client, server);
+        communicator_daemon::server::pointer_t s;
+        test_connection tc(s, client);
+
+        // not corked, nothing to flush
+        //
+        CATCH_REQUIRE_FALSE(tc.batch_output(1'000, true, 100));
+
+        CATCH_REQUIRE(tc.cork_output());
+        CATCH_REQUIRE_FALSE(tc.cork_output());
+        CATCH_REQUIRE(tc.is_corked());
+        CATCH_REQUIRE_FALSE(tc.batch_output(100, false, 250));
+        CATCH_REQUIRE_FALSE(tc.batch_output(100, false, 250));
+        CATCH_REQUIRE(tc.batch_output(100, false, 250));
+        tc.uncork_output();
+        CATCH_REQUIRE_FALSE(tc.is_corked());
+
+        // a new batch starts from zero and a control message flushes it
+        //
+        CATCH_REQUIRE(tc.cork_output());
+        CATCH_REQUIRE_FALSE(tc.batch_output(200, false, 250));
+        CATCH_REQUIRE(tc.batch_output(10, true, 250));
+        tc.uncork_output();
+
+        // without a byte limit only the control messages flush the batch
+        //
+        CATCH_REQUIRE(tc.cork_output());
+        CATCH_REQUIRE_FALSE(tc.batch_output(1'000'000, false, 0));
+        tc.uncork_output();
+
+        close(client);
+        close(server);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("base_connection: batched output is sent once uncorked")
+    {
+        int client(-1);
+        int server(-1);
+        tcp_pair(client, server);
+        communicator_daemon::server::pointer_t s;
+        test_connection tc(s, client);
+
+        // while corked, the kernel keeps a partial packet
+        //
+        CATCH_REQUIRE(tc.cork_output());
+        char const data[] = "PING\n";
+        CATCH_REQUIRE(write(client, data, sizeof(data) - 1) == sizeof(data) - 1);
+        CATCH_REQUIRE_FALSE(tc.batch_output(sizeof(data) - 1, false, 65536));
+        CATCH_REQUIRE_FALSE(has_input(server, 50));
+
+        // this is what the flush timer does
+        //
+        tc.uncork_output();
+        CATCH_REQUIRE(has_input(server, 1'000));
+        char buf[16];
+        CATCH_REQUIRE(read(server, buf, sizeof(buf)) == sizeof(data) - 1);
+
+        close(client);
+        close(server);
+    }
+    CATCH_END_SECTION()
 }
 
 
@@ -0,0 +1,199 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the bloom_filter class.
+ *
+ * This file implements tests to verify that the Bloom filter used to
+ * send the list of informed neighbors never loses an entry and that
+ * the string sent by peers is validated.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/bloom_filter.h>
+
+
+// C++
+//
+#include    <string>
+#include    <vector>
+
+
+
+namespace
+{
+
+
+
+std::vector<std::string> get_addresses(int count, int offset)
+{
+    std::vector<std::string> result;
+    for(int i(0); i < count; ++i)
+    {
+        int const n(i + offset);
+        result.push_back(
+                  "10."
+                + std::to_string((n >> 16) & 255)
+                + "."
+                + std::to_string((n >> 8) & 255)
+                + "."
+                + std::to_string(n & 255));
+    }
+    return result;
+}
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("bloom_filter", "[broadcast]")
+{
+    CATCH_START_SECTION("bloom_filter: size")
+    {
+        std::size_t const minimum(communicator_daemon::bloom_filter::MINIMUM_BITS);
+        std::size_t const maximum(communicator_daemon::bloom_filter::MAXIMUM_BITS);
+        CATCH_REQUIRE(communicator_daemon::bloom_filter().bit_count() == minimum);
+        CATCH_REQUIRE(communicator_daemon::bloom_filter(3).bit_count() == minimum);
+        CATCH_REQUIRE(communicator_daemon::bloom_filter(100).bit_count() == 1600);
+        CATCH_REQUIRE(communicator_daemon::bloom_filter(101).bit_count() == 1664);
+
+        // the size is capped
+        //
+        CATCH_REQUIRE(communicator_daemon::bloom_filter(1'000'000).bit_count() == maximum);
+        CATCH_REQUIRE(communicator_daemon::bloom_filter(static_cast<std::size_t>(-1)).bit_count() == maximum);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("bloom_filter: no false negatives")
+    {
+        std::vector<std::string> const added(get_addresses(1'000, 0));
+        communicator_daemon::bloom_filter filter(added.size());
+        for(auto const & a : added)
+        {
+            filter.add(a);
+        }
+        for(auto const & a : added)
+        {
+            CATCH_REQUIRE(filter.contains(a));
+        }
+
+        // the false positive rate is expected to be about 0.05%, allow
+        // for some margin
+        //
+        std::vector<std::string> const others(get_addresses(10'000, 100'000));
+        int false_positives(0);
+        for(auto const & a : others)
+        {
+            if(filter.contains(a))
+            {
+                ++false_positives;
+            }
+        }
+        CATCH_REQUIRE(false_positives < 50);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("bloom_filter: to_string() and from_string() round trip")
+    {
+        std::vector<std::string> const added(get_addresses(300, 1'000));
+        communicator_daemon::bloom_filter filter(added.size());
+        for(auto const & a : added)
+        {
+            filter.add(a);
+        }
+        std::string const encoded(filter.to_string());
+        CATCH_REQUIRE(encoded.length() == filter.bit_count() / 4);
+
+        // the receiver may have been created with a different size
+        //
+        communicator_daemon::bloom_filter copy(5);
+        CATCH_REQUIRE(copy.from_string(encoded));
+        CATCH_REQUIRE(copy.bit_count() == filter.bit_count());
+        CATCH_REQUIRE(copy.to_string() == encoded);
+        for(auto const & a : added)
+        {
+            CATCH_REQUIRE(copy.contains(a));
+        }
+
+        // an empty filter contains nothing
+        //
+        communicator_daemon::bloom_filter empty;
+        CATCH_REQUIRE(empty.to_string() == std::string(communicator_daemon::bloom_filter::MINIMUM_BITS / 4, '0'));
+        CATCH_REQUIRE_FALSE(empty.contains("10.0.0.1"));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("bloom_filter: invalid strings are rejected")
+    {
+        communicator_daemon::bloom_filter filter;
+        filter.add("10.0.0.1");
+        std::string const original(filter.to_string());
+        std::string const valid(std::string(communicator_daemon::bloom_filter::MINIMUM_BITS / 4, 'f'));
+
+        std::vector<std::string> const invalid = {
+            // bad length
+            //
+            std::string(),
+            "0123456789abcdef",
+            valid.substr(1),
+            valid + "0",
+            valid + "0123456789abcde",
+
+            // too large
+            //
+            std::string(communicator_daemon::bloom_filter::MAXIMUM_BITS / 4 + 16, '0'),
+
+            // not lowercase hexadecimal
+            //
+            "g" + valid.substr(1),
+            valid.substr(1) + "F",
+            valid.substr(0, 16) + " " + valid.substr(17),
+            valid.substr(0, 20) + std::string(1, '\0') + valid.substr(21),
+            valid.substr(0, 30) + "-" + valid.substr(31),
+        };
+        for(auto const & s : invalid)
+        {
+            CATCH_REQUIRE_FALSE(filter.from_string(s));
+
+            // the filter is not modified on errors
+            //
+            CATCH_REQUIRE(filter.to_string() == original);
+            CATCH_REQUIRE(filter.contains("10.0.0.1"));
+        }
+
+        // the largest accepted size
+        //
+        CATCH_REQUIRE(filter.from_string(std::string(communicator_daemon::bloom_filter::MAXIMUM_BITS / 4, 'f')));
+        std::size_t const maximum(communicator_daemon::bloom_filter::MAXIMUM_BITS);
+        CATCH_REQUIRE(filter.bit_count() == maximum);
+        CATCH_REQUIRE(filter.contains("10.0.0.1"));
+        CATCH_REQUIRE(filter.contains("anything"));
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
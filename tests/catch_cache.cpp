@@ -0,0 +1,258 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the cache class.
+ *
+ * This file implements tests to verify that the cache of messages
+ * enforces its limits and replays messages per service.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/cache.h>
+
+
+
+namespace
+{
+
+
+ed::message create_message(std::string const & service, std::string const & command)
+{
+    ed::message msg;
+    msg.set_service(service);
+    msg.set_command(command);
+    return msg;
+}
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("cache", "[cache]")
+{
+    CATCH_START_SECTION("cache: per service limit evicts oldest first")
+    {
+        communicator_daemon::cache c;
+        c.set_limits(0, 0, 3, 0);
+
+        for(int i(0); i < 5; ++i)
+        {
+            ed::message msg(create_message("monster", "CMD" + std::to_string(i)));
+            CATCH_REQUIRE(c.cache_message(msg) == communicator_daemon::cache_message_t::CACHE_MESSAGE_CACHED);
+        }
+        CATCH_REQUIRE(c.size() == 3);
+        CATCH_REQUIRE(c.size("monster") == 3);
+        CATCH_REQUIRE(c.get_evicted() == 2);
+
+        std::vector<std::string> commands;
+        c.process_messages("monster", [&commands](ed::message & msg)
+            {
+                commands.push_back(msg.get_command());
+                return true;
+            });
+        CATCH_REQUIRE(commands == std::vector<std::string>({ "CMD2", "CMD3", "CMD4" }));
+        CATCH_REQUIRE(c.size() == 0);
+        CATCH_REQUIRE(c.get_bytes() == 0);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("cache: only the registering service is replayed")
+    {
+        communicator_daemon::cache c;
+
+        ed::message a(create_message("firewall", "BLOCK"));
+        ed::message b(create_message("logger", "LOG"));
+        c.cache_message(a);
+        c.cache_message(b);
+        CATCH_REQUIRE(c.size() == 2);
+
+        int count(0);
+        c.process_messages("firewall", [&count](ed::message & msg)
+            {
+                CATCH_REQUIRE(msg.get_service() == "firewall");
+                ++count;
+                return true;
+            });
+        CATCH_REQUIRE(count == 1);
+        CATCH_REQUIRE(c.size() == 1);
+        CATCH_REQUIRE(c.size("logger") == 1);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("cache: replay into a congested connection")
+    {
+        communicator_daemon::cache c;
+        for(int i(0); i < 5; ++i)
+        {
+            ed::message msg(create_message("snapdb", "CMD" + std::to_string(i)));
+            c.cache_message(msg);
+        }
+
+        // the connection accepts two messages and then is congested,
+        // a congested connection caches the messages it receives again
+        //
+        std::vector<std::string> queue;
+        auto congested([&queue]() { return queue.size() >= 2; });
+        auto send([&](ed::message & msg)
+            {
+                if(congested())
+                {
+                    ed::message copy(msg);
+                    c.cache_message(copy);
+                    return true;
+                }
+                queue.push_back(msg.get_command());
+                return true;
+            });
+
+        c.process_messages("snapdb", [&](ed::message & msg)
+            {
+                return !congested() && send(msg);
+            });
+        CATCH_REQUIRE(queue == std::vector<std::string>({ "CMD0", "CMD1" }));
+        CATCH_REQUIRE(c.size("snapdb") == 3);
+
+        // without the congestion check, the messages get cached again
+        // but the replay still ends and nothing gets lost
+        //
+        c.process_messages("snapdb", send);
+        CATCH_REQUIRE(queue.size() == 2);
+        CATCH_REQUIRE(c.size("snapdb") == 3);
+
+        // once the connection caught up, the rest is sent in order
+        //
+        queue.clear();
+        c.process_messages("snapdb", [&](ed::message & msg)
+            {
+                return !congested() && send(msg);
+            });
+        CATCH_REQUIRE(queue == std::vector<std::string>({ "CMD2", "CMD3" }));
+        CATCH_REQUIRE(c.size("snapdb") == 1);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("cache: total limit and expiration")
+    {
+        communicator_daemon::cache c;
+        c.set_limits(2, 0, 0, 0);
+
+        ed::message a(create_message("a", "PING"));
+        ed::message b(create_message("b", "PING"));
+        ed::message d(create_message("c", "PING"));
+        c.cache_message(a);
+        c.cache_message(b);
+        c.cache_message(d);
+        CATCH_REQUIRE(c.size() == 2);
+        CATCH_REQUIRE(c.size("a") == 0);
+        CATCH_REQUIRE(c.get_next_timeout() > 0);
+
+        // the default TTL is 60 seconds
+        //
+        c.remove_old_messages(time(nullptr) + 61);
+        CATCH_REQUIRE(c.size() == 0);
+        CATCH_REQUIRE(c.get_next_timeout() == -1);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("cache: one message per service")
+    {
+        communicator_daemon::cache c;
+        c.set_limits(0, 0, 1, 0);
+
+        // each new message empties the bucket, which gets removed
+        //
+        for(int i(0); i < 5; ++i)
+        {
+            ed::message msg(create_message("monster", "CMD" + std::to_string(i)));
+            CATCH_REQUIRE(c.cache_message(msg) == communicator_daemon::cache_message_t::CACHE_MESSAGE_CACHED);
+            CATCH_REQUIRE(c.size("monster") == 1);
+        }
+        CATCH_REQUIRE(c.size() == 1);
+        CATCH_REQUIRE(c.get_evicted() == 4);
+
+        std::vector<std::string> commands;
+        c.process_messages("monster", [&commands](ed::message & msg)
+            {
+                commands.push_back(msg.get_command());
+                return true;
+            });
+        CATCH_REQUIRE(commands == std::vector<std::string>({ "CMD4" }));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("cache: service byte limit empties the bucket")
+    {
+        ed::message large(create_message("logger", "LOG"));
+        large.add_parameter("data", std::string(100, 'x'));
+        std::size_t const size(large.to_message().length());
+
+        communicator_daemon::cache c;
+        c.set_limits(0, 0, 0, size + size / 2);
+
+        for(int i(0); i < 3; ++i)
+        {
+            ed::message msg(large);
+            CATCH_REQUIRE(c.cache_message(msg) == communicator_daemon::cache_message_t::CACHE_MESSAGE_CACHED);
+            CATCH_REQUIRE(c.size("logger") == 1);
+        }
+        CATCH_REQUIRE(c.get_evicted() == 2);
+        CATCH_REQUIRE(c.get_bytes() == size);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("cache: total limit reached by the first message of a service")
+    {
+        communicator_daemon::cache c;
+        c.set_limits(2, 0, 0, 0);
+
+        ed::message a1(create_message("a", "FIRST"));
+        ed::message a2(create_message("a", "SECOND"));
+        c.cache_message(a1);
+        c.cache_message(a2);
+        CATCH_REQUIRE(c.size("a") == 2);
+
+        // "b" has no bucket yet; the oldest message of "a" goes
+        //
+        ed::message b(create_message("b", "PING"));
+        CATCH_REQUIRE(c.cache_message(b) == communicator_daemon::cache_message_t::CACHE_MESSAGE_CACHED);
+        CATCH_REQUIRE(c.size() == 2);
+        CATCH_REQUIRE(c.size("a") == 1);
+        CATCH_REQUIRE(c.size("b") == 1);
+        CATCH_REQUIRE(c.get_evicted() == 1);
+
+        std::vector<std::string> commands;
+        c.process_messages("a", [&commands](ed::message & msg)
+            {
+                commands.push_back(msg.get_command());
+                return true;
+            });
+        CATCH_REQUIRE(commands == std::vector<std::string>({ "SECOND" }));
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
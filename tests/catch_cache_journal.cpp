@@ -0,0 +1,144 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the cache journal.
+ *
+ * This file implements tests to verify that the records written by the
+ * background thread of the cache journal are all on disk once the journal
+ * is destroyed and that a compaction keeps the records appended while it
+ * runs.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/cache_journal.h>
+
+
+// C++
+//
+#include    <thread>
+
+
+// C
+//
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
+
+namespace
+{
+
+
+
+communicator_daemon::cache_journal::entry make_entry(std::uint64_t serial)
+{
+    communicator_daemon::cache_journal::entry e;
+    e.f_serial = serial;
+    e.f_timeout_timestamp = 2'000'000'000;
+    e.f_message = "unit_test/PING serial=" + std::to_string(serial);
+    return e;
+}
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("cache_journal", "[cache_journal]")
+{
+    CATCH_START_SECTION("cache_journal: add, remove and recover")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/journal");
+        mkdir(path.c_str(), 0700);
+        std::string const filename(path + "/add-remove.journal");
+        unlink(filename.c_str());
+
+        {
+            communicator_daemon::cache_journal journal(filename);
+            CATCH_REQUIRE(journal.recover().empty());
+            for(std::uint64_t serial(1); serial <= 1'000; ++serial)
+            {
+                journal.add(make_entry(serial));
+                if(serial % 2 == 0)
+                {
+                    journal.remove(serial);
+                }
+            }
+        }
+
+        communicator_daemon::cache_journal journal(filename);
+        communicator_daemon::cache_journal::entry::vector_t const entries(journal.recover());
+        CATCH_REQUIRE(entries.size() == 500);
+        for(std::size_t idx(0); idx < entries.size(); ++idx)
+        {
+            communicator_daemon::cache_journal::entry const expected(make_entry(idx * 2 + 1));
+            CATCH_REQUIRE(entries[idx].f_serial == expected.f_serial);
+            CATCH_REQUIRE(entries[idx].f_timeout_timestamp == expected.f_timeout_timestamp);
+            CATCH_REQUIRE(entries[idx].f_message == expected.f_message);
+        }
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("cache_journal: records added during a compaction are kept")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/journal");
+        mkdir(path.c_str(), 0700);
+        std::string const filename(path + "/compaction.journal");
+        unlink(filename.c_str());
+
+        {
+            communicator_daemon::cache_journal journal(filename);
+            CATCH_REQUIRE(journal.recover().empty());
+            communicator_daemon::cache_journal::entry::vector_t live;
+            for(std::uint64_t serial(1); serial <= 100; ++serial)
+            {
+                live.push_back(make_entry(serial));
+                journal.add(live.back());
+            }
+            journal.compact(std::move(live));
+            journal.add(make_entry(101));
+            journal.remove(50);
+            while(journal.is_compacting())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            journal.add(make_entry(102));
+        }
+
+        communicator_daemon::cache_journal journal(filename);
+        communicator_daemon::cache_journal::entry::vector_t const entries(journal.recover());
+        CATCH_REQUIRE(entries.size() == 101);
+        CATCH_REQUIRE(entries[48].f_serial == 49);
+        CATCH_REQUIRE(entries[49].f_serial == 51);
+        CATCH_REQUIRE(entries[99].f_serial == 101);
+        CATCH_REQUIRE(entries[100].f_serial == 102);
+        CATCH_REQUIRE(entries[100].f_message == make_entry(102).f_message);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,140 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/** \file
+ * \brief Verify the clock offset estimator.
+ *
+ * This file implements tests to verify that the offset and RTT are
+ * computed from the NTP timestamps and that the sample with the
+ * smallest RTT is selected.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/clock_offset.h>
+
+
+
+CATCH_TEST_CASE("clock_offset", "[clock_offset]")
+{
+    CATCH_START_SECTION("clock_offset: echo of the last timestamps")
+    {
+        communicator_daemon::clock_offset offset;
+        std::int64_t peer_sent(0);
+        std::int64_t received(0);
+        CATCH_REQUIRE_FALSE(offset.get_echo(peer_sent, received));
+        CATCH_REQUIRE_FALSE(offset.has_estimate());
+        CATCH_REQUIRE_FALSE(offset.is_skewed());
+
+        offset.received(1'000'000'000LL, 1'000'500'000LL);
+        CATCH_REQUIRE(offset.get_echo(peer_sent, received));
+        CATCH_REQUIRE(peer_sent == 1'000'000'000LL);
+        CATCH_REQUIRE(received == 1'000'500'000LL);
+
+        offset.reset();
+        CATCH_REQUIRE_FALSE(offset.get_echo(peer_sent, received));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("clock_offset: offset and rtt of a sample")
+    {
+        communicator_daemon::clock_offset offset;
+
+        // the peer is 5 seconds ahead, each way takes 10ms and the peer
+        // replies 200ms after receiving our message
+        //
+        std::int64_t const t1(1'000'000'000LL);
+        std::int64_t const t2(t1 + 5'000'000 + 10'000);
+        std::int64_t const t3(t2 + 200'000);
+        std::int64_t const t4(t1 + 10'000 + 200'000 + 10'000);
+        CATCH_REQUIRE(offset.sample(t1, t2, t3, t4));
+        CATCH_REQUIRE(offset.has_estimate());
+        CATCH_REQUIRE(offset.size() == 1);
+        CATCH_REQUIRE(offset.get_offset() == 5'000'000);
+        CATCH_REQUIRE(offset.get_rtt() == 20'000);
+        CATCH_REQUIRE(offset.to_local(t3) == t3 - 5'000'000);
+        CATCH_REQUIRE(offset.is_skewed());
+        CATCH_REQUIRE_FALSE(offset.is_skewed(5'000'000));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("clock_offset: smallest rtt wins")
+    {
+        communicator_daemon::clock_offset offset(4);
+
+        // asymmetric delays make the offset wrong, the sample with the
+        // smallest rtt is the most accurate
+        //
+        std::int64_t t1(1'000'000'000LL);
+        CATCH_REQUIRE(offset.sample(t1, t1 + 300'000, t1 + 300'000, t1 + 320'000));
+        CATCH_REQUIRE(offset.get_offset() == 140'000);
+        t1 += 1'000'000;
+        CATCH_REQUIRE(offset.sample(t1, t1 + 10'000, t1 + 10'000, t1 + 20'000));
+        CATCH_REQUIRE(offset.get_offset() == 0);
+        CATCH_REQUIRE(offset.get_rtt() == 20'000);
+        t1 += 1'000'000;
+        CATCH_REQUIRE(offset.sample(t1, t1 + 100'000, t1 + 100'000, t1 + 120'000 + 100'000));
+        CATCH_REQUIRE(offset.get_offset() == 0);
+        CATCH_REQUIRE(offset.size() == 3);
+
+        // the best sample goes out of the window
+        //
+        for(int i(0); i < 4; ++i)
+        {
+            t1 += 1'000'000;
+            CATCH_REQUIRE(offset.sample(t1, t1 + 50'000, t1 + 50'000, t1 + 60'000 + i * 1'000));
+        }
+        CATCH_REQUIRE(offset.size() == 4);
+        CATCH_REQUIRE(offset.get_rtt() == 60'000);
+        CATCH_REQUIRE(offset.get_offset() == 20'000);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("clock_offset: invalid samples are ignored")
+    {
+        communicator_daemon::clock_offset offset;
+        std::int64_t const t1(1'000'000'000LL);
+
+        // negative rtt: a clock was changed in between
+        //
+        CATCH_REQUIRE_FALSE(offset.sample(t1, t1 + 100'000, t1 + 300'000, t1 + 100'000));
+
+        // rtt too large
+        //
+        CATCH_REQUIRE_FALSE(offset.sample(
+                  t1
+                , t1
+                , t1
+                , t1 + communicator_daemon::clock_offset::MAX_RTT + 1));
+
+        CATCH_REQUIRE_FALSE(offset.has_estimate());
+        CATCH_REQUIRE(offset.get_offset() == 0);
+        CATCH_REQUIRE(offset.to_local(t1) == t1);
+    }
+    CATCH_END_SECTION()
+}
+
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,110 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the command identifiers.
+ *
+ * This file implements tests to verify that the command names get
+ * stable identifiers, that the message definitions can be seeded and
+ * that the names received from other processes are limited.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/command_ids.h>
+
+
+
+CATCH_TEST_CASE("command_ids", "[command]")
+{
+    CATCH_START_SECTION("command_ids: known commands")
+    {
+        communicator_daemon::command_id_t const register_id(communicator_daemon::find_command("REGISTER"));
+        CATCH_REQUIRE(register_id != communicator_daemon::COMMAND_ID_UNKNOWN);
+        CATCH_REQUIRE(communicator_daemon::intern_command("REGISTER") == register_id);
+        CATCH_REQUIRE(communicator_daemon::seed_command("REGISTER") == register_id);
+        CATCH_REQUIRE(communicator_daemon::command_name(register_id) == "REGISTER");
+
+        CATCH_REQUIRE(communicator_daemon::find_command("COMMAND_IDS_NEVER_SEEN") == communicator_daemon::COMMAND_ID_UNKNOWN);
+        CATCH_REQUIRE(communicator_daemon::command_name(communicator_daemon::COMMAND_ID_UNKNOWN).empty());
+
+        std::size_t const count(communicator_daemon::command_count());
+        communicator_daemon::command_id_t const id(communicator_daemon::intern_command("COMMAND_IDS_NEW"));
+        CATCH_REQUIRE(id == count);
+        CATCH_REQUIRE(communicator_daemon::command_count() == count + 1);
+        CATCH_REQUIRE(communicator_daemon::find_command("COMMAND_IDS_NEW") == id);
+        CATCH_REQUIRE(communicator_daemon::intern_command("COMMAND_IDS_NEW") == id);
+        CATCH_REQUIRE(communicator_daemon::command_name(id) == "COMMAND_IDS_NEW");
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("command_ids: seed the message definitions")
+    {
+        std::size_t const dynamic(communicator_daemon::dynamic_command_count());
+        CATCH_REQUIRE(communicator_daemon::seed_commands(
+                  SNAP_CATCH2_NAMESPACE::g_source_dir() + "/tests/message-definitions:"
+                + SNAP_CATCH2_NAMESPACE::g_source_dir() + "/tests/no-such-directory") == 1);
+        CATCH_REQUIRE(communicator_daemon::find_command("DATA") != communicator_daemon::COMMAND_ID_UNKNOWN);
+        CATCH_REQUIRE(communicator_daemon::dynamic_command_count() == dynamic);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("command_ids: the dynamic commands are limited")
+    {
+        std::size_t const dynamic(communicator_daemon::dynamic_command_count());
+        communicator_daemon::set_dynamic_command_limit(dynamic + 2);
+
+        communicator_daemon::command_id_t const first(communicator_daemon::intern_command("COMMAND_IDS_LIMIT_1"));
+        communicator_daemon::command_id_t const second(communicator_daemon::intern_command("COMMAND_IDS_LIMIT_2"));
+        CATCH_REQUIRE(first != communicator_daemon::COMMAND_ID_UNKNOWN);
+        CATCH_REQUIRE(second != communicator_daemon::COMMAND_ID_UNKNOWN);
+        CATCH_REQUIRE(communicator_daemon::dynamic_command_count() == dynamic + 2);
+
+        // the limit is reached, new names do not get an identifier
+        //
+        std::size_t const count(communicator_daemon::command_count());
+        CATCH_REQUIRE(communicator_daemon::intern_command("COMMAND_IDS_LIMIT_3") == communicator_daemon::COMMAND_ID_UNKNOWN);
+        CATCH_REQUIRE(communicator_daemon::find_command("COMMAND_IDS_LIMIT_3") == communicator_daemon::COMMAND_ID_UNKNOWN);
+        CATCH_REQUIRE(communicator_daemon::command_count() == count);
+        CATCH_REQUIRE(communicator_daemon::dynamic_command_count() == dynamic + 2);
+
+        // names which already have an identifier still work
+        //
+        CATCH_REQUIRE(communicator_daemon::intern_command("COMMAND_IDS_LIMIT_1") == first);
+        CATCH_REQUIRE(communicator_daemon::intern_command("REGISTER") == communicator_daemon::find_command("REGISTER"));
+
+        // and trusted names are not limited
+        //
+        communicator_daemon::command_id_t const seeded(communicator_daemon::seed_command("COMMAND_IDS_LIMIT_SEEDED"));
+        CATCH_REQUIRE(seeded == count);
+        CATCH_REQUIRE(communicator_daemon::intern_command("COMMAND_IDS_LIMIT_SEEDED") == seeded);
+        CATCH_REQUIRE(communicator_daemon::dynamic_command_count() == dynamic + 2);
+
+        communicator_daemon::set_dynamic_command_limit(communicator_daemon::DEFAULT_DYNAMIC_COMMAND_LIMIT);
+        CATCH_REQUIRE(communicator_daemon::intern_command("COMMAND_IDS_LIMIT_3") != communicator_daemon::COMMAND_ID_UNKNOWN);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -25,6 +25,7 @@
 
 // communicatord
 //
+#include    <communicatord/cache_parameter.h>
 #include    <communicatord/communicator.h>
 #include    <communicatord/exception.h>
 #include    <communicatord/version.h>
@@ -335,6 +336,50 @@ private:
 };
 
 
+/** \brief Create a messenger connected to \p listen.
+ *
+ * The messenger is not added to the ed::communicator and no event loop
+ * runs so the tests can call the functions used internally by the
+ * connection (process_response(), flush_outbound_queue(), etc.) by hand.
+ *
+ * \param[in] opts  The options used by the messenger.
+ * \param[in] listen  The URI of the communicator daemon.
+ *
+ * \return The new messenger with its communicatord connection.
+ */
+test_messenger::pointer_t create_messenger(
+      advgetopt::getopt & opts
+    , std::string const & listen)
+{
+    std::vector<std::string> const args = {
+        "test-service", // name of command
+        "--communicatord-listen",
+        listen,
+        "--path-to-message-definitions",
+        SNAP_CATCH2_NAMESPACE::g_source_dir() + "/tests/message-definitions:"
+            + SNAP_CATCH2_NAMESPACE::g_source_dir() + "/daemon/message-definitions:"
+            + SNAP_CATCH2_NAMESPACE::g_dist_dir() + "/share/eventdispatcher/messages",
+    };
+
+    std::vector<char const *> args_strings;
+    args_strings.reserve(args.size() + 1);
+    for(auto const & arg : args)
+    {
+        args_strings.push_back(arg.c_str());
+    }
+    args_strings.push_back(nullptr); // NULL terminated
+
+    test_messenger::pointer_t messenger(std::make_shared<test_messenger>(
+              opts
+            , args.size()
+            , const_cast<char **>(args_strings.data())
+            , test_messenger::sequence_t::SEQUENCE_SUCCESS));
+    messenger->process_communicatord_options();
+
+    return messenger;
+}
+
+
 
 } // no name namespace
 
@@ -363,6 +408,444 @@ CATCH_TEST_CASE("communicator", "[client]")
         CATCH_REQUIRE(msg.get_parameter("transmission_report") == "failure");
     }
     CATCH_END_SECTION()
+
+    CATCH_START_SECTION("communicator: verify request_trace() and get_trace()")
+    {
+        ed::message msg;
+        CATCH_REQUIRE(communicatord::get_trace(msg).empty());
+        communicatord::request_trace(msg);
+        CATCH_REQUIRE(msg.has_parameter("trace"));
+        CATCH_REQUIRE(communicatord::get_trace(msg).empty());
+
+        msg.add_parameter("trace", "alpha:1000:1050,bad:12,beta:2000:x,gamma:3000:3007:-25,delta:4000:4001:y");
+        communicatord::trace_t const trace(communicatord::get_trace(msg));
+        CATCH_REQUIRE(trace.size() == 2);
+        CATCH_REQUIRE(trace[0].f_node == "alpha");
+        CATCH_REQUIRE(trace[0].f_received == 1000);
+        CATCH_REQUIRE(trace[0].f_sent == 1050);
+        CATCH_REQUIRE(trace[0].f_offset == 0);
+        CATCH_REQUIRE(trace[1].f_node == "gamma");
+        CATCH_REQUIRE(trace[1].f_received == 3000);
+        CATCH_REQUIRE(trace[1].f_sent == 3007);
+        CATCH_REQUIRE(trace[1].f_offset == -25);
+    }
+    CATCH_END_SECTION()
+}
+
+
+CATCH_TEST_CASE("communicator_request", "[client]")
+{
+    CATCH_START_SECTION("communicator_request: the reply is routed to the callback of its request")
+    {
+        // the UDP connection is always considered connected so the
+        // requests get sent without a daemon
+        //
+        advgetopt::getopt opts(g_options_environment);
+        test_messenger::pointer_t messenger(create_messenger(opts, "cdu://127.0.0.1:20003"));
+        CATCH_REQUIRE(messenger->is_connected());
+
+        int first_count(0);
+        communicatord::response_status_t first_status(communicatord::response_status_t::RESPONSE_STATUS_TIMEOUT);
+        std::string first_command;
+        ed::message first;
+        first.set_command("FIRST_REQUEST");
+        first.set_service("responder");
+        communicatord::correlation_id_t const first_id(messenger->send_request(
+              first
+            , [&first_count, &first_status, &first_command](communicatord::response_status_t status, ed::message & msg)
+            {
+                ++first_count;
+                first_status = status;
+                first_command = msg.get_command();
+            }));
+        CATCH_REQUIRE(first_id != 0);
+        CATCH_REQUIRE(first.has_parameter("correlation_id"));
+        CATCH_REQUIRE(first.get_parameter("transmission_report") == "failure");
+
+        int second_count(0);
+        communicatord::response_status_t second_status(communicatord::response_status_t::RESPONSE_STATUS_TIMEOUT);
+        std::string second_command;
+        ed::message second;
+        second.set_command("SECOND_REQUEST");
+        second.set_service("responder");
+        communicatord::correlation_id_t const second_id(messenger->send_request(
+              second
+            , [&second_count, &second_status, &second_command](communicatord::response_status_t status, ed::message & msg)
+            {
+                ++second_count;
+                second_status = status;
+                second_command = msg.get_command();
+            }));
+        CATCH_REQUIRE(second_id != 0);
+        CATCH_REQUIRE(second_id != first_id);
+        CATCH_REQUIRE(second.get_parameter("correlation_id") != first.get_parameter("correlation_id"));
+        CATCH_REQUIRE(messenger->pending_requests() == 2);
+
+        // messages which are not replies to our requests are left alone
+        //
+        ed::message unrelated;
+        unrelated.set_command("UNRELATED");
+        CATCH_REQUIRE_FALSE(messenger->process_response(unrelated));
+        unrelated.add_parameter("correlation_id", "another_service-1-" + std::to_string(second_id));
+        CATCH_REQUIRE_FALSE(messenger->process_response(unrelated));
+
+        // reply to the second request first
+        //
+        ed::message second_reply;
+        second_reply.set_command("SECOND_REPLY");
+        communicatord::copy_correlation_id(second, second_reply);
+        CATCH_REQUIRE(messenger->process_response(second_reply));
+        CATCH_REQUIRE(first_count == 0);
+        CATCH_REQUIRE(second_count == 1);
+        CATCH_REQUIRE(second_status == communicatord::response_status_t::RESPONSE_STATUS_REPLY);
+        CATCH_REQUIRE(second_command == "SECOND_REPLY");
+        CATCH_REQUIRE(messenger->pending_requests() == 1);
+
+        // a "cached" report does not end the request
+        //
+        ed::message cached;
+        cached.set_command("TRANSMISSION_REPORT");
+        cached.add_parameter("status", "cached");
+        communicatord::copy_correlation_id(first, cached);
+        CATCH_REQUIRE(messenger->process_response(cached));
+        CATCH_REQUIRE(first_count == 0);
+        CATCH_REQUIRE(messenger->pending_requests() == 1);
+
+        ed::message failed;
+        failed.set_command("TRANSMISSION_REPORT");
+        failed.add_parameter("status", "failed");
+        communicatord::copy_correlation_id(first, failed);
+        CATCH_REQUIRE(messenger->process_response(failed));
+        CATCH_REQUIRE(first_count == 1);
+        CATCH_REQUIRE(first_status == communicatord::response_status_t::RESPONSE_STATUS_FAILED);
+        CATCH_REQUIRE(first_command == "TRANSMISSION_REPORT");
+        CATCH_REQUIRE(second_count == 1);
+        CATCH_REQUIRE(messenger->pending_requests() == 0);
+
+        messenger->stop(true);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("communicator_request: a timeout fires once and a late reply is ignored")
+    {
+        advgetopt::getopt opts(g_options_environment);
+        test_messenger::pointer_t messenger(create_messenger(opts, "cdu://127.0.0.1:20003"));
+
+        int count(0);
+        communicatord::response_status_t last_status(communicatord::response_status_t::RESPONSE_STATUS_REPLY);
+        std::string last_command;
+        ed::message request;
+        request.set_command("SLOW_REQUEST");
+        request.set_service("responder");
+        CATCH_REQUIRE(messenger->send_request(
+              request
+            , [&count, &last_status, &last_command](communicatord::response_status_t status, ed::message & msg)
+            {
+                ++count;
+                last_status = status;
+                last_command = msg.get_command();
+            }
+            , 0) != 0);
+
+        // a request which did not yet time out is not affected
+        //
+        ed::message other;
+        other.set_command("OTHER_REQUEST");
+        other.set_service("responder");
+        int other_count(0);
+        communicatord::correlation_id_t const other_id(messenger->send_request(
+              other
+            , [&other_count](communicatord::response_status_t, ed::message &)
+            {
+                ++other_count;
+            }));
+        CATCH_REQUIRE(other_id != 0);
+        CATCH_REQUIRE(messenger->pending_requests() == 2);
+
+        messenger->process_request_timeouts();
+        CATCH_REQUIRE(count == 1);
+        CATCH_REQUIRE(last_status == communicatord::response_status_t::RESPONSE_STATUS_TIMEOUT);
+        CATCH_REQUIRE(last_command == "SLOW_REQUEST");
+        CATCH_REQUIRE(other_count == 0);
+        CATCH_REQUIRE(messenger->pending_requests() == 1);
+
+        messenger->process_request_timeouts();
+        CATCH_REQUIRE(count == 1);
+
+        // the reply arrives after the timeout: it is swallowed and the
+        // callback does not get called a second time
+        //
+        ed::message late_reply;
+        late_reply.set_command("SLOW_REPLY");
+        communicatord::copy_correlation_id(request, late_reply);
+        CATCH_REQUIRE(messenger->process_response(late_reply));
+        CATCH_REQUIRE(count == 1);
+        CATCH_REQUIRE(last_status == communicatord::response_status_t::RESPONSE_STATUS_TIMEOUT);
+        CATCH_REQUIRE(other_count == 0);
+
+        // a canceled request behaves the same way
+        //
+        CATCH_REQUIRE(messenger->cancel_request(other_id));
+        CATCH_REQUIRE_FALSE(messenger->cancel_request(other_id));
+        CATCH_REQUIRE(messenger->pending_requests() == 0);
+        ed::message canceled_reply;
+        canceled_reply.set_command("OTHER_REPLY");
+        communicatord::copy_correlation_id(other, canceled_reply);
+        CATCH_REQUIRE(messenger->process_response(canceled_reply));
+        CATCH_REQUIRE(other_count == 0);
+
+        messenger->stop(true);
+    }
+    CATCH_END_SECTION()
+}
+
+
+CATCH_TEST_CASE("communicator_cluster_status", "[client]")
+{
+    CATCH_START_SECTION("communicator_cluster_status: the status is cached and the callback called on changes only")
+    {
+        advgetopt::getopt opts(g_options_environment);
+        communicatord::communicator::pointer_t c(std::make_shared<communicatord::communicator>(opts, "test_communicator_client"));
+        CATCH_REQUIRE_FALSE(c->get_cluster_status().f_known);
+
+        int count(0);
+        communicatord::cluster_status last;
+        c->set_cluster_status_callback([&count, &last](communicatord::cluster_status const & status)
+            {
+                ++count;
+                last = status;
+            });
+
+        ed::message msg;
+        msg.set_command("CLUSTER_CURRENT_STATUS");
+        msg.add_parameter("status", "down");
+        msg.add_parameter("complete", "false");
+        msg.add_parameter("neighbors_count", 3);
+
+        // the first message always changes the status since it was unknown
+        //
+        c->msg_cluster_current_status(msg);
+        CATCH_REQUIRE(count == 1);
+        CATCH_REQUIRE(last.f_known);
+        CATCH_REQUIRE(c->get_cluster_status().f_known);
+        CATCH_REQUIRE_FALSE(c->get_cluster_status().f_up);
+        CATCH_REQUIRE_FALSE(c->get_cluster_status().f_complete);
+        CATCH_REQUIRE(c->get_cluster_status().f_neighbors_count == 3);
+
+        // repeats do not call the callback
+        //
+        c->msg_cluster_current_status(msg);
+        c->msg_cluster_current_status(msg);
+        CATCH_REQUIRE(count == 1);
+
+        msg.add_parameter("status", "up");
+        c->msg_cluster_current_status(msg);
+        CATCH_REQUIRE(count == 2);
+        CATCH_REQUIRE(last.f_up);
+        CATCH_REQUIRE_FALSE(last.f_complete);
+        CATCH_REQUIRE(c->get_cluster_status().f_up);
+        c->msg_cluster_current_status(msg);
+        CATCH_REQUIRE(count == 2);
+
+        msg.add_parameter("complete", "true");
+        c->msg_cluster_current_status(msg);
+        CATCH_REQUIRE(count == 3);
+        CATCH_REQUIRE(last.f_complete);
+        CATCH_REQUIRE(c->get_cluster_status().f_complete);
+
+        msg.add_parameter("neighbors_count", 4);
+        c->msg_cluster_current_status(msg);
+        CATCH_REQUIRE(count == 4);
+        CATCH_REQUIRE(last.f_neighbors_count == 4);
+        CATCH_REQUIRE(c->get_cluster_status().f_neighbors_count == 4);
+        c->msg_cluster_current_status(msg);
+        CATCH_REQUIRE(count == 4);
+
+        // without a callback the status is still cached
+        //
+        c->set_cluster_status_callback(nullptr);
+        msg.add_parameter("status", "down");
+        c->msg_cluster_current_status(msg);
+        CATCH_REQUIRE(count == 4);
+        CATCH_REQUIRE_FALSE(c->get_cluster_status().f_up);
+        CATCH_REQUIRE(c->get_cluster_status().f_complete);
+        CATCH_REQUIRE(c->get_cluster_status().f_neighbors_count == 4);
+    }
+    CATCH_END_SECTION()
+}
+
+
+CATCH_TEST_CASE("communicator_outbound_queue", "[client]")
+{
+    CATCH_START_SECTION("communicator_outbound_queue: parse the cache parameter")
+    {
+        ed::message msg;
+        msg.set_command("CACHED");
+        communicatord::cache_parameter p(communicatord::parse_cache_parameter(msg));
+        CATCH_REQUIRE_FALSE(p.f_no_cache);
+        CATCH_REQUIRE_FALSE(p.f_reply);
+        CATCH_REQUIRE(p.f_ttl == communicatord::DEFAULT_CACHE_TTL);
+
+        msg.add_parameter("cache", "no");
+        p = communicatord::parse_cache_parameter(msg);
+        CATCH_REQUIRE(p.f_no_cache);
+        CATCH_REQUIRE_FALSE(p.f_reply);
+
+        msg.add_parameter("cache", "reply;;ttl=5m");
+        p = communicatord::parse_cache_parameter(msg);
+        CATCH_REQUIRE_FALSE(p.f_no_cache);
+        CATCH_REQUIRE(p.f_reply);
+        CATCH_REQUIRE(p.f_ttl == 300);
+
+        // invalid and out of range TTLs fall back to the default
+        //
+        for(auto const & ttl : { "ttl=5", "ttl=86401", "ttl=soon", "ttl", "=no" })
+        {
+            msg.add_parameter("cache", ttl);
+            p = communicatord::parse_cache_parameter(msg);
+            CATCH_REQUIRE_FALSE(p.f_no_cache);
+            CATCH_REQUIRE(p.f_ttl == communicatord::DEFAULT_CACHE_TTL);
+        }
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("communicator_outbound_queue: the count limit drops the oldest messages")
+    {
+        // nothing listens on that port and the event loop does not run
+        // so the connection remains down
+        //
+        advgetopt::getopt opts(g_options_environment);
+        test_messenger::pointer_t messenger(create_messenger(opts, "cd://127.0.0.1:20004"));
+        CATCH_REQUIRE_FALSE(messenger->is_connected());
+
+        ed::message msg;
+        msg.set_command("QUEUED");
+        msg.set_service("communicator_test");
+
+        // by default the queue is disabled
+        //
+        CATCH_REQUIRE_FALSE(messenger->send_message(msg));
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 0);
+
+        messenger->set_outbound_queue_limits(3, 0);
+        for(int i(0); i < 5; ++i)
+        {
+            CATCH_REQUIRE(messenger->send_message(msg));
+        }
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 3);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 2);
+
+        // lowering the limit applies immediately
+        //
+        messenger->set_outbound_queue_limits(2, 0);
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 2);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 3);
+
+        // disabling the queue drops everything
+        //
+        messenger->set_outbound_queue_limits(0, 0);
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 0);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 5);
+        CATCH_REQUIRE_FALSE(messenger->send_message(msg));
+
+        messenger->stop(true);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("communicator_outbound_queue: the byte limit and messages too large to be queued")
+    {
+        advgetopt::getopt opts(g_options_environment);
+        test_messenger::pointer_t messenger(create_messenger(opts, "cd://127.0.0.1:20004"));
+
+        ed::message msg;
+        msg.set_command("QUEUED");
+        msg.set_service("communicator_test");
+        msg.set_sent_from_service("test_communicator_client");
+        msg.add_parameter("data", std::string(100, 'x'));
+        std::size_t const size(msg.to_message().length());
+
+        messenger->set_outbound_queue_limits(0, size * 2 + size / 2);
+        CATCH_REQUIRE(messenger->send_message(msg));
+        CATCH_REQUIRE(messenger->send_message(msg));
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 2);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 0);
+        CATCH_REQUIRE(messenger->send_message(msg));
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 2);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 1);
+
+        // a message larger than the whole queue is refused and the
+        // messages already queued are kept
+        //
+        ed::message large(msg);
+        large.add_parameter("data", std::string(size * 3, 'x'));
+        CATCH_REQUIRE_FALSE(messenger->send_message(large));
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 2);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 2);
+
+        messenger->stop(true);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("communicator_outbound_queue: cache=no messages are not queued")
+    {
+        advgetopt::getopt opts(g_options_environment);
+        test_messenger::pointer_t messenger(create_messenger(opts, "cd://127.0.0.1:20004"));
+        messenger->set_outbound_queue_limits(10, 0);
+
+        ed::message msg;
+        msg.set_command("QUEUED");
+        msg.set_service("communicator_test");
+        CATCH_REQUIRE(messenger->send_message(msg));
+
+        ed::message no_cache(msg);
+        no_cache.add_parameter("cache", "no");
+        CATCH_REQUIRE_FALSE(messenger->send_message(no_cache));
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 1);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 0);
+
+        messenger->stop(true);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("communicator_outbound_queue: messages with an expired TTL are dropped on flush")
+    {
+        advgetopt::getopt opts(g_options_environment);
+        test_messenger::pointer_t messenger(create_messenger(opts, "cd://127.0.0.1:20004"));
+        messenger->set_outbound_queue_limits(10, 0);
+
+        ed::message short_ttl;
+        short_ttl.set_command("QUEUED");
+        short_ttl.set_service("communicator_test");
+        short_ttl.add_parameter("cache", "ttl=10");
+        ed::message long_ttl(short_ttl);
+        long_ttl.add_parameter("cache", "ttl=2m");
+
+        CATCH_REQUIRE(messenger->send_message(short_ttl));
+        CATCH_REQUIRE(messenger->send_message(long_ttl));
+        CATCH_REQUIRE(messenger->send_message(short_ttl));
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 3);
+
+        // nothing timed out yet and sending still fails: all are kept
+        //
+        messenger->flush_outbound_queue();
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 3);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 0);
+
+        // the first message timed out; the second one is still valid
+        // and since it cannot be sent, it and the messages after it
+        // stay queued (in order)
+        //
+        messenger->flush_outbound_queue(time(nullptr) + 61);
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 2);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 1);
+
+        messenger->flush_outbound_queue(time(nullptr) + 121);
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 0);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 3);
+
+        messenger->stop(true);
+    }
+    CATCH_END_SECTION()
 }
 
 
@@ -505,6 +988,64 @@ CATCH_TEST_CASE("communicator_client_connection", "[client]")
         CATCH_REQUIRE(s->get_exit_code() == 0);
     }
     CATCH_END_SECTION()
+
+    CATCH_START_SECTION("communicator_client_connection: queued messages are sent in order on READY")
+    {
+        std::string const source_dir(SNAP_CATCH2_NAMESPACE::g_source_dir());
+        std::string const filename(source_dir + "/tests/rprtr/communicator_queue_test.rprtr");
+        SNAP_CATCH2_NAMESPACE::reporter::lexer::pointer_t l(SNAP_CATCH2_NAMESPACE::reporter::create_lexer(filename));
+        CATCH_REQUIRE(l != nullptr);
+        SNAP_CATCH2_NAMESPACE::reporter::state::pointer_t s(std::make_shared<SNAP_CATCH2_NAMESPACE::reporter::state>());
+        SNAP_CATCH2_NAMESPACE::reporter::parser::pointer_t p(std::make_shared<SNAP_CATCH2_NAMESPACE::reporter::parser>(l, s));
+        p->parse_program();
+
+        SNAP_CATCH2_NAMESPACE::reporter::executor::pointer_t e(std::make_shared<SNAP_CATCH2_NAMESPACE::reporter::executor>(s));
+        e->start();
+
+        addr::addr a(get_address());
+        advgetopt::getopt opts(g_options_environment);
+        test_messenger::pointer_t messenger(create_messenger(
+                  opts
+                , "cd://" + a.to_ipv4or6_string(addr::STRING_IP_ADDRESS_PORT)));
+        CATCH_REQUIRE_FALSE(messenger->is_connected());
+
+        // queue messages before the connection exists; the one with
+        // cache=no is refused and must not show up on the other side
+        //
+        messenger->set_outbound_queue_limits(10, 0);
+        for(int i(1); i <= 3; ++i)
+        {
+            ed::message msg;
+            msg.set_command("QUEUED");
+            msg.set_service("communicator_test");
+            msg.add_parameter("order", i);
+            CATCH_REQUIRE(messenger->send_message(msg));
+
+            ed::message no_cache(msg);
+            no_cache.set_command("NOT_QUEUED");
+            no_cache.add_parameter("cache", "no");
+            CATCH_REQUIRE_FALSE(messenger->send_message(no_cache));
+        }
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 3);
+
+        ed::communicator::instance()->add_connection(messenger);
+        test_timer::pointer_t timer(std::make_shared<test_timer>(messenger));
+        ed::communicator::instance()->add_connection(timer);
+        messenger->set_timer(timer);
+
+        e->set_thread_done_callback([messenger, timer]()
+            {
+                ed::communicator::instance()->remove_connection(messenger);
+                ed::communicator::instance()->remove_connection(timer);
+            });
+
+        CATCH_REQUIRE(e->run());
+
+        CATCH_REQUIRE(s->get_exit_code() == 0);
+        CATCH_REQUIRE(messenger->outbound_queue_size() == 0);
+        CATCH_REQUIRE(messenger->outbound_queue_dropped() == 0);
+    }
+    CATCH_END_SECTION()
 }
 
 
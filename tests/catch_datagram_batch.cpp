@@ -0,0 +1,105 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the datagram_batch class.
+ *
+ * This file implements tests to verify that datagrams are read in
+ * batches and that truncated datagrams get counted.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/datagram_batch.h>
+
+
+// C
+//
+#include    <netinet/in.h>
+#include    <unistd.h>
+
+
+
+CATCH_TEST_CASE("datagram_batch", "[datagram_batch]")
+{
+    CATCH_START_SECTION("datagram_batch: read a burst in batches")
+    {
+        int const server(socket(AF_INET, SOCK_DGRAM, 0));
+        CATCH_REQUIRE(server >= 0);
+        sockaddr_in a = {};
+        a.sin_family = AF_INET;
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CATCH_REQUIRE(bind(server, reinterpret_cast<sockaddr *>(&a), sizeof(a)) == 0);
+        socklen_t length(sizeof(a));
+        CATCH_REQUIRE(getsockname(server, reinterpret_cast<sockaddr *>(&a), &length) == 0);
+        CATCH_REQUIRE(communicator_daemon::datagram_batch::enable_drop_counter(server));
+
+        int const client(socket(AF_INET, SOCK_DGRAM, 0));
+        CATCH_REQUIRE(client >= 0);
+        for(int i(0); i < 10; ++i)
+        {
+            std::string const msg("PING n=" + std::to_string(i));
+            CATCH_REQUIRE(sendto(client, msg.data(), msg.length(), 0, reinterpret_cast<sockaddr *>(&a), sizeof(a)) == static_cast<ssize_t>(msg.length()));
+        }
+        std::string const large(200, 'x');
+        CATCH_REQUIRE(sendto(client, large.data(), large.length(), 0, reinterpret_cast<sockaddr *>(&a), sizeof(a)) == static_cast<ssize_t>(large.length()));
+
+        communicator_daemon::datagram_batch batch(4, 100);
+        int count(0);
+        for(;;)
+        {
+            int const r(batch.receive(server));
+            CATCH_REQUIRE(r >= 0);
+            if(r == 0)
+            {
+                break;
+            }
+            CATCH_REQUIRE(r <= 4);
+            for(std::size_t idx(0); idx < batch.size(); ++idx, ++count)
+            {
+                if(count < 10)
+                {
+                    CATCH_REQUIRE_FALSE(batch.is_truncated(idx));
+                    CATCH_REQUIRE(batch.get_datagram(idx) == "PING n=" + std::to_string(count));
+                }
+                else
+                {
+                    CATCH_REQUIRE(batch.is_truncated(idx));
+                    CATCH_REQUIRE(batch.get_datagram(idx) == std::string(100, 'x'));
+                }
+            }
+        }
+        CATCH_REQUIRE(count == 11);
+        CATCH_REQUIRE(batch.get_received() == 11);
+        CATCH_REQUIRE(batch.get_truncated() == 1);
+        CATCH_REQUIRE(batch.get_dropped() == 0);
+
+        close(client);
+        close(server);
+    }
+    CATCH_END_SECTION()
+}
+
+
+
+// vim: ts=4 sw=4 et
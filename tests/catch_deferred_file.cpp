@@ -0,0 +1,80 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the deferred file.
+ *
+ * This file implements tests to verify that the deferred file writes
+ * its contents atomically and, without an event loop, synchronously.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/deferred_file.h>
+
+
+// snapdev
+//
+#include    <snapdev/file_contents.h>
+
+
+// C
+//
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
+
+CATCH_TEST_CASE("deferred_file", "[deferred_file]")
+{
+    CATCH_START_SECTION("deferred_file: write atomically")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/deferred");
+        mkdir(path.c_str(), 0700);
+        std::string const filename(path + "/neighbors.txt");
+
+        CATCH_REQUIRE(communicator_daemon::deferred_file::write_file(filename, "10.0.0.1:4040\n"));
+        CATCH_REQUIRE(communicator_daemon::deferred_file::write_file(filename, "10.0.0.2:4040\n"));
+
+        snapdev::file_contents in(filename);
+        CATCH_REQUIRE(in.read_all());
+        CATCH_REQUIRE(in.contents() == "10.0.0.2:4040\n");
+
+        // the temporary file was renamed
+        //
+        CATCH_REQUIRE(access((filename + ".tmp").c_str(), F_OK) != 0);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("deferred_file: missing directory")
+    {
+        std::string const filename(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/no-such-directory/neighbors.txt");
+
+        CATCH_REQUIRE_FALSE(communicator_daemon::deferred_file::write_file(filename, "10.0.0.1:4040\n"));
+        CATCH_REQUIRE(access((filename + ".tmp").c_str(), F_OK) != 0);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
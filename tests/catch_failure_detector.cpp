@@ -0,0 +1,120 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the phi-accrual failure detector.
+ *
+ * This file implements tests to verify that phi grows as heartbeats
+ * go missing and that the peer state follows the thresholds.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/failure_detector.h>
+
+
+
+CATCH_TEST_CASE("failure_detector", "[failure_detector]")
+{
+    CATCH_START_SECTION("failure_detector: phi grows without heartbeats")
+    {
+        communicator_daemon::failure_detector detector;
+        CATCH_REQUIRE_FALSE(detector.is_started());
+        CATCH_REQUIRE(detector.phi(1'000'000'000LL) == 0.0);
+
+        std::int64_t now(1'000'000'000LL);
+        detector.start(now, 1'000'000);
+        CATCH_REQUIRE(detector.is_started());
+        for(int i(0); i < 20; ++i)
+        {
+            now += 1'000'000;
+            detector.heartbeat(now);
+        }
+        CATCH_REQUIRE(detector.size() == 22);
+
+        double const on_time(detector.phi(now + 1'000'000));
+        double const late(detector.phi(now + 4'500'000));
+        double const very_late(detector.phi(now + 6'000'000));
+        CATCH_REQUIRE(on_time < 1.0);
+        CATCH_REQUIRE(late > on_time);
+        CATCH_REQUIRE(very_late > late);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("failure_detector: state transitions")
+    {
+        communicator_daemon::failure_detector detector;
+        detector.set_acceptable_pause(0);
+        detector.set_thresholds(3.0, 8.0);
+
+        std::int64_t now(1'000'000'000LL);
+        detector.start(now, 1'000'000);
+        for(int i(0); i < 10; ++i)
+        {
+            now += 1'000'000;
+            detector.heartbeat(now);
+        }
+        CATCH_REQUIRE(detector.evaluate(now + 1'000'000) == communicator_daemon::peer_state_t::PEER_STATE_UP);
+
+        // a little late: suspect, a heartbeat brings the peer back up
+        //
+        std::int64_t t(now + 1'000'000);
+        while(detector.evaluate(t) == communicator_daemon::peer_state_t::PEER_STATE_UP)
+        {
+            t += 10'000;
+        }
+        CATCH_REQUIRE(detector.get_state() == communicator_daemon::peer_state_t::PEER_STATE_SUSPECT);
+        detector.heartbeat(t);
+        CATCH_REQUIRE(detector.evaluate(t + 500'000) == communicator_daemon::peer_state_t::PEER_STATE_UP);
+
+        // much later: down, and it stays down
+        //
+        CATCH_REQUIRE(detector.evaluate(t + 60'000'000) == communicator_daemon::peer_state_t::PEER_STATE_DOWN);
+        detector.heartbeat(t + 60'000'000);
+        CATCH_REQUIRE(detector.evaluate(t + 60'000'001) == communicator_daemon::peer_state_t::PEER_STATE_DOWN);
+
+        detector.reset();
+        CATCH_REQUIRE_FALSE(detector.is_started());
+        CATCH_REQUIRE(detector.get_state() == communicator_daemon::peer_state_t::PEER_STATE_UP);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("failure_detector: bounded history")
+    {
+        communicator_daemon::failure_detector detector(5);
+        std::int64_t now(1'000'000'000LL);
+        detector.start(now, 1'000'000);
+        for(int i(0); i < 10; ++i)
+        {
+            now += 2'000'000;
+            detector.heartbeat(now);
+        }
+        CATCH_REQUIRE(detector.size() == 5);
+        CATCH_REQUIRE(detector.get_mean() == 2'000'000.0);
+        CATCH_REQUIRE(detector.get_stddev() < 1.0);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,241 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the in-memory flag index.
+ *
+ * This file implements tests to verify that the flag index only reloads
+ * the flag files which changed and that the snapshot it saves can be
+ * read back.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <communicatord/flags.h>
+
+
+// C++
+//
+#include    <fstream>
+
+
+// C
+//
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
+
+namespace
+{
+
+
+
+void write_flag(std::string const & path, std::string const & name, std::string const & message)
+{
+    std::ofstream out(path + "/unit_section_" + name + ".flag");
+    out << "unit=unit\n"
+        << "section=section\n"
+        << "name=" << name << "\n"
+        << "message=" << message << "\n"
+        << "priority=50\n";
+}
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("flag_index", "[flags]")
+{
+    CATCH_START_SECTION("flag_index: watch and update")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/flags");
+        mkdir(path.c_str(), 0700);
+
+        write_flag(path, "first", "first flag");
+
+        communicatord::flag_index index(path);
+        CATCH_REQUIRE(index.watch());
+        CATCH_REQUIRE(index.get_socket() != -1);
+        CATCH_REQUIRE(index.size() == 1);
+        std::uint64_t const version(index.get_version());
+
+        // nothing happened yet
+        //
+        CATCH_REQUIRE_FALSE(index.process_events());
+
+        write_flag(path, "second", "second flag");
+        std::ofstream(path + "/unit_section_first.flag.bak") << "ignored\n";
+        CATCH_REQUIRE(index.process_events());
+        CATCH_REQUIRE(index.size() == 2);
+        CATCH_REQUIRE(index.get_version() > version);
+
+        communicatord::flag::list_t flags(index.get_flags());
+        CATCH_REQUIRE(flags.size() == 2);
+        CATCH_REQUIRE(flags.front()->get_name() == "first");
+        CATCH_REQUIRE(flags.back()->get_name() == "second");
+        CATCH_REQUIRE(flags.back()->get_message() == "second flag");
+        CATCH_REQUIRE(flags.back()->get_priority() == 50);
+
+        std::uint64_t const before(index.get_version());
+        communicatord::flag::list_t changes;
+        unlink((path + "/unit_section_first.flag").c_str());
+        CATCH_REQUIRE(index.process_events(&changes));
+        CATCH_REQUIRE(index.size() == 1);
+        CATCH_REQUIRE(index.get_flags().front()->get_name() == "second");
+        CATCH_REQUIRE(changes.size() == 1);
+        CATCH_REQUIRE(changes.front()->get_name() == "first");
+        CATCH_REQUIRE(changes.front()->get_state() == communicatord::flag::state_t::STATE_DOWN);
+        CATCH_REQUIRE(index.get_version() == before + 1);
+
+        // a rescan without changes does not bump the version
+        //
+        std::uint64_t const current(index.get_version());
+        CATCH_REQUIRE_FALSE(index.rescan());
+        CATCH_REQUIRE(index.get_version() == current);
+
+        unlink((path + "/unit_section_second.flag").c_str());
+        unlink((path + "/unit_section_first.flag.bak").c_str());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("flag_index: parameters round trip")
+    {
+        communicatord::flag f("unit", "section", "name");
+        f.set_message("line one\nline two");
+        f.set_priority(75);
+        f.add_tag("network");
+        f.add_tag("security");
+
+        communicatord::flag const copy(f.get_parameters());
+        CATCH_REQUIRE(copy.get_unit() == "unit");
+        CATCH_REQUIRE(copy.get_section() == "section");
+        CATCH_REQUIRE(copy.get_name() == "name");
+        CATCH_REQUIRE(copy.get_message() == "line one\nline two");
+        CATCH_REQUIRE(copy.get_priority() == 75);
+        CATCH_REQUIRE(copy.get_tags() == f.get_tags());
+        CATCH_REQUIRE(copy.get_parameters() == f.get_parameters());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("flag_index: snapshot")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/flags-snapshot");
+        mkdir(path.c_str(), 0700);
+
+        write_flag(path, "saved", "saved\\flag");
+
+        communicatord::flag_index index(path);
+        CATCH_REQUIRE(index.watch());
+        CATCH_REQUIRE(index.save_snapshot());
+
+        struct stat s;
+        CATCH_REQUIRE(stat(index.get_snapshot_filename().c_str(), &s) == 0);
+        CATCH_REQUIRE(stat((index.get_snapshot_filename() + ".tmp").c_str(), &s) != 0);
+
+        std::ifstream in(index.get_snapshot_filename());
+        std::string line;
+        bool found(false);
+        while(std::getline(in, line))
+        {
+            if(line == "message=saved\\\\flag")
+            {
+                found = true;
+            }
+        }
+        CATCH_REQUIRE(found);
+
+        communicatord::flag::list_t flags;
+        CATCH_REQUIRE(communicatord::flag::from_snapshot(index.get_snapshot(), flags));
+        CATCH_REQUIRE(flags.size() == 1);
+        CATCH_REQUIRE(flags.front()->get_name() == "saved");
+        CATCH_REQUIRE(flags.front()->get_message() == "saved\\flag");
+        CATCH_REQUIRE_FALSE(communicatord::flag::from_snapshot("[flag]\nunit=missing-fields\n", flags));
+        CATCH_REQUIRE(flags.size() == 1);
+
+        index.remove_snapshot();
+        CATCH_REQUIRE(stat(index.get_snapshot_filename().c_str(), &s) != 0);
+
+        unlink((path + "/unit_section_saved.flag").c_str());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("flag_index: stale snapshot")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/flags-stale");
+        mkdir(path.c_str(), 0700);
+
+        write_flag(path, "kept", "kept flag");
+        write_flag(path, "edited", "original");
+
+        communicatord::flag_index index(path);
+        CATCH_REQUIRE(index.watch());
+        CATCH_REQUIRE(index.save_snapshot());
+
+        communicatord::flag::list_t flags;
+        CATCH_REQUIRE(communicatord::flag::load_snapshot(path, flags));
+        CATCH_REQUIRE(flags.size() == 2);
+        CATCH_REQUIRE(flags.front()->get_message() == "original");
+
+        // rewriting a file in place does not change the directory
+        // modification time, the file stamp catches it
+        //
+        write_flag(path, "edited", "edited in place");
+        communicatord::flag::list_t stale;
+        CATCH_REQUIRE_FALSE(communicatord::flag::load_snapshot(path, stale));
+        CATCH_REQUIRE(stale.empty());
+
+        CATCH_REQUIRE(index.process_events());
+        CATCH_REQUIRE(index.save_snapshot());
+        CATCH_REQUIRE(communicatord::flag::load_snapshot(path, flags));
+        CATCH_REQUIRE(flags.size() == 2);
+        CATCH_REQUIRE(flags.front()->get_message() == "edited in place");
+
+        // a file the snapshot does not know about
+        //
+        std::ofstream(path + "/unit_section_invalid.flag") << "not a flag\n";
+        CATCH_REQUIRE_FALSE(communicatord::flag::load_snapshot(path, stale));
+
+        // invalid files are not indexed but readers still trust the
+        // snapshot once it knows about them
+        //
+        index.process_events();
+        CATCH_REQUIRE(index.size() == 2);
+        CATCH_REQUIRE(index.save_snapshot());
+        CATCH_REQUIRE(communicatord::flag::load_snapshot(path, stale));
+        CATCH_REQUIRE(stale.size() == 2);
+
+        index.remove_snapshot();
+        CATCH_REQUIRE_FALSE(communicatord::flag::load_snapshot(path, stale));
+
+        unlink((path + "/unit_section_kept.flag").c_str());
+        unlink((path + "/unit_section_edited.flag").c_str());
+        unlink((path + "/unit_section_invalid.flag").c_str());
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,89 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the gateway election.
+ *
+ * This file implements tests to verify which communicator daemons of a
+ * site get elected as gateways.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/gateway.h>
+
+
+
+CATCH_TEST_CASE("gateway", "[gateway]")
+{
+    CATCH_START_SECTION("gateway: parse the modes")
+    {
+        communicator_daemon::gateway_mode_t mode(communicator_daemon::gateway_mode_t::GATEWAY_MODE_NEVER);
+        CATCH_REQUIRE(communicator_daemon::parse_gateway_mode("auto", mode));
+        CATCH_REQUIRE(mode == communicator_daemon::gateway_mode_t::GATEWAY_MODE_AUTO);
+        CATCH_REQUIRE(communicator_daemon::parse_gateway_mode("always", mode));
+        CATCH_REQUIRE(mode == communicator_daemon::gateway_mode_t::GATEWAY_MODE_ALWAYS);
+        CATCH_REQUIRE(communicator_daemon::parse_gateway_mode("never", mode));
+        CATCH_REQUIRE(mode == communicator_daemon::gateway_mode_t::GATEWAY_MODE_NEVER);
+        CATCH_REQUIRE_FALSE(communicator_daemon::parse_gateway_mode("sometimes", mode));
+        CATCH_REQUIRE(mode == communicator_daemon::gateway_mode_t::GATEWAY_MODE_NEVER);
+
+        CATCH_REQUIRE(std::string(communicator_daemon::gateway_mode_to_string(communicator_daemon::gateway_mode_t::GATEWAY_MODE_ALWAYS)) == "always");
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("gateway: elect by name")
+    {
+        communicator_daemon::gateway_candidates_t candidates;
+        candidates["node3"] = communicator_daemon::gateway_mode_t::GATEWAY_MODE_AUTO;
+        candidates["node1"] = communicator_daemon::gateway_mode_t::GATEWAY_MODE_NEVER;
+        candidates["node2"] = communicator_daemon::gateway_mode_t::GATEWAY_MODE_AUTO;
+        candidates["node4"] = communicator_daemon::gateway_mode_t::GATEWAY_MODE_AUTO;
+
+        CATCH_REQUIRE(communicator_daemon::select_gateways(candidates, 0).empty());
+        CATCH_REQUIRE(communicator_daemon::select_gateways(candidates, 2) == advgetopt::string_set_t({ "node2", "node3" }));
+
+        // when a gateway goes away, the next one takes over
+        //
+        candidates.erase("node2");
+        CATCH_REQUIRE(communicator_daemon::select_gateways(candidates, 2) == advgetopt::string_set_t({ "node3", "node4" }));
+        CATCH_REQUIRE(communicator_daemon::select_gateways(candidates, 5) == advgetopt::string_set_t({ "node3", "node4" }));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("gateway: configured gateways come first")
+    {
+        communicator_daemon::gateway_candidates_t candidates;
+        candidates["node1"] = communicator_daemon::gateway_mode_t::GATEWAY_MODE_AUTO;
+        candidates["node2"] = communicator_daemon::gateway_mode_t::GATEWAY_MODE_AUTO;
+        candidates["node8"] = communicator_daemon::gateway_mode_t::GATEWAY_MODE_ALWAYS;
+        candidates["node9"] = communicator_daemon::gateway_mode_t::GATEWAY_MODE_ALWAYS;
+
+        CATCH_REQUIRE(communicator_daemon::select_gateways(candidates, 1) == advgetopt::string_set_t({ "node8", "node9" }));
+        CATCH_REQUIRE(communicator_daemon::select_gateways(candidates, 3) == advgetopt::string_set_t({ "node1", "node8", "node9" }));
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,128 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the TLS handshake history.
+ *
+ * This file implements tests to verify the handshake budget of a peer
+ * and the delays returned once a peer is flapping.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/handshake_history.h>
+
+
+// libaddr
+//
+#include    <libaddr/addr_parser.h>
+
+
+// C++
+//
+#include    <string>
+
+
+
+namespace
+{
+
+
+
+addr::addr make_addr(int idx, int port = 4043)
+{
+    return addr::string_to_addr(
+              "10.0.0." + std::to_string(idx)
+            , std::string()
+            , port
+            , "tcp");
+}
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("handshake_history", "[handshake_history]")
+{
+    CATCH_START_SECTION("handshake_history: budget and delays")
+    {
+        communicator_daemon::handshake_history history;
+        history.set_budget(2, 10LL * 60LL * 1'000'000LL);
+        std::int64_t const minute(communicator_daemon::handshake_history::FIRST_DELAY);
+        std::int64_t now(1'000'000'000LL);
+
+        // the port is ignored, clients use a new port on each connection
+        //
+        CATCH_REQUIRE(history.record(make_addr(1, 50001), now) == 0);
+        CATCH_REQUIRE(history.record(make_addr(1, 50002), now + 1) == 0);
+        CATCH_REQUIRE(history.record(make_addr(1, 50003), now + 2) == minute);
+        CATCH_REQUIRE(history.record(make_addr(1, 50004), now + 3) == minute * 2);
+        CATCH_REQUIRE(history.record(make_addr(1, 50005), now + 4) == minute * 4);
+        CATCH_REQUIRE(history.record(make_addr(1, 50006), now + 5) == minute * 8);
+        CATCH_REQUIRE(history.record(make_addr(1, 50007), now + 6) == minute * 10);
+        CATCH_REQUIRE(history.recent(make_addr(1), now + 6) == 7);
+
+        // other peers have their own budget
+        //
+        CATCH_REQUIRE(history.record(make_addr(2), now) == 0);
+
+        CATCH_REQUIRE(history.get_handshakes() == 8);
+        CATCH_REQUIRE(history.get_throttled() == 5);
+        CATCH_REQUIRE(history.size() == 2);
+
+        // once the window is over, the peer is within budget again
+        //
+        now += 10LL * 60LL * 1'000'000LL + 10;
+        CATCH_REQUIRE(history.recent(make_addr(1), now) == 0);
+        CATCH_REQUIRE(history.record(make_addr(1), now) == 0);
+
+        CATCH_REQUIRE(history.forget(make_addr(2)));
+        CATCH_REQUIRE_FALSE(history.forget(make_addr(2)));
+        CATCH_REQUIRE(history.size() == 1);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("handshake_history: limited number of peers")
+    {
+        communicator_daemon::handshake_history history(2);
+        std::int64_t const now(1'000'000'000LL);
+
+        history.record(make_addr(1), now);
+        history.record(make_addr(2), now + 1);
+        history.record(make_addr(1), now + 2);
+        history.record(make_addr(3), now + 3);
+
+        // peer 2 had the oldest handshake
+        //
+        CATCH_REQUIRE(history.size() == 2);
+        CATCH_REQUIRE(history.recent(make_addr(1), now + 3) == 2);
+        CATCH_REQUIRE(history.recent(make_addr(2), now + 3) == 0);
+        CATCH_REQUIRE(history.recent(make_addr(3), now + 3) == 1);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
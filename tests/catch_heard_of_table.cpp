@@ -0,0 +1,161 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the heard_of_table class.
+ *
+ * This file implements tests to verify that the services heard of are
+ * maintained incrementally, per peer, with split horizon.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/base_connection.h>
+#include    <daemon/heard_of_table.h>
+
+
+
+namespace
+{
+
+
+
+class peer_connection
+    : public communicator_daemon::base_connection
+{
+public:
+    typedef std::shared_ptr<peer_connection>    pointer_t;
+
+    peer_connection()
+        : base_connection(communicator_daemon::server::pointer_t(), false)
+    {
+    }
+
+    virtual int get_socket() const override
+    {
+        return -1;
+    }
+};
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("heard_of_table", "[heard_of]")
+{
+    CATCH_START_SECTION("heard_of_table: split horizon")
+    {
+        communicator_daemon::heard_of_table table;
+        peer_connection::pointer_t a(std::make_shared<peer_connection>());
+        peer_connection::pointer_t b(std::make_shared<peer_connection>());
+
+        table.set_local_services({ "communicatord" });
+        table.set_peer(a.get(), { "snaplock", "communicatord" }, { "snapdbproxy" });
+        table.set_peer(b.get(), { "sitter" }, advgetopt::string_set_t());
+
+        CATCH_REQUIRE(table.size() == 3);
+        CATCH_REQUIRE(table.get_list() == "sitter,snapdbproxy,snaplock");
+        CATCH_REQUIRE(table.get_list(a.get()) == "sitter");
+
+        // a receives everything we heard of from b at 1 hop
+        //
+        std::int64_t version(0);
+        communicator_daemon::heard_of_table::distance_map_t advertised(table.get_advertised(a.get(), version));
+        CATCH_REQUIRE(version == 1);
+        CATCH_REQUIRE(communicator_daemon::heard_of_table::to_string(advertised) == "sitter:1");
+
+        // b receives the services of a at 1 hop and those a heard of at 2
+        //
+        advertised = table.get_advertised(b.get(), version);
+        CATCH_REQUIRE(communicator_daemon::heard_of_table::to_string(advertised) == "snapdbproxy:2,snaplock:1");
+
+        communicator_daemon::heard_of_table::update_map_t updates;
+        table.take_updates(updates);
+        CATCH_REQUIRE(updates.empty());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("heard_of_table: incremental updates")
+    {
+        communicator_daemon::heard_of_table table;
+        peer_connection::pointer_t a(std::make_shared<peer_connection>());
+        peer_connection::pointer_t b(std::make_shared<peer_connection>());
+
+        table.set_peer(a.get(), { "snaplock" }, advgetopt::string_set_t());
+        table.set_peer(b.get(), advgetopt::string_set_t(), advgetopt::string_set_t());
+        std::int64_t version(0);
+        table.get_advertised(a.get(), version);
+        table.get_advertised(b.get(), version);
+
+        // a now heard of sitter; only b gets told about it
+        //
+        CATCH_REQUIRE(table.update_peer_heard_of(a.get(), 0, 3, { { "sitter", 2 } }));
+        communicator_daemon::heard_of_table::update_map_t updates;
+        table.take_updates(updates);
+        CATCH_REQUIRE(updates.size() == 1);
+        CATCH_REQUIRE(updates.begin()->first == b.get());
+        CATCH_REQUIRE(updates.begin()->second.f_base_version == 1);
+        CATCH_REQUIRE(updates.begin()->second.f_version == 2);
+        CATCH_REQUIRE(updates.begin()->second.f_changes.at("sitter") == 3);
+
+        // an update based on the wrong version is refused
+        //
+        CATCH_REQUIRE_FALSE(table.update_peer_heard_of(a.get(), 5, 6, { { "sitter", 0 } }));
+
+        // losing a removes its services from what b knows
+        //
+        table.remove_peer(a.get());
+        updates.clear();
+        table.take_updates(updates);
+        CATCH_REQUIRE(updates.size() == 1);
+        CATCH_REQUIRE(updates.at(b.get()).f_base_version == 2);
+        CATCH_REQUIRE(updates.at(b.get()).f_changes.at("sitter") == 0);
+        CATCH_REQUIRE(updates.at(b.get()).f_changes.at("snaplock") == 0);
+        CATCH_REQUIRE(table.size() == 0);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("heard_of_table: hop limit")
+    {
+        communicator_daemon::heard_of_table table;
+        peer_connection::pointer_t a(std::make_shared<peer_connection>());
+        peer_connection::pointer_t b(std::make_shared<peer_connection>());
+
+        table.set_peer(a.get(), advgetopt::string_set_t(), advgetopt::string_set_t());
+        table.set_peer(b.get(), advgetopt::string_set_t(), advgetopt::string_set_t());
+        CATCH_REQUIRE(table.set_peer_heard_of(
+                  a.get()
+                , 1
+                , communicator_daemon::heard_of_table::from_string("far:16,near")));
+
+        std::int64_t version(0);
+        communicator_daemon::heard_of_table::distance_map_t const advertised(table.get_advertised(b.get(), version));
+        CATCH_REQUIRE(communicator_daemon::heard_of_table::to_string(advertised) == "near:2");
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
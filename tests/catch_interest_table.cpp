@@ -0,0 +1,123 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the interest_table class.
+ *
+ * This file implements tests to verify that the interest summaries
+ * get versioned and updated incrementally as expected.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/interest_table.h>
+
+
+
+CATCH_TEST_CASE("interest_table", "[interest]")
+{
+    CATCH_START_SECTION("interest_table: local summary")
+    {
+        communicator_daemon::interest_table table;
+        advgetopt::string_set_t added;
+        advgetopt::string_set_t removed;
+
+        CATCH_REQUIRE_FALSE(table.is_known("monster"));
+        CATCH_REQUIRE(table.set_local("monster", { "LOCK", "UNLOCK" }, false, added, removed));
+        CATCH_REQUIRE(added.size() == 2);
+        CATCH_REQUIRE(removed.empty());
+
+        std::int64_t version(0);
+        std::string list;
+        bool opaque(true);
+        CATCH_REQUIRE(table.get_summary("monster", version, list, opaque));
+        CATCH_REQUIRE(list == "LOCK,UNLOCK");
+        CATCH_REQUIRE_FALSE(opaque);
+
+        // no change, no new version
+        //
+        added.clear();
+        CATCH_REQUIRE_FALSE(table.set_local("monster", { "LOCK", "UNLOCK" }, false, added, removed));
+
+        CATCH_REQUIRE(table.set_local("monster", { "LOCK", "STATUS" }, false, added, removed));
+        CATCH_REQUIRE(added == advgetopt::string_set_t({ "STATUS" }));
+        CATCH_REQUIRE(removed == advgetopt::string_set_t({ "UNLOCK" }));
+
+        std::int64_t next_version(0);
+        CATCH_REQUIRE(table.get_summary("monster", next_version, list, opaque));
+        CATCH_REQUIRE(next_version == version + 1);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("interest_table: remote updates")
+    {
+        communicator_daemon::interest_table table;
+
+        CATCH_REQUIRE(table.wants("remote", "LOCK"));     // unknown servers may want anything
+
+        CATCH_REQUIRE(table.update("remote", 10, "LOCK,UNLOCK", false) == communicator_daemon::interest_update_t::INTEREST_UPDATE_APPLIED);
+        CATCH_REQUIRE(table.update("remote", 10, "STATUS", false) == communicator_daemon::interest_update_t::INTEREST_UPDATE_IGNORED);
+        CATCH_REQUIRE(table.wants("remote", "LOCK"));
+        CATCH_REQUIRE_FALSE(table.wants("remote", "STATUS"));
+
+        CATCH_REQUIRE(table.apply("remote", 10, 11, "STATUS", "LOCK", false) == communicator_daemon::interest_update_t::INTEREST_UPDATE_APPLIED);
+        CATCH_REQUIRE(table.wants("remote", "STATUS"));
+        CATCH_REQUIRE_FALSE(table.wants("remote", "LOCK"));
+
+        // an old update is ignored, a missed one requires the full summary
+        //
+        CATCH_REQUIRE(table.apply("remote", 10, 11, "LOCK", std::string(), false) == communicator_daemon::interest_update_t::INTEREST_UPDATE_IGNORED);
+        CATCH_REQUIRE(table.apply("remote", 12, 13, "LOCK", std::string(), false) == communicator_daemon::interest_update_t::INTEREST_UPDATE_MISMATCH);
+        CATCH_REQUIRE(table.apply("other", 1, 2, "LOCK", std::string(), false) == communicator_daemon::interest_update_t::INTEREST_UPDATE_MISMATCH);
+
+        // an opaque server may want anything
+        //
+        CATCH_REQUIRE(table.apply("remote", 11, 12, std::string(), std::string(), true) == communicator_daemon::interest_update_t::INTEREST_UPDATE_APPLIED);
+        CATCH_REQUIRE(table.wants("remote", "LOCK"));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("interest_table: wanted beyond direct peers")
+    {
+        communicator_daemon::interest_table table;
+        advgetopt::string_set_t added;
+        advgetopt::string_set_t removed;
+
+        table.set_local("me", { "STATUS" }, false, added, removed);
+        table.update("peer", 5, "LOCK", false);
+        table.update("far", 7, "UNLOCK", false);
+
+        advgetopt::string_set_t const direct({ "me", "peer" });
+        CATCH_REQUIRE_FALSE(table.wanted_beyond("STATUS", direct));
+        CATCH_REQUIRE_FALSE(table.wanted_beyond("LOCK", direct));
+        CATCH_REQUIRE(table.wanted_beyond("UNLOCK", direct));
+
+        table.update("far", 8, std::string(), true);
+        CATCH_REQUIRE(table.wanted_beyond("STATUS", direct));
+        CATCH_REQUIRE(table.size() == 3);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,186 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the io_shard class.
+ *
+ * This file implements tests to verify that an I/O shard reads the
+ * messages of its connections, writes their output and reports a hang
+ * up, with its thread handing everything to the main thread in order.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/base_connection.h>
+
+
+// C
+//
+#include    <poll.h>
+#include    <sys/socket.h>
+#include    <unistd.h>
+
+
+
+namespace
+{
+
+
+
+class test_connection
+    : public ed::connection
+    , public communicator_daemon::base_connection
+{
+public:
+    typedef std::shared_ptr<test_connection>    pointer_t;
+
+    test_connection(int s)
+        : base_connection(communicator_daemon::server::pointer_t(), false)
+        , f_socket(s)
+    {
+    }
+
+    virtual int get_socket() const override
+    {
+        return f_socket;
+    }
+
+    virtual void shard_message(ed::message & msg) override
+    {
+        f_commands.push_back(msg.get_command());
+    }
+
+    virtual void process_hup() override
+    {
+        f_hup = true;
+    }
+
+    ssize_t write(void const * data, std::size_t length)
+    {
+        return shard_write(data, length);
+    }
+
+    int                         f_socket = -1;
+    std::vector<std::string>    f_commands = std::vector<std::string>();
+    bool                        f_hup = false;
+};
+
+
+void wait_for_shard(communicator_daemon::io_shard::pointer_t shard)
+{
+    struct pollfd fd = {};
+    fd.fd = shard->get_socket();
+    fd.events = POLLIN;
+    if(poll(&fd, 1, 100) > 0)
+    {
+        shard->process_read();
+    }
+}
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("io_shard", "[io_shard]")
+{
+    CATCH_START_SECTION("io_shard: read, write and hang up")
+    {
+        int s[2];
+        CATCH_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+
+        communicator_daemon::io_shard::pointer_t shard(std::make_shared<communicator_daemon::io_shard>(0));
+        shard->start();
+
+        test_connection::pointer_t conn(std::make_shared<test_connection>(s[0]));
+        CATCH_REQUIRE(conn->attach_shard(shard));
+        CATCH_REQUIRE(conn->is_sharded());
+        CATCH_REQUIRE(shard->get_connection_count() == 1);
+
+        // messages split between two writes come out whole and in order
+        //
+        std::string const input("REGISTER service=a\nSTATUS\nUNREG");
+        CATCH_REQUIRE(::write(s[1], input.data(), input.length()) == static_cast<ssize_t>(input.length()));
+        for(int retry(0); retry < 50 && conn->f_commands.size() < 2; ++retry)
+        {
+            wait_for_shard(shard);
+        }
+        CATCH_REQUIRE(conn->f_commands.size() == 2);
+        CATCH_REQUIRE(conn->f_commands[0] == "REGISTER");
+        CATCH_REQUIRE(conn->f_commands[1] == "STATUS");
+
+        CATCH_REQUIRE(::write(s[1], "ISTER\n", 6) == 6);
+        for(int retry(0); retry < 50 && conn->f_commands.size() < 3; ++retry)
+        {
+            wait_for_shard(shard);
+        }
+        CATCH_REQUIRE(conn->f_commands.size() == 3);
+        CATCH_REQUIRE(conn->f_commands[2] == "UNREGISTER");
+        CATCH_REQUIRE(shard->get_messages() == 3);
+
+        // the second write waits in the output queue until the shard
+        // sent the first one
+        //
+        CATCH_REQUIRE(conn->write("HELP\n", 5) == 5);
+        CATCH_REQUIRE(conn->write("READY\n", 6) == 6);
+        CATCH_REQUIRE(conn->get_queued_messages() == 1);
+        std::string output;
+        for(int retry(0); retry < 50 && output.length() < 11; ++retry)
+        {
+            wait_for_shard(shard);
+            char buf[256];
+            ssize_t const r(recv(s[1], buf, sizeof(buf), MSG_DONTWAIT));
+            if(r > 0)
+            {
+                output.append(buf, r);
+            }
+        }
+        CATCH_REQUIRE(output == "HELP\nREADY\n");
+        CATCH_REQUIRE(conn->get_queued_messages() == 0);
+
+        // the hang up comes after the last message
+        //
+        CATCH_REQUIRE(::write(s[1], "QUITTING\n", 9) == 9);
+        close(s[1]);
+        for(int retry(0); retry < 50 && !conn->f_hup; ++retry)
+        {
+            wait_for_shard(shard);
+        }
+        CATCH_REQUIRE(conn->f_hup);
+        CATCH_REQUIRE(conn->f_commands.size() == 4);
+        CATCH_REQUIRE(conn->f_commands[3] == "QUITTING");
+
+        conn->detach_shard();
+        CATCH_REQUIRE_FALSE(conn->is_sharded());
+        CATCH_REQUIRE(shard->get_connection_count() == 0);
+
+        shard->stop();
+        close(s[0]);
+    }
+    CATCH_END_SECTION()
+}
+
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,120 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the load sampler.
+ *
+ * This file implements tests to verify the parsing of the /proc files
+ * and the smoothing of the load score.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/load_sampler.h>
+
+
+// C++
+//
+#include    <cmath>
+#include    <fstream>
+
+
+// C
+//
+#include    <sys/stat.h>
+
+
+
+CATCH_TEST_CASE("load_sampler", "[load_sampler]")
+{
+    CATCH_START_SECTION("load_sampler: parse /proc files")
+    {
+        double loadavg(0.0);
+        double running(0.0);
+        CATCH_REQUIRE(communicator_daemon::load_sampler::parse_loadavg("2.50 1.40 0.30 5/512 12345\n", loadavg, running));
+        CATCH_REQUIRE(loadavg == 2.5);
+        CATCH_REQUIRE(running == 5.0);
+        CATCH_REQUIRE_FALSE(communicator_daemon::load_sampler::parse_loadavg("2.50 1.40\n", loadavg, running));
+
+        double avg10(0.0);
+        CATCH_REQUIRE(communicator_daemon::load_sampler::parse_pressure(
+                  "some avg10=12.50 avg60=0.87 avg300=0.32 total=1234567\n"
+                  "full avg10=1.00 avg60=0.00 avg300=0.00 total=0\n"
+                , avg10));
+        CATCH_REQUIRE(avg10 == 12.5);
+        CATCH_REQUIRE_FALSE(communicator_daemon::load_sampler::parse_pressure("full avg10=1.00\n", avg10));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("load_sampler: smoothed score")
+    {
+        std::string const proc(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/proc");
+        mkdir(proc.c_str(), 0700);
+        mkdir((proc + "/pressure").c_str(), 0700);
+        {
+            std::ofstream out(proc + "/loadavg");
+            out << "0.00 0.00 0.00 1/100 1000\n";
+        }
+        {
+            std::ofstream out(proc + "/pressure/cpu");
+            out << "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+        }
+        {
+            std::ofstream out(proc + "/pressure/memory");
+            out << "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+        }
+
+        communicator_daemon::load_sampler sampler(4);
+        CATCH_REQUIRE(sampler.open(proc));
+        CATCH_REQUIRE(sampler.has_pressure());
+        sampler.set_half_life(2.0);
+        CATCH_REQUIRE(sampler.sample(1.0));
+        CATCH_REQUIRE(sampler.get_score() == 0.0);
+
+        // 9 running tasks (8 plus us) on 4 processors and memory stalls
+        //
+        {
+            std::ofstream out(proc + "/loadavg");
+            out << "0.50 0.00 0.00 9/100 1000\n";
+        }
+        {
+            std::ofstream out(proc + "/pressure/memory");
+            out << "some avg10=50.00 avg60=0.00 avg300=0.00 total=0\n";
+        }
+
+        // after one half-life, the score is half way to the raw value
+        //
+        CATCH_REQUIRE(sampler.sample(2.0));
+        CATCH_REQUIRE(sampler.get_run_queue() == 2.0);
+        CATCH_REQUIRE(sampler.get_memory_pressure() == 0.5);
+        CATCH_REQUIRE(sampler.get_loadavg() == 0.125);
+        CATCH_REQUIRE(std::fabs(sampler.get_score() - 1.25) < 0.0001);
+
+        CATCH_REQUIRE(sampler.sample(2.0));
+        CATCH_REQUIRE(std::fabs(sampler.get_score() - 1.875) < 0.0001);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,225 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the load average table.
+ *
+ * This file implements tests to verify that the communicator daemon
+ * updates the memory mapped table in place and that readers see the
+ * updates.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <communicatord/loadavg.h>
+
+
+// C++
+//
+#include    <algorithm>
+#include    <iterator>
+
+
+// C
+//
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
+
+namespace
+{
+
+
+
+communicatord::loadavg_item make_item(int idx, float avg)
+{
+    communicatord::loadavg_item item;
+    item.f_timestamp.tv_sec = 1'700'000'000 + idx;
+    item.f_address.sin6_family = AF_INET6;
+    item.f_address.sin6_addr.s6_addr[10] = 0xFF;
+    item.f_address.sin6_addr.s6_addr[11] = 0xFF;
+    item.f_address.sin6_addr.s6_addr[12] = 10;
+    item.f_address.sin6_addr.s6_addr[15] = idx;
+    item.f_address.sin6_port = htons(4040);
+    item.f_avg = avg;
+    return item;
+}
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("loadavg", "[loadavg]")
+{
+    CATCH_START_SECTION("loadavg: update in place and read back")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/loadavg");
+        mkdir(path.c_str(), 0700);
+        unlink((path + "/loadavg.lavg").c_str());
+        communicatord::set_loadavg_path(path);
+
+        // no table yet
+        //
+        communicatord::loadavg_table reader;
+        CATCH_REQUIRE_FALSE(reader.open(false));
+
+        communicatord::loadavg_table writer;
+        CATCH_REQUIRE(writer.open(true, 8));
+        CATCH_REQUIRE(writer.get_slots() == 8);
+
+        for(int i(1); i <= 8; ++i)
+        {
+            CATCH_REQUIRE(writer.update(make_item(i, static_cast<float>(i))));
+        }
+        CATCH_REQUIRE_FALSE(writer.update(make_item(9, 1.0f)));
+        CATCH_REQUIRE(writer.update(make_item(3, 0.25f)));
+
+        CATCH_REQUIRE(reader.open(false));
+        CATCH_REQUIRE(reader.get_slots() == 8);
+        CATCH_REQUIRE_FALSE(reader.update(make_item(1, 1.0f)));
+
+        communicatord::loadavg_item item;
+        CATCH_REQUIRE(reader.find(make_item(3, 0.0f).f_address, item));
+        CATCH_REQUIRE(item.f_avg == 0.25f);
+        CATCH_REQUIRE_FALSE(reader.find(make_item(9, 0.0f).f_address, item));
+
+        // updates are visible without reopening the table
+        //
+        CATCH_REQUIRE(writer.update(make_item(5, 0.125f)));
+        CATCH_REQUIRE(reader.find(make_item(5, 0.0f).f_address, item));
+        CATCH_REQUIRE(item.f_avg == 0.125f);
+
+        communicatord::loadavg_item::vector_t items;
+        reader.snapshot(items);
+        CATCH_REQUIRE(items.size() == 8);
+
+        communicatord::loadavg_file file;
+        CATCH_REQUIRE(file.load());
+        communicatord::loadavg_item const * least_busy(file.find_least_busy());
+        CATCH_REQUIRE(least_busy != nullptr);
+        CATCH_REQUIRE(least_busy->f_avg == 0.125f);
+
+        // reopening keeps the existing size
+        //
+        writer.close();
+        CATCH_REQUIRE(writer.open(true, 1024));
+        CATCH_REQUIRE(writer.get_slots() == 8);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("loadavg: save while the daemon has the table open")
+    {
+        // the path can only be set once, start with a new table
+        //
+        unlink(communicatord::get_loadavg_path().c_str());
+
+        communicatord::loadavg_table daemon;
+        CATCH_REQUIRE(daemon.open(true, 8));
+        CATCH_REQUIRE(daemon.update(make_item(1, 1.0f)));
+
+        communicatord::loadavg_file file;
+        file.add(make_item(1, 0.5f));
+        file.add(make_item(2, 2.0f));
+        CATCH_REQUIRE(file.save());
+
+        // the daemon sees the saved items and can still update the table
+        //
+        communicatord::loadavg_item item;
+        CATCH_REQUIRE(daemon.find(make_item(1, 0.0f).f_address, item));
+        CATCH_REQUIRE(item.f_avg == 0.5f);
+        CATCH_REQUIRE(daemon.find(make_item(2, 0.0f).f_address, item));
+        CATCH_REQUIRE(item.f_avg == 2.0f);
+        CATCH_REQUIRE(daemon.update(make_item(2, 0.25f)));
+
+        communicatord::loadavg_item::vector_t items;
+        daemon.snapshot(items);
+        CATCH_REQUIRE(items.size() == 2);
+
+        communicatord::loadavg_file reloaded;
+        CATCH_REQUIRE(reloaded.load());
+        communicatord::loadavg_item const * found(reloaded.find(make_item(2, 0.0f).f_address));
+        CATCH_REQUIRE(found != nullptr);
+        CATCH_REQUIRE(found->f_avg == 0.25f);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("loadavg: spread the selection")
+    {
+        communicatord::loadavg_file file;
+        CATCH_REQUIRE(file.select(0) == nullptr);
+
+        for(int i(1); i <= 4; ++i)
+        {
+            file.add(make_item(i, static_cast<float>(i)));
+        }
+
+        // all the entries are old
+        //
+        CATCH_REQUIRE(file.select(10) == nullptr);
+
+        communicatord::loadavg_item fresh(make_item(5, 3.0f));
+        fresh.f_timestamp = snapdev::now();
+        file.add(fresh);
+        communicatord::loadavg_item const * item(file.select(10));
+        CATCH_REQUIRE(item != nullptr);
+        CATCH_REQUIRE(item->f_avg == 3.0f);
+        CATCH_REQUIRE(file.select(10, { fresh.f_address }) == nullptr);
+
+        item = file.select(0, {}, communicatord::loadavg_selection_t::LOADAVG_SELECTION_LEAST_BUSY);
+        CATCH_REQUIRE(item != nullptr);
+        CATCH_REQUIRE(item->f_avg == 1.0f);
+
+        // with two choices, the busiest computer never gets picked and
+        // the least busy one does not get all the work
+        //
+        int counts[6] = {};
+        for(int i(0); i < 1000; ++i)
+        {
+            item = file.select(0);
+            CATCH_REQUIRE(item != nullptr);
+            ++counts[item->f_address.sin6_addr.s6_addr[15]];
+        }
+        CATCH_REQUIRE(counts[4] == 0);
+        CATCH_REQUIRE(counts[1] > 0);
+        CATCH_REQUIRE(counts[1] < 1000);
+
+        // weighted random favors the least busy computers
+        //
+        std::fill(std::begin(counts), std::end(counts), 0);
+        for(int i(0); i < 1000; ++i)
+        {
+            item = file.select(0, {}, communicatord::loadavg_selection_t::LOADAVG_SELECTION_WEIGHTED_RANDOM);
+            CATCH_REQUIRE(item != nullptr);
+            ++counts[item->f_address.sin6_addr.s6_addr[15]];
+        }
+        CATCH_REQUIRE(counts[1] > counts[4]);
+        CATCH_REQUIRE(counts[4] > 0);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
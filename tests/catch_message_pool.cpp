@@ -0,0 +1,101 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the message pool.
+ *
+ * This file implements tests to verify that the messages released to
+ * the pool get reused and that a reused message is an exact copy of
+ * its model.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/message_pool.h>
+
+
+
+CATCH_TEST_CASE("message_pool", "[message_pool]")
+{
+    CATCH_START_SECTION("message_pool: reuse released messages")
+    {
+        communicator_daemon::message_pool pool;
+        CATCH_REQUIRE(pool.get_free() == 0);
+
+        ed::message model;
+        model.set_command("BROADCAST_TEST");
+        model.set_service("*");
+        model.add_parameter("first", "one");
+        model.add_parameter("second", "two");
+
+        {
+            communicator_daemon::message_pool::message_ptr msg(pool.acquire(model));
+            CATCH_REQUIRE(msg->get_command() == "BROADCAST_TEST");
+            CATCH_REQUIRE((*msg).get_parameter("first") == "one");
+            msg->add_parameter("third", "three");
+        }
+        CATCH_REQUIRE(pool.get_allocated() == 1);
+        CATCH_REQUIRE(pool.get_reused() == 0);
+        CATCH_REQUIRE(pool.get_free() == 1);
+
+        // the parameter added to the previous copy is gone
+        //
+        {
+            communicator_daemon::message_pool::message_ptr msg(pool.acquire(model));
+            CATCH_REQUIRE(msg->get_all_parameters() == model.get_all_parameters());
+            CATCH_REQUIRE(msg->get_service() == "*");
+            CATCH_REQUIRE(pool.get_free() == 0);
+        }
+        CATCH_REQUIRE(pool.get_allocated() == 1);
+        CATCH_REQUIRE(pool.get_reused() == 1);
+        CATCH_REQUIRE(pool.get_free() == 1);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("message_pool: nested messages")
+    {
+        communicator_daemon::message_pool pool(2);
+        ed::message model;
+        model.set_command("NESTED_TEST");
+
+        {
+            communicator_daemon::message_pool::message_ptr a(pool.acquire(model));
+            communicator_daemon::message_pool::message_ptr b(pool.acquire(model));
+            communicator_daemon::message_pool::message_ptr c(pool.acquire(model));
+            CATCH_REQUIRE(&*a != &*b);
+            CATCH_REQUIRE(&*b != &*c);
+
+            communicator_daemon::message_pool::message_ptr moved(std::move(c));
+            CATCH_REQUIRE(moved->get_command() == "NESTED_TEST");
+        }
+        CATCH_REQUIRE(pool.get_allocated() == 3);
+
+        // only two messages are kept
+        //
+        CATCH_REQUIRE(pool.get_free() == 2);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
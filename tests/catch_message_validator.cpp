@@ -0,0 +1,127 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the message_validator class.
+ *
+ * This file implements tests to verify that the message definitions get
+ * compiled and messages are checked against them.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/message_validator.h>
+
+
+
+CATCH_TEST_CASE("message_validator", "[validator]")
+{
+    CATCH_START_SECTION("message_validator: verify messages against the definitions")
+    {
+        communicator_daemon::message_validator v;
+        CATCH_REQUIRE(v.load(SNAP_CATCH2_NAMESPACE::g_source_dir() + "/daemon/message-definitions") > 0);
+
+        ed::message msg;
+        msg.set_command("LOADAVG");
+        CATCH_REQUIRE(v.validate(msg) == communicator_daemon::validation_t::VALIDATION_INVALID);
+        CATCH_REQUIRE(v.get_error(msg) == "missing required parameter \"avg\"");
+
+        msg.add_parameter("avg", "0.25");
+        msg.add_parameter("my_address", "10.0.0.1");
+        msg.add_parameter("timestamp", "1700000000.123456789");
+        CATCH_REQUIRE(v.validate(msg) == communicator_daemon::validation_t::VALIDATION_VALID);
+        CATCH_REQUIRE(v.get_error(msg).empty());
+
+        msg.add_parameter("score", "high");
+        CATCH_REQUIRE(v.validate(msg) == communicator_daemon::validation_t::VALIDATION_INVALID);
+        CATCH_REQUIRE(v.get_error(msg) == "expected an integer in parameter \"score\"");
+
+        CATCH_REQUIRE(v.set_command_modes("LOADAVG=reject"));
+        CATCH_REQUIRE(v.validate(msg) == communicator_daemon::validation_t::VALIDATION_REJECT);
+        CATCH_REQUIRE(v.set_command_modes("LOADAVG=off"));
+        CATCH_REQUIRE(v.validate(msg) == communicator_daemon::validation_t::VALIDATION_VALID);
+        CATCH_REQUIRE_FALSE(v.set_command_modes("LOADAVG=maybe"));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("message_validator: control messages cannot be broadcast")
+    {
+        communicator_daemon::message_validator v;
+        CATCH_REQUIRE(v.add_definition("REGISTER", "[service]\nflags = required\n"));
+
+        ed::message msg;
+        msg.set_command("REGISTER");
+        msg.set_service("*");
+        msg.add_parameter("service", "test");
+        CATCH_REQUIRE(v.validate(msg) == communicator_daemon::validation_t::VALIDATION_INVALID);
+
+        msg.set_service("communicatord");
+        CATCH_REQUIRE(v.validate(msg) == communicator_daemon::validation_t::VALIDATION_VALID);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("message_validator: commands without a definition are valid")
+    {
+        communicator_daemon::message_validator v;
+        v.set_mode(communicator_daemon::validation_mode_t::VALIDATION_MODE_REJECT);
+
+        ed::message msg;
+        msg.set_command("NOT_DEFINED_ANYWHERE");
+        CATCH_REQUIRE(v.validate(msg) == communicator_daemon::validation_t::VALIDATION_VALID);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("message_validator: reliable delivery")
+    {
+        communicator_daemon::message_validator v;
+        CATCH_REQUIRE(v.add_definition("ORDER", "description = an order\ndelivery = reliable\n\n[id]\nflags = required\n"));
+        CATCH_REQUIRE(v.add_definition("PING", "description = a ping\n\n[delivery]\ndescription = not the field\n"));
+
+        CATCH_REQUIRE(v.is_reliable("ORDER"));
+        CATCH_REQUIRE_FALSE(v.is_reliable("PING"));
+        CATCH_REQUIRE_FALSE(v.is_reliable("NOT_DEFINED_ANYWHERE"));
+
+        // a new definition replaces the previous one
+        //
+        CATCH_REQUIRE(v.add_definition("ORDER", "[id]\nflags = required\n"));
+        CATCH_REQUIRE_FALSE(v.is_reliable("ORDER"));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("message_validator: default rate limit")
+    {
+        communicator_daemon::message_validator v;
+        CATCH_REQUIRE(v.add_definition("STATS", "description = stats request\nrate = 10/50\n"));
+        CATCH_REQUIRE(v.add_definition("NOISE", "description = bad rate\nrate = often\n\n[rate]\ndescription = not the field\n"));
+
+        communicator_daemon::rate_limit const limit(v.get_rate_limit(communicator_daemon::find_command("STATS")));
+        CATCH_REQUIRE(limit.f_rate == 10.0);
+        CATCH_REQUIRE(limit.f_burst == 50.0);
+        CATCH_REQUIRE_FALSE(v.get_rate_limit(communicator_daemon::find_command("NOISE")).is_limited());
+        CATCH_REQUIRE_FALSE(v.get_rate_limit(communicator_daemon::COMMAND_ID_UNKNOWN).is_limited());
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
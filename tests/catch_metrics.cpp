@@ -0,0 +1,112 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the metrics class.
+ *
+ * This file implements tests to verify that the metrics get counted per
+ * command and route and are output in the Prometheus text format.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/metrics.h>
+
+
+// C++
+//
+#include    <sstream>
+
+
+
+CATCH_TEST_CASE("metrics", "[metrics]")
+{
+    CATCH_START_SECTION("metrics: count per command and route")
+    {
+        communicator_daemon::intern_command("METRICS_TEST");
+
+        communicator_daemon::metrics m;
+        m.message_in("METRICS_TEST");
+        m.message_in("METRICS_TEST");
+        m.route("METRICS_TEST", communicator_daemon::route_t::ROUTE_FORWARDED);
+        m.route("METRICS_TEST", communicator_daemon::route_t::ROUTE_DROPPED);
+        m.route("METRICS_TEST", communicator_daemon::route_t::ROUTE_DROPPED);
+        m.message_in("NEVER_INTERNED_COMMAND");
+        m.transmission_report();
+
+        std::stringstream out;
+        m.output(out);
+        std::string const text(out.str());
+
+        CATCH_REQUIRE(text.find("# TYPE communicatord_messages_in_total counter\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("communicatord_messages_in_total{command=\"METRICS_TEST\"} 2\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("communicatord_messages_in_total{command=\"<unknown>\"} 1\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("communicatord_messages_routed_total{command=\"METRICS_TEST\",route=\"forwarded\"} 1\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("communicatord_messages_routed_total{command=\"METRICS_TEST\",route=\"dropped\"} 2\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("route=\"cached\"") == std::string::npos);
+        CATCH_REQUIRE(text.find("communicatord_transmission_reports_total 1\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("NEVER_INTERNED_COMMAND") == std::string::npos);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("metrics: latency histogram")
+    {
+        communicator_daemon::latency_histogram h;
+        h.record(1);
+        h.record(3);
+        h.record(150'000);
+        CATCH_REQUIRE(h.get_count() == 3);
+
+        std::stringstream out;
+        h.output(out, "latency", "command=\"TEST\",");
+        std::string const text(out.str());
+
+        CATCH_REQUIRE(text.find("latency_bucket{command=\"TEST\",le=\"0.000001\"} 1\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("latency_bucket{command=\"TEST\",le=\"0.000004\"} 2\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("latency_bucket{command=\"TEST\",le=\"0.131072\"} 2\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("latency_bucket{command=\"TEST\",le=\"0.262144\"} 3\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("latency_bucket{command=\"TEST\",le=\"+Inf\"} 3\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("latency_sum{command=\"TEST\"} 0.150004\n") != std::string::npos);
+        CATCH_REQUIRE(text.find("latency_count{command=\"TEST\"} 3\n") != std::string::npos);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("metrics: label escaping")
+    {
+        CATCH_REQUIRE(communicator_daemon::metrics::label("connection", "plain") == "connection=\"plain\"");
+        CATCH_REQUIRE(communicator_daemon::metrics::label("connection", "a\"b\\c\nd") == "connection=\"a\\\"b\\\\c\\nd\"");
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("metrics: negative samples")
+    {
+        std::stringstream out;
+        communicator_daemon::metrics::sample_signed(out, "offset", communicator_daemon::metrics::label("server", "a"), -1'500);
+        communicator_daemon::metrics::sample_signed(out, "offset", std::string(), 20);
+        CATCH_REQUIRE(out.str() == "offset{server=\"a\"} -1500\noffset 20\n");
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
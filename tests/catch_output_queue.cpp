@@ -0,0 +1,178 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the output_queue class.
+ *
+ * This file implements tests to verify that the output queue tracks the
+ * data waiting for a connection and applies its watermarks.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/output_queue.h>
+
+
+
+CATCH_TEST_CASE("output_queue", "[output_queue]")
+{
+    CATCH_START_SECTION("output_queue: chunks keep the messages in order")
+    {
+        communicator_daemon::output_queue q;
+        q.push("one\n", 4);
+        q.push("two\n", 4);
+        q.push("three\n", 6);
+        CATCH_REQUIRE(q.get_messages() == 3);
+        CATCH_REQUIRE(q.get_bytes() == 14);
+
+        CATCH_REQUIRE(q.pop(8) == "one\ntwo\n");
+        CATCH_REQUIRE(q.get_messages() == 1);
+        CATCH_REQUIRE(q.get_bytes() == 6);
+
+        // a message larger than the chunk is still returned
+        //
+        CATCH_REQUIRE(q.pop(2) == "three\n");
+        CATCH_REQUIRE(q.empty());
+        CATCH_REQUIRE(q.get_bytes() == 0);
+        CATCH_REQUIRE(q.pop().empty());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("output_queue: time of the oldest message")
+    {
+        communicator_daemon::output_queue q;
+        std::int64_t queued_on(-1);
+        CATCH_REQUIRE(q.pop(communicator_daemon::output_queue::WRITE_CHUNK_SIZE, &queued_on).empty());
+        CATCH_REQUIRE(queued_on == -1);
+
+        q.push("one\n", 4);
+        q.push("two\n", 4);
+        CATCH_REQUIRE(q.pop(communicator_daemon::output_queue::WRITE_CHUNK_SIZE, &queued_on) == "one\ntwo\n");
+        CATCH_REQUIRE(queued_on > 0);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("output_queue: control lane goes first")
+    {
+        communicator_daemon::output_queue q;
+        q.push("bulk1\n", 6);
+        q.push("bulk2\n", 6);
+        q.push("STOP\n", 5, communicator_daemon::message_priority_t::MESSAGE_PRIORITY_HIGH);
+        CATCH_REQUIRE(q.get_messages() == 3);
+
+        CATCH_REQUIRE(q.pop(11) == "STOP\nbulk1\n");
+        CATCH_REQUIRE(q.pop() == "bulk2\n");
+        CATCH_REQUIRE(q.empty());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("output_queue: message priority")
+    {
+        ed::message stop;
+        stop.set_command("STOP");
+        CATCH_REQUIRE(communicator_daemon::get_message_priority(stop) == communicator_daemon::message_priority_t::MESSAGE_PRIORITY_HIGH);
+        stop.add_parameter("priority", "normal");
+        CATCH_REQUIRE(communicator_daemon::get_message_priority(stop) == communicator_daemon::message_priority_t::MESSAGE_PRIORITY_NORMAL);
+
+        ed::message bulk;
+        bulk.set_command("DATA");
+        CATCH_REQUIRE(communicator_daemon::get_message_priority(bulk) == communicator_daemon::message_priority_t::MESSAGE_PRIORITY_NORMAL);
+        bulk.add_parameter("priority", "high");
+        CATCH_REQUIRE(communicator_daemon::get_message_priority(bulk) == communicator_daemon::message_priority_t::MESSAGE_PRIORITY_HIGH);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("output_queue: untrusted senders cannot raise the priority")
+    {
+        // bulk messages go back to the normal lane
+        //
+        ed::message bulk;
+        bulk.set_command("DATA");
+        CATCH_REQUIRE_FALSE(communicator_daemon::restrict_message_priority(bulk));
+        CATCH_REQUIRE_FALSE(bulk.has_parameter("priority"));
+        bulk.add_parameter("priority", "high");
+        CATCH_REQUIRE(communicator_daemon::restrict_message_priority(bulk));
+        CATCH_REQUIRE(bulk.get_parameter("priority") == "normal");
+        CATCH_REQUIRE(communicator_daemon::get_message_priority(bulk) == communicator_daemon::message_priority_t::MESSAGE_PRIORITY_NORMAL);
+
+        // control commands keep their priority
+        //
+        ed::message stop;
+        stop.set_command("STOP");
+        stop.add_parameter("priority", "high");
+        CATCH_REQUIRE_FALSE(communicator_daemon::restrict_message_priority(stop));
+        CATCH_REQUIRE(communicator_daemon::get_message_priority(stop) == communicator_daemon::message_priority_t::MESSAGE_PRIORITY_HIGH);
+
+        // lowering the priority is always allowed
+        //
+        stop.add_parameter("priority", "normal");
+        CATCH_REQUIRE_FALSE(communicator_daemon::restrict_message_priority(stop));
+        CATCH_REQUIRE(communicator_daemon::get_message_priority(stop) == communicator_daemon::message_priority_t::MESSAGE_PRIORITY_NORMAL);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("output_queue: congestion has hysteresis")
+    {
+        communicator_daemon::output_queue q;
+        q.set_limits(0, 4, 0, 1);
+        for(int i(0); i < 3; ++i)
+        {
+            q.push("msg\n", 4);
+            CATCH_REQUIRE_FALSE(q.update_congestion());
+        }
+        q.push("msg\n", 4);
+        CATCH_REQUIRE(q.update_congestion());
+        CATCH_REQUIRE(q.is_congested());
+
+        // still congested until we reach the low watermark
+        //
+        q.pop(8);
+        CATCH_REQUIRE_FALSE(q.update_congestion());
+        CATCH_REQUIRE(q.is_congested());
+
+        // messages waiting elsewhere count too
+        //
+        q.pop(4);
+        CATCH_REQUIRE_FALSE(q.update_congestion(0, 1));
+        CATCH_REQUIRE(q.update_congestion());
+        CATCH_REQUIRE_FALSE(q.is_congested());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("output_queue: slow consumer policy names")
+    {
+        communicator_daemon::slow_consumer_policy_t policy(communicator_daemon::slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DROP);
+        CATCH_REQUIRE(communicator_daemon::parse_slow_consumer_policy("disconnect", policy));
+        CATCH_REQUIRE(policy == communicator_daemon::slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DISCONNECT);
+        CATCH_REQUIRE(communicator_daemon::parse_slow_consumer_policy("drop", policy));
+        CATCH_REQUIRE(policy == communicator_daemon::slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DROP);
+        policy = communicator_daemon::slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DISCONNECT;
+        CATCH_REQUIRE_FALSE(communicator_daemon::parse_slow_consumer_policy("wait", policy));
+        CATCH_REQUIRE(policy == communicator_daemon::slow_consumer_policy_t::SLOW_CONSUMER_POLICY_DROP);
+    }
+    CATCH_END_SECTION()
+}
+
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,112 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the overlay peer selection.
+ *
+ * This file implements tests to verify that the overlay keeps the
+ * nearest neighbors plus a few long links and nothing more.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/overlay.h>
+
+
+// libaddr
+//
+#include    <libaddr/addr_parser.h>
+
+
+// C++
+//
+#include    <string>
+
+
+
+namespace
+{
+
+
+
+addr::addr make_addr(int idx)
+{
+    return addr::string_to_addr(
+              "10.0.0." + std::to_string(idx)
+            , std::string()
+            , 4040
+            , "tcp");
+}
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("overlay", "[overlay]")
+{
+    CATCH_START_SECTION("overlay: small clusters remain a full mesh")
+    {
+        addr::addr::set_t all;
+        for(int i(1); i <= 5; ++i)
+        {
+            all.insert(make_addr(i));
+        }
+        addr::addr::set_t const peers(communicator_daemon::select_overlay_peers(all, make_addr(3), 4, 2));
+        CATCH_REQUIRE(peers.size() == 4);
+        CATCH_REQUIRE(peers.find(make_addr(3)) == peers.end());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("overlay: ring neighbors and long links")
+    {
+        addr::addr::set_t all;
+        for(int i(1); i <= 100; ++i)
+        {
+            all.insert(make_addr(i));
+        }
+        addr::addr::set_t const peers(communicator_daemon::select_overlay_peers(all, make_addr(1), 4, 2));
+        CATCH_REQUIRE(peers.size() == 6);
+
+        // the ring wraps around
+        //
+        CATCH_REQUIRE(peers.find(make_addr(2)) != peers.end());
+        CATCH_REQUIRE(peers.find(make_addr(3)) != peers.end());
+        CATCH_REQUIRE(peers.find(make_addr(99)) != peers.end());
+        CATCH_REQUIRE(peers.find(make_addr(100)) != peers.end());
+
+        // the selection is symmetric for ring neighbors
+        //
+        addr::addr::set_t const other(communicator_daemon::select_overlay_peers(all, make_addr(99), 4, 2));
+        CATCH_REQUIRE(other.find(make_addr(1)) != other.end());
+
+        // and stable
+        //
+        CATCH_REQUIRE(communicator_daemon::select_overlay_peers(all, make_addr(1), 4, 2) == peers);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
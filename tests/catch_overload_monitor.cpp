@@ -0,0 +1,123 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the overload monitor.
+ *
+ * This file implements tests to verify when the daemon starts and stops
+ * shedding the work which can wait.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/overload_monitor.h>
+
+
+
+CATCH_TEST_CASE("overload_monitor", "[overload_monitor]")
+{
+    CATCH_START_SECTION("overload_monitor: disabled by default")
+    {
+        communicator_daemon::overload_monitor monitor;
+        CATCH_REQUIRE_FALSE(monitor.is_enabled());
+        CATCH_REQUIRE_FALSE(monitor.sample(10'000'000, 1'000'000));
+        CATCH_REQUIRE_FALSE(monitor.is_shedding());
+        CATCH_REQUIRE(monitor.get_lag() == 10'000'000);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("overload_monitor: event loop lag")
+    {
+        communicator_daemon::overload_monitor monitor;
+        monitor.set_limits(250'000, 0);
+        CATCH_REQUIRE(monitor.is_enabled());
+        CATCH_REQUIRE_FALSE(monitor.sample(1'000, 1'000'000));
+        CATCH_REQUIRE(monitor.sample(300'000, 0));
+        CATCH_REQUIRE(monitor.is_shedding());
+        CATCH_REQUIRE(monitor.get_shedding_count() == 1);
+
+        // under the limit but not under half of it, keep shedding
+        //
+        for(int i(0); i < 10; ++i)
+        {
+            CATCH_REQUIRE_FALSE(monitor.sample(200'000, 0));
+            CATCH_REQUIRE(monitor.is_shedding());
+        }
+
+        // a few calm samples in a row are required
+        //
+        CATCH_REQUIRE_FALSE(monitor.sample(1'000, 0));
+        CATCH_REQUIRE_FALSE(monitor.sample(1'000, 0));
+        CATCH_REQUIRE_FALSE(monitor.sample(200'000, 0));
+        for(std::size_t i(1); i < communicator_daemon::overload_monitor::DEFAULT_RECOVERY_SAMPLES; ++i)
+        {
+            CATCH_REQUIRE_FALSE(monitor.sample(1'000, 0));
+        }
+        CATCH_REQUIRE(monitor.sample(1'000, 0));
+        CATCH_REQUIRE_FALSE(monitor.is_shedding());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("overload_monitor: queue depth")
+    {
+        communicator_daemon::overload_monitor monitor;
+        monitor.set_limits(0, 1'000);
+        CATCH_REQUIRE_FALSE(monitor.sample(10'000'000, 1'000));
+        CATCH_REQUIRE(monitor.sample(0, 1'001));
+        CATCH_REQUIRE(monitor.get_queue_depth() == 1'001);
+        for(std::size_t i(1); i < communicator_daemon::overload_monitor::DEFAULT_RECOVERY_SAMPLES; ++i)
+        {
+            CATCH_REQUIRE_FALSE(monitor.sample(0, 500));
+        }
+        CATCH_REQUIRE(monitor.sample(0, 500));
+        CATCH_REQUIRE(monitor.sample(0, 2'000));
+        CATCH_REQUIRE(monitor.get_shedding_count() == 2);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("overload_monitor: only non-critical broadcasts are shed")
+    {
+        communicator_daemon::overload_monitor monitor;
+        monitor.set_limits(0, 1'000);
+
+        // not overloaded, nothing is shed
+        //
+        CATCH_REQUIRE_FALSE(monitor.shed_forward(true, false));
+        CATCH_REQUIRE_FALSE(monitor.shed_forward(false, false));
+
+        CATCH_REQUIRE(monitor.sample(0, 1'001));
+        CATCH_REQUIRE(monitor.is_shedding());
+
+        // messages sent to a remote service always survive
+        //
+        CATCH_REQUIRE_FALSE(monitor.shed_forward(false, false));
+        CATCH_REQUIRE_FALSE(monitor.shed_forward(false, true));
+
+        CATCH_REQUIRE_FALSE(monitor.shed_forward(true, true));
+        CATCH_REQUIRE(monitor.shed_forward(true, false));
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
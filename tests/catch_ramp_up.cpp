@@ -0,0 +1,136 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the connection ramp-up.
+ *
+ * This file implements tests to verify the concurrency limit and the
+ * retry delays used while the cluster forms.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/ramp_up.h>
+
+
+// libaddr
+//
+#include    <libaddr/addr_parser.h>
+
+
+// C++
+//
+#include    <string>
+
+
+
+namespace
+{
+
+
+
+addr::addr make_addr(int idx)
+{
+    return addr::string_to_addr(
+              "10.0.0." + std::to_string(idx)
+            , std::string()
+            , 4040
+            , "tcp");
+}
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("ramp_up", "[ramp_up]")
+{
+    CATCH_START_SECTION("ramp_up: phase duration")
+    {
+        communicator_daemon::ramp_up r;
+        CATCH_REQUIRE_FALSE(r.is_active(0));
+
+        r.start(1'000'000, 4, 60'000'000);
+        CATCH_REQUIRE(r.is_active(1'000'000));
+        CATCH_REQUIRE(r.is_active(60'999'999));
+        CATCH_REQUIRE_FALSE(r.is_active(61'000'000));
+
+        r.start(1'000'000, 4, 0);
+        CATCH_REQUIRE_FALSE(r.is_active(1'000'000));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("ramp_up: concurrency limit")
+    {
+        communicator_daemon::ramp_up r;
+        r.start(0, 2, 60'000'000);
+
+        CATCH_REQUIRE(r.acquire(make_addr(1)));
+        CATCH_REQUIRE(r.acquire(make_addr(2)));
+        CATCH_REQUIRE_FALSE(r.acquire(make_addr(3)));
+        CATCH_REQUIRE_FALSE(r.acquire(make_addr(4)));
+        CATCH_REQUIRE(r.in_flight() == 2);
+        CATCH_REQUIRE(r.queued() == 2);
+
+        // a slot frees up, the first queued address gets it
+        //
+        addr::addr next;
+        CATCH_REQUIRE(r.release(make_addr(1), next));
+        CATCH_REQUIRE(next == make_addr(3));
+        CATCH_REQUIRE(r.in_flight() == 2);
+        CATCH_REQUIRE(r.queued() == 1);
+
+        // canceling a queued address does not free a slot
+        //
+        CATCH_REQUIRE_FALSE(r.release(make_addr(4), next));
+        CATCH_REQUIRE(r.queued() == 0);
+        CATCH_REQUIRE_FALSE(r.release(make_addr(2), next));
+        CATCH_REQUIRE(r.in_flight() == 1);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("ramp_up: jittered retries")
+    {
+        communicator_daemon::ramp_up r;
+        std::int64_t expected(communicator_daemon::ramp_up::FIRST_RETRY);
+        for(int i(0); i < 10; ++i)
+        {
+            std::int64_t const delay(r.retry_delay(make_addr(1)));
+            CATCH_REQUIRE(delay >= expected / 2);
+            CATCH_REQUIRE(delay <= expected);
+            expected *= 2;
+            if(expected > communicator_daemon::ramp_up::MAX_RETRY)
+            {
+                expected = communicator_daemon::ramp_up::MAX_RETRY;
+            }
+        }
+        CATCH_REQUIRE(r.forget(make_addr(1)));
+        CATCH_REQUIRE_FALSE(r.forget(make_addr(1)));
+        CATCH_REQUIRE(r.retry_delay(make_addr(1)) <= communicator_daemon::ramp_up::FIRST_RETRY);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
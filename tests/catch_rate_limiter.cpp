@@ -0,0 +1,220 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the ingress rate limiter.
+ *
+ * This file implements tests to verify the token buckets used to limit
+ * the number of messages a connection can send to the communicator
+ * daemon.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/rate_limiter.h>
+
+
+
+CATCH_TEST_CASE("rate_limiter", "[rate_limiter]")
+{
+    CATCH_START_SECTION("rate_limiter: parse the limits")
+    {
+        communicator_daemon::rate_limit limit;
+        CATCH_REQUIRE(communicator_daemon::parse_rate_limit("100", limit));
+        CATCH_REQUIRE(limit.f_rate == 100.0);
+        CATCH_REQUIRE(limit.f_burst == 100.0);
+        CATCH_REQUIRE(communicator_daemon::parse_rate_limit("0.5/10", limit));
+        CATCH_REQUIRE(limit.f_rate == 0.5);
+        CATCH_REQUIRE(limit.f_burst == 10.0);
+        CATCH_REQUIRE(communicator_daemon::parse_rate_limit("0.5", limit));
+        CATCH_REQUIRE(limit.f_burst == 1.0);
+        CATCH_REQUIRE(communicator_daemon::parse_rate_limit("0", limit));
+        CATCH_REQUIRE_FALSE(limit.is_limited());
+
+        CATCH_REQUIRE_FALSE(communicator_daemon::parse_rate_limit("", limit));
+        CATCH_REQUIRE_FALSE(communicator_daemon::parse_rate_limit("-3", limit));
+        CATCH_REQUIRE_FALSE(communicator_daemon::parse_rate_limit("10/", limit));
+        CATCH_REQUIRE_FALSE(communicator_daemon::parse_rate_limit("10/0.5", limit));
+        CATCH_REQUIRE_FALSE(communicator_daemon::parse_rate_limit("fast", limit));
+
+        communicator_daemon::rate_limit_action_t action(communicator_daemon::rate_limit_action_t::RATE_LIMIT_ACTION_DROP);
+        CATCH_REQUIRE(communicator_daemon::parse_rate_limit_action("delay", action));
+        CATCH_REQUIRE(action == communicator_daemon::rate_limit_action_t::RATE_LIMIT_ACTION_DELAY);
+        CATCH_REQUIRE(communicator_daemon::parse_rate_limit_action("throttle", action));
+        CATCH_REQUIRE(action == communicator_daemon::rate_limit_action_t::RATE_LIMIT_ACTION_THROTTLE);
+        CATCH_REQUIRE_FALSE(communicator_daemon::parse_rate_limit_action("ignore", action));
+        CATCH_REQUIRE(action == communicator_daemon::rate_limit_action_t::RATE_LIMIT_ACTION_THROTTLE);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("rate_limiter: token bucket")
+    {
+        communicator_daemon::token_bucket bucket;
+        CATCH_REQUIRE(bucket.available(0));
+        CATCH_REQUIRE(bucket.next_token(0) == 0);
+
+        // 10 messages per second with bursts of 3
+        //
+        bucket.set_limit({ 10.0, 3.0 }, 1'000'000);
+        for(int i(0); i < 3; ++i)
+        {
+            CATCH_REQUIRE(bucket.available(1'000'000));
+            bucket.consume();
+        }
+        CATCH_REQUIRE_FALSE(bucket.available(1'000'000));
+        CATCH_REQUIRE(bucket.next_token(1'000'000) == 100'000);
+        CATCH_REQUIRE(bucket.next_token(1'040'000) == 60'000);
+
+        CATCH_REQUIRE_FALSE(bucket.available(1'099'999));
+        CATCH_REQUIRE(bucket.available(1'100'000));
+        bucket.consume();
+        CATCH_REQUIRE_FALSE(bucket.available(1'100'000));
+
+        // a long pause does not give more than the burst
+        //
+        CATCH_REQUIRE(bucket.available(60'000'000));
+        for(int i(0); i < 3; ++i)
+        {
+            CATCH_REQUIRE(bucket.available(60'000'000));
+            bucket.consume();
+        }
+        CATCH_REQUIRE_FALSE(bucket.available(60'000'000));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("rate_limiter: rules")
+    {
+        communicator_daemon::rate_limit_rules rules;
+        CATCH_REQUIRE(rules.empty());
+        CATCH_REQUIRE(rules.set_rules("service:snapbackend=100/200, type:udp=50, command:RATE_TEST=5"));
+        CATCH_REQUIRE_FALSE(rules.empty());
+
+        CATCH_REQUIRE(rules.get_connection_limit("snapbackend", "tcp").f_rate == 100.0);
+        CATCH_REQUIRE(rules.get_connection_limit("snapbackend", "tcp").f_burst == 200.0);
+        CATCH_REQUIRE(rules.get_connection_limit("ed-signal", "udp").f_rate == 50.0);
+        CATCH_REQUIRE_FALSE(rules.get_connection_limit("ed-signal", "tcp").is_limited());
+
+        communicator_daemon::command_id_t const id(communicator_daemon::intern_command("RATE_TEST"));
+        CATCH_REQUIRE(rules.get_command_limit(id).f_rate == 5.0);
+
+        // the rule has priority over the message definition
+        //
+        rules.set_default_command_limit(id, { 1.0, 1.0 });
+        CATCH_REQUIRE(rules.get_command_limit(id).f_rate == 5.0);
+
+        communicator_daemon::command_id_t const other(communicator_daemon::intern_command("RATE_OTHER"));
+        CATCH_REQUIRE_FALSE(rules.get_command_limit(other).is_limited());
+        rules.set_default_command_limit(other, { 2.0, 4.0 });
+        CATCH_REQUIRE(rules.get_command_limit(other).f_rate == 2.0);
+
+        CATCH_REQUIRE_FALSE(rules.set_rules("type:pipe=10"));
+        CATCH_REQUIRE_FALSE(rules.set_rules("host:node1=10"));
+        CATCH_REQUIRE_FALSE(rules.set_rules("service:=10"));
+        CATCH_REQUIRE_FALSE(rules.set_rules("service:snapbackend"));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("rate_limiter: connection and command buckets")
+    {
+        communicator_daemon::rate_limit_rules rules;
+        CATCH_REQUIRE(rules.set_rules("type:unix=4/4,command:RATE_SLOW=1/2"));
+        communicator_daemon::command_id_t const slow(communicator_daemon::intern_command("RATE_SLOW"));
+        communicator_daemon::command_id_t const fast(communicator_daemon::intern_command("RATE_FAST"));
+
+        communicator_daemon::ingress_limiter limiter;
+        CATCH_REQUIRE(limiter.accept(rules, "snapwatchdog", "unix", slow, 0));
+        CATCH_REQUIRE(limiter.accept(rules, "snapwatchdog", "unix", slow, 0));
+        CATCH_REQUIRE_FALSE(limiter.accept(rules, "snapwatchdog", "unix", slow, 0));
+        CATCH_REQUIRE(limiter.next_token(slow, 0) == 1'000'000);
+
+        // the refused message did not use a token of the connection
+        //
+        CATCH_REQUIRE(limiter.accept(rules, "snapwatchdog", "unix", fast, 0));
+        CATCH_REQUIRE(limiter.accept(rules, "snapwatchdog", "unix", fast, 0));
+        CATCH_REQUIRE_FALSE(limiter.accept(rules, "snapwatchdog", "unix", fast, 0));
+        CATCH_REQUIRE(limiter.next_token(fast, 0) == 250'000);
+        CATCH_REQUIRE(limiter.next_token(slow, 0) == 1'000'000);
+
+        CATCH_REQUIRE(limiter.set_throttled(true));
+        CATCH_REQUIRE_FALSE(limiter.set_throttled(true));
+        CATCH_REQUIRE_FALSE(limiter.set_throttled(false));
+        CATCH_REQUIRE(limiter.set_throttled(true));
+
+        // a connection changing type gets a new bucket
+        //
+        CATCH_REQUIRE(limiter.accept(rules, "snapwatchdog", "tcp", fast, 0));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("rate_limiter: delayed messages")
+    {
+        communicator_daemon::ingress_limiter limiter;
+        CATCH_REQUIRE_FALSE(limiter.has_delayed());
+
+        ed::message msg;
+        msg.set_command("RATE_ONE");
+        CATCH_REQUIRE(limiter.delay(msg, 2, 1'000));
+        msg.set_command("RATE_TWO");
+        CATCH_REQUIRE(limiter.delay(msg, 2, 2'000));
+        msg.set_command("RATE_THREE");
+        CATCH_REQUIRE_FALSE(limiter.delay(msg, 2, 3'000));
+
+        // the time each message was received is kept with it
+        //
+        CATCH_REQUIRE(limiter.has_delayed());
+        CATCH_REQUIRE(limiter.front().get_command() == "RATE_ONE");
+        CATCH_REQUIRE(limiter.front_received_on() == 1'000);
+        limiter.pop_front();
+        CATCH_REQUIRE(limiter.front().get_command() == "RATE_TWO");
+        CATCH_REQUIRE(limiter.front_received_on() == 2'000);
+        limiter.pop_front();
+        CATCH_REQUIRE_FALSE(limiter.has_delayed());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("rate_limiter: exempt messages")
+    {
+        communicator_daemon::command_id_t const heartbeat(communicator_daemon::intern_command("HEARTBEAT"));
+        communicator_daemon::command_id_t const gossip(communicator_daemon::intern_command("GOSSIP"));
+        communicator_daemon::command_id_t const user(communicator_daemon::intern_command("RATE_USER_COMMAND"));
+
+        // the control commands of the communicator links
+        //
+        CATCH_REQUIRE(communicator_daemon::is_rate_limit_exempt(heartbeat, true, false));
+        CATCH_REQUIRE(communicator_daemon::is_rate_limit_exempt(gossip, true, false));
+        CATCH_REQUIRE_FALSE(communicator_daemon::is_rate_limit_exempt(user, true, false));
+
+        // reliable messages were already acknowledged
+        //
+        CATCH_REQUIRE(communicator_daemon::is_rate_limit_exempt(user, true, true));
+
+        // a local service sending the same commands is limited
+        //
+        CATCH_REQUIRE_FALSE(communicator_daemon::is_rate_limit_exempt(heartbeat, false, false));
+        CATCH_REQUIRE_FALSE(communicator_daemon::is_rate_limit_exempt(user, false, true));
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,92 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the received_broadcasts class.
+ *
+ * This file implements tests to verify that the table of received
+ * broadcast messages detects duplicates and expires old entries.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/received_broadcasts.h>
+
+
+
+CATCH_TEST_CASE("received_broadcasts", "[broadcast]")
+{
+    CATCH_START_SECTION("received_broadcasts: duplicates")
+    {
+        communicator_daemon::received_broadcasts table;
+        time_t const now(1'700'000'000);
+
+        CATCH_REQUIRE(table.size() == 0);
+        CATCH_REQUIRE_FALSE(table.contains("monster-1"));
+
+        CATCH_REQUIRE(table.add("monster-1", now + 10, now));
+        CATCH_REQUIRE(table.contains("monster-1"));
+        CATCH_REQUIRE_FALSE(table.add("monster-1", now + 10, now));
+        CATCH_REQUIRE(table.add("monster-2", now + 10, now));
+        CATCH_REQUIRE(table.size() == 2);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("received_broadcasts: expiration")
+    {
+        communicator_daemon::received_broadcasts table;
+        time_t const now(1'700'000'000);
+
+        CATCH_REQUIRE(table.add("short", now + 5, now));
+        CATCH_REQUIRE(table.add("long", now + 10, now));
+
+        // a timeout larger than the wheel survives a full round
+        //
+        time_t const far(now + communicator_daemon::received_broadcasts::WHEEL_SIZE + 20);
+        CATCH_REQUIRE(table.add("far", far, now));
+        CATCH_REQUIRE(table.size() == 3);
+
+        table.expire(now + 5);
+        CATCH_REQUIRE(table.size() == 3);
+
+        table.expire(now + 6);
+        CATCH_REQUIRE(table.size() == 2);
+        CATCH_REQUIRE_FALSE(table.contains("short"));
+        CATCH_REQUIRE(table.contains("long"));
+
+        table.expire(now + communicator_daemon::received_broadcasts::WHEEL_SIZE + 5);
+        CATCH_REQUIRE(table.size() == 1);
+        CATCH_REQUIRE(table.contains("far"));
+
+        table.expire(far + 1);
+        CATCH_REQUIRE(table.size() == 0);
+
+        // the identifier can be reused once expired
+        //
+        CATCH_REQUIRE(table.add("short", far + 10, far + 1));
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
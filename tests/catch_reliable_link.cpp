@@ -0,0 +1,134 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the reliable link state.
+ *
+ * This file implements tests to verify the sequence numbers, the
+ * acknowledgements and the de-duplication of the reliable messages.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/reliable_link.h>
+
+
+// C++
+//
+#include    <string>
+#include    <vector>
+
+
+
+CATCH_TEST_CASE("reliable_link", "[reliable_link]")
+{
+    CATCH_START_SECTION("reliable_link: send, acknowledge and replay")
+    {
+        communicator_daemon::reliable_link link;
+        for(std::uint64_t seq(1); seq <= 5; ++seq)
+        {
+            ed::message msg;
+            msg.set_command("ORDER");
+            msg.set_service("shop");
+            CATCH_REQUIRE(link.send(msg) == seq);
+            CATCH_REQUIRE(msg.get_parameter("reliable_sequence") == std::to_string(seq));
+        }
+        CATCH_REQUIRE(link.pending() == 5);
+
+        // acknowledgements are cumulative
+        //
+        CATCH_REQUIRE(link.acknowledge(3) == 3);
+        CATCH_REQUIRE(link.acknowledge(3) == 0);
+        CATCH_REQUIRE(link.pending() == 2);
+
+        std::vector<ed::message> messages;
+        link.get_unacknowledged(messages);
+        CATCH_REQUIRE(messages.size() == 2);
+        CATCH_REQUIRE(messages[0].get_parameter("reliable_sequence") == "4");
+        CATCH_REQUIRE(messages[1].get_parameter("reliable_sequence") == "5");
+
+        CATCH_REQUIRE(link.acknowledge(10) == 2);
+        CATCH_REQUIRE(link.pending() == 0);
+        CATCH_REQUIRE(link.get_overflow() == 0);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("reliable_link: the buffer is bounded")
+    {
+        communicator_daemon::reliable_link link;
+        link.set_max_messages(3);
+        for(int i(0); i < 5; ++i)
+        {
+            ed::message msg;
+            msg.set_command("ORDER");
+            link.send(msg);
+        }
+        CATCH_REQUIRE(link.pending() == 3);
+        CATCH_REQUIRE(link.get_overflow() == 2);
+
+        std::vector<ed::message> messages;
+        link.get_unacknowledged(messages);
+        CATCH_REQUIRE(messages.front().get_parameter("reliable_sequence") == "3");
+
+        link.set_max_messages(1);
+        CATCH_REQUIRE(link.pending() == 1);
+        CATCH_REQUIRE(link.get_overflow() == 4);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("reliable_link: receive and de-duplicate")
+    {
+        communicator_daemon::reliable_link link;
+        std::uint64_t ack(0);
+        CATCH_REQUIRE_FALSE(link.take_ack(ack));
+
+        CATCH_REQUIRE(link.set_peer_session(1000));
+        CATCH_REQUIRE_FALSE(link.set_peer_session(1000));
+
+        // the first message does not have to be 1 (i.e. the peer lost
+        // some messages before we started)
+        //
+        CATCH_REQUIRE(link.receive(7) == communicator_daemon::receive_t::RECEIVE_NEW);
+        CATCH_REQUIRE(link.receive(8) == communicator_daemon::receive_t::RECEIVE_NEW);
+        CATCH_REQUIRE(link.receive(8) == communicator_daemon::receive_t::RECEIVE_DUPLICATE);
+        CATCH_REQUIRE(link.receive(2) == communicator_daemon::receive_t::RECEIVE_DUPLICATE);
+        CATCH_REQUIRE(link.take_ack(ack));
+        CATCH_REQUIRE(ack == 8);
+        CATCH_REQUIRE_FALSE(link.take_ack(ack));
+
+        CATCH_REQUIRE(link.receive(11) == communicator_daemon::receive_t::RECEIVE_GAP);
+        CATCH_REQUIRE(link.get_received() == 11);
+
+        // a restarted peer starts over
+        //
+        CATCH_REQUIRE(link.set_peer_session(2000));
+        CATCH_REQUIRE(link.get_peer_session() == 2000);
+        CATCH_REQUIRE(link.get_received() == 0);
+        CATCH_REQUIRE_FALSE(link.take_ack(ack));
+        CATCH_REQUIRE(link.receive(1) == communicator_daemon::receive_t::RECEIVE_NEW);
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
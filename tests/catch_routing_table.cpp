@@ -0,0 +1,167 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the routing_table class.
+ *
+ * This file implements tests to verify that the routing table
+ * finds and forgets routes as expected.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/base_connection.h>
+#include    <daemon/routing_table.h>
+
+
+
+namespace
+{
+
+
+
+class route_connection
+    : public communicator_daemon::base_connection
+{
+public:
+    typedef std::shared_ptr<route_connection>   pointer_t;
+
+    route_connection()
+        : base_connection(communicator_daemon::server::pointer_t(), false)
+    {
+    }
+
+    virtual int get_socket() const override
+    {
+        return -1;
+    }
+};
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("routing_table", "[routing]")
+{
+    CATCH_START_SECTION("routing_table: local routes")
+    {
+        communicator_daemon::routing_table table;
+        route_connection::pointer_t a(std::make_shared<route_connection>());
+        route_connection::pointer_t b(std::make_shared<route_connection>());
+
+        CATCH_REQUIRE(table.size() == 0);
+        CATCH_REQUIRE(table.find_route("monster", "snaplock") == nullptr);
+
+        table.add_route("monster", "snaplock", a);
+        table.add_route("monster", "snapdbproxy", b);
+        CATCH_REQUIRE(table.size() == 2);
+        CATCH_REQUIRE(table.find_route("monster", "snaplock") == a);
+        CATCH_REQUIRE(table.find_route("monster", "snapdbproxy") == b);
+        CATCH_REQUIRE(table.find_route("other", "snaplock") == nullptr);
+        CATCH_REQUIRE(table.find_link("monster") == nullptr);
+
+        table.remove_connection(a.get());
+        CATCH_REQUIRE(table.size() == 1);
+        CATCH_REQUIRE(table.find_route("monster", "snaplock") == nullptr);
+        CATCH_REQUIRE(table.find_route("monster", "snapdbproxy") == b);
+
+        b.reset();
+        CATCH_REQUIRE(table.find_route("monster", "snapdbproxy") == nullptr);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("routing_table: remote links")
+    {
+        communicator_daemon::routing_table table;
+        route_connection::pointer_t r1(std::make_shared<route_connection>());
+        route_connection::pointer_t r2(std::make_shared<route_connection>());
+
+        table.add_link("far", { "fluid_settings", "snaplock" }, r1);
+        table.add_link("away", { "snaplock" }, r2);
+        CATCH_REQUIRE(table.size() == 5);
+        CATCH_REQUIRE(table.find_link("far") == r1);
+        CATCH_REQUIRE(table.find_link("away") == r2);
+        CATCH_REQUIRE(table.find_route("far", "fluid_settings") == r1);
+        CATCH_REQUIRE(table.find_route("away", "fluid_settings") == nullptr);
+
+        communicator_daemon::routing_table::connection_vector_t links;
+        table.get_links(links);
+        CATCH_REQUIRE(links.size() == 2);
+
+        // a new link replaces the previous services of that connection
+        //
+        table.add_link("far", { "snaplock" }, r1);
+        CATCH_REQUIRE(table.size() == 4);
+        CATCH_REQUIRE(table.find_route("far", "fluid_settings") == nullptr);
+        CATCH_REQUIRE(table.find_route("far", "snaplock") == r1);
+
+        table.remove_connection(r2.get());
+        links.clear();
+        table.get_links(links);
+        CATCH_REQUIRE(links.size() == 1);
+        CATCH_REQUIRE(links[0] == r1);
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("routing_table: next hops")
+    {
+        communicator_daemon::routing_table table;
+        route_connection::pointer_t r1(std::make_shared<route_connection>());
+        route_connection::pointer_t r2(std::make_shared<route_connection>());
+
+        table.add_link("far", { "snaplock" }, r1, { "snapdbproxy" });
+        table.add_link("away", { "snapdbproxy" }, r2, { "snaplock", "sitter" });
+
+        // direct next hops win over "heard of" next hops
+        //
+        communicator_daemon::routing_table::connection_vector_t hops;
+        table.find_next_hops("snapdbproxy", hops);
+        CATCH_REQUIRE(hops.size() == 1);
+        CATCH_REQUIRE(hops[0] == r2);
+
+        hops.clear();
+        table.find_next_hops("sitter", hops);
+        CATCH_REQUIRE(hops.size() == 1);
+        CATCH_REQUIRE(hops[0] == r2);
+
+        hops.clear();
+        table.find_next_hops("unknown", hops);
+        CATCH_REQUIRE(hops.empty());
+
+        table.remove_connection(r2.get());
+        hops.clear();
+        table.find_next_hops("snapdbproxy", hops);
+        CATCH_REQUIRE(hops.size() == 1);
+        CATCH_REQUIRE(hops[0] == r1);
+
+        hops.clear();
+        table.find_next_hops("sitter", hops);
+        CATCH_REQUIRE(hops.empty());
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
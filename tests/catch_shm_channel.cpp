@@ -0,0 +1,101 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the shared memory channel.
+ *
+ * This file implements tests to verify that the descriptors of a channel
+ * can be passed over a Unix socket and that messages go both ways,
+ * including when a ring is full.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <communicatord/shm_channel.h>
+
+
+// C
+//
+#include    <sys/socket.h>
+#include    <unistd.h>
+
+
+
+CATCH_TEST_CASE("shm_channel", "[shm]")
+{
+    CATCH_START_SECTION("shm_channel: exchange messages")
+    {
+        int sv[2];
+        CATCH_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+        communicatord::shm_channel::pointer_t daemon(communicatord::shm_channel::create(4096));
+        CATCH_REQUIRE(daemon != nullptr);
+
+        // the client writes its token first, then waits for the descriptors
+        //
+        char const token[] = "secret\n";
+        CATCH_REQUIRE(write(sv[0], token, sizeof(token) - 1) == sizeof(token) - 1);
+        char buf[sizeof(token) - 1];
+        CATCH_REQUIRE(read(sv[1], buf, sizeof(buf)) == sizeof(buf));
+        CATCH_REQUIRE(daemon->send_descriptors(sv[1]));
+
+        communicatord::shm_channel::pointer_t client(communicatord::shm_channel::receive_descriptors(sv[0], "ignored"));
+        CATCH_REQUIRE(client != nullptr);
+        close(sv[0]);
+        close(sv[1]);
+
+        CATCH_REQUIRE(client->send("REGISTER service=test"));
+        std::string msg;
+        CATCH_REQUIRE(daemon->receive(msg));
+        CATCH_REQUIRE(msg == "REGISTER service=test");
+        CATCH_REQUIRE_FALSE(daemon->receive(msg));
+        CATCH_REQUIRE(daemon->prepare_to_sleep());
+
+        // fill the ring, the extra messages are kept pending
+        //
+        std::string const data(1000, 'x');
+        for(int i(0); i < 10; ++i)
+        {
+            CATCH_REQUIRE(daemon->send(data + std::to_string(i)));
+        }
+        CATCH_REQUIRE_FALSE(daemon->flush());
+        for(int i(0); i < 10; ++i)
+        {
+            if(!client->receive(msg))
+            {
+                daemon->flush();
+                CATCH_REQUIRE(client->receive(msg));
+            }
+            CATCH_REQUIRE(msg == data + std::to_string(i));
+        }
+        CATCH_REQUIRE(daemon->flush());
+
+        // too large for the ring, has to go through the socket
+        //
+        CATCH_REQUIRE_FALSE(daemon->send(std::string(5000, 'y')));
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,130 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the spsc_queue template.
+ *
+ * This file implements tests to verify that the single producer single
+ * consumer queue keeps the items in order, including when the producer
+ * and the consumer run in separate threads.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/spsc_queue.h>
+
+
+// C++
+//
+#include    <string>
+#include    <thread>
+
+
+
+CATCH_TEST_CASE("spsc_queue", "[spsc_queue]")
+{
+    CATCH_START_SECTION("spsc_queue: capacity is a power of two")
+    {
+        communicator_daemon::spsc_queue<int> q(5);
+        CATCH_REQUIRE(q.capacity() == 8);
+        CATCH_REQUIRE(q.empty());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("spsc_queue: items come out in order until full")
+    {
+        communicator_daemon::spsc_queue<std::string> q(4);
+        bool was_empty(false);
+        std::string item("one");
+        CATCH_REQUIRE(q.push(item, &was_empty));
+        CATCH_REQUIRE(was_empty);
+        item = "two";
+        CATCH_REQUIRE(q.push(item, &was_empty));
+        CATCH_REQUIRE_FALSE(was_empty);
+        item = "three";
+        CATCH_REQUIRE(q.push(item));
+        item = "four";
+        CATCH_REQUIRE(q.push(item));
+        CATCH_REQUIRE(q.size() == 4);
+
+        // a full queue leaves the item alone
+        //
+        item = "five";
+        CATCH_REQUIRE_FALSE(q.push(item));
+        CATCH_REQUIRE(item == "five");
+
+        CATCH_REQUIRE(q.pop(item));
+        CATCH_REQUIRE(item == "one");
+        item = "five";
+        CATCH_REQUIRE(q.push(item));
+
+        char const * expected[] = { "two", "three", "four", "five" };
+        for(auto const * e : expected)
+        {
+            CATCH_REQUIRE(q.pop(item));
+            CATCH_REQUIRE(item == e);
+        }
+        CATCH_REQUIRE_FALSE(q.pop(item));
+        CATCH_REQUIRE(q.empty());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("spsc_queue: producer and consumer threads")
+    {
+        constexpr int const count(100'000);
+        communicator_daemon::spsc_queue<int> q(64);
+        std::thread producer([&q]()
+            {
+                for(int i(1); i <= count; ++i)
+                {
+                    int item(i);
+                    while(!q.push(item))
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+
+        int expected(1);
+        while(expected <= count)
+        {
+            int item(0);
+            if(q.pop(item))
+            {
+                CATCH_REQUIRE(item == expected);
+                ++expected;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+        producer.join();
+        CATCH_REQUIRE(q.empty());
+    }
+    CATCH_END_SECTION()
+}
+
+
+
+// vim: ts=4 sw=4 et
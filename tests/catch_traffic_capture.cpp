@@ -0,0 +1,215 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the traffic capture.
+ *
+ * This file implements tests to verify that the records saved by the
+ * traffic capture are read back as is and that a truncated capture ends
+ * on its last complete record.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <communicatord/capture.h>
+#include    <daemon/traffic_capture.h>
+
+
+// snapdev
+//
+#include    <snapdev/file_contents.h>
+
+
+// C
+//
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
+
+namespace
+{
+
+
+
+communicatord::capture_record make_record(std::int64_t idx)
+{
+    communicatord::capture_record r;
+    r.f_timestamp = 1'700'000'000'000'000LL + idx * 1'000;
+    r.f_route = static_cast<std::uint8_t>(idx % 3);
+    r.f_source_type = idx % 2 == 0 ? "local" : "remote";
+    r.f_source = "service" + std::to_string(idx % 5);
+    r.f_connection = idx % 5;
+    r.f_message = "unit_test/PING index=" + std::to_string(idx);
+    return r;
+}
+
+
+std::vector<std::string> const g_route_names =
+{
+    "handled",
+    "forwarded",
+    "broadcast",
+};
+
+
+
+} // no name namespace
+
+
+
+CATCH_TEST_CASE("traffic_capture", "[traffic_capture]")
+{
+    CATCH_START_SECTION("traffic_capture: write and read back")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/capture");
+        mkdir(path.c_str(), 0700);
+        std::string const filename(path + "/traffic.capture");
+
+        {
+            communicator_daemon::traffic_capture capture(filename);
+            CATCH_REQUIRE(capture.open(g_route_names));
+            CATCH_REQUIRE(capture.is_open());
+            for(std::int64_t idx(0); idx < 10'000; ++idx)
+            {
+                capture.record(make_record(idx));
+            }
+            communicatord::capture_record none;
+            none.f_message = "UNROUTED";
+            capture.record(none);
+            capture.close();
+            CATCH_REQUIRE_FALSE(capture.is_open());
+            CATCH_REQUIRE(capture.get_records() == 10'001);
+            CATCH_REQUIRE(capture.get_dropped() == 0);
+        }
+
+        struct stat st;
+        CATCH_REQUIRE(stat(filename.c_str(), &st) == 0);
+        CATCH_REQUIRE((st.st_mode & 0777) == 0600);
+
+        communicatord::capture_reader reader;
+        CATCH_REQUIRE(reader.open(filename));
+        CATCH_REQUIRE(reader.get_route_names() == g_route_names);
+        CATCH_REQUIRE(reader.get_route_name(1) == "forwarded");
+        CATCH_REQUIRE(reader.get_route_name(communicatord::capture_record::NO_ROUTE) == "none");
+
+        communicatord::capture_record r;
+        for(std::int64_t idx(0); idx < 10'000; ++idx)
+        {
+            communicatord::capture_record const expected(make_record(idx));
+            CATCH_REQUIRE(reader.next(r));
+            CATCH_REQUIRE(r.f_timestamp == expected.f_timestamp);
+            CATCH_REQUIRE(r.f_route == expected.f_route);
+            CATCH_REQUIRE(r.f_source_type == expected.f_source_type);
+            CATCH_REQUIRE(r.f_source == expected.f_source);
+            CATCH_REQUIRE(r.f_connection == expected.f_connection);
+            CATCH_REQUIRE(r.f_message == expected.f_message);
+        }
+        CATCH_REQUIRE(reader.next(r));
+        CATCH_REQUIRE(r.f_route == communicatord::capture_record::NO_ROUTE);
+        CATCH_REQUIRE(r.f_connection == -1);
+        CATCH_REQUIRE(r.f_source.empty());
+        CATCH_REQUIRE(r.f_message == "UNROUTED");
+
+        CATCH_REQUIRE_FALSE(reader.next(r));
+        CATCH_REQUIRE_FALSE(reader.is_truncated());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("traffic_capture: maximum size")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/capture");
+        mkdir(path.c_str(), 0700);
+        std::string const filename(path + "/limited.capture");
+
+        communicator_daemon::traffic_capture capture(filename, 1'000);
+        CATCH_REQUIRE(capture.open(g_route_names));
+        for(std::int64_t idx(0); idx < 100; ++idx)
+        {
+            capture.record(make_record(idx));
+        }
+        capture.close();
+        CATCH_REQUIRE(capture.get_records() > 0);
+        CATCH_REQUIRE(capture.get_records() + capture.get_dropped() == 100);
+        CATCH_REQUIRE(capture.get_bytes() <= 1'000);
+
+        struct stat st;
+        CATCH_REQUIRE(stat(filename.c_str(), &st) == 0);
+        CATCH_REQUIRE(static_cast<std::uint64_t>(st.st_size) == capture.get_bytes());
+
+        communicatord::capture_reader reader;
+        CATCH_REQUIRE(reader.open(filename));
+        communicatord::capture_record r;
+        std::uint64_t count(0);
+        while(reader.next(r))
+        {
+            ++count;
+        }
+        CATCH_REQUIRE(count == capture.get_records());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("traffic_capture: truncated capture")
+    {
+        std::string const path(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/capture");
+        mkdir(path.c_str(), 0700);
+        std::string const filename(path + "/truncated.capture");
+
+        std::string data(communicatord::capture_header(g_route_names));
+        communicatord::append_capture_record(data, make_record(1));
+        communicatord::append_capture_record(data, make_record(2));
+        data.resize(data.length() - 3);
+        {
+            snapdev::file_contents out(filename);
+            out.contents(data);
+            CATCH_REQUIRE(out.write_all());
+        }
+
+        communicatord::capture_reader reader;
+        CATCH_REQUIRE(reader.open(filename));
+        communicatord::capture_record r;
+        CATCH_REQUIRE(reader.next(r));
+        CATCH_REQUIRE(r.f_message == make_record(1).f_message);
+        CATCH_REQUIRE_FALSE(reader.next(r));
+        CATCH_REQUIRE(reader.is_truncated());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("traffic_capture: invalid header")
+    {
+        std::string const filename(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/capture/invalid.capture");
+        {
+            snapdev::file_contents out(filename);
+            out.contents("CACHE-JOURNAL 1\n");
+            CATCH_REQUIRE(out.write_all());
+        }
+
+        communicatord::capture_reader reader;
+        CATCH_REQUIRE_FALSE(reader.open(filename));
+        CATCH_REQUIRE_FALSE(reader.open(SNAP_CATCH2_NAMESPACE::g_tmp_dir() + "/capture/no-such-file.capture"));
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
@@ -0,0 +1,173 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Verify the packed parameters wire format.
+ *
+ * This file implements tests to verify that messages with their
+ * parameters packed in the wire format are restored as is.
+ */
+
+// self
+//
+#include    "catch_main.h"
+
+
+// communicatord
+//
+#include    <daemon/wire_format.h>
+
+
+// C
+//
+#include    <stdio.h>
+
+
+
+CATCH_TEST_CASE("wire_format", "[wire]")
+{
+    CATCH_START_SECTION("wire_format: round trip")
+    {
+        ed::message msg;
+        msg.set_command("PING");
+        msg.set_server("monster");
+        msg.set_service("snaplock");
+        msg.add_parameter("broadcast_hops", "3");
+        msg.add_parameter("negative", "-42");
+        msg.add_parameter("leading_zero", "007");
+        msg.add_parameter("timestamp", "1700000000.000001234");
+        msg.add_parameter("text", "multiple\nlines; with = signs");
+
+        ed::message wire;
+        CATCH_REQUIRE(communicator_daemon::encode_wire_message(msg, wire));
+        CATCH_REQUIRE(wire.get_command() == "PING");
+        CATCH_REQUIRE(wire.get_server() == "monster");
+        CATCH_REQUIRE(wire.get_service() == "snaplock");
+        CATCH_REQUIRE(wire.has_parameter("wire"));
+        CATCH_REQUIRE_FALSE(wire.has_parameter("broadcast_hops"));
+
+        // already encoded
+        //
+        ed::message twice;
+        CATCH_REQUIRE_FALSE(communicator_daemon::encode_wire_message(wire, twice));
+
+        ed::message decoded;
+        CATCH_REQUIRE(communicator_daemon::decode_wire_message(wire, decoded));
+        CATCH_REQUIRE(decoded.get_command() == "PING");
+        CATCH_REQUIRE(decoded.get_server() == "monster");
+        CATCH_REQUIRE(decoded.get_service() == "snaplock");
+        CATCH_REQUIRE(decoded.get_all_parameters() == msg.get_all_parameters());
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("wire_format: text messages are left alone")
+    {
+        ed::message msg;
+        msg.set_command("HELP");
+
+        ed::message wire;
+        CATCH_REQUIRE_FALSE(communicator_daemon::encode_wire_message(msg, wire));
+
+        ed::message decoded;
+        CATCH_REQUIRE_FALSE(communicator_daemon::decode_wire_message(msg, decoded));
+
+        msg.add_parameter("wire", "not*base64");
+        CATCH_REQUIRE_FALSE(communicator_daemon::decode_wire_message(msg, decoded));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("wire_format: compressed messages")
+    {
+        std::string services;
+        for(int i(0); i < 50; ++i)
+        {
+            services += "service";
+            services += std::to_string(i % 7);
+            services += ',';
+        }
+
+        ed::message msg;
+        msg.set_command("STATUS");
+        msg.set_service("*");
+        msg.add_parameter("services", services);
+        msg.add_parameter("status", "up");
+
+        ed::message plain;
+        CATCH_REQUIRE(communicator_daemon::encode_wire_message(msg, plain));
+
+        ed::message compressed;
+        CATCH_REQUIRE(communicator_daemon::encode_wire_message(msg, compressed, 3, 64));
+        CATCH_REQUIRE(compressed.get_parameter("wire").length() < plain.get_parameter("wire").length());
+
+        ed::message decoded;
+        CATCH_REQUIRE(communicator_daemon::decode_wire_message(compressed, decoded));
+        CATCH_REQUIRE(decoded.get_command() == "STATUS");
+        CATCH_REQUIRE(decoded.get_all_parameters() == msg.get_all_parameters());
+
+        // below the threshold, the message is not compressed
+        //
+        ed::message small;
+        CATCH_REQUIRE(communicator_daemon::encode_wire_message(msg, small, 3, 100000));
+        CATCH_REQUIRE(small.get_parameter("wire") == plain.get_parameter("wire"));
+    }
+    CATCH_END_SECTION()
+
+    CATCH_START_SECTION("wire_format: compression saves bytes at the default threshold")
+    {
+        // values which do not repeat, so the gain only comes from the
+        // dictionary and zstd, not from a repeated pattern
+        //
+        std::uint32_t seed(1);
+        std::string objects;
+        while(objects.length() < 1024)
+        {
+            if(!objects.empty())
+            {
+                objects += ',';
+            }
+            seed = seed * 1103515245 + 12345;
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%08x-%04x", seed, seed >> 16);
+            objects += buf;
+        }
+
+        ed::message msg;
+        msg.set_command("LOCK_ACQUIRED");
+        msg.set_service("snaplock");
+        msg.add_parameter("object_name", objects);
+        msg.add_parameter("timeout", 1700000123);
+
+        ed::message plain;
+        CATCH_REQUIRE(communicator_daemon::encode_wire_message(msg, plain));
+
+        // 1024 is the default of --link-compression-threshold
+        //
+        ed::message compressed;
+        CATCH_REQUIRE(communicator_daemon::encode_wire_message(msg, compressed, 3, 1024));
+        CATCH_REQUIRE(compressed.get_parameter("wire").length() < plain.get_parameter("wire").length());
+        CATCH_REQUIRE(compressed.to_message().length() < msg.to_message().length());
+
+        ed::message decoded;
+        CATCH_REQUIRE(communicator_daemon::decode_wire_message(compressed, decoded));
+        CATCH_REQUIRE(decoded.get_all_parameters() == msg.get_all_parameters());
+    }
+    CATCH_END_SECTION()
+}
+
+
+// vim: ts=4 sw=4 et
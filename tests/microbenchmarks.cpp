@@ -0,0 +1,625 @@
+// Copyright (c) 2011-2024  Made to Order Software Corp.  All Rights Reserved
+//
+// https://snapwebsites.org/project/communicator
+// contact@m2osw.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+/** \file
+ * \brief Microbenchmarks of the communicator daemon hot paths.
+ *
+ * This tool times the objects used by the daemon when it forwards,
+ * broadcasts and caches messages: the routing table used by
+ * forward_message(), the received broadcasts used by
+ * check_broadcast_message(), the wire format, serialization and
+ * message pool used by broadcast_message(), the cache, the
+ * canonicalization functions and the load average file.
+ *
+ * The sizes are parameterized with --connections, --services and
+ * --cache-size. Each benchmark outputs one JSON object per line so the
+ * results can easily be compared between two versions.
+ *
+ * With --capture, the messages of a traffic capture saved by the
+ * communicatord (see its --capture-file option) are also parsed, routed
+ * and cached so the changes can be checked against the real mix of
+ * messages.
+ */
+
+// communicatord
+//
+#include    <communicatord/capture.h>
+#include    <communicatord/loadavg.h>
+#include    <communicatord/version.h>
+
+
+// daemon
+//
+#include    <daemon/base_connection.h>
+#include    <daemon/cache.h>
+#include    <daemon/message_pool.h>
+#include    <daemon/received_broadcasts.h>
+#include    <daemon/routing_table.h>
+#include    <daemon/utils.h>
+#include    <daemon/wire_format.h>
+
+
+// advgetopt
+//
+#include    <advgetopt/advgetopt.h>
+#include    <advgetopt/exception.h>
+
+
+// snapdev
+//
+#include    <snapdev/stringize.h>
+
+
+// C++
+//
+#include    <chrono>
+#include    <functional>
+#include    <iostream>
+#include    <random>
+
+
+// C
+//
+#include    <arpa/inet.h>
+#include    <sys/stat.h>
+#include    <unistd.h>
+
+
+// last include
+//
+#include    <snapdev/poison.h>
+
+
+
+namespace
+{
+
+
+
+const advgetopt::option g_options[] =
+{
+    advgetopt::define_option(
+          advgetopt::Name("cache-size")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("1000")
+        , advgetopt::Help("number of messages added to the cache.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("capture")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::Help("also time the messages found in this traffic capture.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("connections")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("100")
+        , advgetopt::Help("number of remote communicator daemons (links) and load average entries.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("filter")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::Help("only run the benchmarks which name includes this string.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("iterations")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("100000")
+        , advgetopt::Help("number of operations timed per benchmark.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("services")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("50")
+        , advgetopt::Help("number of services advertised by each connection.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("tmp-dir")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("/tmp/communicatord-microbenchmarks")
+        , advgetopt::Help("directory where the load average file gets saved.")
+    ),
+    advgetopt::end_options()
+};
+
+
+// until we have C++20, remove warnings this way
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+advgetopt::options_environment const g_options_environment =
+{
+    .f_project_name = "communicatord",
+    .f_group_name = nullptr,
+    .f_options = g_options,
+    .f_options_files_directory = nullptr,
+    .f_environment_variable_name = nullptr,
+    .f_environment_variable_intro = nullptr,
+    .f_section_variables_name = nullptr,
+    .f_configuration_files = nullptr,
+    .f_configuration_filename = nullptr,
+    .f_configuration_directories = nullptr,
+    .f_environment_flags = advgetopt::GETOPT_ENVIRONMENT_FLAG_PROCESS_SYSTEM_PARAMETERS,
+    .f_help_header = "Usage: %p [-<opt>]\n"
+                     "where -<opt> is one or more of:",
+    .f_help_footer = "%c",
+    .f_version = COMMUNICATORD_VERSION_STRING,
+    .f_license = "GNU GPL v3",
+    .f_copyright = "Copyright (c) 2011-"
+                   SNAPDEV_STRINGIZE(UTC_BUILD_YEAR)
+                   " by Made to Order Software Corporation -- All Rights Reserved",
+};
+#pragma GCC diagnostic pop
+
+
+
+class bench_connection
+    : public communicator_daemon::base_connection
+{
+public:
+    typedef std::shared_ptr<bench_connection>   pointer_t;
+
+    bench_connection()
+        : base_connection(communicator_daemon::server::pointer_t(), false)
+    {
+    }
+
+    virtual int get_socket() const override
+    {
+        return -1;
+    }
+};
+
+
+std::string server_name(std::size_t idx)
+{
+    return "server" + std::to_string(idx);
+}
+
+
+std::string service_name(std::size_t idx)
+{
+    return "service" + std::to_string(idx);
+}
+
+
+communicatord::loadavg_item make_item(std::size_t idx)
+{
+    communicatord::loadavg_item item;
+    item.f_address.sin6_family = AF_INET6;
+    item.f_address.sin6_addr.s6_addr[10] = 0xFF;
+    item.f_address.sin6_addr.s6_addr[11] = 0xFF;
+    item.f_address.sin6_addr.s6_addr[12] = 10;
+    item.f_address.sin6_addr.s6_addr[13] = static_cast<std::uint8_t>(idx >> 16);
+    item.f_address.sin6_addr.s6_addr[14] = static_cast<std::uint8_t>(idx >> 8);
+    item.f_address.sin6_addr.s6_addr[15] = static_cast<std::uint8_t>(idx);
+    item.f_address.sin6_port = htons(4040);
+    item.f_avg = static_cast<float>(idx % 100) / 10.0f;
+    return item;
+}
+
+
+ed::message make_message(std::size_t idx, std::size_t services)
+{
+    ed::message msg;
+    msg.set_server(server_name(idx % 10));
+    msg.set_service(service_name(idx % services));
+    msg.set_command("BENCHMARK");
+    msg.add_parameter("index", idx);
+    msg.add_parameter("payload", std::string(64, 'x'));
+    return msg;
+}
+
+
+
+class microbenchmarks
+{
+public:
+    microbenchmarks(int argc, char * argv[])
+        : f_opts(g_options_environment)
+    {
+        f_opts.finish_parsing(argc, argv);
+
+        f_connections = static_cast<std::size_t>(std::max(f_opts.get_long("connections"), 1L));
+        f_services = static_cast<std::size_t>(std::max(f_opts.get_long("services"), 1L));
+        f_cache_size = static_cast<std::size_t>(std::max(f_opts.get_long("cache-size"), 1L));
+        f_iterations = static_cast<std::size_t>(std::max(f_opts.get_long("iterations"), 1L));
+        if(f_opts.is_defined("filter"))
+        {
+            f_filter = f_opts.get_string("filter");
+        }
+        f_tmp_dir = f_opts.get_string("tmp-dir");
+        if(f_opts.is_defined("capture"))
+        {
+            f_capture = f_opts.get_string("capture");
+        }
+    }
+
+    int run()
+    {
+        bench_routing_table();
+        bench_received_broadcasts();
+        bench_serialization();
+        bench_cache();
+        bench_canonicalize();
+        bench_loadavg_file();
+        return bench_capture() ? 0 : 1;
+    }
+
+private:
+    /** \brief Time \p count calls to \p f and output the result.
+     *
+     * The output is one JSON object with the name of the benchmark, the
+     * parameters and the average number of nanoseconds per operation.
+     */
+    void measure(
+          std::string const & name
+        , std::size_t count
+        , std::function<void(std::size_t idx)> f)
+    {
+        if(!f_filter.empty()
+        && name.find(f_filter) == std::string::npos)
+        {
+            return;
+        }
+
+        std::chrono::steady_clock::time_point const start(std::chrono::steady_clock::now());
+        for(std::size_t idx(0); idx < count; ++idx)
+        {
+            f(idx);
+        }
+        std::chrono::steady_clock::time_point const end(std::chrono::steady_clock::now());
+
+        double const ns(static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+        double const ns_per_op(ns / static_cast<double>(count));
+        std::cout << "{\"name\":\"" << name << '"'
+                  << ",\"connections\":" << f_connections
+                  << ",\"services\":" << f_services
+                  << ",\"cache_size\":" << f_cache_size
+                  << ",\"operations\":" << count
+                  << ",\"ns_per_op\":" << ns_per_op
+                  << ",\"ops_per_sec\":" << (ns_per_op > 0.0 ? 1'000'000'000.0 / ns_per_op : 0.0)
+                  << ",\"checksum\":" << f_checksum
+                  << "}" << std::endl;
+        f_checksum = 0;
+    }
+
+    // forward_message() searches the routing table
+    //
+    void bench_routing_table()
+    {
+        communicator_daemon::routing_table table;
+        std::vector<bench_connection::pointer_t> connections;
+        advgetopt::string_set_t services;
+        for(std::size_t s(0); s < f_services; ++s)
+        {
+            services.insert(service_name(s));
+        }
+        for(std::size_t c(0); c < f_connections; ++c)
+        {
+            connections.push_back(std::make_shared<bench_connection>());
+            table.add_link(server_name(c), services, connections.back());
+        }
+        for(std::size_t s(0); s < f_services; ++s)
+        {
+            connections.push_back(std::make_shared<bench_connection>());
+            table.add_route("local", service_name(s) + "_local", connections.back());
+        }
+
+        std::vector<std::pair<std::string, std::string>> keys;
+        std::mt19937 rng(1);
+        for(std::size_t idx(0); idx < 1024; ++idx)
+        {
+            keys.emplace_back(
+                      server_name(rng() % f_connections)
+                    , service_name(rng() % f_services));
+        }
+
+        measure("routing_table.find_route", f_iterations, [&](std::size_t idx)
+            {
+                auto const & k(keys[idx % keys.size()]);
+                f_checksum += table.find_route(k.first, k.second) != nullptr ? 1 : 0;
+            });
+
+        communicator_daemon::routing_table::connection_vector_t hops;
+        measure("routing_table.find_next_hops", f_iterations, [&](std::size_t idx)
+            {
+                hops.clear();
+                table.find_next_hops(keys[idx % keys.size()].second, hops);
+                f_checksum += hops.size();
+            });
+
+        measure("routing_table.add_link", f_connections, [&](std::size_t idx)
+            {
+                table.add_link(server_name(idx), services, connections[idx]);
+                f_checksum += table.size();
+            });
+    }
+
+    // check_broadcast_message() searches and adds message identifiers
+    //
+    void bench_received_broadcasts()
+    {
+        communicator_daemon::received_broadcasts received;
+        time_t const now(time(nullptr));
+        measure("received_broadcasts.add", f_iterations, [&](std::size_t idx)
+            {
+                f_checksum += received.add(
+                          server_name(idx % f_connections) + "-" + std::to_string(idx)
+                        , now + 10 + static_cast<time_t>(idx % 50)
+                        , now) ? 1 : 0;
+            });
+
+        measure("received_broadcasts.contains", f_iterations, [&](std::size_t idx)
+            {
+                f_checksum += received.contains(
+                          server_name(idx % f_connections) + "-" + std::to_string(idx * 2)) ? 1 : 0;
+            });
+
+        measure("received_broadcasts.expire", 60, [&](std::size_t idx)
+            {
+                received.expire(now + static_cast<time_t>(idx));
+                f_checksum += received.size();
+            });
+    }
+
+    // broadcast_message() serializes the message once per connection
+    //
+    void bench_serialization()
+    {
+        ed::message const msg(make_message(1, f_services));
+        measure("message.to_message", f_iterations, [&](std::size_t)
+            {
+                f_checksum += msg.to_message().length();
+            });
+
+        // broadcast_message() copies the message it forwards
+        //
+        measure("message.copy", f_iterations, [&](std::size_t)
+            {
+                ed::message copy(msg);
+                f_checksum += copy.get_command().length();
+            });
+
+        communicator_daemon::message_pool pool;
+        measure("message_pool.acquire", f_iterations, [&](std::size_t)
+            {
+                communicator_daemon::message_pool::message_ptr copy(pool.acquire(msg));
+                f_checksum += copy->get_command().length();
+            });
+
+        std::string const serialized(msg.to_message());
+        measure("message.from_message", f_iterations, [&](std::size_t)
+            {
+                ed::message m;
+                f_checksum += m.from_message(serialized) ? 1 : 0;
+            });
+
+        measure("wire_format.encode_decode", f_iterations, [&](std::size_t)
+            {
+                ed::message wire;
+                ed::message decoded;
+                if(communicator_daemon::encode_wire_message(msg, wire)
+                && communicator_daemon::decode_wire_message(wire, decoded))
+                {
+                    ++f_checksum;
+                }
+            });
+    }
+
+    void bench_cache()
+    {
+        communicator_daemon::cache c;
+        c.set_limits(0, 0, 0, 0);
+        measure("cache.cache_message", f_cache_size, [&](std::size_t idx)
+            {
+                ed::message msg(make_message(idx, f_services));
+                f_checksum += static_cast<std::size_t>(c.cache_message(msg));
+            });
+
+        measure("cache.process_messages", f_services, [&](std::size_t idx)
+            {
+                c.process_messages(service_name(idx), [&](ed::message & msg)
+                    {
+                        f_checksum += msg.get_command().length();
+                        return true;
+                    });
+            });
+    }
+
+    void bench_canonicalize()
+    {
+        std::string services;
+        for(std::size_t s(0); s < f_services; ++s)
+        {
+            services += service_name(f_services - s - 1) + ", ";
+        }
+        measure("utils.canonicalize_services", std::max(f_iterations / 100, static_cast<std::size_t>(1)), [&](std::size_t)
+            {
+                f_checksum += communicator_daemon::canonicalize_services(services).size();
+            });
+
+        std::string neighbors;
+        for(std::size_t c(0); c < f_connections; ++c)
+        {
+            neighbors += "10.0." + std::to_string((c >> 8) & 255) + "." + std::to_string(c & 255) + ":4042, ";
+        }
+        measure("utils.canonicalize_neighbors", std::max(f_iterations / 100, static_cast<std::size_t>(1)), [&](std::size_t)
+            {
+                f_checksum += communicator_daemon::canonicalize_neighbors(neighbors).length();
+            });
+    }
+
+    void bench_loadavg_file()
+    {
+        mkdir(f_tmp_dir.c_str(), 0700);
+        communicatord::set_loadavg_path(f_tmp_dir);
+
+        communicatord::loadavg_file file;
+        for(std::size_t c(0); c < f_connections; ++c)
+        {
+            file.add(make_item(c));
+        }
+
+        measure("loadavg_file.save", 100, [&](std::size_t)
+            {
+                f_checksum += file.save() ? 1 : 0;
+            });
+
+        measure("loadavg_file.load", 100, [&](std::size_t)
+            {
+                communicatord::loadavg_file f;
+                f_checksum += f.load() ? 1 : 0;
+            });
+
+        measure("loadavg_file.find", f_iterations, [&](std::size_t idx)
+            {
+                f_checksum += file.find(make_item(idx % f_connections).f_address) != nullptr ? 1 : 0;
+            });
+
+        measure("loadavg_file.find_least_busy", f_iterations / 10 + 1, [&](std::size_t)
+            {
+                f_checksum += file.find_least_busy() != nullptr ? 1 : 0;
+            });
+    }
+
+    // replay the messages of a real capture through the same objects
+    //
+    bool bench_capture()
+    {
+        if(f_capture.empty())
+        {
+            return true;
+        }
+
+        communicatord::capture_reader reader;
+        if(!reader.open(f_capture))
+        {
+            std::cerr << "microbenchmarks: could not open capture \"" << f_capture << "\"." << std::endl;
+            return false;
+        }
+        std::vector<std::string> serialized;
+        communicatord::capture_record record;
+        while(reader.next(record))
+        {
+            serialized.push_back(std::move(record.f_message));
+        }
+        if(serialized.empty())
+        {
+            std::cerr << "microbenchmarks: capture \"" << f_capture << "\" is empty." << std::endl;
+            return false;
+        }
+
+        std::vector<ed::message> messages;
+        messages.reserve(serialized.size());
+        measure("capture.from_message", serialized.size(), [&](std::size_t idx)
+            {
+                ed::message m;
+                if(m.from_message(serialized[idx]))
+                {
+                    messages.push_back(std::move(m));
+                    ++f_checksum;
+                }
+            });
+        if(messages.empty())
+        {
+            return true;
+        }
+
+        // one route per destination found in the capture
+        //
+        communicator_daemon::routing_table table;
+        std::vector<bench_connection::pointer_t> connections;
+        for(auto const & m : messages)
+        {
+            if(table.find_route(m.get_server(), m.get_service()) == nullptr)
+            {
+                connections.push_back(std::make_shared<bench_connection>());
+                table.add_route(m.get_server(), m.get_service(), connections.back());
+            }
+        }
+        measure("capture.routing_table.find_route", messages.size(), [&](std::size_t idx)
+            {
+                ed::message const & m(messages[idx]);
+                f_checksum += table.find_route(m.get_server(), m.get_service()) != nullptr ? 1 : 0;
+            });
+
+        measure("capture.to_message", messages.size(), [&](std::size_t idx)
+            {
+                f_checksum += messages[idx].to_message().length();
+            });
+
+        communicator_daemon::cache c;
+        c.set_limits(0, 0, 0, 0);
+        measure("capture.cache_message", std::min(messages.size(), f_cache_size), [&](std::size_t idx)
+            {
+                ed::message msg(messages[idx]);
+                f_checksum += static_cast<std::size_t>(c.cache_message(msg));
+            });
+
+        return true;
+    }
+
+    advgetopt::getopt           f_opts;
+    std::size_t                 f_connections = 100;
+    std::size_t                 f_services = 50;
+    std::size_t                 f_cache_size = 1000;
+    std::size_t                 f_iterations = 100000;
+    std::string                 f_filter = std::string();
+    std::string                 f_tmp_dir = std::string();
+    std::string                 f_capture = std::string();
+    std::size_t                 f_checksum = 0;     // prevent the compiler from optimizing the loops away
+};
+
+
+
+} // no name namespace
+
+
+
+int main(int argc, char * argv[])
+{
+    try
+    {
+        microbenchmarks b(argc, argv);
+        return b.run();
+    }
+    catch(advgetopt::getopt_exit const & e)
+    {
+        return e.code();
+    }
+    catch(std::exception const & e)
+    {
+        std::cerr << "microbenchmarks: exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+// vim: ts=4 sw=4 et
@@ -19,6 +19,7 @@
 
 // communicatord
 //
+#include    <communicatord/capture.h>
 #include    <communicatord/communicator.h>
 #include    <communicatord/names.h>
 #include    <communicatord/version.h>
@@ -27,6 +28,8 @@
 // eventdispatcher
 //
 #include    <eventdispatcher/cui_connection.h>
+#include    <eventdispatcher/names.h>
+#include    <eventdispatcher/timer.h>
 #include    <eventdispatcher/local_stream_client_message_connection.h>
 #include    <eventdispatcher/local_dgram_server_message_connection.h>
 #include    <eventdispatcher/tcp_client_message_connection.h>
@@ -67,7 +70,13 @@
 
 // C++
 //
+#include    <algorithm>
 #include    <atomic>
+#include    <chrono>
+#include    <cmath>
+#include    <map>
+#include    <set>
+#include    <vector>
 
 
 // ncurses
@@ -131,6 +140,7 @@ namespace
 
 constexpr char const * g_history_file = "~/.message_history";
 constexpr char const * g_gui_command = "/var/lib/communicatord/sendmessage.gui";
+constexpr char const * g_benchmark_timestamp = "benchmark_timestamp";
 
 
 const advgetopt::option g_command_line_options[] =
@@ -143,6 +153,22 @@ const advgetopt::option g_command_line_options[] =
             , advgetopt::GETOPT_FLAG_REQUIRED>())
         , advgetopt::Help("the address and port to connect to (i.e. \"127.0.0.1:4040\").")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("benchmark")
+        , advgetopt::Flags(advgetopt::any_flags<
+              advgetopt::GETOPT_FLAG_GROUP_COMMANDS
+            , advgetopt::GETOPT_FLAG_FLAG
+            , advgetopt::GETOPT_FLAG_COMMAND_LINE>())
+        , advgetopt::Help("send the --mix messages to the --echo-service and report the throughput and round-trip latency.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("connections")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("1")
+        , advgetopt::Help("number of connections opened by --benchmark.")
+    ),
     advgetopt::define_option(
           advgetopt::Name("cui")
         , advgetopt::Flags(advgetopt::any_flags<
@@ -151,6 +177,30 @@ const advgetopt::option g_command_line_options[] =
             , advgetopt::GETOPT_FLAG_COMMAND_LINE>())
         , advgetopt::Help("start in interactive mode in your terminal.")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("duration")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("10")
+        , advgetopt::Help("number of seconds the --benchmark sends messages.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("echo")
+        , advgetopt::Flags(advgetopt::any_flags<
+              advgetopt::GETOPT_FLAG_GROUP_COMMANDS
+            , advgetopt::GETOPT_FLAG_FLAG
+            , advgetopt::GETOPT_FLAG_COMMAND_LINE>())
+        , advgetopt::Help("register as the --echo-service and send back each --benchmark message.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("echo-service")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("message_echo")
+        , advgetopt::Help("name of the service echoing the --benchmark messages.")
+    ),
     advgetopt::define_option(
           advgetopt::Name("gui")
         , advgetopt::Flags(advgetopt::any_flags<
@@ -159,6 +209,45 @@ const advgetopt::option g_command_line_options[] =
             , advgetopt::GETOPT_FLAG_COMMAND_LINE>())
         , advgetopt::Help("open a graphical window with an input and an output console.")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("json")
+        , advgetopt::Flags(advgetopt::any_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_FLAG
+            , advgetopt::GETOPT_FLAG_COMMAND_LINE>())
+        , advgetopt::Help("output the --benchmark or --replay results in JSON.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("mix")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED
+            , advgetopt::GETOPT_FLAG_MULTIPLE>())
+        , advgetopt::Help("messages sent by --benchmark, each optionally prefixed by a weight (i.e. \"3*PING size=10\"); the default is \"BENCHMARK\".")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("rate")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("0")
+        , advgetopt::Help("number of messages per second sent by --benchmark; 0 sends as fast as possible within the --window.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("replay")
+        , advgetopt::Flags(advgetopt::command_flags<
+              advgetopt::GETOPT_FLAG_GROUP_COMMANDS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::Help("send the messages of the local services found in this capture (see the communicatord --capture-file option) to the communicatord.")
+    ),
+    advgetopt::define_option(
+          advgetopt::Name("speed")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("1")
+        , advgetopt::Help("how many times faster than recorded --replay sends the messages; 0 sends up to --window messages per millisecond.")
+    ),
     advgetopt::define_option(
           advgetopt::Name("tcp")
         , advgetopt::Flags(advgetopt::any_flags<
@@ -209,6 +298,14 @@ const advgetopt::option g_command_line_options[] =
             , advgetopt::GETOPT_FLAG_ENVIRONMENT_VARIABLE>())
         , advgetopt::Help("in case you used --tcp, this tells %p to wait for a reply before quiting.")
     ),
+    advgetopt::define_option(
+          advgetopt::Name("window")
+        , advgetopt::Flags(advgetopt::all_flags<
+              advgetopt::GETOPT_FLAG_GROUP_OPTIONS
+            , advgetopt::GETOPT_FLAG_REQUIRED>())
+        , advgetopt::DefaultValue("100")
+        , advgetopt::Help("maximum number of --benchmark messages waiting for their echo on each connection when --rate is 0; number of messages sent per millisecond by --replay when --speed is 0.")
+    ),
     // default (anything goes in this)
     advgetopt::define_option(
           advgetopt::Name("message")
@@ -884,6 +981,21 @@ public:
         return f_selected_connection_type;
     }
 
+    connection_t get_selected_connection_type() const
+    {
+        return f_selected_connection_type;
+    }
+
+    addr::addr const & get_ip_address() const
+    {
+        return f_ip_address;
+    }
+
+    addr::addr_unix const & get_unix_address() const
+    {
+        return f_unix_address;
+    }
+
     // call when you do /tcp and /udp in CUI/GUI
     void set_selected_connection_type(connection_t type)
     {
@@ -1182,75 +1294,1243 @@ console_connection * console_connection::g_console = nullptr;
 
 
 
-class message
+/** \brief Interface used by the benchmark connections.
+ *
+ * The --benchmark, --echo and --replay modes open their own connections to the
+ * communicator daemon. Those connections forward all the events to an
+ * object implementing this interface.
+ */
+class benchmark_client
 {
 public:
-    message(int argc, char * argv[])
-        : f_opts(g_command_line_options_environment)
+    virtual ~benchmark_client() {}
+
+    virtual void    benchmark_message(std::size_t index, ed::message & msg) = 0;
+    virtual void    benchmark_lost(std::size_t index) = 0;
+    virtual void    benchmark_tick() = 0;
+};
+
+
+
+template<class B>
+class benchmark_connection
+    : public B
+{
+public:
+    typedef std::shared_ptr<benchmark_connection<B>>    pointer_t;
+
+    template<typename ... ARGS>
+    benchmark_connection(
+              benchmark_client * client
+            , std::size_t index
+            , ARGS && ... args)
+        : B(std::forward<ARGS>(args)...)
+        , f_client(client)
+        , f_index(index)
     {
-        snaplogger::add_logger_options(f_opts);
-        f_opts.finish_parsing(argc, argv);
-        if(!snaplogger::process_logger_options(
-                              f_opts
-                            , "/etc/communicatord/logger"
-                            , std::cout
-                            , false))
+        this->set_name("benchmark_connection_" + std::to_string(index));
+    }
+
+    benchmark_connection(benchmark_connection const &) = delete;
+    benchmark_connection & operator = (benchmark_connection const &) = delete;
+
+    virtual void process_error() override
+    {
+        B::process_error();
+        f_client->benchmark_lost(f_index);
+    }
+
+    virtual void process_hup() override
+    {
+        B::process_hup();
+        f_client->benchmark_lost(f_index);
+    }
+
+    virtual void process_invalid() override
+    {
+        B::process_invalid();
+        f_client->benchmark_lost(f_index);
+    }
+
+    virtual void process_message(ed::message & msg) override
+    {
+        f_client->benchmark_message(f_index, msg);
+    }
+
+private:
+    benchmark_client *      f_client = nullptr;
+    std::size_t             f_index = 0;
+};
+
+
+typedef benchmark_connection<ed::tcp_client_message_connection>             benchmark_tcp_connection;
+typedef benchmark_connection<ed::local_stream_client_message_connection>    benchmark_local_connection;
+
+
+
+class benchmark_timer
+    : public ed::timer
+{
+public:
+    typedef std::shared_ptr<benchmark_timer>    pointer_t;
+
+    benchmark_timer(benchmark_client * client, std::int64_t tick)
+        : timer(tick)
+        , f_client(client)
+    {
+        set_name("benchmark_timer");
+    }
+
+    virtual void process_timeout() override
+    {
+        f_client->benchmark_tick();
+    }
+
+private:
+    benchmark_client *      f_client = nullptr;
+};
+
+
+
+/** \brief Messages and connections shared by --benchmark and --echo.
+ *
+ * Both modes register one service per connection, answer the HELP of
+ * the daemon with the commands found in the --mix and recognize the
+ * benchmark messages by their timestamp parameter.
+ */
+class benchmark_base
+    : public benchmark_client
+{
+public:
+    struct client
+    {
+        std::string                                     f_service = std::string();
+        ed::connection::pointer_t                       f_connection = ed::connection::pointer_t();
+        ed::connection_with_send_message::pointer_t     f_sender = ed::connection_with_send_message::pointer_t();
+        bool                                            f_ready = false;
+        bool                                            f_registered = false;
+        std::size_t                                     f_in_flight = 0;
+    };
+
+    benchmark_base(
+              advgetopt::getopt & opts
+            , network_connection::pointer_t c)
+        : f_connection_type(c->get_selected_connection_type())
+        , f_ip_address(c->get_ip_address())
+        , f_unix_address(c->get_unix_address())
+        , f_echo_service(opts.get_string("echo-service"))
+    {
+        std::size_t const max(opts.size("mix"));
+        for(std::size_t idx(0); idx < max; ++idx)
         {
-            // exit on any error
-            throw advgetopt::getopt_exit("logger options generated an error.", 1);
+            add_mix(opts.get_string("mix", idx));
+        }
+        if(f_mix.empty())
+        {
+            add_mix("BENCHMARK");
         }
+    }
 
-        f_gui = f_opts.is_defined("gui");
+    bool is_stream() const
+    {
+        switch(f_connection_type)
+        {
+        case network_connection::connection_t::TCP:
+        case network_connection::connection_t::REMOTE_TCP:
+        case network_connection::connection_t::SECURE_TCP:
+        case network_connection::connection_t::LOCAL_STREAM:
+            return true;
 
-        f_cui = f_opts.is_defined("cui")
-            || (!f_opts.is_defined("message") && !f_gui);
+        default:
+            return false;
 
-        if(f_gui
-        && f_cui)
+        }
+    }
+
+    std::string transport_name() const
+    {
+        switch(f_connection_type)
         {
-            std::cerr << "error: --gui and --cui are mutually exclusive." << std::endl;
-            exit(1);
-            snapdev::NOT_REACHED();
+        case network_connection::connection_t::TCP:
+        case network_connection::connection_t::REMOTE_TCP:
+            return "tcp";
+
+        case network_connection::connection_t::SECURE_TCP:
+            return "tls";
+
+        case network_connection::connection_t::UDP:
+        case network_connection::connection_t::BROADCAST_UDP:
+            return "udp";
+
+        case network_connection::connection_t::LOCAL_STREAM:
+            return "unix";
+
+        case network_connection::connection_t::LOCAL_DGRAM:
+            return "unix-dgram";
+
+        default:
+            return "none";
+
         }
+    }
 
-        if(f_cui
-        || f_gui)
+    bool open_client(std::string const & service, bool register_service = true)
+    {
+        client c;
+        c.f_service = service;
+
+        std::size_t const index(f_clients.size());
+        try
         {
-            if(f_opts.is_defined("message"))
+            switch(f_connection_type)
             {
-                std::cerr << "error: --message is not compatible with --cui or --gui." << std::endl;
-                exit(1);
-                snapdev::NOT_REACHED();
+            case network_connection::connection_t::TCP:
+            case network_connection::connection_t::REMOTE_TCP:
+            case network_connection::connection_t::SECURE_TCP:
+                {
+                    benchmark_tcp_connection::pointer_t conn(std::make_shared<benchmark_tcp_connection>(
+                              this
+                            , index
+                            , f_ip_address
+                            , f_connection_type == network_connection::connection_t::SECURE_TCP
+                                    ? ed::mode_t::MODE_SECURE
+                                    : ed::mode_t::MODE_PLAIN
+                            , false));
+                    c.f_connection = conn;
+                    c.f_sender = conn;
+                }
+                break;
+
+            case network_connection::connection_t::LOCAL_STREAM:
+                {
+                    benchmark_local_connection::pointer_t conn(std::make_shared<benchmark_local_connection>(
+                              this
+                            , index
+                            , f_unix_address
+                            , false
+                            , false));
+                    c.f_connection = conn;
+                    c.f_sender = conn;
+                }
+                break;
+
+            default:
+                // datagrams do not register, they can be sent immediately
+                //
+                c.f_ready = true;
+                f_clients.push_back(c);
+                return true;
+
             }
         }
-        else
+        catch(std::exception const & e)
         {
-            if(!f_opts.is_defined("address"))
+            std::cerr
+                << "error: could not create benchmark connection #"
+                << index
+                << ": "
+                << e.what()
+                << '.'
+                << std::endl;
+            return false;
+        }
+
+        if(!ed::communicator::instance()->add_connection(c.f_connection))
+        {
+            std::cerr
+                << "error: could not add benchmark connection #"
+                << index
+                << " to the communicator."
+                << std::endl;
+            return false;
+        }
+        if(!register_service)
+        {
+            c.f_ready = true;
+            f_clients.push_back(c);
+            return true;
+        }
+
+        c.f_registered = true;
+        f_clients.push_back(c);
+
+        ed::message register_message;
+        register_message.set_command(communicatord::g_name_communicatord_cmd_register);
+        register_message.add_parameter(communicatord::g_name_communicatord_param_service, service);
+        register_message.add_version_parameter();
+        c.f_sender->send_message(register_message, false);
+
+        return true;
+    }
+
+    void close_clients()
+    {
+        for(auto & c : f_clients)
+        {
+            if(c.f_connection == nullptr)
             {
-                std::cerr << "error: --address is mandatory when not entering the CUI or GUI interface." << std::endl;
-                exit(1);
-                snapdev::NOT_REACHED();
+                continue;
+            }
+            if(c.f_registered)
+            {
+                ed::message unregister_service;
+                unregister_service.set_command(communicatord::g_name_communicatord_cmd_unregister);
+                unregister_service.add_parameter(communicatord::g_name_communicatord_param_service, c.f_service);
+                c.f_sender->send_message(unregister_service, false);
             }
+            c.f_connection->mark_done();
+            c.f_connection.reset();
+            c.f_sender.reset();
         }
+    }
 
-        f_connection = std::make_shared<network_connection>();
-
-        if(f_opts.is_defined("address"))
+    /** \brief Handle the messages common to all the benchmark clients.
+     *
+     * \return true if the message was handled.
+     */
+    bool process_protocol(std::size_t index, ed::message & msg)
+    {
+        client & c(f_clients[index]);
+        std::string const & command(msg.get_command());
+        if(command == ed::g_name_ed_cmd_help)
         {
-            f_connection->set_address(f_opts.get_string("address"));
+            std::string list(
+                      std::string(ed::g_name_ed_cmd_help)
+                    + ',' + ed::g_name_ed_cmd_quitting
+                    + ',' + ed::g_name_ed_cmd_ready
+                    + ',' + ed::g_name_ed_cmd_stop
+                    + ',' + ed::g_name_ed_cmd_unknown);
+            for(auto const & cmd : f_commands)
+            {
+                list += ',';
+                list += cmd;
+            }
+            ed::message commands;
+            commands.set_command(ed::g_name_ed_cmd_commands);
+            commands.add_parameter(communicatord::g_name_communicatord_param_list, list);
+            c.f_sender->send_message(commands, false);
+            return true;
+        }
+        if(command == ed::g_name_ed_cmd_ready)
+        {
+            if(!c.f_ready)
+            {
+                c.f_ready = true;
+                ++f_ready_count;
+                process_ready();
+            }
+            return true;
+        }
+        if(command == ed::g_name_ed_cmd_stop
+        || command == ed::g_name_ed_cmd_quitting)
+        {
+            process_stop();
+            return true;
         }
+        return false;
     }
 
-    int run()
+    void send_datagram(ed::message & msg)
     {
-        if(f_gui)
+        if(f_signal_secret.empty())
         {
-            return start_gui();
+            advgetopt::conf_file_setup const setup("communicatord");
+            advgetopt::conf_file::pointer_t config(advgetopt::conf_file::get_conf_file(setup));
+            f_signal_secret = config->get_parameter(communicatord::g_name_communicatord_config_signal_secret);
         }
+        if(f_connection_type == network_connection::connection_t::LOCAL_DGRAM)
+        {
+            ed::local_dgram_server_message_connection::send_message(f_unix_address, msg, f_signal_secret);
+        }
+        else
+        {
+            ed::udp_server_message_connection::send_message(f_ip_address, msg, f_signal_secret);
+        }
+    }
 
-        if(f_cui)
+    virtual void benchmark_lost(std::size_t index) override
+    {
+        std::cerr
+            << "error: benchmark connection #"
+            << index
+            << " was lost."
+            << std::endl;
+        f_clients[index].f_connection.reset();
+        f_clients[index].f_sender.reset();
+        process_stop();
+    }
+
+    virtual void process_ready() = 0;
+    virtual void process_stop() = 0;
+
+protected:
+    struct mix_entry
+    {
+        ed::message         f_message = ed::message();
+        std::size_t         f_weight = 1;
+    };
+
+    void add_mix(std::string const & mix)
+    {
+        mix_entry e;
+        std::string message(mix);
+        std::string::size_type const pos(mix.find('*'));
+        if(pos != std::string::npos
+        && pos > 0
+        && std::all_of(mix.begin(), mix.begin() + pos, [](char ch) { return ch >= '0' && ch <= '9'; }))
         {
-            return enter_cui();
+            e.f_weight = std::stoul(mix.substr(0, pos));
+            message = mix.substr(pos + 1);
+        }
+        if(e.f_weight == 0
+        || e.f_weight > 1000)
+        {
+            throw advgetopt::getopt_exit("the weight of a --mix message must be between 1 and 1000.", 1);
+        }
+        if(!e.f_message.from_message(message))
+        {
+            throw advgetopt::getopt_exit("--mix message \"" + message + "\" is not valid.", 1);
+        }
+        if(e.f_message.get_service().empty())
+        {
+            e.f_message.set_service(f_echo_service);
+        }
+        f_commands.insert(e.f_message.get_command());
+        for(std::size_t count(0); count < e.f_weight; ++count)
+        {
+            f_cycle.push_back(f_mix.size());
+        }
+        f_mix.push_back(e);
+    }
+
+    network_connection::connection_t    f_connection_type = network_connection::connection_t::NONE;
+    addr::addr                          f_ip_address = addr::addr();
+    addr::addr_unix                     f_unix_address = addr::addr_unix();
+    std::string                         f_echo_service = std::string();
+    std::string                         f_signal_secret = std::string();
+    std::vector<mix_entry>              f_mix = std::vector<mix_entry>();
+    std::vector<std::size_t>            f_cycle = std::vector<std::size_t>();
+    std::set<std::string>               f_commands = std::set<std::string>();
+    std::vector<client>                 f_clients = std::vector<client>();
+    std::size_t                         f_ready_count = 0;
+};
+
+
+
+/** \brief Implementation of the --benchmark command.
+ *
+ * The benchmark opens --connections connections, registers each one as
+ * a service and, once all are READY, sends the --mix messages to the
+ * --echo-service for --duration seconds. Each message includes the
+ * time it was sent so the round-trip latency can be computed when the
+ * echo comes back.
+ *
+ * With a --rate, the messages are sent at that rate across all the
+ * connections. Without one, each connection keeps up to --window
+ * messages in flight.
+ *
+ * Datagrams (cdu: and cdb:) cannot receive an echo so only the send
+ * rate is reported for those.
+ */
+class benchmark
+    : public benchmark_base
+{
+public:
+    static constexpr std::int64_t const     TICK = 1'000;               // 1ms in microseconds
+    static constexpr std::int64_t const     DRAIN_TIMEOUT = 2'000'000'000;  // 2s in nanoseconds
+
+    benchmark(
+              advgetopt::getopt & opts
+            , network_connection::pointer_t c)
+        : benchmark_base(opts, c)
+        , f_count(static_cast<std::size_t>(std::max(opts.get_long("connections"), 1L)))
+        , f_rate(std::max(opts.get_double("rate"), 0.0))
+        , f_duration(std::max(opts.get_long("duration"), 1L) * 1'000'000'000LL)
+        , f_window(static_cast<std::size_t>(std::max(opts.get_long("window"), 1L)))
+        , f_json(opts.is_defined("json"))
+    {
+    }
+
+    int run()
+    {
+        for(std::size_t idx(0); idx < f_count; ++idx)
+        {
+            if(!open_client("message_benchmark_" + std::to_string(idx)))
+            {
+                close_clients();
+                return 1;
+            }
+        }
+
+        f_timer = std::make_shared<benchmark_timer>(this, TICK);
+        f_timer->set_enable(false);
+        if(!ed::communicator::instance()->add_connection(f_timer))
+        {
+            std::cerr << "error: could not add the benchmark timer to the communicator." << std::endl;
+            close_clients();
+            return 1;
+        }
+
+        if(!is_stream())
+        {
+            start();
+        }
+
+        if(!ed::communicator::instance()->run())
+        {
+            std::cerr << "error: something went wrong in the ed::communicator run() loop." << std::endl;
+            return 1;
+        }
+
+        report();
+
+        return f_sent > 0 && (!is_stream() || f_received > 0) ? 0 : 1;
+    }
+
+    virtual void process_ready() override
+    {
+        if(f_ready_count == f_clients.size())
+        {
+            start();
+        }
+    }
+
+    virtual void process_stop() override
+    {
+        finish();
+    }
+
+    virtual void benchmark_message(std::size_t index, ed::message & msg) override
+    {
+        if(process_protocol(index, msg))
+        {
+            return;
+        }
+        if(!msg.has_parameter(g_benchmark_timestamp))
+        {
+            return;
+        }
+
+        f_latencies.push_back(now() - msg.get_integer_parameter(g_benchmark_timestamp));
+        ++f_received;
+
+        client & c(f_clients[index]);
+        if(c.f_in_flight > 0)
+        {
+            --c.f_in_flight;
+        }
+
+        if(f_state == state_t::STATE_RUNNING
+        && f_rate == 0.0)
+        {
+            fill_window(c);
+        }
+        else if(f_state == state_t::STATE_DRAINING
+             && f_received >= f_sent)
+        {
+            finish();
+        }
+    }
+
+    virtual void benchmark_tick() override
+    {
+        std::int64_t const elapsed(now() - f_start);
+        switch(f_state)
+        {
+        case state_t::STATE_RUNNING:
+            if(elapsed >= f_duration)
+            {
+                f_elapsed = elapsed;
+                f_state = state_t::STATE_DRAINING;
+                if(!is_stream()
+                || f_received >= f_sent)
+                {
+                    finish();
+                }
+                return;
+            }
+            if(f_rate > 0.0)
+            {
+                std::size_t const expected(static_cast<std::size_t>(f_rate * static_cast<double>(elapsed) / 1'000'000'000.0));
+                while(f_sent < expected)
+                {
+                    client & c(f_clients[f_next_client]);
+                    f_next_client = (f_next_client + 1) % f_clients.size();
+                    send_next(c);
+                }
+            }
+            else if(!is_stream())
+            {
+                for(auto & c : f_clients)
+                {
+                    fill_window(c);
+                }
+            }
+            break;
+
+        case state_t::STATE_DRAINING:
+            if(elapsed >= f_duration + DRAIN_TIMEOUT)
+            {
+                finish();
+            }
+            break;
+
+        default:
+            break;
+
+        }
+    }
+
+private:
+    enum class state_t
+    {
+        STATE_CONNECTING,
+        STATE_RUNNING,
+        STATE_DRAINING,
+        STATE_DONE,
+    };
+
+    static std::int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void start()
+    {
+        f_state = state_t::STATE_RUNNING;
+        f_start = now();
+        f_timer->set_enable(true);
+        if(f_rate == 0.0)
+        {
+            for(auto & c : f_clients)
+            {
+                fill_window(c);
+            }
+        }
+    }
+
+    void fill_window(client & c)
+    {
+        if(is_stream())
+        {
+            while(c.f_in_flight < f_window)
+            {
+                send_next(c);
+            }
+        }
+        else
+        {
+            for(std::size_t count(0); count < f_window; ++count)
+            {
+                send_next(c);
+            }
+        }
+    }
+
+    void send_next(client & c)
+    {
+        ed::message msg(f_mix[f_cycle[f_next_mix]].f_message);
+        f_next_mix = (f_next_mix + 1) % f_cycle.size();
+
+        msg.set_sent_from_service(c.f_service);
+        msg.add_parameter(g_benchmark_timestamp, now());
+
+        if(c.f_sender != nullptr)
+        {
+            c.f_sender->send_message(msg, false);
+            ++c.f_in_flight;
+        }
+        else
+        {
+            send_datagram(msg);
+        }
+        ++f_sent;
+    }
+
+    void finish()
+    {
+        if(f_state == state_t::STATE_DONE)
+        {
+            return;
+        }
+        if(f_state == state_t::STATE_RUNNING)
+        {
+            f_elapsed = now() - f_start;
+        }
+        f_state = state_t::STATE_DONE;
+
+        if(f_timer != nullptr)
+        {
+            ed::communicator::instance()->remove_connection(f_timer);
+            f_timer.reset();
+        }
+        close_clients();
+    }
+
+    double percentile(double p) const
+    {
+        if(f_latencies.empty())
+        {
+            return 0.0;
+        }
+        std::size_t idx(static_cast<std::size_t>(std::ceil(p * static_cast<double>(f_latencies.size()))));
+        idx = std::min(std::max(idx, static_cast<std::size_t>(1)), f_latencies.size()) - 1;
+        return static_cast<double>(f_latencies[idx]) / 1'000.0;
+    }
+
+    void report()
+    {
+        std::sort(f_latencies.begin(), f_latencies.end());
+
+        double const seconds(static_cast<double>(std::max(f_elapsed, static_cast<std::int64_t>(1))) / 1'000'000'000.0);
+        double const throughput(static_cast<double>(is_stream() ? f_received : f_sent) / seconds);
+        std::size_t const lost(is_stream() && f_sent > f_received ? f_sent - f_received : 0);
+
+        if(f_json)
+        {
+            std::cout << "{\"transport\":\"" << transport_name() << '"'
+                      << ",\"connections\":" << f_clients.size()
+                      << ",\"seconds\":" << seconds
+                      << ",\"sent\":" << f_sent
+                      << ",\"received\":" << f_received
+                      << ",\"lost\":" << lost
+                      << ",\"throughput\":" << throughput;
+            if(is_stream())
+            {
+                std::cout << ",\"latency_us\":{\"p50\":" << percentile(0.5)
+                          << ",\"p99\":" << percentile(0.99)
+                          << ",\"p999\":" << percentile(0.999)
+                          << ",\"max\":" << percentile(1.0)
+                          << '}';
+            }
+            std::cout << "}" << std::endl;
+            return;
+        }
+
+        std::cout << "        Transport: " << transport_name() << '\n'
+                  << "      Connections: " << f_clients.size() << '\n'
+                  << "         Duration: " << seconds << "s\n"
+                  << "    Messages Sent: " << f_sent << '\n';
+        if(is_stream())
+        {
+            std::cout << "Messages Received: " << f_received << '\n'
+                      << "    Messages Lost: " << lost << '\n'
+                      << "       Throughput: " << throughput << " msg/s\n"
+                      << "      Latency p50: " << percentile(0.5) << "us\n"
+                      << "      Latency p99: " << percentile(0.99) << "us\n"
+                      << "     Latency p999: " << percentile(0.999) << "us\n"
+                      << "      Latency max: " << percentile(1.0) << "us\n";
+        }
+        else
+        {
+            std::cout << "  Send Throughput: " << throughput << " msg/s\n"
+                      << "          Latency: not available with datagrams\n";
+        }
+        std::cout << std::flush;
+    }
+
+    std::size_t                         f_count = 1;
+    double                              f_rate = 0.0;
+    std::int64_t                        f_duration = 0;
+    std::size_t                         f_window = 1;
+    bool                                f_json = false;
+    state_t                             f_state = state_t::STATE_CONNECTING;
+    benchmark_timer::pointer_t          f_timer = benchmark_timer::pointer_t();
+    std::int64_t                        f_start = 0;
+    std::int64_t                        f_elapsed = 0;
+    std::size_t                         f_next_client = 0;
+    std::size_t                         f_next_mix = 0;
+    std::size_t                         f_sent = 0;
+    std::size_t                         f_received = 0;
+    std::vector<std::int64_t>           f_latencies = std::vector<std::int64_t>();
+};
+
+
+
+/** \brief Implementation of the --echo command.
+ *
+ * The echo registers as the --echo-service and sends each benchmark
+ * message back to its sender. Run it on the target computer before
+ * starting a --benchmark.
+ */
+class benchmark_echo
+    : public benchmark_base
+{
+public:
+    benchmark_echo(
+              advgetopt::getopt & opts
+            , network_connection::pointer_t c)
+        : benchmark_base(opts, c)
+    {
+    }
+
+    int run()
+    {
+        if(!is_stream())
+        {
+            std::cerr << "error: --echo requires a stream connection (cd: or cds:)." << std::endl;
+            return 1;
+        }
+        if(!open_client(f_echo_service))
+        {
+            return 1;
+        }
+        if(!ed::communicator::instance()->run())
+        {
+            std::cerr << "error: something went wrong in the ed::communicator run() loop." << std::endl;
+            return 1;
+        }
+        std::cout << "echoed " << f_echoed << " messages." << std::endl;
+        return 0;
+    }
+
+    virtual void process_ready() override
+    {
+        std::cout << "echo service \"" << f_echo_service << "\" ready." << std::endl;
+    }
+
+    virtual void process_stop() override
+    {
+        close_clients();
+    }
+
+    virtual void benchmark_message(std::size_t index, ed::message & msg) override
+    {
+        if(process_protocol(index, msg)
+        || !msg.has_parameter(g_benchmark_timestamp))
+        {
+            return;
+        }
+
+        client & c(f_clients[index]);
+        ed::message reply(msg);
+        reply.reply_to(msg);
+        reply.set_sent_from_service(c.f_service);
+        c.f_sender->send_message(reply, false);
+        ++f_echoed;
+    }
+
+    virtual void benchmark_tick() override
+    {
+    }
+
+private:
+    std::size_t                         f_echoed = 0;
+};
+
+
+
+/** \brief Implementation of the --replay command.
+ *
+ * The replay reads a capture saved by a communicatord started with
+ * --capture-file and sends the messages it received from its local
+ * services back to the communicatord at --address. Each connection
+ * found in the capture gets its own connection so the services get
+ * registered, send and receive their messages as they did when the
+ * capture was taken. The messages are sent verbatim, including their
+ * REGISTER and UNREGISTER, so no extra registration takes place.
+ *
+ * The messages are sent at the recorded pace divided by --speed. With
+ * a --speed of 0, up to --window messages are sent per millisecond
+ * instead.
+ *
+ * The messages received from remote communicators and through UDP
+ * cannot be reproduced from a client connection; those are counted
+ * and skipped. The routes recorded by the capture are reported so they
+ * can be compared with the metrics of the communicatord used for the
+ * replay.
+ */
+class benchmark_replay
+    : public benchmark_base
+{
+public:
+    static constexpr std::int64_t const     TICK = 1'000;               // 1ms in microseconds
+    static constexpr std::int64_t const     DRAIN_TIMEOUT = 2'000'000'000;  // 2s in nanoseconds
+
+    benchmark_replay(
+              advgetopt::getopt & opts
+            , network_connection::pointer_t c)
+        : benchmark_base(opts, c)
+        , f_filename(opts.get_string("replay"))
+        , f_speed(std::max(opts.get_double("speed"), 0.0))
+        , f_window(static_cast<std::size_t>(std::max(opts.get_long("window"), 1L)))
+        , f_json(opts.is_defined("json"))
+    {
+    }
+
+    int run()
+    {
+        if(!is_stream())
+        {
+            std::cerr << "error: --replay requires a stream connection (cd: or cds:)." << std::endl;
+            return 1;
+        }
+        if(!f_reader.open(f_filename))
+        {
+            std::cerr << "error: could not open capture \"" << f_filename << "\" or it is not a valid capture." << std::endl;
+            return 1;
+        }
+
+        f_has_next = f_reader.next(f_next);
+        if(!f_has_next)
+        {
+            std::cerr << "error: capture \"" << f_filename << "\" does not include any message." << std::endl;
+            return 1;
+        }
+        f_first_timestamp = f_next.f_timestamp;
+
+        f_timer = std::make_shared<benchmark_timer>(this, TICK);
+        if(!ed::communicator::instance()->add_connection(f_timer))
+        {
+            std::cerr << "error: could not add the replay timer to the communicator." << std::endl;
+            return 1;
+        }
+
+        f_state = state_t::STATE_RUNNING;
+        f_start = now();
+
+        if(!ed::communicator::instance()->run())
+        {
+            std::cerr << "error: something went wrong in the ed::communicator run() loop." << std::endl;
+            return 1;
+        }
+
+        report();
+
+        return f_failed ? 1 : 0;
+    }
+
+    virtual void process_ready() override
+    {
+    }
+
+    virtual void process_stop() override
+    {
+        finish();
+    }
+
+    virtual void benchmark_message(std::size_t index, ed::message & msg) override
+    {
+        snapdev::NOT_USED(index);
+
+        // the replies of the original services (i.e. COMMANDS in reply
+        // to HELP) are part of the capture so nothing gets answered here
+        //
+        ++f_received;
+        if(msg.get_command() == ed::g_name_ed_cmd_quitting)
+        {
+            finish();
+        }
+    }
+
+    virtual void benchmark_lost(std::size_t index) override
+    {
+        // a service may close its connection on its own (i.e. after an
+        // UNREGISTER); the next message from that connection reopens it
+        //
+        f_clients[index].f_connection.reset();
+        f_clients[index].f_sender.reset();
+        ++f_lost;
+    }
+
+    virtual void benchmark_tick() override
+    {
+        std::int64_t const elapsed(now() - f_start);
+        switch(f_state)
+        {
+        case state_t::STATE_RUNNING:
+            send_due(elapsed);
+            if(!f_has_next
+            && f_state == state_t::STATE_RUNNING)
+            {
+                f_elapsed = elapsed;
+                f_state = state_t::STATE_DRAINING;
+            }
+            break;
+
+        case state_t::STATE_DRAINING:
+            if(elapsed >= f_elapsed + DRAIN_TIMEOUT)
+            {
+                finish();
+            }
+            break;
+
+        default:
+            break;
+
+        }
+    }
+
+private:
+    enum class state_t
+    {
+        STATE_LOADING,
+        STATE_RUNNING,
+        STATE_DRAINING,
+        STATE_DONE,
+    };
+
+    static std::int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void send_due(std::int64_t elapsed)
+    {
+        std::size_t count(0);
+        while(f_has_next)
+        {
+            if(f_speed > 0.0)
+            {
+                double const due(static_cast<double>(f_next.f_timestamp - f_first_timestamp) * 1'000.0 / f_speed);
+                if(due > static_cast<double>(elapsed))
+                {
+                    return;
+                }
+            }
+            else if(count >= f_window)
+            {
+                return;
+            }
+
+            if(!replay(f_next))
+            {
+                f_failed = true;
+                f_has_next = false;
+                finish();
+                return;
+            }
+            ++count;
+            f_has_next = f_reader.next(f_next);
+        }
+    }
+
+    bool replay(communicatord::capture_record const & record)
+    {
+        ++f_records;
+        ++f_routes[f_reader.get_route_name(record.f_route)];
+
+        if(record.f_source_type != "local")
+        {
+            ++f_skipped;
+            return true;
+        }
+
+        ed::message msg;
+        if(!msg.from_message(record.f_message))
+        {
+            ++f_invalid;
+            return true;
+        }
+
+        auto it(f_sources.find(record.f_connection));
+        if(it == f_sources.end()
+        || f_clients[it->second].f_sender == nullptr)
+        {
+            if(!open_client(record.f_source, false))
+            {
+                return false;
+            }
+            it = f_sources.insert_or_assign(record.f_connection, f_clients.size() - 1).first;
+        }
+
+        f_clients[it->second].f_sender->send_message(msg, false);
+        ++f_sent;
+        return true;
+    }
+
+    void finish()
+    {
+        if(f_state == state_t::STATE_DONE)
+        {
+            return;
+        }
+        if(f_state == state_t::STATE_RUNNING)
+        {
+            f_elapsed = now() - f_start;
+        }
+        f_state = state_t::STATE_DONE;
+
+        if(f_timer != nullptr)
+        {
+            ed::communicator::instance()->remove_connection(f_timer);
+            f_timer.reset();
+        }
+        close_clients();
+    }
+
+    void report()
+    {
+        double const seconds(static_cast<double>(std::max(f_elapsed, static_cast<std::int64_t>(1))) / 1'000'000'000.0);
+        double const throughput(static_cast<double>(f_sent) / seconds);
+
+        if(f_json)
+        {
+            std::cout << "{\"capture\":\"" << f_filename << '"'
+                      << ",\"transport\":\"" << transport_name() << '"'
+                      << ",\"speed\":" << f_speed
+                      << ",\"connections\":" << f_clients.size()
+                      << ",\"seconds\":" << seconds
+                      << ",\"records\":" << f_records
+                      << ",\"sent\":" << f_sent
+                      << ",\"skipped\":" << f_skipped
+                      << ",\"invalid\":" << f_invalid
+                      << ",\"received\":" << f_received
+                      << ",\"lost\":" << f_lost
+                      << ",\"truncated\":" << (f_reader.is_truncated() ? "true" : "false")
+                      << ",\"throughput\":" << throughput
+                      << ",\"routes\":{";
+            char const * sep("");
+            for(auto const & r : f_routes)
+            {
+                std::cout << sep << '"' << r.first << "\":" << r.second;
+                sep = ",";
+            }
+            std::cout << "}}" << std::endl;
+            return;
+        }
+
+        std::cout << "          Capture: " << f_filename << (f_reader.is_truncated() ? " (truncated)" : "") << '\n'
+                  << "        Transport: " << transport_name() << '\n'
+                  << "      Connections: " << f_clients.size() << '\n'
+                  << "         Duration: " << seconds << "s\n"
+                  << "          Records: " << f_records << '\n'
+                  << "    Messages Sent: " << f_sent << '\n'
+                  << " Messages Skipped: " << f_skipped << " (not from a local service)\n"
+                  << " Messages Invalid: " << f_invalid << '\n'
+                  << "Messages Received: " << f_received << '\n'
+                  << " Connections Lost: " << f_lost << '\n'
+                  << "       Throughput: " << throughput << " msg/s\n"
+                  << "  Recorded Routes:\n";
+        for(auto const & r : f_routes)
+        {
+            std::cout << "    " << r.first << ": " << r.second << '\n';
+        }
+        std::cout << std::flush;
+    }
+
+    std::string                         f_filename = std::string();
+    double                              f_speed = 1.0;
+    std::size_t                         f_window = 1;
+    bool                                f_json = false;
+    communicatord::capture_reader       f_reader = communicatord::capture_reader();
+    communicatord::capture_record       f_next = communicatord::capture_record();
+    bool                                f_has_next = false;
+    std::int64_t                        f_first_timestamp = 0;          // in microseconds
+    state_t                             f_state = state_t::STATE_LOADING;
+    benchmark_timer::pointer_t          f_timer = benchmark_timer::pointer_t();
+    std::int64_t                        f_start = 0;
+    std::int64_t                        f_elapsed = 0;
+    bool                                f_failed = false;
+    std::map<std::int64_t, std::size_t> f_sources = std::map<std::int64_t, std::size_t>();   // connection in the capture to index in f_clients
+    std::map<std::string, std::size_t>  f_routes = std::map<std::string, std::size_t>();
+    std::size_t                         f_records = 0;
+    std::size_t                         f_sent = 0;
+    std::size_t                         f_skipped = 0;
+    std::size_t                         f_invalid = 0;
+    std::size_t                         f_received = 0;
+    std::size_t                         f_lost = 0;
+};
+
+
+
+
+class message
+{
+public:
+    message(int argc, char * argv[])
+        : f_opts(g_command_line_options_environment)
+    {
+        snaplogger::add_logger_options(f_opts);
+        f_opts.finish_parsing(argc, argv);
+        if(!snaplogger::process_logger_options(
+                              f_opts
+                            , "/etc/communicatord/logger"
+                            , std::cout
+                            , false))
+        {
+            // exit on any error
+            throw advgetopt::getopt_exit("logger options generated an error.", 1);
+        }
+
+        f_gui = f_opts.is_defined("gui");
+        f_benchmark = f_opts.is_defined("benchmark");
+        f_echo = f_opts.is_defined("echo");
+        f_replay = f_opts.is_defined("replay");
+
+        f_cui = f_opts.is_defined("cui")
+            || (!f_opts.is_defined("message") && !f_gui && !f_benchmark && !f_echo && !f_replay);
+
+        if((f_gui ? 1 : 0) + (f_cui ? 1 : 0) + (f_benchmark ? 1 : 0) + (f_echo ? 1 : 0) + (f_replay ? 1 : 0) > 1)
+        {
+            std::cerr << "error: --gui, --cui, --benchmark, --echo, and --replay are mutually exclusive." << std::endl;
+            exit(1);
+            snapdev::NOT_REACHED();
+        }
+
+        if(f_cui
+        || f_gui
+        || f_benchmark
+        || f_echo
+        || f_replay)
+        {
+            if(f_opts.is_defined("message"))
+            {
+                std::cerr << "error: --message is not compatible with --cui, --gui, --benchmark, --echo, or --replay." << std::endl;
+                exit(1);
+                snapdev::NOT_REACHED();
+            }
+        }
+        else
+        {
+            if(!f_opts.is_defined("address"))
+            {
+                std::cerr << "error: --address is mandatory when not entering the CUI or GUI interface." << std::endl;
+                exit(1);
+                snapdev::NOT_REACHED();
+            }
+        }
+
+        f_connection = std::make_shared<network_connection>();
+
+        if(f_opts.is_defined("address"))
+        {
+            f_connection->set_address(f_opts.get_string("address"));
+        }
+    }
+
+    int run()
+    {
+        if(f_gui)
+        {
+            return start_gui();
+        }
+
+        if(f_cui)
+        {
+            return enter_cui();
+        }
+
+        if(f_benchmark
+        || f_echo
+        || f_replay)
+        {
+            if(!f_opts.is_defined("address"))
+            {
+                std::cerr << "error: --address is mandatory with --benchmark, --echo, and --replay." << std::endl;
+                return 1;
+            }
+            if(f_benchmark)
+            {
+                return benchmark(f_opts, f_connection).run();
+            }
+            if(f_replay)
+            {
+                return benchmark_replay(f_opts, f_connection).run();
+            }
+            return benchmark_echo(f_opts, f_connection).run();
         }
 
         if(f_opts.is_defined("message"))
@@ -1312,6 +2592,9 @@ private:
     advgetopt::getopt                       f_opts;
     bool                                    f_gui = false;
     bool                                    f_cui = false;
+    bool                                    f_benchmark = false;
+    bool                                    f_echo = false;
+    bool                                    f_replay = false;
     network_connection::pointer_t           f_connection = network_connection::pointer_t();
     //connection_handler::pointer_t           f_connection_handler;
 };